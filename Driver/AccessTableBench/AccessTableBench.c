@@ -0,0 +1,800 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    AccessTableBench.c
+
+Abstract:
+
+    Stress test and benchmark for the access aggregation table implemented by the
+    'LcRecordFileAccess' and 'LcDrainAccessTable' in the 'LazyCopyDriver\AccessTable.c'.
+
+    The table is reproduced with the ERESOURCE replaced by a read-write lock, and the
+    interlocked operations replaced by the GCC atomic builtins. Recorder threads report
+    accesses to a set of paths, where a few hot paths get most of them, while the drainer
+    thread drains the table into a small buffer at the interval given, the way the client does.
+
+    Every recorder counts its own accesses per path. At the end, the table is drained once more,
+    and the counts drained for every path, plus the accesses reported as dropped, should
+    add up to the accesses recorded. The drained timestamps should also be ordered.
+    The run is repeated with more paths than the table can hold, so the dropped accesses
+    are accounted for as well.
+
+    Build and run:
+
+        gcc -O2 -pthread -o AccessTableBench AccessTableBench.c
+        ./AccessTableBench [threads] [seconds] [drain interval, ms]
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//------------------------------------------------------------------------
+//  Definitions.
+//------------------------------------------------------------------------
+
+// Should match the ones in the 'AccessTable.c'.
+#define ACCESS_TABLE_BUCKETS      256
+#define ACCESS_TABLE_MAX_ENTRIES  8192
+
+// Size of the buffer the drainer thread uses.
+#define DRAIN_BUFFER_SIZE         (64 * 1024)
+
+#define MAX_PATH_LENGTH           96
+
+#define ALIGN_UP_BY(Length, Alignment) (((Length) + (Alignment) - 1) & ~((size_t)(Alignment) - 1))
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+typedef uint16_t WCHAR;
+
+typedef struct _LIST_ENTRY
+{
+    struct _LIST_ENTRY* Flink;
+    struct _LIST_ENTRY* Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+#define CONTAINING_RECORD(Address, Type, Field) ((Type*)((char*)(Address) - offsetof(Type, Field)))
+
+typedef struct _ACCESS_TABLE_ENTRY
+{
+    uint32_t      Hash;
+    WCHAR*        Path;
+    uint16_t      PathLength;
+    volatile long long AccessCount;
+    long long     FirstAccessTime;
+    volatile long long LastAccessTime;
+    LIST_ENTRY    BucketListEntry;
+    LIST_ENTRY    ListEntry;
+} ACCESS_TABLE_ENTRY, *PACCESS_TABLE_ENTRY;
+
+// Should match the ones in the 'CommunicationData.h'.
+typedef struct _FILE_ACCESS_RECORD
+{
+    long long AccessCount;
+    long long FirstAccessTime;
+    long long LastAccessTime;
+    uint32_t  PathLength;
+    WCHAR     Path[];
+} FILE_ACCESS_RECORD, *PFILE_ACCESS_RECORD;
+
+typedef struct _FILE_ACCESSES
+{
+    uint32_t  RecordCount;
+    uint32_t  RemainingCount;
+    long long DroppedCount;
+    uint8_t   Data[];
+} FILE_ACCESSES, *PFILE_ACCESSES;
+
+typedef struct _THREAD_STATE
+{
+    pthread_t     Thread;
+    unsigned int  Seed;
+    unsigned long Operations;
+    long long*    Recorded;
+} THREAD_STATE, *PTHREAD_STATE;
+
+//------------------------------------------------------------------------
+//  Global variables.
+//------------------------------------------------------------------------
+
+static pthread_rwlock_t   AccessTableResource = PTHREAD_RWLOCK_INITIALIZER;
+static LIST_ENTRY         AccessTableBuckets[ACCESS_TABLE_BUCKETS];
+static LIST_ENTRY         AccessTableList;
+static uint32_t           AccessTableSize     = 0;
+static volatile long long AccessTableDropped  = 0;
+
+static WCHAR              (*Paths)[MAX_PATH_LENGTH];
+static uint16_t*          PathLengths         = NULL;
+static uint32_t           PathCount           = 0;
+
+// Counts drained per path.
+static long long*         Drained             = NULL;
+static long long          DrainedDropped      = 0;
+static unsigned long      DrainCount          = 0;
+
+static volatile int       StopRequested       = 0;
+static int                Failures            = 0;
+
+//------------------------------------------------------------------------
+//  List functions.
+//------------------------------------------------------------------------
+
+static void InitializeListHead(PLIST_ENTRY Head)            { Head->Flink = Head->Blink = Head; }
+static int  IsListEmpty(PLIST_ENTRY Head)                   { return Head->Flink == Head; }
+
+static
+void
+RemoveEntryList(
+    PLIST_ENTRY Entry
+    )
+{
+    Entry->Blink->Flink = Entry->Flink;
+    Entry->Flink->Blink = Entry->Blink;
+}
+
+static
+void
+InsertTailList(
+    PLIST_ENTRY Head,
+    PLIST_ENTRY Entry
+    )
+{
+    Entry->Flink       = Head;
+    Entry->Blink       = Head->Blink;
+    Head->Blink->Flink = Entry;
+    Head->Blink        = Entry;
+}
+
+static
+void
+InsertHeadList(
+    PLIST_ENTRY Head,
+    PLIST_ENTRY Entry
+    )
+{
+    Entry->Flink       = Head->Flink;
+    Entry->Blink       = Head;
+    Head->Flink->Blink = Entry;
+    Head->Flink        = Entry;
+}
+
+//------------------------------------------------------------------------
+//  Helper functions.
+//------------------------------------------------------------------------
+
+static
+WCHAR
+LcUpcase(
+    WCHAR Character
+    )
+{
+    return Character >= 'a' && Character <= 'z' ? (WCHAR)(Character - ('a' - 'A')) : Character;
+}
+
+//------------------------------------------------------------------------
+
+static
+uint32_t
+LcHashPath(
+    const WCHAR* Path,
+    uint16_t     Length
+    )
+/*++
+
+Summary:
+
+    This function replaces the 'RtlHashUnicodeString' with the 'HASH_STRING_ALGORITHM_X65599'.
+
+--*/
+{
+    uint32_t hash = 0;
+    uint16_t idx  = 0;
+
+    for (idx = 0; idx < Length; idx++)
+    {
+        hash = hash * 65599 + LcUpcase(Path[idx]);
+    }
+
+    return hash;
+}
+
+//------------------------------------------------------------------------
+
+static
+int
+LcEqualPaths(
+    const WCHAR* First,
+    uint16_t     FirstLength,
+    const WCHAR* Second,
+    uint16_t     SecondLength
+    )
+{
+    uint16_t idx = 0;
+
+    if (FirstLength != SecondLength)
+    {
+        return 0;
+    }
+
+    for (idx = 0; idx < FirstLength; idx++)
+    {
+        if (LcUpcase(First[idx]) != LcUpcase(Second[idx]))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------
+
+static
+long long
+LcNow(
+    void
+    )
+{
+    struct timespec now = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+//------------------------------------------------------------------------
+//  Access table functions.
+//------------------------------------------------------------------------
+
+static
+PACCESS_TABLE_ENTRY
+LcFindAccessTableEntry(
+    const WCHAR* Path,
+    uint16_t     Length,
+    uint32_t     Hash
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcFindAccessTableEntry'.
+
+--*/
+{
+    PLIST_ENTRY         bucket    = &AccessTableBuckets[Hash & (ACCESS_TABLE_BUCKETS - 1)];
+    PLIST_ENTRY         listEntry = bucket->Flink;
+    PACCESS_TABLE_ENTRY entry     = NULL;
+
+    while (listEntry != bucket)
+    {
+        entry = CONTAINING_RECORD(listEntry, ACCESS_TABLE_ENTRY, BucketListEntry);
+        if (entry->Hash == Hash && LcEqualPaths(Path, Length, entry->Path, entry->PathLength))
+        {
+            return entry;
+        }
+
+        listEntry = listEntry->Flink;
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcUpdateAccessTableEntry(
+    PACCESS_TABLE_ENTRY Entry,
+    long long           AccessTime
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcUpdateAccessTableEntry'.
+
+--*/
+{
+    long long lastAccessTime = 0;
+
+    __atomic_add_fetch(&Entry->AccessCount, 1, __ATOMIC_SEQ_CST);
+
+    do
+    {
+        lastAccessTime = __atomic_load_n(&Entry->LastAccessTime, __ATOMIC_RELAXED);
+        if (lastAccessTime >= AccessTime)
+        {
+            break;
+        }
+    }
+    while (!__atomic_compare_exchange_n(&Entry->LastAccessTime, &lastAccessTime, AccessTime, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcRecordFileAccess(
+    const WCHAR* Path,
+    uint16_t     Length
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcRecordFileAccess'. 'Length' is in characters.
+
+--*/
+{
+    uint32_t            hash       = LcHashPath(Path, Length);
+    long long           accessTime = LcNow();
+    PACCESS_TABLE_ENTRY entry      = NULL;
+
+    pthread_rwlock_rdlock(&AccessTableResource);
+
+    entry = LcFindAccessTableEntry(Path, Length, hash);
+    if (entry != NULL)
+    {
+        LcUpdateAccessTableEntry(entry, accessTime);
+    }
+
+    pthread_rwlock_unlock(&AccessTableResource);
+
+    if (entry != NULL)
+    {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&AccessTableResource);
+
+    entry = LcFindAccessTableEntry(Path, Length, hash);
+    if (entry != NULL)
+    {
+        LcUpdateAccessTableEntry(entry, accessTime);
+    }
+    else if (AccessTableSize >= ACCESS_TABLE_MAX_ENTRIES)
+    {
+        __atomic_add_fetch(&AccessTableDropped, 1, __ATOMIC_SEQ_CST);
+    }
+    else
+    {
+        entry = malloc(sizeof(ACCESS_TABLE_ENTRY) + Length * sizeof(WCHAR));
+
+        entry->Hash            = hash;
+        entry->Path            = (WCHAR*)(entry + 1);
+        entry->PathLength      = Length;
+        entry->AccessCount     = 1;
+        entry->FirstAccessTime = accessTime;
+        entry->LastAccessTime  = accessTime;
+
+        memcpy(entry->Path, Path, Length * sizeof(WCHAR));
+
+        InsertHeadList(&AccessTableBuckets[hash & (ACCESS_TABLE_BUCKETS - 1)], &entry->BucketListEntry);
+        InsertTailList(&AccessTableList, &entry->ListEntry);
+        AccessTableSize++;
+    }
+
+    pthread_rwlock_unlock(&AccessTableResource);
+}
+
+//------------------------------------------------------------------------
+
+static
+uint32_t
+LcDrainAccessTable(
+    void*    Buffer,
+    uint32_t BufferSize
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcDrainAccessTable'. Returns the amount of bytes written.
+
+--*/
+{
+    PFILE_ACCESSES      accesses       = (PFILE_ACCESSES)Buffer;
+    PFILE_ACCESS_RECORD record         = NULL;
+    PACCESS_TABLE_ENTRY entry          = NULL;
+    LIST_ENTRY          drainedList    = { 0 };
+    uint32_t            offset         = offsetof(FILE_ACCESSES, Data);
+    uint32_t            recordSize     = 0;
+    uint32_t            recordCount    = 0;
+    uint32_t            remainingCount = 0;
+    long long           droppedCount   = 0;
+
+    InitializeListHead(&drainedList);
+
+    pthread_rwlock_wrlock(&AccessTableResource);
+
+    while (!IsListEmpty(&AccessTableList))
+    {
+        entry      = CONTAINING_RECORD(AccessTableList.Flink, ACCESS_TABLE_ENTRY, ListEntry);
+        recordSize = (uint32_t)ALIGN_UP_BY(offsetof(FILE_ACCESS_RECORD, Path) + (entry->PathLength + 1) * sizeof(WCHAR), sizeof(long long));
+
+        if (recordSize > BufferSize - offset)
+        {
+            break;
+        }
+
+        RemoveEntryList(&entry->BucketListEntry);
+        RemoveEntryList(&entry->ListEntry);
+        AccessTableSize--;
+
+        InsertTailList(&drainedList, &entry->ListEntry);
+
+        offset += recordSize;
+        recordCount++;
+    }
+
+    remainingCount = AccessTableSize;
+    droppedCount   = __atomic_exchange_n(&AccessTableDropped, 0, __ATOMIC_SEQ_CST);
+
+    pthread_rwlock_unlock(&AccessTableResource);
+
+    offset = offsetof(FILE_ACCESSES, Data);
+
+    while (!IsListEmpty(&drainedList))
+    {
+        entry = CONTAINING_RECORD(drainedList.Flink, ACCESS_TABLE_ENTRY, ListEntry);
+        RemoveEntryList(&entry->ListEntry);
+
+        recordSize = (uint32_t)ALIGN_UP_BY(offsetof(FILE_ACCESS_RECORD, Path) + (entry->PathLength + 1) * sizeof(WCHAR), sizeof(long long));
+
+        record                  = (PFILE_ACCESS_RECORD)((uint8_t*)Buffer + offset);
+        record->AccessCount     = entry->AccessCount;
+        record->FirstAccessTime = entry->FirstAccessTime;
+        record->LastAccessTime  = entry->LastAccessTime;
+        record->PathLength      = entry->PathLength * sizeof(WCHAR);
+
+        memcpy(record->Path, entry->Path, entry->PathLength * sizeof(WCHAR));
+        record->Path[entry->PathLength] = 0;
+
+        offset += recordSize;
+        free(entry);
+    }
+
+    accesses->RecordCount    = recordCount;
+    accesses->RemainingCount = remainingCount;
+    accesses->DroppedCount   = droppedCount;
+
+    return offset;
+}
+
+//------------------------------------------------------------------------
+//  Client functions.
+//------------------------------------------------------------------------
+
+static
+void
+LcConsumeAccesses(
+    PFILE_ACCESSES Accesses
+    )
+/*++
+
+Summary:
+
+    This function adds the records drained to the per-path totals.
+    Paths end with the five-digit index, so the records are matched back to the path set.
+
+--*/
+{
+    PFILE_ACCESS_RECORD record = NULL;
+    uint32_t            offset = 0;
+    uint32_t            idx    = 0;
+    uint32_t            length = 0;
+    uint32_t            path   = 0;
+    uint32_t            digit  = 0;
+
+    DrainedDropped += Accesses->DroppedCount;
+    DrainCount++;
+
+    for (idx = 0; idx < Accesses->RecordCount; idx++)
+    {
+        record = (PFILE_ACCESS_RECORD)(Accesses->Data + offset);
+        length = record->PathLength / sizeof(WCHAR);
+        path   = 0;
+
+        for (digit = length - 5; digit < length; digit++)
+        {
+            path = path * 10 + (record->Path[digit] - '0');
+        }
+
+        if (path >= PathCount
+            || record->AccessCount <= 0
+            || record->FirstAccessTime > record->LastAccessTime
+            || record->Path[length] != 0)
+        {
+            fprintf(stderr, "FAILED: invalid record for path %u\n", path);
+            Failures++;
+        }
+        else
+        {
+            Drained[path] += record->AccessCount;
+        }
+
+        offset += (uint32_t)ALIGN_UP_BY(offsetof(FILE_ACCESS_RECORD, Path) + record->PathLength + sizeof(WCHAR), sizeof(long long));
+    }
+}
+
+//------------------------------------------------------------------------
+//  Threads.
+//------------------------------------------------------------------------
+
+static
+void*
+LcRecorderThread(
+    void* Context
+    )
+/*++
+
+Summary:
+
+    This function reports the accesses. A half of them goes to the first 16 paths.
+
+--*/
+{
+    PTHREAD_STATE state = (PTHREAD_STATE)Context;
+    uint32_t      path  = 0;
+
+    while (!__atomic_load_n(&StopRequested, __ATOMIC_RELAXED))
+    {
+        path = (uint32_t)rand_r(&state->Seed);
+        path = path % 2 == 0 ? (path >> 1) % 16 : (path >> 1) % PathCount;
+
+        LcRecordFileAccess(Paths[path], PathLengths[path]);
+
+        state->Recorded[path]++;
+        state->Operations++;
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+static
+void*
+LcDrainerThread(
+    void* Context
+    )
+/*++
+
+Summary:
+
+    This function drains the table at the interval given, in milliseconds.
+
+--*/
+{
+    long            interval = *(long*)Context;
+    struct timespec delay    = { interval / 1000, (interval % 1000) * 1000000L };
+    static uint64_t buffer[DRAIN_BUFFER_SIZE / sizeof(uint64_t)];
+    PFILE_ACCESSES  accesses = (PFILE_ACCESSES)buffer;
+
+    while (!__atomic_load_n(&StopRequested, __ATOMIC_RELAXED))
+    {
+        nanosleep(&delay, NULL);
+
+        // Drain until the table is empty, as the client does when the 'RemainingCount' is not zero.
+        do
+        {
+            LcDrainAccessTable(accesses, sizeof(buffer));
+            LcConsumeAccesses(accesses);
+        }
+        while (accesses->RemainingCount != 0);
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcRun(
+    uint32_t PathTotal,
+    int      ThreadCount,
+    double   Seconds,
+    long     Interval
+    )
+/*++
+
+Summary:
+
+    This function runs the recorders and the drainer, and checks that every access is accounted for.
+
+--*/
+{
+    PTHREAD_STATE   threads      = calloc((size_t)ThreadCount, sizeof(THREAD_STATE));
+    pthread_t       drainer      = { 0 };
+    struct timespec delay        = { (time_t)Seconds, (long)((Seconds - (time_t)Seconds) * 1e9) };
+    static uint64_t buffer[DRAIN_BUFFER_SIZE / sizeof(uint64_t)];
+    PFILE_ACCESSES  accesses     = (PFILE_ACCESSES)buffer;
+    long long       start        = 0;
+    long long       elapsed      = 0;
+    long long       recorded     = 0;
+    long long       drained      = 0;
+    unsigned long   operations   = 0;
+    uint32_t        mismatches   = 0;
+    uint32_t        idx          = 0;
+    int             threadIdx    = 0;
+    char            path[MAX_PATH_LENGTH];
+
+    PathCount   = PathTotal;
+    Paths       = calloc(PathCount, sizeof(*Paths));
+    PathLengths = calloc(PathCount, sizeof(uint16_t));
+    Drained     = calloc(PathCount, sizeof(long long));
+
+    DrainedDropped = 0;
+    DrainCount     = 0;
+
+    for (idx = 0; idx < PathCount; idx++)
+    {
+        int length = snprintf(path, sizeof(path), "\\Device\\HarddiskVolume2\\Src\\Module%03u\\File%05u", idx / 100, idx);
+        int charIdx = 0;
+
+        for (charIdx = 0; charIdx < length; charIdx++)
+        {
+            Paths[idx][charIdx] = (WCHAR)path[charIdx];
+        }
+
+        PathLengths[idx] = (uint16_t)length;
+    }
+
+    StopRequested = 0;
+    start         = LcNow();
+
+    for (threadIdx = 0; threadIdx < ThreadCount; threadIdx++)
+    {
+        threads[threadIdx].Seed     = (unsigned int)threadIdx + 1;
+        threads[threadIdx].Recorded = calloc(PathCount, sizeof(long long));
+        pthread_create(&threads[threadIdx].Thread, NULL, LcRecorderThread, &threads[threadIdx]);
+    }
+
+    pthread_create(&drainer, NULL, LcDrainerThread, &Interval);
+
+    nanosleep(&delay, NULL);
+    __atomic_store_n(&StopRequested, 1, __ATOMIC_RELAXED);
+
+    for (threadIdx = 0; threadIdx < ThreadCount; threadIdx++)
+    {
+        pthread_join(threads[threadIdx].Thread, NULL);
+    }
+
+    elapsed = LcNow() - start;
+
+    pthread_join(drainer, NULL);
+
+    do
+    {
+        LcDrainAccessTable(accesses, sizeof(buffer));
+        LcConsumeAccesses(accesses);
+    }
+    while (accesses->RemainingCount != 0);
+
+    for (idx = 0; idx < PathCount; idx++)
+    {
+        long long pathRecorded = 0;
+
+        for (threadIdx = 0; threadIdx < ThreadCount; threadIdx++)
+        {
+            pathRecorded += threads[threadIdx].Recorded[idx];
+        }
+
+        // Without drops, every path should be accounted for exactly.
+        if (DrainedDropped == 0 && pathRecorded != Drained[idx])
+        {
+            mismatches++;
+        }
+
+        recorded += pathRecorded;
+        drained  += Drained[idx];
+    }
+
+    for (threadIdx = 0; threadIdx < ThreadCount; threadIdx++)
+    {
+        operations += threads[threadIdx].Operations;
+        free(threads[threadIdx].Recorded);
+    }
+
+    if (mismatches != 0 || recorded != drained + DrainedDropped)
+    {
+        fprintf(stderr, "FAILED: %u paths: %lld accesses recorded, %lld drained, %lld dropped, %u paths mismatched\n",
+                PathCount, recorded, drained, DrainedDropped, mismatches);
+        Failures++;
+    }
+
+    printf("%6u paths, %2d threads: %7.2f M accesses/s, %lu drains, %lld drained, %lld dropped\n",
+           PathCount,
+           ThreadCount,
+           operations / (elapsed / 1e9) / 1e6,
+           DrainCount,
+           drained,
+           DrainedDropped);
+
+    free(Drained);
+    free(PathLengths);
+    free(Paths);
+    free(threads);
+}
+
+//------------------------------------------------------------------------
+
+int
+main(
+    int   argc,
+    char* argv[]
+    )
+{
+    int    threads  = argc > 1 ? atoi(argv[1]) : 4;
+    double seconds  = argc > 2 ? atof(argv[2]) : 1.0;
+    long   interval = argc > 3 ? atol(argv[3]) : 100;
+    int    count    = 0;
+    int    idx      = 0;
+
+    if (threads <= 0 || seconds <= 0 || interval <= 0)
+    {
+        fprintf(stderr, "Usage: %s [threads] [seconds] [drain interval, ms]\n", argv[0]);
+        return 2;
+    }
+
+    for (idx = 0; idx < ACCESS_TABLE_BUCKETS; idx++)
+    {
+        InitializeListHead(&AccessTableBuckets[idx]);
+    }
+
+    InitializeListHead(&AccessTableList);
+
+    for (count = 1; count <= threads; count *= 2)
+    {
+        LcRun(1000, count, seconds, interval);
+    }
+
+    // More paths than the table can hold, so some accesses are dropped between the drains.
+    LcRun(50000, threads, seconds, interval);
+
+    printf("%d failure(s)\n", Failures);
+
+    return Failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,835 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    DirectoryEntryWalker.c
+
+Abstract:
+
+    Unit test and benchmark for the table-driven directory entry walker implemented by the
+    'LcProcessDirectoryEntries' and the 'DirectoryEntryLayouts' in the 'LazyCopyDriver\Operations.c'.
+
+    The directory information structures are declared with the same field order, so the
+    natural alignment gives the same offsets as on Windows. The walker is reproduced with
+    the remote file size lookup replaced by a function that derives the size from the file name.
+
+    The test builds synthetic directory buffers for every information class and checks that:
+    - Only the LazyCopy files are updated, and their sizes are taken from the lookup;
+    - The allocation size is rounded up to the sector size;
+    - Directories, system files and files with other reparse tags are not changed;
+    - The walker doesn't read past the buffer end, if the entries are truncated or the
+      'NextEntryOffset' and 'FileNameLength' values are invalid. Buffers are placed right
+      before an inaccessible page, so such a read crashes the test.
+
+    The benchmark walks 64 KB buffers with one LazyCopy file in every eight entries,
+    restoring the buffer before every pass, so every LazyCopy entry is looked up.
+
+    Build and run:
+
+        gcc -O2 -o DirectoryEntryWalker DirectoryEntryWalker.c
+        ./DirectoryEntryWalker [seconds]
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------
+//  Definitions.
+//------------------------------------------------------------------------
+
+// Should match the ones in the 'Globals.h'.
+#define LC_REPARSE_TAG                0x00000340
+#define FILE_ATTRIBUTE_SYSTEM         0x00000004
+#define FILE_ATTRIBUTE_DIRECTORY      0x00000010
+#define FILE_ATTRIBUTE_ARCHIVE        0x00000020
+#define FILE_ATTRIBUTE_REPARSE_POINT  0x00000400
+#define FILE_ATTRIBUTE_OFFLINE        0x00001000
+#define LC_FILE_ATTRIBUTES            (FILE_ATTRIBUTE_OFFLINE | FILE_ATTRIBUTE_REPARSE_POINT)
+
+#define IO_REPARSE_TAG_SYMLINK        0xA000000C
+
+#define SECTOR_SIZE                   4096
+#define BENCHMARK_BUFFER_SIZE         (64 * 1024)
+
+#define FIELD_OFFSET(Type, Field) ((uint32_t)offsetof(Type, Field))
+#define ARRAYSIZE(Array)          (sizeof(Array) / sizeof((Array)[0]))
+
+#define LC_DIRECTORY_ENTRY_LAYOUT(InformationClass, Type, ReparseTagOffset) \
+    {                                                                       \
+        InformationClass,                                                   \
+        #Type,                                                              \
+        FIELD_OFFSET(Type, ChangeTime),                                     \
+        FIELD_OFFSET(Type, EndOfFile),                                      \
+        FIELD_OFFSET(Type, AllocationSize),                                 \
+        FIELD_OFFSET(Type, FileAttributes),                                 \
+        FIELD_OFFSET(Type, FileNameLength),                                 \
+        FIELD_OFFSET(Type, FileName),                                       \
+        ReparseTagOffset                                                    \
+    }
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+typedef uint16_t WCHAR;
+
+// Values of the 'FILE_INFORMATION_CLASS'.
+typedef enum _FILE_INFORMATION_CLASS
+{
+    FileDirectoryInformation           = 1,
+    FileFullDirectoryInformation       = 2,
+    FileBothDirectoryInformation       = 3,
+    FileIdBothDirectoryInformation     = 37,
+    FileIdFullDirectoryInformation     = 38,
+    FileIdGlobalTxDirectoryInformation = 50,
+    FileIdExtdDirectoryInformation     = 60,
+    FileIdExtdBothDirectoryInformation = 63
+} FILE_INFORMATION_CLASS;
+
+#define DIRECTORY_ENTRY_HEADER      \
+    uint32_t NextEntryOffset;       \
+    uint32_t FileIndex;             \
+    int64_t  CreationTime;          \
+    int64_t  LastAccessTime;        \
+    int64_t  LastWriteTime;         \
+    int64_t  ChangeTime;            \
+    int64_t  EndOfFile;             \
+    int64_t  AllocationSize;        \
+    uint32_t FileAttributes;        \
+    uint32_t FileNameLength;
+
+typedef struct _FILE_DIRECTORY_INFORMATION
+{
+    DIRECTORY_ENTRY_HEADER
+    WCHAR    FileName[1];
+} FILE_DIRECTORY_INFORMATION;
+
+typedef struct _FILE_FULL_DIR_INFORMATION
+{
+    DIRECTORY_ENTRY_HEADER
+    uint32_t EaSize;
+    WCHAR    FileName[1];
+} FILE_FULL_DIR_INFORMATION;
+
+typedef struct _FILE_BOTH_DIR_INFORMATION
+{
+    DIRECTORY_ENTRY_HEADER
+    uint32_t EaSize;
+    int8_t   ShortNameLength;
+    WCHAR    ShortName[12];
+    WCHAR    FileName[1];
+} FILE_BOTH_DIR_INFORMATION;
+
+typedef struct _FILE_ID_BOTH_DIR_INFORMATION
+{
+    DIRECTORY_ENTRY_HEADER
+    uint32_t EaSize;
+    int8_t   ShortNameLength;
+    WCHAR    ShortName[12];
+    int64_t  FileId;
+    WCHAR    FileName[1];
+} FILE_ID_BOTH_DIR_INFORMATION;
+
+typedef struct _FILE_ID_FULL_DIR_INFORMATION
+{
+    DIRECTORY_ENTRY_HEADER
+    uint32_t EaSize;
+    int64_t  FileId;
+    WCHAR    FileName[1];
+} FILE_ID_FULL_DIR_INFORMATION;
+
+typedef struct _FILE_ID_GLOBAL_TX_DIR_INFORMATION
+{
+    DIRECTORY_ENTRY_HEADER
+    int64_t  FileId;
+    uint8_t  LockingTransactionId[16];
+    uint32_t TxInfoFlags;
+    WCHAR    FileName[1];
+} FILE_ID_GLOBAL_TX_DIR_INFORMATION;
+
+typedef struct _FILE_ID_EXTD_DIR_INFORMATION
+{
+    DIRECTORY_ENTRY_HEADER
+    uint32_t EaSize;
+    uint32_t ReparsePointTag;
+    uint8_t  FileId[16];
+    WCHAR    FileName[1];
+} FILE_ID_EXTD_DIR_INFORMATION;
+
+typedef struct _FILE_ID_EXTD_BOTH_DIR_INFORMATION
+{
+    DIRECTORY_ENTRY_HEADER
+    uint32_t EaSize;
+    uint32_t ReparsePointTag;
+    uint8_t  FileId[16];
+    int8_t   ShortNameLength;
+    WCHAR    ShortName[12];
+    WCHAR    FileName[1];
+} FILE_ID_EXTD_BOTH_DIR_INFORMATION;
+
+// File name offsets documented for Windows.
+_Static_assert(offsetof(FILE_DIRECTORY_INFORMATION,        FileName) == 0x40, "FILE_DIRECTORY_INFORMATION layout");
+_Static_assert(offsetof(FILE_FULL_DIR_INFORMATION,         FileName) == 0x44, "FILE_FULL_DIR_INFORMATION layout");
+_Static_assert(offsetof(FILE_BOTH_DIR_INFORMATION,         FileName) == 0x5E, "FILE_BOTH_DIR_INFORMATION layout");
+_Static_assert(offsetof(FILE_ID_BOTH_DIR_INFORMATION,      FileName) == 0x68, "FILE_ID_BOTH_DIR_INFORMATION layout");
+_Static_assert(offsetof(FILE_ID_FULL_DIR_INFORMATION,      FileName) == 0x50, "FILE_ID_FULL_DIR_INFORMATION layout");
+_Static_assert(offsetof(FILE_ID_GLOBAL_TX_DIR_INFORMATION, FileName) == 0x5C, "FILE_ID_GLOBAL_TX_DIR_INFORMATION layout");
+_Static_assert(offsetof(FILE_ID_EXTD_DIR_INFORMATION,      FileName) == 0x58, "FILE_ID_EXTD_DIR_INFORMATION layout");
+_Static_assert(offsetof(FILE_ID_EXTD_BOTH_DIR_INFORMATION, FileName) == 0x72, "FILE_ID_EXTD_BOTH_DIR_INFORMATION layout");
+
+typedef struct _DIRECTORY_ENTRY_LAYOUT
+{
+    FILE_INFORMATION_CLASS InformationClass;
+    const char*            Name;
+
+    uint32_t               ChangeTimeOffset;
+    uint32_t               EndOfFileOffset;
+    uint32_t               AllocationSizeOffset;
+    uint32_t               FileAttributesOffset;
+    uint32_t               FileNameLengthOffset;
+    uint32_t               FileNameOffset;
+
+    uint32_t               ReparseTagOffset;
+} DIRECTORY_ENTRY_LAYOUT, *PDIRECTORY_ENTRY_LAYOUT;
+
+typedef const DIRECTORY_ENTRY_LAYOUT* PCDIRECTORY_ENTRY_LAYOUT;
+
+// Kind of the synthetic directory entry.
+typedef enum _ENTRY_KIND
+{
+    EntryOrdinary,
+    EntryPlaceholder,
+    EntryFetchedPlaceholder,
+    EntrySystemPlaceholder,
+    EntryDirectory,
+    EntryOtherReparsePoint,
+    EntryKindCount
+} ENTRY_KIND;
+
+//------------------------------------------------------------------------
+//  Global variables.
+//------------------------------------------------------------------------
+
+// Should match the 'DirectoryEntryLayouts' in the 'Operations.c'.
+static const DIRECTORY_ENTRY_LAYOUT DirectoryEntryLayouts[] =
+{
+    LC_DIRECTORY_ENTRY_LAYOUT(FileDirectoryInformation,           FILE_DIRECTORY_INFORMATION,        0),
+    LC_DIRECTORY_ENTRY_LAYOUT(FileFullDirectoryInformation,       FILE_FULL_DIR_INFORMATION,         FIELD_OFFSET(FILE_FULL_DIR_INFORMATION,         EaSize)),
+    LC_DIRECTORY_ENTRY_LAYOUT(FileBothDirectoryInformation,       FILE_BOTH_DIR_INFORMATION,         FIELD_OFFSET(FILE_BOTH_DIR_INFORMATION,         EaSize)),
+    LC_DIRECTORY_ENTRY_LAYOUT(FileIdBothDirectoryInformation,     FILE_ID_BOTH_DIR_INFORMATION,      FIELD_OFFSET(FILE_ID_BOTH_DIR_INFORMATION,      EaSize)),
+    LC_DIRECTORY_ENTRY_LAYOUT(FileIdFullDirectoryInformation,     FILE_ID_FULL_DIR_INFORMATION,      FIELD_OFFSET(FILE_ID_FULL_DIR_INFORMATION,      EaSize)),
+    LC_DIRECTORY_ENTRY_LAYOUT(FileIdGlobalTxDirectoryInformation, FILE_ID_GLOBAL_TX_DIR_INFORMATION, 0),
+    LC_DIRECTORY_ENTRY_LAYOUT(FileIdExtdDirectoryInformation,     FILE_ID_EXTD_DIR_INFORMATION,      FIELD_OFFSET(FILE_ID_EXTD_DIR_INFORMATION,      ReparsePointTag)),
+    LC_DIRECTORY_ENTRY_LAYOUT(FileIdExtdBothDirectoryInformation, FILE_ID_EXTD_BOTH_DIR_INFORMATION, FIELD_OFFSET(FILE_ID_EXTD_BOTH_DIR_INFORMATION, ReparsePointTag)),
+};
+
+// Amount of remote file size lookups and directory name queries made by the walker.
+static unsigned long RemoteSizeLookups    = 0;
+static unsigned long DirectoryNameQueries = 0;
+
+static int           Failures             = 0;
+
+//------------------------------------------------------------------------
+//  Walker functions.
+//------------------------------------------------------------------------
+
+static
+int64_t
+LcGetRemoteFileSize(
+    const WCHAR* FileName,
+    uint32_t     FileNameLength
+    )
+/*++
+
+Summary:
+
+    This function replaces the 'LcGetDirectoryEntryRemoteFileSize'.
+    The size is derived from the file name, so the test can check it.
+
+--*/
+{
+    int64_t  size = 1;
+    uint32_t idx  = 0;
+
+    RemoteSizeLookups++;
+
+    for (idx = 0; idx < FileNameLength / sizeof(WCHAR); idx++)
+    {
+        size = size * 31 + FileName[idx];
+    }
+
+    return (size & 0xFFFFFFF) + 1;
+}
+
+//------------------------------------------------------------------------
+
+static
+int
+LcProcessDirectoryEntries(
+    void*                    Buffer,
+    uint32_t                 BufferLength,
+    PCDIRECTORY_ENTRY_LAYOUT Layout,
+    uint32_t                 SectorSize
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcProcessDirectoryEntries'.
+
+--*/
+{
+    int       placeholderFound     = 0;
+    uint32_t  offset               = 0;
+    uint32_t  nextEntryOffset      = 0;
+    uint8_t*  entry                = NULL;
+    uint32_t* fileAttributes       = NULL;
+    int64_t*  endOfFile            = NULL;
+    uint32_t  fileNameLength       = 0;
+    int64_t   remoteFileSize       = 0;
+    int       directoryNameQueried = 0;
+
+    while (BufferLength >= Layout->FileNameOffset && offset <= BufferLength - Layout->FileNameOffset)
+    {
+        entry           = (uint8_t*)Buffer + offset;
+        nextEntryOffset = *(uint32_t*)entry;
+        fileAttributes  = (uint32_t*)(entry + Layout->FileAttributesOffset);
+
+        if (!(*fileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            && (*fileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+            && (Layout->ReparseTagOffset == 0 || *(uint32_t*)(entry + Layout->ReparseTagOffset) == LC_REPARSE_TAG))
+        {
+            placeholderFound = 1;
+        }
+
+        if (!(*fileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            && !(*fileAttributes & FILE_ATTRIBUTE_SYSTEM)
+            && (*fileAttributes & LC_FILE_ATTRIBUTES) == LC_FILE_ATTRIBUTES
+            && (Layout->ReparseTagOffset == 0 || *(uint32_t*)(entry + Layout->ReparseTagOffset) == LC_REPARSE_TAG))
+        {
+            *fileAttributes &= ~FILE_ATTRIBUTE_OFFLINE;
+
+            endOfFile      = (int64_t*)(entry + Layout->EndOfFileOffset);
+            fileNameLength = *(uint32_t*)(entry + Layout->FileNameLengthOffset);
+
+            if (*endOfFile == 0
+                && fileNameLength > 0
+                && fileNameLength <= UINT16_MAX
+                && fileNameLength <= BufferLength - offset - Layout->FileNameOffset)
+            {
+                if (!directoryNameQueried)
+                {
+                    directoryNameQueried = 1;
+                    DirectoryNameQueries++;
+                }
+
+                remoteFileSize = LcGetRemoteFileSize((const WCHAR*)(entry + Layout->FileNameOffset), fileNameLength);
+                *endOfFile     = remoteFileSize;
+
+                *(int64_t*)(entry + Layout->AllocationSizeOffset) = SectorSize != 0
+                    ? (remoteFileSize + SectorSize - 1) / SectorSize * SectorSize
+                    : remoteFileSize;
+            }
+        }
+
+        if (nextEntryOffset == 0 || nextEntryOffset > BufferLength - offset)
+        {
+            break;
+        }
+
+        offset += nextEntryOffset;
+    }
+
+    return placeholderFound;
+}
+
+//------------------------------------------------------------------------
+//  Buffer functions.
+//------------------------------------------------------------------------
+
+static
+uint32_t
+LcAppendEntry(
+    uint8_t*                 Buffer,
+    uint32_t                 BufferSize,
+    uint32_t                 Offset,
+    PCDIRECTORY_ENTRY_LAYOUT Layout,
+    ENTRY_KIND               Kind,
+    int                      Index
+    )
+/*++
+
+Summary:
+
+    This function appends a synthetic entry of the 'Kind' given to the 'Buffer'
+    and links the previous entry to it.
+
+    Returns the size of the entry appended, or zero, if it doesn't fit.
+
+--*/
+{
+    char      name[32]   = { 0 };
+    int       nameLength = snprintf(name, sizeof(name), "File%06d.bin", Index);
+    uint32_t  size       = (Layout->FileNameOffset + (uint32_t)nameLength * sizeof(WCHAR) + 7) & ~7u;
+    uint8_t*  entry      = Buffer + Offset;
+    uint32_t  attributes = FILE_ATTRIBUTE_ARCHIVE;
+    uint32_t  tag        = 0;
+    int       idx        = 0;
+
+    if (Offset + size > BufferSize)
+    {
+        return 0;
+    }
+
+    memset(entry, 0, size);
+
+    switch (Kind)
+    {
+        case EntryOrdinary:
+            break;
+
+        case EntryPlaceholder:
+        case EntryFetchedPlaceholder:
+            attributes |= LC_FILE_ATTRIBUTES;
+            tag         = LC_REPARSE_TAG;
+            break;
+
+        case EntrySystemPlaceholder:
+            attributes |= LC_FILE_ATTRIBUTES | FILE_ATTRIBUTE_SYSTEM;
+            tag         = LC_REPARSE_TAG;
+            break;
+
+        case EntryDirectory:
+            attributes  = FILE_ATTRIBUTE_DIRECTORY | LC_FILE_ATTRIBUTES;
+            tag         = LC_REPARSE_TAG;
+            break;
+
+        case EntryOtherReparsePoint:
+            attributes |= LC_FILE_ATTRIBUTES;
+            tag         = IO_REPARSE_TAG_SYMLINK;
+            break;
+
+        default:
+            break;
+    }
+
+    *(uint32_t*)(entry + Layout->FileAttributesOffset) = attributes;
+    *(uint32_t*)(entry + Layout->FileNameLengthOffset) = (uint32_t)nameLength * sizeof(WCHAR);
+    *(int64_t*)(entry + Layout->ChangeTimeOffset)      = 130000000000000000LL + Index;
+
+    if (Kind == EntryFetchedPlaceholder || Kind == EntryOrdinary)
+    {
+        *(int64_t*)(entry + Layout->EndOfFileOffset)      = 1000 + Index;
+        *(int64_t*)(entry + Layout->AllocationSizeOffset) = SECTOR_SIZE;
+    }
+
+    if (Layout->ReparseTagOffset != 0)
+    {
+        *(uint32_t*)(entry + Layout->ReparseTagOffset) = tag;
+    }
+
+    for (idx = 0; idx < nameLength; idx++)
+    {
+        ((WCHAR*)(entry + Layout->FileNameOffset))[idx] = (WCHAR)name[idx];
+    }
+
+    return size;
+}
+
+//------------------------------------------------------------------------
+
+static
+uint32_t
+LcBuildBuffer(
+    uint8_t*                 Buffer,
+    uint32_t                 BufferSize,
+    PCDIRECTORY_ENTRY_LAYOUT Layout,
+    const ENTRY_KIND*        Kinds,
+    int                      KindCount,
+    uint32_t*                EntryOffsets,
+    unsigned long*           EntryCount
+    )
+/*++
+
+Summary:
+
+    This function fills the 'Buffer' with the entries of the 'Kinds' given, repeating them,
+    until the buffer is full, if the 'KindCount' is negative.
+
+    Returns the amount of bytes used.
+
+--*/
+{
+    uint32_t offset     = 0;
+    uint32_t lastOffset = 0;
+    uint32_t size       = 0;
+    int      count      = KindCount < 0 ? -KindCount : KindCount;
+    int      idx        = 0;
+
+    for (idx = 0; KindCount < 0 || idx < count; idx++)
+    {
+        size = LcAppendEntry(Buffer, BufferSize, offset, Layout, Kinds[idx % count], idx);
+        if (size == 0)
+        {
+            break;
+        }
+
+        if (idx > 0)
+        {
+            *(uint32_t*)(Buffer + lastOffset) = offset - lastOffset;
+        }
+
+        if (EntryOffsets != NULL)
+        {
+            EntryOffsets[idx] = offset;
+        }
+
+        lastOffset = offset;
+        offset    += size;
+    }
+
+    if (EntryCount != NULL)
+    {
+        *EntryCount = (unsigned long)idx;
+    }
+
+    // The last entry is only as long as its name.
+    return lastOffset + Layout->FileNameOffset + *(uint32_t*)(Buffer + lastOffset + Layout->FileNameLengthOffset);
+}
+
+//------------------------------------------------------------------------
+
+static
+uint8_t*
+LcAllocateGuardedBuffer(
+    uint32_t Size
+    )
+/*++
+
+Summary:
+
+    This function allocates a buffer that ends right before an inaccessible page.
+
+--*/
+{
+    long     pageSize  = sysconf(_SC_PAGESIZE);
+    size_t   pages     = (Size + (size_t)pageSize - 1) / (size_t)pageSize;
+    uint8_t* mapping   = mmap(NULL, (pages + 1) * (size_t)pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (mapping == MAP_FAILED)
+    {
+        abort();
+    }
+
+    mprotect(mapping + pages * (size_t)pageSize, (size_t)pageSize, PROT_NONE);
+
+    return mapping + pages * (size_t)pageSize - Size;
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcFreeGuardedBuffer(
+    uint8_t* Buffer,
+    uint32_t Size
+    )
+/*++
+
+Summary:
+
+    This function frees the buffer allocated by the 'LcAllocateGuardedBuffer'.
+
+--*/
+{
+    long   pageSize = sysconf(_SC_PAGESIZE);
+    size_t pages    = (Size + (size_t)pageSize - 1) / (size_t)pageSize;
+
+    munmap(Buffer + Size - pages * (size_t)pageSize, (pages + 1) * (size_t)pageSize);
+}
+
+//------------------------------------------------------------------------
+//  Tests.
+//------------------------------------------------------------------------
+
+#define CHECK(Condition, Layout, Message)                                                   \
+    if (!(Condition))                                                                       \
+    {                                                                                       \
+        fprintf(stderr, "FAILED: %s: %s (line %d)\n", (Layout)->Name, Message, __LINE__);   \
+        Failures++;                                                                         \
+    }
+
+static
+void
+LcTestLayout(
+    PCDIRECTORY_ENTRY_LAYOUT Layout
+    )
+/*++
+
+Summary:
+
+    This function checks that every kind of entry is processed as expected.
+
+--*/
+{
+    static const ENTRY_KIND kinds[] =
+    {
+        EntryOrdinary,
+        EntryPlaceholder,
+        EntryFetchedPlaceholder,
+        EntrySystemPlaceholder,
+        EntryDirectory,
+        EntryOtherReparsePoint,
+        EntryPlaceholder
+    };
+
+    uint8_t   buffer[4096]                  = { 0 };
+    uint8_t   original[4096]                = { 0 };
+    uint32_t  offsets[ARRAYSIZE(kinds)]     = { 0 };
+    uint32_t  length                        = 0;
+    uint8_t*  entry                         = NULL;
+    uint32_t  attributes                    = 0;
+    int64_t   endOfFile                     = 0;
+    int64_t   expectedSize                  = 0;
+    size_t    idx                           = 0;
+
+    length = LcBuildBuffer(buffer, sizeof(buffer), Layout, kinds, (int)ARRAYSIZE(kinds), offsets, NULL);
+    memcpy(original, buffer, sizeof(buffer));
+
+    RemoteSizeLookups    = 0;
+    DirectoryNameQueries = 0;
+
+    CHECK(LcProcessDirectoryEntries(buffer, length, Layout, SECTOR_SIZE), Layout, "placeholder not reported");
+    CHECK(DirectoryNameQueries == 1, Layout, "directory name should be queried once");
+
+    for (idx = 0; idx < ARRAYSIZE(kinds); idx++)
+    {
+        entry      = buffer + offsets[idx];
+        attributes = *(uint32_t*)(entry + Layout->FileAttributesOffset);
+        endOfFile  = *(int64_t*)(entry + Layout->EndOfFileOffset);
+
+        switch (kinds[idx])
+        {
+            case EntryPlaceholder:
+                expectedSize = LcGetRemoteFileSize((const WCHAR*)(entry + Layout->FileNameOffset), *(uint32_t*)(entry + Layout->FileNameLengthOffset));
+                RemoteSizeLookups--;
+
+                CHECK(!(attributes & FILE_ATTRIBUTE_OFFLINE), Layout, "offline attribute not cleared");
+                CHECK(endOfFile == expectedSize, Layout, "remote size not reported");
+                CHECK(*(int64_t*)(entry + Layout->AllocationSizeOffset) == (expectedSize + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE, Layout, "allocation size not rounded");
+                break;
+
+            case EntryFetchedPlaceholder:
+                CHECK(!(attributes & FILE_ATTRIBUTE_OFFLINE), Layout, "offline attribute not cleared");
+                CHECK(endOfFile == 1000 + (int64_t)idx, Layout, "local size replaced");
+                break;
+
+            case EntryOtherReparsePoint:
+                // Information classes without the reparse tag can't tell the LazyCopy files from the other ones.
+                if (Layout->ReparseTagOffset == 0)
+                {
+                    break;
+                }
+
+                CHECK(memcmp(entry, original + offsets[idx], Layout->FileNameOffset) == 0, Layout, "other reparse point changed");
+                break;
+
+            default:
+                CHECK(memcmp(entry, original + offsets[idx], Layout->FileNameOffset) == 0, Layout, "entry changed");
+                break;
+        }
+    }
+
+    CHECK(RemoteSizeLookups == (Layout->ReparseTagOffset == 0 ? 3u : 2u), Layout, "unexpected amount of remote size lookups");
+
+    // Ordinary entries only.
+    length = LcBuildBuffer(buffer, sizeof(buffer), Layout, kinds, 1, NULL, NULL);
+    DirectoryNameQueries = 0;
+
+    CHECK(!LcProcessDirectoryEntries(buffer, length, Layout, SECTOR_SIZE), Layout, "ordinary file reported as placeholder");
+    CHECK(DirectoryNameQueries == 0, Layout, "directory name queried without placeholders");
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcTestMalformedBuffers(
+    PCDIRECTORY_ENTRY_LAYOUT Layout
+    )
+/*++
+
+Summary:
+
+    This function checks that the walker stays within the buffer, if the entries are invalid.
+    Every buffer ends right before an inaccessible page.
+
+--*/
+{
+    static const ENTRY_KIND kinds[] = { EntryPlaceholder, EntryPlaceholder, EntryPlaceholder };
+
+    uint8_t  source[1024] = { 0 };
+    uint32_t offsets[3]   = { 0 };
+    uint32_t length       = LcBuildBuffer(source, sizeof(source), Layout, kinds, 3, offsets, NULL);
+    uint32_t truncated    = 0;
+    uint8_t* buffer       = NULL;
+
+    // Truncated at every possible length.
+    for (truncated = 0; truncated <= length; truncated++)
+    {
+        buffer = LcAllocateGuardedBuffer(truncated);
+        memcpy(buffer, source, truncated);
+
+        LcProcessDirectoryEntries(buffer, truncated, Layout, SECTOR_SIZE);
+        LcFreeGuardedBuffer(buffer, truncated);
+    }
+
+    // Next entry offset points past the buffer end.
+    buffer = LcAllocateGuardedBuffer(length);
+    memcpy(buffer, source, length);
+    *(uint32_t*)(buffer + offsets[1]) = length;
+
+    RemoteSizeLookups = 0;
+    LcProcessDirectoryEntries(buffer, length, Layout, SECTOR_SIZE);
+    CHECK(RemoteSizeLookups == 2, Layout, "entries before the invalid offset not processed");
+
+    // File name length points past the buffer end.
+    memcpy(buffer, source, length);
+    *(uint32_t*)(buffer + offsets[2] + Layout->FileNameLengthOffset) = 0xFFFF;
+
+    RemoteSizeLookups = 0;
+    LcProcessDirectoryEntries(buffer, length, Layout, SECTOR_SIZE);
+    CHECK(RemoteSizeLookups == 2, Layout, "entry with invalid name length looked up");
+
+    LcFreeGuardedBuffer(buffer, length);
+}
+
+//------------------------------------------------------------------------
+//  Benchmark.
+//------------------------------------------------------------------------
+
+static
+void
+LcBenchmarkLayout(
+    PCDIRECTORY_ENTRY_LAYOUT Layout,
+    double                   Seconds
+    )
+/*++
+
+Summary:
+
+    This function measures how fast the walker processes the entries of the layout given.
+
+--*/
+{
+    static const ENTRY_KIND kinds[] =
+    {
+        EntryPlaceholder, EntryOrdinary, EntryOrdinary, EntryOrdinary,
+        EntryOrdinary,    EntryOrdinary, EntryOrdinary, EntryDirectory
+    };
+
+    static uint8_t  source[BENCHMARK_BUFFER_SIZE];
+    static uint8_t  buffer[BENCHMARK_BUFFER_SIZE];
+
+    uint32_t        length    = 0;
+    unsigned long   entries   = 0;
+    unsigned long   passes    = 0;
+    unsigned long   perPass   = 0;
+    double          elapsed   = 0;
+    struct timespec start     = { 0 };
+    struct timespec now       = { 0 };
+
+    length = LcBuildBuffer(source, sizeof(source), Layout, kinds, -(int)ARRAYSIZE(kinds), NULL, &perPass);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    do
+    {
+        memcpy(buffer, source, length);
+        LcProcessDirectoryEntries(buffer, length, Layout, SECTOR_SIZE);
+
+        passes++;
+        entries += perPass;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (double)(now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+    } while (elapsed < Seconds);
+
+    printf("%-36s %6lu entries per buffer, %8.1f M entries/s, %7.1f ns per entry\n",
+           Layout->Name,
+           perPass,
+           entries / elapsed / 1e6,
+           elapsed * 1e9 / entries);
+}
+
+//------------------------------------------------------------------------
+
+int
+main(
+    int   argc,
+    char* argv[]
+    )
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    size_t idx     = 0;
+
+    if (seconds <= 0)
+    {
+        fprintf(stderr, "Usage: %s [seconds]\n", argv[0]);
+        return 2;
+    }
+
+    for (idx = 0; idx < ARRAYSIZE(DirectoryEntryLayouts); idx++)
+    {
+        LcTestLayout(&DirectoryEntryLayouts[idx]);
+        LcTestMalformedBuffers(&DirectoryEntryLayouts[idx]);
+    }
+
+    printf("Tests: %d failure(s)\n", Failures);
+
+    for (idx = 0; idx < ARRAYSIZE(DirectoryEntryLayouts); idx++)
+    {
+        LcBenchmarkLayout(&DirectoryEntryLayouts[idx], seconds / ARRAYSIZE(DirectoryEntryLayouts));
+    }
+
+    return Failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+﻿// --------------------------------------------------------------------------------------------------------------------
+// <copyright file="ConnectionSettings.cs">
+//   The MIT License (MIT)
+//   Copyright (c) 2015 Aleksey Kabanov
+// </copyright>
+// <summary>
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to deal
+//   in the Software without restriction, including without limitation the rights
+//   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//   copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be included in
+//   all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//   THE SOFTWARE.
+// </summary>
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace LazyCopy.DriverClientLibrary
+{
+    using System;
+
+    /// <summary>
+    /// Contains the settings of a single connection to the driver's communication port.
+    /// </summary>
+    public sealed class ConnectionSettings
+    {
+        #region Fields
+
+        /// <summary>
+        /// The default amount of message requests kept pending per notification thread.
+        /// </summary>
+        private const int DefaultReceivesPerThread = 2;
+
+        /// <summary>
+        /// Context passed to the driver, when the connection is established.
+        /// </summary>
+        private readonly byte[] context;
+
+        #endregion // Fields
+
+        #region Constructors
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="ConnectionSettings"/> class.
+        /// </summary>
+        /// <param name="threadCount">Amount of background threads processing the notifications received via this connection.</param>
+        /// <param name="context">Context passed to the driver, when the connection is established. May be <see langword="null"/>.</param>
+        /// <exception cref="ArgumentOutOfRangeException">
+        /// <paramref name="threadCount"/> is lesser than zero.
+        ///     <para>-or-</para>
+        /// <paramref name="context"/> is longer than <see cref="short.MaxValue"/> bytes.
+        /// </exception>
+        public ConnectionSettings(int threadCount, byte[] context)
+            : this(threadCount, threadCount * ConnectionSettings.DefaultReceivesPerThread, context)
+        {
+            // Do nothing.
+        }
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="ConnectionSettings"/> class.
+        /// </summary>
+        /// <param name="threadCount">Amount of background threads processing the notifications received via this connection.</param>
+        /// <param name="receiveCount">Amount of message requests kept pending on this connection.</param>
+        /// <param name="context">Context passed to the driver, when the connection is established. May be <see langword="null"/>.</param>
+        /// <exception cref="ArgumentOutOfRangeException">
+        /// <paramref name="threadCount"/> is lesser than zero.
+        ///     <para>-or-</para>
+        /// <paramref name="receiveCount"/> is lesser than one, while the <paramref name="threadCount"/> is not zero.
+        ///     <para>-or-</para>
+        /// <paramref name="context"/> is longer than <see cref="short.MaxValue"/> bytes.
+        /// </exception>
+        /// <remarks>
+        /// The notification threads only dispatch the notifications to the handler, so the <paramref name="receiveCount"/>
+        /// may be larger than the <paramref name="threadCount"/> to keep the driver busy, when the handlers are slow.
+        /// </remarks>
+        public ConnectionSettings(int threadCount, int receiveCount, byte[] context)
+        {
+            if (threadCount < 0)
+            {
+                throw new ArgumentOutOfRangeException(nameof(threadCount), threadCount, "Thread count should be more or equal to zero.");
+            }
+
+            if (threadCount > 0 && receiveCount <= 0)
+            {
+                throw new ArgumentOutOfRangeException(nameof(receiveCount), receiveCount, "Receive count should be more than zero.");
+            }
+
+            if (context != null && context.Length > short.MaxValue)
+            {
+                throw new ArgumentOutOfRangeException(nameof(context), context.Length, "Connection context is too long.");
+            }
+
+            this.ThreadCount  = threadCount;
+            this.ReceiveCount = receiveCount;
+            this.context      = (byte[])context?.Clone();
+        }
+
+        #endregion // Constructors
+
+        #region Properties
+
+        /// <summary>
+        /// Gets the amount of background threads processing the notifications received via this connection.
+        /// </summary>
+        public int ThreadCount { get; }
+
+        /// <summary>
+        /// Gets the amount of message requests kept pending on this connection.
+        /// </summary>
+        public int ReceiveCount { get; }
+
+        #endregion // Properties
+
+        #region Public methods
+
+        /// <summary>
+        /// Gets the context passed to the driver, when the connection is established.
+        /// </summary>
+        /// <returns>Copy of the connection context, or <see langword="null"/>, if there is no context.</returns>
+        public byte[] GetContext()
+        {
+            return (byte[])this.context?.Clone();
+        }
+
+        #endregion // Public methods
+    }
+}
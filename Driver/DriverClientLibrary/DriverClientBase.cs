@@ -77,9 +77,9 @@ namespace LazyCopy.DriverClientLibrary
         private readonly string portName;
 
         /// <summary>
-        /// Current amount of concurrent connections supported by the communication port.
+        /// Settings of the connections to open to the communication port.
         /// </summary>
-        private readonly int threadCount;
+        private readonly List<ConnectionSettings> connectionSettings;
 
         /// <summary>
         /// Maximum notification size expected.
@@ -97,14 +97,15 @@ namespace LazyCopy.DriverClientLibrary
         private CancellationTokenSource cancellationTokenSource;
 
         /// <summary>
-        /// MiniFilter driver communication port handle.
+        /// MiniFilter driver communication port handles, one per connection.
+        /// The first one is also used to send commands to the driver.
         /// </summary>
-        private SafeFileHandle filterPortHandle;
+        private readonly List<SafeFileHandle> filterPortHandles = new List<SafeFileHandle>();
 
         /// <summary>
-        /// MiniFilter driver I/O completion port handle.
+        /// MiniFilter driver I/O completion port handles, one per connection.
         /// </summary>
-        private SafeFileHandle completionPortHandle;
+        private readonly List<SafeFileHandle> completionPortHandles = new List<SafeFileHandle>();
 
         /// <summary>
         /// Current connection state.
@@ -138,24 +139,75 @@ namespace LazyCopy.DriverClientLibrary
         /// <exception cref="ArgumentNullException"><paramref name="portName"/> is <see langword="null"/> or empty.</exception>
         /// <exception cref="ArgumentOutOfRangeException"><paramref name="threadCount"/> or <paramref name="maxNotificationSize"/> is lesser than zero.</exception>
         protected DriverClientBase(string portName, int threadCount, int maxNotificationSize)
+            : this(portName, threadCount, maxNotificationSize, 1)
+        {
+            // Do nothing.
+        }
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="DriverClientBase"/> class.
+        /// </summary>
+        /// <param name="portName">Driver communication port name.</param>
+        /// <param name="threadCount">Amount of background threads to be created per connection.</param>
+        /// <param name="maxNotificationSize">Maximum notification size.</param>
+        /// <param name="connectionCount">Amount of connections to open to the communication port.</param>
+        /// <exception cref="ArgumentNullException"><paramref name="portName"/> is <see langword="null"/> or empty.</exception>
+        /// <exception cref="ArgumentOutOfRangeException">
+        /// <paramref name="threadCount"/> or <paramref name="maxNotificationSize"/> is lesser than zero.
+        ///     <para>-or-</para>
+        /// <paramref name="connectionCount"/> is lesser than one.
+        /// </exception>
+        /// <remarks>
+        /// The driver distributes notifications between the connections, and resends the ones that were
+        /// not replied to, if a connection is closed.
+        /// </remarks>
+        protected DriverClientBase(string portName, int threadCount, int maxNotificationSize, int connectionCount)
+            : this(portName, maxNotificationSize, DriverClientBase.CreateConnectionSettings(threadCount, connectionCount))
+        {
+            // Do nothing.
+        }
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="DriverClientBase"/> class.
+        /// </summary>
+        /// <param name="portName">Driver communication port name.</param>
+        /// <param name="maxNotificationSize">Maximum notification size.</param>
+        /// <param name="connections">Settings of the connections to open to the communication port.</param>
+        /// <exception cref="ArgumentNullException"><paramref name="portName"/> is <see langword="null"/> or empty, or <paramref name="connections"/> is <see langword="null"/>.</exception>
+        /// <exception cref="ArgumentOutOfRangeException">
+        /// <paramref name="maxNotificationSize"/> is lesser than zero.
+        ///     <para>-or-</para>
+        /// <paramref name="connections"/> is empty.
+        /// </exception>
+        /// <remarks>
+        /// Each connection has its own notification threads, so the driver can route different
+        /// notifications to different connections based on their context.
+        /// Commands are sent via the first connection.
+        /// </remarks>
+        protected DriverClientBase(string portName, int maxNotificationSize, IEnumerable<ConnectionSettings> connections)
         {
             if (string.IsNullOrEmpty(portName))
             {
                 throw new ArgumentNullException(nameof(portName));
             }
 
-            if (threadCount < 0)
+            if (maxNotificationSize <= 0)
             {
-                throw new ArgumentOutOfRangeException(nameof(threadCount), threadCount, "Thread count should be more or equal to zero.");
+                throw new ArgumentOutOfRangeException(nameof(maxNotificationSize), maxNotificationSize, "Notification size should be more than zero.");
             }
 
-            if (maxNotificationSize <= 0)
+            if (connections == null)
             {
-                throw new ArgumentOutOfRangeException(nameof(maxNotificationSize), maxNotificationSize, "Notification size should be more than zero.");
+                throw new ArgumentNullException(nameof(connections));
+            }
+
+            this.connectionSettings = connections.Where(c => c != null).ToList();
+            if (!this.connectionSettings.Any())
+            {
+                throw new ArgumentOutOfRangeException(nameof(connections), "At least one connection should be given.");
             }
 
             this.portName            = portName;
-            this.threadCount         = threadCount;
             this.maxNotificationSize = maxNotificationSize;
 
             this.state = ConnectionState.Created;
@@ -227,24 +279,33 @@ namespace LazyCopy.DriverClientLibrary
                     this.state = ConnectionState.Connecting;
                     DriverClientBase.Logger.Debug(CultureInfo.InvariantCulture, "Connecting to port: {0}", this.portName);
 
-                    // Open communication ports.
-                    uint hr = NativeMethods.FilterConnectCommunicationPort(this.portName, 0, IntPtr.Zero, 0, IntPtr.Zero, out this.filterPortHandle);
-                    if (hr != NativeMethods.Ok || this.filterPortHandle == null || this.filterPortHandle.IsInvalid)
+                    // Open communication ports. Each connection gets its own completion port, so the monitors
+                    // waiting on it only receive the notifications sent via this connection.
+                    foreach (ConnectionSettings settings in this.connectionSettings)
                     {
-                        string message = string.Format(CultureInfo.InvariantCulture, "Unable to connect to driver via the '{0}' port: 0x{1:X8}", this.portName, hr);
-                        Exception innerException = Marshal.GetExceptionForHR(unchecked((int)hr));
+                        uint hr;
+                        SafeFileHandle filterPortHandle = DriverClientBase.ConnectCommunicationPort(this.portName, settings.GetContext(), out hr);
+                        if (hr != NativeMethods.Ok || filterPortHandle == null || filterPortHandle.IsInvalid)
+                        {
+                            string message = string.Format(CultureInfo.InvariantCulture, "Unable to connect to driver via the '{0}' port: 0x{1:X8}", this.portName, hr);
+                            Exception innerException = Marshal.GetExceptionForHR(unchecked((int)hr));
 
-                        DriverClientBase.Logger.Error(innerException, message);
-                        throw new InvalidOperationException(message, innerException);
-                    }
+                            DriverClientBase.Logger.Error(innerException, message);
+                            throw new InvalidOperationException(message, innerException);
+                        }
 
-                    this.completionPortHandle = NativeMethods.CreateIoCompletionPort(this.filterPortHandle, IntPtr.Zero, IntPtr.Zero, (uint)this.threadCount);
-                    if (this.completionPortHandle == null || this.completionPortHandle.IsInvalid)
-                    {
-                        string message = string.Format(CultureInfo.InvariantCulture, "Unable to create I/O completion port: 0x{0:X8}", Marshal.GetHRForLastWin32Error());
-                        DriverClientBase.Logger.Error(message);
+                        this.filterPortHandles.Add(filterPortHandle);
 
-                        throw new InvalidOperationException(message);
+                        SafeFileHandle completionPortHandle = NativeMethods.CreateIoCompletionPort(filterPortHandle, IntPtr.Zero, IntPtr.Zero, (uint)settings.ThreadCount);
+                        if (completionPortHandle == null || completionPortHandle.IsInvalid)
+                        {
+                            string message = string.Format(CultureInfo.InvariantCulture, "Unable to create I/O completion port: 0x{0:X8}", Marshal.GetHRForLastWin32Error());
+                            DriverClientBase.Logger.Error(message);
+
+                            throw new InvalidOperationException(message);
+                        }
+
+                        this.completionPortHandles.Add(completionPortHandle);
                     }
 
                     // Start monitoring threads, so we will start getting notifications from the driver.
@@ -281,17 +342,11 @@ namespace LazyCopy.DriverClientLibrary
 
                     this.StopMonitoringThreads();
 
-                    if (this.completionPortHandle != null && !this.completionPortHandle.IsInvalid)
-                    {
-                        this.completionPortHandle.Dispose();
-                        this.completionPortHandle = null;
-                    }
+                    this.completionPortHandles.ForEach(h => h.Dispose());
+                    this.completionPortHandles.Clear();
 
-                    if (this.filterPortHandle != null && !this.filterPortHandle.IsInvalid)
-                    {
-                        this.filterPortHandle.Dispose();
-                        this.filterPortHandle = null;
-                    }
+                    this.filterPortHandles.ForEach(h => h.Dispose());
+                    this.filterPortHandles.Clear();
 
                     this.state = ConnectionState.Closed;
                     DriverClientBase.Logger.Info(CultureInfo.InvariantCulture, "Disconnected from port: {0}", this.portName);
@@ -320,7 +375,7 @@ namespace LazyCopy.DriverClientLibrary
         /// </remarks>
         public void ExecuteCommand(IDriverCommand command)
         {
-            this.ExecuteCommand(command, null);
+            this.ExecuteCommand(command, 0, null);
         }
 
         /// <summary>
@@ -344,7 +399,50 @@ namespace LazyCopy.DriverClientLibrary
         public TResponse ExecuteCommand<TResponse>(IDriverCommand command)
             where TResponse : struct
         {
-            return (TResponse)this.ExecuteCommand(command, typeof(TResponse));
+            Type responseType = typeof(TResponse);
+            if (responseType.IsPrimitive)
+            {
+                throw new ArgumentException("Response type is not a structure type.", nameof(TResponse));
+            }
+
+            return (TResponse)this.ExecuteCommand(command, Marshal.SizeOf(responseType), (buffer, length) => Marshal.PtrToStructure(buffer, responseType));
+        }
+
+        /// <summary>
+        /// Sends the command to the driver and gets the variable-length response.
+        /// </summary>
+        /// <param name="command">Command to be sent to the driver.</param>
+        /// <param name="responseSize">Maximum size of the response, in bytes.</param>
+        /// <returns>Response bytes received from the driver.</returns>
+        /// <exception cref="ArgumentNullException"><paramref name="command"/> is <see langword="null"/>.</exception>
+        /// <exception cref="ArgumentOutOfRangeException"><paramref name="responseSize"/> is not positive.</exception>
+        /// <exception cref="InvalidOperationException">
+        /// Memory for the command could not be allocated.
+        ///     <para>-or-</para>
+        /// Memory for the response could not be allocated.
+        ///     <para>-or-</para>
+        /// Message was not sent to the driver.
+        /// </exception>
+        /// <remarks>
+        /// This method should be called from a synchronized context.
+        /// </remarks>
+        public byte[] ExecuteCommand(IDriverCommand command, int responseSize)
+        {
+            if (responseSize <= 0)
+            {
+                throw new ArgumentOutOfRangeException(nameof(responseSize), responseSize, "Response size should be positive.");
+            }
+
+            return (byte[])this.ExecuteCommand(
+                command,
+                responseSize,
+                (buffer, length) =>
+                {
+                    byte[] response = new byte[length];
+                    Marshal.Copy(buffer, response, 0, length);
+
+                    return response;
+                });
         }
 
         #endregion // Public methods
@@ -383,10 +481,123 @@ namespace LazyCopy.DriverClientLibrary
         [SuppressMessage("StyleCop.CSharp.DocumentationRules", "SA1650:ElementDocumentationMustBeSpelledCorrectly", Justification = "The spelling is correct.")]
         protected abstract object NotificationsHandler(IDriverNotification driverNotification);
 
+        /// <summary>
+        /// Handles notifications received from the driver via the communication port asynchronously.
+        /// </summary>
+        /// <param name="driverNotification">Driver notification. Its data stays valid until the task returned is finished.</param>
+        /// <returns>Task that returns the reply to be sent back to the driver.</returns>
+        /// <remarks>
+        /// The default implementation invokes the <see cref="NotificationsHandler"/> synchronously on the notification thread.
+        /// Override this method to handle the long-running notifications without blocking the notification threads.
+        /// </remarks>
+        [SuppressMessage("Microsoft.Design", "CA1031:DoNotCatchGeneralExceptionTypes", Justification = "The exception is passed to the task returned.")]
+        protected virtual Task<object> NotificationsHandlerAsync(IDriverNotification driverNotification)
+        {
+            TaskCompletionSource<object> completionSource = new TaskCompletionSource<object>();
+
+            try
+            {
+                completionSource.SetResult(this.NotificationsHandler(driverNotification));
+            }
+            catch (Exception e)
+            {
+                completionSource.SetException(e);
+            }
+
+            return completionSource.Task;
+        }
+
+        /// <summary>
+        /// Starts processing the notifications the driver posts to the notification ring mapped into the current process.
+        /// </summary>
+        /// <param name="ring">Address of the notification ring.</param>
+        /// <param name="requestEvent">Event the driver signals, when new notifications are posted.</param>
+        /// <param name="completeCommand">Command telling the driver that the replies are written to the ring.</param>
+        /// <exception cref="ArgumentNullException">One of the parameters is <see langword="null"/> or an invalid pointer.</exception>
+        /// <exception cref="InvalidOperationException">Client is not connected, or the ring layout is not supported.</exception>
+        /// <remarks>
+        /// The ring is processed by a separate task, which is stopped, when the client is disconnected.
+        /// Notifications are handled by the <see cref="NotificationsHandlerAsync"/>, so the long-running ones don't block the ring.
+        /// Notifications that don't fit into the ring are still received via the communication port.
+        /// </remarks>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Reliability", "CA2001:AvoidCallingProblematicMethods", MessageId = "System.Runtime.InteropServices.SafeHandle.DangerousGetHandle",
+            Justification = "Handle won't be garbage collected.")]
+        protected void StartNotificationRing(IntPtr ring, WaitHandle requestEvent, IDriverCommand completeCommand)
+        {
+            lock (this.syncRoot)
+            {
+                if (this.state != ConnectionState.Connected)
+                {
+                    throw new InvalidOperationException("Client is not connected.");
+                }
+
+                NotificationRingMonitor monitor = new NotificationRingMonitor(
+                    this.cancellationTokenSource.Token,
+                    this.NotificationsHandlerAsync,
+                    this.filterPortHandles[0].DangerousGetHandle(),
+                    ring,
+                    requestEvent,
+                    completeCommand);
+
+                this.StartMonitorTask(monitor.DoWork);
+            }
+        }
+
         #endregion // Protected methods
 
         #region Private methods
 
+        /// <summary>
+        /// Creates the settings for the <paramref name="connectionCount"/> identical connections without context.
+        /// </summary>
+        /// <param name="threadCount">Amount of background threads to be created per connection.</param>
+        /// <param name="connectionCount">Amount of connections.</param>
+        /// <returns>Connection settings.</returns>
+        /// <exception cref="ArgumentOutOfRangeException"><paramref name="threadCount"/> is lesser than zero, or <paramref name="connectionCount"/> is lesser than one.</exception>
+        private static IEnumerable<ConnectionSettings> CreateConnectionSettings(int threadCount, int connectionCount)
+        {
+            if (connectionCount <= 0)
+            {
+                throw new ArgumentOutOfRangeException(nameof(connectionCount), connectionCount, "Connection count should be more than zero.");
+            }
+
+            ConnectionSettings settings = new ConnectionSettings(threadCount, null);
+            return Enumerable.Repeat(settings, connectionCount).ToList();
+        }
+
+        /// <summary>
+        /// Opens a new connection to the driver's communication port.
+        /// </summary>
+        /// <param name="portName">Driver communication port name.</param>
+        /// <param name="context">Context to be passed to the driver. May be <see langword="null"/>.</param>
+        /// <param name="hr">Result of the <see cref="NativeMethods.FilterConnectCommunicationPort"/> call.</param>
+        /// <returns>Connection port handle. May be invalid, if the <paramref name="hr"/> is not <see cref="NativeMethods.Ok"/>.</returns>
+        private static SafeFileHandle ConnectCommunicationPort(string portName, byte[] context, out uint hr)
+        {
+            IntPtr contextBuffer = IntPtr.Zero;
+
+            try
+            {
+                if (context != null && context.Length > 0)
+                {
+                    contextBuffer = Marshal.AllocHGlobal(context.Length);
+                    Marshal.Copy(context, 0, contextBuffer, context.Length);
+                }
+
+                SafeFileHandle portHandle;
+                hr = NativeMethods.FilterConnectCommunicationPort(portName, 0, contextBuffer, (short)(context?.Length ?? 0), IntPtr.Zero, out portHandle);
+
+                return portHandle;
+            }
+            finally
+            {
+                if (contextBuffer != IntPtr.Zero)
+                {
+                    Marshal.FreeHGlobal(contextBuffer);
+                }
+            }
+        }
+
         /// <summary>
         /// Starts listening for the notifications from the driver.
         /// </summary>
@@ -399,59 +610,86 @@ namespace LazyCopy.DriverClientLibrary
         {
             this.cancellationTokenSource = new CancellationTokenSource();
 
-            for (int i = 0; i < this.threadCount; i++)
+            for (int connection = 0; connection < this.connectionSettings.Count; connection++)
             {
-                using (ManualResetEvent taskStartedEvent = new ManualResetEvent(false))
+                ConnectionSettings settings = this.connectionSettings[connection];
+                if (settings.ThreadCount == 0)
                 {
-                    ManualResetEvent taskFinishedEvent = new ManualResetEvent(false);
-                    this.tasksCompletionWaitHandles.Add(taskFinishedEvent);
-
-                    // Create new long-running background task.
-                    NotificationsMonitor monitor = new NotificationsMonitor(
-                        this.cancellationTokenSource.Token,
-                        this.maxNotificationSize,
-                        this.NotificationsHandler,
-                        this.filterPortHandle.DangerousGetHandle(),
-                        this.completionPortHandle.DangerousGetHandle());
-
-                    Task.Factory.StartNew(
-                        () =>
-                        {
-                            taskStartedEvent.Set();
-                            monitor.DoWork();
-                        },
-                        this.cancellationTokenSource.Token,
-                        TaskCreationOptions.LongRunning,
-                        TaskScheduler.Current)
-                    .ContinueWith(t =>
+                    continue;
+                }
+
+                // All threads of the connection share the monitor, which keeps several message requests pending,
+                // and dequeue their completions from the connection's completion port.
+                NotificationsMonitor monitor = new NotificationsMonitor(
+                    this.cancellationTokenSource.Token,
+                    this.maxNotificationSize,
+                    this.NotificationsHandlerAsync,
+                    this.filterPortHandles[connection].DangerousGetHandle(),
+                    this.completionPortHandles[connection].DangerousGetHandle(),
+                    settings.ReceiveCount);
+
+                for (int i = 0; i < settings.ThreadCount; i++)
+                {
+                    this.StartMonitorTask(monitor.DoWork);
+                }
+
+                monitor.Start();
+            }
+        }
+
+        /// <summary>
+        /// Starts a long-running background task, which is stopped by the <see cref="StopMonitoringThreads"/>.
+        /// If the task fails, the client is put into the faulted state.
+        /// </summary>
+        /// <param name="doWork">Monitor action to be executed by the task.</param>
+        /// <remarks>
+        /// This method should be executed in the synchronization context.
+        /// </remarks>
+        private void StartMonitorTask(Action doWork)
+        {
+            using (ManualResetEvent taskStartedEvent = new ManualResetEvent(false))
+            {
+                ManualResetEvent taskFinishedEvent = new ManualResetEvent(false);
+                this.tasksCompletionWaitHandles.Add(taskFinishedEvent);
+
+                // Create new long-running background task.
+                Task.Factory.StartNew(
+                    () =>
                     {
-                        if (t.IsFaulted)
-                        {
-                            DriverClientBase.Logger.Error(t.Exception, "Monitor thread failed.");
-                        }
+                        taskStartedEvent.Set();
+                        doWork();
+                    },
+                    this.cancellationTokenSource.Token,
+                    TaskCreationOptions.LongRunning,
+                    TaskScheduler.Current)
+                .ContinueWith(t =>
+                {
+                    if (t.IsFaulted)
+                    {
+                        DriverClientBase.Logger.Error(t.Exception, "Monitor thread failed.");
+                    }
 
-                        // Set the event, so the 'StopMonitoringThreads' method will be unblocked, if it's waiting for us.
-                        taskFinishedEvent.Set();
+                    // Set the event, so the 'StopMonitoringThreads' method will be unblocked, if it's waiting for us.
+                    taskFinishedEvent.Set();
 
-                        // If the monitoring task has failed, we need to put the client into the faulted state.
-                        ConnectionState currentState = this.state;
-                        if (t.IsFaulted && currentState != ConnectionState.Closed && currentState != ConnectionState.Faulted)
+                    // If the monitoring task has failed, we need to put the client into the faulted state.
+                    ConnectionState currentState = this.state;
+                    if (t.IsFaulted && currentState != ConnectionState.Closed && currentState != ConnectionState.Faulted)
+                    {
+                        // After the lock is acquired, any pending 'Disconnect()' should've already been finished.
+                        lock (this.syncRoot)
                         {
-                            // After the lock is acquired, any pending 'Disconnect()' should've already been finished.
-                            lock (this.syncRoot)
+                            if (this.state != ConnectionState.Closed && this.state != ConnectionState.Faulted)
                             {
-                                if (this.state != ConnectionState.Closed && this.state != ConnectionState.Faulted)
-                                {
-                                    this.Disconnect();
-                                    this.state = ConnectionState.Faulted;
-                                }
+                                this.Disconnect();
+                                this.state = ConnectionState.Faulted;
                             }
                         }
-                    });
+                    }
+                });
 
-                    // Wait for this monitor task to start.
-                    taskStartedEvent.WaitOne();
-                }
+                // Wait for this monitor task to start.
+                taskStartedEvent.WaitOne();
             }
         }
 
@@ -481,10 +719,13 @@ namespace LazyCopy.DriverClientLibrary
         /// Sends the command to the driver.
         /// </summary>
         /// <param name="command">Command to be sent to the driver.</param>
-        /// <param name="responseType">Type of the response. This parameter may be <see langword="null"/>.</param>
-        /// <returns>Response received from the driver, or <see langword="null"/>, if the <paramref name="responseType"/> is <see langword="null"/>.</returns>
+        /// <param name="responseSize">Size of the response buffer, in bytes.</param>
+        /// <param name="responseReader">
+        /// Converts the response buffer and the amount of bytes received into the response object.
+        /// This parameter may be <see langword="null"/>, if no response is expected.
+        /// </param>
+        /// <returns>Response received from the driver, or <see langword="null"/>, if the <paramref name="responseReader"/> is <see langword="null"/>.</returns>
         /// <exception cref="ArgumentNullException"><paramref name="command"/> is <see langword="null"/>.</exception>
-        /// <exception cref="ArgumentException"><paramref name="responseType"/> is not a structure type.</exception>
         /// <exception cref="InvalidOperationException">
         /// Client is not connected.
         ///     <para>-or-</para>
@@ -492,18 +733,13 @@ namespace LazyCopy.DriverClientLibrary
         ///     <para>-or-</para>
         /// Message was not sent to the driver.
         /// </exception>
-        private object ExecuteCommand(IDriverCommand command, Type responseType)
+        private object ExecuteCommand(IDriverCommand command, int responseSize, Func<IntPtr, int, object> responseReader)
         {
             if (command == null)
             {
                 throw new ArgumentNullException(nameof(command));
             }
 
-            if (responseType != null && (!responseType.IsValueType || responseType.IsPrimitive))
-            {
-                throw new ArgumentException("Response type is not a structure type.", nameof(responseType));
-            }
-
             lock (this.syncRoot)
             {
                 if (this.state != ConnectionState.Connected)
@@ -544,12 +780,8 @@ namespace LazyCopy.DriverClientLibrary
                     // Allocate the response buffer, if needed.
                     //
 
-                    int responseSize = 0;
-
-                    if (responseType != null)
+                    if (responseReader != null)
                     {
-                        responseSize = Marshal.SizeOf(responseType);
-
                         try
                         {
                             responseBuffer = Marshal.AllocHGlobal(responseSize);
@@ -568,7 +800,7 @@ namespace LazyCopy.DriverClientLibrary
                     //
 
                     uint bytesReceived;
-                    uint hr = NativeMethods.FilterSendMessage(this.filterPortHandle, commandBuffer, (uint)commandSize, responseBuffer, (uint)responseSize, out bytesReceived);
+                    uint hr = NativeMethods.FilterSendMessage(this.filterPortHandles[0], commandBuffer, (uint)commandSize, responseBuffer, (uint)responseSize, out bytesReceived);
                     if (hr != NativeMethods.Ok)
                     {
                         string message = string.Format(CultureInfo.InvariantCulture, "Unable to send message to the driver: 0x{0:X8}", hr);
@@ -578,8 +810,8 @@ namespace LazyCopy.DriverClientLibrary
                         throw new InvalidOperationException(message, innerException);
                     }
 
-                    // Return NULL, if response type is not specified.
-                    return responseType == null ? null : Marshal.PtrToStructure(responseBuffer, responseType);
+                    // Return NULL, if response is not expected.
+                    return responseReader == null ? null : responseReader(responseBuffer, (int)bytesReceived);
                 }
                 catch
                 {
@@ -115,6 +115,17 @@ namespace LazyCopy.DriverClientLibrary.Native
         /// </summary>
         public const uint ErrorFltInstanceNotFound = 0x801F0015;
 
+        /// <summary>
+        /// There is no filter waiting for the reply to the message given.
+        /// </summary>
+        public const uint ErrorFltNoWaiterForReply = 0x801F0020;
+
+        /// <summary>
+        /// The handle is invalid.
+        /// It's also returned, when the communication port has been disconnected.
+        /// </summary>
+        public const uint ErrorInvalidHandle = 0x80070006;
+
         /// <summary>
         /// Element not found.
         /// </summary>
@@ -213,7 +224,7 @@ namespace LazyCopy.DriverClientLibrary.Native
         /// Size, in bytes, of the buffer that the <paramref name="messageBuffer"/> parameter points to.
         /// </param>
         /// <param name="overlapped">
-        /// Pointer to an <see cref="NativeOverlapped"/> structure.
+        /// Pointer to an unmanaged <see cref="NativeOverlapped"/> structure, which must stay valid until the operation completes.
         /// </param>
         /// <returns>
         /// <see cref="Ok"/> if successful. Otherwise, it returns an error value.
@@ -223,7 +234,7 @@ namespace LazyCopy.DriverClientLibrary.Native
             /* [in]  */ SafeFileHandle portHandle,
             /* [out] */ IntPtr messageBuffer,
             /* [in]  */ int messageBufferSize,
-            /* [out] */ ref NativeOverlapped overlapped);
+            /* [in]  */ IntPtr overlapped);
 
         /// <summary>
         /// Sends a message to a kernel-mode MiniFilter.
@@ -608,7 +619,7 @@ namespace LazyCopy.DriverClientLibrary.Native
         /// the file handle whose I/O operation has completed.
         /// </param>
         /// <param name="overlapped">
-        /// A pointer to a variable that receives the address of the <see cref="NativeOverlapped"/> structure
+        /// A variable that receives the address of the <see cref="NativeOverlapped"/> structure
         /// that was specified when the completed I/O operation was started.
         /// </param>
         /// <param name="milliseconds">
@@ -625,9 +636,36 @@ namespace LazyCopy.DriverClientLibrary.Native
             /* [in]  */ IntPtr completionPort,
             /* [out] */ out uint numberOfBytes,
             /* [out] */ out IntPtr completionKey,
-            /* [out] */ out NativeOverlapped overlapped,
+            /* [out] */ out IntPtr overlapped,
             /* [in]  */ int milliseconds);
 
+        /// <summary>
+        /// Posts an I/O completion packet to an I/O completion port.
+        /// </summary>
+        /// <param name="completionPort">
+        /// A handle to the completion port.
+        /// </param>
+        /// <param name="numberOfBytes">
+        /// The value to be returned through the <c>numberOfBytes</c> parameter of the <see cref="GetQueuedCompletionStatus"/> method.
+        /// </param>
+        /// <param name="completionKey">
+        /// The value to be returned through the <c>completionKey</c> parameter of the <see cref="GetQueuedCompletionStatus"/> method.
+        /// </param>
+        /// <param name="overlapped">
+        /// The value to be returned through the <c>overlapped</c> parameter of the <see cref="GetQueuedCompletionStatus"/> method.
+        /// </param>
+        /// <returns>
+        /// Returns <see langword="true"/> if successful or <see langword="false"/> otherwise.
+        /// </returns>
+        [SuppressMessage("StyleCop.CSharp.DocumentationRules", "SA1650:ElementDocumentationMustBeSpelledCorrectly", Justification = "'Queued' spelling is correct.")]
+        [DllImport("kernel32.dll", SetLastError = true)]
+        [return: MarshalAs(UnmanagedType.Bool)]
+        public static extern bool PostQueuedCompletionStatus(
+            /* [in] */ IntPtr completionPort,
+            /* [in] */ uint numberOfBytes,
+            /* [in] */ IntPtr completionKey,
+            /* [in] */ IntPtr overlapped);
+
         /// <summary>
         /// Marks any outstanding I/O operations for the specified file handle.
         /// The function only cancels I/O operations in the current process, regardless of which thread created the I/O operation.
@@ -637,6 +675,7 @@ namespace LazyCopy.DriverClientLibrary.Native
         /// </param>
         /// <param name="overlapped">
         /// A pointer to an OVERLAPPED data structure that contains the data used for asynchronous I/O.
+        /// If this parameter is <see cref="IntPtr.Zero"/>, all I/O requests for the <paramref name="portHandle"/> are cancelled.
         /// </param>
         /// <returns>
         /// Returns <see langword="true"/> if successful or <see langword="false"/> otherwise.
@@ -645,7 +684,7 @@ namespace LazyCopy.DriverClientLibrary.Native
         [return: MarshalAs(UnmanagedType.Bool)]
         public static extern bool CancelIoEx(
             /* [in] */ SafeFileHandle portHandle,
-            /* [in] */ ref NativeOverlapped overlapped);
+            /* [in] */ IntPtr overlapped);
 
         #endregion // kernel32.dll
     }
@@ -0,0 +1,493 @@
+﻿// --------------------------------------------------------------------------------------------------------------------
+// <copyright file="NotificationRingMonitor.cs">
+//   The MIT License (MIT)
+//   Copyright (c) 2015 Aleksey Kabanov
+// </copyright>
+// <summary>
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to deal
+//   in the Software without restriction, including without limitation the rights
+//   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//   copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be included in
+//   all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//   THE SOFTWARE.
+// </summary>
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace LazyCopy.DriverClientLibrary
+{
+    using System;
+    using System.Globalization;
+    using System.Runtime.InteropServices;
+    using System.Threading;
+    using System.Threading.Tasks;
+
+    using LazyCopy.DriverClientLibrary.Native;
+    using LazyCopy.Utilities;
+    using Microsoft.Win32.SafeHandles;
+    using NLog;
+
+    /// <summary>
+    /// This class processes the notifications the driver posts to the notification ring shared with the current process.
+    /// </summary>
+    /// <remarks>
+    /// The driver signals the request event only if this monitor is waiting for it, and the monitor sends the
+    /// completion command once for all replies written during a single pass over the ring.<br/>
+    /// Notifications the handler doesn't finish synchronously, like the file fetches, keep their slots, until
+    /// they are finished, so they don't hold back the notifications posted after them.
+    /// See the <c>NOTIFICATION_RING</c> structure in the driver's <c>CommunicationData.h</c> for the layout details.
+    /// </remarks>
+    [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1001:TypesThatOwnDisposableFieldsShouldBeDisposable", Justification = "Safe handles wrappers don't own the pointers, and the reply event is disposed, when the monitor is stopped")]
+    internal class NotificationRingMonitor
+    {
+        #region Fields
+
+        /// <summary>
+        /// Supported ring layout version.
+        /// </summary>
+        private const int RingVersion = 1;
+
+        /// <summary>
+        /// Offsets of the ring header fields.
+        /// </summary>
+        private const int VersionOffset = 0, SlotCountOffset = 4, SlotSizeOffset = 8, ClientWaitingOffset = 12, SlotsOffset = 16;
+
+        /// <summary>
+        /// Offsets of the slot fields.
+        /// </summary>
+        private const int StateOffset = 0, TypeOffset = 4, DataLengthOffset = 8, ReplyLengthOffset = 12, StatusOffset = 16, DataOffset = 24;
+
+        /// <summary>
+        /// Slot states. See the <c>NOTIFICATION_SLOT_STATE</c> enumeration.
+        /// </summary>
+        private const int SlotFree = 0, SlotRequest = 2, SlotProcessing = 3, SlotReply = 4;
+
+        /// <summary>
+        /// Logger instance.
+        /// </summary>
+        private static readonly Logger Logger = LogManager.GetCurrentClassLogger();
+
+        /// <summary>
+        /// User-defined notification handler.
+        /// </summary>
+        private readonly Func<IDriverNotification, Task<object>> handler;
+
+        /// <summary>
+        /// Signaled, when the reply to the notification handled asynchronously is written.
+        /// </summary>
+        private readonly AutoResetEvent replyEvent = new AutoResetEvent(false);
+
+        /// <summary>
+        /// Prevents the asynchronous replies from being written, after the monitor is stopped and the ring may be unmapped.
+        /// </summary>
+        private readonly object replyLock = new object();
+
+        /// <summary>
+        /// Driver port handle.
+        /// </summary>
+        private readonly SafeFileHandle filterPortHandle;
+
+        /// <summary>
+        /// Address of the ring in the current process.
+        /// </summary>
+        private readonly IntPtr ring;
+
+        /// <summary>
+        /// Event signaled by the driver, when new notifications are posted.
+        /// </summary>
+        private readonly WaitHandle requestEvent;
+
+        /// <summary>
+        /// Type of the command telling the driver that the replies are written.
+        /// </summary>
+        private readonly int completeCommandType;
+
+        /// <summary>
+        /// Task cancellation token.
+        /// </summary>
+        private readonly CancellationToken token;
+
+        /// <summary>
+        /// Amount of slots in the ring.
+        /// </summary>
+        private readonly int slotCount;
+
+        /// <summary>
+        /// Size of a single slot, in bytes.
+        /// </summary>
+        private readonly int slotSize;
+
+        /// <summary>
+        /// Index of the slot the next pass over the ring starts from.
+        /// </summary>
+        private int nextSlot;
+
+        /// <summary>
+        /// Amount of the asynchronous replies written since the last completion command.
+        /// </summary>
+        private int asyncReplyCount;
+
+        /// <summary>
+        /// Whether the monitor is stopped.
+        /// </summary>
+        private bool stopped;
+
+        #endregion // Fields
+
+        #region Constructor
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="NotificationRingMonitor"/> class.
+        /// </summary>
+        /// <param name="token">Cancellation token.</param>
+        /// <param name="handler">User-defined notification handler.</param>
+        /// <param name="filterPortHandle">Driver port handle.</param>
+        /// <param name="ring">Address of the notification ring mapped into the current process.</param>
+        /// <param name="requestEvent">Event signaled by the driver, when new notifications are posted.</param>
+        /// <param name="completeCommand">Command telling the driver that the replies are written.</param>
+        /// <exception cref="ArgumentNullException">One of the parameters is <see langword="null"/> or an invalid pointer.</exception>
+        /// <exception cref="InvalidOperationException">Ring layout is not supported.</exception>
+        public NotificationRingMonitor(CancellationToken token, Func<IDriverNotification, Task<object>> handler, IntPtr filterPortHandle, IntPtr ring, WaitHandle requestEvent, IDriverCommand completeCommand)
+        {
+            if (handler == null)
+            {
+                throw new ArgumentNullException(nameof(handler));
+            }
+
+            if (filterPortHandle == IntPtr.Zero)
+            {
+                throw new ArgumentNullException(nameof(filterPortHandle));
+            }
+
+            if (ring == IntPtr.Zero)
+            {
+                throw new ArgumentNullException(nameof(ring));
+            }
+
+            if (requestEvent == null)
+            {
+                throw new ArgumentNullException(nameof(requestEvent));
+            }
+
+            if (completeCommand == null)
+            {
+                throw new ArgumentNullException(nameof(completeCommand));
+            }
+
+            int version = Marshal.ReadInt32(ring, NotificationRingMonitor.VersionOffset);
+            if (version != NotificationRingMonitor.RingVersion)
+            {
+                throw new InvalidOperationException(string.Format(CultureInfo.InvariantCulture, "Notification ring version {0} is not supported.", version));
+            }
+
+            this.token               = token;
+            this.handler             = handler;
+            this.filterPortHandle    = new SafeFileHandle(filterPortHandle, false);
+            this.ring                = ring;
+            this.requestEvent        = requestEvent;
+            this.completeCommandType = completeCommand.Type;
+            this.slotCount           = Marshal.ReadInt32(ring, NotificationRingMonitor.SlotCountOffset);
+            this.slotSize            = Marshal.ReadInt32(ring, NotificationRingMonitor.SlotSizeOffset);
+        }
+
+        #endregion // Constructor
+
+        #region Public methods
+
+        /// <summary>
+        /// This method is passed as an action delegate to the <see cref="System.Threading.Tasks.Task.Factory"/> and invoked when the according task is started.
+        /// </summary>
+        /// <exception cref="InvalidOperationException">Completion command was not sent to the driver.</exception>
+        public void DoWork()
+        {
+            // Command header contains 'Type' and 'DataLength' (Int32) values, and the command has no data.
+            IntPtr commandBuffer = Marshal.AllocHGlobal(sizeof(int) * 2);
+            WaitHandle[] waitHandles = { this.token.WaitHandle, this.requestEvent, this.replyEvent };
+
+            try
+            {
+                MarshalingHelper.MarshalObjectsToPointer(commandBuffer, sizeof(int) * 2, this.completeCommandType, 0);
+
+                while (!this.token.IsCancellationRequested)
+                {
+                    int replyCount;
+                    int processed = this.ProcessRequests(out replyCount);
+
+                    // Replies to the notifications handled asynchronously are completed along with the other ones.
+                    replyCount += Interlocked.Exchange(ref this.asyncReplyCount, 0);
+                    if (replyCount > 0)
+                    {
+                        this.CompleteNotifications(commandBuffer);
+                    }
+
+                    if (processed > 0)
+                    {
+                        continue;
+                    }
+
+                    // Tell the driver we're about to wait, and check the ring once again,
+                    // so the notifications posted before the flag was set are not missed.
+                    Marshal.WriteInt32(this.ring, NotificationRingMonitor.ClientWaitingOffset, 1);
+                    Thread.MemoryBarrier();
+
+                    if (this.HasRequests())
+                    {
+                        continue;
+                    }
+
+                    if (WaitHandle.WaitAny(waitHandles) == 0)
+                    {
+                        break;
+                    }
+                }
+            }
+            finally
+            {
+                // The client disconnects after all monitors are stopped, so the ring stays mapped, while the replies are written.
+                lock (this.replyLock)
+                {
+                    this.stopped = true;
+                }
+
+                this.replyEvent.Dispose();
+                Marshal.FreeHGlobal(commandBuffer);
+            }
+        }
+
+        #endregion // Public methods
+
+        #region Private methods
+
+        /// <summary>
+        /// Processes all notifications currently available in the ring.
+        /// </summary>
+        /// <param name="replyCount">Receives the amount of replies written to the ring.</param>
+        /// <returns>Amount of notifications processed.</returns>
+        private int ProcessRequests(out int replyCount)
+        {
+            int processed = 0;
+            replyCount    = 0;
+
+            // Start from the slot after the last one processed, so the notifications are handled roughly in the order they were posted.
+            for (int i = 0; i < this.slotCount; i++)
+            {
+                int index   = (this.nextSlot + i) % this.slotCount;
+                IntPtr slot = this.GetSlot(index);
+
+                if (Marshal.ReadInt32(slot, NotificationRingMonitor.StateOffset) != NotificationRingMonitor.SlotRequest)
+                {
+                    continue;
+                }
+
+                // Driver withdraws the notifications nobody waits for anymore, so the slot
+                // is only taken, if it's still in the 'Request' state.
+                if (!NotificationRingMonitor.TryChangeSlotState(slot, NotificationRingMonitor.SlotRequest, NotificationRingMonitor.SlotProcessing))
+                {
+                    continue;
+                }
+
+                if (this.ProcessSlot(slot))
+                {
+                    replyCount++;
+                }
+
+                this.nextSlot = index + 1;
+                processed++;
+            }
+
+            return processed;
+        }
+
+        /// <summary>
+        /// Invokes the user-defined handler for the notification in the <paramref name="slot"/> and writes the reply to it.
+        /// </summary>
+        /// <param name="slot">Pointer to the slot.</param>
+        /// <returns><see langword="true"/>, if the driver expects a reply and it was written to the slot.</returns>
+        /// <remarks>
+        /// If the handler doesn't finish synchronously, the reply is written, when it's finished, and the slot is kept meanwhile.
+        /// </remarks>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1031:DoNotCatchGeneralExceptionTypes", Justification = "General exception is required here.")]
+        private bool ProcessSlot(IntPtr slot)
+        {
+            int replyLength = Marshal.ReadInt32(slot, NotificationRingMonitor.ReplyLengthOffset);
+
+            DriverNotification notification = new DriverNotification
+            {
+                Type       = Marshal.ReadInt32(slot, NotificationRingMonitor.TypeOffset),
+                DataLength = Marshal.ReadInt32(slot, NotificationRingMonitor.DataLengthOffset),
+                Data       = slot + NotificationRingMonitor.DataOffset
+            };
+
+            Task<object> handlerTask;
+
+            try
+            {
+                handlerTask = this.handler(notification) ?? Task.FromResult<object>(null);
+            }
+            catch (Exception e)
+            {
+                TaskCompletionSource<object> failedTask = new TaskCompletionSource<object>();
+                failedTask.SetException(e);
+
+                handlerTask = failedTask.Task;
+            }
+
+            if (!handlerTask.IsCompleted)
+            {
+                handlerTask.ContinueWith(t => this.WriteAsyncReply(slot, replyLength, t), CancellationToken.None, TaskContinuationOptions.ExecuteSynchronously, TaskScheduler.Default);
+                return false;
+            }
+
+            return NotificationRingMonitor.WriteReply(slot, replyLength, handlerTask);
+        }
+
+        /// <summary>
+        /// Writes the reply to the notification handled asynchronously, unless the monitor is stopped, and wakes up the monitor to complete it.
+        /// </summary>
+        /// <param name="slot">Pointer to the slot.</param>
+        /// <param name="replyLength">Reply length expected by the driver.</param>
+        /// <param name="handlerTask">Notification handler task finished.</param>
+        private void WriteAsyncReply(IntPtr slot, int replyLength, Task<object> handlerTask)
+        {
+            lock (this.replyLock)
+            {
+                if (this.stopped)
+                {
+                    NotificationRingMonitor.Logger.Warn("Notification ring monitor is stopped, the reply is discarded.");
+                    return;
+                }
+
+                if (NotificationRingMonitor.WriteReply(slot, replyLength, handlerTask))
+                {
+                    Interlocked.Increment(ref this.asyncReplyCount);
+                    this.replyEvent.Set();
+                }
+            }
+        }
+
+        /// <summary>
+        /// Writes the reply returned by the notification handler to the <paramref name="slot"/>.
+        /// </summary>
+        /// <param name="slot">Pointer to the slot.</param>
+        /// <param name="replyLength">Reply length expected by the driver.</param>
+        /// <param name="handlerTask">Notification handler task finished.</param>
+        /// <returns><see langword="true"/>, if the driver expects a reply and it was written to the slot.</returns>
+        private static bool WriteReply(IntPtr slot, int replyLength, Task<object> handlerTask)
+        {
+            IntPtr data = slot + NotificationRingMonitor.DataOffset;
+
+            object reply = null;
+            int handlerResult = (int)NativeMethods.Ok;
+
+            if (handlerTask.IsFaulted || handlerTask.IsCanceled)
+            {
+                Exception e = handlerTask.Exception?.GetBaseException() ?? new OperationCanceledException();
+
+                handlerResult = Marshal.GetHRForException(e);
+                NotificationRingMonitor.Logger.Error(e, "Notification handler threw an exception.");
+            }
+            else
+            {
+                reply = handlerTask.Result;
+            }
+
+            // Driver is not expecting any reply, so the slot can be reused right away.
+            if (replyLength == 0)
+            {
+                Marshal.WriteInt32(slot, NotificationRingMonitor.StateOffset, NotificationRingMonitor.SlotFree);
+                return false;
+            }
+
+            int replySize = MarshalingHelper.GetObjectSize(reply);
+            if (replySize > replyLength)
+            {
+                NotificationRingMonitor.Logger.Error(CultureInfo.InvariantCulture, "Reply ({0} bytes) is bigger than the one expected by the driver ({1} bytes).", replySize, replyLength);
+
+                reply         = null;
+                replySize     = 0;
+                handlerResult = unchecked((int)NativeMethods.ErrorInsufficientBuffer);
+            }
+
+            if (reply != null && replySize > 0)
+            {
+                MarshalingHelper.MarshalObjectToPointer(reply, data, replyLength);
+            }
+
+            Marshal.WriteInt32(slot, NotificationRingMonitor.DataLengthOffset, replySize);
+            Marshal.WriteInt32(slot, NotificationRingMonitor.StatusOffset, handlerResult);
+
+            // Reply must be visible to the driver before the state is changed.
+            Thread.MemoryBarrier();
+            Marshal.WriteInt32(slot, NotificationRingMonitor.StateOffset, NotificationRingMonitor.SlotReply);
+
+            return true;
+        }
+
+        /// <summary>
+        /// Checks whether there are any notifications available in the ring.
+        /// </summary>
+        /// <returns><see langword="true"/>, if at least one slot contains a notification to be processed.</returns>
+        private bool HasRequests()
+        {
+            for (int i = 0; i < this.slotCount; i++)
+            {
+                if (Marshal.ReadInt32(this.GetSlot(i), NotificationRingMonitor.StateOffset) == NotificationRingMonitor.SlotRequest)
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        /// <summary>
+        /// Tells the driver that the replies are written to the ring.
+        /// </summary>
+        /// <param name="commandBuffer">Buffer containing the completion command.</param>
+        /// <exception cref="InvalidOperationException">Command was not sent to the driver.</exception>
+        private void CompleteNotifications(IntPtr commandBuffer)
+        {
+            uint bytesReceived;
+            uint hr = NativeMethods.FilterSendMessage(this.filterPortHandle, commandBuffer, sizeof(int) * 2, IntPtr.Zero, 0, out bytesReceived);
+            if (hr != NativeMethods.Ok)
+            {
+                throw new InvalidOperationException(string.Format(CultureInfo.InvariantCulture, "Unable to complete ring notifications: 0x{0:X8}", hr), Marshal.GetExceptionForHR(unchecked((int)hr)));
+            }
+        }
+
+        /// <summary>
+        /// Atomically changes the state of the <paramref name="slot"/>, if it's equal to the <paramref name="expected"/> one.
+        /// </summary>
+        /// <param name="slot">Pointer to the slot.</param>
+        /// <param name="expected">Expected slot state.</param>
+        /// <param name="state">New slot state.</param>
+        /// <returns><see langword="true"/>, if the state was changed.</returns>
+        private static unsafe bool TryChangeSlotState(IntPtr slot, int expected, int state)
+        {
+            int* slotState = (int*)(slot + NotificationRingMonitor.StateOffset).ToPointer();
+            return Interlocked.CompareExchange(ref *slotState, state, expected) == expected;
+        }
+
+        /// <summary>
+        /// Gets the pointer to the slot with the <paramref name="index"/> given.
+        /// </summary>
+        /// <param name="index">Slot index.</param>
+        /// <returns>Pointer to the slot.</returns>
+        private IntPtr GetSlot(int index)
+        {
+            return this.ring + NotificationRingMonitor.SlotsOffset + (index * this.slotSize);
+        }
+
+        #endregion // Private methods
+    }
+}
@@ -27,7 +27,10 @@
 namespace LazyCopy.DriverClientLibrary
 {
     using System;
+    using System.Collections.Concurrent;
+    using System.Collections.Generic;
     using System.Globalization;
+    using System.Runtime.CompilerServices;
     using System.Runtime.InteropServices;
     using System.Threading;
     using System.Threading.Tasks;
@@ -38,10 +41,18 @@ namespace LazyCopy.DriverClientLibrary
     using NLog;
 
     /// <summary>
-    /// This class is a wrapper for a <see cref="Task"/> delegate that is waiting for the
-    /// driver notifications, marshals them, invokes the user-defined handler, and sends the
-    /// reply back to the driver.
+    /// This class keeps several asynchronous message requests pending on the driver port, dispatches the
+    /// notifications completed via the I/O completion port to the user-defined asynchronous handler, and sends
+    /// the replies back to the driver, when the handler tasks finish.
     /// </summary>
+    /// <remarks>
+    /// The receive buffer is handed over to the notification handler and the request is re-issued with a new buffer
+    /// right away, so slow handlers don't decrease the amount of notifications the driver can deliver.
+    /// The buffers are pooled together with the <see cref="DriverNotification"/> objects passing them to the handler,
+    /// so the notification object should not be used after the handler task finishes.
+    /// The <see cref="DoWork"/> method is executed by several threads dequeuing the completion packets.
+    /// </remarks>
+    /// <seealso cref="Start"/>
     /// <seealso cref="DoWork"/>
     [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1001:TypesThatOwnDisposableFieldsShouldBeDisposable", Justification = "Safe handles wrappers don't own the pointers")]
     internal class NotificationsMonitor
@@ -49,17 +60,36 @@ namespace LazyCopy.DriverClientLibrary
         #region Fields
 
         /// <summary>
-        /// Timeout to wait on the <see cref="Native.NativeMethods.GetQueuedCompletionStatus"/> method.
+        /// Logger instance.
         /// </summary>
-        /// <remarks>
-        /// The current value is <c>300 milliseconds</c>.
-        /// </remarks>
-        private const int QueueTimeout = 300;
+        private static readonly Logger Logger = LogManager.GetCurrentClassLogger();
 
         /// <summary>
-        /// Logger instance.
+        /// Size of the <see cref="NativeOverlapped"/> structure.
         /// </summary>
-        private static readonly Logger Logger = LogManager.GetCurrentClassLogger();
+        private static readonly int OverlappedSize = Marshal.SizeOf(typeof(NativeOverlapped));
+
+        /// <summary>
+        /// Zeroes to reset the OVERLAPPED structures with.
+        /// </summary>
+        private static readonly byte[] EmptyOverlapped = new byte[NotificationsMonitor.OverlappedSize];
+
+        /// <summary>
+        /// Offsets of the <see cref="DriverNotificationHeader"/> fields.
+        /// The header is read field by field, so no structure is boxed for every notification.
+        /// </summary>
+        private static readonly int
+            ReplyLengthOffset = Marshal.OffsetOf(typeof(DriverNotificationHeader), nameof(DriverNotificationHeader.ReplyLength)).ToInt32(),
+            MessageIdOffset   = Marshal.OffsetOf(typeof(DriverNotificationHeader), nameof(DriverNotificationHeader.MessageId)).ToInt32(),
+            TypeOffset        = Marshal.OffsetOf(typeof(DriverNotificationHeader), nameof(DriverNotificationHeader.Type)).ToInt32(),
+            DataLengthOffset  = Marshal.OffsetOf(typeof(DriverNotificationHeader), nameof(DriverNotificationHeader.DataLength)).ToInt32();
+
+        /// <summary>
+        /// Offsets of the <see cref="DriverReplyHeader"/> fields.
+        /// </summary>
+        private static readonly int
+            ReplyStatusOffset    = Marshal.OffsetOf(typeof(DriverReplyHeader), nameof(DriverReplyHeader.Status)).ToInt32(),
+            ReplyMessageIdOffset = Marshal.OffsetOf(typeof(DriverReplyHeader), nameof(DriverReplyHeader.MessageId)).ToInt32();
 
         /// <summary>
         /// Size of the <see cref="DriverNotificationHeader"/> structure.
@@ -74,7 +104,7 @@ namespace LazyCopy.DriverClientLibrary
         /// <summary>
         /// User-defined notification handler.
         /// </summary>
-        private readonly Func<IDriverNotification, object> handler;
+        private readonly Func<IDriverNotification, Task<object>> handler;
 
         /// <summary>
         /// Driver port handle.
@@ -92,9 +122,34 @@ namespace LazyCopy.DriverClientLibrary
         private readonly CancellationToken token;
 
         /// <summary>
-        /// Default notification buffer size.
+        /// Size of the buffers the notifications are received into.
         /// </summary>
-        private readonly int bufferSize;
+        private readonly int messageSize;
+
+        /// <summary>
+        /// Message requests issued to the driver, keyed by their OVERLAPPED structure addresses.
+        /// </summary>
+        private readonly Dictionary<IntPtr, PendingReceive> receives = new Dictionary<IntPtr, PendingReceive>();
+
+        /// <summary>
+        /// Notification buffers that are not used at the moment.
+        /// </summary>
+        private readonly ConcurrentBag<NotificationBuffer> freeBuffers = new ConcurrentBag<NotificationBuffer>();
+
+        /// <summary>
+        /// Amount of message requests pending and notifications being handled, plus one, until the monitor is stopped.
+        /// </summary>
+        private int pendingOperations = 1;
+
+        /// <summary>
+        /// Whether the monitor is stopped.
+        /// </summary>
+        private int stopped;
+
+        /// <summary>
+        /// The first error encountered.
+        /// </summary>
+        private Exception fault;
 
         #endregion // Fields
 
@@ -105,10 +160,11 @@ namespace LazyCopy.DriverClientLibrary
         /// </summary>
         /// <param name="token">Cancellation token.</param>
         /// <param name="bufferSize">The desired size of the buffer used to store notification structures received from the driver into.</param>
-        /// <param name="handler">User-defined notification handler.</param>
+        /// <param name="handler">User-defined asynchronous notification handler.</param>
         /// <param name="filterPortHandle">Driver port handle.</param>
         /// <param name="completionPortHandle">Driver I/O completion port handle.</param>
-        /// <exception cref="ArgumentOutOfRangeException"><paramref name="bufferSize"/> is invalid.</exception>
+        /// <param name="receiveCount">Amount of message requests to keep pending on the driver port.</param>
+        /// <exception cref="ArgumentOutOfRangeException"><paramref name="bufferSize"/> or <paramref name="receiveCount"/> is invalid.</exception>
         /// <exception cref="ArgumentNullException">
         /// <paramref name="handler"/> is <see langword="null"/>.
         ///     <para>-or-</para>
@@ -119,7 +175,7 @@ namespace LazyCopy.DriverClientLibrary
         /// should also contain <see cref="DriverNotificationHeader"/> structure. So we add it to the buffer to make sure it'll be large enough to store both
         /// header and data.
         /// </remarks>
-        public NotificationsMonitor(CancellationToken token, int bufferSize, Func<IDriverNotification, object> handler, IntPtr filterPortHandle, IntPtr completionPortHandle)
+        public NotificationsMonitor(CancellationToken token, int bufferSize, Func<IDriverNotification, Task<object>> handler, IntPtr filterPortHandle, IntPtr completionPortHandle, int receiveCount)
         {
             if (bufferSize <= 0)
             {
@@ -141,19 +197,58 @@ namespace LazyCopy.DriverClientLibrary
                 throw new ArgumentNullException(nameof(completionPortHandle));
             }
 
+            if (receiveCount <= 0)
+            {
+                throw new ArgumentOutOfRangeException(nameof(receiveCount), receiveCount, "Receive count should be more than zero.");
+            }
+
             this.token                = token;
-            this.bufferSize           = bufferSize;
+            this.messageSize          = this.notificationHeaderSize + bufferSize;
             this.handler              = handler;
             this.filterPortHandle     = new SafeFileHandle(filterPortHandle, false);
             this.completionPortHandle = new SafeFileHandle(completionPortHandle, false);
+
+            for (int i = 0; i < receiveCount; i++)
+            {
+                PendingReceive receive = new PendingReceive { Overlapped = Marshal.AllocHGlobal(NotificationsMonitor.OverlappedSize), Buffer = this.RentBuffer() };
+                this.receives.Add(receive.Overlapped, receive);
+            }
         }
 
         #endregion // Constructor
 
+        #region Properties
+
+        /// <summary>
+        /// Gets a value indicating whether the monitor is stopped.
+        /// </summary>
+        private bool IsStopped => Volatile.Read(ref this.stopped) != 0;
+
+        #endregion // Properties
+
         #region Public methods
 
+        /// <summary>
+        /// Issues the message requests to the driver.
+        /// </summary>
+        /// <remarks>
+        /// This method should be invoked once, after the <see cref="DoWork"/> threads are started.
+        /// When the cancellation token is set, the pending requests are cancelled, and the <see cref="DoWork"/>
+        /// threads finish, once all notifications received are replied to.
+        /// </remarks>
+        public void Start()
+        {
+            this.token.Register(this.Stop);
+
+            foreach (PendingReceive receive in this.receives.Values)
+            {
+                this.IssueReceive(receive);
+            }
+        }
+
         /// <summary>
         /// This method is passed as an action delegate to the <see cref="Task.Factory"/> and invoked when the according <see cref="Task"/> is started.
+        /// It dequeues the completed message requests and dispatches the notifications received to the handler.
         /// </summary>
         /// <exception cref="InvalidOperationException">
         /// Message request was not sent to the driver.
@@ -163,30 +258,36 @@ namespace LazyCopy.DriverClientLibrary
         /// Reply was not sent to the driver.
         /// </exception>
         [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Reliability", "CA2001:AvoidCallingProblematicMethods", MessageId = "System.Runtime.InteropServices.SafeHandle.DangerousGetHandle",
-            Justification = "The I/O will be cancelled before leaving this method, so no AVs should occur.")]
+            Justification = "The completion port is closed after all monitor threads finish.")]
         public void DoWork()
         {
-            // Notification buffer must also include a message header. This also validates the 'this.bufferSize' parameter.
-            // The 'resetEvent' will be set by the I/O completion port via the OVERLAPPED structure when notification is available.
-            using (ResizableBuffer resizableBuffer = new ResizableBuffer(this.notificationHeaderSize + this.bufferSize))
-            using (ManualResetEvent resetEvent     = new ManualResetEvent(false))
+            while (true)
             {
-                // This OVERLAPPED structure will be passed to the 'FilterGetMessage' method, so it'll operate in the asynchronous mode.
-                NativeOverlapped overlapped = new NativeOverlapped { EventHandle = resetEvent.SafeWaitHandle.DangerousGetHandle() };
+                uint numberOfBytesTransferred;
+                IntPtr completionKey;
+                IntPtr overlapped;
 
-                try
+                bool completed = NativeMethods.GetQueuedCompletionStatus(this.completionPortHandle.DangerousGetHandle(), out numberOfBytesTransferred, out completionKey, out overlapped, Timeout.Infinite);
+                uint hr = completed ? NativeMethods.Ok : unchecked((uint)Marshal.GetHRForLastWin32Error());
+
+                if (overlapped == IntPtr.Zero)
                 {
-                    // Get the next notification and store it into the 'resizableBuffer'.
-                    while (this.GetNextNotification(resizableBuffer, resetEvent, overlapped))
+                    if (!completed)
                     {
-                        // Get the reply and send it back to the driver.
-                        this.ProcessNotification(resizableBuffer);
+                        throw new InvalidOperationException(string.Format(CultureInfo.InvariantCulture, "Invalid completion status: 0x{0:X8}", hr), Marshal.GetExceptionForHR(unchecked((int)hr)));
                     }
+
+                    // The monitor is stopped. Pass the packet on, so the other threads also finish.
+                    this.PostStopPacket();
+                    break;
                 }
-                finally
-                {
-                    this.CancelIo(overlapped);
-                }
+
+                this.OnReceiveCompleted(this.receives[overlapped], hr);
+            }
+
+            if (this.fault != null)
+            {
+                throw new InvalidOperationException("Unable to process driver notifications.", this.fault);
             }
         }
 
@@ -195,160 +296,371 @@ namespace LazyCopy.DriverClientLibrary
         #region Private methods
 
         /// <summary>
-        /// Gets the next notification.
+        /// Issues the asynchronous message request to the driver.
         /// </summary>
-        /// <param name="resizableBuffer">Resizable buffer to store notification into.</param>
-        /// <param name="resetEvent">Reset event used in the <paramref name="overlapped"/> structure.</param>
-        /// <param name="overlapped">Native structure to be used by the driver for notifications.</param>
-        /// <returns>
-        /// <see langword="true"/>, if the notification was successfully received and stored in the <paramref name="resizableBuffer"/> variable;
-        /// <see langword="false"/>, if the operation or the current task was cancelled.
-        /// </returns>
-        /// <exception cref="InvalidOperationException">
-        /// Message request was not sent to the driver.
-        ///     <para>-or-</para>
-        /// I/O completion status was not retrieved.
-        /// </exception>
-        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Reliability", "CA2001:AvoidCallingProblematicMethods", MessageId = "System.Runtime.InteropServices.SafeHandle.DangerousGetHandle",
-            Justification = "The I/O will be cancelled in the 'DoWork()' method, so no AVs should occur.")]
-        private bool GetNextNotification(ResizableBuffer resizableBuffer, ManualResetEvent resetEvent, NativeOverlapped overlapped)
+        /// <param name="receive">Request to be issued.</param>
+        private void IssueReceive(PendingReceive receive)
         {
-            uint numberOfBytesTransferred;
-            IntPtr completionKey;
-            NativeOverlapped nativeOverlapped;
+            // The operation is counted before the check, so the buffers are not released while the request is being issued.
+            Interlocked.Increment(ref this.pendingOperations);
 
-            // Buffer to marshal the notification into.
-            IntPtr notificationBuffer = resizableBuffer.DangerousGetPointer();
-            resetEvent.Reset();
+            if (this.IsStopped)
+            {
+                this.CompleteOperation();
+                return;
+            }
 
-            //
-            // 'Asynchronously' request and get a message from the driver.
-            //
+            // The OVERLAPPED structure should be zeroed before it's reused. No event is set, so the completion is only posted to the completion port.
+            Marshal.Copy(NotificationsMonitor.EmptyOverlapped, 0, receive.Overlapped, NotificationsMonitor.OverlappedSize);
 
             // FilterGetMessage returns ERROR_IO_PENDING, if it's set to operate in the asynchronous mode.
-            uint hr = NativeMethods.FilterGetMessage(this.filterPortHandle, notificationBuffer, this.bufferSize, ref overlapped);
+            uint hr = NativeMethods.FilterGetMessage(this.filterPortHandle, receive.Buffer.Address, this.messageSize, receive.Overlapped);
             if (hr != NativeMethods.Ok && hr != NativeMethods.ErrorIoPending)
             {
-                throw new InvalidOperationException(string.Format(CultureInfo.InvariantCulture, "Unable to request for a message: 0x{0:X8}", hr), Marshal.GetExceptionForHR(unchecked((int)hr)));
+                this.Fail(new InvalidOperationException(string.Format(CultureInfo.InvariantCulture, "Unable to request for a message: 0x{0:X8}", hr), Marshal.GetExceptionForHR(unchecked((int)hr))));
+                this.CompleteOperation();
+
+                return;
             }
 
-            // If we don't specify timeout, this method will wait forever, but we want to be able to react on the task cancellation.
-            while (!NativeMethods.GetQueuedCompletionStatus(this.completionPortHandle.DangerousGetHandle(), out numberOfBytesTransferred, out completionKey, out nativeOverlapped, NotificationsMonitor.QueueTimeout))
+            // The monitor might've been stopped after the check above, but before the request was issued, so it would not be cancelled.
+            if (this.IsStopped)
             {
-                hr = unchecked((uint)Marshal.GetHRForLastWin32Error());
+                NativeMethods.CancelIoEx(this.filterPortHandle, receive.Overlapped);
+            }
+        }
 
-                // Break on the task cancellation.
-                if (this.token.IsCancellationRequested)
+        /// <summary>
+        /// Dispatches the notification received, and issues the message request again.
+        /// </summary>
+        /// <param name="receive">Message request completed.</param>
+        /// <param name="hr">Completion status.</param>
+        private void OnReceiveCompleted(PendingReceive receive, uint hr)
+        {
+            if (hr != NativeMethods.Ok)
+            {
+                // Requests are cancelled, when the monitor is stopped.
+                if (hr != NativeMethods.ErrorOperationAborted || !this.IsStopped)
                 {
-                    break;
+                    this.Fail(new InvalidOperationException(string.Format(CultureInfo.InvariantCulture, "Unable to receive a message: 0x{0:X8}", hr), Marshal.GetExceptionForHR(unchecked((int)hr))));
                 }
 
-                // If the WAIT_TIMEOUT is returned, there was no notification available and we want to wait again.
-                if (hr == NativeMethods.WaitTimeout)
-                {
-                    continue;
-                }
+                this.CompleteOperation();
+                return;
+            }
 
-                // If the I/O was cancelled on the completion port, or the completion port was closed.
-                throw new InvalidOperationException(string.Format(CultureInfo.InvariantCulture, "Invalid completion status: 0x{0:X8}", hr), Marshal.GetExceptionForHR(unchecked((int)hr)));
+            NotificationBuffer notificationBuffer = receive.Buffer;
+
+            try
+            {
+                receive.Buffer = this.RentBuffer();
             }
+            catch (OutOfMemoryException oom)
+            {
+                // The notification is not replied to, so the driver will time out waiting for it.
+                this.Fail(oom);
+                this.CompleteOperation();
 
-            // If the current task was cancelled, the token wait handle will be set.
-            // The 'resetEvent' will be set via the overlapped' structure, when the driver finishes writing notification to the buffer.
-            return WaitHandle.WaitAny(new[] { this.token.WaitHandle, resetEvent }) == 1;
+                return;
+            }
+
+            // The handler now owns the notification buffer, and the request can be issued again.
+            Interlocked.Increment(ref this.pendingOperations);
+
+            this.IssueReceive(receive);
+            this.CompleteOperation();
+
+            this.DispatchNotification(notificationBuffer);
         }
 
         /// <summary>
-        /// Gets the reply by calling the notification handler and sends the reply back to the driver.
+        /// Invokes the notification handler and sends the reply back to the driver, when it's finished.
         /// </summary>
-        /// <param name="resizableBuffer">Resizable buffer that contains the notification received from the driver.</param>
-        /// <exception cref="InvalidOperationException">
-        /// The reply cannot be marshaled.
-        ///     <para>-or-</para>
-        /// The reply size is bigger, than the one expected by the driver.
-        ///     <para>-or-</para>
-        /// Reply was not sent to the driver.
-        /// </exception>
+        /// <param name="notificationBuffer">Buffer that contains the notification received from the driver.</param>
         [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1031:DoNotCatchGeneralExceptionTypes", Justification = "General exception is required here.")]
-        private void ProcessNotification(ResizableBuffer resizableBuffer)
+        private void DispatchNotification(NotificationBuffer notificationBuffer)
         {
-            IntPtr bufferPointer = resizableBuffer.DangerousGetPointer();
+            IntPtr address = notificationBuffer.Address;
 
             // Marshal the notification received.
-            DriverNotificationHeader header = (DriverNotificationHeader)Marshal.PtrToStructure(bufferPointer, typeof(DriverNotificationHeader));
-            DriverNotification notification = new DriverNotification { Type = header.Type, DataLength = header.DataLength, Data = bufferPointer + this.notificationHeaderSize };
+            notificationBuffer.Header = new DriverNotificationHeader
+            {
+                ReplyLength = Marshal.ReadInt32(address, NotificationsMonitor.ReplyLengthOffset),
+                MessageId   = Marshal.ReadInt64(address, NotificationsMonitor.MessageIdOffset),
+                Type        = Marshal.ReadInt32(address, NotificationsMonitor.TypeOffset),
+                DataLength  = Marshal.ReadInt32(address, NotificationsMonitor.DataLengthOffset)
+            };
+
+            DriverNotification notification = notificationBuffer.Notification;
+            notification.Type       = notificationBuffer.Header.Type;
+            notification.DataLength = notificationBuffer.Header.DataLength;
+            notification.Data       = address + this.notificationHeaderSize;
 
-            // Get the reply object from the user-defined handler.
-            object reply = null;
-            int handlerResult = (int)NativeMethods.Ok;
+            Task<object> handlerTask;
 
             try
             {
-                reply = this.handler(notification);
+                handlerTask = this.handler(notification) ?? Task.FromResult<object>(null);
             }
             catch (Exception e)
             {
-                handlerResult = Marshal.GetHRForException(e);
-                NotificationsMonitor.Logger.Error(e, "Notification handler threw an exception.");
+                TaskCompletionSource<object> failedTask = new TaskCompletionSource<object>();
+                failedTask.SetException(e);
+
+                handlerTask = failedTask.Task;
             }
 
-            // Driver is not expecting any reply.
-            if (header.ReplyLength == 0)
+            notificationBuffer.HandlerTask = handlerTask;
+
+            // The reply is sent from the thread the handler finishes on. The continuation delegate is cached
+            // in the buffer, so neither a closure nor a continuation task is allocated for the notification.
+            ConfiguredTaskAwaitable<object>.ConfiguredTaskAwaiter awaiter = handlerTask.ConfigureAwait(false).GetAwaiter();
+            if (awaiter.IsCompleted)
+            {
+                this.SendReply(notificationBuffer);
+            }
+            else
+            {
+                awaiter.UnsafeOnCompleted(notificationBuffer.SendReply);
+            }
+        }
+
+        /// <summary>
+        /// Sends the reply returned by the notification handler back to the driver.
+        /// </summary>
+        /// <param name="notificationBuffer">Buffer that contains the notification and the handler task finished. It's reused to send the reply.</param>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1031:DoNotCatchGeneralExceptionTypes", Justification = "General exception is required here.")]
+        private void SendReply(NotificationBuffer notificationBuffer)
+        {
+            DriverNotificationHeader header = notificationBuffer.Header;
+            Task<object> handlerTask        = notificationBuffer.HandlerTask;
+            IntPtr replyBuffer              = notificationBuffer.Address;
+
+            try
             {
+                // Get the reply object from the user-defined handler.
+                object reply = null;
+                int handlerResult = (int)NativeMethods.Ok;
+
+                if (handlerTask.IsFaulted || handlerTask.IsCanceled)
+                {
+                    Exception e = handlerTask.Exception?.GetBaseException() ?? new OperationCanceledException();
+
+                    handlerResult = Marshal.GetHRForException(e);
+                    NotificationsMonitor.Logger.Error(e, "Notification handler threw an exception.");
+                }
+                else
+                {
+                    reply = handlerTask.Result;
+                }
+
+                // Driver is not expecting any reply.
+                if (header.ReplyLength == 0)
+                {
+                    if (reply != null)
+                    {
+                        NotificationsMonitor.Logger.Warn(CultureInfo.InvariantCulture, "Driver is not expecting any reply, but reply object is returned from handler: {0}", reply.GetType());
+                    }
+
+                    return;
+                }
+
+                int replySize = this.replyHeaderSize + MarshalingHelper.GetObjectSize(reply);
+                if (replySize > header.ReplyLength)
+                {
+                    throw new InvalidOperationException(string.Format(CultureInfo.InvariantCulture, "Reply ({0} bytes) is bigger than the one expected by the driver ({1} bytes).", replySize, header.ReplyLength));
+                }
+
+                // The notification buffer is not needed anymore, so the reply is marshaled into it, if it fits.
+                if (replySize > this.messageSize)
+                {
+                    replyBuffer = Marshal.AllocHGlobal(replySize);
+                }
+
+                // Notify driver about the exception thrown, if any.
+                Marshal.WriteInt32(replyBuffer, NotificationsMonitor.ReplyStatusOffset, handlerResult);
+                Marshal.WriteInt64(replyBuffer, NotificationsMonitor.ReplyMessageIdOffset, header.MessageId);
+
                 if (reply != null)
                 {
-                    NotificationsMonitor.Logger.Warn(CultureInfo.InvariantCulture, "Driver is not expecting any reply, but reply object is returned from handler: {0}", reply.GetType());
+                    MarshalingHelper.MarshalObjectToPointer(reply, replyBuffer + this.replyHeaderSize, replySize - this.replyHeaderSize);
                 }
 
-                return;
+                // And send it to the driver.
+                uint hr = NativeMethods.FilterReplyMessage(this.filterPortHandle, replyBuffer, (uint)replySize);
+                if (hr == NativeMethods.ErrorFltNoWaiterForReply || hr == NativeMethods.ErrorInvalidHandle)
+                {
+                    // The driver stopped waiting for this reply (timed out or cancelled), or the port is disconnected.
+                    // Only the current notification is affected, so the monitor keeps running.
+                    NotificationsMonitor.Logger.Warn(CultureInfo.InvariantCulture, "Reply to the message {0} was not delivered to the driver: 0x{1:X8}", header.MessageId, hr);
+                }
+                else if (hr != NativeMethods.Ok)
+                {
+                    throw new InvalidOperationException(string.Format(CultureInfo.InvariantCulture, "Unable to send reply: 0x{0:X8}", hr), Marshal.GetExceptionForHR(unchecked((int)hr)));
+                }
+            }
+            catch (Exception e)
+            {
+                this.Fail(e);
+            }
+            finally
+            {
+                if (replyBuffer != notificationBuffer.Address)
+                {
+                    Marshal.FreeHGlobal(replyBuffer);
+                }
+
+                notificationBuffer.HandlerTask = null;
+                this.freeBuffers.Add(notificationBuffer);
+                this.CompleteOperation();
             }
+        }
 
-            int replySize = this.replyHeaderSize + MarshalingHelper.GetObjectSize(reply);
-            if (replySize > header.ReplyLength)
+        /// <summary>
+        /// Stops the monitor and cancels the pending message requests.
+        /// </summary>
+        private void Stop()
+        {
+            if (Interlocked.Exchange(ref this.stopped, 1) != 0)
             {
-                throw new InvalidOperationException(string.Format(CultureInfo.InvariantCulture, "Reply ({0} bytes) is bigger than the one expected by the driver ({1} bytes).", replySize, header.ReplyLength));
+                return;
             }
 
-            DriverReplyHeader replyHeader = new DriverReplyHeader
+            // Cancel all message requests issued for the port.
+            if (!NativeMethods.CancelIoEx(this.filterPortHandle, IntPtr.Zero))
             {
-                MessageId = header.MessageId,
+                uint hr = unchecked((uint)Marshal.GetHRForLastWin32Error());
+                if (hr != NativeMethods.ErrorNotFound)
+                {
+                    NotificationsMonitor.Logger.Warn(CultureInfo.InvariantCulture, "Unable to cancel I/O for the notifications monitor: 0x{0:X8}", hr);
+                }
+            }
 
-                // Notify driver about the exception thrown, if any.
-                Status    = handlerResult
-            };
+            this.CompleteOperation();
+        }
 
-            // Adjust the buffer to fit the reply.
-            resizableBuffer.Resize(replySize);
-            bufferPointer = resizableBuffer.DangerousGetPointer();
+        /// <summary>
+        /// Saves the <paramref name="exception"/> given, if it's the first one, and stops the monitor.
+        /// </summary>
+        /// <param name="exception">Exception encountered.</param>
+        private void Fail(Exception exception)
+        {
+            Interlocked.CompareExchange(ref this.fault, exception, null);
+            this.Stop();
+        }
+
+        /// <summary>
+        /// Decrements the amount of pending operations. When the last one completes, the buffers are released,
+        /// and the <see cref="DoWork"/> threads are notified to finish.
+        /// </summary>
+        private void CompleteOperation()
+        {
+            if (Interlocked.Decrement(ref this.pendingOperations) != 0)
+            {
+                return;
+            }
 
-            // Marshal reply to the output buffer.
-            MarshalingHelper.MarshalObjectsToPointer(bufferPointer, replySize, replyHeader, reply);
+            foreach (PendingReceive receive in this.receives.Values)
+            {
+                Marshal.FreeHGlobal(receive.Overlapped);
+                Marshal.FreeHGlobal(receive.Buffer.Address);
+            }
 
-            // And send it to the driver.
-            uint hr = NativeMethods.FilterReplyMessage(this.filterPortHandle, bufferPointer, (uint)replySize);
-            if (hr != NativeMethods.Ok)
+            NotificationBuffer buffer;
+            while (this.freeBuffers.TryTake(out buffer))
             {
-                throw new InvalidOperationException(string.Format(CultureInfo.InvariantCulture, "Unable to send reply: 0x{0:X8}", hr), Marshal.GetExceptionForHR(unchecked((int)hr)));
+                Marshal.FreeHGlobal(buffer.Address);
             }
+
+            this.PostStopPacket();
         }
 
         /// <summary>
-        /// Cancels the pending I/O on the filter port.
+        /// Posts the completion packet without the OVERLAPPED structure, which tells the <see cref="DoWork"/> thread to finish.
         /// </summary>
-        /// <param name="overlapped">OVERLAPPED structure.</param>
-        private void CancelIo(NativeOverlapped overlapped)
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Reliability", "CA2001:AvoidCallingProblematicMethods", MessageId = "System.Runtime.InteropServices.SafeHandle.DangerousGetHandle",
+            Justification = "The completion port is closed after all monitor threads finish.")]
+        private void PostStopPacket()
         {
-            // We need to cancel I/O before leaving, so the driver won't try to read the OVERLAPPED memory (and no AVs will occur).
-            if (!NativeMethods.CancelIoEx(this.filterPortHandle, ref overlapped))
+            if (!NativeMethods.PostQueuedCompletionStatus(this.completionPortHandle.DangerousGetHandle(), 0, IntPtr.Zero, IntPtr.Zero))
             {
-                uint hr = unchecked((uint)Marshal.GetHRForLastWin32Error());
-                if (hr != NativeMethods.ErrorNotFound)
-                {
-                    NotificationsMonitor.Logger.Warn(CultureInfo.InvariantCulture, "Unable to cancel I/O for the current task: 0x{0:X8}", hr);
-                }
+                NotificationsMonitor.Logger.Error(CultureInfo.InvariantCulture, "Unable to post the stop packet: 0x{0:X8}", Marshal.GetHRForLastWin32Error());
             }
         }
 
+        /// <summary>
+        /// Gets the notification buffer that is not used, or allocates a new one.
+        /// </summary>
+        /// <returns>Notification buffer.</returns>
+        /// <exception cref="OutOfMemoryException">There is insufficient memory to satisfy the request.</exception>
+        private NotificationBuffer RentBuffer()
+        {
+            NotificationBuffer buffer;
+            return this.freeBuffers.TryTake(out buffer) ? buffer : new NotificationBuffer(this, Marshal.AllocHGlobal(this.messageSize));
+        }
+
         #endregion // Private methods
+
+        #region Nested types
+
+        /// <summary>
+        /// Message request issued to the driver.
+        /// </summary>
+        private sealed class PendingReceive
+        {
+            /// <summary>
+            /// Gets or sets the address of the unmanaged OVERLAPPED structure.
+            /// </summary>
+            public IntPtr Overlapped { get; set; }
+
+            /// <summary>
+            /// Gets or sets the buffer the notification is received into.
+            /// </summary>
+            public NotificationBuffer Buffer { get; set; }
+        }
+
+        /// <summary>
+        /// Unmanaged notification buffer, and the state of the notification received into it.
+        /// </summary>
+        private sealed class NotificationBuffer
+        {
+            /// <summary>
+            /// Initializes a new instance of the <see cref="NotificationBuffer"/> class.
+            /// </summary>
+            /// <param name="monitor">Monitor the buffer belongs to.</param>
+            /// <param name="address">Address of the unmanaged buffer.</param>
+            public NotificationBuffer(NotificationsMonitor monitor, IntPtr address)
+            {
+                this.Address   = address;
+                this.SendReply = () => monitor.SendReply(this);
+            }
+
+            /// <summary>
+            /// Gets the address of the unmanaged buffer.
+            /// </summary>
+            public IntPtr Address { get; }
+
+            /// <summary>
+            /// Gets the notification object passed to the handler.
+            /// </summary>
+            public DriverNotification Notification { get; } = new DriverNotification();
+
+            /// <summary>
+            /// Gets the action that sends the reply to the notification, when the <see cref="HandlerTask"/> finishes.
+            /// </summary>
+            public Action SendReply { get; }
+
+            /// <summary>
+            /// Gets or sets the header of the notification received.
+            /// </summary>
+            public DriverNotificationHeader Header { get; set; }
+
+            /// <summary>
+            /// Gets or sets the notification handler task.
+            /// </summary>
+            public Task<object> HandlerTask { get; set; }
+        }
+
+        #endregion // Nested types
     }
 }
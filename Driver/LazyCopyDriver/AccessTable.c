@@ -0,0 +1,616 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    AccessTable.c
+
+Abstract:
+
+    Contains the table aggregating the file access reports.
+    Instead of raising an ETW event per file access, the access counts and
+    timestamps are collected per path, and periodically drained by the
+    user-mode client in batches.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "AccessTable.h"
+#include "CommunicationData.h"
+#include "Utilities.h"
+
+//------------------------------------------------------------------------
+//  Defines.
+//------------------------------------------------------------------------
+
+// Amount of hash buckets. Should be a power of two.
+#define ACCESS_TABLE_BUCKETS      256
+
+// Maximum amount of paths stored in the table.
+// When the limit is reached, accesses to the new paths are dropped until the table is drained.
+#define ACCESS_TABLE_MAX_ENTRIES  8192
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+//
+// Contains access statistics for a single path.
+//
+typedef struct _ACCESS_TABLE_ENTRY
+{
+    // Case-insensitive hash of the 'Path'.
+    ULONG               Hash;
+
+    // Full path to the file. The buffer is allocated together with the entry.
+    UNICODE_STRING      Path;
+
+    // Amount of accesses reported.
+    __volatile LONGLONG AccessCount;
+
+    // System time of the first and the last reported access.
+    LONGLONG            FirstAccessTime;
+    __volatile LONGLONG LastAccessTime;
+
+    // List entry for the hash bucket.
+    LIST_ENTRY          BucketListEntry;
+
+    // List entry for the 'AccessTableList'.
+    LIST_ENTRY          ListEntry;
+} ACCESS_TABLE_ENTRY, *PACCESS_TABLE_ENTRY;
+
+//------------------------------------------------------------------------
+//  Local function prototypes.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+PACCESS_TABLE_ENTRY
+LcFindAccessTableEntry(
+    _In_ PCUNICODE_STRING Path,
+    _In_ ULONG            Hash
+    );
+
+static
+VOID
+LcUpdateAccessTableEntry(
+    _In_ PACCESS_TABLE_ENTRY Entry,
+    _In_ LONGLONG            AccessTime
+    );
+
+static
+VOID
+LcDeleteAccessTableEntry(
+    _In_ PACCESS_TABLE_ENTRY Entry
+    );
+
+//------------------------------------------------------------------------
+//  Text sections.
+//------------------------------------------------------------------------
+
+#ifdef ALLOC_PRAGMA
+    #pragma alloc_text(PAGE, LcInitializeAccessTable)
+    #pragma alloc_text(PAGE, LcFreeAccessTable)
+    #pragma alloc_text(PAGE, LcRecordFileAccess)
+    #pragma alloc_text(PAGE, LcDrainAccessTable)
+
+    // Local functions.
+    #pragma alloc_text(PAGE, LcFindAccessTableEntry)
+    #pragma alloc_text(PAGE, LcUpdateAccessTableEntry)
+    #pragma alloc_text(PAGE, LcDeleteAccessTableEntry)
+#endif // ALLOC_PRAGMA
+
+//------------------------------------------------------------------------
+//  Global variables.
+//------------------------------------------------------------------------
+
+// Used to synchronize access to the table lists.
+// Existing entries are updated under the shared lock, so the exclusive one is only needed for the new paths.
+static PERESOURCE          AccessTableResource = NULL;
+
+// Hash buckets containing the 'ACCESS_TABLE_ENTRY' items.
+static LIST_ENTRY          AccessTableBuckets[ACCESS_TABLE_BUCKETS] = { 0 };
+
+// All table entries ordered by the insertion time. The oldest entry is at the head, so it's drained first.
+static LIST_ENTRY          AccessTableList     = { 0 };
+
+// Amount of entries currently stored in the table.
+static ULONG               AccessTableSize     = 0;
+
+// Amount of accesses dropped since the last drain, because the table was full.
+static __volatile LONGLONG AccessTableDropped  = 0;
+
+//------------------------------------------------------------------------
+//  Access table functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializeAccessTable()
+/*++
+
+Summary:
+
+    This function initializes objects used by the current module.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG    idx    = 0;
+
+    PAGED_CODE();
+
+    for (idx = 0; idx < ACCESS_TABLE_BUCKETS; idx++)
+    {
+        InitializeListHead(&AccessTableBuckets[idx]);
+    }
+
+    InitializeListHead(&AccessTableList);
+    AccessTableSize    = 0;
+    AccessTableDropped = 0;
+
+    NT_IF_FAIL_RETURN(LcAllocateResource(&AccessTableResource));
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcFreeAccessTable()
+/*++
+
+Summary:
+
+    This function releases objects used by the current module.
+
+    It is not thread-safe, so it should only be called when the driver is about to be unloaded.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (AccessTableList.Flink != NULL)
+    {
+        while (!IsListEmpty(&AccessTableList))
+        {
+            LcDeleteAccessTableEntry(CONTAINING_RECORD(AccessTableList.Flink, ACCESS_TABLE_ENTRY, ListEntry));
+        }
+    }
+
+    if (AccessTableResource != NULL)
+    {
+        LcFreeResource(AccessTableResource);
+        AccessTableResource = NULL;
+    }
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcRecordFileAccess(
+    _In_ PCUNICODE_STRING Path
+    )
+/*++
+
+Summary:
+
+    This function increments the access count for the 'Path' given.
+
+    Paths already in the table are updated under the shared lock using the
+    interlocked operations, so the concurrent accesses to them don't serialize.
+
+Arguments:
+
+    Path - Full path to the file accessed.
+
+Return value:
+
+    None.
+
+--*/
+{
+    NTSTATUS            status     = STATUS_SUCCESS;
+    ULONG               hash       = 0;
+    LARGE_INTEGER       accessTime = { 0 };
+    PACCESS_TABLE_ENTRY entry      = NULL;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN(NT_SUCCESS(RtlUnicodeStringValidate(Path)));
+    IF_FALSE_RETURN(Path->Length > 0);
+
+    if (!NT_SUCCESS(RtlHashUnicodeString(Path, TRUE, HASH_STRING_ALGORITHM_DEFAULT, &hash)))
+    {
+        return;
+    }
+
+    KeQuerySystemTime(&accessTime);
+
+    FltAcquireResourceShared(AccessTableResource);
+
+    __try
+    {
+        entry = LcFindAccessTableEntry(Path, hash);
+        if (entry != NULL)
+        {
+            LcUpdateAccessTableEntry(entry, accessTime.QuadPart);
+        }
+    }
+    __finally
+    {
+        FltReleaseResource(AccessTableResource);
+    }
+
+    if (entry != NULL)
+    {
+        return;
+    }
+
+    // The path is not in the table yet, so it should be added under the exclusive lock.
+    FltAcquireResourceExclusive(AccessTableResource);
+
+    __try
+    {
+        // Another thread might have added the same path while the lock was released.
+        entry = LcFindAccessTableEntry(Path, hash);
+        if (entry != NULL)
+        {
+            LcUpdateAccessTableEntry(entry, accessTime.QuadPart);
+            __leave;
+        }
+
+        NT_IF_FALSE_LEAVE(AccessTableSize < ACCESS_TABLE_MAX_ENTRIES, STATUS_QUOTA_EXCEEDED);
+
+        // The path buffer is allocated right after the entry.
+        NT_IF_FAIL_LEAVE(LcAllocateNonPagedBuffer((PVOID*)&entry, sizeof(ACCESS_TABLE_ENTRY) + Path->Length));
+
+        entry->Hash               = hash;
+        entry->Path.Buffer        = (PWCH)(entry + 1);
+        entry->Path.Length        = Path->Length;
+        entry->Path.MaximumLength = Path->Length;
+        entry->AccessCount        = 1;
+        entry->FirstAccessTime    = accessTime.QuadPart;
+        entry->LastAccessTime     = accessTime.QuadPart;
+
+        RtlCopyMemory(entry->Path.Buffer, Path->Buffer, Path->Length);
+
+        InsertHeadList(&AccessTableBuckets[hash & (ACCESS_TABLE_BUCKETS - 1)], &entry->BucketListEntry);
+        InsertTailList(&AccessTableList, &entry->ListEntry);
+        AccessTableSize++;
+    }
+    __finally
+    {
+        FltReleaseResource(AccessTableResource);
+
+        if (!NT_SUCCESS(status))
+        {
+            InterlockedIncrement64(&AccessTableDropped);
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcDrainAccessTable(
+    _Out_writes_bytes_to_(BufferSize, *BytesWritten) PVOID  Buffer,
+    _In_                                             ULONG  BufferSize,
+    _Out_                                            PULONG BytesWritten
+    )
+/*++
+
+Summary:
+
+    This function moves the oldest table entries to the 'Buffer' given in
+    the 'FILE_ACCESSES' format.
+
+    Entries that fit into the 'Buffer' are removed from the table under the lock,
+    and they are written to the 'Buffer' after the lock is released, so a slow or
+    faulting user-mode buffer doesn't block the operation callbacks.
+    If the 'Buffer' is too small to contain all of them, the rest are left for the next call.
+
+    The 'Buffer' may be a user-mode buffer, so the caller should protect
+    the call with an exception handler. If the 'Buffer' becomes invalid, the entries
+    removed are counted as dropped.
+
+Arguments:
+
+    Buffer       - Buffer to write the entries to.
+
+    BufferSize   - Size of the 'Buffer', in bytes.
+
+    BytesWritten - Amount of bytes written to the 'Buffer'.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS            status         = STATUS_SUCCESS;
+    PFILE_ACCESSES      accesses       = (PFILE_ACCESSES)Buffer;
+    PFILE_ACCESS_RECORD record         = NULL;
+    PACCESS_TABLE_ENTRY entry          = NULL;
+    LIST_ENTRY          drainedList    = { 0 };
+    PLIST_ENTRY         listEntry      = NULL;
+    ULONG               offset         = FIELD_OFFSET(FILE_ACCESSES, Data);
+    ULONG               recordSize     = 0;
+    ULONG               recordCount    = 0;
+    ULONG               remainingCount = 0;
+    LONGLONG            droppedCount   = 0;
+    BOOLEAN             written        = FALSE;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Buffer != NULL,                      STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(BufferSize >= sizeof(FILE_ACCESSES), STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT(BytesWritten != NULL,                STATUS_INVALID_PARAMETER_3);
+
+    *BytesWritten = 0;
+
+    InitializeListHead(&drainedList);
+
+    // Move the entries that fit into the buffer to the local list.
+    FltAcquireResourceExclusive(AccessTableResource);
+
+    while (!IsListEmpty(&AccessTableList))
+    {
+        entry      = CONTAINING_RECORD(AccessTableList.Flink, ACCESS_TABLE_ENTRY, ListEntry);
+        recordSize = (ULONG)ALIGN_UP_BY(FIELD_OFFSET(FILE_ACCESS_RECORD, Path) + entry->Path.Length + sizeof(WCHAR), sizeof(LONGLONG));
+
+        // Stop, if the record doesn't fit into the buffer.
+        if (recordSize > BufferSize - offset)
+        {
+            break;
+        }
+
+        RemoveEntryList(&entry->BucketListEntry);
+        RemoveEntryList(&entry->ListEntry);
+        AccessTableSize--;
+
+        InsertTailList(&drainedList, &entry->ListEntry);
+
+        offset += recordSize;
+        recordCount++;
+    }
+
+    remainingCount = AccessTableSize;
+    droppedCount   = InterlockedExchange64(&AccessTableDropped, 0);
+
+    FltReleaseResource(AccessTableResource);
+
+    // The entries are not visible to other threads anymore, so they can be read without the lock.
+    __try
+    {
+        offset = FIELD_OFFSET(FILE_ACCESSES, Data);
+
+        for (listEntry = drainedList.Flink; listEntry != &drainedList; listEntry = listEntry->Flink)
+        {
+            entry      = CONTAINING_RECORD(listEntry, ACCESS_TABLE_ENTRY, ListEntry);
+            recordSize = (ULONG)ALIGN_UP_BY(FIELD_OFFSET(FILE_ACCESS_RECORD, Path) + entry->Path.Length + sizeof(WCHAR), sizeof(LONGLONG));
+
+            record                  = (PFILE_ACCESS_RECORD)Add2Ptr(Buffer, offset);
+            record->AccessCount     = entry->AccessCount;
+            record->FirstAccessTime = entry->FirstAccessTime;
+            record->LastAccessTime  = entry->LastAccessTime;
+            record->PathLength      = entry->Path.Length;
+
+            RtlCopyMemory(record->Path, entry->Path.Buffer, entry->Path.Length);
+            record->Path[entry->Path.Length / sizeof(WCHAR)] = UNICODE_NULL;
+
+            offset += recordSize;
+        }
+
+        accesses->RecordCount    = recordCount;
+        accesses->RemainingCount = remainingCount;
+        accesses->DroppedCount   = droppedCount;
+
+        *BytesWritten = offset;
+        written       = TRUE;
+    }
+    __finally
+    {
+        // Entries that were not delivered to the client are reported with the next drain.
+        if (!written)
+        {
+            InterlockedExchangeAdd64(&AccessTableDropped, droppedCount + recordCount);
+        }
+
+        while (!IsListEmpty(&drainedList))
+        {
+            entry = CONTAINING_RECORD(RemoveHeadList(&drainedList), ACCESS_TABLE_ENTRY, ListEntry);
+            LcFreeNonPagedBuffer(entry);
+        }
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+//  Local functions.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+PACCESS_TABLE_ENTRY
+LcFindAccessTableEntry(
+    _In_ PCUNICODE_STRING Path,
+    _In_ ULONG            Hash
+    )
+/*++
+
+Summary:
+
+    This function looks for the table entry with the 'Path' given.
+
+    The 'AccessTableResource' should be acquired by the caller.
+
+Arguments:
+
+    Path - Full path to the file.
+
+    Hash - Case-insensitive hash of the 'Path'.
+
+Return value:
+
+    Pointer to the entry found, or NULL.
+
+--*/
+{
+    PLIST_ENTRY         bucket    = NULL;
+    PLIST_ENTRY         listEntry = NULL;
+    PACCESS_TABLE_ENTRY entry     = NULL;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(Path != NULL);
+
+    bucket    = &AccessTableBuckets[Hash & (ACCESS_TABLE_BUCKETS - 1)];
+    listEntry = bucket->Flink;
+
+    while (listEntry != bucket)
+    {
+        entry = CONTAINING_RECORD(listEntry, ACCESS_TABLE_ENTRY, BucketListEntry);
+        if (entry->Hash == Hash && RtlEqualUnicodeString(Path, &entry->Path, TRUE))
+        {
+            return entry;
+        }
+
+        // Move to the next element.
+        listEntry = listEntry->Flink;
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+static
+VOID
+LcUpdateAccessTableEntry(
+    _In_ PACCESS_TABLE_ENTRY Entry,
+    _In_ LONGLONG            AccessTime
+    )
+/*++
+
+Summary:
+
+    This function increments the 'Entry' access count and updates its last access time.
+
+    The 'AccessTableResource' should be acquired by the caller.
+    Shared lock is enough, because the fields are updated with the interlocked operations.
+
+Arguments:
+
+    Entry      - Entry to be updated.
+
+    AccessTime - Access system time.
+
+Return value:
+
+    None.
+
+--*/
+{
+    LONGLONG lastAccessTime = 0;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(Entry != NULL);
+
+    InterlockedIncrement64(&Entry->AccessCount);
+
+    // Don't move the last access time back, if a concurrent thread has already set a newer value.
+    do
+    {
+        lastAccessTime = Entry->LastAccessTime;
+        if (lastAccessTime >= AccessTime)
+        {
+            break;
+        }
+    }
+    while (InterlockedCompareExchange64(&Entry->LastAccessTime, AccessTime, lastAccessTime) != lastAccessTime);
+}
+
+//------------------------------------------------------------------------
+
+static
+VOID
+LcDeleteAccessTableEntry(
+    _In_ PACCESS_TABLE_ENTRY Entry
+    )
+/*++
+
+Summary:
+
+    This function removes the 'Entry' from the table lists and frees it.
+
+    The 'AccessTableResource' should be exclusively acquired by the caller.
+
+Arguments:
+
+    Entry - Entry to be deleted.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    FLT_ASSERT(Entry != NULL);
+    FLT_ASSERT(AccessTableSize > 0);
+
+    RemoveEntryList(&Entry->BucketListEntry);
+    RemoveEntryList(&Entry->ListEntry);
+    AccessTableSize--;
+
+    LcFreeNonPagedBuffer(Entry);
+}
@@ -0,0 +1,73 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    AccessTable.h
+
+Abstract:
+
+    Contains the access table function declarations.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+#ifndef __LAZY_COPY_ACCESS_TABLE_H__
+#define __LAZY_COPY_ACCESS_TABLE_H__
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "Globals.h"
+
+//------------------------------------------------------------------------
+//  Access table function prototypes.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializeAccessTable();
+
+VOID
+LcFreeAccessTable();
+
+VOID
+LcRecordFileAccess(
+    _In_ PCUNICODE_STRING Path
+    );
+
+_Check_return_
+NTSTATUS
+LcDrainAccessTable(
+    _Out_writes_bytes_to_(BufferSize, *BytesWritten) PVOID  Buffer,
+    _In_                                             ULONG  BufferSize,
+    _Out_                                            PULONG BytesWritten
+    );
+
+#endif // __LAZY_COPY_ACCESS_TABLE_H__
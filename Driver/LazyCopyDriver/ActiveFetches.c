@@ -0,0 +1,449 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    ActiveFetches.c
+
+Abstract:
+
+    Contains the registry of the file fetches in flight.
+    The user-mode client can query it to see which files are being fetched,
+    how far each fetch has progressed, and how many threads are blocked on it.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "ActiveFetches.h"
+#include "CommunicationData.h"
+#include "FileLocks.h"
+#include "Utilities.h"
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+//
+// Contains information about a single fetch in flight.
+// Type names are declared in the 'ActiveFetches.h'.
+//
+struct _ACTIVE_FETCH
+{
+    // Paths to the local file and the remote one it's fetched from.
+    // Buffers are allocated together with the entry.
+    UNICODE_STRING      LocalPath;
+    UNICODE_STRING      RemotePath;
+
+    // Expected size of the file.
+    LONGLONG            FileSize;
+
+    // Amount of bytes written to the local file so far.
+    __volatile LONGLONG BytesCopied;
+
+    // System time the fetch was started at.
+    LONGLONG            StartTime;
+
+    // ID of the process, which access triggered the fetch.
+    ULONG               ProcessId;
+
+    // Whether the file is fetched by the user-mode client.
+    BOOLEAN             UserModeFetch;
+
+    // File lock owned by the fetching thread. Used to count the waiters.
+    PKEVENT             FileLock;
+
+    // List entry for the 'ActiveFetchesList'.
+    LIST_ENTRY          ListEntry;
+};
+
+//------------------------------------------------------------------------
+//  Text sections.
+//------------------------------------------------------------------------
+
+#ifdef ALLOC_PRAGMA
+    #pragma alloc_text(PAGE, LcInitializeActiveFetches)
+    #pragma alloc_text(PAGE, LcFreeActiveFetches)
+    #pragma alloc_text(PAGE, LcRegisterActiveFetch)
+    #pragma alloc_text(PAGE, LcUnregisterActiveFetch)
+    #pragma alloc_text(PAGE, LcQueryActiveFetches)
+#endif // ALLOC_PRAGMA
+
+//------------------------------------------------------------------------
+//  Global variables.
+//------------------------------------------------------------------------
+
+// Used to synchronize access to the 'ActiveFetchesList'.
+// Progress of the existing entries is updated without the lock.
+static PERESOURCE ActiveFetchesResource = NULL;
+
+// List to store the 'ACTIVE_FETCH' items.
+static LIST_ENTRY ActiveFetchesList     = { 0 };
+
+// Amount of entries in the 'ActiveFetchesList'.
+static ULONG      ActiveFetchesCount    = 0;
+
+//------------------------------------------------------------------------
+//  Active fetches functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializeActiveFetches()
+/*++
+
+Summary:
+
+    This function initializes objects used by the current module.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    InitializeListHead(&ActiveFetchesList);
+    ActiveFetchesCount = 0;
+
+    NT_IF_FAIL_RETURN(LcAllocateResource(&ActiveFetchesResource));
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcFreeActiveFetches()
+/*++
+
+Summary:
+
+    This function releases objects used by the current module.
+
+    It is not thread-safe, so it should only be called when the driver is about to be unloaded.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PLIST_ENTRY listEntry = NULL;
+
+    PAGED_CODE();
+
+    if (ActiveFetchesList.Flink != NULL)
+    {
+        // There should be no fetches in flight, when the driver is unloaded.
+        while ((listEntry = RemoveTailList(&ActiveFetchesList)) != &ActiveFetchesList)
+        {
+            LcFreeNonPagedBuffer(CONTAINING_RECORD(listEntry, ACTIVE_FETCH, ListEntry));
+        }
+    }
+
+    ActiveFetchesCount = 0;
+
+    if (ActiveFetchesResource != NULL)
+    {
+        LcFreeResource(ActiveFetchesResource);
+        ActiveFetchesResource = NULL;
+    }
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcRegisterActiveFetch(
+    _In_     PCUNICODE_STRING LocalPath,
+    _In_     PCUNICODE_STRING RemotePath,
+    _In_     LONGLONG         FileSize,
+    _In_     BOOLEAN          UserModeFetch,
+    _In_     PKEVENT          FileLock,
+    _Outptr_ PACTIVE_FETCH*   ActiveFetch
+    )
+/*++
+
+Summary:
+
+    This function adds a new entry describing the fetch, which is about to be
+    started by the current thread, to the registry.
+
+    The entry should be removed with the 'LcUnregisterActiveFetch' before
+    the 'FileLock' is released.
+
+Arguments:
+
+    LocalPath     - Path to the file being fetched.
+
+    RemotePath    - Path to the remote file the content is fetched from.
+
+    FileSize      - Expected size of the file.
+
+    UserModeFetch - Whether the file is fetched by the user-mode client.
+
+    FileLock      - File lock owned by the current thread.
+
+    ActiveFetch   - Pointer to a PACTIVE_FETCH variable that receives the entry created.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS      status    = STATUS_SUCCESS;
+    PACTIVE_FETCH entry     = NULL;
+    LARGE_INTEGER startTime = { 0 };
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(LocalPath   != NULL, STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(RemotePath  != NULL, STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT(FileLock    != NULL, STATUS_INVALID_PARAMETER_5);
+    IF_FALSE_RETURN_RESULT(ActiveFetch != NULL, STATUS_INVALID_PARAMETER_6);
+
+    // Both path buffers are allocated right after the entry.
+    NT_IF_FAIL_RETURN(LcAllocateNonPagedBuffer((PVOID*)&entry, sizeof(ACTIVE_FETCH) + LocalPath->Length + RemotePath->Length));
+
+    KeQuerySystemTime(&startTime);
+
+    entry->LocalPath.Buffer         = (PWCH)(entry + 1);
+    entry->LocalPath.Length         = LocalPath->Length;
+    entry->LocalPath.MaximumLength  = LocalPath->Length;
+    entry->RemotePath.Buffer        = (PWCH)Add2Ptr(entry->LocalPath.Buffer, LocalPath->Length);
+    entry->RemotePath.Length        = RemotePath->Length;
+    entry->RemotePath.MaximumLength = RemotePath->Length;
+    entry->FileSize                 = FileSize;
+    entry->BytesCopied              = 0;
+    entry->StartTime                = startTime.QuadPart;
+    entry->ProcessId                = HandleToULong(PsGetCurrentProcessId());
+    entry->UserModeFetch            = UserModeFetch;
+    entry->FileLock                 = FileLock;
+
+    RtlCopyMemory(entry->LocalPath.Buffer,  LocalPath->Buffer,  LocalPath->Length);
+    RtlCopyMemory(entry->RemotePath.Buffer, RemotePath->Buffer, RemotePath->Length);
+
+    FltAcquireResourceExclusive(ActiveFetchesResource);
+    InsertTailList(&ActiveFetchesList, &entry->ListEntry);
+    ActiveFetchesCount++;
+    FltReleaseResource(ActiveFetchesResource);
+
+    *ActiveFetch = entry;
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcUnregisterActiveFetch(
+    _In_ PACTIVE_FETCH ActiveFetch
+    )
+/*++
+
+Summary:
+
+    This function removes the entry created by the 'LcRegisterActiveFetch' from
+    the registry and frees it.
+
+Arguments:
+
+    ActiveFetch - Entry to be removed.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    IF_FALSE_RETURN(ActiveFetch != NULL);
+
+    FltAcquireResourceExclusive(ActiveFetchesResource);
+    RemoveEntryList(&ActiveFetch->ListEntry);
+    ActiveFetchesCount--;
+    FltReleaseResource(ActiveFetchesResource);
+
+    LcFreeNonPagedBuffer(ActiveFetch);
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcUpdateActiveFetchProgress(
+    _In_opt_ PACTIVE_FETCH ActiveFetch,
+    _In_     LONGLONG      BytesCopied
+    )
+/*++
+
+Summary:
+
+    This function sets the amount of bytes copied for the fetch given.
+
+    It's called by the fetching thread after every chunk written, so it doesn't
+    acquire the registry lock, and the entry is only freed by the same thread.
+
+Arguments:
+
+    ActiveFetch - Entry to be updated. If it's NULL, this function does nothing.
+
+    BytesCopied - Total amount of bytes written to the local file.
+
+Return value:
+
+    None.
+
+--*/
+{
+    if (ActiveFetch != NULL)
+    {
+        InterlockedExchange64(&ActiveFetch->BytesCopied, BytesCopied);
+    }
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcQueryActiveFetches(
+    _Out_writes_bytes_to_(BufferSize, *BytesWritten) PVOID  Buffer,
+    _In_                                             ULONG  BufferSize,
+    _Out_                                            PULONG BytesWritten
+    )
+/*++
+
+Summary:
+
+    This function writes the registry entries to the 'Buffer' given in
+    the 'ACTIVE_FETCHES' format, starting from the oldest fetch.
+
+    Entries are only read under the shared lock, so the query does not block
+    the fetches that are already in flight.
+
+    The 'Buffer' may be a user-mode buffer, so the caller should protect
+    the call with an exception handler.
+
+Arguments:
+
+    Buffer       - Buffer to write the entries to.
+
+    BufferSize   - Size of the 'Buffer', in bytes.
+
+    BytesWritten - Amount of bytes written to the 'Buffer'.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS             status         = STATUS_SUCCESS;
+    PACTIVE_FETCHES      fetches        = (PACTIVE_FETCHES)Buffer;
+    PACTIVE_FETCH_RECORD record         = NULL;
+    PACTIVE_FETCH        entry          = NULL;
+    PLIST_ENTRY          listEntry      = NULL;
+    LARGE_INTEGER        collectionTime = { 0 };
+    ULONG                offset         = FIELD_OFFSET(ACTIVE_FETCHES, Data);
+    ULONG                recordSize     = 0;
+    ULONG                recordCount    = 0;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Buffer != NULL,                       STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(BufferSize >= sizeof(ACTIVE_FETCHES), STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT(BytesWritten != NULL,                 STATUS_INVALID_PARAMETER_3);
+
+    *BytesWritten = 0;
+
+    KeQuerySystemTime(&collectionTime);
+
+    FltAcquireResourceShared(ActiveFetchesResource);
+
+    __try
+    {
+        for (listEntry = ActiveFetchesList.Flink; listEntry != &ActiveFetchesList; listEntry = listEntry->Flink)
+        {
+            entry      = CONTAINING_RECORD(listEntry, ACTIVE_FETCH, ListEntry);
+            recordSize = (ULONG)ALIGN_UP_BY(FIELD_OFFSET(ACTIVE_FETCH_RECORD, Data) + entry->LocalPath.Length + entry->RemotePath.Length + 2 * sizeof(WCHAR), sizeof(LONGLONG));
+
+            // Stop, if the record doesn't fit into the buffer.
+            if (recordSize > BufferSize - offset)
+            {
+                break;
+            }
+
+            record                   = (PACTIVE_FETCH_RECORD)Add2Ptr(Buffer, offset);
+            record->FileSize         = entry->FileSize;
+            record->BytesCopied      = entry->BytesCopied;
+            record->StartTime        = entry->StartTime;
+            record->ProcessId        = entry->ProcessId;
+            record->WaiterCount      = LcGetFileLockWaiterCount(entry->FileLock);
+            record->UserModeFetch    = entry->UserModeFetch;
+            record->LocalPathLength  = entry->LocalPath.Length;
+            record->RemotePathLength = entry->RemotePath.Length;
+
+            RtlCopyMemory(record->Data, entry->LocalPath.Buffer, entry->LocalPath.Length);
+            record->Data[entry->LocalPath.Length / sizeof(WCHAR)] = UNICODE_NULL;
+
+            RtlCopyMemory(&record->Data[entry->LocalPath.Length / sizeof(WCHAR) + 1], entry->RemotePath.Buffer, entry->RemotePath.Length);
+            record->Data[(entry->LocalPath.Length + entry->RemotePath.Length) / sizeof(WCHAR) + 1] = UNICODE_NULL;
+
+            offset += recordSize;
+            recordCount++;
+        }
+
+        fetches->RecordCount    = recordCount;
+        fetches->RemainingCount = ActiveFetchesCount - recordCount;
+        fetches->CollectionTime = collectionTime.QuadPart;
+
+        *BytesWritten = offset;
+    }
+    __finally
+    {
+        FltReleaseResource(ActiveFetchesResource);
+    }
+
+    return status;
+}
@@ -0,0 +1,100 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    ActiveFetches.h
+
+Abstract:
+
+    Contains the active fetches registry function declarations.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+#ifndef __LAZY_COPY_ACTIVE_FETCHES_H__
+#define __LAZY_COPY_ACTIVE_FETCHES_H__
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "Globals.h"
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+//
+// Registry entry describing a single fetch in flight. Defined in the 'ActiveFetches.c'.
+//
+typedef struct _ACTIVE_FETCH ACTIVE_FETCH, *PACTIVE_FETCH;
+
+//------------------------------------------------------------------------
+//  Active fetches function prototypes.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializeActiveFetches();
+
+VOID
+LcFreeActiveFetches();
+
+_Check_return_
+NTSTATUS
+LcRegisterActiveFetch(
+    _In_     PCUNICODE_STRING LocalPath,
+    _In_     PCUNICODE_STRING RemotePath,
+    _In_     LONGLONG         FileSize,
+    _In_     BOOLEAN          UserModeFetch,
+    _In_     PKEVENT          FileLock,
+    _Outptr_ PACTIVE_FETCH*   ActiveFetch
+    );
+
+VOID
+LcUnregisterActiveFetch(
+    _In_ PACTIVE_FETCH ActiveFetch
+    );
+
+VOID
+LcUpdateActiveFetchProgress(
+    _In_opt_ PACTIVE_FETCH ActiveFetch,
+    _In_     LONGLONG      BytesCopied
+    );
+
+_Check_return_
+NTSTATUS
+LcQueryActiveFetches(
+    _Out_writes_bytes_to_(BufferSize, *BytesWritten) PVOID  Buffer,
+    _In_                                             ULONG  BufferSize,
+    _Out_                                            PULONG BytesWritten
+    );
+
+#endif // __LAZY_COPY_ACTIVE_FETCHES_H__
@@ -0,0 +1,471 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    ClientConnections.c
+
+Abstract:
+
+    Contains the table of the user-mode client connections.
+
+    Notifications are sent via the connection with the least amount of
+    outstanding requests, so several service processes (or several connections
+    opened by the same one) share the load.
+
+    Each connection serves a set of notification lanes, so the latency-sensitive
+    requests are not queued behind the bulk ones.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "ClientConnections.h"
+#include "Configuration.h"
+#include "NotificationRing.h"
+#include "Utilities.h"
+
+//------------------------------------------------------------------------
+//  Text sections.
+//------------------------------------------------------------------------
+
+#ifdef ALLOC_PRAGMA
+    #pragma alloc_text(PAGE, LcInitializeClientConnections)
+    #pragma alloc_text(PAGE, LcFreeClientConnections)
+    #pragma alloc_text(PAGE, LcAddClientConnection)
+    #pragma alloc_text(PAGE, LcRemoveClientConnection)
+    #pragma alloc_text(PAGE, LcAcquireClientConnection)
+    #pragma alloc_text(PAGE, LcReleaseClientConnection)
+    #pragma alloc_text(PAGE, LcReferenceClientProcess)
+#endif // ALLOC_PRAGMA
+
+//------------------------------------------------------------------------
+//  Global variables.
+//------------------------------------------------------------------------
+
+// Used to synchronize access to the 'ClientConnections'.
+// Outstanding request counters are updated without the lock.
+static PERESOURCE         ClientConnectionsResource                 = NULL;
+
+// Connections currently open. Empty slots are NULL.
+static PCLIENT_CONNECTION ClientConnections[MAX_CLIENT_CONNECTIONS] = { 0 };
+
+//------------------------------------------------------------------------
+//  Client connections functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializeClientConnections()
+/*++
+
+Summary:
+
+    This function initializes objects used by the current module.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    RtlZeroMemory(ClientConnections, sizeof(ClientConnections));
+
+    NT_IF_FAIL_RETURN(LcAllocateResource(&ClientConnectionsResource));
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcFreeClientConnections()
+/*++
+
+Summary:
+
+    This function releases objects used by the current module.
+
+    It is not thread-safe, so it should only be called when the driver is about to be unloaded,
+    and all client ports are closed.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    None.
+
+--*/
+{
+    ULONG index = 0;
+
+    PAGED_CODE();
+
+    // Filter manager invokes the disconnect callbacks before the filter is unregistered,
+    // so the table should be empty at this point.
+    for (index = 0; index < MAX_CLIENT_CONNECTIONS; index++)
+    {
+        FLT_ASSERT(ClientConnections[index] == NULL);
+    }
+
+    if (ClientConnectionsResource != NULL)
+    {
+        LcFreeResource(ClientConnectionsResource);
+        ClientConnectionsResource = NULL;
+    }
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcAddClientConnection(
+    _In_     PFLT_PORT           Port,
+    _In_     ULONG               LaneMask,
+    _Outptr_ PCLIENT_CONNECTION* Connection
+    )
+/*++
+
+Summary:
+
+    This function adds the client port given to the connections table.
+
+    It should be called in the context of the client process, when it connects to the port.
+    The process is added to the list of trusted ones.
+
+Arguments:
+
+    Port       - Client connection port.
+
+    LaneMask   - Lanes the connection receives notifications for.
+
+    Connection - Pointer to a PCLIENT_CONNECTION variable that receives the connection created.
+                 It should be removed with the 'LcRemoveClientConnection', when the port is disconnected.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS           status     = STATUS_SUCCESS;
+    PCLIENT_CONNECTION connection = NULL;
+    ULONG              index      = 0;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Port != NULL,                                                   STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(LaneMask != 0 && (LaneMask & ~ALL_NOTIFICATION_LANES) == 0, STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT(Connection != NULL,                                             STATUS_INVALID_PARAMETER_3);
+
+    NT_IF_FAIL_RETURN(LcAllocateNonPagedBuffer((PVOID*)&connection, sizeof(CLIENT_CONNECTION)));
+
+    connection->Port                = Port;
+    connection->Process             = PsGetCurrentProcess();
+    connection->ProcessId           = PsGetCurrentProcessId();
+    connection->LaneMask            = LaneMask;
+    connection->OutstandingRequests = 0;
+
+    ObReferenceObject(connection->Process);
+    ExInitializeRundownProtection(&connection->Rundown);
+
+    FltAcquireResourceExclusive(ClientConnectionsResource);
+
+    __try
+    {
+        // We trust the client process. It's a no-op, if the process has another connection open.
+        NT_IF_FAIL_LEAVE(LcAddTrustedProcess(connection->ProcessId));
+
+        // The server port doesn't accept more than 'MAX_CLIENT_CONNECTIONS', so there should always be a free slot.
+        for (index = 0; index < MAX_CLIENT_CONNECTIONS && ClientConnections[index] != NULL; index++);
+        NT_IF_FALSE_LEAVE(index < MAX_CLIENT_CONNECTIONS, STATUS_CONNECTION_COUNT_LIMIT);
+
+        ClientConnections[index] = connection;
+        *Connection              = connection;
+    }
+    __finally
+    {
+        FltReleaseResource(ClientConnectionsResource);
+
+        if (!NT_SUCCESS(status))
+        {
+            ObDereferenceObject(connection->Process);
+            LcFreeNonPagedBuffer(connection);
+        }
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcRemoveClientConnection(
+    _In_ PCLIENT_CONNECTION Connection
+    )
+/*++
+
+Summary:
+
+    This function removes the connection from the table, closes its port and frees it.
+
+    Threads sending notifications via this connection are released with the STATUS_PORT_DISCONNECTED,
+    so they can resend them via another one.
+
+    If it's the last connection of the client process, the notification ring is unmapped from
+    that process, and it's removed from the list of trusted ones.
+
+Arguments:
+
+    Connection - Connection to be removed.
+
+Return value:
+
+    None.
+
+--*/
+{
+    ULONG   index         = 0;
+    BOOLEAN lastOfProcess = TRUE;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN(Connection != NULL);
+
+    FltAcquireResourceExclusive(ClientConnectionsResource);
+
+    for (index = 0; index < MAX_CLIENT_CONNECTIONS; index++)
+    {
+        if (ClientConnections[index] == Connection)
+        {
+            ClientConnections[index] = NULL;
+        }
+        else if (ClientConnections[index] != NULL && ClientConnections[index]->Process == Connection->Process)
+        {
+            lastOfProcess = FALSE;
+        }
+    }
+
+    if (lastOfProcess)
+    {
+        // Release the threads waiting for the ring replies, and unmap it while we're still in the client process context.
+        LcUnmapNotificationRing(Connection->Process);
+        LcRemoveTrustedProcess(Connection->ProcessId);
+    }
+
+    FltReleaseResource(ClientConnectionsResource);
+
+    // Close the connection handle. This will set the 'Port' to NULL, and the pending 'FltSendMessage' calls will fail.
+    FltCloseClientPort(Globals.Filter, &Connection->Port);
+
+    // Wait for the senders to stop using the connection.
+    ExWaitForRundownProtectionRelease(&Connection->Rundown);
+
+    ObDereferenceObject(Connection->Process);
+    LcFreeNonPagedBuffer(Connection);
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcAcquireClientConnection(
+    _In_     NOTIFICATION_LANE   Lane,
+    _In_opt_ PEPROCESS           TargetProcess,
+    _Outptr_ PCLIENT_CONNECTION* Connection
+    )
+/*++
+
+Summary:
+
+    This function finds the connection serving the 'Lane' with the least amount of
+    outstanding requests, and acquires it for sending a notification.
+
+    If none of the connections serve the 'Lane', the other ones are used, so the
+    notification is not lost.
+
+    The connection acquired should be released with the 'LcReleaseClientConnection'.
+
+Arguments:
+
+    Lane          - Lane the notification is sent through.
+
+    TargetProcess - If set, only the connections opened by this process are considered.
+
+    Connection    - Pointer to a PCLIENT_CONNECTION variable that receives the connection acquired.
+
+Return value:
+
+    STATUS_PORT_DISCONNECTED - There are no suitable connections.
+
+    Any other value is the status of the operation.
+
+--*/
+{
+    PCLIENT_CONNECTION connection      = NULL;
+    PCLIENT_CONNECTION candidate       = NULL;
+    BOOLEAN            inLane          = FALSE;
+    BOOLEAN            candidateInLane = FALSE;
+    ULONG              index           = 0;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Lane < NotificationLaneCount, STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(Connection != NULL,           STATUS_INVALID_PARAMETER_3);
+
+    FltAcquireResourceShared(ClientConnectionsResource);
+
+    for (index = 0; index < MAX_CLIENT_CONNECTIONS; index++)
+    {
+        candidate = ClientConnections[index];
+        if (candidate == NULL || (TargetProcess != NULL && candidate->Process != TargetProcess))
+        {
+            continue;
+        }
+
+        // Connections serving the lane always win over the other ones.
+        candidateInLane = BooleanFlagOn(candidate->LaneMask, 1UL << Lane);
+
+        if (connection == NULL
+            || (candidateInLane && !inLane)
+            || (candidateInLane == inLane && candidate->OutstandingRequests < connection->OutstandingRequests))
+        {
+            connection = candidate;
+            inLane     = candidateInLane;
+        }
+    }
+
+    // Connections are removed from the table before their rundown is waited for,
+    // so the acquisition only fails, if the table is corrupted.
+    if (connection != NULL && ExAcquireRundownProtection(&connection->Rundown))
+    {
+        InterlockedIncrement(&connection->OutstandingRequests);
+    }
+    else
+    {
+        connection = NULL;
+    }
+
+    FltReleaseResource(ClientConnectionsResource);
+
+    IF_FALSE_RETURN_RESULT(connection != NULL, STATUS_PORT_DISCONNECTED);
+
+    *Connection = connection;
+
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcReleaseClientConnection(
+    _In_ PCLIENT_CONNECTION Connection
+    )
+/*++
+
+Summary:
+
+    This function releases the connection acquired by the 'LcAcquireClientConnection'.
+
+Arguments:
+
+    Connection - Connection to be released.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    IF_FALSE_RETURN(Connection != NULL);
+
+    InterlockedDecrement(&Connection->OutstandingRequests);
+    ExReleaseRundownProtection(&Connection->Rundown);
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcReferenceClientProcess(
+    _In_     NOTIFICATION_LANE Lane,
+    _Outptr_ PEPROCESS*        Process
+    )
+/*++
+
+Summary:
+
+    This function references the process that opened the least loaded connection
+    serving the 'Lane', so the notification data can be prepared for it, before the
+    notification is sent with the 'TargetProcess' set.
+
+    The process returned should be dereferenced with the 'ObDereferenceObject'.
+
+Arguments:
+
+    Lane    - Lane the notification will be sent through.
+
+    Process - Pointer to a PEPROCESS variable that receives the referenced client process.
+
+Return value:
+
+    STATUS_PORT_DISCONNECTED - There are no clients connected.
+
+    Any other value is the status of the operation.
+
+--*/
+{
+    PCLIENT_CONNECTION connection = NULL;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Process != NULL, STATUS_INVALID_PARAMETER_2);
+
+    NT_IF_FAIL_RETURN(LcAcquireClientConnection(Lane, NULL, &connection));
+
+    ObReferenceObject(connection->Process);
+    *Process = connection->Process;
+
+    LcReleaseClientConnection(connection);
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,130 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    ClientConnections.h
+
+Abstract:
+
+    Contains the user-mode client connections table function declarations.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+#ifndef __LAZY_COPY_CLIENT_CONNECTIONS_H__
+#define __LAZY_COPY_CLIENT_CONNECTIONS_H__
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "Globals.h"
+#include "CommunicationData.h"
+
+//------------------------------------------------------------------------
+//  Defines.
+//------------------------------------------------------------------------
+
+// Maximum amount of simultaneous user-mode client connections.
+#define MAX_CLIENT_CONNECTIONS  8
+
+// Lane mask of the connections serving all lanes.
+#define ALL_NOTIFICATION_LANES  ((1UL << NotificationLaneCount) - 1)
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+//
+// Describes a single user-mode client connection.
+//
+typedef struct _CLIENT_CONNECTION
+{
+    // Client port used to send notifications to.
+    PFLT_PORT       Port;
+
+    // Process that opened the connection. Referenced.
+    PEPROCESS       Process;
+    HANDLE          ProcessId;
+
+    // Lanes the connection receives notifications for. See the 'CLIENT_CONNECTION_CONTEXT'.
+    ULONG           LaneMask;
+
+    // Amount of notifications sent via this connection, which are not replied yet.
+    __volatile LONG OutstandingRequests;
+
+    // Prevents the connection from being freed, while notifications are sent via it.
+    EX_RUNDOWN_REF  Rundown;
+} CLIENT_CONNECTION, *PCLIENT_CONNECTION;
+
+//------------------------------------------------------------------------
+//  Client connections function prototypes.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializeClientConnections();
+
+VOID
+LcFreeClientConnections();
+
+_Check_return_
+NTSTATUS
+LcAddClientConnection(
+    _In_     PFLT_PORT           Port,
+    _In_     ULONG               LaneMask,
+    _Outptr_ PCLIENT_CONNECTION* Connection
+    );
+
+VOID
+LcRemoveClientConnection(
+    _In_ PCLIENT_CONNECTION Connection
+    );
+
+_Check_return_
+NTSTATUS
+LcAcquireClientConnection(
+    _In_     NOTIFICATION_LANE   Lane,
+    _In_opt_ PEPROCESS           TargetProcess,
+    _Outptr_ PCLIENT_CONNECTION* Connection
+    );
+
+VOID
+LcReleaseClientConnection(
+    _In_ PCLIENT_CONNECTION Connection
+    );
+
+_Check_return_
+NTSTATUS
+LcReferenceClientProcess(
+    _In_     NOTIFICATION_LANE Lane,
+    _Outptr_ PEPROCESS*        Process
+    );
+
+#endif // __LAZY_COPY_CLIENT_CONNECTIONS_H__
@@ -41,8 +41,14 @@ Environment:
 //------------------------------------------------------------------------
 
 #include "Communication.h"
+#include "AccessTable.h"
+#include "ActiveFetches.h"
+#include "ClientConnections.h"
 #include "CommunicationData.h"
 #include "Configuration.h"
+#include "LazyCopyDriver.h"
+#include "NotificationRing.h"
+#include "Statistics.h"
 #include "Utilities.h"
 
 //------------------------------------------------------------------------
@@ -52,6 +58,12 @@ Environment:
 // Communication port name.
 #define DEFAULT_PORT_NAME  L"\\LazyCopyDriverPort"
 
+// Name of the port used by the monitoring tools.
+#define MONITOR_PORT_NAME  L"\\LazyCopyDriverMonitorPort"
+
+// Maximum amount of simultaneous monitor port connections.
+#define MONITOR_PORT_MAX_CONNECTIONS  4
+
 //------------------------------------------------------------------------
 //  Local types.
 //------------------------------------------------------------------------
@@ -74,20 +86,15 @@ NTSTATUS
 //  Local variables.
 //------------------------------------------------------------------------
 
-// User-mode client process Id.
-static __volatile HANDLE    ClientProcessId     = NULL;
-
-// User-mode client process handle.
-static __volatile HANDLE    ClientProcessHandle = NULL;
-
 // Handle to the system process.
 static __volatile HANDLE    SystemProcessHandle = NULL;
 
 // Server port that listens for incoming connections.
+// Client ports are stored in the connections table.
 static __volatile PFLT_PORT ServerPort          = NULL;
 
-// Used to send notifications to the user-mode client.
-static __volatile PFLT_PORT ClientPort          = NULL;
+// Server port that listens for the monitoring tools connections.
+static __volatile PFLT_PORT MonitorPort         = NULL;
 
 //------------------------------------------------------------------------
 //  Local functions.
@@ -110,9 +117,22 @@ LcCommunicationPortDisconnect(
     _In_opt_ PVOID ConnectionCookie
     );
 
+static
+_Check_return_
+NTSTATUS
+LcMonitorPortConnect(
+    _In_                                PFLT_PORT Port,
+    _In_opt_                            PVOID     ServerPortCookie,
+    _In_reads_bytes_opt_(SizeOfContext) PVOID     ConnectionContext,
+    _In_                                ULONG     SizeOfContext,
+    _Outptr_result_maybenull_           PVOID*    ConnectionCookie
+    );
+
 static
 VOID
-LcResetConnectionVariables();
+LcMonitorPortDisconnect(
+    _In_opt_ PVOID ConnectionCookie
+    );
 
 static
 _Check_return_
@@ -126,6 +146,30 @@ LcClientMessageReceived(
     _Out_                                                                  PULONG ReturnOutputBufferLength
     );
 
+static
+_Check_return_
+NTSTATUS
+LcMonitorMessageReceived(
+    _In_                                                                   PVOID  ConnectionCookie,
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
+    );
+
+static
+_Check_return_
+NTSTATUS
+LcExecuteClientCommand(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID   InputBuffer,
+    _In_                                                                   ULONG   InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID   OutputBuffer,
+    _In_                                                                   ULONG   OutputBufferSize,
+    _Out_                                                                  PULONG  ReturnOutputBufferLength,
+    _In_                                                                   BOOLEAN QueryOnly
+    );
+
 static
 _Check_return_
 NTSTATUS
@@ -134,7 +178,12 @@ LcSendMessageToClient(
     _In_reads_bytes_(DataLength)                     PVOID                    Data,
     _In_                                             ULONG                    DataLength,
     _Inout_updates_bytes_all_opt_(ReplyBufferLength) PVOID                    ReplyBuffer,
-    _In_opt_                                         ULONG                    ReplyBufferLength
+    _In_opt_                                         ULONG                    ReplyBufferLength,
+    _In_opt_                                         PLARGE_INTEGER           Timeout,
+    _In_opt_                                         PKEVENT                  CancelEvent,
+    _In_opt_                                         PEPROCESS                TargetProcess,
+    _Outptr_opt_result_maybenull_                    PEPROCESS*               ReplyProcess,
+    _Out_opt_                                        PBOOLEAN                 Delivered
     );
 
 static
@@ -144,6 +193,23 @@ LcDriverExceptionFilter(
     _In_ BOOLEAN             AccessingUserBuffer
     );
 
+static
+_Check_return_
+NTSTATUS
+LcOpenFileForClient(
+    _In_  PCFLT_RELATED_OBJECTS FltObjects,
+    _In_  PCUNICODE_STRING      FileName,
+    _In_  PEPROCESS             ClientProcess,
+    _Out_ PHANDLE               Handle
+    );
+
+static
+VOID
+LcCloseClientHandle(
+    _In_ PEPROCESS ClientProcess,
+    _In_ HANDLE    Handle
+    );
+
 //------------------------------------------------------------------------
 //  Command handlers.
 //------------------------------------------------------------------------
@@ -203,6 +269,103 @@ LcSetReportRateHandler(
     _Out_                                                                  PULONG ReturnOutputBufferLength
     );
 
+static
+_Check_return_
+NTSTATUS
+LcSetVolumePolicyHandler(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
+    );
+
+static
+_Check_return_
+NTSTATUS
+LcApplyConfigurationHandler(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
+    );
+
+static
+_Check_return_
+NTSTATUS
+LcDrainFileAccessesHandler(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
+    );
+
+static
+_Check_return_
+NTSTATUS
+LcGetStatisticsHandler(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
+    );
+
+static
+_Check_return_
+NTSTATUS
+LcGetActiveFetchesHandler(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
+    );
+
+static
+_Check_return_
+NTSTATUS
+LcMapNotificationRingHandler(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
+    );
+
+static
+_Check_return_
+NTSTATUS
+LcCompleteRingNotificationsHandler(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
+    );
+
+//------------------------------------------------------------------------
+//  Command data parsing functions.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcLoadWatchPaths(
+    _In_ PWATCH_PATHS WatchPaths,
+    _In_ ULONG_PTR    BufferEnd
+    );
+
+static
+_Check_return_
+NTSTATUS
+LcLoadVolumePolicy(
+    _In_ PVOLUME_POLICY VolumePolicy,
+    _In_ ULONG_PTR      BufferEnd
+    );
+
 //------------------------------------------------------------------------
 //  Additional validation functions.
 //------------------------------------------------------------------------
@@ -214,6 +377,14 @@ LcValidateBufferAlignment(
     _In_ PVOID Buffer
     );
 
+static
+_Check_return_
+NTSTATUS
+LcValidateConfigurationOffset(
+    _In_ ULONG Offset,
+    _In_ ULONG BufferSize
+    );
+
 //------------------------------------------------------------------------
 //  Text sections.
 //------------------------------------------------------------------------
@@ -230,10 +401,15 @@ LcValidateBufferAlignment(
     // Local functions.
     #pragma alloc_text(PAGE, LcCommunicationPortConnect)
     #pragma alloc_text(PAGE, LcCommunicationPortDisconnect)
-    #pragma alloc_text(PAGE, LcResetConnectionVariables)
+    #pragma alloc_text(PAGE, LcMonitorPortConnect)
+    #pragma alloc_text(PAGE, LcMonitorPortDisconnect)
     #pragma alloc_text(PAGE, LcClientMessageReceived)
+    #pragma alloc_text(PAGE, LcMonitorMessageReceived)
+    #pragma alloc_text(PAGE, LcExecuteClientCommand)
     #pragma alloc_text(PAGE, LcSendMessageToClient)
     #pragma alloc_text(PAGE, LcDriverExceptionFilter)
+    #pragma alloc_text(PAGE, LcOpenFileForClient)
+    #pragma alloc_text(PAGE, LcCloseClientHandle)
 
     // Command handlers.
     #pragma alloc_text(PAGE, LcGetDriverVersionHandler)
@@ -241,9 +417,21 @@ LcValidateBufferAlignment(
     #pragma alloc_text(PAGE, LcSetOperationModeHandler)
     #pragma alloc_text(PAGE, LcSetWatchPathsHandler)
     #pragma alloc_text(PAGE, LcSetReportRateHandler)
+    #pragma alloc_text(PAGE, LcSetVolumePolicyHandler)
+    #pragma alloc_text(PAGE, LcApplyConfigurationHandler)
+    #pragma alloc_text(PAGE, LcDrainFileAccessesHandler)
+    #pragma alloc_text(PAGE, LcGetStatisticsHandler)
+    #pragma alloc_text(PAGE, LcGetActiveFetchesHandler)
+    #pragma alloc_text(PAGE, LcMapNotificationRingHandler)
+    #pragma alloc_text(PAGE, LcCompleteRingNotificationsHandler)
+
+    // Command data parsing functions.
+    #pragma alloc_text(PAGE, LcLoadWatchPaths)
+    #pragma alloc_text(PAGE, LcLoadVolumePolicy)
 
     // Additional validation functions.
     #pragma alloc_text(PAGE, LcValidateBufferAlignment)
+    #pragma alloc_text(PAGE, LcValidateConfigurationOffset)
 #endif // ALLOC_PRAGMA
 
 //------------------------------------------------------------------------
@@ -263,7 +451,11 @@ Summary:
     In order to use the port created, client must be running with the
     SYSTEM or ADMIN privileges.
 
-    Only one simultaneous clientv connection is allowed.
+    Up to 'MAX_CLIENT_CONNECTIONS' simultaneous client connections are allowed,
+    and notifications are distributed between them.
+
+    Another port is created for the monitoring tools. It only accepts the commands
+    that query the driver state, so they can be used while the client is connected.
 
 Arguments:
 
@@ -284,6 +476,16 @@ Return value:
 
     __try
     {
+        // Handles received from the clients are duplicated into the system process.
+        NT_IF_FAIL_LEAVE(ObOpenObjectByPointer(
+            PsInitialSystemProcess,
+            OBJ_KERNEL_HANDLE,
+            NULL,
+            STANDARD_RIGHTS_READ,
+            NULL,
+            KernelMode,
+            (PHANDLE)&SystemProcessHandle));
+
         // Initialize the port name string.
         NT_IF_FAIL_LEAVE(RtlInitUnicodeStringEx(&portName, DEFAULT_PORT_NAME));
 
@@ -309,7 +511,21 @@ Return value:
                 LcCommunicationPortDisconnect,
             (PFLT_MESSAGE_NOTIFY)                      // [in] Message notification callback function.
                 LcClientMessageReceived,
-            1));                                       // [in] Maximum number of simultaneous client connections allowed.
+            MAX_CLIENT_CONNECTIONS));                  // [in] Maximum number of simultaneous client connections allowed.
+
+        // The monitor port uses the same security descriptor.
+        NT_IF_FAIL_LEAVE(RtlInitUnicodeStringEx(&portName, MONITOR_PORT_NAME));
+        InitializeObjectAttributes(&objectAttributes, &portName, OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE, NULL, securityDescriptor);
+
+        NT_IF_FAIL_LEAVE(FltCreateCommunicationPort(
+            Globals.Filter,
+            &MonitorPort,
+            &objectAttributes,
+            NULL,
+            (PFLT_CONNECT_NOTIFY)LcMonitorPortConnect,
+            (PFLT_DISCONNECT_NOTIFY)LcMonitorPortDisconnect,
+            (PFLT_MESSAGE_NOTIFY)LcMonitorMessageReceived,
+            MONITOR_PORT_MAX_CONNECTIONS));
 
         LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Communication port created\n"));
     }
@@ -360,6 +576,18 @@ Return value:
         ServerPort = NULL;
     }
 
+    if (MonitorPort != NULL)
+    {
+        FltCloseCommunicationPort(MonitorPort);
+        MonitorPort = NULL;
+    }
+
+    if (SystemProcessHandle != NULL)
+    {
+        ZwClose(SystemProcessHandle);
+        SystemProcessHandle = NULL;
+    }
+
     LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Communication port closed\n"));
 }
 
@@ -378,6 +606,9 @@ Summary:
 
     This function asks user-mode client to open the file.
 
+    The handle is duplicated from the process that replied, so the close notification
+    is sent to the same process.
+
 Arguments:
 
     SourceFile - Path to the file to open.
@@ -392,9 +623,11 @@ Return value:
 
 --*/
 {
-    NTSTATUS                      status = STATUS_SUCCESS;
-    PFILE_OPEN_NOTIFICATION_DATA  data   = NULL;
-    PFILE_OPEN_NOTIFICATION_REPLY reply  = NULL;
+    NTSTATUS                      status        = STATUS_SUCCESS;
+    PFILE_OPEN_NOTIFICATION_DATA  data          = NULL;
+    PFILE_OPEN_NOTIFICATION_REPLY reply         = NULL;
+    PEPROCESS                     clientProcess = NULL;
+    HANDLE                        processHandle = NULL;
 
     PAGED_CODE();
 
@@ -420,14 +653,23 @@ Return value:
         // NOTE: 'data->Data' is WCHAR*, not BYTE*.
         RtlCopyMemory(data->Data + (SourceFile->Length / sizeof(WCHAR)) + 1, TargetFile->Buffer, TargetFile->Length);
 
-        NT_IF_FAIL_LEAVE(LcSendMessageToClient(OpenFileInUserMode, data, dataSize, reply, replySize));
+        NT_IF_FAIL_LEAVE(LcSendMessageToClient(OpenFileInUserMode, data, dataSize, reply, replySize, NULL, NULL, NULL, &clientProcess, NULL));
 
         //
         // Duplicate the file handle received.
         //
 
+        NT_IF_FAIL_LEAVE(ObOpenObjectByPointer(
+            clientProcess,
+            OBJ_KERNEL_HANDLE,
+            NULL,
+            PROCESS_DUP_HANDLE,
+            *PsProcessType,
+            KernelMode,
+            &processHandle));
+
         NT_IF_FAIL_LEAVE(ZwDuplicateObject(
-            ClientProcessHandle,
+            processHandle,
             reply->FileHandle,
             SystemProcessHandle,
             Handle,
@@ -444,14 +686,24 @@ Return value:
 
         if (reply != NULL)
         {
-            if (reply->FileHandle != NULL)
+            if (reply->FileHandle != NULL && clientProcess != NULL)
             {
                 #pragma warning(suppress: __WARNING_RETVAL_IGNORED_FUNC_COULD_FAIL) // Ignore the return value here.
-                LcCloseFileHandle(reply->FileHandle);
+                LcCloseFileHandle(clientProcess, reply->FileHandle);
             }
 
             LcFreeBuffer(reply, LC_COMMUNICATION_NON_PAGED_POOL_TAG);
         }
+
+        if (processHandle != NULL)
+        {
+            ZwClose(processHandle);
+        }
+
+        if (clientProcess != NULL)
+        {
+            ObDereferenceObject(clientProcess);
+        }
     }
 
     return status;
@@ -462,7 +714,8 @@ Return value:
 _Check_return_
 NTSTATUS
 LcCloseFileHandle(
-    _In_  HANDLE FileHandle
+    _In_ PEPROCESS ClientProcess,
+    _In_ HANDLE    FileHandle
     )
 /*++
 
@@ -473,7 +726,9 @@ Summary:
 
 Arguments:
 
-    FileHandle - Handle to be closed.
+    ClientProcess - Client process the 'FileHandle' belongs to.
+
+    FileHandle    - Handle to be closed.
 
 Return value:
 
@@ -486,7 +741,8 @@ Return value:
 
     PAGED_CODE();
 
-    IF_FALSE_RETURN_RESULT(FileHandle != NULL, STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(ClientProcess != NULL, STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(FileHandle    != NULL, STATUS_INVALID_PARAMETER_2);
 
     LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Sending close notification for handle: %p\n", FileHandle));
 
@@ -496,7 +752,7 @@ Return value:
         NT_IF_FAIL_LEAVE(LcAllocateBuffer((PVOID*)&data, NonPagedPoolNx, dataSize, LC_COMMUNICATION_NON_PAGED_POOL_TAG));
         data->FileHandle = FileHandle;
 
-        NT_IF_FAIL_LEAVE(LcSendMessageToClient(CloseFileHandle, data, dataSize, NULL, 0));
+        NT_IF_FAIL_LEAVE(LcSendMessageToClient(CloseFileHandle, data, dataSize, NULL, 0, NULL, NULL, ClientProcess, NULL, NULL));
     }
     __finally
     {
@@ -514,9 +770,11 @@ Return value:
 _Check_return_
 NTSTATUS
 LcFetchFileInUserMode(
-    _In_  PCUNICODE_STRING SourceFile,
-    _In_  PCUNICODE_STRING TargetFile,
-    _Out_ PLARGE_INTEGER   BytesCopied
+    _In_     PCFLT_RELATED_OBJECTS FltObjects,
+    _In_     PCUNICODE_STRING      SourceFile,
+    _In_     PCUNICODE_STRING      TargetFile,
+    _In_opt_ PKEVENT               CancelEvent,
+    _Out_    PLARGE_INTEGER        BytesCopied
     )
 /*++
 
@@ -524,12 +782,25 @@ Summary:
 
     This function asks the user-mode client to copy the original file to the local/target file.
 
+    The client receives a handle to the target file opened for writing, so it streams the
+    content directly into it. Once the notification is delivered, the client owns the handle
+    and closes it, when the fetch is finished, even if the driver has stopped waiting for the
+    reply. The driver only closes the handle, if the client has never received it.
+
+    The client is given the 'Configuration.UserModeFetchTimeout' time to reply.
+
 Arguments:
 
+    FltObjects  - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                  opaque handles to this filter, instance, its associated volume and
+                  file object.
+
     SourceFile  - Path to the file to fetch content from.
 
     TargetFile  - Path to the file to store content to.
 
+    CancelEvent - Event signaled, when the fetch is no longer needed. Optional.
+
     BytesCopied - The amount of bytes copied.
 
 Return value:
@@ -538,16 +809,26 @@ Return value:
 
 --*/
 {
-    NTSTATUS                       status      = STATUS_SUCCESS;
-    LARGE_INTEGER                  bytesCopied = { 0 };
-    PFILE_FETCH_NOTIFICATION_DATA  data        = NULL;
-    PFILE_FETCH_NOTIFICATION_REPLY reply       = NULL;
+    NTSTATUS                       status        = STATUS_SUCCESS;
+    LARGE_INTEGER                  bytesCopied   = { 0 };
+    PFILE_FETCH_NOTIFICATION_DATA  data          = NULL;
+    PFILE_FETCH_NOTIFICATION_REPLY reply         = NULL;
+    LARGE_INTEGER                  timeout       = { 0 };
+    ULONG                          timeoutMs     = 0;
+    PEPROCESS                      clientProcess = NULL;
+    HANDLE                         targetHandle  = NULL;
+    BOOLEAN                        delivered     = FALSE;
 
     PAGED_CODE();
 
-    IF_FALSE_RETURN_RESULT(NT_SUCCESS(RtlUnicodeStringValidate(SourceFile)), STATUS_INVALID_PARAMETER_1);
-    IF_FALSE_RETURN_RESULT(NT_SUCCESS(RtlUnicodeStringValidate(TargetFile)), STATUS_INVALID_PARAMETER_2);
-    IF_FALSE_RETURN_RESULT(BytesCopied != NULL,                              STATUS_INVALID_PARAMETER_3);
+    IF_FALSE_RETURN_RESULT(FltObjects != NULL,                               STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(NT_SUCCESS(RtlUnicodeStringValidate(SourceFile)), STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT(NT_SUCCESS(RtlUnicodeStringValidate(TargetFile)), STATUS_INVALID_PARAMETER_3);
+    IF_FALSE_RETURN_RESULT(BytesCopied != NULL,                              STATUS_INVALID_PARAMETER_5);
+
+    // Relative timeout in 100-nanosecond intervals.
+    timeoutMs        = LcGetUserModeFetchTimeout();
+    timeout.QuadPart = -10000LL * timeoutMs;
 
     LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Sending fetch notification for file: '%wZ' -> '%wZ'\n", SourceFile, TargetFile));
 
@@ -560,6 +841,12 @@ Return value:
         NT_IF_FAIL_LEAVE(LcAllocateBuffer((PVOID*)&data,  NonPagedPoolNx, dataSize,  LC_COMMUNICATION_NON_PAGED_POOL_TAG));
         NT_IF_FAIL_LEAVE(LcAllocateBuffer((PVOID*)&reply, NonPagedPoolNx, replySize, LC_COMMUNICATION_NON_PAGED_POOL_TAG));
 
+        // The target handle is only valid in the process it's created for, so the notification is sent to that process.
+        NT_IF_FAIL_LEAVE(LcReferenceClientProcess(NotificationLaneBulk, &clientProcess));
+        NT_IF_FAIL_LEAVE(LcOpenFileForClient(FltObjects, TargetFile, clientProcess, &targetHandle));
+
+        data->TargetHandle = targetHandle;
+
         // Add the 'SourceFile'.
         RtlCopyMemory(data->Data, SourceFile->Buffer, SourceFile->Length);
 
@@ -567,13 +854,32 @@ Return value:
         // NOTE: 'data->Data' is WCHAR*, not BYTE*.
         RtlCopyMemory(data->Data + (SourceFile->Length / sizeof(WCHAR)) + 1, TargetFile->Buffer, TargetFile->Length);
 
-        NT_IF_FAIL_LEAVE(LcSendMessageToClient(FetchFileInUserMode, data, dataSize, reply, replySize));
+        status = LcSendMessageToClient(FetchFileInUserMode, data, dataSize, reply, replySize, timeoutMs > 0 ? &timeout : NULL, CancelEvent, clientProcess, NULL, &delivered);
+
+        // The client may still be using the handle, if the fetch has timed out or been cancelled,
+        // so it's closed by the client, once the notification is delivered.
+        if (delivered)
+        {
+            targetHandle = NULL;
+        }
+
+        NT_IF_FAIL_LEAVE(status);
 
         bytesCopied.QuadPart = reply->BytesCopied;
         *BytesCopied         = bytesCopied;
     }
     __finally
     {
+        if (targetHandle != NULL)
+        {
+            LcCloseClientHandle(clientProcess, targetHandle);
+        }
+
+        if (clientProcess != NULL)
+        {
+            ObDereferenceObject(clientProcess);
+        }
+
         if (data != NULL)
         {
             LcFreeBuffer(data, LC_COMMUNICATION_NON_PAGED_POOL_TAG);
@@ -617,12 +923,12 @@ Arguments:
     ServerPortCookie  - The context associated with this port when the minifilter
                         created this port.
 
-    ConnectionContext - Context from entity connecting to this port (most likely
-                        your user mode service).
+    ConnectionContext - Optional 'CLIENT_CONNECTION_CONTEXT' from the user-mode service connecting
+                        to this port. If it's not given, the connection serves all notification lanes.
 
     SizeOfContext     - Size of 'ConnectionContext', in bytes.
 
-    ConnectionCookie  - Context to be passed to the port disconnect function.
+    ConnectionCookie  - Receives the connection created, so it can be removed on disconnect.
 
 Return value:
 
@@ -630,64 +936,36 @@ Return value:
 
 --*/
 {
-    NTSTATUS          status           = STATUS_SUCCESS;
-    OBJECT_ATTRIBUTES objectAttributes = { 0 };
-    CLIENT_ID         clientId         = { 0 };
+    NTSTATUS           status     = STATUS_SUCCESS;
+    PCLIENT_CONNECTION connection = NULL;
+    ULONG              laneMask   = ALL_NOTIFICATION_LANES;
 
     PAGED_CODE();
 
     UNREFERENCED_PARAMETER(ServerPortCookie);
-    UNREFERENCED_PARAMETER(ConnectionContext);
-    UNREFERENCED_PARAMETER(SizeOfContext);
 
     FLT_ASSERT(Port             != NULL);
     FLT_ASSERT(ConnectionCookie != NULL);
 
-    FLT_ASSERT(ClientPort       == NULL);
-    FLT_ASSERT(ClientProcessId  == NULL);
-
     *ConnectionCookie = NULL;
 
-    ClientPort        = Port;
-    ClientProcessId   = PsGetCurrentProcessId();
-
-    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_INFO_LEVEL, "[LazyCopy] Client connected to port: %p\n", ClientPort));
-
-    __try
+    // Filter manager captures the connection context, so it can be accessed directly.
+    if (ConnectionContext != NULL && SizeOfContext >= sizeof(CLIENT_CONNECTION_CONTEXT))
     {
-        // Obtain handles to the client and system processes.
-        InitializeObjectAttributes(&objectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
-        clientId.UniqueProcess = ClientProcessId;
-        clientId.UniqueThread  = NULL;
-
-        NT_IF_FAIL_LEAVE(ZwOpenProcess(
-            &ClientProcessHandle,
-            GENERIC_READ,
-            &objectAttributes,
-            &clientId));
-
-        NT_IF_FAIL_LEAVE(ObOpenObjectByPointer(
-            PsInitialSystemProcess,
-            OBJ_KERNEL_HANDLE,
-            NULL,
-            STANDARD_RIGHTS_READ,
-            NULL,
-            KernelMode,
-            &SystemProcessHandle));
-
-        // We trust the client process.
-        NT_IF_FAIL_LEAVE(LcAddTrustedProcess(ClientProcessId));
+        laneMask = ((PCLIENT_CONNECTION_CONTEXT)ConnectionContext)->LaneMask;
     }
-    __finally
-    {
-        if (!NT_SUCCESS(status))
-        {
-            LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_INFO_LEVEL, "[LazyCopy] Unable to accept client connection: %08X\n", status));
 
-            LcResetConnectionVariables();
-        }
+    status = LcAddClientConnection(Port, laneMask, &connection);
+    if (!NT_SUCCESS(status))
+    {
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_INFO_LEVEL, "[LazyCopy] Unable to accept client connection: %08X\n", status));
+        return status;
     }
 
+    *ConnectionCookie = connection;
+
+    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_INFO_LEVEL, "[LazyCopy] Client connected to port: %p, lanes: %X\n", Port, laneMask));
+
     return status;
 }
 
@@ -705,9 +983,12 @@ Summary:
     This function is called when the connection is torn-down.
     We use it to close our connection handle.
 
+    Notifications in flight on this connection are failed with the STATUS_PORT_DISCONNECTED,
+    and resent via the remaining ones.
+
 Arguments:
 
-    ConnectionCookie - Context from the port connect function.
+    ConnectionCookie - Connection returned by the 'LcCommunicationPortConnect'.
 
 Return value:
 
@@ -717,14 +998,9 @@ Return value:
 {
     PAGED_CODE();
 
-    UNREFERENCED_PARAMETER(ConnectionCookie);
-
-    // Close the connection handle. This will set the 'ClientPort' to NULL.
-    // NOTE: Since we limited max connections to 1, another connect request
-    //       won't be allowed until we return from the disconnect function.
-    FltCloseClientPort(Globals.Filter, &ClientPort);
+    FLT_ASSERT(ConnectionCookie != NULL);
 
-    LcResetConnectionVariables();
+    LcRemoveClientConnection((PCLIENT_CONNECTION)ConnectionCookie);
 
     LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_INFO_LEVEL, "[LazyCopy] Client disconnected\n"));
 }
@@ -732,51 +1008,99 @@ Return value:
 //------------------------------------------------------------------------
 
 static
-VOID
-LcResetConnectionVariables()
+_Check_return_
+NTSTATUS
+LcMonitorPortConnect(
+    _In_                                PFLT_PORT Port,
+    _In_opt_                            PVOID     ServerPortCookie,
+    _In_reads_bytes_opt_(SizeOfContext) PVOID     ConnectionContext,
+    _In_                                ULONG     SizeOfContext,
+    _Outptr_result_maybenull_           PVOID*    ConnectionCookie
+    )
 /*++
 
 Summary:
 
-    This function resets the connection-related variables.
+    This function is called when a monitoring tool connects to the monitor port.
+
+    Unlike the main client, monitoring tools are not trusted and don't receive
+    notifications, so there is no global state to set up.
 
 Arguments:
 
-    None.
+    Port              - Client connection port.
+
+    ServerPortCookie  - The context associated with this port when the minifilter
+                        created this port.
+
+    ConnectionContext - Context from entity connecting to this port.
+
+    SizeOfContext     - Size of 'ConnectionContext', in bytes.
+
+    ConnectionCookie  - Receives the 'Port', so it can be closed on disconnect.
 
 Return value:
 
-    None.
+    The return value is the status of the operation.
 
 --*/
 {
     PAGED_CODE();
 
-    if (ClientProcessHandle != NULL)
-    {
-        ZwClose(ClientProcessHandle);
-        ClientProcessHandle = NULL;
-    }
+    UNREFERENCED_PARAMETER(ServerPortCookie);
+    UNREFERENCED_PARAMETER(ConnectionContext);
+    UNREFERENCED_PARAMETER(SizeOfContext);
 
-    if (SystemProcessHandle != NULL)
-    {
-        ZwClose(SystemProcessHandle);
-        SystemProcessHandle = NULL;
-    }
+    FLT_ASSERT(Port             != NULL);
+    FLT_ASSERT(ConnectionCookie != NULL);
 
-    if (ClientProcessId != NULL)
-    {
-        LcRemoveTrustedProcess(ClientProcessId);
-        ClientProcessId = NULL;
-    }
+    *ConnectionCookie = Port;
+
+    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_INFO_LEVEL, "[LazyCopy] Monitor connected to port: %p\n", Port));
+
+    return STATUS_SUCCESS;
 }
 
 //------------------------------------------------------------------------
 
 static
-_Check_return_
-NTSTATUS
-LcClientMessageReceived(
+VOID
+LcMonitorPortDisconnect(
+    _In_opt_ PVOID ConnectionCookie
+    )
+/*++
+
+Summary:
+
+    This function is called when the monitor port connection is torn-down.
+
+Arguments:
+
+    ConnectionCookie - Client port returned by the 'LcMonitorPortConnect'.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PFLT_PORT port = (PFLT_PORT)ConnectionCookie;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(port != NULL);
+
+    FltCloseClientPort(Globals.Filter, &port);
+
+    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_INFO_LEVEL, "[LazyCopy] Monitor disconnected\n"));
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcClientMessageReceived(
     _In_                                                                   PVOID  ConnectionCookie,
     _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
     _In_                                                                   ULONG  InputBufferSize,
@@ -793,7 +1117,55 @@ Summary:
 
 Arguments:
 
-    ConnectionCookie         - Unused.
+    ConnectionCookie         - Client connection the message is received from.
+
+    InputBuffer              - A buffer containing input data, can be NULL if there
+                               is no input data.
+
+    InputBufferSize          - The size in bytes of the 'InputBuffer'.
+
+    OutputBuffer             - A buffer provided by the application that originated the
+                               communication in which to store data to be returned to this
+                               application.
+
+    OutputBufferSize         - The size in bytes of the 'OutputBuffer'.
+
+    ReturnOutputBufferLength - The size in bytes of meaningful data returned in the 'OutputBuffer'.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER(ConnectionCookie);
+
+    return LcExecuteClientCommand(InputBuffer, InputBufferSize, OutputBuffer, OutputBufferSize, ReturnOutputBufferLength, FALSE);
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcExecuteClientCommand(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID   InputBuffer,
+    _In_                                                                   ULONG   InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID   OutputBuffer,
+    _In_                                                                   ULONG   OutputBufferSize,
+    _Out_                                                                  PULONG  ReturnOutputBufferLength,
+    _In_                                                                   BOOLEAN QueryOnly
+    )
+/*++
+
+Summary:
+
+    This function validates the command received from a user-mode client, and
+    executes its handler.
+
+Arguments:
 
     InputBuffer              - A buffer containing input data, can be NULL if there
                                is no input data.
@@ -808,6 +1180,8 @@ Arguments:
 
     ReturnOutputBufferLength - The size in bytes of meaningful data returned in the 'OutputBuffer'.
 
+    QueryOnly                - Whether only the commands that query the driver state are allowed.
+
 Return value:
 
     The return value is the status of the operation.
@@ -821,12 +1195,10 @@ Return value:
 
     PAGED_CODE();
 
-    UNREFERENCED_PARAMETER(ConnectionCookie);
-
-    IF_FALSE_RETURN_RESULT(InputBuffer != NULL,                              STATUS_INVALID_PARAMETER_2);
-    IF_FALSE_RETURN_RESULT(InputBufferSize > 0,                              STATUS_INVALID_PARAMETER_3);
-    IF_FALSE_RETURN_RESULT((OutputBuffer != NULL) == (OutputBufferSize > 0), STATUS_INVALID_PARAMETER_4);
-    IF_FALSE_RETURN_RESULT(ReturnOutputBufferLength != NULL,                 STATUS_INVALID_PARAMETER_6);
+    IF_FALSE_RETURN_RESULT(InputBuffer != NULL,                              STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(InputBufferSize > 0,                              STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT((OutputBuffer != NULL) == (OutputBufferSize > 0), STATUS_INVALID_PARAMETER_3);
+    IF_FALSE_RETURN_RESULT(ReturnOutputBufferLength != NULL,                 STATUS_INVALID_PARAMETER_5);
 
     // Validate the output buffer alignment.
     if (OutputBuffer != NULL)
@@ -849,6 +1221,16 @@ Return value:
         return GetExceptionCode();
     }
 
+    // Monitoring tools are only allowed to query the driver state.
+    if (QueryOnly
+        && command != GetDriverVersion
+        && command != GetStatistics
+        && command != GetActiveFetches)
+    {
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "[LazyCopy] Command not allowed on the monitor port: %d\n", command));
+        return STATUS_ACCESS_DENIED;
+    }
+
     // Get the command handler based on the command type received.
     switch (command)
     {
@@ -870,6 +1252,31 @@ Return value:
         case SetReportRate:
             commandHandler = &LcSetReportRateHandler;
             break;
+        case SetVolumePolicy:
+            commandHandler = &LcSetVolumePolicyHandler;
+            break;
+        case ApplyConfiguration:
+            commandHandler = &LcApplyConfigurationHandler;
+            break;
+
+        // Driver statistics commands.
+        case DrainFileAccesses:
+            commandHandler = &LcDrainFileAccessesHandler;
+            break;
+        case GetStatistics:
+            commandHandler = &LcGetStatisticsHandler;
+            break;
+        case GetActiveFetches:
+            commandHandler = &LcGetActiveFetchesHandler;
+            break;
+
+        // Notification ring commands.
+        case MapNotificationRing:
+            commandHandler = &LcMapNotificationRingHandler;
+            break;
+        case CompleteRingNotifications:
+            commandHandler = &LcCompleteRingNotificationsHandler;
+            break;
 
         default:
             LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "[LazyCopy] Command not supported: %d\n", command));
@@ -906,6 +1313,57 @@ Return value:
 
 //------------------------------------------------------------------------
 
+static
+_Check_return_
+NTSTATUS
+LcMonitorMessageReceived(
+    _In_                                                                   PVOID  ConnectionCookie,
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Summary:
+
+    This function is called whenever a monitoring tool sends a command to the monitor port.
+
+    Monitoring tools are only allowed to query the driver state.
+
+Arguments:
+
+    ConnectionCookie         - Client port returned by the 'LcMonitorPortConnect'.
+
+    InputBuffer              - A buffer containing input data, can be NULL if there
+                               is no input data.
+
+    InputBufferSize          - The size in bytes of the 'InputBuffer'.
+
+    OutputBuffer             - A buffer provided by the application that originated the
+                               communication in which to store data to be returned to this
+                               application.
+
+    OutputBufferSize         - The size in bytes of the 'OutputBuffer'.
+
+    ReturnOutputBufferLength - The size in bytes of meaningful data returned in the 'OutputBuffer'.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER(ConnectionCookie);
+
+    return LcExecuteClientCommand(InputBuffer, InputBufferSize, OutputBuffer, OutputBufferSize, ReturnOutputBufferLength, TRUE);
+}
+
+//------------------------------------------------------------------------
+
 static
 _Check_return_
 NTSTATUS
@@ -914,7 +1372,12 @@ LcSendMessageToClient(
     _In_reads_bytes_(DataLength)                     PVOID                    Data,
     _In_                                             ULONG                    DataLength,
     _Inout_updates_bytes_all_opt_(ReplyBufferLength) PVOID                    ReplyBuffer,
-    _In_opt_                                         ULONG                    ReplyBufferLength
+    _In_opt_                                         ULONG                    ReplyBufferLength,
+    _In_opt_                                         PLARGE_INTEGER           Timeout,
+    _In_opt_                                         PKEVENT                  CancelEvent,
+    _In_opt_                                         PEPROCESS                TargetProcess,
+    _Outptr_opt_result_maybenull_                    PEPROCESS*               ReplyProcess,
+    _Out_opt_                                        PBOOLEAN                 Delivered
     )
 /*++
 
@@ -922,6 +1385,11 @@ Summary:
 
     This function sends the notification message to the connected user-mode client.
 
+    The notification is posted to the notification ring, if the client has mapped it.
+    Otherwise, it's sent via the client connection serving the notification lane with the
+    least amount of outstanding requests. If that connection is closed before the client
+    replies, the notification is resent via another one, unless the 'Delivered' is set.
+
 Arguments:
 
     NotificationType  - Notification message type.
@@ -935,15 +1403,36 @@ Arguments:
 
     ReplyBufferLength - Length of the 'ReplyBuffer' buffer.
 
+    Timeout           - Relative time to wait for the client reply for. Optional.
+
+    CancelEvent       - Event signaled, when the caller is no longer interested in the reply. Optional.
+                        Only the notification ring waits are cancelled, the port ones are limited by the 'Timeout'.
+
+    TargetProcess     - If set, the notification is only sent to this process. Optional.
+
+    ReplyProcess      - Receives the referenced client process that replied. Optional.
+
+    Delivered         - Receives TRUE, if the client might have received the notification. Optional.
+                        It's set by the callers, which pass the resources the client takes ownership of,
+                        so such notifications are never resent, and the client doesn't receive them twice.
+                        The port can't tell whether the client has received the notification, before the
+                        send fails, so it's only FALSE, if the notification is not sent, or withdrawn from the ring.
+
 Return value:
 
-    The return value is the status of the operation.
+    STATUS_IO_TIMEOUT - The client didn't reply within the 'Timeout' given.
+
+    Any other value is the status of the operation.
 
 --*/
 {
     NTSTATUS             status           = STATUS_SUCCESS;
     PDRIVER_NOTIFICATION notification     = NULL;
     const ULONG          notificationSize = sizeof(DRIVER_NOTIFICATION) + DataLength;
+    PCLIENT_CONNECTION   connection       = NULL;
+    ULONG                replyLength      = 0;
+    ULONG                attempt          = 0;
+    NOTIFICATION_LANE    lane             = NotificationLaneLatency;
 
     PAGED_CODE();
 
@@ -952,10 +1441,44 @@ Return value:
 
     IF_FALSE_RETURN_RESULT(ReplyBuffer != NULL ? ReplyBufferLength >= sizeof(FILTER_REPLY_HEADER) : ReplyBufferLength == 0, STATUS_INVALID_PARAMETER_5);
 
+    if (ReplyProcess != NULL)
+    {
+        *ReplyProcess = NULL;
+    }
+
+    if (Delivered != NULL)
+    {
+        *Delivered = FALSE;
+    }
+
+    // File fetches may take minutes, so they are kept away from the connections serving the open and close requests.
+    lane = NotificationType == FetchFileInUserMode ? NotificationLaneBulk : NotificationLaneLatency;
+    LcUpdateNotificationQueueDepth(lane, 1);
+
     __try
     {
-        // If the client is not connected, don't send the notification.
-        NT_IF_FALSE_LEAVE(ClientPort != NULL, STATUS_PORT_DISCONNECTED);
+        // The ring is mapped into a single process, so it's only used, if that's the 'TargetProcess'.
+        // The 'ReplyBuffer' receives the reply without the 'FILTER_REPLY_HEADER', so the ring doesn't need space for it.
+        status = LcSendRingNotification(
+            NotificationType,
+            Data,
+            DataLength,
+            ReplyBuffer,
+            ReplyBuffer != NULL ? ReplyBufferLength - sizeof(FILTER_REPLY_HEADER) : 0,
+            Timeout,
+            CancelEvent,
+            TargetProcess,
+            ReplyProcess,
+            Delivered);
+
+        // If the ring is unmapped while we wait, the notification is resent via the remaining connections,
+        // unless the client has already picked it up.
+        if ((status != STATUS_NOT_SUPPORTED && status != STATUS_PORT_DISCONNECTED) || (Delivered != NULL && *Delivered))
+        {
+            __leave;
+        }
+
+        status = STATUS_SUCCESS;
 
         // Allocate enough memory for the notification.
         NT_IF_FAIL_LEAVE(LcAllocateBuffer((PVOID*)&notification, NonPagedPoolNx, notificationSize, LC_COMMUNICATION_NON_PAGED_POOL_TAG));
@@ -965,11 +1488,52 @@ Return value:
         // Copy the data buffer to the notification message.
         RtlCopyMemory(&notification->Data, Data, DataLength);
 
-        // Send message to the user-mode client.
-        NT_IF_FAIL_LEAVE(FltSendMessage(Globals.Filter, &ClientPort, notification, notificationSize, ReplyBuffer, (PULONG)&ReplyBufferLength, NULL));
+        // Send message to the least loaded client connection.
+        // If the client disconnects before replying, try the next one, so the notification is not lost.
+        for (attempt = 0; attempt < MAX_CLIENT_CONNECTIONS; attempt++)
+        {
+            // Fails with the STATUS_PORT_DISCONNECTED, if there are no clients connected.
+            NT_IF_FAIL_LEAVE(LcAcquireClientConnection(lane, TargetProcess, &connection));
+
+            replyLength = ReplyBufferLength;
+            status      = FltSendMessage(Globals.Filter, &connection->Port, notification, notificationSize, ReplyBuffer, &replyLength, Timeout);
+
+            // The client might have received the notification, before the connection was closed or the send timed out.
+            if (Delivered != NULL)
+            {
+                *Delivered = TRUE;
+            }
+
+            if (status != STATUS_PORT_DISCONNECTED || Delivered != NULL)
+            {
+                break;
+            }
+
+            LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_WARNING_LEVEL, "[LazyCopy] Client connection %p closed, resending notification\n", connection));
+
+            LcReleaseClientConnection(connection);
+            connection = NULL;
+        }
+
+        // 'STATUS_TIMEOUT' is a success code, so it's converted to the error one.
+        NT_IF_FALSE_LEAVE(status != STATUS_TIMEOUT, STATUS_IO_TIMEOUT);
+        NT_IF_FAIL_LEAVE(status);
+
+        if (ReplyProcess != NULL)
+        {
+            ObReferenceObject(connection->Process);
+            *ReplyProcess = connection->Process;
+        }
     }
     __finally
     {
+        LcUpdateNotificationQueueDepth(lane, -1);
+
+        if (connection != NULL)
+        {
+            LcReleaseClientConnection(connection);
+        }
+
         if (notification != NULL)
         {
             LcFreeBuffer(notification, LC_COMMUNICATION_NON_PAGED_POOL_TAG);
@@ -1033,6 +1597,155 @@ Return value:
     return EXCEPTION_EXECUTE_HANDLER;
 }
 
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcOpenFileForClient(
+    _In_  PCFLT_RELATED_OBJECTS FltObjects,
+    _In_  PCUNICODE_STRING      FileName,
+    _In_  PEPROCESS             ClientProcess,
+    _Out_ PHANDLE               Handle
+    )
+/*++
+
+Summary:
+
+    This function opens the 'FileName' for writing below the current instance,
+    and creates a handle for it in the 'ClientProcess' handle table.
+
+    The client writes to the file directly, so it doesn't need to reopen it by path,
+    while the driver holds the original operation. The client process is trusted,
+    so its writes are not intercepted by this driver.
+
+Arguments:
+
+    FltObjects    - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                    opaque handles to this filter, instance, its associated volume and
+                    file object.
+
+    FileName      - Path to the file to open.
+
+    ClientProcess - Process the handle is created for.
+
+    Handle        - Receives the handle valid in the 'ClientProcess'.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS          status           = STATUS_SUCCESS;
+    HANDLE            fileHandle       = NULL;
+    PFILE_OBJECT      fileObject       = NULL;
+    OBJECT_ATTRIBUTES objectAttributes = { 0 };
+    IO_STATUS_BLOCK   statusBlock      = { 0 };
+    KAPC_STATE        apcState         = { 0 };
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(FltObjects    != NULL, STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(FileName      != NULL, STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT(ClientProcess != NULL, STATUS_INVALID_PARAMETER_3);
+    IF_FALSE_RETURN_RESULT(Handle        != NULL, STATUS_INVALID_PARAMETER_4);
+
+    *Handle = NULL;
+
+    __try
+    {
+        InitializeObjectAttributes(&objectAttributes, (PUNICODE_STRING)FileName, OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE, NULL, NULL);
+
+        // The file is already opened by the caller we're fetching it for, so the share access is not checked.
+        NT_IF_FAIL_LEAVE(FltCreateFileEx(
+            Globals.Filter,
+            FltObjects->Instance,
+            &fileHandle,
+            &fileObject,
+            FILE_WRITE_DATA | SYNCHRONIZE,
+            &objectAttributes,
+            &statusBlock,
+            0,
+            FILE_ATTRIBUTE_NORMAL,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            FILE_OPEN,
+            FILE_OPEN_REPARSE_POINT | FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT | FILE_COMPLETE_IF_OPLOCKED,
+            NULL,
+            0,
+            IO_IGNORE_SHARE_ACCESS_CHECK));
+
+        // Handle created without the 'OBJ_KERNEL_HANDLE' goes to the handle table of the process we're attached to.
+        KeStackAttachProcess(ClientProcess, &apcState);
+
+        status = ObOpenObjectByPointer(
+            fileObject,
+            0,
+            NULL,
+            FILE_WRITE_DATA | SYNCHRONIZE,
+            *IoFileObjectType,
+            KernelMode,
+            Handle);
+
+        KeUnstackDetachProcess(&apcState);
+
+        NT_IF_FAIL_LEAVE(status);
+    }
+    __finally
+    {
+        if (fileHandle != NULL)
+        {
+            FltClose(fileHandle);
+            ObDereferenceObject(fileObject);
+        }
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+static
+VOID
+LcCloseClientHandle(
+    _In_ PEPROCESS ClientProcess,
+    _In_ HANDLE    Handle
+    )
+/*++
+
+Summary:
+
+    This function closes the handle created by the 'LcOpenFileForClient'
+    in the client process.
+
+Arguments:
+
+    ClientProcess - Process the handle belongs to.
+
+    Handle        - Handle to be closed.
+
+Return value:
+
+    None.
+
+--*/
+{
+    KAPC_STATE apcState = { 0 };
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN(ClientProcess != NULL);
+    IF_FALSE_RETURN(Handle        != NULL);
+
+    KeStackAttachProcess(ClientProcess, &apcState);
+
+    // The 'UserMode' makes sure that only the user-mode handle is closed.
+    #pragma warning(suppress: __WARNING_RETVAL_IGNORED_FUNC_COULD_FAIL) // The process might be exiting, and the handle is already closed.
+    ObCloseHandle(Handle, UserMode);
+
+    KeUnstackDetachProcess(&apcState);
+}
+
 //------------------------------------------------------------------------
 //  Command handlers.
 //------------------------------------------------------------------------
@@ -1168,6 +1881,12 @@ Return value:
         FltReleaseResource(Globals.Lock);
     }
 
+    // Volume policy might have changed, apply it to the volumes the driver is (not) attached to.
+    if (NT_SUCCESS(status))
+    {
+        status = LcApplyVolumePolicy();
+    }
+
     return status;
 }
 
@@ -1287,10 +2006,7 @@ Return value:
 
 --*/
 {
-    NTSTATUS     status     = STATUS_SUCCESS;
-    PWATCH_PATHS watchPaths = NULL;
-    PWCHAR       buffer     = NULL;
-    ULONG        idx        = 0;
+    NTSTATUS status = STATUS_SUCCESS;
 
     const ULONG_PTR bufferEnd = (ULONG_PTR)InputBuffer + InputBufferSize;
 
@@ -1299,7 +2015,7 @@ Return value:
     UNREFERENCED_PARAMETER(OutputBuffer);
     UNREFERENCED_PARAMETER(OutputBufferSize);
 
-    // Input buffer should at least contain the 'PathCount' value.
+    // Input buffer should at least contain the 'RuleCount' value.
     IF_FALSE_RETURN_RESULT(InputBuffer != NULL,                                       STATUS_INVALID_PARAMETER_1);
     IF_FALSE_RETURN_RESULT(InputBufferSize >= (ULONG)FIELD_OFFSET(WATCH_PATHS, Data), STATUS_INVALID_PARAMETER_2);
 
@@ -1311,28 +2027,7 @@ Return value:
     {
         __try
         {
-            // Free the previous list before populating it again.
-            LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Clearing previous paths to watch\n"));
-            LcClearPathsToWatch();
-
-            watchPaths = (PWATCH_PATHS)InputBuffer;
-            buffer     = watchPaths->Data;
-
-            for (idx = 0; idx < watchPaths->PathCount; idx++)
-            {
-                UNICODE_STRING currentString       = { 0 };
-                SIZE_T         currentStringLength = wcslen(buffer);
-
-                NT_IF_FALSE_LEAVE(bufferEnd >= (ULONG_PTR)buffer + (currentStringLength + 1) * sizeof(WCHAR), STATUS_INVALID_BUFFER_SIZE);
-
-                NT_IF_FAIL_LEAVE(RtlInitUnicodeStringEx(&currentString, buffer));
-                LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Adding path to watch: '%wZ'\n", currentString));
-
-                NT_IF_FAIL_LEAVE(LcAddPathToWatch(&currentString));
-
-                // Move to the next string in the buffer.
-                buffer += currentStringLength + 1;
-            }
+            status = LcLoadWatchPaths((PWATCH_PATHS)InputBuffer, bufferEnd);
         }
         __except (LcDriverExceptionFilter(GetExceptionInformation(), TRUE))
         {
@@ -1424,26 +2119,41 @@ Return value:
     return status;
 }
 
-//------------------------------------------------------------------------
-//  Additional validation functions.
 //------------------------------------------------------------------------
 
 static
 _Check_return_
 NTSTATUS
-LcValidateBufferAlignment(
-    _In_ PVOID Buffer
+LcSetVolumePolicyHandler(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
     )
 /*++
 
 Summary:
 
-    This function validates the 'Buffer' alignment.
-    It supports both 32 and 64-bit platforms.
+    This function handles the 'SetVolumePolicy' command received from a user-mode client.
+
+    After the new rules are stored, the policy is applied to all volumes, so the driver
+    attaches to the newly matching volumes, and disables its instances on the others.
 
 Arguments:
 
-    Buffer - Buffer, which alignment should be validated.
+    InputBuffer              - A buffer containing input data, can be NULL if there
+                               is no input data.
+
+    InputBufferSize          - The size, in bytes, of the 'InputBuffer'.
+
+    OutputBuffer             - A buffer provided by the application that originated the
+                               communication in which to store data to be returned to this
+                               application.
+
+    OutputBufferSize         - The size, in bytes, of the 'OutputBuffer'.
+
+    ReturnOutputBufferLength - The size, in bytes, of meaningful data returned in the 'OutputBuffer'.
 
 Return value:
 
@@ -1453,31 +2163,757 @@ Return value:
 {
     NTSTATUS status = STATUS_SUCCESS;
 
+    const ULONG_PTR bufferEnd = (ULONG_PTR)InputBuffer + InputBufferSize;
+
     PAGED_CODE();
 
-    IF_FALSE_RETURN_RESULT(Buffer != NULL, STATUS_INVALID_PARAMETER_1);
+    UNREFERENCED_PARAMETER(OutputBuffer);
+    UNREFERENCED_PARAMETER(OutputBufferSize);
 
-    #if defined(_WIN64)
-    if (IoIs32bitProcess(NULL))
+    // Input buffer should at least contain the 'RuleCount' value.
+    IF_FALSE_RETURN_RESULT(InputBuffer != NULL,                                         STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(InputBufferSize >= (ULONG)FIELD_OFFSET(VOLUME_POLICY, Data), STATUS_INVALID_PARAMETER_2);
+
+    *ReturnOutputBufferLength = 0;
+
+    FltAcquireResourceExclusive(Globals.Lock);
+
+    __try
     {
-        // Validate alignment for the 32bit process on a 64bit system.
-        if (!IS_ALIGNED(Buffer, sizeof(ULONG)))
+        __try
         {
-            status = STATUS_DATATYPE_MISALIGNMENT;
+            status = LcLoadVolumePolicy((PVOLUME_POLICY)InputBuffer, bufferEnd);
+        }
+        __except (LcDriverExceptionFilter(GetExceptionInformation(), TRUE))
+        {
+            status = GetExceptionCode();
         }
     }
-    else
+    __finally
     {
-    #endif // defined(_WIN64)
+        FltReleaseResource(Globals.Lock);
+    }
 
-        if (!IS_ALIGNED(Buffer, sizeof(PVOID)))
+    if (NT_SUCCESS(status))
+    {
+        status = LcApplyVolumePolicy();
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcApplyConfigurationHandler(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Summary:
+
+    This function handles the 'ApplyConfiguration' command received from a user-mode client.
+
+    All parameters are changed within a single configuration update, so the file operation
+    callbacks see either the previous configuration or the new one, and a single snapshot
+    is published. If any part of the configuration cannot be applied, the driver is disabled
+    instead of running with the partially applied one.
+
+Arguments:
+
+    InputBuffer              - A buffer containing input data, can be NULL if there
+                               is no input data.
+
+    InputBufferSize          - The size, in bytes, of the 'InputBuffer'.
+
+    OutputBuffer             - A buffer provided by the application that originated the
+                               communication in which to store data to be returned to this
+                               application.
+
+    OutputBufferSize         - The size, in bytes, of the 'OutputBuffer'.
+
+    ReturnOutputBufferLength - The size, in bytes, of meaningful data returned in the 'OutputBuffer'.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS              status          = STATUS_SUCCESS;
+    NTSTATUS              publishStatus   = STATUS_SUCCESS;
+    PDRIVER_CONFIGURATION configuration   = NULL;
+    BOOLEAN               volumePolicySet = FALSE;
+
+    const ULONG_PTR bufferEnd = (ULONG_PTR)InputBuffer + InputBufferSize;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER(OutputBuffer);
+    UNREFERENCED_PARAMETER(OutputBufferSize);
+
+    // Input buffer should at least contain the configuration header.
+    IF_FALSE_RETURN_RESULT(InputBuffer != NULL,                                                STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(InputBufferSize >= (ULONG)FIELD_OFFSET(DRIVER_CONFIGURATION, Data), STATUS_INVALID_PARAMETER_2);
+
+    *ReturnOutputBufferLength = 0;
+
+    FltAcquireResourceExclusive(Globals.Lock);
+    LcBeginConfigurationUpdate();
+
+    __try
+    {
+        __try
         {
-            status = STATUS_DATATYPE_MISALIGNMENT;
+            configuration = (PDRIVER_CONFIGURATION)InputBuffer;
+
+            NT_IF_FALSE_LEAVE(configuration->Version == DRIVER_CONFIGURATION_VERSION, STATUS_REVISION_MISMATCH);
+
+            LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Applying configuration: mode %u, report rate %u\n", configuration->OperationMode, configuration->ReportRate));
+
+            NT_IF_FAIL_LEAVE(LcValidateConfigurationOffset(configuration->WatchPathsOffset, InputBufferSize));
+            NT_IF_FAIL_LEAVE(LcLoadWatchPaths((PWATCH_PATHS)Add2Ptr(InputBuffer, configuration->WatchPathsOffset), bufferEnd));
+
+            // Zero offset means the current volume policy should be kept.
+            if (configuration->VolumePolicyOffset != 0)
+            {
+                NT_IF_FAIL_LEAVE(LcValidateConfigurationOffset(configuration->VolumePolicyOffset, InputBufferSize));
+                NT_IF_FAIL_LEAVE(LcLoadVolumePolicy((PVOLUME_POLICY)Add2Ptr(InputBuffer, configuration->VolumePolicyOffset), bufferEnd));
+
+                volumePolicySet = TRUE;
+            }
+
+            LcSetReportRate(configuration->ReportRate);
+            LcSetOperationMode((DRIVER_OPERATION_MODE)configuration->OperationMode);
+        }
+        __except (LcDriverExceptionFilter(GetExceptionInformation(), TRUE))
+        {
+            status = GetExceptionCode();
+        }
+    }
+    __finally
+    {
+        if (!NT_SUCCESS(status))
+        {
+            LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "[LazyCopy] Unable to apply configuration, disabling driver: %08X\n", status));
+            LcSetOperationMode(DriverDisabled);
         }
 
-    #if defined(_WIN64)
+        publishStatus = LcEndConfigurationUpdate();
+        FltReleaseResource(Globals.Lock);
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        status = publishStatus;
+    }
+
+    if (NT_SUCCESS(status) && volumePolicySet)
+    {
+        status = LcApplyVolumePolicy();
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcDrainFileAccessesHandler(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Summary:
+
+    This function handles the 'DrainFileAccesses' command received from a user-mode client.
+
+    It moves as many access table records as fit into the 'OutputBuffer'.
+    The client should send the command again, if the 'RemainingCount' is not zero.
+
+Arguments:
+
+    InputBuffer              - A buffer containing input data, can be NULL if there
+                               is no input data.
+
+    InputBufferSize          - The size, in bytes, of the 'InputBuffer'.
+
+    OutputBuffer             - A buffer provided by the application that originated the
+                               communication in which to store data to be returned to this
+                               application.
+
+    OutputBufferSize         - The size, in bytes, of the 'OutputBuffer'.
+
+    ReturnOutputBufferLength - The size, in bytes, of meaningful data returned in the 'OutputBuffer'.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    // The 'DrainFileAccesses' command does not contain any data.
+    UNREFERENCED_PARAMETER(InputBuffer);
+    UNREFERENCED_PARAMETER(InputBufferSize);
+
+    // Verify we have a valid output buffer.
+    IF_FALSE_RETURN_RESULT(OutputBuffer != NULL,                      STATUS_INVALID_PARAMETER_3);
+    IF_FALSE_RETURN_RESULT(OutputBufferSize >= sizeof(FILE_ACCESSES), STATUS_INVALID_PARAMETER_4);
+
+    // Protect access to the raw user-mode output buffer with an exception handler.
+    __try
+    {
+        status = LcDrainAccessTable(OutputBuffer, OutputBufferSize, ReturnOutputBufferLength);
+    }
+    __except (LcDriverExceptionFilter(GetExceptionInformation(), TRUE))
+    {
+        status = GetExceptionCode();
     }
-    #endif // defined(_WIN64)
 
     return status;
 }
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcGetStatisticsHandler(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Summary:
+
+    This function handles the 'GetStatistics' command received from a user-mode client.
+
+    The statistics are summed into the local buffer first, so the raw user-mode
+    buffer is only accessed once.
+
+Arguments:
+
+    InputBuffer              - A buffer containing input data, can be NULL if there
+                               is no input data.
+
+    InputBufferSize          - The size, in bytes, of the 'InputBuffer'.
+
+    OutputBuffer             - A buffer provided by the application that originated the
+                               communication in which to store data to be returned to this
+                               application.
+
+    OutputBufferSize         - The size, in bytes, of the 'OutputBuffer'.
+
+    ReturnOutputBufferLength - The size, in bytes, of meaningful data returned in the 'OutputBuffer'.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS           status     = STATUS_SUCCESS;
+    PDRIVER_STATISTICS statistics = NULL;
+
+    PAGED_CODE();
+
+    // The 'GetStatistics' command does not contain any data.
+    UNREFERENCED_PARAMETER(InputBuffer);
+    UNREFERENCED_PARAMETER(InputBufferSize);
+
+    // Verify we have a valid output buffer.
+    IF_FALSE_RETURN_RESULT(OutputBuffer != NULL,                          STATUS_INVALID_PARAMETER_3);
+    IF_FALSE_RETURN_RESULT(OutputBufferSize >= sizeof(DRIVER_STATISTICS), STATUS_INVALID_PARAMETER_4);
+
+    // The structure is too large to be allocated on the stack.
+    NT_IF_FAIL_RETURN(LcAllocateBuffer((PVOID*)&statistics, PagedPool, sizeof(DRIVER_STATISTICS), LC_COMMUNICATION_PAGED_POOL_TAG));
+
+    LcQueryStatistics(statistics);
+
+    // Protect access to the raw user-mode output buffer with an exception handler.
+    __try
+    {
+        RtlCopyMemory(OutputBuffer, statistics, sizeof(DRIVER_STATISTICS));
+        *ReturnOutputBufferLength = sizeof(DRIVER_STATISTICS);
+    }
+    __except (LcDriverExceptionFilter(GetExceptionInformation(), TRUE))
+    {
+        status = GetExceptionCode();
+    }
+
+    LcFreeBuffer(statistics, LC_COMMUNICATION_PAGED_POOL_TAG);
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcGetActiveFetchesHandler(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Summary:
+
+    This function handles the 'GetActiveFetches' command received from a user-mode client.
+
+    It writes as many fetches in flight as fit into the 'OutputBuffer'.
+    The client should retry with a larger buffer, if the 'RemainingCount' is not zero.
+
+Arguments:
+
+    InputBuffer              - A buffer containing input data, can be NULL if there
+                               is no input data.
+
+    InputBufferSize          - The size, in bytes, of the 'InputBuffer'.
+
+    OutputBuffer             - A buffer provided by the application that originated the
+                               communication in which to store data to be returned to this
+                               application.
+
+    OutputBufferSize         - The size, in bytes, of the 'OutputBuffer'.
+
+    ReturnOutputBufferLength - The size, in bytes, of meaningful data returned in the 'OutputBuffer'.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    // The 'GetActiveFetches' command does not contain any data.
+    UNREFERENCED_PARAMETER(InputBuffer);
+    UNREFERENCED_PARAMETER(InputBufferSize);
+
+    // Verify we have a valid output buffer.
+    IF_FALSE_RETURN_RESULT(OutputBuffer != NULL,                       STATUS_INVALID_PARAMETER_3);
+    IF_FALSE_RETURN_RESULT(OutputBufferSize >= sizeof(ACTIVE_FETCHES), STATUS_INVALID_PARAMETER_4);
+
+    // Protect access to the raw user-mode output buffer with an exception handler.
+    __try
+    {
+        status = LcQueryActiveFetches(OutputBuffer, OutputBufferSize, ReturnOutputBufferLength);
+    }
+    __except (LcDriverExceptionFilter(GetExceptionInformation(), TRUE))
+    {
+        status = GetExceptionCode();
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcMapNotificationRingHandler(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Summary:
+
+    This function handles the 'MapNotificationRing' command received from a user-mode client.
+
+    It maps the notification ring into the client process, so the following notifications
+    are posted to it instead of being sent via the communication port.
+
+Arguments:
+
+    InputBuffer              - A buffer containing input data, can be NULL if there
+                               is no input data.
+
+    InputBufferSize          - The size, in bytes, of the 'InputBuffer'.
+
+    OutputBuffer             - A buffer provided by the application that originated the
+                               communication in which to store data to be returned to this
+                               application.
+
+    OutputBufferSize         - The size, in bytes, of the 'OutputBuffer'.
+
+    ReturnOutputBufferLength - The size, in bytes, of meaningful data returned in the 'OutputBuffer'.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS                  status       = STATUS_SUCCESS;
+    HANDLE                    requestEvent = NULL;
+    NOTIFICATION_RING_MAPPING mapping      = { 0 };
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(InputBuffer != NULL,                                          STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(InputBufferSize >= sizeof(NOTIFICATION_RING_MAPPING_REQUEST), STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT(OutputBuffer != NULL,                                         STATUS_INVALID_PARAMETER_3);
+    IF_FALSE_RETURN_RESULT(OutputBufferSize >= sizeof(NOTIFICATION_RING_MAPPING),        STATUS_INVALID_PARAMETER_4);
+
+    // Capture the raw user-mode input.
+    __try
+    {
+        requestEvent = ((PNOTIFICATION_RING_MAPPING_REQUEST)InputBuffer)->RequestEvent;
+    }
+    __except (LcDriverExceptionFilter(GetExceptionInformation(), TRUE))
+    {
+        return GetExceptionCode();
+    }
+
+    NT_IF_FAIL_RETURN(LcMapNotificationRing(requestEvent, &mapping));
+
+    __try
+    {
+        *(PNOTIFICATION_RING_MAPPING)OutputBuffer = mapping;
+        *ReturnOutputBufferLength                 = sizeof(NOTIFICATION_RING_MAPPING);
+    }
+    __except (LcDriverExceptionFilter(GetExceptionInformation(), TRUE))
+    {
+        status = GetExceptionCode();
+    }
+
+    // Client won't know the ring address, so there is no point in keeping it mapped.
+    if (!NT_SUCCESS(status))
+    {
+        LcUnmapNotificationRing(PsGetCurrentProcess());
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcCompleteRingNotificationsHandler(
+    _In_reads_bytes_opt_(InputBufferSize)                                  PVOID  InputBuffer,
+    _In_                                                                   ULONG  InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize, *ReturnOutputBufferLength) PVOID  OutputBuffer,
+    _In_                                                                   ULONG  OutputBufferSize,
+    _Out_                                                                  PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Summary:
+
+    This function handles the 'CompleteRingNotifications' command received from a user-mode client.
+
+    Client sends it after writing the replies for one or more notification ring slots.
+
+Arguments:
+
+    InputBuffer              - A buffer containing input data, can be NULL if there
+                               is no input data.
+
+    InputBufferSize          - The size, in bytes, of the 'InputBuffer'.
+
+    OutputBuffer             - A buffer provided by the application that originated the
+                               communication in which to store data to be returned to this
+                               application.
+
+    OutputBufferSize         - The size, in bytes, of the 'OutputBuffer'.
+
+    ReturnOutputBufferLength - The size, in bytes, of meaningful data returned in the 'OutputBuffer'.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    PAGED_CODE();
+
+    // The 'CompleteRingNotifications' command does not contain any data.
+    UNREFERENCED_PARAMETER(InputBuffer);
+    UNREFERENCED_PARAMETER(InputBufferSize);
+    UNREFERENCED_PARAMETER(OutputBuffer);
+    UNREFERENCED_PARAMETER(OutputBufferSize);
+
+    *ReturnOutputBufferLength = 0;
+
+    return LcCompleteRingNotifications();
+}
+
+//------------------------------------------------------------------------
+//  Command data parsing functions.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcLoadWatchPaths(
+    _In_ PWATCH_PATHS WatchPaths,
+    _In_ ULONG_PTR    BufferEnd
+    )
+/*++
+
+Summary:
+
+    This function replaces the current paths to watch with the ones from the 'WatchPaths' given,
+    and compiles them.
+
+    The 'WatchPaths' may be a user-mode buffer, so the caller should protect the call
+    with an exception handler.
+
+Arguments:
+
+    WatchPaths - Pointer to the 'WATCH_PATHS' structure.
+
+    BufferEnd  - Address right after the end of the buffer containing the 'WatchPaths'.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS         status = STATUS_SUCCESS;
+    PWATCH_PATH_RULE rule   = NULL;
+    ULONG            idx    = 0;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(WatchPaths != NULL,                                                   STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(BufferEnd >= (ULONG_PTR)WatchPaths + FIELD_OFFSET(WATCH_PATHS, Data), STATUS_INVALID_BUFFER_SIZE);
+
+    // Free the previous list before populating it again.
+    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Clearing previous paths to watch\n"));
+    LcClearPathsToWatch();
+
+    rule = (PWATCH_PATH_RULE)WatchPaths->Data;
+
+    for (idx = 0; idx < WatchPaths->RuleCount; idx++)
+    {
+        UNICODE_STRING path            = { 0 };
+        UNICODE_STRING extension       = { 0 };
+        PWCHAR         extensionBuffer = NULL;
+        SIZE_T         pathLength      = 0;
+        SIZE_T         extensionLength = 0;
+
+        IF_FALSE_RETURN_RESULT(BufferEnd >= (ULONG_PTR)rule->Data, STATUS_INVALID_BUFFER_SIZE);
+
+        pathLength = wcslen(rule->Data);
+        IF_FALSE_RETURN_RESULT(BufferEnd >= (ULONG_PTR)rule->Data + (pathLength + 1) * sizeof(WCHAR), STATUS_INVALID_BUFFER_SIZE);
+
+        extensionBuffer = rule->Data + pathLength + 1;
+        extensionLength = wcslen(extensionBuffer);
+        IF_FALSE_RETURN_RESULT(BufferEnd >= (ULONG_PTR)extensionBuffer + (extensionLength + 1) * sizeof(WCHAR), STATUS_INVALID_BUFFER_SIZE);
+
+        NT_IF_FAIL_RETURN(RtlInitUnicodeStringEx(&path,      rule->Data));
+        NT_IF_FAIL_RETURN(RtlInitUnicodeStringEx(&extension, extensionBuffer));
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Adding path to watch: '%wZ'\n", &path));
+
+        NT_IF_FAIL_RETURN(LcAddPathToWatch(&path, rule->ReportRate, &extension, ULongToHandle(rule->ProcessId)));
+
+        // Move to the next rule in the buffer.
+        rule = (PWATCH_PATH_RULE)ALIGN_UP_POINTER_BY(extensionBuffer + extensionLength + 1, sizeof(ULONG));
+    }
+
+    NT_IF_FAIL_RETURN(LcCompilePathsToWatch());
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcLoadVolumePolicy(
+    _In_ PVOLUME_POLICY VolumePolicy,
+    _In_ ULONG_PTR      BufferEnd
+    )
+/*++
+
+Summary:
+
+    This function replaces the current volume policy rules with the ones from the 'VolumePolicy' given.
+
+    The rules are not applied to the volumes, so the caller should call the 'LcApplyVolumePolicy',
+    once the configuration update is finished.
+
+    The 'VolumePolicy' may be a user-mode buffer, so the caller should protect the call
+    with an exception handler.
+
+Arguments:
+
+    VolumePolicy - Pointer to the 'VOLUME_POLICY' structure.
+
+    BufferEnd    - Address right after the end of the buffer containing the 'VolumePolicy'.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS            status = STATUS_SUCCESS;
+    PVOLUME_POLICY_RULE rule   = NULL;
+    ULONG               idx    = 0;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(VolumePolicy != NULL,                                                     STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(BufferEnd >= (ULONG_PTR)VolumePolicy + FIELD_OFFSET(VOLUME_POLICY, Data), STATUS_INVALID_BUFFER_SIZE);
+
+    // Free the previous rules before populating them again.
+    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Clearing previous volume policy\n"));
+    LcClearVolumePolicies();
+
+    rule = (PVOLUME_POLICY_RULE)VolumePolicy->Data;
+
+    for (idx = 0; idx < VolumePolicy->RuleCount; idx++)
+    {
+        UNICODE_STRING selector       = { 0 };
+        VOLUME_TUNING  tuning         = { 0 };
+        SIZE_T         selectorLength = 0;
+
+        IF_FALSE_RETURN_RESULT(BufferEnd >= (ULONG_PTR)rule->Selector, STATUS_INVALID_BUFFER_SIZE);
+
+        selectorLength = wcslen(rule->Selector);
+        IF_FALSE_RETURN_RESULT(BufferEnd >= (ULONG_PTR)rule->Selector + (selectorLength + 1) * sizeof(WCHAR), STATUS_INVALID_BUFFER_SIZE);
+
+        tuning.ChunkSize           = rule->ChunkSize;
+        tuning.MaxChunks           = rule->MaxChunks;
+        tuning.UnbufferedThreshold = rule->UnbufferedThreshold;
+
+        NT_IF_FAIL_RETURN(RtlInitUnicodeStringEx(&selector, rule->Selector));
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Adding volume policy rule: '%wZ'\n", &selector));
+
+        NT_IF_FAIL_RETURN(LcAddVolumePolicy(&selector, &tuning));
+
+        // Move to the next rule in the buffer.
+        rule = (PVOLUME_POLICY_RULE)ALIGN_UP_POINTER_BY(rule->Selector + selectorLength + 1, sizeof(ULONG));
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+//  Additional validation functions.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcValidateBufferAlignment(
+    _In_ PVOID Buffer
+    )
+/*++
+
+Summary:
+
+    This function validates the 'Buffer' alignment.
+    It supports both 32 and 64-bit platforms.
+
+Arguments:
+
+    Buffer - Buffer, which alignment should be validated.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Buffer != NULL, STATUS_INVALID_PARAMETER_1);
+
+    #if defined(_WIN64)
+    if (IoIs32bitProcess(NULL))
+    {
+        // Validate alignment for the 32bit process on a 64bit system.
+        if (!IS_ALIGNED(Buffer, sizeof(ULONG)))
+        {
+            status = STATUS_DATATYPE_MISALIGNMENT;
+        }
+    }
+    else
+    {
+    #endif // defined(_WIN64)
+
+        if (!IS_ALIGNED(Buffer, sizeof(PVOID)))
+        {
+            status = STATUS_DATATYPE_MISALIGNMENT;
+        }
+
+    #if defined(_WIN64)
+    }
+    #endif // defined(_WIN64)
+
+    return status;
+}
+
+static
+_Check_return_
+NTSTATUS
+LcValidateConfigurationOffset(
+    _In_ ULONG Offset,
+    _In_ ULONG BufferSize
+    )
+/*++
+
+Summary:
+
+    This function validates the section 'Offset' within the 'ApplyConfiguration' command buffer.
+    The section should start after the configuration header, within the buffer and be ULONG-aligned.
+
+Arguments:
+
+    Offset     - Section offset from the start of the DRIVER_CONFIGURATION structure.
+
+    BufferSize - Size of the command buffer.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Offset >= (ULONG)FIELD_OFFSET(DRIVER_CONFIGURATION, Data), STATUS_INVALID_PARAMETER);
+    IF_FALSE_RETURN_RESULT(Offset <= BufferSize,                                      STATUS_INVALID_BUFFER_SIZE);
+    IF_FALSE_RETURN_RESULT(IS_ALIGNED(Offset, sizeof(ULONG)),                         STATUS_DATATYPE_MISALIGNMENT);
+
+    return STATUS_SUCCESS;
+}
@@ -68,15 +68,18 @@ LcOpenFileInUserMode(
 _Check_return_
 NTSTATUS
 LcCloseFileHandle(
-    _In_ HANDLE FileHandle
+    _In_ PEPROCESS ClientProcess,
+    _In_ HANDLE    FileHandle
     );
 
 _Check_return_
 NTSTATUS
 LcFetchFileInUserMode(
-    _In_  PCUNICODE_STRING SourceFile,
-    _In_  PCUNICODE_STRING TargetFile,
-    _Out_ PLARGE_INTEGER   BytesCopied
+    _In_     PCFLT_RELATED_OBJECTS FltObjects,
+    _In_     PCUNICODE_STRING      SourceFile,
+    _In_     PCUNICODE_STRING      TargetFile,
+    _In_opt_ PKEVENT               CancelEvent,
+    _Out_    PLARGE_INTEGER        BytesCopied
     );
 
 #endif // __LAZY_COPY_COMMUNICATION_H__
@@ -62,7 +62,18 @@ typedef enum _DRIVER_COMMAND_TYPE
     ReadRegistryParameters = 100,
     SetOperationMode       = 101,
     SetWatchPaths          = 102,
-    SetReportRate          = 103
+    SetReportRate          = 103,
+    SetVolumePolicy        = 104,
+    ApplyConfiguration     = 105,
+
+    // Driver statistics commands.
+    DrainFileAccesses      = 200,
+    GetStatistics          = 201,
+    GetActiveFetches       = 202,
+
+    // Notification ring commands.
+    MapNotificationRing       = 300,
+    CompleteRingNotifications = 301
 } DRIVER_COMMAND_TYPE, *PDRIVER_COMMAND_TYPE;
 
 //
@@ -80,6 +91,103 @@ typedef enum _DRIVER_NOTIFICATION_TYPE
     FetchFileInUserMode = 3
 } DRIVER_NOTIFICATION_TYPE, *PDRIVER_NOTIFICATION_TYPE;
 
+//
+// Lane the notification is sent through.
+// Each client connection serves a set of lanes, so the short requests don't wait behind the long ones.
+//
+typedef enum _NOTIFICATION_LANE
+{
+    // Latency-sensitive requests: 'OpenFileInUserMode' and 'CloseFileHandle'.
+    NotificationLaneLatency = 0,
+
+    // Bulk requests: 'FetchFileInUserMode'.
+    NotificationLaneBulk    = 1,
+
+    // Amount of notification lanes.
+    NotificationLaneCount
+} NOTIFICATION_LANE, *PNOTIFICATION_LANE;
+
+//
+// Operation callback counted in the driver statistics.
+//
+typedef enum _DRIVER_CALLBACK_TYPE
+{
+    PreCreateCallback               = 0,
+    PostCreateCallback              = 1,
+    PreReadWriteCallback            = 2,
+    PreQueryInformationCallback     = 3,
+    PostQueryInformationCallback    = 4,
+    PreDirectoryControlCallback     = 5,
+    PostDirectoryControlCallback    = 6,
+    PreFileSystemControlCallback    = 7,
+    PreSetInformationCallback       = 8,
+    PostFileSystemControlCallback   = 9,
+    PostSetInformationCallback      = 10,
+
+    // Amount of callback types.
+    DriverCallbackTypeCount
+} DRIVER_CALLBACK_TYPE, *PDRIVER_CALLBACK_TYPE;
+
+//
+// Phase of the file fetch, which latency is measured in the driver statistics
+// and traced with the 'File_Fetch_Phase' ETW event.
+//
+typedef enum _FETCH_PHASE
+{
+    // Opening the remote file.
+    FetchPhaseOpen          = 0,
+
+    // Querying the remote file size.
+    FetchPhaseSizeQuery     = 1,
+
+    // Reading a single chunk from the remote file.
+    FetchPhaseRead          = 2,
+
+    // Writing a single chunk to the local file.
+    FetchPhaseWrite         = 3,
+
+    // Removing the reparse point from the fetched file.
+    FetchPhaseUntag         = 4,
+
+    // Whole fetch, including the user-mode ones.
+    FetchPhaseTotal         = 5,
+
+    // Waiting for another thread fetching the same file.
+    FetchPhaseLockWait      = 6,
+
+    // Checking the reparse tag of the file to be fetched.
+    FetchPhaseReparseRead   = 7,
+
+    // Deleting the stream context from the fetched file.
+    FetchPhaseContextDelete = 8,
+
+    // Amount of fetch phases.
+    FetchPhaseCount
+} FETCH_PHASE, *PFETCH_PHASE;
+
+//
+// State of the notification ring slot.
+// The driver moves slots from 'Free' to 'Request', the client moves them from 'Request' to 'Reply',
+// or back to 'Free', if no reply is expected.
+//
+typedef enum _NOTIFICATION_SLOT_STATE
+{
+    // Slot can be taken by the driver.
+    NotificationSlotFree       = 0,
+
+    // Driver is writing the notification to the slot.
+    NotificationSlotFilling    = 1,
+
+    // Notification is ready to be processed by the client.
+    NotificationSlotRequest    = 2,
+
+    // Client is processing the notification.
+    NotificationSlotProcessing = 3,
+
+    // Client has written the reply to the slot.
+    NotificationSlotReply      = 4
+} NOTIFICATION_SLOT_STATE, *PNOTIFICATION_SLOT_STATE;
+
 //------------------------------------------------------------------------
 //  Structures.
 //------------------------------------------------------------------------
@@ -107,6 +215,16 @@ typedef struct _DRIVER_NOTIFICATION
     PVOID                    Data;
 } DRIVER_NOTIFICATION, *PDRIVER_NOTIFICATION;
 
+//
+// Optional context the user-mode client passes, when it connects to the communication port.
+//
+typedef struct _CLIENT_CONNECTION_CONTEXT
+{
+    // Lanes the connection receives notifications for. Bit N is set for the lane N, see the 'NOTIFICATION_LANE'.
+    // Connections without the context receive notifications for all lanes.
+    ULONG LaneMask;
+} CLIENT_CONNECTION_CONTEXT, *PCLIENT_CONNECTION_CONTEXT;
+
 //------------------------------------------------------------------------
 //  'GetDriverVersion' command.
 //------------------------------------------------------------------------
@@ -137,15 +255,33 @@ typedef struct _OPERATION_MODE
 //------------------------------------------------------------------------
 
 //
-// Contains list of paths to be watched for file access operations.
+// Contains a single rule defining the files to be watched for access operations.
 //
-typedef struct _WATCH_PATHS
+typedef struct _WATCH_PATH_RULE
 {
-    // Probability of sending the file access notification for the 'Path'.
-    ULONG PathCount;
+    // Probability of sending the file access notification for the files matching this rule.
+    // 0xFFFFFFFF means the value set by the 'SetReportRate' command is used.
+    ULONG ReportRate;
 
-    // Buffer containing the list of paths.
+    // Only the files opened by this process match the rule. Zero matches any process.
+    ULONG ProcessId;
+
+    // Null-terminated path, followed by the null-terminated file extension.
+    // Empty extension matches any file.
+    // Next rule starts at the ULONG-aligned offset after the extension.
     WCHAR Data[];
+} WATCH_PATH_RULE, *PWATCH_PATH_RULE;
+
+//
+// Contains list of rules defining the paths to be watched for file access operations.
+//
+typedef struct _WATCH_PATHS
+{
+    // Amount of rules in the 'Data' buffer.
+    ULONG RuleCount;
+
+    // Buffer containing the list of 'WATCH_PATH_RULE' structures.
+    UCHAR Data[];
 } WATCH_PATHS, *PWATCH_PATHS;
 
 //------------------------------------------------------------------------
@@ -161,6 +297,308 @@ typedef struct _REPORT_RATE
     ULONG ReportRate;
 } REPORT_RATE, *PREPORT_RATE;
 
+//------------------------------------------------------------------------
+//  'SetVolumePolicy' command.
+//------------------------------------------------------------------------
+
+//
+// Contains a single volume policy rule.
+//
+typedef struct _VOLUME_POLICY_RULE
+{
+    // Size of the chunks used to fetch files. Zero means the default value.
+    ULONG ChunkSize;
+
+    // Maximum amount of chunks used to fetch a file. Zero means the default value.
+    ULONG MaxChunks;
+
+    // Files of this size or larger are written bypassing the system cache. Zero disables it.
+    ULONG UnbufferedThreshold;
+
+    // Null-terminated volume selector: '*', 'FS:<name>', 'GUID:<guid>' or 'LABEL:<label>'.
+    // Next rule starts at the ULONG-aligned offset after the selector.
+    WCHAR Selector[];
+} VOLUME_POLICY_RULE, *PVOLUME_POLICY_RULE;
+
+//
+// Contains list of rules defining the volumes the driver attaches to.
+//
+typedef struct _VOLUME_POLICY
+{
+    // Amount of rules in the 'Data' buffer.
+    ULONG RuleCount;
+
+    // Buffer containing the list of 'VOLUME_POLICY_RULE' structures.
+    UCHAR Data[];
+} VOLUME_POLICY, *PVOLUME_POLICY;
+
+//------------------------------------------------------------------------
+//  'ApplyConfiguration' command.
+//------------------------------------------------------------------------
+
+//
+// Version of the 'DRIVER_CONFIGURATION' layout expected by this driver.
+//
+#define DRIVER_CONFIGURATION_VERSION 1
+
+//
+// Contains the whole driver configuration applied at once.
+//
+typedef struct _DRIVER_CONFIGURATION
+{
+    // Should be equal to the 'DRIVER_CONFIGURATION_VERSION'.
+    ULONG Version;
+
+    // New driver operation mode.
+    ULONG OperationMode;
+
+    // Default probability of sending the file access notifications.
+    ULONG ReportRate;
+
+    // ULONG-aligned offset of the 'WATCH_PATHS' structure from the start of this structure.
+    ULONG WatchPathsOffset;
+
+    // ULONG-aligned offset of the 'VOLUME_POLICY' structure from the start of this structure.
+    // Zero, if the current volume policy should be kept.
+    ULONG VolumePolicyOffset;
+
+    // Buffer containing the 'WATCH_PATHS' and 'VOLUME_POLICY' structures.
+    UCHAR Data[];
+} DRIVER_CONFIGURATION, *PDRIVER_CONFIGURATION;
+
+//------------------------------------------------------------------------
+//  'DrainFileAccesses' command.
+//------------------------------------------------------------------------
+
+//
+// Contains the access statistics collected for a single file.
+//
+typedef struct _FILE_ACCESS_RECORD
+{
+    // Amount of times the file access was reported.
+    LONGLONG AccessCount;
+
+    // System time of the first and the last reported file access.
+    LONGLONG FirstAccessTime;
+    LONGLONG LastAccessTime;
+
+    // Length of the 'Path' in bytes, not including the null-terminator.
+    ULONG    PathLength;
+
+    // Null-terminated file path.
+    // Next record starts at the LONGLONG-aligned offset after the path.
+    WCHAR    Path[];
+} FILE_ACCESS_RECORD, *PFILE_ACCESS_RECORD;
+
+//
+// Contains the batch of records drained from the access table.
+//
+typedef struct _FILE_ACCESSES
+{
+    // Amount of records in the 'Data' buffer.
+    ULONG    RecordCount;
+
+    // Amount of records left in the table, because they didn't fit into the output buffer.
+    ULONG    RemainingCount;
+
+    // Amount of file accesses that were not recorded since the previous drain, because the table was full.
+    LONGLONG DroppedCount;
+
+    // Buffer containing the list of 'FILE_ACCESS_RECORD' structures.
+    UCHAR    Data[];
+} FILE_ACCESSES, *PFILE_ACCESSES;
+
+//------------------------------------------------------------------------
+//  'GetStatistics' command.
+//------------------------------------------------------------------------
+
+//
+// Amount of buckets in the fetch latency histograms.
+// Bucket 0 counts operations faster than 1 microsecond, and the bucket N
+// counts the ones that took [2^(N-1), 2^N) microseconds. The last bucket
+// also counts all slower operations.
+//
+#define STATISTICS_LATENCY_BUCKETS 32
+
+//
+// Contains the driver statistics summed over all processors.
+//
+typedef struct _DRIVER_STATISTICS
+{
+    // System time the statistics were collected at.
+    LONGLONG CollectionTime;
+
+    // Amount of times each operation callback was invoked. See the 'DRIVER_CALLBACK_TYPE'.
+    LONGLONG CallbackCounts[DriverCallbackTypeCount];
+
+    // Amount of fetches finished successfully and the ones failed.
+    LONGLONG FetchesCompleted;
+    LONGLONG FetchesFailed;
+
+    // Amount of bytes read from the remote files and written to the local ones by the driver.
+    LONGLONG BytesRead;
+    LONGLONG BytesWritten;
+
+    // Amount of bytes fetched, including the files fetched by the user-mode client.
+    LONGLONG BytesFetched;
+
+    // Amount of placeholder cache lookups that found the file name and the ones that didn't.
+    LONGLONG PlaceholderCacheHits;
+    LONGLONG PlaceholderCacheMisses;
+
+    // Amount of LazyCopy file opens that required the create operation to be reissued and the ones that didn't.
+    LONGLONG CreatesReissued;
+    LONGLONG CreatesNotReissued;
+
+    // Amount of directory queries passed through, because the directory is known to contain
+    // no LazyCopy files, and the ones, which results were processed by the driver.
+    LONGLONG DirectoryQueriesSkipped;
+    LONGLONG DirectoryQueriesProcessed;
+
+    // Amount of create operations skipped, because the file is known not to be a LazyCopy file,
+    // and the ones, which file was not found in the negative cache.
+    LONGLONG NegativeCacheHits;
+    LONGLONG NegativeCacheMisses;
+
+    // Latency histograms for each fetch phase. See the 'FETCH_PHASE'.
+    LONGLONG FetchLatency[FetchPhaseCount][STATISTICS_LATENCY_BUCKETS];
+
+    // Amount of notifications waiting for the client reply in each lane. See the 'NOTIFICATION_LANE'.
+    LONGLONG NotificationQueueDepth[NotificationLaneCount];
+} DRIVER_STATISTICS, *PDRIVER_STATISTICS;
+
+//------------------------------------------------------------------------
+//  'GetActiveFetches' command.
+//------------------------------------------------------------------------
+
+//
+// Contains the progress of a single file fetch in flight.
+//
+typedef struct _ACTIVE_FETCH_RECORD
+{
+    // Expected size of the file being fetched.
+    LONGLONG FileSize;
+
+    // Amount of bytes written to the local file so far.
+    // Files fetched by the user-mode client report zero until they are fetched.
+    LONGLONG BytesCopied;
+
+    // System time the fetch was started at.
+    LONGLONG StartTime;
+
+    // ID of the process, which access triggered the fetch.
+    ULONG    ProcessId;
+
+    // Amount of threads waiting for the fetch to finish.
+    ULONG    WaiterCount;
+
+    // Whether the file is fetched by the user-mode client.
+    ULONG    UserModeFetch;
+
+    // Length of the local and remote paths in bytes, not including the null-terminators.
+    ULONG    LocalPathLength;
+    ULONG    RemotePathLength;
+
+    // Null-terminated local path, followed by the null-terminated remote path.
+    // Next record starts at the LONGLONG-aligned offset after the remote path.
+    WCHAR    Data[];
+} ACTIVE_FETCH_RECORD, *PACTIVE_FETCH_RECORD;
+
+//
+// Contains the snapshot of the file fetches in flight.
+//
+typedef struct _ACTIVE_FETCHES
+{
+    // Amount of records in the 'Data' buffer.
+    ULONG    RecordCount;
+
+    // Amount of fetches not returned, because they didn't fit into the output buffer.
+    ULONG    RemainingCount;
+
+    // System time the snapshot was taken at.
+    LONGLONG CollectionTime;
+
+    // Buffer containing the list of 'ACTIVE_FETCH_RECORD' structures.
+    UCHAR    Data[];
+} ACTIVE_FETCHES, *PACTIVE_FETCHES;
+
+//------------------------------------------------------------------------
+//  'MapNotificationRing' command.
+//------------------------------------------------------------------------
+
+// Version of the 'NOTIFICATION_RING' layout.
+#define NOTIFICATION_RING_VERSION         1
+
+// Amount of slots in the notification ring.
+#define NOTIFICATION_RING_SLOT_COUNT      32
+
+// Size of the data buffer in each slot. Notifications that don't fit are sent via the communication port.
+#define NOTIFICATION_RING_SLOT_DATA_SIZE  4072
+
+//
+// Contains the parameters of the 'MapNotificationRing' command.
+//
+typedef struct _NOTIFICATION_RING_MAPPING_REQUEST
+{
+    // Handle to the client event the driver should signal, when new notifications are posted.
+    HANDLE RequestEvent;
+} NOTIFICATION_RING_MAPPING_REQUEST, *PNOTIFICATION_RING_MAPPING_REQUEST;
+
+//
+// Reply for the 'MapNotificationRing' command.
+//
+typedef struct _NOTIFICATION_RING_MAPPING
+{
+    // Address of the 'NOTIFICATION_RING' in the client process.
+    PVOID RingAddress;
+
+    // Size of the mapping, in bytes.
+    ULONG RingSize;
+} NOTIFICATION_RING_MAPPING, *PNOTIFICATION_RING_MAPPING;
+
+//
+// Single notification ring slot.
+//
+typedef struct _NOTIFICATION_RING_SLOT
+{
+    // Current slot state. See the 'NOTIFICATION_SLOT_STATE'.
+    __volatile LONG          State;
+
+    // Notification type.
+    DRIVER_NOTIFICATION_TYPE Type;
+
+    // Length of the notification data, or the reply data, when the slot is in the 'Reply' state.
+    ULONG                    DataLength;
+
+    // Maximum reply length expected by the driver. Zero, if no reply is expected.
+    ULONG                    ReplyLength;
+
+    // Status set by the client. Negative value means the notification handler failed.
+    LONG                     Status;
+
+    ULONG                    Reserved;
+
+    // Notification data, replaced with the reply data by the client.
+    UCHAR                    Data[NOTIFICATION_RING_SLOT_DATA_SIZE];
+} NOTIFICATION_RING_SLOT, *PNOTIFICATION_RING_SLOT;
+
+//
+// Notification ring shared between the driver and the client.
+//
+typedef struct _NOTIFICATION_RING
+{
+    // Layout version, slot count and size, so the client can validate them.
+    ULONG                  Version;
+    ULONG                  SlotCount;
+    ULONG                  SlotSize;
+
+    // Set by the client before it waits for the request event.
+    // The driver only signals the event, if this flag is set, and clears it.
+    __volatile LONG        ClientWaiting;
+
+    NOTIFICATION_RING_SLOT Slots[NOTIFICATION_RING_SLOT_COUNT];
+} NOTIFICATION_RING, *PNOTIFICATION_RING;
+
 //------------------------------------------------------------------------
 //  'OpenFileInUserMode' notification.
 //------------------------------------------------------------------------
@@ -209,6 +647,11 @@ typedef struct _FILE_CLOSE_NOTIFICATION_DATA
 //
 typedef struct _FILE_FETCH_NOTIFICATION_DATA
 {
+    // Handle to the target file opened for writing in the client process.
+    // The client owns the handle, once it receives the notification, and should close it, when the fetch
+    // is finished, even if the driver has stopped waiting for the reply.
+    HANDLE TargetHandle;
+
     // Paths to the source and target files.
     // Strings are divided by the null-terminator.
     WCHAR Data[];
@@ -42,9 +42,25 @@ Environment:
 
 #include "Configuration.h"
 #include "LazyCopyEtw.h"
+#include "PathTrie.h"
 #include "Registry.h"
 #include "Utilities.h"
 
+//------------------------------------------------------------------------
+//  Defines.
+//------------------------------------------------------------------------
+
+// Amount of the configuration snapshot reader counters.
+// Readers use the counter that belongs to the current processor, so they don't contend
+// for the same cache line.
+#define SNAPSHOT_READER_SLOTS 64
+
+// Delay between the checks for the configuration snapshot readers to leave, in milliseconds.
+#define SNAPSHOT_READER_WAIT_INTERVAL 1
+
+// Minimal amount of slots in the trusted process hash set. Should be a power of two.
+#define TRUSTED_PROCESS_MIN_SLOTS 8
+
 //------------------------------------------------------------------------
 //  Structures.
 //------------------------------------------------------------------------
@@ -63,16 +79,47 @@ typedef struct _DRIVER_CONFIGURATION_DATA
     // Probability of raising the FileAccessed ETW event.
     __volatile ULONG                 ReportRate;
 
+    // Time, in milliseconds, the user-mode client is given to fetch a file. Zero means no timeout.
+    __volatile ULONG                 UserModeFetchTimeout;
+
     // Registry path to read the driver configuration parameters from,
     // when the 'LcReadConfigurationFromRegistry' function is called.
     UNICODE_STRING                   RegistryPath;
 
+    // Current configuration snapshot used by the file operation callbacks.
+    PCONFIGURATION_SNAPSHOT __volatile Snapshot;
+
+    // Reader epoch. Readers are counted separately for the odd and even epochs,
+    // so the previous snapshot can be freed, when there are no readers left in the previous epoch.
+    __volatile LONG                  SnapshotEpoch;
+
+    // Nesting level of the 'LcBeginConfigurationUpdate' calls.
+    // A new snapshot is published, when the outermost update ends.
+    ULONG                            UpdateDepth;
+
     // List of 'trusted' processes that will not be monitored by this driver.
     LIST_ENTRY                       TrustedProccessList;
 
+    // Amount of elements in the 'TrustedProccessList' list.
+    ULONG                            TrustedProcessCount;
+
+    // Whether the 'LcProcessNotifyRoutine' is registered.
+    BOOLEAN                          ProcessNotifyRegistered;
+
     // List of path roots that should be monitored for file access operations.
     LIST_ENTRY                       PathsToWatch;
 
+    // Amount of elements in the 'PathsToWatch' list.
+    ULONG                            PathsToWatchCount;
+
+    // Paths to watch compiled by the 'LcCompilePathsToWatch'.
+    // It's NULL, if there are no paths to watch.
+    PWATCH_RULES                     WatchRules;
+
+    // List of volume selectors the driver should be attached to.
+    // If it's empty, the driver is attached to all NTFS volumes.
+    LIST_ENTRY                       VolumePolicies;
+
 } DRIVER_CONFIGURATION_DATA, *PDRIVER_CONFIGURATION_DATA;
 
 //
@@ -90,13 +137,166 @@ typedef struct _TRUSTED_PROCESS_ENTRY
 typedef struct _PATH_TO_WATCH_ENTRY
 {
     UNICODE_STRING Path;
+
+    // Report rate for the files matching this entry, or the 'GLOBAL_REPORT_RATE'.
+    ULONG          ReportRate;
+
+    // File extension without the leading dot. Empty, if any extension matches.
+    UNICODE_STRING Extension;
+
+    // Process the files should be opened by. NULL, if any process matches.
+    HANDLE         ProcessId;
+
     LIST_ENTRY     ListEntry;
 } PATH_TO_WATCH_ENTRY, *PPATH_TO_WATCH_ENTRY;
 
+//
+// Compiled watch rule.
+//
+typedef struct _WATCH_RULE
+{
+    ULONG          ReportRate;
+    HANDLE         ProcessId;
+
+    // Points to the 'WATCH_RULES' buffer.
+    UNICODE_STRING Extension;
+} WATCH_RULE, *PWATCH_RULE;
+
+//
+// Paths to watch compiled by the 'LcCompilePathsToWatch'.
+// The trie path indices are the indices in the 'Rules' array.
+//
+struct _WATCH_RULES
+{
+    // Watch rules are shared by the configuration snapshots.
+    __volatile LONG ReferenceCount;
+
+    PPATH_TRIE      Trie;
+
+    ULONG           RuleCount;
+
+    // Extensions follow the rules in the same buffer.
+    WATCH_RULE      Rules[ANYSIZE_ARRAY];
+};
+
+//
+// Context passed to the 'LcMatchWatchRule'.
+//
+typedef struct _WATCH_RULE_MATCH_CONTEXT
+{
+    PWATCH_RULES   WatchRules;
+
+    // Properties of the file being matched.
+    UNICODE_STRING Extension;
+    HANDLE         ProcessId;
+
+    // Receives the report rate of the rule matched.
+    ULONG          ReportRate;
+} WATCH_RULE_MATCH_CONTEXT, *PWATCH_RULE_MATCH_CONTEXT;
+
+//
+// Defines the volume property the 'VOLUME_POLICY_ENTRY' is matched against.
+//
+typedef enum _VOLUME_SELECTOR_TYPE
+{
+    // Matches all volumes: '*'.
+    VolumeSelectorAny        = 0,
+
+    // File system name, i.e. 'FS:NTFS'.
+    VolumeSelectorFileSystem = 1,
+
+    // Volume GUID, i.e. 'GUID:{00000000-0000-0000-0000-000000000000}'.
+    VolumeSelectorGuid       = 2,
+
+    // Volume label, i.e. 'LABEL:Data'.
+    VolumeSelectorLabel      = 3
+} VOLUME_SELECTOR_TYPE, *PVOLUME_SELECTOR_TYPE;
+
+//
+// The 'Configuration.VolumePolicies' list entry.
+//
+typedef struct _VOLUME_POLICY_ENTRY
+{
+    VOLUME_SELECTOR_TYPE SelectorType;
+
+    // Selector value without the type prefix.
+    UNICODE_STRING       Value;
+
+    // Fetch tuning parameters for the matching volumes.
+    VOLUME_TUNING        Tuning;
+
+    LIST_ENTRY           ListEntry;
+} VOLUME_POLICY_ENTRY, *PVOLUME_POLICY_ENTRY;
+
+//
+// Configuration snapshot reader counters for the odd and even epochs.
+//
+typedef struct DECLSPEC_CACHEALIGN _SNAPSHOT_READER_SLOT
+{
+    __volatile LONG Count[2];
+} SNAPSHOT_READER_SLOT, *PSNAPSHOT_READER_SLOT;
+
 //------------------------------------------------------------------------
 //  Local functions.
 //------------------------------------------------------------------------
 
+static
+_Check_return_
+NTSTATUS
+LcPublishConfigurationSnapshot();
+
+static
+VOID
+LcFreeConfigurationSnapshot(
+    _In_ PCONFIGURATION_SNAPSHOT Snapshot
+    );
+
+static
+PSNAPSHOT_READER_SLOT
+LcGetSnapshotReaderSlot();
+
+static
+_Check_return_
+BOOLEAN
+LcFindTrustedProcess(
+    _In_ HANDLE ProcessId
+    );
+
+static
+ULONG
+LcHashProcessId(
+    _In_ HANDLE ProcessId
+    );
+
+static
+VOID
+LcReleaseWatchRules(
+    _In_ PWATCH_RULES WatchRules
+    );
+
+static
+_Check_return_
+BOOLEAN
+LcMatchWatchRule(
+    _In_     ULONG PathIndex,
+    _In_opt_ PVOID Context
+    );
+
+static
+VOID
+LcGetFileExtension(
+    _In_  PCUNICODE_STRING Path,
+    _Out_ PUNICODE_STRING  Extension
+    );
+
+static
+VOID
+LcProcessNotifyRoutine(
+    _In_ HANDLE  ParentId,
+    _In_ HANDLE  ProcessId,
+    _In_ BOOLEAN Create
+    );
+
 static
 _Check_return_
 NTSTATUS
@@ -104,6 +304,12 @@ LcValidatePath(
     _In_ PCUNICODE_STRING Path
     );
 
+static
+VOID
+LcNormalizeVolumeTuning(
+    _Inout_ PVOLUME_TUNING Tuning
+    );
+
 //------------------------------------------------------------------------
 //  Text sections.
 //------------------------------------------------------------------------
@@ -116,6 +322,16 @@ LcValidatePath(
     // Registry access functions.
     #pragma alloc_text(PAGE, LcReadConfigurationFromRegistry)
 
+    // Configuration snapshot functions.
+    #pragma alloc_text(PAGE, LcAcquireConfigurationSnapshot)
+    #pragma alloc_text(PAGE, LcReleaseConfigurationSnapshot)
+    #pragma alloc_text(PAGE, LcIsProcessTrustedInSnapshot)
+    #pragma alloc_text(PAGE, LcGetReportRateForPathInSnapshot)
+
+    // Configuration update functions.
+    #pragma alloc_text(PAGE, LcBeginConfigurationUpdate)
+    #pragma alloc_text(PAGE, LcEndConfigurationUpdate)
+
     // Trusted processes management functions.
     #pragma alloc_text(PAGE, LcAddTrustedProcess)
     #pragma alloc_text(PAGE, LcRemoveTrustedProcess)
@@ -124,9 +340,15 @@ LcValidatePath(
 
     // Paths to watch management functions.
     #pragma alloc_text(PAGE, LcAddPathToWatch)
+    #pragma alloc_text(PAGE, LcCompilePathsToWatch)
     #pragma alloc_text(PAGE, LcIsPathWatched)
     #pragma alloc_text(PAGE, LcClearPathsToWatch)
 
+    // Volume policy management functions.
+    #pragma alloc_text(PAGE, LcAddVolumePolicy)
+    #pragma alloc_text(PAGE, LcGetVolumePolicy)
+    #pragma alloc_text(PAGE, LcClearVolumePolicies)
+
     // Operation mode management functions.
     #pragma alloc_text(PAGE, LcSetOperationMode)
     #pragma alloc_text(PAGE, LcGetOperationMode)
@@ -135,8 +357,22 @@ LcValidatePath(
     #pragma alloc_text(PAGE, LcSetReportRate)
     #pragma alloc_text(PAGE, LcGetReportRateForPath)
 
+    // User-mode fetch timeout management functions.
+    #pragma alloc_text(PAGE, LcSetUserModeFetchTimeout)
+    #pragma alloc_text(PAGE, LcGetUserModeFetchTimeout)
+
     // Local functions.
+    #pragma alloc_text(PAGE, LcPublishConfigurationSnapshot)
+    #pragma alloc_text(PAGE, LcFreeConfigurationSnapshot)
+    #pragma alloc_text(PAGE, LcGetSnapshotReaderSlot)
+    #pragma alloc_text(PAGE, LcFindTrustedProcess)
+    #pragma alloc_text(PAGE, LcHashProcessId)
+    #pragma alloc_text(PAGE, LcReleaseWatchRules)
+    #pragma alloc_text(PAGE, LcMatchWatchRule)
+    #pragma alloc_text(PAGE, LcGetFileExtension)
+    #pragma alloc_text(PAGE, LcProcessNotifyRoutine)
     #pragma alloc_text(PAGE, LcValidatePath)
+    #pragma alloc_text(PAGE, LcNormalizeVolumeTuning)
 #endif // ALLOC_PRAGMA
 
 //------------------------------------------------------------------------
@@ -146,6 +382,9 @@ LcValidatePath(
 // Local instance of the configuration structure.
 static DRIVER_CONFIGURATION_DATA Configuration = { 0 };
 
+// Configuration snapshot reader counters.
+static SNAPSHOT_READER_SLOT SnapshotReaders[SNAPSHOT_READER_SLOTS] = { 0 };
+
 //------------------------------------------------------------------------
 //  Configuration lifecycle management functions.
 //------------------------------------------------------------------------
@@ -188,9 +427,19 @@ Return value:
         // Initalize lists.
         InitializeListHead(&Configuration.TrustedProccessList);
         InitializeListHead(&Configuration.PathsToWatch);
+        InitializeListHead(&Configuration.VolumePolicies);
+
+        Configuration.ReportRate           = 0;
+        Configuration.OperationMode        = DriverDisabled;
+        Configuration.UserModeFetchTimeout = DEFAULT_USER_MODE_FETCH_TIMEOUT;
+
+        // Publish the initial snapshot, so readers always have one.
+        NT_IF_FAIL_LEAVE(LcPublishConfigurationSnapshot());
 
-        Configuration.ReportRate    = 0;
-        Configuration.OperationMode = DriverDisabled;
+        // Trusted processes are removed from the list, when they exit,
+        // so their IDs are not trusted, when they are reused by other processes.
+        NT_IF_FAIL_LEAVE(PsSetCreateProcessNotifyRoutine(LcProcessNotifyRoutine, FALSE));
+        Configuration.ProcessNotifyRegistered = TRUE;
 
         // Read parameters from the Registry.
         NT_IF_FAIL_LEAVE(LcCopyUnicodeString(&Configuration.RegistryPath, RegistryPath));
@@ -237,6 +486,12 @@ Return value:
         return;
     }
 
+    if (Configuration.ProcessNotifyRegistered)
+    {
+        PsSetCreateProcessNotifyRoutine(LcProcessNotifyRoutine, TRUE);
+        Configuration.ProcessNotifyRegistered = FALSE;
+    }
+
     if (Configuration.TrustedProccessList.Flink != NULL)
     {
         LcClearTrustedProcesses();
@@ -247,11 +502,23 @@ Return value:
         LcClearPathsToWatch();
     }
 
+    if (Configuration.VolumePolicies.Flink != NULL)
+    {
+        LcClearVolumePolicies();
+    }
+
     if (Configuration.RegistryPath.Buffer != NULL)
     {
         LcFreeUnicodeString(&Configuration.RegistryPath);
     }
 
+    // There should be no readers left, when the driver is being unloaded.
+    if (Configuration.Snapshot != NULL)
+    {
+        LcFreeConfigurationSnapshot(Configuration.Snapshot);
+        Configuration.Snapshot = NULL;
+    }
+
     LcFreeResource(Configuration.Lock);
     Configuration.Lock = NULL;
 }
@@ -274,8 +541,12 @@ Summary:
 
     This minifilter reads the following values:
     * OperationMode - see the 'LcSetOperationMode';
-    * ReportRate    - see the 'LcSetReportRate';
-    * WatchPaths    - see the 'LcAddPathToWatch'.
+    * ReportRate           - see the 'LcSetReportRate';
+    * UserModeFetchTimeout - see the 'LcSetUserModeFetchTimeout';
+    * WatchPaths           - see the 'LcAddPathToWatch';
+    * VolumePolicy         - see the 'LcAddVolumePolicy'. Default tuning parameters are used.
+
+    A single configuration snapshot is published, after all values are read.
 
 Arguments:
 
@@ -287,20 +558,21 @@ Return value:
 
 --*/
 {
-    NTSTATUS       status      = STATUS_SUCCESS;
-    UNICODE_STRING valueName   = { 0 };
-    UNICODE_STRING stringValue = { 0 };
-    ULONG          dwordValue  = 0;
+    NTSTATUS       status        = STATUS_SUCCESS;
+    NTSTATUS       publishStatus = STATUS_SUCCESS;
+    UNICODE_STRING valueName     = { 0 };
+    UNICODE_STRING stringValue   = { 0 };
+    ULONG          dwordValue    = 0;
 
     // Temporary variables for parsing the 'WatchPaths' values.
-    PWCHAR         buffer      = NULL;
+    PWCHAR         buffer        = NULL;
 
     PAGED_CODE();
 
     IF_FALSE_RETURN_RESULT(NT_SUCCESS(RtlUnicodeStringValidate(&Configuration.RegistryPath)), STATUS_INVALID_PARAMETER);
     LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Reading configuration from the registry key: '%wZ'\n", Configuration.RegistryPath));
 
-    FltAcquireResourceExclusive(Configuration.Lock);
+    LcBeginConfigurationUpdate();
 
     __try
     {
@@ -330,6 +602,32 @@ Return value:
             LcSetReportRate(dwordValue);
         }
 
+        //
+        // Read the 'UserModeFetchTimeout' value.
+        //
+
+        NT_IF_FAIL_LEAVE(RtlInitUnicodeStringEx(&valueName, L"UserModeFetchTimeout"));
+        status = LcGetRegistryValueDWord(&Configuration.RegistryPath, &valueName, &dwordValue);
+        if (!NT_SUCCESS(status))
+        {
+            if (status == STATUS_INVALID_PARAMETER)
+            {
+                LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] UserModeFetchTimeout value not found\n"));
+
+                LcSetUserModeFetchTimeout(DEFAULT_USER_MODE_FETCH_TIMEOUT);
+                status = STATUS_SUCCESS;
+            }
+            else
+            {
+                LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Unable to get UserModeFetchTimeout value: %08X\n", status));
+                __leave;
+            }
+        }
+        else
+        {
+            LcSetUserModeFetchTimeout(dwordValue);
+        }
+
         //
         // Read the 'OperationMode' value.
         //
@@ -392,14 +690,60 @@ Return value:
                 }
 
                 NT_IF_FAIL_LEAVE(RtlInitUnicodeStringEx(&currentString, buffer));
-                NT_IF_FAIL_LEAVE(LcAddPathToWatch(&currentString));
+                NT_IF_FAIL_LEAVE(LcAddPathToWatch(&currentString, GLOBAL_REPORT_RATE, NULL, NULL));
 
                 buffer += currentStringLength + 1;
             }
 
+            NT_IF_FAIL_LEAVE(LcCompilePathsToWatch());
+
             // Don't forget to free the string before reusing it.
             LcFreeUnicodeString(&stringValue);
         }
+
+        //
+        // Read the 'VolumePolicy' value.
+        //
+
+        LcClearVolumePolicies();
+
+        NT_IF_FAIL_LEAVE(RtlInitUnicodeStringEx(&valueName, L"VolumePolicy"));
+        status = LcGetRegistryValueString(&Configuration.RegistryPath, &valueName, &stringValue);
+        if (!NT_SUCCESS(status))
+        {
+            if (status == STATUS_INVALID_PARAMETER)
+            {
+                LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] VolumePolicy value not found\n"));
+                status = STATUS_SUCCESS;
+            }
+            else
+            {
+                LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Unable to get VolumePolicy value: %08X\n", status));
+                __leave;
+            }
+        }
+        else
+        {
+            __analysis_assume(stringValue.Buffer != NULL);
+            buffer = stringValue.Buffer;
+
+            for (;;)
+            {
+                UNICODE_STRING currentString       = { 0 };
+                SIZE_T         currentStringLength = wcslen(buffer);
+                if (currentStringLength == 0)
+                {
+                    break;
+                }
+
+                NT_IF_FAIL_LEAVE(RtlInitUnicodeStringEx(&currentString, buffer));
+                NT_IF_FAIL_LEAVE(LcAddVolumePolicy(&currentString, NULL));
+
+                buffer += currentStringLength + 1;
+            }
+
+            LcFreeUnicodeString(&stringValue);
+        }
     }
     __finally
     {
@@ -415,94 +759,103 @@ Return value:
             LcSetOperationMode(DriverDisabled);
             LcSetReportRate(0);
             LcClearPathsToWatch();
+            LcClearVolumePolicies();
         }
 
-        FltReleaseResource(Configuration.Lock);
+        // Publish the values read, or the disabled configuration on failure.
+        publishStatus = LcEndConfigurationUpdate();
+        if (NT_SUCCESS(status))
+        {
+            status = publishStatus;
+        }
     }
 
     return status;
 }
 
 //------------------------------------------------------------------------
-//  Trusted processes management functions.
+//  Configuration snapshot functions.
 //------------------------------------------------------------------------
 
-_Check_return_
-NTSTATUS
-LcAddTrustedProcess(
-    _In_ HANDLE ProcessId
+VOID
+LcAcquireConfigurationSnapshot(
+    _Out_ PCONFIGURATION_REFERENCE Reference
     )
 /*++
 
 Summary:
 
-    This function adds the process handle given to the list of trusted processes.
+    This function acquires a reference to the current configuration snapshot.
 
-    Trusted processes will not be monitored by this driver.
-    It means that if a trusted process is accessing a file that is suitable for fetching,
-    driver will skip it the file will not be fetched.
+    No locks are acquired. The reader is counted in the counter of the current processor
+    for the current epoch, and the snapshot is not freed, until all readers counted
+    in its epoch release their references.
 
-    This is helpful, when we need to allow some application to perform some file operations,
-    like rename, without fetching the file.
+    The counter is selected once per attempt, so the retry and the release decrement
+    the counter that was incremented. Otherwise, a thread moved to another processor
+    would leave one counter negative, and the writer might see a zero sum, while
+    a reader is still using the snapshot.
+
+    The reference should be released with the 'LcReleaseConfigurationSnapshot' as soon
+    as possible, because the configuration updates wait for it.
 
 Arguments:
 
-    ProcessId - Process handle.
+    Reference - Receives the snapshot reference.
 
 Return value:
 
-    The return value is the status of the operation.
+    None.
 
 --*/
 {
-    NTSTATUS               status              = STATUS_SUCCESS;
-    PTRUSTED_PROCESS_ENTRY trustedProcessEntry = NULL;
+    LONG             epoch       = 0;
+    __volatile LONG* readerCount = NULL;
 
     PAGED_CODE();
 
-    IF_FALSE_RETURN_RESULT(ProcessId != NULL, STATUS_INVALID_PARAMETER_1);
-
-    FltAcquireResourceExclusive(Configuration.Lock);
+    FLT_ASSERT(Reference != NULL);
 
-    __try
+    for (;;)
     {
-        if (LcIsProcessTrusted(ProcessId))
-        {
-            __leave;
-        }
+        epoch       = Configuration.SnapshotEpoch;
+        readerCount = &LcGetSnapshotReaderSlot()->Count[epoch & 1];
 
-        // Allocate a new list entry.
-        NT_IF_FAIL_LEAVE(LcAllocateNonPagedBuffer((PVOID*)&trustedProcessEntry, sizeof(TRUSTED_PROCESS_ENTRY)));
-        trustedProcessEntry->ProcessId = ProcessId;
+        InterlockedIncrement(readerCount);
 
-        // Add the new record to the list.
-        InsertHeadList(&Configuration.TrustedProccessList, &trustedProcessEntry->ListEntry);
+        // If the epoch has changed, the writer might have already checked the counter,
+        // so try again with the new epoch.
+        if (epoch == Configuration.SnapshotEpoch)
+        {
+            break;
+        }
 
-        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Process added to trusted: %p\n", ProcessId));
-    }
-    __finally
-    {
-        FltReleaseResource(Configuration.Lock);
+        InterlockedDecrement(readerCount);
     }
 
-    return status;
+    Reference->ReaderCount = readerCount;
+    Reference->Snapshot    = Configuration.Snapshot;
 }
 
 //------------------------------------------------------------------------
 
 VOID
-LcRemoveTrustedProcess(
-    _In_ HANDLE ProcessId
+LcReleaseConfigurationSnapshot(
+    _Inout_ PCONFIGURATION_REFERENCE Reference
     )
 /*++
 
 Summary:
 
-    This function removes the process handle given from the list of trusted processes.
+    This function releases the configuration snapshot reference acquired by
+    the 'LcAcquireConfigurationSnapshot'.
+
+    The thread might be running on a different processor now, so the counter stored
+    in the 'Reference' is decremented instead of the one of the current processor.
 
 Arguments:
 
-    ProcessId - Process handle.
+    Reference - Reference to release.
 
 Return value:
 
@@ -510,76 +863,296 @@ Return value:
 
 --*/
 {
-    PLIST_ENTRY            listEntry           = NULL;
-    PTRUSTED_PROCESS_ENTRY trustedProcessEntry = NULL;
-
     PAGED_CODE();
 
-    IF_FALSE_RETURN(ProcessId != NULL);
-
-    FltAcquireResourceExclusive(Configuration.Lock);
-
-    __try
-    {
-        if (IsListEmpty(&Configuration.TrustedProccessList))
-        {
-            __leave;
-        }
-
-        listEntry = Configuration.TrustedProccessList.Flink;
-        while (listEntry != &Configuration.TrustedProccessList)
-        {
-            trustedProcessEntry = CONTAINING_RECORD(listEntry, TRUSTED_PROCESS_ENTRY, ListEntry);
-            if (trustedProcessEntry->ProcessId == ProcessId)
-            {
-                RemoveEntryList(listEntry);
-                LcFreeNonPagedBuffer(trustedProcessEntry);
+    FLT_ASSERT(Reference != NULL);
 
-                break;
-            }
+    InterlockedDecrement(Reference->ReaderCount);
 
-            // Move to the next element.
-            listEntry = listEntry->Flink;
-        }
-    }
-    __finally
-    {
-        FltReleaseResource(Configuration.Lock);
-    }
+    Reference->ReaderCount = NULL;
+    Reference->Snapshot    = NULL;
 }
 
 //------------------------------------------------------------------------
 
 _Check_return_
 BOOLEAN
-LcIsProcessTrusted(
-    _In_ HANDLE ProcessId
+LcIsProcessTrustedInSnapshot(
+    _In_opt_ PCCONFIGURATION_SNAPSHOT Snapshot,
+    _In_     HANDLE                   ProcessId
     )
 /*++
 
 Summary:
 
-    This function checks whether the process handle given is in the list of trusted processes.
+    This function checks whether the process handle given is in the list of trusted
+    processes of the configuration snapshot given.
 
 Arguments:
 
+    Snapshot  - Configuration snapshot to check.
+
     ProcessId - Process handle.
 
 Return value:
 
-    Whether the 'ProcessId' is in the list of trusted processes.
+    Whether the 'ProcessId' is trusted.
+
+--*/
+{
+    ULONG idx = 0;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Snapshot  != NULL, FALSE);
+    IF_FALSE_RETURN_RESULT(ProcessId != NULL, FALSE);
+
+    // The hash set always has empty slots, so the probing stops.
+    for (idx = LcHashProcessId(ProcessId) & Snapshot->TrustedProcessMask;
+         Snapshot->TrustedProcesses[idx] != NULL;
+         idx = (idx + 1) & Snapshot->TrustedProcessMask)
+    {
+        if (Snapshot->TrustedProcesses[idx] == ProcessId)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+ULONG
+LcGetReportRateForPathInSnapshot(
+    _In_opt_ PCCONFIGURATION_SNAPSHOT Snapshot,
+    _In_     PCUNICODE_STRING         Path,
+    _In_opt_ HANDLE                   ProcessId
+    )
+/*++
+
+Summary:
+
+    This function finds the watch rule matching the 'Path' given in the configuration
+    snapshot given, and returns the report rate for it.
+
+    Rules with longer paths take precedence. Rules with the same path are checked
+    in the order they were added in. If the file extension or process doesn't match
+    the rule's filter, the next rule is checked.
+
+Arguments:
+
+    Snapshot  - Configuration snapshot to check.
+
+    Path      - Pointer to a unicode string containing the path to be checked.
+
+    ProcessId - Process that accesses the 'Path'.
+
+Return value:
+
+    Report rate for the 'Path' given.
+
+    If no watch rule matches the 'Path', this function returns zero.
+
+--*/
+{
+    WATCH_RULE_MATCH_CONTEXT context = { 0 };
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Snapshot != NULL,                           0);
+    IF_FALSE_RETURN_RESULT(Snapshot->WatchRules != NULL,               0);
+    IF_FALSE_RETURN_RESULT(NT_SUCCESS(RtlUnicodeStringValidate(Path)), 0);
+
+    context.WatchRules = Snapshot->WatchRules;
+    context.ProcessId  = ProcessId;
+    LcGetFileExtension(Path, &context.Extension);
+
+    if (!LcMatchPathTrie(Snapshot->WatchRules->Trie, Path, LcMatchWatchRule, &context))
+    {
+        return 0;
+    }
+
+    return context.ReportRate == GLOBAL_REPORT_RATE ? Snapshot->ReportRate : context.ReportRate;
+}
+
+//------------------------------------------------------------------------
+//  Configuration update functions.
+//------------------------------------------------------------------------
+
+VOID
+LcBeginConfigurationUpdate()
+/*++
+
+Summary:
+
+    This function acquires the 'Configuration.Lock' exclusively before the configuration
+    parameters are changed.
+
+    Updates can be nested, and a new configuration snapshot is only published,
+    when the outermost 'LcEndConfigurationUpdate' is called. It allows to publish
+    several parameters at once.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    FltAcquireResourceExclusive(Configuration.Lock);
+    Configuration.UpdateDepth++;
+}
+
+//------------------------------------------------------------------------
+
+NTSTATUS
+LcEndConfigurationUpdate()
+/*++
+
+Summary:
+
+    This function completes the update started by the 'LcBeginConfigurationUpdate',
+    publishes a new configuration snapshot, if it's the outermost one, and releases
+    the 'Configuration.Lock'.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    The status of the snapshot publishing.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(Configuration.UpdateDepth > 0);
+
+    if (--Configuration.UpdateDepth == 0)
+    {
+        status = LcPublishConfigurationSnapshot();
+        if (!NT_SUCCESS(status))
+        {
+            LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "[LazyCopy] Unable to publish configuration snapshot: %08X\n", status));
+        }
+    }
+
+    FltReleaseResource(Configuration.Lock);
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+//  Trusted processes management functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcAddTrustedProcess(
+    _In_ HANDLE ProcessId
+    )
+/*++
+
+Summary:
+
+    This function adds the process handle given to the list of trusted processes.
+
+    Trusted processes will not be monitored by this driver.
+    It means that if a trusted process is accessing a file that is suitable for fetching,
+    driver will skip it the file will not be fetched.
+
+    This is helpful, when we need to allow some application to perform some file operations,
+    like rename, without fetching the file.
+
+Arguments:
+
+    ProcessId - Process handle.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS               status              = STATUS_SUCCESS;
+    NTSTATUS               publishStatus       = STATUS_SUCCESS;
+    PTRUSTED_PROCESS_ENTRY trustedProcessEntry = NULL;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(ProcessId != NULL, STATUS_INVALID_PARAMETER_1);
+
+    LcBeginConfigurationUpdate();
+
+    __try
+    {
+        if (LcFindTrustedProcess(ProcessId))
+        {
+            __leave;
+        }
+
+        // Allocate a new list entry.
+        NT_IF_FAIL_LEAVE(LcAllocateNonPagedBuffer((PVOID*)&trustedProcessEntry, sizeof(TRUSTED_PROCESS_ENTRY)));
+        trustedProcessEntry->ProcessId = ProcessId;
+
+        // Add the new record to the list.
+        InsertHeadList(&Configuration.TrustedProccessList, &trustedProcessEntry->ListEntry);
+        Configuration.TrustedProcessCount++;
+
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Process added to trusted: %p\n", ProcessId));
+    }
+    __finally
+    {
+        publishStatus = LcEndConfigurationUpdate();
+        if (NT_SUCCESS(status))
+        {
+            status = publishStatus;
+        }
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcRemoveTrustedProcess(
+    _In_ HANDLE ProcessId
+    )
+/*++
+
+Summary:
+
+    This function removes the process handle given from the list of trusted processes.
+
+Arguments:
+
+    ProcessId - Process handle.
+
+Return value:
+
+    None.
 
 --*/
 {
     PLIST_ENTRY            listEntry           = NULL;
     PTRUSTED_PROCESS_ENTRY trustedProcessEntry = NULL;
-    BOOLEAN                result              = FALSE;
 
     PAGED_CODE();
 
-    IF_FALSE_RETURN_RESULT(ProcessId != NULL, FALSE);
+    IF_FALSE_RETURN(ProcessId != NULL);
 
-    FltAcquireResourceShared(Configuration.Lock);
+    LcBeginConfigurationUpdate();
 
     __try
     {
@@ -594,7 +1167,10 @@ Return value:
             trustedProcessEntry = CONTAINING_RECORD(listEntry, TRUSTED_PROCESS_ENTRY, ListEntry);
             if (trustedProcessEntry->ProcessId == ProcessId)
             {
-                result = TRUE;
+                RemoveEntryList(listEntry);
+                LcFreeNonPagedBuffer(trustedProcessEntry);
+                Configuration.TrustedProcessCount--;
+
                 break;
             }
 
@@ -604,25 +1180,1065 @@ Return value:
     }
     __finally
     {
-        FltReleaseResource(Configuration.Lock);
+        LcEndConfigurationUpdate();
+    }
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+BOOLEAN
+LcIsProcessTrusted(
+    _In_ HANDLE ProcessId
+    )
+/*++
+
+Summary:
+
+    This function checks whether the process handle given is in the list of trusted processes.
+
+    The current configuration snapshot is used, so no locks are acquired.
+
+Arguments:
+
+    ProcessId - Process handle.
+
+Return value:
+
+    Whether the 'ProcessId' is in the list of trusted processes.
+
+--*/
+{
+    CONFIGURATION_REFERENCE reference = { 0 };
+    BOOLEAN                 result    = FALSE;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(ProcessId != NULL, FALSE);
+
+    LcAcquireConfigurationSnapshot(&reference);
+    result = LcIsProcessTrustedInSnapshot(reference.Snapshot, ProcessId);
+    LcReleaseConfigurationSnapshot(&reference);
+
+    return result;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcClearTrustedProcesses()
+/*++
+
+Summary:
+
+    This function clears the list of trusted processes.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PLIST_ENTRY            listEntry           = NULL;
+    PTRUSTED_PROCESS_ENTRY trustedProcessEntry = NULL;
+
+    PAGED_CODE();
+
+    LcBeginConfigurationUpdate();
+
+    __try
+    {
+        // Remove the last element from the list, while it's not empty.
+        while ((listEntry = RemoveTailList(&Configuration.TrustedProccessList)) != &Configuration.TrustedProccessList)
+        {
+            trustedProcessEntry = CONTAINING_RECORD(listEntry, TRUSTED_PROCESS_ENTRY, ListEntry);
+            LcFreeNonPagedBuffer(trustedProcessEntry);
+        }
+
+        Configuration.TrustedProcessCount = 0;
+    }
+    __finally
+    {
+        LcEndConfigurationUpdate();
+    }
+}
+
+//------------------------------------------------------------------------
+//  Paths to watch management functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcAddPathToWatch(
+    _In_     PCUNICODE_STRING Path,
+    _In_     ULONG            ReportRate,
+    _In_opt_ PCUNICODE_STRING Extension,
+    _In_opt_ HANDLE           ProcessId
+    )
+/*++
+
+Summary:
+
+    This function adds the watch rule for the path given to the list of paths to watch.
+
+    When a managed file is accessed such path, the FileAccessed ETW event is raised
+    with the probability defined by the 'ReportRate'.
+
+    The path is not matched against, until the 'LcCompilePathsToWatch' is called.
+    If several rules match the same file, the one with the longest path is used.
+    Rules with the same path are checked in the order they were added in.
+
+Arguments:
+
+    Path       - Pointer to the preallocated unicode string containing the path to be added to the watch list.
+                 Path must end with the directory separator character.
+                 The pointer content is copied.
+
+    ReportRate - Report rate for the files matching this rule, see the 'LcSetReportRate'.
+                 If it's 'GLOBAL_REPORT_RATE', the 'Configuration.ReportRate' value is used.
+
+    Extension  - Optional file extension filter, with or without the leading dot.
+                 The comparison is case-insensitive.
+
+    ProcessId  - Optional process filter. If it's set, only the files opened by this process match.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS             status    = STATUS_SUCCESS;
+    PPATH_TO_WATCH_ENTRY pathEntry = NULL;
+    UNICODE_STRING       extension = { 0 };
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(NT_SUCCESS(LcValidatePath(Path)), STATUS_INVALID_PARAMETER_1);
+
+    if (Extension != NULL)
+    {
+        IF_FALSE_RETURN_RESULT(NT_SUCCESS(RtlUnicodeStringValidate(Extension)), STATUS_INVALID_PARAMETER_3);
+
+        extension = *Extension;
+        if (extension.Length > 0 && extension.Buffer[0] == L'.')
+        {
+            extension.Buffer++;
+            extension.Length        -= sizeof(WCHAR);
+            extension.MaximumLength -= sizeof(WCHAR);
+        }
+    }
+
+    if (ReportRate != GLOBAL_REPORT_RATE && ReportRate > MAX_REPORT_RATE)
+    {
+        ReportRate = MAX_REPORT_RATE;
+    }
+
+    FltAcquireResourceExclusive(Configuration.Lock);
+
+    __try
+    {
+        // Allocate memory for a new list entry.
+        NT_IF_FAIL_LEAVE(LcAllocateNonPagedBuffer((PVOID*)&pathEntry, sizeof(PATH_TO_WATCH_ENTRY)));
+
+        // Copy the Path and Extension given.
+        NT_IF_FAIL_LEAVE(LcCopyUnicodeString(&pathEntry->Path, Path));
+
+        if (extension.Length > 0)
+        {
+            NT_IF_FAIL_LEAVE(LcCopyUnicodeString(&pathEntry->Extension, &extension));
+        }
+
+        pathEntry->ReportRate = ReportRate;
+        pathEntry->ProcessId  = ProcessId;
+
+        // Add a new record to the end of the list, so the rules keep their order.
+        InsertTailList(&Configuration.PathsToWatch, &pathEntry->ListEntry);
+        Configuration.PathsToWatchCount++;
+
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Path added to the watch list: '%wZ', rate: %u, extension: '%wZ', process: %p\n", &pathEntry->Path, ReportRate, &pathEntry->Extension, ProcessId));
+    }
+    __finally
+    {
+        FltReleaseResource(Configuration.Lock);
+
+        // Don't forget to free memory on failure.
+        if (!NT_SUCCESS(status) && pathEntry != NULL)
+        {
+            if (pathEntry->Path.Buffer != NULL)
+            {
+                LcFreeUnicodeString(&pathEntry->Path);
+            }
+
+            if (pathEntry->Extension.Buffer != NULL)
+            {
+                LcFreeUnicodeString(&pathEntry->Extension);
+            }
+
+            LcFreeNonPagedBuffer(pathEntry);
+        }
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcCompilePathsToWatch()
+/*++
+
+Summary:
+
+    This function compiles the current list of watch rules into a prefix trie,
+    and publishes a new configuration snapshot containing it.
+
+    It should be called after the rules are added with the 'LcAddPathToWatch'.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS             status          = STATUS_SUCCESS;
+    NTSTATUS             publishStatus   = STATUS_SUCCESS;
+    PCUNICODE_STRING*    paths           = NULL;
+    PWATCH_RULES         watchRules      = NULL;
+    PLIST_ENTRY          listEntry       = NULL;
+    PPATH_TO_WATCH_ENTRY pathEntry       = NULL;
+    PWCHAR               extensions      = NULL;
+    SIZE_T               extensionLength = 0;
+    ULONG                ruleCount       = 0;
+
+    PAGED_CODE();
+
+    LcBeginConfigurationUpdate();
+
+    __try
+    {
+        if (Configuration.PathsToWatchCount > 0)
+        {
+            NT_IF_FAIL_LEAVE(LcAllocateBuffer((PVOID*)&paths, PagedPool, Configuration.PathsToWatchCount * sizeof(PCUNICODE_STRING), LC_BUFFER_PAGED_POOL_TAG));
+
+            for (listEntry = Configuration.PathsToWatch.Flink; listEntry != &Configuration.PathsToWatch; listEntry = listEntry->Flink)
+            {
+                pathEntry        = CONTAINING_RECORD(listEntry, PATH_TO_WATCH_ENTRY, ListEntry);
+                extensionLength += pathEntry->Extension.Length;
+                paths[ruleCount] = &pathEntry->Path;
+                ruleCount++;
+            }
+
+            // Rules and their extensions are stored in a single buffer.
+            NT_IF_FAIL_LEAVE(LcAllocateBuffer(
+                (PVOID*)&watchRules,
+                PagedPool,
+                FIELD_OFFSET(WATCH_RULES, Rules) + ruleCount * sizeof(WATCH_RULE) + extensionLength,
+                LC_BUFFER_PAGED_POOL_TAG));
+
+            watchRules->ReferenceCount = 1;
+            watchRules->RuleCount      = ruleCount;
+            extensions                 = (PWCHAR)&watchRules->Rules[ruleCount];
+
+            ruleCount = 0;
+            for (listEntry = Configuration.PathsToWatch.Flink; listEntry != &Configuration.PathsToWatch; listEntry = listEntry->Flink)
+            {
+                PWATCH_RULE rule = &watchRules->Rules[ruleCount++];
+
+                pathEntry        = CONTAINING_RECORD(listEntry, PATH_TO_WATCH_ENTRY, ListEntry);
+                rule->ReportRate = pathEntry->ReportRate;
+                rule->ProcessId  = pathEntry->ProcessId;
+
+                if (pathEntry->Extension.Length > 0)
+                {
+                    RtlCopyMemory(extensions, pathEntry->Extension.Buffer, pathEntry->Extension.Length);
+
+                    rule->Extension.Buffer        = extensions;
+                    rule->Extension.Length        = pathEntry->Extension.Length;
+                    rule->Extension.MaximumLength = pathEntry->Extension.Length;
+
+                    extensions += pathEntry->Extension.Length / sizeof(WCHAR);
+                }
+            }
+
+            NT_IF_FAIL_LEAVE(LcCreatePathTrie(paths, ruleCount, &watchRules->Trie));
+        }
+
+        // Replace the previous rules. The published snapshots hold their own references to them.
+        if (Configuration.WatchRules != NULL)
+        {
+            LcReleaseWatchRules(Configuration.WatchRules);
+        }
+
+        Configuration.WatchRules = watchRules;
+        watchRules               = NULL;
+
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Paths to watch compiled: %u\n", ruleCount));
+    }
+    __finally
+    {
+        publishStatus = LcEndConfigurationUpdate();
+        if (NT_SUCCESS(status))
+        {
+            status = publishStatus;
+        }
+
+        if (watchRules != NULL)
+        {
+            LcReleaseWatchRules(watchRules);
+        }
+
+        if (paths != NULL)
+        {
+            LcFreeBuffer(paths, LC_BUFFER_PAGED_POOL_TAG);
+        }
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+BOOLEAN
+LcIsPathWatched(
+    _In_ PCUNICODE_STRING Path
+    )
+/*++
+
+Summary:
+
+    This function checks whether the 'Path' given (or one of its parents) is in the list of paths to watch.
+
+    Only the paths compiled by the 'LcCompilePathsToWatch' are taken into account.
+    The current configuration snapshot is used, so no locks are acquired.
+
+Arguments:
+
+    Path - Pointer to the preallocated unicode string containing the path to be checked.
+
+Return value:
+
+    Whether the 'Path' is in the list of paths to watch.
+
+--*/
+{
+    CONFIGURATION_REFERENCE reference = { 0 };
+    BOOLEAN                 result    = FALSE;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(NT_SUCCESS(RtlUnicodeStringValidate(Path)), FALSE);
+
+    LcAcquireConfigurationSnapshot(&reference);
+
+    if (reference.Snapshot != NULL && reference.Snapshot->WatchRules != NULL)
+    {
+        result = LcMatchPathTrie(reference.Snapshot->WatchRules->Trie, Path, NULL, NULL);
+    }
+
+    LcReleaseConfigurationSnapshot(&reference);
+
+    return result;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcClearPathsToWatch()
+/*++
+
+Summary:
+
+    This function clears the list of paths to watch and releases the compiled paths.
+
+    The published configuration snapshot is not changed, so the previous paths are
+    still watched, until the next snapshot is published.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PLIST_ENTRY          listEntry = NULL;
+    PPATH_TO_WATCH_ENTRY pathEntry = NULL;
+
+    PAGED_CODE();
+
+    FltAcquireResourceExclusive(Configuration.Lock);
+
+    __try
+    {
+        // Remove the last element from the list while it's not empty.
+        while ((listEntry = RemoveTailList(&Configuration.PathsToWatch)) != &Configuration.PathsToWatch)
+        {
+            pathEntry = CONTAINING_RECORD(listEntry, PATH_TO_WATCH_ENTRY, ListEntry);
+
+            // Free the unicode strings and the list entry.
+            LcFreeUnicodeString(&pathEntry->Path);
+
+            if (pathEntry->Extension.Buffer != NULL)
+            {
+                LcFreeUnicodeString(&pathEntry->Extension);
+            }
+
+            LcFreeNonPagedBuffer(pathEntry);
+        }
+
+        Configuration.PathsToWatchCount = 0;
+
+        if (Configuration.WatchRules != NULL)
+        {
+            LcReleaseWatchRules(Configuration.WatchRules);
+            Configuration.WatchRules = NULL;
+        }
+    }
+    __finally
+    {
+        FltReleaseResource(Configuration.Lock);
+    }
+}
+
+//------------------------------------------------------------------------
+//  Volume policy management functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcAddVolumePolicy(
+    _In_     PCUNICODE_STRING Selector,
+    _In_opt_ PCVOLUME_TUNING  Tuning
+    )
+/*++
+
+Summary:
+
+    This function adds the volume selector given to the volume policy list.
+
+    The driver is only attached to the volumes matching at least one selector.
+    If the list is empty, the driver is attached to all NTFS volumes.
+
+    Supported selectors (case-insensitive):
+    * '*'                - Any NTFS or ReFS volume;
+    * 'FS:<name>'        - File system name, 'NTFS' or 'REFS';
+    * 'GUID:<guid>'      - Volume GUID, with or without the '\??\Volume' prefix;
+    * 'LABEL:<label>'    - Volume label.
+
+Arguments:
+
+    Selector - Volume selector string. The pointer content is copied.
+
+    Tuning   - Fetch tuning parameters for the matching volumes.
+               If it's NULL, default parameters are used.
+               Zero values are replaced with the defaults.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS             status      = STATUS_SUCCESS;
+    PVOLUME_POLICY_ENTRY policyEntry = NULL;
+    UNICODE_STRING       value       = { 0 };
+    VOLUME_SELECTOR_TYPE type        = VolumeSelectorAny;
+
+    UNICODE_STRING       anySelector      = CONSTANT_STRING(L"*");
+    UNICODE_STRING       fileSystemPrefix = CONSTANT_STRING(L"FS:");
+    UNICODE_STRING       guidPrefix       = CONSTANT_STRING(L"GUID:");
+    UNICODE_STRING       labelPrefix      = CONSTANT_STRING(L"LABEL:");
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(NT_SUCCESS(RtlUnicodeStringValidate(Selector)), STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(Selector->Length > 0,                           STATUS_INVALID_PARAMETER_1);
+
+    // Parse the selector type.
+    value = *Selector;
+
+    if (RtlEqualUnicodeString(Selector, &anySelector, FALSE))
+    {
+        type         = VolumeSelectorAny;
+        value.Length = 0;
+    }
+    else if (RtlPrefixUnicodeString(&fileSystemPrefix, Selector, TRUE))
+    {
+        type = VolumeSelectorFileSystem;
+        value.Buffer        += fileSystemPrefix.Length / sizeof(WCHAR);
+        value.Length        -= fileSystemPrefix.Length;
+        value.MaximumLength -= fileSystemPrefix.Length;
+    }
+    else if (RtlPrefixUnicodeString(&guidPrefix, Selector, TRUE))
+    {
+        type = VolumeSelectorGuid;
+        value.Buffer        += guidPrefix.Length / sizeof(WCHAR);
+        value.Length        -= guidPrefix.Length;
+        value.MaximumLength -= guidPrefix.Length;
+    }
+    else if (RtlPrefixUnicodeString(&labelPrefix, Selector, TRUE))
+    {
+        type = VolumeSelectorLabel;
+        value.Buffer        += labelPrefix.Length / sizeof(WCHAR);
+        value.Length        -= labelPrefix.Length;
+        value.MaximumLength -= labelPrefix.Length;
+    }
+    else
+    {
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "[LazyCopy] Unknown volume selector: '%wZ'\n", Selector));
+        return STATUS_INVALID_PARAMETER_1;
+    }
+
+    IF_FALSE_RETURN_RESULT(type == VolumeSelectorAny || value.Length > 0, STATUS_INVALID_PARAMETER_1);
+
+    FltAcquireResourceExclusive(Configuration.Lock);
+
+    __try
+    {
+        // Allocate memory for a new list entry.
+        NT_IF_FAIL_LEAVE(LcAllocateNonPagedBuffer((PVOID*)&policyEntry, sizeof(VOLUME_POLICY_ENTRY)));
+
+        if (value.Length > 0)
+        {
+            NT_IF_FAIL_LEAVE(LcCopyUnicodeString(&policyEntry->Value, &value));
+        }
+
+        policyEntry->SelectorType = type;
+
+        if (Tuning != NULL)
+        {
+            policyEntry->Tuning = *Tuning;
+        }
+
+        LcNormalizeVolumeTuning(&policyEntry->Tuning);
+
+        // Policies are evaluated in the order they were added.
+        InsertTailList(&Configuration.VolumePolicies, &policyEntry->ListEntry);
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Volume policy added: '%wZ' (chunk size: %u, max chunks: %u, unbuffered threshold: %u)\n",
+            Selector, policyEntry->Tuning.ChunkSize, policyEntry->Tuning.MaxChunks, policyEntry->Tuning.UnbufferedThreshold));
+    }
+    __finally
+    {
+        FltReleaseResource(Configuration.Lock);
+
+        // Don't forget to free memory on failure.
+        if (!NT_SUCCESS(status) && policyEntry != NULL)
+        {
+            if (policyEntry->Value.Buffer != NULL)
+            {
+                LcFreeUnicodeString(&policyEntry->Value);
+            }
+
+            LcFreeNonPagedBuffer(policyEntry);
+        }
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+BOOLEAN
+LcGetVolumePolicy(
+    _In_     PCUNICODE_STRING FileSystemName,
+    _In_opt_ PCUNICODE_STRING VolumeGuidName,
+    _In_opt_ PCUNICODE_STRING VolumeLabel,
+    _Out_    PVOLUME_TUNING   Tuning
+    )
+/*++
+
+Summary:
+
+    This function looks for the first volume policy matching the volume properties given.
+
+    If there are no volume policies, only the NTFS volumes are matched, and the default
+    tuning parameters are returned.
+
+Arguments:
+
+    FileSystemName - Name of the volume file system, i.e. 'NTFS'.
+
+    VolumeGuidName - Volume GUID name in the '\??\Volume{GUID}' format.
+                     May be NULL, if it's not available.
+
+    VolumeLabel    - Volume label. May be NULL, if it's not available.
+
+    Tuning         - Receives the tuning parameters for the volume.
+
+Return value:
+
+    Whether the driver should be attached to the volume.
+
+--*/
+{
+    BOOLEAN              result      = FALSE;
+    PLIST_ENTRY          listEntry   = NULL;
+    PVOLUME_POLICY_ENTRY policyEntry = NULL;
+    UNICODE_STRING       ntfsName    = CONSTANT_STRING(L"NTFS");
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(FileSystemName != NULL, FALSE);
+    IF_FALSE_RETURN_RESULT(Tuning         != NULL, FALSE);
+
+    RtlZeroMemory(Tuning, sizeof(VOLUME_TUNING));
+    LcNormalizeVolumeTuning(Tuning);
+
+    FltAcquireResourceShared(Configuration.Lock);
+
+    __try
+    {
+        if (IsListEmpty(&Configuration.VolumePolicies))
+        {
+            result = RtlEqualUnicodeString(FileSystemName, &ntfsName, TRUE);
+            __leave;
+        }
+
+        for (listEntry = Configuration.VolumePolicies.Flink; listEntry != &Configuration.VolumePolicies; listEntry = listEntry->Flink)
+        {
+            policyEntry = CONTAINING_RECORD(listEntry, VOLUME_POLICY_ENTRY, ListEntry);
+
+            switch (policyEntry->SelectorType)
+            {
+                case VolumeSelectorAny:
+                    result = TRUE;
+                    break;
+
+                case VolumeSelectorFileSystem:
+                    result = RtlEqualUnicodeString(FileSystemName, &policyEntry->Value, TRUE);
+                    break;
+
+                case VolumeSelectorGuid:
+                    // The selector may or may not contain the '\??\Volume' prefix, so compare the trailing part only.
+                    if (VolumeGuidName != NULL && VolumeGuidName->Length >= policyEntry->Value.Length)
+                    {
+                        UNICODE_STRING guidSuffix = { 0 };
+
+                        guidSuffix.Buffer        = (PWCH)((PUCHAR)VolumeGuidName->Buffer + VolumeGuidName->Length - policyEntry->Value.Length);
+                        guidSuffix.Length        = policyEntry->Value.Length;
+                        guidSuffix.MaximumLength = policyEntry->Value.Length;
+
+                        result = RtlEqualUnicodeString(&guidSuffix, &policyEntry->Value, TRUE);
+                    }
+                    break;
+
+                case VolumeSelectorLabel:
+                    result = VolumeLabel != NULL && RtlEqualUnicodeString(VolumeLabel, &policyEntry->Value, TRUE);
+                    break;
+            }
+
+            if (result)
+            {
+                *Tuning = policyEntry->Tuning;
+                break;
+            }
+        }
+    }
+    __finally
+    {
+        FltReleaseResource(Configuration.Lock);
+    }
+
+    return result;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcClearVolumePolicies()
+/*++
+
+Summary:
+
+    This function clears the volume policy list.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PLIST_ENTRY          listEntry   = NULL;
+    PVOLUME_POLICY_ENTRY policyEntry = NULL;
+
+    PAGED_CODE();
+
+    FltAcquireResourceExclusive(Configuration.Lock);
+
+    __try
+    {
+        // Remove the last element from the list while it's not empty.
+        while ((listEntry = RemoveTailList(&Configuration.VolumePolicies)) != &Configuration.VolumePolicies)
+        {
+            policyEntry = CONTAINING_RECORD(listEntry, VOLUME_POLICY_ENTRY, ListEntry);
+
+            if (policyEntry->Value.Buffer != NULL)
+            {
+                LcFreeUnicodeString(&policyEntry->Value);
+            }
+
+            LcFreeNonPagedBuffer(policyEntry);
+        }
+    }
+    __finally
+    {
+        FltReleaseResource(Configuration.Lock);
+    }
+}
+
+//------------------------------------------------------------------------
+//  Operation mode management functions.
+//------------------------------------------------------------------------
+
+VOID
+LcSetOperationMode(
+    _In_ DRIVER_OPERATION_MODE Value
+    )
+/*++
+
+Summary:
+
+    This function sets the new value for the 'Configuration.OperationMode' variable.
+
+Arguments:
+
+    Value - The new operation mode value.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    LcBeginConfigurationUpdate();
+
+    Configuration.OperationMode = Value;
+    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Configuration.OperationMode is set to: %08X\n", (ULONG)Value));
+
+    LcEndConfigurationUpdate();
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+DRIVER_OPERATION_MODE
+LcGetOperationMode()
+/*++
+
+Summary:
+
+    This function gets the value of the 'Configuration.OperationMode' variable.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    The current 'Configuration.OperationMode' value.
+
+--*/
+{
+    PAGED_CODE();
+
+    return Configuration.OperationMode;
+}
+
+//------------------------------------------------------------------------
+//  Report rate management functions.
+//------------------------------------------------------------------------
+
+VOID
+LcSetReportRate(
+    _In_ ULONG Value
+    )
+/*++
+
+Summary:
+
+    This function sets the new value for the 'Configuration.ReportRate' variable.
+
+Arguments:
+
+    Value - The new report rate value.
+            This value belongs to the [0; 10000] interval and represents the number
+            of chances in 10,000 that the current driver will report ETW for a file
+            access operation.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (Value > MAX_REPORT_RATE)
+    {
+        Value = MAX_REPORT_RATE;
+    }
+
+    LcBeginConfigurationUpdate();
+
+    Configuration.ReportRate = Value;
+    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Configuration.ReportRate is set to: %u\n", Value));
+
+    LcEndConfigurationUpdate();
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+ULONG
+LcGetReportRateForPath(
+    _In_     PCUNICODE_STRING Path,
+    _In_opt_ HANDLE           ProcessId
+    )
+/*++
+
+Summary:
+
+    This function finds the watch rule matching the 'Path' given, and returns
+    the proper report rate for it.
+
+    See the 'LcGetReportRateForPathInSnapshot' for more details.
+
+Arguments:
+
+    Path      - Pointer to a unicode string containing the path to be checked.
+
+    ProcessId - Process that accesses the 'Path'.
+
+Return value:
+
+    Report rate for the 'Path' given.
+
+    If the 'Path' is not in the list of paths to watch, this function returns zero.
+
+--*/
+{
+    CONFIGURATION_REFERENCE reference  = { 0 };
+    ULONG                   reportRate = 0;
+
+    PAGED_CODE();
+
+    LcAcquireConfigurationSnapshot(&reference);
+    reportRate = LcGetReportRateForPathInSnapshot(reference.Snapshot, Path, ProcessId);
+    LcReleaseConfigurationSnapshot(&reference);
+
+    return reportRate;
+}
+
+//------------------------------------------------------------------------
+//  User-mode fetch timeout management functions.
+//------------------------------------------------------------------------
+
+VOID
+LcSetUserModeFetchTimeout(
+    _In_ ULONG Value
+    )
+/*++
+
+Summary:
+
+    This function sets the new value for the 'Configuration.UserModeFetchTimeout' variable.
+
+    The value is not a part of the configuration snapshot, because it's only read
+    right before the fetch notification is sent to the user-mode client.
+
+Arguments:
+
+    Value - Time, in milliseconds, the user-mode client is given to fetch a file.
+            If it's zero, the driver waits for the client reply indefinitely.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    Configuration.UserModeFetchTimeout = Value;
+    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Configuration.UserModeFetchTimeout is set to: %u\n", Value));
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+ULONG
+LcGetUserModeFetchTimeout()
+/*++
+
+Summary:
+
+    This function returns the current value of the 'Configuration.UserModeFetchTimeout' variable.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    Time, in milliseconds, the user-mode client is given to fetch a file, or zero, if there is no timeout.
+
+--*/
+{
+    PAGED_CODE();
+
+    return Configuration.UserModeFetchTimeout;
+}
+
+//------------------------------------------------------------------------
+//  Local functions.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcPublishConfigurationSnapshot()
+/*++
+
+Summary:
+
+    This function creates a new configuration snapshot from the current configuration
+    parameters and replaces the current one with it.
+
+    The previous snapshot is freed, after all readers that might have acquired it are gone.
+    Readers are counted per epoch, so the epoch is advanced, and this function waits
+    for the counters of the previous epoch to drop to zero.
+
+    The 'Configuration.Lock' should be acquired exclusively by the caller, so the writers
+    are serialized.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS                status              = STATUS_SUCCESS;
+    PCONFIGURATION_SNAPSHOT snapshot            = NULL;
+    PCONFIGURATION_SNAPSHOT oldSnapshot         = NULL;
+    PLIST_ENTRY             listEntry           = NULL;
+    PTRUSTED_PROCESS_ENTRY  trustedProcessEntry = NULL;
+    LONG                    epoch               = 0;
+    LONG                    readers             = 0;
+    ULONG                   slotCount           = TRUSTED_PROCESS_MIN_SLOTS;
+    ULONG                   idx                 = 0;
+    LARGE_INTEGER           interval            = { 0 };
+
+    PAGED_CODE();
+
+    // Keep the hash set at most half full.
+    while (slotCount / 2 < Configuration.TrustedProcessCount)
+    {
+        IF_FALSE_RETURN_RESULT(slotCount <= MAXULONG / 4, STATUS_INTEGER_OVERFLOW);
+        slotCount *= 2;
+    }
+
+    NT_IF_FAIL_RETURN(LcAllocateBuffer(
+        (PVOID*)&snapshot,
+        PagedPool,
+        FIELD_OFFSET(CONFIGURATION_SNAPSHOT, TrustedProcesses) + (SIZE_T)slotCount * sizeof(HANDLE),
+        LC_BUFFER_PAGED_POOL_TAG));
+
+    snapshot->OperationMode    = Configuration.OperationMode;
+    snapshot->ReportRate       = Configuration.ReportRate;
+    snapshot->WatchRules       = Configuration.WatchRules;
+
+    if (snapshot->WatchRules != NULL)
+    {
+        InterlockedIncrement(&snapshot->WatchRules->ReferenceCount);
+    }
+
+    // Insert the trusted process IDs into the hash set. The list does not contain duplicates.
+    snapshot->TrustedProcessMask = slotCount - 1;
+
+    for (listEntry = Configuration.TrustedProccessList.Flink; listEntry != &Configuration.TrustedProccessList; listEntry = listEntry->Flink)
+    {
+        trustedProcessEntry = CONTAINING_RECORD(listEntry, TRUSTED_PROCESS_ENTRY, ListEntry);
+
+        idx = LcHashProcessId(trustedProcessEntry->ProcessId) & snapshot->TrustedProcessMask;
+        while (snapshot->TrustedProcesses[idx] != NULL)
+        {
+            idx = (idx + 1) & snapshot->TrustedProcessMask;
+        }
+
+        snapshot->TrustedProcesses[idx] = trustedProcessEntry->ProcessId;
+    }
+
+    oldSnapshot = InterlockedExchangePointer((PVOID*)&Configuration.Snapshot, snapshot);
+    if (oldSnapshot == NULL)
+    {
+        return status;
+    }
+
+    // New readers are counted in the next epoch. Wait for the ones counted in the previous epoch to leave.
+    epoch             = InterlockedIncrement(&Configuration.SnapshotEpoch) - 1;
+    interval.QuadPart = -10000LL * SNAPSHOT_READER_WAIT_INTERVAL;
+
+    for (;;)
+    {
+        readers = 0;
+        for (idx = 0; idx < SNAPSHOT_READER_SLOTS; idx++)
+        {
+            readers += SnapshotReaders[idx].Count[epoch & 1];
+        }
+
+        if (readers == 0)
+        {
+            break;
+        }
+
+        KeDelayExecutionThread(KernelMode, FALSE, &interval);
     }
 
-    return result;
+    LcFreeConfigurationSnapshot(oldSnapshot);
+
+    return status;
 }
 
 //------------------------------------------------------------------------
 
+static
 VOID
-LcClearTrustedProcesses()
+LcFreeConfigurationSnapshot(
+    _In_ PCONFIGURATION_SNAPSHOT Snapshot
+    )
 /*++
 
 Summary:
 
-    This function clears the list of trusted processes.
+    This function frees the configuration snapshot given.
 
 Arguments:
 
-    None.
+    Snapshot - Snapshot to free. It should not be used by any reader.
 
 Return value:
 
@@ -630,228 +2246,151 @@ Return value:
 
 --*/
 {
-    PLIST_ENTRY            listEntry           = NULL;
-    PTRUSTED_PROCESS_ENTRY trustedProcessEntry = NULL;
-
     PAGED_CODE();
 
-    FltAcquireResourceExclusive(Configuration.Lock);
+    IF_FALSE_RETURN(Snapshot != NULL);
 
-    __try
-    {
-        // Remove the last element from the list, while it's not empty.
-        while ((listEntry = RemoveTailList(&Configuration.TrustedProccessList)) != &Configuration.TrustedProccessList)
-        {
-            trustedProcessEntry = CONTAINING_RECORD(listEntry, TRUSTED_PROCESS_ENTRY, ListEntry);
-            LcFreeNonPagedBuffer(trustedProcessEntry);
-        }
-    }
-    __finally
+    if (Snapshot->WatchRules != NULL)
     {
-        FltReleaseResource(Configuration.Lock);
+        LcReleaseWatchRules(Snapshot->WatchRules);
     }
+
+    LcFreeBuffer(Snapshot, LC_BUFFER_PAGED_POOL_TAG);
 }
 
-//------------------------------------------------------------------------
-//  Paths to watch management functions.
 //------------------------------------------------------------------------
 
-_Check_return_
-NTSTATUS
-LcAddPathToWatch(
-    _In_ PCUNICODE_STRING Path
-    )
+static
+PSNAPSHOT_READER_SLOT
+LcGetSnapshotReaderSlot()
 /*++
 
 Summary:
 
-    This function adds the path given to the list of paths to watch.
-
-    When a managed file is accessed such path, the FileAccessed ETW event is raised.
+    This function returns the configuration snapshot reader counters
+    for the current processor.
 
 Arguments:
 
-    Path - Pointer to the preallocated unicode string containing the path to be added to the watch list.
-           Path must end with the directory separator character.
-           The pointer content is copied.
+    None.
 
 Return value:
 
-    The return value is the status of the operation.
+    Reader counters to use.
 
 --*/
 {
-    NTSTATUS             status    = STATUS_SUCCESS;
-    PPATH_TO_WATCH_ENTRY pathEntry = NULL;
-
     PAGED_CODE();
 
-    IF_FALSE_RETURN_RESULT(NT_SUCCESS(LcValidatePath(Path)), STATUS_INVALID_PARAMETER_1);
-
-    FltAcquireResourceExclusive(Configuration.Lock);
-
-    __try
-    {
-        // If the path is already added to the list, leave.
-        if (LcIsPathWatched(Path))
-        {
-            LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_WARNING_LEVEL, "[LazyCopy] Path is already in the watch list: '%wZ'\n", Path));
-            __leave;
-        }
-
-        // Allocate memory for a new list entry.
-        NT_IF_FAIL_LEAVE(LcAllocateNonPagedBuffer((PVOID*)&pathEntry, sizeof(PATH_TO_WATCH_ENTRY)));
-
-        // Copy the Path given.
-        NT_IF_FAIL_LEAVE(LcCopyUnicodeString(&pathEntry->Path, Path));
-
-        // Add a new record to the list.
-        InsertHeadList(&Configuration.PathsToWatch, &pathEntry->ListEntry);
-        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Path added to the watch list: '%wZ'\n", pathEntry->Path));
-    }
-    __finally
-    {
-        FltReleaseResource(Configuration.Lock);
-
-        // Don't forget to free memory on failure.
-        if (!NT_SUCCESS(status) && pathEntry != NULL)
-        {
-            if (pathEntry->Path.Buffer != NULL)
-            {
-                LcFreeUnicodeString(&pathEntry->Path);
-            }
-
-            LcFreeNonPagedBuffer(pathEntry);
-        }
-    }
-
-    return status;
+#if PLATFORM_WIN7
+    return &SnapshotReaders[KeGetCurrentProcessorNumberEx(NULL) % SNAPSHOT_READER_SLOTS];
+#else
+    return &SnapshotReaders[KeGetCurrentProcessorNumber() % SNAPSHOT_READER_SLOTS];
+#endif // PLATFORM_WIN7
 }
 
 //------------------------------------------------------------------------
 
+static
 _Check_return_
 BOOLEAN
-LcIsPathWatched(
-    _In_ PCUNICODE_STRING Path
+LcFindTrustedProcess(
+    _In_ HANDLE ProcessId
     )
 /*++
 
 Summary:
 
-    This function checks whether the 'Path' given (or one of its parents) is in the list of paths to watch.
+    This function checks whether the process handle given is in the 'Configuration.TrustedProccessList'.
+
+    The 'Configuration.Lock' should be acquired by the caller.
 
 Arguments:
 
-    Path - Pointer to the preallocated unicode string containing the path to be checked.
+    ProcessId - Process handle.
 
 Return value:
 
-    Whether the 'Path' is in the list of paths to watch.
+    Whether the 'ProcessId' is in the list of trusted processes.
 
 --*/
 {
-    PLIST_ENTRY          listEntry = NULL;
-    PPATH_TO_WATCH_ENTRY pathEntry = NULL;
-    BOOLEAN              result    = FALSE;
+    PLIST_ENTRY            listEntry           = NULL;
+    PTRUSTED_PROCESS_ENTRY trustedProcessEntry = NULL;
 
     PAGED_CODE();
 
-    IF_FALSE_RETURN_RESULT(NT_SUCCESS(RtlUnicodeStringValidate(Path)), FALSE);
-
-    FltAcquireResourceShared(Configuration.Lock);
-
-    __try
+    for (listEntry = Configuration.TrustedProccessList.Flink; listEntry != &Configuration.TrustedProccessList; listEntry = listEntry->Flink)
     {
-        if (IsListEmpty(&Configuration.PathsToWatch))
-        {
-            __leave;
-        }
-
-        listEntry = Configuration.PathsToWatch.Flink;
-        while (listEntry != &Configuration.PathsToWatch)
+        trustedProcessEntry = CONTAINING_RECORD(listEntry, TRUSTED_PROCESS_ENTRY, ListEntry);
+        if (trustedProcessEntry->ProcessId == ProcessId)
         {
-            pathEntry = CONTAINING_RECORD(listEntry, PATH_TO_WATCH_ENTRY, ListEntry);
-            if (RtlPrefixUnicodeString(&pathEntry->Path, Path, TRUE))
-            {
-                result = TRUE;
-                break;
-            }
-
-            // Move to the next element.
-            listEntry = listEntry->Flink;
+            return TRUE;
         }
     }
-    __finally
-    {
-        FltReleaseResource(Configuration.Lock);
-    }
 
-    return result;
+    return FALSE;
 }
 
 //------------------------------------------------------------------------
 
-VOID
-LcClearPathsToWatch()
+static
+ULONG
+LcHashProcessId(
+    _In_ HANDLE ProcessId
+    )
 /*++
 
 Summary:
 
-    This function clears the list of paths to watch.
+    This function calculates the hash of the process ID given for the trusted process hash set.
 
 Arguments:
 
-    None.
+    ProcessId - Process handle.
 
 Return value:
 
-    None.
+    Hash value. The caller should apply the hash set mask to it.
 
 --*/
 {
-    PLIST_ENTRY          listEntry = NULL;
-    PPATH_TO_WATCH_ENTRY pathEntry = NULL;
+    ULONG hash = 0;
 
     PAGED_CODE();
 
-    FltAcquireResourceExclusive(Configuration.Lock);
-
-    __try
-    {
-        // Remove the last element from the list while it's not empty.
-        while ((listEntry = RemoveTailList(&Configuration.PathsToWatch)) != &Configuration.PathsToWatch)
-        {
-            pathEntry = CONTAINING_RECORD(listEntry, PATH_TO_WATCH_ENTRY, ListEntry);
+    // Process IDs are multiples of four, so the lowest bits are dropped.
+    hash  = (ULONG)((ULONG_PTR)ProcessId >> 2) * 0x9E3779B1;
+    hash ^= hash >> 16;
 
-            // Free the unicode string and the list entry.
-            LcFreeUnicodeString(&pathEntry->Path);
-            LcFreeNonPagedBuffer(pathEntry);
-        }
-    }
-    __finally
-    {
-        FltReleaseResource(Configuration.Lock);
-    }
+    return hash;
 }
 
-//------------------------------------------------------------------------
-//  Operation mode management functions.
 //------------------------------------------------------------------------
 
+static
 VOID
-LcSetOperationMode(
-    _In_ DRIVER_OPERATION_MODE Value
+LcProcessNotifyRoutine(
+    _In_ HANDLE  ParentId,
+    _In_ HANDLE  ProcessId,
+    _In_ BOOLEAN Create
     )
 /*++
 
 Summary:
 
-    This function sets the new value for the 'Configuration.OperationMode' variable.
+    This function is called by the system, when a process is created or deleted.
+
+    It removes the exiting process from the list of trusted processes, because
+    its ID might be reused by another process.
 
 Arguments:
 
-    Value - The new operation mode value.
+    ParentId  - Parent process ID.
+
+    ProcessId - Process ID.
+
+    Create    - Whether the process was created or deleted.
 
 Return value:
 
@@ -861,107 +2400,178 @@ Return value:
 {
     PAGED_CODE();
 
-    Configuration.OperationMode = Value;
-    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Configuration.OperationMode is set to: %08X\n", (ULONG)Value));
+    UNREFERENCED_PARAMETER(ParentId);
+
+    // Most of the processes are not trusted, so check the snapshot first without acquiring the lock.
+    if (Create || !LcIsProcessTrusted(ProcessId))
+    {
+        return;
+    }
+
+    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Trusted process exited: %p\n", ProcessId));
+
+    LcRemoveTrustedProcess(ProcessId);
 }
 
 //------------------------------------------------------------------------
 
-_Check_return_
-DRIVER_OPERATION_MODE
-LcGetOperationMode()
+static
+VOID
+LcReleaseWatchRules(
+    _In_ PWATCH_RULES WatchRules
+    )
 /*++
 
 Summary:
 
-    This function gets the value of the 'Configuration.OperationMode' variable.
+    This function releases a reference to the watch rules given.
+    The rules are freed, when the last reference is released.
 
 Arguments:
 
-    None.
+    WatchRules - Watch rules to release.
 
 Return value:
 
-    The current 'Configuration.OperationMode' value.
+    None.
 
 --*/
 {
     PAGED_CODE();
 
-    return Configuration.OperationMode;
+    IF_FALSE_RETURN(WatchRules != NULL);
+
+    if (InterlockedDecrement(&WatchRules->ReferenceCount) == 0)
+    {
+        if (WatchRules->Trie != NULL)
+        {
+            LcReleasePathTrie(WatchRules->Trie);
+        }
+
+        LcFreeBuffer(WatchRules, LC_BUFFER_PAGED_POOL_TAG);
+    }
 }
 
-//------------------------------------------------------------------------
-//  Report rate management functions.
 //------------------------------------------------------------------------
 
-VOID
-LcSetReportRate(
-    _In_ ULONG Value
+static
+_Check_return_
+BOOLEAN
+LcMatchWatchRule(
+    _In_     ULONG PathIndex,
+    _In_opt_ PVOID Context
     )
 /*++
 
 Summary:
 
-    This function sets the new value for the 'Configuration.ReportRate' variable.
+    This function is called by the 'LcMatchPathTrie' for every watch rule, which path matches
+    the file path, and checks whether the file matches the rule filters.
 
 Arguments:
 
-    Value - The new report rate value.
-            This value belongs to the [0; 10000] interval and represents the number
-            of chances in 10,000 that the current driver will report ETW for a file
-            access operation.
+    PathIndex - Index of the rule in the 'WATCH_RULES.Rules' array.
+
+    Context   - Pointer to the 'WATCH_RULE_MATCH_CONTEXT' structure.
 
 Return value:
 
-    None.
+    Whether the file matches the rule.
 
 --*/
 {
+    PWATCH_RULE_MATCH_CONTEXT context = (PWATCH_RULE_MATCH_CONTEXT)Context;
+    PWATCH_RULE               rule    = NULL;
+
     PAGED_CODE();
 
-    if (Value > MAX_REPORT_RATE)
+    IF_FALSE_RETURN_RESULT(context != NULL,                            FALSE);
+    IF_FALSE_RETURN_RESULT(PathIndex < context->WatchRules->RuleCount, FALSE);
+
+    rule = &context->WatchRules->Rules[PathIndex];
+
+    if (rule->ProcessId != NULL && rule->ProcessId != context->ProcessId)
     {
-        Value = MAX_REPORT_RATE;
+        return FALSE;
     }
 
-    Configuration.ReportRate = Value;
-    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Configuration.ReportRate is set to: %u\n", Value));
+    if (rule->Extension.Length > 0 && !RtlEqualUnicodeString(&rule->Extension, &context->Extension, TRUE))
+    {
+        return FALSE;
+    }
+
+    context->ReportRate = rule->ReportRate;
+
+    return TRUE;
 }
 
 //------------------------------------------------------------------------
 
-_Check_return_
-ULONG
-LcGetReportRateForPath(
-    _In_ PCUNICODE_STRING Path
+static
+VOID
+LcGetFileExtension(
+    _In_  PCUNICODE_STRING Path,
+    _Out_ PUNICODE_STRING  Extension
     )
 /*++
 
 Summary:
 
-    This function checks, whether the 'Path' given (or one of its parents) is in the list
-    of paths to watch, and returns the proper report rate for it.
+    This function finds the extension of the file the 'Path' given points to.
+
+    Stream name, if any, is not included into the extension.
 
 Arguments:
 
-    Path - Pointer to a unicode string containing the path to be checked.
+    Path      - File path.
 
-Return value:
+    Extension - Receives the file extension without the leading dot.
+                It points to the 'Path' buffer, and is empty, if the file has no extension.
 
-    Report rate for the 'Path' given.
+Return value:
 
-    If the 'Path' is not in the list of paths to watch, this function returns zero.
+    None.
 
 --*/
 {
+    USHORT start = 0;
+    USHORT end   = 0;
+    USHORT idx   = 0;
+
     PAGED_CODE();
 
-    return LcIsPathWatched(Path) ? Configuration.ReportRate : 0;
+    FLT_ASSERT(Path      != NULL);
+    FLT_ASSERT(Extension != NULL);
+
+    RtlZeroMemory(Extension, sizeof(UNICODE_STRING));
+
+    // Find the beginning of the file name.
+    start = Path->Length / sizeof(WCHAR);
+    while (start > 0 && Path->Buffer[start - 1] != L'\\')
+    {
+        start--;
+    }
+
+    // Stream name and type follow the first colon in the file name.
+    end = start;
+    while (end < Path->Length / sizeof(WCHAR) && Path->Buffer[end] != L':')
+    {
+        end++;
+    }
+
+    // Extension follows the last dot.
+    for (idx = end; idx > start; idx--)
+    {
+        if (Path->Buffer[idx - 1] == L'.')
+        {
+            Extension->Buffer        = &Path->Buffer[idx];
+            Extension->Length        = (end - idx) * sizeof(WCHAR);
+            Extension->MaximumLength = Extension->Length;
+            break;
+        }
+    }
 }
 
-//------------------------------------------------------------------------
-//  Local functions.
 //------------------------------------------------------------------------
 
 static
@@ -1018,3 +2628,47 @@ Return value:
 
     return STATUS_SUCCESS;
 }
+
+//------------------------------------------------------------------------
+
+static
+VOID
+LcNormalizeVolumeTuning(
+    _Inout_ PVOLUME_TUNING Tuning
+    )
+/*++
+
+Summary:
+
+    This local function replaces zero tuning values with the defaults, and makes sure
+    that the rest of the values are within the supported limits.
+
+    Chunk size is rounded up to the page size, so the non-cached writes stay aligned.
+
+Arguments:
+
+    Tuning - Tuning parameters to normalize.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    FLT_ASSERT(Tuning != NULL);
+
+    if (Tuning->ChunkSize == 0)
+    {
+        Tuning->ChunkSize = DEFAULT_CHUNK_SIZE;
+    }
+
+    if (Tuning->MaxChunks == 0)
+    {
+        Tuning->MaxChunks = DEFAULT_MAX_CHUNKS;
+    }
+
+    Tuning->ChunkSize = (ULONG)ROUND_TO_PAGES(max(MIN_CHUNK_SIZE, min(MAX_CHUNK_SIZE, Tuning->ChunkSize)));
+    Tuning->MaxChunks = max(MIN_CHUNKS, min(MAX_CHUNKS, Tuning->MaxChunks));
+}
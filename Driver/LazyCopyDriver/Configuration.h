@@ -53,6 +53,23 @@ Environment:
 #define MAX_REPORT_RATE      10000L
 #define DEFAULT_REPORT_RATE  600L
 
+// Watch rule report rate value meaning that the 'Configuration.ReportRate' is used.
+#define GLOBAL_REPORT_RATE   MAXULONG
+
+// Default time, in milliseconds, the user-mode client is given to fetch a file.
+// Zero means that the driver waits for the reply indefinitely.
+#define DEFAULT_USER_MODE_FETCH_TIMEOUT  (5 * 60 * 1000)
+
+// Default fetch tuning parameters for volumes without explicit policy.
+#define DEFAULT_CHUNK_SIZE   (128 * 1024)
+#define DEFAULT_MAX_CHUNKS   4
+
+// Limits for the fetch tuning parameters.
+#define MIN_CHUNK_SIZE       PAGE_SIZE
+#define MAX_CHUNK_SIZE       (16 * 1024 * 1024)
+#define MIN_CHUNKS           2
+#define MAX_CHUNKS           64
+
 //------------------------------------------------------------------------
 //  Enums.
 //------------------------------------------------------------------------
@@ -63,15 +80,86 @@ Environment:
 typedef enum _DRIVER_OPERATION_MODE
 {
     // All driver operations are disabled.
-    DriverDisabled = 0,
+    DriverDisabled    = 0,
 
     // Fetch operations are enabled.
-    FetchEnabled   = 1 << 0,
+    FetchEnabled      = 1 << 0,
 
     // Watch paths are enabled.
-    WatchEnabled   = 1 << 1
+    WatchEnabled      = 1 << 1,
+
+    // File access events are sampled by the path hash instead of randomly,
+    // so the same files are reported every time.
+    SampleByPath      = 1 << 2,
+
+    // File accesses are counted in the access table to be drained by the user-mode client,
+    // instead of raising an ETW event per access.
+    AggregateAccesses = 1 << 3
 } DRIVER_OPERATION_MODE, *PDRIVER_OPERATION_MODE;
 
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+//
+// Contains fetch tuning parameters for a volume.
+//
+typedef struct _VOLUME_TUNING
+{
+    // Size of a single buffer the remote file content is read into.
+    ULONG ChunkSize;
+
+    // Maximum amount of buffers that can be read or written at the same time.
+    ULONG MaxChunks;
+
+    // Files that are not smaller than this value are written to the volume bypassing
+    // the system cache. Zero disables the non-cached writes.
+    ULONG UnbufferedThreshold;
+} VOLUME_TUNING, *PVOLUME_TUNING;
+
+typedef const VOLUME_TUNING* PCVOLUME_TUNING;
+
+//
+// Opaque compiled list of the paths to watch.
+//
+typedef struct _WATCH_RULES WATCH_RULES, *PWATCH_RULES;
+
+//
+// Immutable copy of the configuration parameters used by the file operation callbacks.
+// A new snapshot is published every time these parameters change, so the readers
+// don't need to acquire any locks.
+//
+typedef struct _CONFIGURATION_SNAPSHOT
+{
+    DRIVER_OPERATION_MODE OperationMode;
+
+    ULONG                 ReportRate;
+
+    // Compiled paths to watch. NULL, if there are no paths to watch.
+    PWATCH_RULES          WatchRules;
+
+    // Open addressing hash set of the trusted process IDs.
+    // It contains 'TrustedProcessMask + 1' slots, and at least a half of them are empty (NULL).
+    ULONG                 TrustedProcessMask;
+    HANDLE                TrustedProcesses[ANYSIZE_ARRAY];
+} CONFIGURATION_SNAPSHOT, *PCONFIGURATION_SNAPSHOT;
+
+typedef const CONFIGURATION_SNAPSHOT* PCCONFIGURATION_SNAPSHOT;
+
+//
+// Reference to the configuration snapshot returned by the 'LcAcquireConfigurationSnapshot'.
+//
+typedef struct _CONFIGURATION_REFERENCE
+{
+    // Snapshot acquired. Might be NULL, if the configuration is not initialized.
+    PCCONFIGURATION_SNAPSHOT Snapshot;
+
+    // Reader counter incremented, when the reference was acquired.
+    // The same counter is decremented on release, even if the thread has moved to
+    // another processor, so the counters never go below zero.
+    __volatile LONG*         ReaderCount;
+} CONFIGURATION_REFERENCE, *PCONFIGURATION_REFERENCE;
+
 //------------------------------------------------------------------------
 //  Function prototypes.
 //------------------------------------------------------------------------
@@ -97,6 +185,45 @@ _Check_return_
 NTSTATUS
 LcReadConfigurationFromRegistry();
 
+//
+//  Configuration snapshot functions.
+//
+
+VOID
+LcAcquireConfigurationSnapshot(
+    _Out_ PCONFIGURATION_REFERENCE Reference
+    );
+
+VOID
+LcReleaseConfigurationSnapshot(
+    _Inout_ PCONFIGURATION_REFERENCE Reference
+    );
+
+_Check_return_
+BOOLEAN
+LcIsProcessTrustedInSnapshot(
+    _In_opt_ PCCONFIGURATION_SNAPSHOT Snapshot,
+    _In_     HANDLE                   ProcessId
+    );
+
+_Check_return_
+ULONG
+LcGetReportRateForPathInSnapshot(
+    _In_opt_ PCCONFIGURATION_SNAPSHOT Snapshot,
+    _In_     PCUNICODE_STRING         Path,
+    _In_opt_ HANDLE                   ProcessId
+    );
+
+//
+//  Configuration update functions.
+//
+
+VOID
+LcBeginConfigurationUpdate();
+
+NTSTATUS
+LcEndConfigurationUpdate();
+
 //
 //  Trusted processes management functions.
 //
@@ -128,9 +255,16 @@ LcClearTrustedProcesses();
 _Check_return_
 NTSTATUS
 LcAddPathToWatch(
-    _In_ PCUNICODE_STRING Path
+    _In_     PCUNICODE_STRING Path,
+    _In_     ULONG            ReportRate,
+    _In_opt_ PCUNICODE_STRING Extension,
+    _In_opt_ HANDLE           ProcessId
     );
 
+_Check_return_
+NTSTATUS
+LcCompilePathsToWatch();
+
 _Check_return_
 BOOLEAN
 LcIsPathWatched(
@@ -140,6 +274,29 @@ LcIsPathWatched(
 VOID
 LcClearPathsToWatch();
 
+//
+//  Volume policy management functions.
+//
+
+_Check_return_
+NTSTATUS
+LcAddVolumePolicy(
+    _In_     PCUNICODE_STRING Selector,
+    _In_opt_ PCVOLUME_TUNING  Tuning
+    );
+
+_Check_return_
+BOOLEAN
+LcGetVolumePolicy(
+    _In_     PCUNICODE_STRING FileSystemName,
+    _In_opt_ PCUNICODE_STRING VolumeGuidName,
+    _In_opt_ PCUNICODE_STRING VolumeLabel,
+    _Out_    PVOLUME_TUNING   Tuning
+    );
+
+VOID
+LcClearVolumePolicies();
+
 //
 //  Operation mode management functions.
 //
@@ -165,7 +322,21 @@ LcSetReportRate(
 _Check_return_
 ULONG
 LcGetReportRateForPath(
-    _In_ PCUNICODE_STRING Path
+    _In_     PCUNICODE_STRING Path,
+    _In_opt_ HANDLE           ProcessId
     );
 
+//
+//  User-mode fetch timeout management functions.
+//
+
+VOID
+LcSetUserModeFetchTimeout(
+    _In_ ULONG Value
+    );
+
+_Check_return_
+ULONG
+LcGetUserModeFetchTimeout();
+
 #endif // __LAZY_COPY_CONFIGURATION_H__
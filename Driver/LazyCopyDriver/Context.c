@@ -41,6 +41,7 @@ Environment:
 //------------------------------------------------------------------------
 
 #include "Context.h"
+#include "Statistics.h"
 #include "Utilities.h"
 
 //------------------------------------------------------------------------
@@ -53,6 +54,17 @@ Environment:
     #pragma alloc_text(PAGE, LcFindOrCreateStreamContext)
     #pragma alloc_text(PAGE, LcCreateStreamContext)
     #pragma alloc_text(PAGE, LcGetStreamContext)
+
+    #pragma alloc_text(PAGE, LcCreateInstanceContext)
+    #pragma alloc_text(PAGE, LcApplyVolumePolicyToInstance)
+    #pragma alloc_text(PAGE, LcIsInstanceEnabled)
+    #pragma alloc_text(PAGE, LcGetInstanceTuning)
+
+    #pragma alloc_text(PAGE, LcGetPlaceholderGeneration)
+    #pragma alloc_text(PAGE, LcInvalidateDirectoryContexts)
+    #pragma alloc_text(PAGE, LcIsDirectoryPlaceholderFree)
+    #pragma alloc_text(PAGE, LcMarkDirectoryPlaceholderFree)
+    #pragma alloc_text(PAGE, LcFindOrCreateDirectoryHandleContext)
 #endif // ALLOC_PRAGMA
 
 //------------------------------------------------------------------------
@@ -83,20 +95,42 @@ Return value:
 
 --*/
 {
-    PLC_STREAM_CONTEXT context = NULL;
+    PLC_STREAM_CONTEXT   streamContext   = NULL;
+    PLC_INSTANCE_CONTEXT instanceContext = NULL;
 
     PAGED_CODE();
 
-    UNREFERENCED_PARAMETER(ContextType);
+    FLT_ASSERT(Context != NULL_CONTEXT);
+    FLT_ASSERT(ContextType == FLT_STREAM_CONTEXT || ContextType == FLT_INSTANCE_CONTEXT || ContextType == FLT_FILE_CONTEXT || ContextType == FLT_STREAMHANDLE_CONTEXT);
 
-    FLT_ASSERT(Context     != NULL_CONTEXT);
-    FLT_ASSERT(ContextType == FLT_STREAM_CONTEXT);
+    if (ContextType == FLT_FILE_CONTEXT || ContextType == FLT_STREAMHANDLE_CONTEXT)
+    {
+        // Directory contexts do not own any resources.
+        return;
+    }
 
-    context = (PLC_STREAM_CONTEXT)Context;
+    if (ContextType == FLT_STREAM_CONTEXT)
+    {
+        streamContext = (PLC_STREAM_CONTEXT)Context;
 
-    if (context->RemoteFilePath.Buffer != NULL)
+        if (streamContext->RemoteFilePath.Buffer != NULL)
+        {
+            LcFreeUnicodeString(&streamContext->RemoteFilePath);
+        }
+    }
+    else
     {
-        LcFreeUnicodeString(&context->RemoteFilePath);
+        instanceContext = (PLC_INSTANCE_CONTEXT)Context;
+
+        if (instanceContext->VolumeGuidName.Buffer != NULL)
+        {
+            LcFreeUnicodeString(&instanceContext->VolumeGuidName);
+        }
+
+        if (instanceContext->VolumeLabel.Buffer != NULL)
+        {
+            LcFreeUnicodeString(&instanceContext->VolumeLabel);
+        }
     }
 }
 
@@ -339,3 +373,586 @@ Return value:
 
     return status;
 }
+
+//------------------------------------------------------------------------
+//  Instance context functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcCreateInstanceContext(
+    _In_     PCFLT_RELATED_OBJECTS FltObjects,
+    _In_     FLT_FILESYSTEM_TYPE   FileSystemType,
+    _In_     BOOLEAN               QueryVolumeGuidName,
+    _Outptr_ PLC_INSTANCE_CONTEXT* InstanceContext
+    )
+/*++
+
+Summary:
+
+    This function creates a new instance context, populates it with the volume
+    properties, and attaches it to the filter instance given.
+
+    The volume GUID name cannot be safely queried for the newly mounted volumes,
+    because the mount manager might deadlock, so the 'QueryVolumeGuidName' should
+    be FALSE in this case.
+
+    The caller should release the context returned.
+
+Arguments:
+
+    FltObjects          - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                          opaque handles to this filter, instance and its associated volume.
+
+    FileSystemType      - File system type of the volume.
+
+    QueryVolumeGuidName - Whether the volume GUID name should be queried.
+
+    InstanceContext     - Receives the context created.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS                    status                  = STATUS_SUCCESS;
+    PLC_INSTANCE_CONTEXT        context                 = NULL;
+    IO_STATUS_BLOCK             statusBlock             = { 0 };
+    ULONG                       bufferSizeNeeded        = 0;
+    UNICODE_STRING              label                   = { 0 };
+    PFLT_VOLUME_PROPERTIES      volumeProperties        = NULL;
+    PFILE_FS_VOLUME_INFORMATION volumeInformation       = NULL;
+
+    // Volume properties and label are followed by the variable-length strings.
+    UCHAR                       volumePropertiesBuffer[sizeof(FLT_VOLUME_PROPERTIES) + 512]                       = { 0 };
+    UCHAR                       volumeInformationBuffer[sizeof(FILE_FS_VOLUME_INFORMATION) + 64 * sizeof(WCHAR)] = { 0 };
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(FltObjects           != NULL, STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(FltObjects->Instance != NULL, STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(InstanceContext      != NULL, STATUS_INVALID_PARAMETER_4);
+
+    *InstanceContext = NULL;
+
+    __try
+    {
+        NT_IF_FAIL_LEAVE(FltAllocateContext(Globals.Filter, FLT_INSTANCE_CONTEXT, sizeof(LC_INSTANCE_CONTEXT), NonPagedPoolNx, (PFLT_CONTEXT*)&context));
+        RtlZeroMemory(context, sizeof(LC_INSTANCE_CONTEXT));
+
+        context->FileSystemType        = FileSystemType;
+        context->PlaceholderGeneration = 1;
+
+        NT_IF_FAIL_LEAVE(LcInitializePendedFetchQueue(FltObjects->Instance, &context->PendedFetches));
+
+        // Sector size is used to align the non-cached writes.
+        volumeProperties = (PFLT_VOLUME_PROPERTIES)volumePropertiesBuffer;
+        status = FltGetVolumeProperties(FltObjects->Volume, volumeProperties, sizeof(volumePropertiesBuffer), &bufferSizeNeeded);
+        NT_IF_FALSE_LEAVE(NT_SUCCESS(status) || status == STATUS_BUFFER_OVERFLOW, status);
+        status = STATUS_SUCCESS;
+
+        context->SectorSize = volumeProperties->SectorSize;
+
+        // Volume label is optional.
+        volumeInformation = (PFILE_FS_VOLUME_INFORMATION)volumeInformationBuffer;
+        if (NT_SUCCESS(FltQueryVolumeInformation(FltObjects->Instance, &statusBlock, volumeInformation, sizeof(volumeInformationBuffer), FileFsVolumeInformation))
+            && volumeInformation->VolumeLabelLength > 0)
+        {
+            label.Buffer        = volumeInformation->VolumeLabel;
+            label.Length        = (USHORT)volumeInformation->VolumeLabelLength;
+            label.MaximumLength = label.Length;
+
+            NT_IF_FAIL_LEAVE(LcCopyUnicodeString(&context->VolumeLabel, &label));
+        }
+
+        if (QueryVolumeGuidName)
+        {
+            // Get the buffer size required first.
+            status = FltGetVolumeGuidName(FltObjects->Volume, NULL, &bufferSizeNeeded);
+            if (status == STATUS_BUFFER_TOO_SMALL)
+            {
+                NT_IF_FAIL_LEAVE(LcAllocateUnicodeString(&context->VolumeGuidName, (USHORT)bufferSizeNeeded));
+                NT_IF_FAIL_LEAVE(FltGetVolumeGuidName(FltObjects->Volume, &context->VolumeGuidName, NULL));
+            }
+            else
+            {
+                LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_WARNING_LEVEL, "[LazyCopy] Unable to get GUID name for Volume = %p: %08X\n", FltObjects->Volume, status));
+                status = STATUS_SUCCESS;
+            }
+        }
+
+        LcApplyVolumePolicyToInstance(context);
+
+        NT_IF_FAIL_LEAVE(FltSetInstanceContext(FltObjects->Instance, FLT_SET_CONTEXT_KEEP_IF_EXISTS, context, NULL));
+
+        *InstanceContext = context;
+        context          = NULL;
+    }
+    __finally
+    {
+        if (context != NULL)
+        {
+            FltReleaseContext(context);
+        }
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+BOOLEAN
+LcApplyVolumePolicyToInstance(
+    _In_ PLC_INSTANCE_CONTEXT InstanceContext
+    )
+/*++
+
+Summary:
+
+    This function evaluates the current volume policy for the volume the instance
+    context belongs to, and updates the 'Enabled' flag and the tuning parameters.
+
+Arguments:
+
+    InstanceContext - Instance context to update.
+
+Return value:
+
+    Whether the current driver should process operations on the volume.
+
+--*/
+{
+    VOLUME_TUNING  tuning         = { 0 };
+    BOOLEAN        enabled        = FALSE;
+    UNICODE_STRING fileSystemName = { 0 };
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(InstanceContext != NULL, FALSE);
+
+    switch (InstanceContext->FileSystemType)
+    {
+        case FLT_FSTYPE_NTFS:
+            RtlInitUnicodeString(&fileSystemName, L"NTFS");
+            break;
+        case FLT_FSTYPE_REFS:
+            RtlInitUnicodeString(&fileSystemName, L"REFS");
+            break;
+
+        default:
+            InstanceContext->Enabled = FALSE;
+            return FALSE;
+    }
+
+    enabled = LcGetVolumePolicy(
+        &fileSystemName,
+        InstanceContext->VolumeGuidName.Buffer != NULL ? &InstanceContext->VolumeGuidName : NULL,
+        InstanceContext->VolumeLabel.Buffer    != NULL ? &InstanceContext->VolumeLabel    : NULL,
+        &tuning);
+
+    // Readers copy these values, so a concurrent fetch will use either the old or the new values for each field.
+    InstanceContext->Tuning  = tuning;
+    InstanceContext->Enabled = enabled;
+
+    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Volume policy applied: '%wZ' '%wZ' enabled: %d\n", &InstanceContext->VolumeGuidName, &InstanceContext->VolumeLabel, enabled));
+
+    return enabled;
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+BOOLEAN
+LcIsInstanceEnabled(
+    _In_ PFLT_INSTANCE Instance
+    )
+/*++
+
+Summary:
+
+    This function checks whether the operations on the volume the 'Instance' is attached to
+    should be processed by the current driver.
+
+Arguments:
+
+    Instance - Filter instance to check.
+
+Return value:
+
+    Whether the volume matches the current volume policy.
+
+--*/
+{
+    PLC_INSTANCE_CONTEXT context = NULL;
+    BOOLEAN              enabled = FALSE;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Instance != NULL, FALSE);
+
+    if (!NT_SUCCESS(FltGetInstanceContext(Instance, (PFLT_CONTEXT*)&context)))
+    {
+        return FALSE;
+    }
+
+    enabled = context->Enabled;
+
+    FltReleaseContext(context);
+
+    return enabled;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcGetInstanceTuning(
+    _In_  PFLT_INSTANCE  Instance,
+    _Out_ PVOLUME_TUNING Tuning,
+    _Out_ PULONG         SectorSize
+    )
+/*++
+
+Summary:
+
+    This function gets the fetch tuning parameters for the volume the 'Instance' is attached to.
+
+    If the instance context is not available, default parameters are returned.
+
+Arguments:
+
+    Instance   - Filter instance attached to the volume.
+
+    Tuning     - Receives the tuning parameters.
+
+    SectorSize - Receives the volume sector size. Zero, if it's unknown.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PLC_INSTANCE_CONTEXT context = NULL;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(Tuning     != NULL);
+    FLT_ASSERT(SectorSize != NULL);
+
+    Tuning->ChunkSize           = DEFAULT_CHUNK_SIZE;
+    Tuning->MaxChunks           = DEFAULT_MAX_CHUNKS;
+    Tuning->UnbufferedThreshold = 0;
+    *SectorSize                 = 0;
+
+    if (Instance == NULL || !NT_SUCCESS(FltGetInstanceContext(Instance, (PFLT_CONTEXT*)&context)))
+    {
+        return;
+    }
+
+    *Tuning     = context->Tuning;
+    *SectorSize = context->SectorSize;
+
+    FltReleaseContext(context);
+}
+
+//------------------------------------------------------------------------
+//  Directory context functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+LONG
+LcGetPlaceholderGeneration(
+    _In_ PFLT_INSTANCE Instance
+    )
+/*++
+
+Summary:
+
+    This function gets the current placeholder generation for the volume
+    the 'Instance' is attached to.
+
+Arguments:
+
+    Instance - Filter instance attached to the volume.
+
+Return value:
+
+    Current placeholder generation, or zero, if the instance context is not available.
+
+--*/
+{
+    PLC_INSTANCE_CONTEXT context    = NULL;
+    LONG                 generation = 0;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Instance != NULL, 0);
+
+    if (!NT_SUCCESS(FltGetInstanceContext(Instance, (PFLT_CONTEXT*)&context)))
+    {
+        return 0;
+    }
+
+    generation = context->PlaceholderGeneration;
+
+    FltReleaseContext(context);
+
+    return generation;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcInvalidateDirectoryContexts(
+    _In_ PFLT_INSTANCE Instance
+    )
+/*++
+
+Summary:
+
+    This function invalidates all directory contexts on the volume the 'Instance' is attached to,
+    so the directories are scanned again for the LazyCopy files.
+
+    It should be called every time a LazyCopy file might appear in a directory.
+
+Arguments:
+
+    Instance - Filter instance attached to the volume.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PLC_INSTANCE_CONTEXT context = NULL;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN(Instance != NULL);
+
+    if (!NT_SUCCESS(FltGetInstanceContext(Instance, (PFLT_CONTEXT*)&context)))
+    {
+        return;
+    }
+
+    // Zero is reserved for the directories that were never validated.
+    if (InterlockedIncrement(&context->PlaceholderGeneration) == 0)
+    {
+        InterlockedIncrement(&context->PlaceholderGeneration);
+    }
+
+    FltReleaseContext(context);
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+BOOLEAN
+LcIsDirectoryPlaceholderFree(
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    )
+/*++
+
+Summary:
+
+    This function checks whether the target directory is known to contain no LazyCopy files,
+    and updates the directory query counters with the result.
+
+Arguments:
+
+    FltObjects - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                 opaque handles to this filter, instance, its associated volume and
+                 file object.
+
+Return value:
+
+    TRUE, if the directory was fully enumerated after the last placeholder generation
+    change, and no LazyCopy files were found in it.
+
+--*/
+{
+    PLC_INSTANCE_CONTEXT  instanceContext  = NULL;
+    PLC_DIRECTORY_CONTEXT directoryContext = NULL;
+    BOOLEAN               placeholderFree  = FALSE;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(FltObjects != NULL, FALSE);
+
+    if (!NT_SUCCESS(FltGetInstanceContext(FltObjects->Instance, (PFLT_CONTEXT*)&instanceContext)))
+    {
+        return FALSE;
+    }
+
+    if (NT_SUCCESS(FltGetFileContext(FltObjects->Instance, FltObjects->FileObject, (PFLT_CONTEXT*)&directoryContext)))
+    {
+        placeholderFree = directoryContext->PlaceholderFreeGeneration == instanceContext->PlaceholderGeneration;
+        FltReleaseContext(directoryContext);
+    }
+
+    LcRecordDirectoryQuery(placeholderFree);
+
+    FltReleaseContext(instanceContext);
+
+    return placeholderFree;
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcMarkDirectoryPlaceholderFree(
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ LONG                  Generation
+    )
+/*++
+
+Summary:
+
+    This function marks the target directory as the one containing no LazyCopy files.
+
+    The mark is only valid while the instance placeholder generation is equal to
+    the 'Generation' given, so if it has changed during the enumeration,
+    the directory will be scanned again.
+
+Arguments:
+
+    FltObjects - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                 opaque handles to this filter, instance, its associated volume and
+                 file object.
+
+    Generation - Placeholder generation the directory enumeration was started with.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS              status     = STATUS_SUCCESS;
+    PLC_DIRECTORY_CONTEXT context    = NULL;
+    PLC_DIRECTORY_CONTEXT oldContext = NULL;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(FltObjects != NULL, STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(Generation != 0,    STATUS_INVALID_PARAMETER_2);
+
+    __try
+    {
+        status = FltGetFileContext(FltObjects->Instance, FltObjects->FileObject, (PFLT_CONTEXT*)&context);
+        if (status == STATUS_NOT_FOUND)
+        {
+            NT_IF_FAIL_LEAVE(FltAllocateContext(Globals.Filter, FLT_FILE_CONTEXT, sizeof(LC_DIRECTORY_CONTEXT), PagedPool, (PFLT_CONTEXT*)&context));
+            RtlZeroMemory(context, sizeof(LC_DIRECTORY_CONTEXT));
+
+            status = FltSetFileContext(FltObjects->Instance, FltObjects->FileObject, FLT_SET_CONTEXT_KEEP_IF_EXISTS, context, (PFLT_CONTEXT*)&oldContext);
+            if (status == STATUS_FLT_CONTEXT_ALREADY_DEFINED)
+            {
+                // Use the context set by another caller.
+                FltReleaseContext(context);
+                context = oldContext;
+                status  = STATUS_SUCCESS;
+            }
+        }
+
+        NT_IF_FAIL_LEAVE(status);
+
+        InterlockedExchange(&context->PlaceholderFreeGeneration, Generation);
+    }
+    __finally
+    {
+        if (context != NULL)
+        {
+            FltReleaseContext(context);
+        }
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcFindOrCreateDirectoryHandleContext(
+    _In_     PCFLT_RELATED_OBJECTS         FltObjects,
+    _Outptr_ PLC_DIRECTORY_HANDLE_CONTEXT* HandleContext,
+    _Out_    PBOOLEAN                      ContextCreated
+    )
+/*++
+
+Summary:
+
+    This function finds the directory handle context for the target file object.
+    If the context does not exist, this function creates a new one and attaches it
+    to the file object.
+
+    The caller should release the context returned.
+
+Arguments:
+
+    FltObjects     - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                     opaque handles to this filter, instance, its associated volume and
+                     file object.
+
+    HandleContext  - Receives the context found or created.
+
+    ContextCreated - Returns TRUE, if the context was created as a result of this function;
+                     otherwise, FALSE.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS                     status     = STATUS_SUCCESS;
+    PLC_DIRECTORY_HANDLE_CONTEXT context    = NULL;
+    PLC_DIRECTORY_HANDLE_CONTEXT oldContext = NULL;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(FltObjects     != NULL, STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(HandleContext  != NULL, STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT(ContextCreated != NULL, STATUS_INVALID_PARAMETER_3);
+
+    *ContextCreated = FALSE;
+
+    __try
+    {
+        status = FltGetStreamHandleContext(FltObjects->Instance, FltObjects->FileObject, (PFLT_CONTEXT*)&context);
+        if (status == STATUS_NOT_FOUND)
+        {
+            NT_IF_FAIL_LEAVE(FltAllocateContext(Globals.Filter, FLT_STREAMHANDLE_CONTEXT, sizeof(LC_DIRECTORY_HANDLE_CONTEXT), PagedPool, (PFLT_CONTEXT*)&context));
+            RtlZeroMemory(context, sizeof(LC_DIRECTORY_HANDLE_CONTEXT));
+
+            status = FltSetStreamHandleContext(FltObjects->Instance, FltObjects->FileObject, FLT_SET_CONTEXT_KEEP_IF_EXISTS, context, (PFLT_CONTEXT*)&oldContext);
+            if (NT_SUCCESS(status))
+            {
+                *ContextCreated = TRUE;
+            }
+            else if (status == STATUS_FLT_CONTEXT_ALREADY_DEFINED)
+            {
+                FltReleaseContext(context);
+                context = oldContext;
+                status  = STATUS_SUCCESS;
+            }
+        }
+
+        NT_IF_FAIL_LEAVE(status);
+
+        *HandleContext = context;
+    }
+    __finally
+    {
+        if (!NT_SUCCESS(status) && context != NULL)
+        {
+            FltReleaseContext(context);
+        }
+    }
+
+    return status;
+}
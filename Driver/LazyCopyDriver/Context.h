@@ -45,6 +45,9 @@ Environment:
 //------------------------------------------------------------------------
 
 #include "Globals.h"
+#include "Configuration.h"
+#include "NegativeCache.h"
+#include "PendedFetches.h"
 
 //------------------------------------------------------------------------
 //  Struct definitions.
@@ -67,6 +70,67 @@ typedef struct _STREAM_CONTEXT
     // There is no resource to protect the context since the its fields are never modified.
 } LC_STREAM_CONTEXT, *PLC_STREAM_CONTEXT;
 
+//
+// Instance context data structure.
+// A new context is attached to every volume the current driver is attached to.
+//
+typedef struct _INSTANCE_CONTEXT
+{
+    // Whether the volume matches the current volume policy.
+    // If it doesn't, the create operations on this volume are not processed,
+    // until the instance is detached by the 'LcApplyVolumePolicy'.
+    __volatile BOOLEAN  Enabled;
+
+    // Fetch tuning parameters for this volume.
+    // Fields may be updated, when the volume policy is reloaded, so they should be copied before use.
+    VOLUME_TUNING       Tuning;
+
+    // Volume properties used to match the volume policy.
+    FLT_FILESYSTEM_TYPE FileSystemType;
+    ULONG               SectorSize;
+    UNICODE_STRING      VolumeGuidName;
+    UNICODE_STRING      VolumeLabel;
+
+    // Incremented every time a LazyCopy file might have appeared in any directory on the volume.
+    // Directory contexts and negative cache entries store the value they were validated with,
+    // so incrementing it invalidates all of them at once.
+    __volatile LONG     PlaceholderGeneration;
+
+    // Read/write operations pended, while their files are fetched by the user-mode client.
+    PENDED_FETCH_QUEUE  PendedFetches;
+
+    // Files known not to be LazyCopy files. Entries are only valid for the current 'PlaceholderGeneration'.
+    NEGATIVE_CACHE      NegativeCache;
+} LC_INSTANCE_CONTEXT, *PLC_INSTANCE_CONTEXT;
+
+//
+// Directory context data structure.
+// Attached to the directories that were fully enumerated and contained no LazyCopy files.
+//
+typedef struct _DIRECTORY_CONTEXT
+{
+    // Instance 'PlaceholderGeneration' value the directory was validated with.
+    // Zero, if the directory is not known to be free of LazyCopy files.
+    __volatile LONG PlaceholderFreeGeneration;
+} LC_DIRECTORY_CONTEXT, *PLC_DIRECTORY_CONTEXT;
+
+//
+// Directory handle context data structure.
+// Tracks the state of the enumeration performed on a single directory handle.
+//
+typedef struct _DIRECTORY_HANDLE_CONTEXT
+{
+    // Whether the current enumeration started from the beginning of the directory
+    // and does not use a file name filter, so it will see every file in it.
+    BOOLEAN ScanEligible;
+
+    // Whether a LazyCopy file was found during the current enumeration.
+    BOOLEAN PlaceholderFound;
+
+    // Instance 'PlaceholderGeneration' value at the moment the enumeration started.
+    LONG    Generation;
+} LC_DIRECTORY_HANDLE_CONTEXT, *PLC_DIRECTORY_HANDLE_CONTEXT;
+
 //------------------------------------------------------------------------
 //  Function prototypes.
 //------------------------------------------------------------------------
@@ -109,4 +173,63 @@ LcGetStreamContext(
     _Outptr_ PLC_STREAM_CONTEXT* StreamContext
     );
 
+_Check_return_
+NTSTATUS
+LcCreateInstanceContext(
+    _In_     PCFLT_RELATED_OBJECTS FltObjects,
+    _In_     FLT_FILESYSTEM_TYPE   FileSystemType,
+    _In_     BOOLEAN               QueryVolumeGuidName,
+    _Outptr_ PLC_INSTANCE_CONTEXT* InstanceContext
+    );
+
+BOOLEAN
+LcApplyVolumePolicyToInstance(
+    _In_ PLC_INSTANCE_CONTEXT InstanceContext
+    );
+
+_Check_return_
+BOOLEAN
+LcIsInstanceEnabled(
+    _In_ PFLT_INSTANCE Instance
+    );
+
+VOID
+LcGetInstanceTuning(
+    _In_  PFLT_INSTANCE  Instance,
+    _Out_ PVOLUME_TUNING Tuning,
+    _Out_ PULONG         SectorSize
+    );
+
+_Check_return_
+LONG
+LcGetPlaceholderGeneration(
+    _In_ PFLT_INSTANCE Instance
+    );
+
+VOID
+LcInvalidateDirectoryContexts(
+    _In_ PFLT_INSTANCE Instance
+    );
+
+_Check_return_
+BOOLEAN
+LcIsDirectoryPlaceholderFree(
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    );
+
+_Check_return_
+NTSTATUS
+LcMarkDirectoryPlaceholderFree(
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ LONG                  Generation
+    );
+
+_Check_return_
+NTSTATUS
+LcFindOrCreateDirectoryHandleContext(
+    _In_     PCFLT_RELATED_OBJECTS         FltObjects,
+    _Outptr_ PLC_DIRECTORY_HANDLE_CONTEXT* HandleContext,
+    _Out_    PBOOLEAN                      ContextCreated
+    );
+
 #endif // __LAZY_COPY_CONTEXT_H__
@@ -0,0 +1,629 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    DirectoryCache.c
+
+Abstract:
+
+    Contains the per-directory cache of the LazyCopy file metadata.
+    It allows the directory enumeration callback to report the remote file
+    size without opening every LazyCopy file in the directory again.
+
+    Each cached file keeps the change time reported by the file system.
+    If the file was changed since it was cached, for example, fetched or
+    re-tagged with another remote file, the entry is considered stale.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "DirectoryCache.h"
+#include "Utilities.h"
+
+//------------------------------------------------------------------------
+//  Defines.
+//------------------------------------------------------------------------
+
+// Amount of directory hash buckets. Should be a power of two.
+#define DIRECTORY_CACHE_BUCKETS          32
+
+// Maximum amount of directories stored in the cache.
+// When the limit is reached, the oldest directory is evicted.
+#define DIRECTORY_CACHE_MAX_DIRECTORIES  128
+
+// Amount of file hash buckets in each directory. Should be a power of two.
+#define DIRECTORY_CACHE_FILE_BUCKETS     32
+
+// Maximum amount of files stored for a single directory.
+// When the limit is reached, new files are not cached.
+#define DIRECTORY_CACHE_MAX_FILES        4096
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+//
+// Contains metadata of a single LazyCopy file.
+//
+typedef struct _FILE_METADATA_ENTRY
+{
+    // Case-insensitive hash of the 'FileName'.
+    ULONG          Hash;
+
+    // Change time of the LazyCopy file, when its metadata was cached.
+    LARGE_INTEGER  ChangeTime;
+
+    // Size of the remote file.
+    LARGE_INTEGER  RemoteFileSize;
+
+    // List entry for the directory file bucket.
+    LIST_ENTRY     ListEntry;
+
+    // Name of the file without the parent directory path.
+    // Its buffer is allocated together with the current structure.
+    UNICODE_STRING FileName;
+} FILE_METADATA_ENTRY, *PFILE_METADATA_ENTRY;
+
+//
+// Contains metadata of the LazyCopy files in a single directory.
+//
+typedef struct _DIRECTORY_CACHE_ENTRY
+{
+    // Case-insensitive hash of the 'DirectoryName'.
+    ULONG          Hash;
+
+    // Full path to the directory.
+    UNICODE_STRING DirectoryName;
+
+    // Hash buckets containing the 'FILE_METADATA_ENTRY' items.
+    LIST_ENTRY     FileBuckets[DIRECTORY_CACHE_FILE_BUCKETS];
+
+    // Amount of files stored for the current directory.
+    ULONG          FileCount;
+
+    // List entry for the hash bucket.
+    LIST_ENTRY     BucketListEntry;
+
+    // List entry for the 'DirectoryCacheAgeList'.
+    LIST_ENTRY     AgeListEntry;
+} DIRECTORY_CACHE_ENTRY, *PDIRECTORY_CACHE_ENTRY;
+
+//------------------------------------------------------------------------
+//  Local function prototypes.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+PDIRECTORY_CACHE_ENTRY
+LcFindDirectoryCacheEntry(
+    _In_ PCUNICODE_STRING DirectoryName,
+    _In_ ULONG            Hash
+    );
+
+static
+_Check_return_
+PFILE_METADATA_ENTRY
+LcFindFileMetadataEntry(
+    _In_ PDIRECTORY_CACHE_ENTRY Directory,
+    _In_ PCUNICODE_STRING       FileName,
+    _In_ ULONG                  Hash
+    );
+
+static
+VOID
+LcDeleteDirectoryCacheEntry(
+    _In_ PDIRECTORY_CACHE_ENTRY Entry
+    );
+
+//------------------------------------------------------------------------
+//  Text sections.
+//------------------------------------------------------------------------
+
+#ifdef ALLOC_PRAGMA
+    #pragma alloc_text(PAGE, LcInitializeDirectoryCache)
+    #pragma alloc_text(PAGE, LcFreeDirectoryCache)
+    #pragma alloc_text(PAGE, LcGetCachedFileMetadata)
+    #pragma alloc_text(PAGE, LcCacheFileMetadata)
+
+    // Local functions.
+    #pragma alloc_text(PAGE, LcFindDirectoryCacheEntry)
+    #pragma alloc_text(PAGE, LcFindFileMetadataEntry)
+    #pragma alloc_text(PAGE, LcDeleteDirectoryCacheEntry)
+#endif // ALLOC_PRAGMA
+
+//------------------------------------------------------------------------
+//  Global variables.
+//------------------------------------------------------------------------
+
+// Used to synchronize access to the cache lists.
+static PERESOURCE DirectoryCacheResource = NULL;
+
+// Hash buckets containing the 'DIRECTORY_CACHE_ENTRY' items.
+static LIST_ENTRY DirectoryCacheBuckets[DIRECTORY_CACHE_BUCKETS] = { 0 };
+
+// All directories ordered by the insertion time. The oldest entry is at the tail.
+static LIST_ENTRY DirectoryCacheAgeList  = { 0 };
+
+// Amount of directories currently stored in the cache.
+static ULONG      DirectoryCacheSize     = 0;
+
+//------------------------------------------------------------------------
+//  Directory cache functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializeDirectoryCache()
+/*++
+
+Summary:
+
+    This function initializes objects used by the current module.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG    idx    = 0;
+
+    PAGED_CODE();
+
+    for (idx = 0; idx < DIRECTORY_CACHE_BUCKETS; idx++)
+    {
+        InitializeListHead(&DirectoryCacheBuckets[idx]);
+    }
+
+    InitializeListHead(&DirectoryCacheAgeList);
+    DirectoryCacheSize = 0;
+
+    NT_IF_FAIL_RETURN(LcAllocateResource(&DirectoryCacheResource));
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcFreeDirectoryCache()
+/*++
+
+Summary:
+
+    This function releases objects used by the current module.
+
+    It is not thread-safe, so it should only be called when the driver is about to be unloaded.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PLIST_ENTRY listEntry = NULL;
+
+    PAGED_CODE();
+
+    if (DirectoryCacheAgeList.Flink != NULL)
+    {
+        // Remove the last element from the list while it's not empty.
+        while ((listEntry = DirectoryCacheAgeList.Blink) != &DirectoryCacheAgeList)
+        {
+            LcDeleteDirectoryCacheEntry(CONTAINING_RECORD(listEntry, DIRECTORY_CACHE_ENTRY, AgeListEntry));
+        }
+    }
+
+    if (DirectoryCacheResource != NULL)
+    {
+        LcFreeResource(DirectoryCacheResource);
+        DirectoryCacheResource = NULL;
+    }
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+BOOLEAN
+LcGetCachedFileMetadata(
+    _In_  PCUNICODE_STRING DirectoryName,
+    _In_  PCUNICODE_STRING FileName,
+    _In_  PLARGE_INTEGER   ChangeTime,
+    _Out_ PLARGE_INTEGER   RemoteFileSize
+    )
+/*++
+
+Summary:
+
+    This function looks for the metadata of the 'FileName' in the 'DirectoryName' given.
+
+    The entry is only returned, if the 'ChangeTime' matches the one stored in the cache.
+
+Arguments:
+
+    DirectoryName  - Full path to the parent directory.
+
+    FileName       - Name of the file without the parent directory path.
+
+    ChangeTime     - Current change time of the file.
+
+    RemoteFileSize - Receives the size of the remote file.
+
+Return value:
+
+    Whether the valid entry was found in the cache.
+
+--*/
+{
+    ULONG                  directoryHash = 0;
+    ULONG                  fileHash      = 0;
+    PDIRECTORY_CACHE_ENTRY directory     = NULL;
+    PFILE_METADATA_ENTRY   file          = NULL;
+    BOOLEAN                result        = FALSE;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(ChangeTime     != NULL, FALSE);
+    IF_FALSE_RETURN_RESULT(RemoteFileSize != NULL, FALSE);
+
+    RemoteFileSize->QuadPart = 0;
+
+    if (!NT_SUCCESS(RtlHashUnicodeString(DirectoryName, TRUE, HASH_STRING_ALGORITHM_DEFAULT, &directoryHash))
+        || !NT_SUCCESS(RtlHashUnicodeString(FileName,   TRUE, HASH_STRING_ALGORITHM_DEFAULT, &fileHash)))
+    {
+        return FALSE;
+    }
+
+    FltAcquireResourceShared(DirectoryCacheResource);
+
+    __try
+    {
+        directory = LcFindDirectoryCacheEntry(DirectoryName, directoryHash);
+        if (directory == NULL)
+        {
+            __leave;
+        }
+
+        file = LcFindFileMetadataEntry(directory, FileName, fileHash);
+        if (file != NULL && file->ChangeTime.QuadPart == ChangeTime->QuadPart)
+        {
+            *RemoteFileSize = file->RemoteFileSize;
+            result          = TRUE;
+        }
+    }
+    __finally
+    {
+        FltReleaseResource(DirectoryCacheResource);
+    }
+
+    return result;
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcCacheFileMetadata(
+    _In_ PCUNICODE_STRING DirectoryName,
+    _In_ PCUNICODE_STRING FileName,
+    _In_ PLARGE_INTEGER   ChangeTime,
+    _In_ PLARGE_INTEGER   RemoteFileSize
+    )
+/*++
+
+Summary:
+
+    This function stores the metadata of the 'FileName' in the 'DirectoryName' given.
+
+    If the directory is not yet cached, and the cache is full, the oldest directory is evicted.
+    Existing file entry is updated with the new values.
+
+Arguments:
+
+    DirectoryName  - Full path to the parent directory.
+
+    FileName       - Name of the file without the parent directory path.
+
+    ChangeTime     - Current change time of the file.
+
+    RemoteFileSize - Size of the remote file.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS               status        = STATUS_SUCCESS;
+    ULONG                  directoryHash = 0;
+    ULONG                  fileHash      = 0;
+    ULONG                  idx           = 0;
+    PDIRECTORY_CACHE_ENTRY directory     = NULL;
+    PDIRECTORY_CACHE_ENTRY newDirectory  = NULL;
+    PFILE_METADATA_ENTRY   file          = NULL;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(NT_SUCCESS(RtlUnicodeStringValidate(DirectoryName)), STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(DirectoryName->Length > 0,                           STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(NT_SUCCESS(RtlUnicodeStringValidate(FileName)),      STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT(FileName->Length > 0,                                STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT(ChangeTime     != NULL,                              STATUS_INVALID_PARAMETER_3);
+    IF_FALSE_RETURN_RESULT(RemoteFileSize != NULL,                              STATUS_INVALID_PARAMETER_4);
+
+    NT_IF_FAIL_RETURN(RtlHashUnicodeString(DirectoryName, TRUE, HASH_STRING_ALGORITHM_DEFAULT, &directoryHash));
+    NT_IF_FAIL_RETURN(RtlHashUnicodeString(FileName,      TRUE, HASH_STRING_ALGORITHM_DEFAULT, &fileHash));
+
+    FltAcquireResourceExclusive(DirectoryCacheResource);
+
+    __try
+    {
+        directory = LcFindDirectoryCacheEntry(DirectoryName, directoryHash);
+        if (directory == NULL)
+        {
+            NT_IF_FAIL_LEAVE(LcAllocateNonPagedBuffer((PVOID*)&newDirectory, sizeof(DIRECTORY_CACHE_ENTRY)));
+            NT_IF_FAIL_LEAVE(LcCopyUnicodeString(&newDirectory->DirectoryName, DirectoryName));
+            newDirectory->Hash = directoryHash;
+
+            for (idx = 0; idx < DIRECTORY_CACHE_FILE_BUCKETS; idx++)
+            {
+                InitializeListHead(&newDirectory->FileBuckets[idx]);
+            }
+
+            // Evict the oldest directory, if there is no space left.
+            if (DirectoryCacheSize >= DIRECTORY_CACHE_MAX_DIRECTORIES)
+            {
+                LcDeleteDirectoryCacheEntry(CONTAINING_RECORD(DirectoryCacheAgeList.Blink, DIRECTORY_CACHE_ENTRY, AgeListEntry));
+            }
+
+            InsertHeadList(&DirectoryCacheBuckets[directoryHash & (DIRECTORY_CACHE_BUCKETS - 1)], &newDirectory->BucketListEntry);
+            InsertHeadList(&DirectoryCacheAgeList, &newDirectory->AgeListEntry);
+            DirectoryCacheSize++;
+
+            // Directory is owned by the cache now.
+            directory    = newDirectory;
+            newDirectory = NULL;
+        }
+
+        file = LcFindFileMetadataEntry(directory, FileName, fileHash);
+        if (file == NULL)
+        {
+            // Don't let a single huge directory consume all the memory.
+            NT_IF_FALSE_LEAVE(directory->FileCount < DIRECTORY_CACHE_MAX_FILES, STATUS_QUOTA_EXCEEDED);
+
+            NT_IF_FAIL_LEAVE(LcAllocateNonPagedBuffer((PVOID*)&file, sizeof(FILE_METADATA_ENTRY) + FileName->Length));
+
+            file->Hash                   = fileHash;
+            file->FileName.Buffer        = (PWCH)((PUCHAR)file + sizeof(FILE_METADATA_ENTRY));
+            file->FileName.Length        = FileName->Length;
+            file->FileName.MaximumLength = FileName->Length;
+            RtlCopyMemory(file->FileName.Buffer, FileName->Buffer, FileName->Length);
+
+            InsertHeadList(&directory->FileBuckets[fileHash & (DIRECTORY_CACHE_FILE_BUCKETS - 1)], &file->ListEntry);
+            directory->FileCount++;
+        }
+
+        file->ChangeTime     = *ChangeTime;
+        file->RemoteFileSize = *RemoteFileSize;
+    }
+    __finally
+    {
+        FltReleaseResource(DirectoryCacheResource);
+
+        if (newDirectory != NULL)
+        {
+            if (newDirectory->DirectoryName.Buffer != NULL)
+            {
+                LcFreeUnicodeString(&newDirectory->DirectoryName);
+            }
+
+            LcFreeNonPagedBuffer(newDirectory);
+        }
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+//  Local functions.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+PDIRECTORY_CACHE_ENTRY
+LcFindDirectoryCacheEntry(
+    _In_ PCUNICODE_STRING DirectoryName,
+    _In_ ULONG            Hash
+    )
+/*++
+
+Summary:
+
+    This function looks for the cache entry with the 'DirectoryName' given.
+
+    The 'DirectoryCacheResource' should be acquired by the caller.
+
+Arguments:
+
+    DirectoryName - Full path to the directory.
+
+    Hash          - Case-insensitive hash of the 'DirectoryName'.
+
+Return value:
+
+    Pointer to the entry found, or NULL.
+
+--*/
+{
+    PLIST_ENTRY            bucket    = NULL;
+    PLIST_ENTRY            listEntry = NULL;
+    PDIRECTORY_CACHE_ENTRY entry     = NULL;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(DirectoryName != NULL);
+
+    bucket    = &DirectoryCacheBuckets[Hash & (DIRECTORY_CACHE_BUCKETS - 1)];
+    listEntry = bucket->Flink;
+
+    while (listEntry != bucket)
+    {
+        entry = CONTAINING_RECORD(listEntry, DIRECTORY_CACHE_ENTRY, BucketListEntry);
+        if (entry->Hash == Hash && RtlEqualUnicodeString(DirectoryName, &entry->DirectoryName, TRUE))
+        {
+            return entry;
+        }
+
+        // Move to the next element.
+        listEntry = listEntry->Flink;
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+PFILE_METADATA_ENTRY
+LcFindFileMetadataEntry(
+    _In_ PDIRECTORY_CACHE_ENTRY Directory,
+    _In_ PCUNICODE_STRING       FileName,
+    _In_ ULONG                  Hash
+    )
+/*++
+
+Summary:
+
+    This function looks for the file entry with the 'FileName' given in the 'Directory'.
+
+    The 'DirectoryCacheResource' should be acquired by the caller.
+
+Arguments:
+
+    Directory - Directory cache entry to look the file in.
+
+    FileName  - Name of the file without the parent directory path.
+
+    Hash      - Case-insensitive hash of the 'FileName'.
+
+Return value:
+
+    Pointer to the entry found, or NULL.
+
+--*/
+{
+    PLIST_ENTRY          bucket    = NULL;
+    PLIST_ENTRY          listEntry = NULL;
+    PFILE_METADATA_ENTRY entry     = NULL;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(Directory != NULL);
+    FLT_ASSERT(FileName  != NULL);
+
+    bucket    = &Directory->FileBuckets[Hash & (DIRECTORY_CACHE_FILE_BUCKETS - 1)];
+    listEntry = bucket->Flink;
+
+    while (listEntry != bucket)
+    {
+        entry = CONTAINING_RECORD(listEntry, FILE_METADATA_ENTRY, ListEntry);
+        if (entry->Hash == Hash && RtlEqualUnicodeString(FileName, &entry->FileName, TRUE))
+        {
+            return entry;
+        }
+
+        // Move to the next element.
+        listEntry = listEntry->Flink;
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+static
+VOID
+LcDeleteDirectoryCacheEntry(
+    _In_ PDIRECTORY_CACHE_ENTRY Entry
+    )
+/*++
+
+Summary:
+
+    This function removes the 'Entry' from the cache lists and frees it
+    together with all file entries it contains.
+
+    The 'DirectoryCacheResource' should be exclusively acquired by the caller.
+
+Arguments:
+
+    Entry - Entry to be deleted.
+
+Return value:
+
+    None.
+
+--*/
+{
+    ULONG       idx       = 0;
+    PLIST_ENTRY listEntry = NULL;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(Entry != NULL);
+    FLT_ASSERT(DirectoryCacheSize > 0);
+
+    RemoveEntryList(&Entry->BucketListEntry);
+    RemoveEntryList(&Entry->AgeListEntry);
+    DirectoryCacheSize--;
+
+    for (idx = 0; idx < DIRECTORY_CACHE_FILE_BUCKETS; idx++)
+    {
+        while ((listEntry = RemoveHeadList(&Entry->FileBuckets[idx])) != &Entry->FileBuckets[idx])
+        {
+            LcFreeNonPagedBuffer(CONTAINING_RECORD(listEntry, FILE_METADATA_ENTRY, ListEntry));
+        }
+    }
+
+    LcFreeUnicodeString(&Entry->DirectoryName);
+    LcFreeNonPagedBuffer(Entry);
+}
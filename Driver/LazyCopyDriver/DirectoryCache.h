@@ -0,0 +1,80 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    DirectoryCache.h
+
+Abstract:
+
+    Contains the per-directory cache of the LazyCopy file metadata.
+    It allows the directory enumeration callback to report the remote file
+    size without opening every LazyCopy file in the directory again.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+#ifndef __LAZY_COPY_DIRECTORY_CACHE_H__
+#define __LAZY_COPY_DIRECTORY_CACHE_H__
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "Globals.h"
+
+//------------------------------------------------------------------------
+//  Directory cache function prototypes.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializeDirectoryCache();
+
+VOID
+LcFreeDirectoryCache();
+
+_Check_return_
+BOOLEAN
+LcGetCachedFileMetadata(
+    _In_  PCUNICODE_STRING DirectoryName,
+    _In_  PCUNICODE_STRING FileName,
+    _In_  PLARGE_INTEGER   ChangeTime,
+    _Out_ PLARGE_INTEGER   RemoteFileSize
+    );
+
+_Check_return_
+NTSTATUS
+LcCacheFileMetadata(
+    _In_ PCUNICODE_STRING DirectoryName,
+    _In_ PCUNICODE_STRING FileName,
+    _In_ PLARGE_INTEGER   ChangeTime,
+    _In_ PLARGE_INTEGER   RemoteFileSize
+    );
+
+#endif // __LAZY_COPY_DIRECTORY_CACHE_H__
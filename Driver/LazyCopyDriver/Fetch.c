@@ -41,8 +41,10 @@ Environment:
 //------------------------------------------------------------------------
 
 #include "Communication.h"
+#include "Context.h"
 #include "Fetch.h"
 #include "LazyCopyEtw.h"
+#include "Statistics.h"
 #include "Utilities.h"
 
 //------------------------------------------------------------------------
@@ -96,10 +98,14 @@ static
 _Check_return_
 NTSTATUS
 LcFetchFileByChunks(
-    _In_  PCFLT_RELATED_OBJECTS FltObjects,
-    _In_  HANDLE                SourceFileHandle,
-    _In_  PLARGE_INTEGER        SourceFileSize,
-    _Out_ PLARGE_INTEGER        BytesCopied
+    _In_     PCFLT_RELATED_OBJECTS FltObjects,
+    _In_     HANDLE                SourceFileHandle,
+    _In_     PLARGE_INTEGER        SourceFileSize,
+    _In_     PCVOLUME_TUNING       Tuning,
+    _In_     ULONG                 SectorSize,
+    _In_opt_ PACTIVE_FETCH         ActiveFetch,
+    _In_     ULONG                 ProcessId,
+    _Out_    PLARGE_INTEGER        BytesCopied
     );
 
 static
@@ -113,30 +119,32 @@ static
 _Check_return_
 NTSTATUS
 LcGetNextAvailableChunk(
-    _In_     PFLT_INSTANCE  Instance,
-    _In_     PLIST_ENTRY    ListHead,
-    _Inout_  PFILE_CHUNK*   CurrentChunk,
-    _Inout_  PULONG         CurrentListLength,
-    _In_     BOOLEAN        ReadOperation,
+    _In_     PFLT_INSTANCE   Instance,
+    _In_     PCVOLUME_TUNING Tuning,
+    _In_     PLIST_ENTRY     ListHead,
+    _Inout_  PFILE_CHUNK*    CurrentChunk,
+    _Inout_  PULONG          CurrentListLength,
+    _In_     BOOLEAN         ReadOperation,
     _When_(ReadOperation,  _In_)
     _When_(!ReadOperation, _In_opt_)
-             PLARGE_INTEGER RemainingBytes,
+             PLARGE_INTEGER  RemainingBytes,
     _When_(ReadOperation,  _In_)
     _When_(!ReadOperation, _In_opt_)
-             PKEVENT        WriteOperationEvent,
+             PKEVENT         WriteOperationEvent,
     _When_(ReadOperation,  _In_)
     _When_(!ReadOperation, _In_opt_)
-             PLARGE_INTEGER WaitTimeout
+             PLARGE_INTEGER  WaitTimeout
     );
 
 static
 _Check_return_
 NTSTATUS
 LcInitializeChunksList(
-    _In_    PFLT_INSTANCE Instance,
-    _In_    PLIST_ENTRY   ListHead,
-    _In_    LARGE_INTEGER FileSize,
-    _Inout_ PULONG        ListLength
+    _In_    PFLT_INSTANCE   Instance,
+    _In_    PCVOLUME_TUNING Tuning,
+    _In_    PLIST_ENTRY     ListHead,
+    _In_    LARGE_INTEGER   FileSize,
+    _Inout_ PULONG          ListLength
     );
 
 static
@@ -150,11 +158,12 @@ static
 _Check_return_
 NTSTATUS
 LcAddNewChunk(
-    _In_     PFLT_INSTANCE  Instance,
-    _In_     PLIST_ENTRY    Entry,
-    _In_     PLARGE_INTEGER RemainingBytes,
-    _Outptr_ PFILE_CHUNK*   AllocatedChunk,
-    _Inout_  PULONG         ListLength
+    _In_     PFLT_INSTANCE   Instance,
+    _In_     PCVOLUME_TUNING Tuning,
+    _In_     PLIST_ENTRY     Entry,
+    _In_     PLARGE_INTEGER  RemainingBytes,
+    _Outptr_ PFILE_CHUNK*    AllocatedChunk,
+    _Inout_  PULONG          ListLength
     );
 
 //------------------------------------------------------------------------
@@ -178,12 +187,6 @@ LcAddNewChunk(
 //  Global variables.
 //------------------------------------------------------------------------
 
-// Size of the temporary buffer to read data into.
-static const ULONG ChunkSize           = 128 * 1024;
-
-// Maximum amount of chunks to use to copy file.
-static const ULONG MaxChunks           = 4;
-
 // I/O operation timeout in milliseconds.
 static const ULONG TimeoutMilliseconds = 15000;
 
@@ -195,11 +198,14 @@ _Check_return_
 _IRQL_requires_(PASSIVE_LEVEL)
 NTSTATUS
 LcFetchRemoteFile(
-    _In_  PCFLT_RELATED_OBJECTS FltObjects,
-    _In_  PUNICODE_STRING       SourceFile,
-    _In_  PUNICODE_STRING       TargetFile,
-    _In_  BOOLEAN               UseCustomHandler,
-    _Out_ PLARGE_INTEGER        BytesCopied
+    _In_     PCFLT_RELATED_OBJECTS FltObjects,
+    _In_     PUNICODE_STRING       SourceFile,
+    _In_     PUNICODE_STRING       TargetFile,
+    _In_     BOOLEAN               UseCustomHandler,
+    _In_opt_ PACTIVE_FETCH         ActiveFetch,
+    _In_opt_ PKEVENT               CancelEvent,
+    _In_     ULONG                 ProcessId,
+    _Out_    PLARGE_INTEGER        BytesCopied
     )
 /*++
 
@@ -222,6 +228,13 @@ Arguments:
 
     UseCustomHandler - Whether the file should be fetched by the user-mode client.
 
+    ActiveFetch      - Active fetches registry entry to report the progress to. Optional.
+
+    CancelEvent      - Event signaled, when the fetch is no longer needed. Optional.
+                       Only the user-mode fetches can be cancelled.
+
+    ProcessId        - ID of the process, which access triggered the fetch.
+
     BytesCopied      - The amount of bytes copied.
 
 Return Value:
@@ -235,13 +248,16 @@ Return Value:
     IO_STATUS_BLOCK              statusBlock      = { 0 };
     FILE_STANDARD_INFORMATION    standardInfo     = { 0 };
     FILE_END_OF_FILE_INFORMATION eofInfo          = { 0 };
+    VOLUME_TUNING                tuning           = { 0 };
+    ULONG                        sectorSize       = 0;
+    LONGLONG                     phaseStartTime   = 0;
 
     PAGED_CODE();
 
     IF_FALSE_RETURN_RESULT(FltObjects  != NULL, STATUS_INVALID_PARAMETER_1);
     IF_FALSE_RETURN_RESULT(SourceFile  != NULL, STATUS_INVALID_PARAMETER_2);
     IF_FALSE_RETURN_RESULT(TargetFile  != NULL, STATUS_INVALID_PARAMETER_3);
-    IF_FALSE_RETURN_RESULT(BytesCopied != NULL, STATUS_INVALID_PARAMETER_5);
+    IF_FALSE_RETURN_RESULT(BytesCopied != NULL, STATUS_INVALID_PARAMETER_8);
 
     FLT_ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
 
@@ -253,7 +269,7 @@ Return Value:
 
         if (UseCustomHandler)
         {
-            NT_IF_FAIL_LEAVE(LcFetchFileInUserMode(SourceFile, TargetFile, BytesCopied));
+            NT_IF_FAIL_LEAVE(LcFetchFileInUserMode(FltObjects, SourceFile, TargetFile, CancelEvent, BytesCopied));
         }
         else
         {
@@ -261,9 +277,15 @@ Return Value:
             // Open the source file and make sure it's not empty.
             //
 
-            NT_IF_FAIL_LEAVE(LcOpenFile(SourceFile, TargetFile, &sourceFileHandle));
+            phaseStartTime = LcGetStatisticsTimestamp();
+            status         = LcOpenFile(SourceFile, TargetFile, &sourceFileHandle);
+            LcRecordFetchPhase(FetchPhaseOpen, ProcessId, phaseStartTime, 0, status);
+            NT_IF_FAIL_LEAVE(status);
 
-            NT_IF_FAIL_LEAVE(ZwQueryInformationFile(sourceFileHandle, &statusBlock, &standardInfo, sizeof(FILE_STANDARD_INFORMATION), FileStandardInformation));
+            phaseStartTime = LcGetStatisticsTimestamp();
+            status         = ZwQueryInformationFile(sourceFileHandle, &statusBlock, &standardInfo, sizeof(FILE_STANDARD_INFORMATION), FileStandardInformation);
+            LcRecordFetchPhase(FetchPhaseSizeQuery, ProcessId, phaseStartTime, standardInfo.EndOfFile.QuadPart, status);
+            NT_IF_FAIL_LEAVE(status);
             if (standardInfo.EndOfFile.QuadPart == 0)
             {
                 // No need to copy an empty file.
@@ -277,13 +299,19 @@ Return Value:
             NT_IF_FAIL_LEAVE(FltSetInformationFile(FltObjects->Instance, FltObjects->FileObject, &eofInfo, sizeof(eofInfo), FileEndOfFileInformation));
 
             //
-            // Copy source file contents into the local (target) file.
+            // Copy source file contents into the local (target) file using the tuning parameters of the current volume.
             //
 
+            LcGetInstanceTuning(FltObjects->Instance, &tuning, &sectorSize);
+
             NT_IF_FAIL_LEAVE(LcFetchFileByChunks(
                 FltObjects,
                 sourceFileHandle,
                 &standardInfo.EndOfFile,
+                &tuning,
+                sectorSize,
+                ActiveFetch,
+                ProcessId,
                 BytesCopied));
         }
     }
@@ -404,10 +432,14 @@ static
 _Check_return_
 NTSTATUS
 LcFetchFileByChunks(
-    _In_  PCFLT_RELATED_OBJECTS FltObjects,
-    _In_  HANDLE                SourceFileHandle,
-    _In_  PLARGE_INTEGER        SourceFileSize,
-    _Out_ PLARGE_INTEGER        BytesCopied
+    _In_     PCFLT_RELATED_OBJECTS FltObjects,
+    _In_     HANDLE                SourceFileHandle,
+    _In_     PLARGE_INTEGER        SourceFileSize,
+    _In_     PCVOLUME_TUNING       Tuning,
+    _In_     ULONG                 SectorSize,
+    _In_opt_ PACTIVE_FETCH         ActiveFetch,
+    _In_     ULONG                 ProcessId,
+    _Out_    PLARGE_INTEGER        BytesCopied
     )
 /*++
 
@@ -494,6 +526,11 @@ Summary:
     is lesser than the 'MaxChunks') makes sure that the data is written sequentially,
     and there is no need to constantly seek in the file.
 
+    'ChunkSize' and 'MaxChunks' values are taken from the volume 'Tuning' parameters.
+    If the source file is not smaller than the 'Tuning->UnbufferedThreshold', chunks that
+    are aligned to the volume sector size are written bypassing the system cache, so
+    large fetches don't evict the hot data from it.
+
 Arguments:
 
     FltObjects       - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
@@ -504,6 +541,14 @@ Arguments:
 
     SourceFileSize   - Size of the source file.
 
+    Tuning           - Tuning parameters of the target volume.
+
+    SectorSize       - Sector size of the target volume.
+
+    ActiveFetch      - Active fetches registry entry to report the progress to. Optional.
+
+    ProcessId        - ID of the process, which access triggered the fetch.
+
     BytesCopied      - Pointer to the LARGE_INTEGER structure that receives the amount
                        of bytes copied.
 
@@ -540,12 +585,21 @@ Return Value:
     LARGE_INTEGER          sourceFileOffset      = { 0 };
     LARGE_INTEGER          destinationFileOffset = { 0 };
 
+    BOOLEAN                nonCachedWrites       = FALSE;
+    FLT_IO_OPERATION_FLAGS writeFlags            = 0;
+
+    // Start times of the pending read and write operations.
+    // Completion is only noticed, when the loop polls for it, so the latency measured includes that delay.
+    LONGLONG               readStartTime         = 0;
+    LONGLONG               writeStartTime        = 0;
+
     PAGED_CODE();
 
     FLT_ASSERT(FltObjects          != NULL);
     FLT_ASSERT(SourceFileHandle    != NULL);
     FLT_ASSERT(SourceFileSize      != NULL);
     FLT_ASSERT(SourceFileSize->QuadPart > 0);
+    FLT_ASSERT(Tuning              != NULL);
     FLT_ASSERT(BytesCopied         != NULL);
     FLT_ASSERT(KeGetCurrentIrql()  == PASSIVE_LEVEL);
 
@@ -562,7 +616,13 @@ Return Value:
 
         remainingBytes.QuadPart = SourceFileSize->QuadPart;
 
-        NT_IF_FAIL_LEAVE(LcInitializeChunksList(FltObjects->Instance, &chunksListHead, remainingBytes, &chunkListLength));
+        // Chunk buffers are allocated with the alignment required by the volume, so only the offset
+        // and length of each write should be checked.
+        nonCachedWrites = Tuning->UnbufferedThreshold != 0
+                          && SectorSize != 0
+                          && (ULONGLONG)SourceFileSize->QuadPart >= Tuning->UnbufferedThreshold;
+
+        NT_IF_FAIL_LEAVE(LcInitializeChunksList(FltObjects->Instance, Tuning, &chunksListHead, remainingBytes, &chunkListLength));
 
         for (;;)
         {
@@ -584,6 +644,13 @@ Return Value:
                 // If it's not the first read, update status of the current chunk.
                 if (readChunk != NULL)
                 {
+                    LcRecordFetchPhase(
+                        FetchPhaseRead,
+                        ProcessId,
+                        readStartTime,
+                        NT_SUCCESS(statusBlock.Status) ? (LONGLONG)statusBlock.Information : 0,
+                        statusBlock.Status);
+
                     status = statusBlock.Status;
 
                     if (NT_SUCCESS(status) || status == STATUS_END_OF_FILE)
@@ -617,11 +684,12 @@ Return Value:
                     // will have the maximum allowed size.
                     if (remainingBytes.QuadPart <= 0)
                     {
-                        remainingBytes.QuadPart = ChunkSize;
+                        remainingBytes.QuadPart = Tuning->ChunkSize;
                     }
 
                     NT_IF_FAIL_LEAVE(LcGetNextAvailableChunk(
                         FltObjects->Instance,
+                        Tuning,
                         &chunksListHead,
                         &readChunk,
                         &chunkListLength,
@@ -631,7 +699,8 @@ Return Value:
                         &waitTimeout));
 
                     // Schedule read operation for the current chunk.
-                    status = ZwReadFile(
+                    readStartTime = LcGetStatisticsTimestamp();
+                    status        = ZwReadFile(
                         SourceFileHandle,
                         NULL,
                         NULL,
@@ -653,15 +722,19 @@ Return Value:
                     // If it's not the first write, update status of the current chunk.
                     if (writeChunk != NULL)
                     {
+                        LcRecordFetchPhase(FetchPhaseWrite, ProcessId, writeStartTime, writeCallbackContext.BytesWritten, writeCallbackContext.Status);
                         NT_IF_FAIL_LEAVE(writeCallbackContext.Status);
 
                         writeChunk->BytesInBuffer       = 0;
                         totalBytesWritten.QuadPart     += writeCallbackContext.BytesWritten;
                         destinationFileOffset.QuadPart += writeCallbackContext.BytesWritten;
+
+                        LcUpdateActiveFetchProgress(ActiveFetch, totalBytesWritten.QuadPart);
                     }
 
                     NT_IF_FAIL_LEAVE(LcGetNextAvailableChunk(
                         FltObjects->Instance,
+                        Tuning,
                         &chunksListHead,
                         &writeChunk,
                         &chunkListLength,
@@ -693,13 +766,23 @@ Return Value:
 
                 KeClearEvent(&writeEvent);
 
+                // The tail of the file is usually not sector-aligned, so it goes through the cache.
+                writeFlags = FLTFL_IO_OPERATION_DO_NOT_UPDATE_BYTE_OFFSET;
+                if (nonCachedWrites
+                    && destinationFileOffset.QuadPart % SectorSize == 0
+                    && writeChunk->BytesInBuffer      % SectorSize == 0)
+                {
+                    writeFlags |= FLTFL_IO_OPERATION_NON_CACHED;
+                }
+
+                writeStartTime = LcGetStatisticsTimestamp();
                 NT_IF_FAIL_LEAVE(FltWriteFile(
                     FltObjects->Instance,
                     FltObjects->FileObject,
                     &destinationFileOffset,
                     writeChunk->BytesInBuffer,
                     writeChunk->Buffer,
-                    FLTFL_IO_OPERATION_DO_NOT_UPDATE_BYTE_OFFSET,
+                    writeFlags,
                     NULL,
                     (PFLT_COMPLETED_ASYNC_IO_CALLBACK)&LcWriteCallback,
                     &writeCallbackContext));
@@ -764,20 +847,21 @@ static
 _Check_return_
 NTSTATUS
 LcGetNextAvailableChunk(
-    _In_     PFLT_INSTANCE  Instance,
-    _In_     PLIST_ENTRY    ListHead,
-    _Inout_  PFILE_CHUNK*   CurrentChunk,
-    _Inout_  PULONG         CurrentListLength,
-    _In_     BOOLEAN        ReadOperation,
+    _In_     PFLT_INSTANCE   Instance,
+    _In_     PCVOLUME_TUNING Tuning,
+    _In_     PLIST_ENTRY     ListHead,
+    _Inout_  PFILE_CHUNK*    CurrentChunk,
+    _Inout_  PULONG          CurrentListLength,
+    _In_     BOOLEAN         ReadOperation,
     _When_(ReadOperation,  _In_)
     _When_(!ReadOperation, _In_opt_)
-             PLARGE_INTEGER RemainingBytes,
+             PLARGE_INTEGER  RemainingBytes,
     _When_(ReadOperation,  _In_)
     _When_(!ReadOperation, _In_opt_)
-             PKEVENT        WriteOperationEvent,
+             PKEVENT         WriteOperationEvent,
     _When_(ReadOperation,  _In_)
     _When_(!ReadOperation, _In_opt_)
-             PLARGE_INTEGER WaitTimeout
+             PLARGE_INTEGER  WaitTimeout
     )
 /*++
 
@@ -795,6 +879,8 @@ Arguments:
     Instance            - Opaque instance pointer for a caller-owned minifilter driver
                           instance that is attached to the volume.
 
+    Tuning              - Tuning parameters of the target volume.
+
     ListHead            - Pointer to the list head element.
 
     CurrentChunk        - Pointer to a pointer to the current chunk. May be NULL.
@@ -823,10 +909,11 @@ Return Value:
     PAGED_CODE();
 
     FLT_ASSERT(Instance           != NULL);
+    FLT_ASSERT(Tuning             != NULL);
     FLT_ASSERT(ListHead           != NULL);
     FLT_ASSERT(CurrentChunk       != NULL);
     FLT_ASSERT(CurrentListLength  != NULL);
-    FLT_ASSERT(*CurrentListLength <= MaxChunks);
+    FLT_ASSERT(*CurrentListLength <= Tuning->MaxChunks);
 
     if (ReadOperation)
     {
@@ -859,9 +946,9 @@ Return Value:
             if (chunk->BytesInBuffer != 0)
             {
                 // Check, whether we can extend the list.
-                if (*CurrentListLength < MaxChunks)
+                if (*CurrentListLength < Tuning->MaxChunks)
                 {
-                    NT_IF_FAIL_LEAVE(LcAddNewChunk(Instance, &chunk->ListEntry, RemainingBytes, &chunk, CurrentListLength));
+                    NT_IF_FAIL_LEAVE(LcAddNewChunk(Instance, Tuning, &chunk->ListEntry, RemainingBytes, &chunk, CurrentListLength));
                 }
                 else
                 {
@@ -887,10 +974,11 @@ static
 _Check_return_
 NTSTATUS
 LcInitializeChunksList(
-    _In_    PFLT_INSTANCE Instance,
-    _In_    PLIST_ENTRY   ListHead,
-    _In_    LARGE_INTEGER FileSize,
-    _Inout_ PULONG        ListLength
+    _In_    PFLT_INSTANCE   Instance,
+    _In_    PCVOLUME_TUNING Tuning,
+    _In_    PLIST_ENTRY     ListHead,
+    _In_    LARGE_INTEGER   FileSize,
+    _Inout_ PULONG          ListLength
     )
 /*++
 
@@ -899,7 +987,7 @@ Summary:
     This function initializes the 'ListHead' list given and preallocates one or more
     chunks, depending on the 'FileSize' given.
 
-    If the 'FileSize' is lesser than the global 'ChunkSize', one buffer is enough
+    If the 'FileSize' is lesser than the 'Tuning->ChunkSize', one buffer is enough
     to fit the file contents in, and no other chunks are to be allocated.
 
 Arguments:
@@ -907,6 +995,8 @@ Arguments:
     Instance   - Opaque instance pointer for a caller-owned minifilter driver
                  instance that is attached to the volume.
 
+    Tuning     - Tuning parameters of the target volume.
+
     ListHead   - Pointer to a head of the list that should be initialized.
 
     FileSize   - Size of the file to be copied.
@@ -926,6 +1016,7 @@ Return Value:
     PAGED_CODE();
 
     FLT_ASSERT(Instance   != NULL);
+    FLT_ASSERT(Tuning     != NULL);
     FLT_ASSERT(ListHead   != NULL);
     FLT_ASSERT(ListLength != NULL);
     FLT_ASSERT(FileSize.QuadPart > 0);
@@ -941,7 +1032,7 @@ Return Value:
         {
             // This will add a new chunk before the ListHead entry, which means that the
             // chunk will be added to the end of the list.
-            NT_IF_FAIL_LEAVE(LcAddNewChunk(Instance, ListHead, &FileSize, &chunk, ListLength));
+            NT_IF_FAIL_LEAVE(LcAddNewChunk(Instance, Tuning, ListHead, &FileSize, &chunk, ListLength));
 
             // Skip, if one chunk is enough to fit the current file contents in.
             FileSize.QuadPart -= chunk->BufferSize;
@@ -1020,11 +1111,12 @@ static
 _Check_return_
 NTSTATUS
 LcAddNewChunk(
-    _In_     PFLT_INSTANCE  Instance,
-    _In_     PLIST_ENTRY    Entry,
-    _In_     PLARGE_INTEGER RemainingBytes,
-    _Outptr_ PFILE_CHUNK*   AllocatedChunk,
-    _Inout_  PULONG         ListLength
+    _In_     PFLT_INSTANCE   Instance,
+    _In_     PCVOLUME_TUNING Tuning,
+    _In_     PLIST_ENTRY     Entry,
+    _In_     PLARGE_INTEGER  RemainingBytes,
+    _Outptr_ PFILE_CHUNK*    AllocatedChunk,
+    _Inout_  PULONG          ListLength
     )
 /*++
 
@@ -1033,7 +1125,7 @@ Summary:
     This function allocates memory for a new FILE_CHUNK structure and adds it
     before the 'Entry'.
 
-    If the 'RemainingBytes' is smaller than the global 'ChunkSize', the
+    If the 'RemainingBytes' is smaller than the 'Tuning->ChunkSize', the
     buffer of the 'RemaningBytes' size will be allocated for the chunk.
 
 Arguments:
@@ -1041,6 +1133,8 @@ Arguments:
     Instance       - Opaque instance pointer for a caller-owned minifilter driver
                      instance that is attached to the volume.
 
+    Tuning         - Tuning parameters of the target volume.
+
     Entry          - The newly allocated chunk will be added before this list entry.
 
     RemainingBytes - Amount of bytes remaining to be copied.
@@ -1063,6 +1157,7 @@ Return Value:
 
     PAGED_CODE();
 
+    FLT_ASSERT(Tuning         != NULL);
     FLT_ASSERT(Entry          != NULL);
     FLT_ASSERT(AllocatedChunk != NULL);
     FLT_ASSERT(ListLength     != NULL);
@@ -1074,7 +1169,7 @@ Return Value:
     __try
     {
         // We don't want to allocate more memory, than needed.
-        bufferSize = (ULONG)min(ChunkSize, (ULONG)RemainingBytes->QuadPart);
+        bufferSize = (ULONG)min(Tuning->ChunkSize, (ULONG)RemainingBytes->QuadPart);
 
         NT_IF_FAIL_LEAVE(LcAllocateNonPagedBuffer((PVOID*)&newChunk, sizeof(FILE_CHUNK)));
         NT_IF_FAIL_LEAVE(LcAllocateNonPagedAlignedBuffer(Instance, (PVOID*)&newChunk->Buffer, bufferSize));
@@ -45,6 +45,7 @@ Environment:
 //------------------------------------------------------------------------
 
 #include "Globals.h"
+#include "ActiveFetches.h"
 
 //------------------------------------------------------------------------
 //  Fetch function prototypes.
@@ -54,11 +55,14 @@ _Check_return_
 _IRQL_requires_(PASSIVE_LEVEL)
 NTSTATUS
 LcFetchRemoteFile(
-    _In_  PCFLT_RELATED_OBJECTS FltObjects,
-    _In_  PUNICODE_STRING       SourceFile,
-    _In_  PUNICODE_STRING       TargetFile,
-    _In_  BOOLEAN               UseCustomHandler,
-    _Out_ PLARGE_INTEGER        BytesCopied
+    _In_     PCFLT_RELATED_OBJECTS FltObjects,
+    _In_     PUNICODE_STRING       SourceFile,
+    _In_     PUNICODE_STRING       TargetFile,
+    _In_     BOOLEAN               UseCustomHandler,
+    _In_opt_ PACTIVE_FETCH         ActiveFetch,
+    _In_opt_ PKEVENT               CancelEvent,
+    _In_     ULONG                 ProcessId,
+    _Out_    PLARGE_INTEGER        BytesCopied
     );
 
 #endif // __LAZY_COPY_FETCH_H__
@@ -75,6 +75,7 @@ typedef struct _FILE_LOCK_ENTRY
     #pragma alloc_text(PAGE, LcFreeFileLocks)
     #pragma alloc_text(PAGE, LcGetFileLock)
     #pragma alloc_text(PAGE, LcReleaseFileLock)
+    #pragma alloc_text(PAGE, LcGetFileLockWaiterCount)
 #endif // ALLOC_PRAGMA
 
 //------------------------------------------------------------------------
@@ -334,3 +335,43 @@ Return value:
         FltReleaseResource(FileLocksResource);
     }
 }
+
+//------------------------------------------------------------------------
+
+_Check_return_
+ULONG
+LcGetFileLockWaiterCount(
+    _In_ PKEVENT Event
+    )
+/*++
+
+Summary:
+
+    This function returns the amount of threads waiting for the file lock given
+    to be released.
+
+    Every thread that got the lock holds a reference to it, so all references
+    but the owner's one belong to the waiters.
+
+    The lock owner should not release it while this function runs, so the entry is not freed.
+
+Arguments:
+
+    Event - Event returned by the 'LcGetFileLock'.
+
+Return value:
+
+    Amount of threads waiting for the lock.
+
+--*/
+{
+    LONG refCount = 0;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(Event != NULL);
+
+    refCount = CONTAINING_RECORD(Event, FILE_LOCK_ENTRY, Event)->RefCount;
+
+    return refCount > 1 ? (ULONG)(refCount - 1) : 0;
+}
@@ -71,4 +71,10 @@ LcReleaseFileLock(
     _In_ PKEVENT Event
     );
 
+_Check_return_
+ULONG
+LcGetFileLockWaiterCount(
+    _In_ PKEVENT Event
+    );
+
 #endif // __LAZY_COPY_FILE_LOCKS_H__
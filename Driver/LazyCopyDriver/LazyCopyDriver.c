@@ -41,9 +41,18 @@ Environment:
 //------------------------------------------------------------------------
 
 #include "LazyCopyDriver.h"
+#include "AccessTable.h"
+#include "ActiveFetches.h"
+#include "Statistics.h"
+#include "ClientConnections.h"
 #include "Configuration.h"
 #include "Communication.h"
+#include "Context.h"
+#include "DirectoryCache.h"
 #include "FileLocks.h"
+#include "NotificationRing.h"
+#include "PendedFetches.h"
+#include "PlaceholderCache.h"
 #include "Utilities.h"
 
 // DriverEvents.h was generated by the 'mc.exe -z LazyCopyEtw -n -km LazyCopyEtw.mc' command.
@@ -87,6 +96,10 @@ LcFreeDriverObjects();
     #pragma alloc_text(INIT, DriverEntry)
     #pragma alloc_text(PAGE, DriverInstanceSetup)
     #pragma alloc_text(PAGE, DriverInstanceQueryTeardown)
+    #pragma alloc_text(PAGE, DriverInstanceTeardownStart)
+
+    // Volume policy functions.
+    #pragma alloc_text(PAGE, LcApplyVolumePolicy)
 
     // Local functions.
     #pragma alloc_text(PAGE, LcInitializeGlobals)
@@ -143,6 +156,14 @@ Return value:
         NT_IF_FAIL_LEAVE(LcInitializeGlobals(DriverObject));
         NT_IF_FAIL_LEAVE(LcInitializeConfiguration(RegistryPath));
         NT_IF_FAIL_LEAVE(LcInitializeFileLocks());
+        NT_IF_FAIL_LEAVE(LcInitializePlaceholderCache());
+        NT_IF_FAIL_LEAVE(LcInitializeDirectoryCache());
+        NT_IF_FAIL_LEAVE(LcInitializeAccessTable());
+        NT_IF_FAIL_LEAVE(LcInitializeStatistics());
+        NT_IF_FAIL_LEAVE(LcInitializeActiveFetches());
+        NT_IF_FAIL_LEAVE(LcInitializeNotificationRing());
+        NT_IF_FAIL_LEAVE(LcInitializeClientConnections());
+        NT_IF_FAIL_LEAVE(LcInitializePendedFetches());
 
         // Register with the Filter Manager to tell it our callback functions.
         NT_IF_FAIL_LEAVE(FltRegisterFilter(DriverObject, &FilterRegistration, &Globals.Filter));
@@ -188,7 +209,12 @@ Summary:
     If this function is not defined in the registration structure, automatic
     instances are always created.
 
-    In the current implementation we allow attachment to NTFS volumes only.
+    In the current implementation we allow attachment to NTFS and ReFS volumes
+    matching the volume policy (see the 'LcGetVolumePolicy'). If there is no volume
+    policy configured, the driver is attached to all NTFS volumes.
+
+    A new instance context containing the volume tuning parameters is attached to
+    every instance created.
 
 Arguments:
 
@@ -208,23 +234,43 @@ Return value:
 
 --*/
 {
-    PAGED_CODE();
+    NTSTATUS             status  = STATUS_SUCCESS;
+    PLC_INSTANCE_CONTEXT context = NULL;
+    BOOLEAN              enabled = FALSE;
 
-    UNREFERENCED_PARAMETER(Flags);
-    UNREFERENCED_PARAMETER(FltObjects);
+    PAGED_CODE();
 
     FLT_ASSERT(FltObjects != NULL);
     FLT_ASSERT(Globals.Filter == FltObjects->Filter);
 
-    // Allow attachments only on NTFS volumes.
-    if (VolumeDeviceType == FILE_DEVICE_DISK_FILE_SYSTEM && VolumeFilesystemType == FLT_FSTYPE_NTFS)
+    // Allow attachments only on NTFS and ReFS volumes.
+    if (VolumeDeviceType != FILE_DEVICE_DISK_FILE_SYSTEM
+        || (VolumeFilesystemType != FLT_FSTYPE_NTFS && VolumeFilesystemType != FLT_FSTYPE_REFS))
     {
-        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Attached to Volume = %p, Instance = %p\n", FltObjects->Volume, FltObjects->Instance));
-        return STATUS_SUCCESS;
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_WARNING_LEVEL, "[LazyCopy] Volume is not eligible for attachment: %p\n", FltObjects->Volume));
+        return STATUS_FLT_DO_NOT_ATTACH;
     }
 
-    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_WARNING_LEVEL, "[LazyCopy] Volume is not eligible for attachment: %p\n", FltObjects->Volume));
-    return STATUS_FLT_DO_NOT_ATTACH;
+    // Per-volume data is kept in the instance context.
+    // The mount manager might deadlock, if the volume GUID is queried for the volume being mounted.
+    status = LcCreateInstanceContext(FltObjects, VolumeFilesystemType, !FlagOn(Flags, FLTFL_INSTANCE_SETUP_NEWLY_MOUNTED_VOLUME), &context);
+    if (!NT_SUCCESS(status))
+    {
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "[LazyCopy] Unable to create instance context for Volume = %p: %08X\n", FltObjects->Volume, status));
+        return STATUS_FLT_DO_NOT_ATTACH;
+    }
+
+    enabled = context->Enabled;
+    FltReleaseContext(context);
+
+    if (!enabled)
+    {
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Volume does not match the volume policy: %p\n", FltObjects->Volume));
+        return STATUS_FLT_DO_NOT_ATTACH;
+    }
+
+    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Attached to Volume = %p, Instance = %p\n", FltObjects->Volume, FltObjects->Instance));
+    return STATUS_SUCCESS;
 }
 
 //------------------------------------------------------------------------
@@ -268,6 +314,53 @@ Return value:
 
 //------------------------------------------------------------------------
 
+VOID
+DriverInstanceTeardownStart(
+    _In_ PCFLT_RELATED_OBJECTS       FltObjects,
+    _In_ FLT_INSTANCE_TEARDOWN_FLAGS Flags
+    )
+/*++
+
+Summary:
+
+    This function is called at the start of the instance teardown.
+
+    The instance cannot be torn down, while there are operations pended on it,
+    so all operations waiting for the user-mode fetches are cancelled here.
+
+Arguments:
+
+    FltObjects - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                 opaque handles to this filter, instance and its associated volume.
+
+    Flags      - Reason why this instance is being torn down.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PLC_INSTANCE_CONTEXT context = NULL;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER(Flags);
+
+    FLT_ASSERT(FltObjects != NULL);
+
+    if (!NT_SUCCESS(FltGetInstanceContext(FltObjects->Instance, (PFLT_CONTEXT*)&context)))
+    {
+        return;
+    }
+
+    LcCancelPendedFetches(&context->PendedFetches);
+
+    FltReleaseContext(context);
+}
+
+//------------------------------------------------------------------------
+
 NTSTATUS
 DriverUnload(
     _In_ FLT_FILTER_UNLOAD_FLAGS Flags
@@ -307,6 +400,106 @@ Return value:
     return STATUS_SUCCESS;
 }
 
+//------------------------------------------------------------------------
+//  Volume policy functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcApplyVolumePolicy()
+/*++
+
+Summary:
+
+    This function applies the current volume policy to all volumes in the system.
+
+    Instances on the volumes that no longer match the policy are detached, so none of
+    the operation callbacks are invoked for these volumes, and the tuning parameters
+    are updated for the rest of them. The instance is disabled before it's detached,
+    so the creates issued in between are not processed.
+    The current driver tries to attach to the volumes it's not attached to, and the
+    'DriverInstanceSetup' decides, whether the volume matches the policy.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS             status          = STATUS_SUCCESS;
+    PFLT_VOLUME*         volumes         = NULL;
+    ULONG                volumeCount     = 0;
+    ULONG                idx             = 0;
+    PFLT_INSTANCE        instance        = NULL;
+    PLC_INSTANCE_CONTEXT instanceContext = NULL;
+    BOOLEAN              enabled         = FALSE;
+    NTSTATUS             detachStatus    = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    __try
+    {
+        // Get the amount of volumes first.
+        status = FltEnumerateVolumes(Globals.Filter, NULL, 0, &volumeCount);
+        NT_IF_FALSE_LEAVE(status == STATUS_BUFFER_TOO_SMALL, status);
+        status = STATUS_SUCCESS;
+
+        NT_IF_FAIL_LEAVE(LcAllocateNonPagedBuffer((PVOID*)&volumes, volumeCount * sizeof(PFLT_VOLUME)));
+        NT_IF_FAIL_LEAVE(FltEnumerateVolumes(Globals.Filter, volumes, volumeCount, &volumeCount));
+
+        for (idx = 0; idx < volumeCount; idx++)
+        {
+            if (NT_SUCCESS(FltGetVolumeInstanceFromName(Globals.Filter, volumes[idx], NULL, &instance)))
+            {
+                enabled = TRUE;
+                if (NT_SUCCESS(FltGetInstanceContext(instance, (PFLT_CONTEXT*)&instanceContext)))
+                {
+                    enabled = LcApplyVolumePolicyToInstance(instanceContext);
+
+                    FltReleaseContext(instanceContext);
+                    instanceContext = NULL;
+                }
+
+                // Instance teardown waits for all references to be released, so it's dereferenced before the detach.
+                FltObjectDereference(instance);
+                instance = NULL;
+
+                if (!enabled)
+                {
+                    detachStatus = FltDetachVolume(Globals.Filter, volumes[idx], NULL);
+                    if (!NT_SUCCESS(detachStatus))
+                    {
+                        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_WARNING_LEVEL, "[LazyCopy] Unable to detach from Volume = %p: %08X\n", volumes[idx], detachStatus));
+                    }
+                }
+            }
+            else
+            {
+                // 'DriverInstanceSetup' will refuse the attachment, if the volume is not eligible.
+                FltAttachVolume(Globals.Filter, volumes[idx], NULL, NULL);
+            }
+        }
+    }
+    __finally
+    {
+        if (volumes != NULL)
+        {
+            for (idx = 0; idx < volumeCount; idx++)
+            {
+                FltObjectDereference(volumes[idx]);
+            }
+
+            LcFreeNonPagedBuffer(volumes);
+        }
+    }
+
+    return status;
+}
+
 //------------------------------------------------------------------------
 //  Local functions.
 //------------------------------------------------------------------------
@@ -378,8 +571,18 @@ ReturnvValue:
         Globals.Filter = NULL;
     }
 
+    // Worker threads are stopped after all instances are torn down.
+    LcFreePendedFetches();
+
     LcFreeConfiguration();
     LcFreeFileLocks();
+    LcFreePlaceholderCache();
+    LcFreeDirectoryCache();
+    LcFreeAccessTable();
+    LcFreeStatistics();
+    LcFreeActiveFetches();
+    LcFreeClientConnections();
+    LcFreeNotificationRing();
 
     if (Globals.Lock != NULL)
     {
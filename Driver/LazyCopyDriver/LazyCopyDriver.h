@@ -46,6 +46,7 @@ Environment:
 //------------------------------------------------------------------------
 
 #include "Globals.h"
+#include "Context.h"
 
 //------------------------------------------------------------------------
 //  Registration structure.
@@ -83,11 +84,25 @@ DriverInstanceQueryTeardown(
     _In_ FLT_INSTANCE_QUERY_TEARDOWN_FLAGS Flags
     );
 
+VOID
+DriverInstanceTeardownStart(
+    _In_ PCFLT_RELATED_OBJECTS       FltObjects,
+    _In_ FLT_INSTANCE_TEARDOWN_FLAGS Flags
+    );
+
 NTSTATUS
 DriverUnload(
     _In_ FLT_FILTER_UNLOAD_FLAGS Flags
     );
 
+//
+//  Volume policy functions.
+//
+
+_Check_return_
+NTSTATUS
+LcApplyVolumePolicy();
+
 //
 //  Functions that track operations on the volume.
 //
@@ -114,6 +129,16 @@ PreReadWriteOperationCallback(
     _Flt_CompletionContext_Outptr_ PVOID*                CompletionContext
     );
 
+_Check_return_
+NTSTATUS
+LcFetchFileForOperation(
+    _In_     PCFLT_RELATED_OBJECTS      FltObjects,
+    _In_     PFLT_FILE_NAME_INFORMATION NameInfo,
+    _In_     PLC_STREAM_CONTEXT         StreamContext,
+    _In_     ULONG                      ProcessId,
+    _In_opt_ PKEVENT                    CancelEvent
+    );
+
 FLT_PREOP_CALLBACK_STATUS
 PreQueryInformationOperationCallback(
     _Inout_                        PFLT_CALLBACK_DATA    Data,
@@ -130,6 +155,13 @@ PostQueryInformationOperationCallback(
     );
 
 FLT_PREOP_CALLBACK_STATUS
+PreDirectoryControlOperationCallback(
+    _Inout_                        PFLT_CALLBACK_DATA    Data,
+    _In_                           PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID*                CompletionContext
+    );
+
+FLT_POSTOP_CALLBACK_STATUS
 PostDirectoryControlOperationCallback(
     _Inout_  PFLT_CALLBACK_DATA       Data,
     _In_     PCFLT_RELATED_OBJECTS    FltObjects,
@@ -137,4 +169,34 @@ PostDirectoryControlOperationCallback(
     _In_     FLT_POST_OPERATION_FLAGS Flags
     );
 
+FLT_PREOP_CALLBACK_STATUS
+PreFileSystemControlOperationCallback(
+    _Inout_                        PFLT_CALLBACK_DATA    Data,
+    _In_                           PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID*                CompletionContext
+    );
+
+FLT_POSTOP_CALLBACK_STATUS
+PostFileSystemControlOperationCallback(
+    _Inout_  PFLT_CALLBACK_DATA       Data,
+    _In_     PCFLT_RELATED_OBJECTS    FltObjects,
+    _In_opt_ PVOID                    CompletionContext,
+    _In_     FLT_POST_OPERATION_FLAGS Flags
+    );
+
+FLT_PREOP_CALLBACK_STATUS
+PreSetInformationOperationCallback(
+    _Inout_                        PFLT_CALLBACK_DATA    Data,
+    _In_                           PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID*                CompletionContext
+    );
+
+FLT_POSTOP_CALLBACK_STATUS
+PostSetInformationOperationCallback(
+    _Inout_  PFLT_CALLBACK_DATA       Data,
+    _In_     PCFLT_RELATED_OBJECTS    FltObjects,
+    _In_opt_ PVOID                    CompletionContext,
+    _In_     FLT_POST_OPERATION_FLAGS Flags
+    );
+
 #endif // __LAZY_COPY_DRIVER_H__
@@ -235,7 +235,7 @@ Remarks:
 #endif
 #endif // MCGEN_DISABLE_PROVIDER_CODE_GENERATION
 //+
-// Provider LazyCopyDriver Event Count 11
+// Provider LazyCopyDriver Event Count 12
 //+
 EXTERN_C __declspec(selectany) const GUID LazyCopyDriverGuid = {0x0fe08ee4, 0xb08f, 0x4d27, {0x8c, 0xbb, 0xc8, 0x16, 0x30, 0x8a, 0xe2, 0x35}};
 
@@ -286,6 +286,8 @@ EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR File_Open_Start = {0x6a, 0
 #define File_Open_Start_value 0x6a
 EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR File_Open_Stop = {0x6b, 0x1, 0x0, 0x4, 0x2, 0x4, 0x2};
 #define File_Open_Stop_value 0x6b
+EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR File_Fetch_Phase = {0x6c, 0x1, 0x0, 0x4, 0x0, 0x1, 0x2};
+#define File_Fetch_Phase_value 0x6c
 
 //
 // Note on Generate Code from Manifest Windows Vista and above
@@ -568,6 +570,20 @@ Remarks:
         TemplateEventDescriptor(LazyCopyDriverHandle, &File_Open_Stop, Activity)\
         : STATUS_SUCCESS\
 
+//
+// Enablement check macro for File_Fetch_Phase
+//
+
+#define EventEnabledFile_Fetch_Phase() ((LazyCopyDriverEnableBits[0] & 0x00000004) != 0)
+
+//
+// Event Macro for File_Fetch_Phase
+//
+#define EventWriteFile_Fetch_Phase(Activity, Phase, ProcessId, Bytes, Duration, Status)\
+        EventEnabledFile_Fetch_Phase() ?\
+        Template_qqiid(LazyCopyDriverHandle, &File_Fetch_Phase, Activity, Phase, ProcessId, Bytes, Duration, Status)\
+        : STATUS_SUCCESS\
+
 #endif // MCGEN_DISABLE_PROVIDER_CODE_GENERATION
 
 
@@ -687,6 +703,42 @@ Template_z(
 }
 #endif
 
+//
+//Template from manifest : FetchPhaseTemplate
+//
+#ifndef Template_qqiid_def
+#define Template_qqiid_def
+ETW_INLINE
+ULONG
+Template_qqiid(
+    _In_ REGHANDLE RegHandle,
+    _In_ PCEVENT_DESCRIPTOR Descriptor,
+    _In_opt_ LPCGUID Activity,
+    _In_ const unsigned int  _Arg0,
+    _In_ const unsigned int  _Arg1,
+    _In_ signed __int64  _Arg2,
+    _In_ signed __int64  _Arg3,
+    _In_ const signed int  _Arg4
+    )
+{
+#define ARGUMENT_COUNT_qqiid 5
+
+    EVENT_DATA_DESCRIPTOR EventData[ARGUMENT_COUNT_qqiid];
+
+    EventDataDescCreate(&EventData[0], &_Arg0, sizeof(const unsigned int)  );
+
+    EventDataDescCreate(&EventData[1], &_Arg1, sizeof(const unsigned int)  );
+
+    EventDataDescCreate(&EventData[2], &_Arg2, sizeof(signed __int64)  );
+
+    EventDataDescCreate(&EventData[3], &_Arg3, sizeof(signed __int64)  );
+
+    EventDataDescCreate(&EventData[4], &_Arg4, sizeof(const signed int)  );
+
+    return EtwWrite(RegHandle, Descriptor, Activity, ARGUMENT_COUNT_qqiid, EventData);
+}
+#endif
+
 #endif // MCGEN_DISABLE_PROVIDER_CODE_GENERATION
 
 #if defined(__cplusplus)
@@ -694,6 +746,7 @@ Template_z(
 #endif
 
 #define MSG_LazyCopyDriver_event_3_message   0x00000003L
+#define MSG_opcode_Info                      0x30000000L
 #define MSG_opcode_Start                     0x30000001L
 #define MSG_opcode_Stop                      0x30000002L
 #define MSG_level_Error                      0x50000002L
@@ -0,0 +1,331 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    NegativeCache.c
+
+Abstract:
+
+    Contains the per-volume cache of the files known not to be LazyCopy files.
+    It allows the pre-create callback to skip the file name query and all other
+    processing for the files, which were already opened as the ordinary ones.
+
+    Files are identified by the name they are opened with, because the file ID
+    is only known after the create operation is completed. Only the absolute opens
+    are cached, and the name is hashed case-sensitively, so different names of the
+    same file are separate entries.
+
+    Entries are only valid for the instance placeholder generation they were added
+    with. The generation is incremented every time a LazyCopy reparse point is set,
+    or a LazyCopy file or a directory is renamed, so a name that might now belong to
+    a LazyCopy file is never found in the cache.
+
+    The cache does not use any locks. Every entry is read and updated with a single
+    interlocked operation, and the table is never freed while the instance exists.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "NegativeCache.h"
+#include "Context.h"
+#include "Statistics.h"
+
+//------------------------------------------------------------------------
+//  Defines.
+//------------------------------------------------------------------------
+
+// Value of the empty entry. Generation is never zero, so valid entries are never equal to it.
+#define NEGATIVE_CACHE_EMPTY 0
+
+// Makes the entry from the key hash and the generation.
+#define NEGATIVE_CACHE_ENTRY(Hash, Generation) ((LONG64)(((Hash) & 0xFFFFFFFF00000000ULL) | (ULONG)(Generation)))
+
+//------------------------------------------------------------------------
+//  Local function prototypes.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+ULONG64
+LcGetNegativeCacheHash(
+    _In_ PFLT_CALLBACK_DATA    Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    );
+
+//------------------------------------------------------------------------
+//  Text sections.
+//------------------------------------------------------------------------
+
+#ifdef ALLOC_PRAGMA
+    #pragma alloc_text(PAGE, LcIsKnownNonPlaceholder)
+    #pragma alloc_text(PAGE, LcAddNonPlaceholder)
+
+    // Local functions.
+    #pragma alloc_text(PAGE, LcGetNegativeCacheHash)
+#endif // ALLOC_PRAGMA
+
+//------------------------------------------------------------------------
+//  Negative cache functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+BOOLEAN
+LcIsKnownNonPlaceholder(
+    _In_  PFLT_CALLBACK_DATA    Data,
+    _In_  PCFLT_RELATED_OBJECTS FltObjects,
+    _Out_ PNEGATIVE_CACHE_KEY   Key
+    )
+/*++
+
+Summary:
+
+    This function checks whether the file being opened by the create operation given
+    is known not to be a LazyCopy file, and updates the negative cache counters.
+
+    If the file is not found, the 'Key' receives the values, which should be passed to the
+    'LcAddNonPlaceholder', once the file is opened and it's not a LazyCopy file.
+
+Arguments:
+
+    Data       - Create operation callback data.
+
+    FltObjects - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                 opaque handles to this filter, instance, its associated volume and
+                 file object.
+
+    Key        - Receives the file key. Its 'Hash' is zero, if the operation cannot be cached.
+
+Return value:
+
+    TRUE, if the file was opened as an ordinary file since the last placeholder generation change.
+
+--*/
+{
+    PLC_INSTANCE_CONTEXT context = NULL;
+    __volatile LONG64*   bucket  = NULL;
+    LONG64               entry   = NEGATIVE_CACHE_EMPTY;
+    ULONG                idx     = 0;
+    BOOLEAN              found   = FALSE;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(Data       != NULL);
+    FLT_ASSERT(FltObjects != NULL);
+    FLT_ASSERT(Key        != NULL);
+
+    Key->Hash       = 0;
+    Key->Generation = 0;
+
+    IF_FALSE_RETURN_RESULT(NT_SUCCESS(FltGetInstanceContext(FltObjects->Instance, (PFLT_CONTEXT*)&context)), FALSE);
+
+    __try
+    {
+        Key->Hash = LcGetNegativeCacheHash(Data, FltObjects);
+        if (Key->Hash == 0)
+        {
+            __leave;
+        }
+
+        // Generation is read before the file is opened, so if it changes while the create
+        // operation is in progress, the entry added for it is stale right away.
+        Key->Generation = context->PlaceholderGeneration;
+
+        entry  = NEGATIVE_CACHE_ENTRY(Key->Hash, Key->Generation);
+        bucket = context->NegativeCache.Entries[(ULONG)Key->Hash & (NEGATIVE_CACHE_BUCKETS - 1)];
+
+        for (idx = 0; idx < NEGATIVE_CACHE_WAYS; idx++)
+        {
+            if (ReadNoFence64(&bucket[idx]) == entry)
+            {
+                found = TRUE;
+                break;
+            }
+        }
+
+        LcRecordNegativeCacheLookup(found);
+    }
+    __finally
+    {
+        FltReleaseContext(context);
+    }
+
+    return found;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcAddNonPlaceholder(
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PNEGATIVE_CACHE_KEY   Key
+    )
+/*++
+
+Summary:
+
+    This function adds the file opened to the negative cache of the instance given.
+
+    It should only be called, if the file was opened without the FILE_OPEN_REPARSE_POINT
+    flag, and the file system did not return the STATUS_REPARSE, so the file doesn't have
+    any reparse point.
+
+    Stale entries of the bucket are replaced first. If there are none, the entry to replace
+    is selected by the hash bits that are not used to select the bucket.
+
+Arguments:
+
+    FltObjects - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                 opaque handles to this filter, instance, its associated volume and
+                 file object.
+
+    Key        - File key captured by the 'LcIsKnownNonPlaceholder'.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PLC_INSTANCE_CONTEXT context = NULL;
+    __volatile LONG64*   bucket  = NULL;
+    LONG64               entry   = NEGATIVE_CACHE_EMPTY;
+    LONG64               current = NEGATIVE_CACHE_EMPTY;
+    ULONG                idx     = 0;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(FltObjects != NULL);
+    FLT_ASSERT(Key        != NULL);
+
+    IF_FALSE_RETURN(Key->Hash != 0);
+    IF_FALSE_RETURN(NT_SUCCESS(FltGetInstanceContext(FltObjects->Instance, (PFLT_CONTEXT*)&context)));
+
+    // The generation has changed while the file was being opened, so the entry would be stale.
+    if (Key->Generation != context->PlaceholderGeneration)
+    {
+        FltReleaseContext(context);
+        return;
+    }
+
+    entry  = NEGATIVE_CACHE_ENTRY(Key->Hash, Key->Generation);
+    bucket = context->NegativeCache.Entries[(ULONG)Key->Hash & (NEGATIVE_CACHE_BUCKETS - 1)];
+
+    for (idx = 0; idx < NEGATIVE_CACHE_WAYS; idx++)
+    {
+        current = ReadNoFence64(&bucket[idx]);
+        if (current == entry)
+        {
+            break;
+        }
+
+        // Take the empty or stale entry. Another thread might take it first, so it's replaced atomically.
+        if ((current == NEGATIVE_CACHE_EMPTY || (LONG)(ULONG)current != context->PlaceholderGeneration)
+            && InterlockedCompareExchange64(&bucket[idx], entry, current) == current)
+        {
+            break;
+        }
+    }
+
+    // Bucket is full of valid entries, so replace one of them.
+    if (idx == NEGATIVE_CACHE_WAYS)
+    {
+        InterlockedExchange64(&bucket[(ULONG)(Key->Hash >> 32) & (NEGATIVE_CACHE_WAYS - 1)], entry);
+    }
+
+    FltReleaseContext(context);
+}
+
+//------------------------------------------------------------------------
+//  Local functions.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+ULONG64
+LcGetNegativeCacheHash(
+    _In_ PFLT_CALLBACK_DATA    Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    )
+/*++
+
+Summary:
+
+    This function calculates the negative cache hash of the file being opened.
+
+    Relative opens are not cached, because the same name might refer to different files.
+    The opens of the rename target directory and the opens of the reparse point itself are
+    not cached either, because they don't tell, whether the file has a reparse point.
+
+Arguments:
+
+    Data       - Create operation callback data.
+
+    FltObjects - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                 opaque handles to this filter, instance, its associated volume and
+                 file object.
+
+Return value:
+
+    Case-sensitive hash of the file name opened, or zero, if the operation cannot be cached.
+
+--*/
+{
+    PFILE_OBJECT fileObject = FltObjects->FileObject;
+    ULONG64      hash       = 0xCBF29CE484222325ULL;
+    USHORT       length     = 0;
+    USHORT       idx        = 0;
+
+    PAGED_CODE();
+
+    if (fileObject == NULL
+        || fileObject->RelatedFileObject != NULL
+        || fileObject->FileName.Length == 0
+        || FlagOn(Data->Iopb->OperationFlags,           SL_OPEN_TARGET_DIRECTORY)
+        || FlagOn(Data->Iopb->Parameters.Create.Options, FILE_OPEN_REPARSE_POINT))
+    {
+        return 0;
+    }
+
+    length = fileObject->FileName.Length / sizeof(WCHAR);
+
+    // FNV-1a is used to combine the characters.
+    for (idx = 0; idx < length; idx++)
+    {
+        hash ^= fileObject->FileName.Buffer[idx];
+        hash *= 0x100000001B3ULL;
+    }
+
+    // Mix the higher bits into the lower ones, because the lower bits select the bucket.
+    hash ^= hash >> 32;
+
+    return hash == 0 ? 1 : hash;
+}
@@ -0,0 +1,108 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    NegativeCache.h
+
+Abstract:
+
+    Contains type definitions and function prototypes for the per-volume cache
+    of the files known not to be LazyCopy files.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+#ifndef __LAZY_COPY_NEGATIVE_CACHE_H__
+#define __LAZY_COPY_NEGATIVE_CACHE_H__
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "Globals.h"
+
+//------------------------------------------------------------------------
+//  Defines.
+//------------------------------------------------------------------------
+
+// Amount of hash buckets. Should be a power of two.
+#define NEGATIVE_CACHE_BUCKETS 256
+
+// Amount of entries stored in a single bucket. Should be a power of two.
+#define NEGATIVE_CACHE_WAYS    8
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+//
+// Set-associative table of the files known not to be LazyCopy files.
+// Embedded into the instance context, so every volume has its own table.
+//
+// Every entry contains the higher half of the file key hash and the instance placeholder
+// generation the file was seen with, so a single interlocked operation reads or updates it.
+// Entries with another generation are stale.
+//
+typedef struct _NEGATIVE_CACHE
+{
+    __volatile LONG64 Entries[NEGATIVE_CACHE_BUCKETS][NEGATIVE_CACHE_WAYS];
+} NEGATIVE_CACHE, *PNEGATIVE_CACHE;
+
+//
+// File key captured by the pre-create callback.
+// Should be passed to the 'LcAddNonPlaceholder', once the file is known not to be a LazyCopy file.
+//
+typedef struct _NEGATIVE_CACHE_KEY
+{
+    // Hash of the file name opened. Zero, if the create operation cannot be cached.
+    ULONG64 Hash;
+
+    // Instance placeholder generation at the moment the key was captured.
+    LONG    Generation;
+} NEGATIVE_CACHE_KEY, *PNEGATIVE_CACHE_KEY;
+
+//------------------------------------------------------------------------
+//  Negative cache function prototypes.
+//------------------------------------------------------------------------
+
+_Check_return_
+BOOLEAN
+LcIsKnownNonPlaceholder(
+    _In_  PFLT_CALLBACK_DATA    Data,
+    _In_  PCFLT_RELATED_OBJECTS FltObjects,
+    _Out_ PNEGATIVE_CACHE_KEY   Key
+    );
+
+VOID
+LcAddNonPlaceholder(
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PNEGATIVE_CACHE_KEY   Key
+    );
+
+#endif // __LAZY_COPY_NEGATIVE_CACHE_H__
@@ -0,0 +1,806 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    NotificationRing.c
+
+Abstract:
+
+    Contains the notification ring shared between the driver and the user-mode client.
+
+    The ring is a non-paged buffer mapped into the client process. It consists of fixed-size
+    slots, each holding a single notification and, later, the client reply to it.
+    The driver signals the client event only if the client is waiting for it, and the client
+    signals the driver with a single 'CompleteRingNotifications' command after it has
+    processed all notifications available, so both sides can handle them in batches.
+
+    Notifications that don't fit into a slot, or can't be posted because the ring is full
+    or not mapped, are still sent via the communication port.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "NotificationRing.h"
+#include "Utilities.h"
+
+//------------------------------------------------------------------------
+//  Defines.
+//------------------------------------------------------------------------
+
+// Size of the ring mapping. The whole pages are mapped into the client process,
+// so the buffer is rounded up to avoid exposing the adjacent pool memory.
+#define NOTIFICATION_RING_SIZE  ((ULONG)ROUND_TO_PAGES(sizeof(NOTIFICATION_RING)))
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+//
+// Driver-side state of the mapped notification ring. It's never shared with the client.
+//
+typedef struct _NOTIFICATION_RING_STATE
+{
+    // Ring shared with the client. Allocations larger than a page are page-aligned.
+    PNOTIFICATION_RING Ring;
+
+    // MDL describing the 'Ring' buffer.
+    PMDL               Mdl;
+
+    // Client process and the address the ring is mapped at in it.
+    PEPROCESS          Process;
+    PVOID              UserAddress;
+
+    // Client event signaled, when new notifications are posted.
+    PKEVENT            RequestEvent;
+
+    // Set, when the ring is being unmapped, so the threads waiting for the replies give up.
+    __volatile BOOLEAN Closing;
+
+    // Index of the slot the next sender starts looking for a free slot from.
+    __volatile LONG    NextSlot;
+
+    // Events the senders wait on for the replies, one per slot.
+    KEVENT             ReplyEvents[NOTIFICATION_RING_SLOT_COUNT];
+
+    // Set for the slots owned by the client, which senders stopped waiting for the reply.
+    // Such slots are freed, when the client replies to them.
+    __volatile LONG    AbandonedSlots[NOTIFICATION_RING_SLOT_COUNT];
+} NOTIFICATION_RING_STATE, *PNOTIFICATION_RING_STATE;
+
+//------------------------------------------------------------------------
+//  Local functions.
+//------------------------------------------------------------------------
+
+static
+VOID
+LcFreeNotificationRingState(
+    _In_ PNOTIFICATION_RING_STATE State
+    );
+
+static
+BOOLEAN
+LcAbandonRingSlot(
+    _In_ PNOTIFICATION_RING_STATE State,
+    _In_ ULONG                    Index
+    );
+
+//------------------------------------------------------------------------
+//  Text sections.
+//------------------------------------------------------------------------
+
+#ifdef ALLOC_PRAGMA
+    #pragma alloc_text(PAGE, LcInitializeNotificationRing)
+    #pragma alloc_text(PAGE, LcFreeNotificationRing)
+    #pragma alloc_text(PAGE, LcMapNotificationRing)
+    #pragma alloc_text(PAGE, LcUnmapNotificationRing)
+    #pragma alloc_text(PAGE, LcCompleteRingNotifications)
+    #pragma alloc_text(PAGE, LcSendRingNotification)
+    #pragma alloc_text(PAGE, LcFreeNotificationRingState)
+    #pragma alloc_text(PAGE, LcAbandonRingSlot)
+#endif // ALLOC_PRAGMA
+
+//------------------------------------------------------------------------
+//  Global variables.
+//------------------------------------------------------------------------
+
+// Serializes the ring mapping and unmapping.
+static PERESOURCE                          RingResource = NULL;
+
+// Protects the 'RingState' from being freed while it's used by the senders.
+static EX_RUNDOWN_REF                      RingRundown  = { 0 };
+
+// Currently mapped ring, or NULL, if the client hasn't mapped it.
+static __volatile PNOTIFICATION_RING_STATE RingState    = NULL;
+
+//------------------------------------------------------------------------
+//  Notification ring functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializeNotificationRing()
+/*++
+
+Summary:
+
+    This function initializes objects used by the current module.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    ExInitializeRundownProtection(&RingRundown);
+    RingState = NULL;
+
+    NT_IF_FAIL_RETURN(LcAllocateResource(&RingResource));
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcFreeNotificationRing()
+/*++
+
+Summary:
+
+    This function releases objects used by the current module.
+
+    The communication port should already be closed, so the ring is not mapped anymore.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (RingResource != NULL)
+    {
+        LcUnmapNotificationRing(NULL);
+
+        LcFreeResource(RingResource);
+        RingResource = NULL;
+    }
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcMapNotificationRing(
+    _In_  HANDLE                     RequestEvent,
+    _Out_ PNOTIFICATION_RING_MAPPING Mapping
+    )
+/*++
+
+Summary:
+
+    This function allocates the notification ring and maps it into the current process.
+
+    It should be called in the context of the client process, when the 'MapNotificationRing'
+    command is received.
+
+Arguments:
+
+    RequestEvent - Handle to the client event to be signaled, when new notifications are posted.
+
+    Mapping      - Receives the address of the ring in the client process and its size.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS                 status = STATUS_SUCCESS;
+    PNOTIFICATION_RING_STATE state  = NULL;
+    ULONG                    index  = 0;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(RequestEvent != NULL, STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(Mapping      != NULL, STATUS_INVALID_PARAMETER_2);
+
+    FltAcquireResourceExclusive(RingResource);
+
+    __try
+    {
+        // The ring is shared by all client connections, so only one process can map it at a time.
+        NT_IF_FALSE_LEAVE(RingState == NULL, STATUS_ALREADY_REGISTERED);
+
+        NT_IF_FAIL_LEAVE(LcAllocateNonPagedBuffer((PVOID*)&state, sizeof(NOTIFICATION_RING_STATE)));
+
+        for (index = 0; index < NOTIFICATION_RING_SLOT_COUNT; index++)
+        {
+            KeInitializeEvent(&state->ReplyEvents[index], NotificationEvent, FALSE);
+        }
+
+        NT_IF_FAIL_LEAVE(ObReferenceObjectByHandle(RequestEvent, EVENT_MODIFY_STATE, *ExEventObjectType, UserMode, (PVOID*)&state->RequestEvent, NULL));
+
+        NT_IF_FAIL_LEAVE(LcAllocateBuffer((PVOID*)&state->Ring, NonPagedPoolNx, NOTIFICATION_RING_SIZE, LC_COMMUNICATION_NON_PAGED_POOL_TAG));
+        state->Ring->Version   = NOTIFICATION_RING_VERSION;
+        state->Ring->SlotCount = NOTIFICATION_RING_SLOT_COUNT;
+        state->Ring->SlotSize  = sizeof(NOTIFICATION_RING_SLOT);
+
+        state->Mdl = IoAllocateMdl(state->Ring, NOTIFICATION_RING_SIZE, FALSE, FALSE, NULL);
+        NT_IF_FALSE_LEAVE(state->Mdl != NULL, STATUS_INSUFFICIENT_RESOURCES);
+
+        MmBuildMdlForNonPagedPool(state->Mdl);
+
+        // The ring can only be unmapped in the context of the process it's mapped into.
+        state->Process = PsGetCurrentProcess();
+        ObReferenceObject(state->Process);
+
+        // Mapping the pages into the user-mode raises an exception on failure.
+        __try
+        {
+            state->UserAddress = MmMapLockedPagesSpecifyCache(state->Mdl, UserMode, MmCached, NULL, FALSE, NormalPagePriority | MdlMappingNoExecute);
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            state->UserAddress = NULL;
+        }
+
+        NT_IF_FALSE_LEAVE(state->UserAddress != NULL, STATUS_INSUFFICIENT_RESOURCES);
+
+        Mapping->RingAddress = state->UserAddress;
+        Mapping->RingSize    = NOTIFICATION_RING_SIZE;
+
+        InterlockedExchangePointer((PVOID volatile*)&RingState, state);
+
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_INFO_LEVEL, "[LazyCopy] Notification ring mapped at: %p\n", state->UserAddress));
+    }
+    __finally
+    {
+        if (!NT_SUCCESS(status) && state != NULL)
+        {
+            LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "[LazyCopy] Unable to map notification ring: %08X\n", status));
+            LcFreeNotificationRingState(state);
+        }
+
+        FltReleaseResource(RingResource);
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcUnmapNotificationRing(
+    _In_opt_ PEPROCESS Process
+    )
+/*++
+
+Summary:
+
+    This function unmaps the notification ring, if it's mapped.
+
+    Threads waiting for the client replies are released with the STATUS_PORT_DISCONNECTED,
+    and the function waits for all senders to stop using the ring before freeing it.
+
+Arguments:
+
+    Process - If set, the ring is only unmapped, if it's mapped into this process.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PNOTIFICATION_RING_STATE state = NULL;
+    ULONG                    index = 0;
+
+    PAGED_CODE();
+
+    FltAcquireResourceExclusive(RingResource);
+
+    __try
+    {
+        // Other connections may still use the ring, if it belongs to another process.
+        if (RingState == NULL || (Process != NULL && RingState->Process != Process))
+        {
+            __leave;
+        }
+
+        state = (PNOTIFICATION_RING_STATE)InterlockedExchangePointer((PVOID volatile*)&RingState, NULL);
+
+        // Wake up the senders waiting for the replies.
+        // 'KeSetEvent' acts as a memory barrier, so they will see the 'Closing' flag set.
+        state->Closing = TRUE;
+        for (index = 0; index < NOTIFICATION_RING_SLOT_COUNT; index++)
+        {
+            KeSetEvent(&state->ReplyEvents[index], IO_NO_INCREMENT, FALSE);
+        }
+
+        // Wait for all senders to release the ring, and allow new ones to check the 'RingState' again.
+        ExWaitForRundownProtectionRelease(&RingRundown);
+        ExReInitializeRundownProtection(&RingRundown);
+
+        LcFreeNotificationRingState(state);
+
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_INFO_LEVEL, "[LazyCopy] Notification ring unmapped\n"));
+    }
+    __finally
+    {
+        FltReleaseResource(RingResource);
+    }
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcCompleteRingNotifications()
+/*++
+
+Summary:
+
+    This function wakes up the senders, which notifications have been replied by the client.
+    Replied slots nobody waits for anymore are freed.
+
+    Client calls it once, after it has processed all notifications available in the ring.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS                 status = STATUS_SUCCESS;
+    PNOTIFICATION_RING_STATE state  = NULL;
+    ULONG                    index  = 0;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(ExAcquireRundownProtection(&RingRundown), STATUS_PORT_DISCONNECTED);
+
+    __try
+    {
+        state = RingState;
+        NT_IF_FALSE_LEAVE(state != NULL, STATUS_INVALID_DEVICE_STATE);
+
+        // The slot state is writable by the client, so it's read once, and the slot is only
+        // freed, if the sender has abandoned it, or woken up to check the state itself.
+        for (index = 0; index < NOTIFICATION_RING_SLOT_COUNT; index++)
+        {
+            if (ReadNoFence(&state->Ring->Slots[index].State) != NotificationSlotReply)
+            {
+                continue;
+            }
+
+            // Whoever clears the flag first frees the slot, so it's not freed twice.
+            if (InterlockedCompareExchange(&state->AbandonedSlots[index], 0, 1) == 1)
+            {
+                InterlockedExchange(&state->Ring->Slots[index].State, NotificationSlotFree);
+            }
+            else
+            {
+                KeSetEvent(&state->ReplyEvents[index], IO_NO_INCREMENT, FALSE);
+            }
+        }
+    }
+    __finally
+    {
+        ExReleaseRundownProtection(&RingRundown);
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcSendRingNotification(
+    _In_                                DRIVER_NOTIFICATION_TYPE NotificationType,
+    _In_reads_bytes_(DataLength)        PVOID                    Data,
+    _In_                                ULONG                    DataLength,
+    _Out_writes_bytes_opt_(ReplyLength) PVOID                    Reply,
+    _In_                                ULONG                    ReplyLength,
+    _In_opt_                            PLARGE_INTEGER           Timeout,
+    _In_opt_                            PKEVENT                  CancelEvent,
+    _In_opt_                            PEPROCESS                TargetProcess,
+    _Outptr_opt_result_maybenull_       PEPROCESS*               ReplyProcess,
+    _Out_opt_                           PBOOLEAN                 Delivered
+    )
+/*++
+
+Summary:
+
+    This function posts the notification to the ring and waits for the client reply, if it's expected.
+
+    If the reply is not received in time, the 'CancelEvent' is signaled, or the ring is unmapped, the slot
+    is abandoned. It's either withdrawn, if the client hasn't picked it up yet, or freed, when the client
+    replies to it.
+
+Arguments:
+
+    NotificationType - Notification message type.
+
+    Data             - A buffer containing the notification data.
+
+    DataLength       - Length of the 'Data' buffer.
+
+    Reply            - A buffer where the client reply should be written to.
+                       May be NULL, if no client reply is expected.
+
+    ReplyLength      - Length of the 'Reply' buffer.
+
+    Timeout          - Relative time to wait for the reply for. Optional.
+                       If it's NULL, the function waits until the reply is received or the ring is unmapped.
+
+    CancelEvent      - Event signaled, when the caller is no longer interested in the reply. Optional.
+
+    TargetProcess    - If set, the notification is only posted, if the ring is mapped into this process. Optional.
+
+    ReplyProcess     - Receives the referenced client process the ring is mapped into, if the reply
+                       is received. Optional.
+
+    Delivered        - Receives TRUE, if the client has picked the notification up, or will do so.
+                       It's FALSE, if the notification was not posted, or was withdrawn. Optional.
+
+Return value:
+
+    STATUS_NOT_SUPPORTED - The notification was not posted, because the ring is not mapped into the
+                           'TargetProcess', full, or the notification doesn't fit into a slot.
+                           It should be sent via the port.
+
+    STATUS_IO_TIMEOUT    - The reply was not received within the 'Timeout' given.
+
+    STATUS_CANCELLED     - The 'CancelEvent' was signaled before the reply was received.
+
+    Any other value is the status of the operation.
+
+--*/
+{
+    NTSTATUS                 status     = STATUS_SUCCESS;
+    PNOTIFICATION_RING_STATE state      = NULL;
+    PNOTIFICATION_RING_SLOT  slot       = NULL;
+    ULONG                    index      = 0;
+    ULONG                    attempt    = 0;
+    LONG                     replyState = 0;
+    ULONG                    dataLength = 0;
+    LONG                     slotStatus = 0;
+    ULONG                    replySize  = 0;
+    BOOLEAN                  posted     = FALSE;
+    BOOLEAN                  withdrawn  = FALSE;
+    ULONGLONG                deadline   = 0;
+    LARGE_INTEGER            waitTime   = { 0 };
+    PVOID                    waitObjects[2] = { 0 };
+
+    PAGED_CODE();
+
+    if (ReplyProcess != NULL)
+    {
+        *ReplyProcess = NULL;
+    }
+
+    if (Delivered != NULL)
+    {
+        *Delivered = FALSE;
+    }
+
+    IF_FALSE_RETURN_RESULT(Data != NULL,                        STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT((Reply != NULL) == (ReplyLength > 0), STATUS_INVALID_PARAMETER_5);
+
+    IF_FALSE_RETURN_RESULT(DataLength  <= NOTIFICATION_RING_SLOT_DATA_SIZE, STATUS_NOT_SUPPORTED);
+    IF_FALSE_RETURN_RESULT(ReplyLength <= NOTIFICATION_RING_SLOT_DATA_SIZE, STATUS_NOT_SUPPORTED);
+
+    // Fails, if the ring is being unmapped.
+    IF_FALSE_RETURN_RESULT(ExAcquireRundownProtection(&RingRundown), STATUS_NOT_SUPPORTED);
+
+    __try
+    {
+        state = RingState;
+        NT_IF_FALSE_LEAVE(state != NULL, STATUS_NOT_SUPPORTED);
+
+        // Notifications bound to another process are sent via its connections.
+        NT_IF_FALSE_LEAVE(TargetProcess == NULL || state->Process == TargetProcess, STATUS_NOT_SUPPORTED);
+
+        // Take the first free slot, starting from the one after the slot taken by the previous sender.
+        for (attempt = 0; attempt < NOTIFICATION_RING_SLOT_COUNT; attempt++)
+        {
+            index = (ULONG)InterlockedIncrement(&state->NextSlot) % NOTIFICATION_RING_SLOT_COUNT;
+            if (InterlockedCompareExchange(&state->Ring->Slots[index].State, NotificationSlotFilling, NotificationSlotFree) == NotificationSlotFree)
+            {
+                slot = &state->Ring->Slots[index];
+                break;
+            }
+        }
+
+        NT_IF_FALSE_LEAVE(slot != NULL, STATUS_NOT_SUPPORTED);
+
+        slot->Type        = NotificationType;
+        slot->DataLength  = DataLength;
+        slot->ReplyLength = ReplyLength;
+        slot->Status      = 0;
+        RtlCopyMemory(slot->Data, Data, DataLength);
+
+        // Reset the event before the request is published, so the reply signal won't be lost.
+        KeClearEvent(&state->ReplyEvents[index]);
+
+        // Publish the notification and ring the doorbell, if the client is waiting for it.
+        // If it's not, it will see the notification, when it finishes processing the current batch.
+        InterlockedExchange(&slot->State, NotificationSlotRequest);
+        posted = TRUE;
+
+        if (InterlockedCompareExchange(&state->Ring->ClientWaiting, 0, 1) == 1)
+        {
+            KeSetEvent(state->RequestEvent, IO_NO_INCREMENT, FALSE);
+        }
+
+        // Client frees the slot itself, if no reply is expected.
+        if (ReplyLength == 0)
+        {
+            __leave;
+        }
+
+        // The event may be signaled several times before the reply is received,
+        // so the relative timeout is converted to the interrupt time deadline.
+        if (Timeout != NULL)
+        {
+            deadline = KeQueryInterruptTime() + (ULONGLONG)(-Timeout->QuadPart);
+        }
+
+        waitObjects[0] = &state->ReplyEvents[index];
+        waitObjects[1] = CancelEvent;
+
+        for (;;)
+        {
+            replyState = ReadNoFence(&slot->State);
+            if (replyState == NotificationSlotReply)
+            {
+                break;
+            }
+
+            // Withdraw the notification, so the caller knows, whether the client has picked it up.
+            if (state->Closing)
+            {
+                withdrawn = LcAbandonRingSlot(state, index);
+                status    = STATUS_PORT_DISCONNECTED;
+                __leave;
+            }
+
+            if (Timeout != NULL)
+            {
+                waitTime.QuadPart = (LONGLONG)KeQueryInterruptTime() - (LONGLONG)deadline;
+                if (waitTime.QuadPart >= 0)
+                {
+                    withdrawn = LcAbandonRingSlot(state, index);
+                    status    = STATUS_IO_TIMEOUT;
+                    __leave;
+                }
+            }
+
+            // The event may be left signaled by an earlier 'CompleteRingNotifications' command, so the state is checked again.
+            status = KeWaitForMultipleObjects(
+                CancelEvent != NULL ? 2 : 1,
+                waitObjects,
+                WaitAny,
+                Executive,
+                KernelMode,
+                FALSE,
+                Timeout != NULL ? &waitTime : NULL,
+                NULL);
+
+            NT_IF_FAIL_LEAVE(status);
+
+            if (status == STATUS_WAIT_1)
+            {
+                withdrawn = LcAbandonRingSlot(state, index);
+                status    = STATUS_CANCELLED;
+                __leave;
+            }
+
+            status = STATUS_SUCCESS;
+            KeClearEvent(&state->ReplyEvents[index]);
+        }
+
+        // The ring memory is writable by the client, so every value is read exactly once
+        // into a local variable, and only the local copies are validated and used.
+        dataLength = ReadULongNoFence((__volatile ULONG*)&slot->DataLength);
+        slotStatus = ReadNoFence((__volatile LONG*)&slot->Status);
+
+        replySize = dataLength < ReplyLength ? dataLength : ReplyLength;
+        status    = slotStatus < 0 ? STATUS_UNSUCCESSFUL : STATUS_SUCCESS;
+
+        RtlCopyMemory(Reply, slot->Data, replySize);
+        if (replySize < ReplyLength)
+        {
+            RtlZeroMemory((PUCHAR)Reply + replySize, ReplyLength - replySize);
+        }
+
+        InterlockedExchange(&slot->State, NotificationSlotFree);
+
+        if (ReplyProcess != NULL)
+        {
+            ObReferenceObject(state->Process);
+            *ReplyProcess = state->Process;
+        }
+    }
+    __finally
+    {
+        if (Delivered != NULL)
+        {
+            *Delivered = posted && !withdrawn;
+        }
+
+        ExReleaseRundownProtection(&RingRundown);
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+//  Local functions.
+//------------------------------------------------------------------------
+
+static
+VOID
+LcFreeNotificationRingState(
+    _In_ PNOTIFICATION_RING_STATE State
+    )
+/*++
+
+Summary:
+
+    This function unmaps the ring from the client process and frees the 'State' given.
+
+Arguments:
+
+    State - Notification ring state to be freed.
+
+Return value:
+
+    None.
+
+--*/
+{
+    KAPC_STATE apcState = { 0 };
+
+    PAGED_CODE();
+
+    FLT_ASSERT(State != NULL);
+
+    if (State->UserAddress != NULL)
+    {
+        // Port disconnect callback is normally invoked in the client process context,
+        // but it's not guaranteed, when the driver is unloaded.
+        if (State->Process != PsGetCurrentProcess())
+        {
+            KeStackAttachProcess(State->Process, &apcState);
+            MmUnmapLockedPages(State->UserAddress, State->Mdl);
+            KeUnstackDetachProcess(&apcState);
+        }
+        else
+        {
+            MmUnmapLockedPages(State->UserAddress, State->Mdl);
+        }
+    }
+
+    if (State->Process != NULL)
+    {
+        ObDereferenceObject(State->Process);
+    }
+
+    if (State->Mdl != NULL)
+    {
+        IoFreeMdl(State->Mdl);
+    }
+
+    if (State->Ring != NULL)
+    {
+        LcFreeBuffer(State->Ring, LC_COMMUNICATION_NON_PAGED_POOL_TAG);
+    }
+
+    if (State->RequestEvent != NULL)
+    {
+        ObDereferenceObject(State->RequestEvent);
+    }
+
+    LcFreeNonPagedBuffer(State);
+}
+
+//------------------------------------------------------------------------
+
+static
+BOOLEAN
+LcAbandonRingSlot(
+    _In_ PNOTIFICATION_RING_STATE State,
+    _In_ ULONG                    Index
+    )
+/*++
+
+Summary:
+
+    This function releases the slot, which sender no longer waits for the reply.
+
+    If the client hasn't picked the notification up yet, it's withdrawn. Otherwise,
+    the slot is freed by the 'LcCompleteRingNotifications', when the client replies to it.
+
+Arguments:
+
+    State - Notification ring state the slot belongs to.
+
+    Index - Index of the slot to be abandoned.
+
+Return value:
+
+    TRUE, if the notification has been withdrawn before the client picked it up.
+
+--*/
+{
+    PAGED_CODE();
+
+    FLT_ASSERT(State != NULL);
+    FLT_ASSERT(Index < NOTIFICATION_RING_SLOT_COUNT);
+
+    if (InterlockedCompareExchange(&State->Ring->Slots[Index].State, NotificationSlotFree, NotificationSlotRequest) == NotificationSlotRequest)
+    {
+        return TRUE;
+    }
+
+    InterlockedExchange(&State->AbandonedSlots[Index], 1);
+
+    // The client might have replied before the flag was set, and the 'LcCompleteRingNotifications'
+    // has already skipped the slot, so it's freed here, unless the flag has been cleared already.
+    if (ReadNoFence(&State->Ring->Slots[Index].State) == NotificationSlotReply
+        && InterlockedCompareExchange(&State->AbandonedSlots[Index], 0, 1) == 1)
+    {
+        InterlockedExchange(&State->Ring->Slots[Index].State, NotificationSlotFree);
+    }
+
+    return FALSE;
+}
@@ -0,0 +1,92 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    NotificationRing.h
+
+Abstract:
+
+    Contains the shared notification ring function prototypes.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+#ifndef __LAZY_COPY_NOTIFICATION_RING_H__
+#define __LAZY_COPY_NOTIFICATION_RING_H__
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "Globals.h"
+#include "CommunicationData.h"
+
+//------------------------------------------------------------------------
+//  Notification ring function prototypes.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializeNotificationRing();
+
+VOID
+LcFreeNotificationRing();
+
+_Check_return_
+NTSTATUS
+LcMapNotificationRing(
+    _In_  HANDLE                     RequestEvent,
+    _Out_ PNOTIFICATION_RING_MAPPING Mapping
+    );
+
+VOID
+LcUnmapNotificationRing(
+    _In_opt_ PEPROCESS Process
+    );
+
+_Check_return_
+NTSTATUS
+LcCompleteRingNotifications();
+
+_Check_return_
+NTSTATUS
+LcSendRingNotification(
+    _In_                                DRIVER_NOTIFICATION_TYPE NotificationType,
+    _In_reads_bytes_(DataLength)        PVOID                    Data,
+    _In_                                ULONG                    DataLength,
+    _Out_writes_bytes_opt_(ReplyLength) PVOID                    Reply,
+    _In_                                ULONG                    ReplyLength,
+    _In_opt_                            PLARGE_INTEGER           Timeout,
+    _In_opt_                            PKEVENT                  CancelEvent,
+    _In_opt_                            PEPROCESS                TargetProcess,
+    _Outptr_opt_result_maybenull_       PEPROCESS*               ReplyProcess,
+    _Out_opt_                           PBOOLEAN                 Delivered
+    );
+
+#endif // __LAZY_COPY_NOTIFICATION_RING_H__
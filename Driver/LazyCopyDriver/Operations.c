@@ -40,13 +40,20 @@ Environment:
 //  Includes.
 //------------------------------------------------------------------------
 
+#include "AccessTable.h"
+#include "ActiveFetches.h"
 #include "Communication.h"
 #include "Configuration.h"
 #include "Context.h"
+#include "DirectoryCache.h"
 #include "Fetch.h"
 #include "FileLocks.h"
 #include "LazyCopyDriver.h"
+#include "NegativeCache.h"
+#include "PendedFetches.h"
+#include "PlaceholderCache.h"
 #include "ReparsePoints.h"
+#include "Statistics.h"
 #include "Utilities.h"
 
 // See the 'LazyCopyDriver.c' for details.
@@ -69,18 +76,101 @@ typedef struct _CREATE_COMPLETION_CONTEXT
 
     // File access notification report rate for this file.
     ULONG                      ReportRate;
+
+    // Whether the pre-create callback modified the create parameters to open
+    // the reparse point itself, because the file is known to be a LazyCopy file.
+    BOOLEAN                    ReparsePointOpened;
+
+    // Create parameters requested by the caller.
+    // Only valid, if the 'ReparsePointOpened' is TRUE.
+    ULONG                      OriginalCreateOptions;
+    USHORT                     OriginalShareAccess;
+
+    // Negative cache key of the file. Its 'Hash' is zero, if the file should not be cached.
+    NEGATIVE_CACHE_KEY         NegativeCacheKey;
 } CREATE_COMPLETION_CONTEXT, *PCREATE_COMPLETION_CONTEXT;
 
+//
+// Describes where the fields are located in the directory entry of the specific
+// information class, so the same code can process entries of all classes.
+//
+typedef struct _DIRECTORY_ENTRY_LAYOUT
+{
+    // Information class the current layout is for.
+    FILE_INFORMATION_CLASS InformationClass;
+
+    // Field offsets in the directory entry.
+    ULONG                  ChangeTimeOffset;
+    ULONG                  EndOfFileOffset;
+    ULONG                  AllocationSizeOffset;
+    ULONG                  FileAttributesOffset;
+    ULONG                  FileNameLengthOffset;
+    ULONG                  FileNameOffset;
+
+    // Offset of the field containing the reparse tag, if the 'FILE_ATTRIBUTE_REPARSE_POINT' is set.
+    // Zero, if the entry doesn't contain it.
+    ULONG                  ReparseTagOffset;
+} DIRECTORY_ENTRY_LAYOUT, *PDIRECTORY_ENTRY_LAYOUT;
+
+typedef const DIRECTORY_ENTRY_LAYOUT* PCDIRECTORY_ENTRY_LAYOUT;
+
+//
+// Pseudo-random generator state used to sample the file access events.
+// Every processor has its own state, so they don't share the cache line.
+//
+typedef struct DECLSPEC_CACHEALIGN _SAMPLER_STATE
+{
+    ULONGLONG State;
+} SAMPLER_STATE, *PSAMPLER_STATE;
+
+//------------------------------------------------------------------------
+//  Defines.
+//------------------------------------------------------------------------
+
+// Amount of the file access sampler states.
+#define SAMPLER_SLOTS 64
+
+#define LC_DIRECTORY_ENTRY_LAYOUT(InformationClass, Type, ReparseTagOffset) \
+    {                                                                       \
+        InformationClass,                                                   \
+        FIELD_OFFSET(Type, ChangeTime),                                     \
+        FIELD_OFFSET(Type, EndOfFile),                                      \
+        FIELD_OFFSET(Type, AllocationSize),                                 \
+        FIELD_OFFSET(Type, FileAttributes),                                 \
+        FIELD_OFFSET(Type, FileNameLength),                                 \
+        FIELD_OFFSET(Type, FileName),                                       \
+        ReparseTagOffset                                                    \
+    }
+
 //------------------------------------------------------------------------
 //  Local function prototypes.
 //------------------------------------------------------------------------
 
 static
 VOID
-LcEtwFileAccessed(
-    _In_ ULONG            ReportRate,
-    _In_ PCUNICODE_STRING Path,
-    _In_ ULONG            CreateOptions
+LcReportFileAccess(
+    _In_ ULONG                 ReportRate,
+    _In_ DRIVER_OPERATION_MODE OperationMode,
+    _In_ PCUNICODE_STRING      Path,
+    _In_ ULONG                 CreateOptions
+    );
+
+static
+_Check_return_
+ULONGLONG
+LcGetNextSamplerValue();
+
+static
+_Check_return_
+ULONGLONG
+LcHashSamplerPath(
+    _In_ PCUNICODE_STRING Path
+    );
+
+static
+ULONGLONG
+LcMixSamplerValue(
+    _In_ ULONGLONG Value
     );
 
 static
@@ -91,6 +181,41 @@ LcGetFileNameInformation(
     _Outptr_ PFLT_FILE_NAME_INFORMATION* NameInformation
     );
 
+static
+_Check_return_
+BOOLEAN
+LcIsDefaultStream(
+    _In_ PFLT_FILE_NAME_INFORMATION NameInformation
+    );
+
+static
+_Check_return_
+PCDIRECTORY_ENTRY_LAYOUT
+LcGetDirectoryEntryLayout(
+    _In_ FILE_INFORMATION_CLASS InformationClass
+    );
+
+static
+BOOLEAN
+LcProcessDirectoryEntries(
+    _In_                                PFLT_CALLBACK_DATA       Data,
+    _In_                                PCFLT_RELATED_OBJECTS    FltObjects,
+    _Inout_updates_bytes_(BufferLength) PVOID                    Buffer,
+    _In_                                ULONG                    BufferLength,
+    _In_                                PCDIRECTORY_ENTRY_LAYOUT Layout
+    );
+
+static
+_Check_return_
+NTSTATUS
+LcGetDirectoryEntryRemoteFileSize(
+    _In_  PCFLT_RELATED_OBJECTS FltObjects,
+    _In_  PCUNICODE_STRING      DirectoryName,
+    _In_  PCUNICODE_STRING      FileName,
+    _In_  PLARGE_INTEGER        ChangeTime,
+    _Out_ PLARGE_INTEGER        RemoteFileSize
+    );
+
 //------------------------------------------------------------------------
 //  Text sections.
 //------------------------------------------------------------------------
@@ -100,13 +225,26 @@ LcGetFileNameInformation(
     #pragma alloc_text(PAGE, PreCreateOperationCallback)
     #pragma alloc_text(PAGE, PostCreateOperationCallback)
     #pragma alloc_text(PAGE, PreReadWriteOperationCallback)
+    #pragma alloc_text(PAGE, LcFetchFileForOperation)
     #pragma alloc_text(PAGE, PreQueryInformationOperationCallback)
     #pragma alloc_text(PAGE, PostQueryInformationOperationCallback)
+    #pragma alloc_text(PAGE, PreDirectoryControlOperationCallback)
     #pragma alloc_text(PAGE, PostDirectoryControlOperationCallback)
+    #pragma alloc_text(PAGE, PreFileSystemControlOperationCallback)
+    #pragma alloc_text(PAGE, PostFileSystemControlOperationCallback)
+    #pragma alloc_text(PAGE, PreSetInformationOperationCallback)
+    #pragma alloc_text(PAGE, PostSetInformationOperationCallback)
 
     // Local functions.
-    #pragma alloc_text(PAGE, LcEtwFileAccessed)
+    #pragma alloc_text(PAGE, LcReportFileAccess)
+    #pragma alloc_text(PAGE, LcGetNextSamplerValue)
+    #pragma alloc_text(PAGE, LcHashSamplerPath)
+    #pragma alloc_text(PAGE, LcMixSamplerValue)
     #pragma alloc_text(PAGE, LcGetFileNameInformation)
+    #pragma alloc_text(PAGE, LcIsDefaultStream)
+    #pragma alloc_text(PAGE, LcGetDirectoryEntryLayout)
+    #pragma alloc_text(PAGE, LcProcessDirectoryEntries)
+    #pragma alloc_text(PAGE, LcGetDirectoryEntryRemoteFileSize)
 #endif // ALLOC_PRAGMA
 
 //------------------------------------------------------------------------
@@ -118,6 +256,26 @@ LcGetFileNameInformation(
 static const ULONG  DefaultCreateOptions = FILE_OPEN_REPARSE_POINT | FILE_OPEN_FOR_BACKUP_INTENT | FILE_RANDOM_ACCESS | FILE_WRITE_THROUGH;
 static const USHORT DefaultShareAccess   = FILE_SHARE_READ | FILE_SHARE_WRITE;
 
+// File access sampler states.
+static SAMPLER_STATE SamplerStates[SAMPLER_SLOTS] = { 0 };
+
+// Directory information classes that contain the file size and attributes.
+static const DIRECTORY_ENTRY_LAYOUT DirectoryEntryLayouts[] =
+{
+    LC_DIRECTORY_ENTRY_LAYOUT(FileDirectoryInformation,           FILE_DIRECTORY_INFORMATION,        0),
+    LC_DIRECTORY_ENTRY_LAYOUT(FileFullDirectoryInformation,       FILE_FULL_DIR_INFORMATION,         FIELD_OFFSET(FILE_FULL_DIR_INFORMATION,         EaSize)),
+    LC_DIRECTORY_ENTRY_LAYOUT(FileBothDirectoryInformation,       FILE_BOTH_DIR_INFORMATION,         FIELD_OFFSET(FILE_BOTH_DIR_INFORMATION,         EaSize)),
+    LC_DIRECTORY_ENTRY_LAYOUT(FileIdBothDirectoryInformation,     FILE_ID_BOTH_DIR_INFORMATION,      FIELD_OFFSET(FILE_ID_BOTH_DIR_INFORMATION,      EaSize)),
+    LC_DIRECTORY_ENTRY_LAYOUT(FileIdFullDirectoryInformation,     FILE_ID_FULL_DIR_INFORMATION,      FIELD_OFFSET(FILE_ID_FULL_DIR_INFORMATION,      EaSize)),
+    LC_DIRECTORY_ENTRY_LAYOUT(FileIdGlobalTxDirectoryInformation, FILE_ID_GLOBAL_TX_DIR_INFORMATION, 0),
+#if PLATFORM_WIN8
+    LC_DIRECTORY_ENTRY_LAYOUT(FileIdExtdDirectoryInformation,     FILE_ID_EXTD_DIR_INFORMATION,      FIELD_OFFSET(FILE_ID_EXTD_DIR_INFORMATION,      ReparsePointTag)),
+#endif
+#if (NTDDI_VERSION >= NTDDI_WIN10)
+    LC_DIRECTORY_ENTRY_LAYOUT(FileIdExtdBothDirectoryInformation, FILE_ID_EXTD_BOTH_DIR_INFORMATION, FIELD_OFFSET(FILE_ID_EXTD_BOTH_DIR_INFORMATION, ReparsePointTag)),
+#endif
+};
+
 //------------------------------------------------------------------------
 //  Functions that track operations on the volume.
 //------------------------------------------------------------------------
@@ -138,6 +296,9 @@ Summary:
     the current driver. If so, the post-operation callback will be scheduled for
     execution.
 
+    Files that were already opened as the ordinary ones are found in the per-volume
+    negative cache, so their file names are not even queried.
+
 Arguments:
 
     Data              - Pointer to the filter's callback data that is passed to us.
@@ -158,11 +319,15 @@ Return value:
     NTSTATUS                   status            = STATUS_SUCCESS;
     PCREATE_COMPLETION_CONTEXT completionContext = NULL;
     DRIVER_OPERATION_MODE      operationMode     = DriverDisabled;
+    CONFIGURATION_REFERENCE    configuration     = { 0 };
     ULONG                      createOptions     = 0;
     ULONG                      createDisposition = 0;
+    NEGATIVE_CACHE_KEY         negativeCacheKey  = { 0 };
 
     PAGED_CODE();
 
+    LcRecordCallback(PreCreateCallback);
+
     UNREFERENCED_PARAMETER(FltObjects);
 
     // We are only registered for the IRP_MJ_CREATE.
@@ -170,7 +335,8 @@ Return value:
     FLT_ASSERT(Data->Iopb                != NULL);
     FLT_ASSERT(Data->Iopb->MajorFunction == IRP_MJ_CREATE);
 
-    FltAcquireResourceShared(Globals.Lock);
+    // All configuration parameters are read from the same snapshot without acquiring any locks.
+    LcAcquireConfigurationSnapshot(&configuration);
 
     __try
     {
@@ -212,14 +378,20 @@ Return value:
             __leave;
         }
 
-        operationMode = LcGetOperationMode();
+        operationMode = configuration.Snapshot != NULL ? configuration.Snapshot->OperationMode : DriverDisabled;
         if (operationMode == DriverDisabled)
         {
             __leave;
         }
 
+        // Volume no longer matches the volume policy.
+        if (!LcIsInstanceEnabled(FltObjects->Instance))
+        {
+            __leave;
+        }
+
         // Let the trusted processes do whatever they want with the current file.
-        if (LcIsProcessTrusted(PsGetThreadProcessId(Data->Thread)))
+        if (LcIsProcessTrustedInSnapshot(configuration.Snapshot, PsGetThreadProcessId(Data->Thread)))
         {
             // If the trusted process is trying to access the current file, make sure it's opened
             // with the flags allowing it to read and write to the file.
@@ -239,21 +411,51 @@ Return value:
             __leave;
         }
 
+        // Skip the files that were already opened as the ordinary ones.
+        // The file accesses are reported by name, so the cache is not used, if they are watched.
+        if (!FlagOn(operationMode, WatchEnabled) && LcIsKnownNonPlaceholder(Data, FltObjects, &negativeCacheKey))
+        {
+            __leave;
+        }
+
         // Allocate context to be passed to the post-operation callback.
         NT_IF_FAIL_LEAVE(LcAllocateNonPagedBuffer((PVOID*)&completionContext, sizeof(CREATE_COMPLETION_CONTEXT)));
+        completionContext->NegativeCacheKey = negativeCacheKey;
 
         // Fill in the completion context fields.
         NT_IF_FAIL_LEAVE(LcGetFileNameInformation(Data, &completionContext->NameInfo));
-        completionContext->ReportRate    = FlagOn(operationMode, WatchEnabled) ? LcGetReportRateForPath(&completionContext->NameInfo->Name) : 0;
+        completionContext->ReportRate    = FlagOn(operationMode, WatchEnabled) ? LcGetReportRateForPathInSnapshot(configuration.Snapshot, &completionContext->NameInfo->Name, PsGetThreadProcessId(Data->Thread)) : 0;
         completionContext->OperationMode = operationMode;
 
+        // If the file is known to be a LazyCopy file, open the reparse point itself right away,
+        // so the post-create callback doesn't have to reissue the create operation.
+        // Only plain open operations are handled, because the cache entry might be stale, and
+        // the post-create callback might need to reopen the file with the original parameters.
+        if (FlagOn(operationMode, FetchEnabled)
+            && createDisposition == FILE_OPEN
+            && !FlagOn(Data->Iopb->OperationFlags, SL_OPEN_TARGET_DIRECTORY)
+            && ((Data->Iopb->Parameters.Create.Options & DefaultCreateOptions)      != DefaultCreateOptions
+                || (Data->Iopb->Parameters.Create.ShareAccess & DefaultShareAccess) != DefaultShareAccess)
+            && LcIsDefaultStream(completionContext->NameInfo)
+            && LcIsKnownPlaceholder(&completionContext->NameInfo->Name))
+        {
+            completionContext->OriginalCreateOptions = Data->Iopb->Parameters.Create.Options;
+            completionContext->OriginalShareAccess   = Data->Iopb->Parameters.Create.ShareAccess;
+            completionContext->ReparsePointOpened    = TRUE;
+
+            Data->Iopb->Parameters.Create.Options     |= DefaultCreateOptions;
+            Data->Iopb->Parameters.Create.ShareAccess |= DefaultShareAccess;
+
+            FltSetCallbackDataDirty(Data);
+        }
+
         *CompletionContext = completionContext;
         completionContext  = NULL;
         callbackStatus     = FLT_PREOP_SUCCESS_WITH_CALLBACK;
     }
     __finally
     {
-        FltReleaseResource(Globals.Lock);
+        LcReleaseConfigurationSnapshot(&configuration);
 
         if (completionContext != NULL)
         {
@@ -288,6 +490,10 @@ Summary:
     read the reparse point data and set a new stream context on the file, if it is not already
     there.
 
+    If the pre-create callback opened the reparse point based on the placeholder cache, this
+    function validates the reparse tag and reopens the file with the original parameters, if
+    the file is no longer a LazyCopy file.
+
     If there is a context set for a file, when read/write callbacks are executed, file will be
     fetched.
 
@@ -312,19 +518,28 @@ Return Value:
 
 --*/
 {
-    NTSTATUS                   status            = STATUS_SUCCESS;
+    NTSTATUS                       status            = STATUS_SUCCESS;
 
     // Completion context received from the pre-operation callback.
-    PCREATE_COMPLETION_CONTEXT completionContext = NULL;
+    PCREATE_COMPLETION_CONTEXT     completionContext = NULL;
+
+    UNICODE_STRING                 remotePath        = { 0 };
+    LARGE_INTEGER                  fileSize          = { 0 };
+    BOOLEAN                        useCustomHandler  = FALSE;
+    PLC_STREAM_CONTEXT             streamContext     = NULL;
+    BOOLEAN                        contextCreated    = FALSE;
+    FILE_ATTRIBUTE_TAG_INFORMATION attributeTag      = { 0 };
 
-    UNICODE_STRING             remotePath        = { 0 };
-    LARGE_INTEGER              fileSize          = { 0 };
-    BOOLEAN                    useCustomHandler  = FALSE;
-    PLC_STREAM_CONTEXT         streamContext     = NULL;
-    BOOLEAN                    contextCreated    = FALSE;
+    // Whether the LazyCopy reparse point was opened without reissuing the create operation.
+    BOOLEAN                        placeholderOpened = FALSE;
+
+    // Whether the create operation was reissued to open the LazyCopy reparse point.
+    BOOLEAN                        createReissued    = FALSE;
 
     PAGED_CODE();
 
+    LcRecordCallback(PostCreateCallback);
+
     UNREFERENCED_PARAMETER(Flags);
 
     FLT_ASSERT(Data                      != NULL);
@@ -343,61 +558,114 @@ Return Value:
         // Leave, if the filter instance is being detached, or the file is opened for deletion.
         if (FlagOn(Flags, FLTFL_POST_OPERATION_DRAINING) || !NT_SUCCESS(Data->IoStatus.Status) || FltObjects->FileObject->DeletePending)
         {
+            // The cached file might have been deleted or renamed.
+            if (completionContext->ReparsePointOpened && !NT_SUCCESS(Data->IoStatus.Status))
+            {
+                LcRemoveKnownPlaceholder(&completionContext->NameInfo->Name);
+            }
+
             __leave;
         }
 
-        // Report access operations for non-reparse files, which are accessed by non-trusted processes.
-        if (Data->IoStatus.Status != STATUS_REPARSE && FlagOn(completionContext->OperationMode, WatchEnabled))
+        // The reparse point was opened by the pre-create callback, so make sure the file is still a LazyCopy file.
+        if (completionContext->ReparsePointOpened)
         {
-            LcEtwFileAccessed(completionContext->ReportRate, &completionContext->NameInfo->Name, Data->Iopb->Parameters.Create.Options);
+            NT_IF_FAIL_LEAVE(FltQueryInformationFile(FltObjects->Instance, FltObjects->FileObject, &attributeTag, sizeof(FILE_ATTRIBUTE_TAG_INFORMATION), FileAttributeTagInformation, NULL));
+            if (attributeTag.ReparseTag == LC_REPARSE_TAG)
+            {
+                placeholderOpened = TRUE;
+            }
+            else
+            {
+                // The file was fetched or replaced since it was cached.
+                // Reopen it with the parameters the caller requested.
+                LcRemoveKnownPlaceholder(&completionContext->NameInfo->Name);
+
+                FltCancelFileOpen(FltObjects->Instance, FltObjects->FileObject);
+
+                Data->Iopb->Parameters.Create.Options     = completionContext->OriginalCreateOptions;
+                Data->Iopb->Parameters.Create.ShareAccess = completionContext->OriginalShareAccess;
+
+                FltSetCallbackDataDirty(Data);
+                FltReissueSynchronousIo(FltObjects->Instance, Data);
+
+                // Let the caller receive the failure status, if any.
+                if (!NT_SUCCESS(Data->IoStatus.Status))
+                {
+                    __leave;
+                }
+            }
         }
 
-        // Skip, if the file was opened by another driver or if the unsupported reparse point is found.
-        if (Data->IoStatus.Status != STATUS_REPARSE || Data->TagData == NULL || Data->TagData->FileTag != LC_REPARSE_TAG)
+        // Report access operations for non-reparse files, which are accessed by non-trusted processes.
+        if (!placeholderOpened && Data->IoStatus.Status != STATUS_REPARSE && FlagOn(completionContext->OperationMode, WatchEnabled))
         {
-            __leave;
+            LcReportFileAccess(
+                completionContext->ReportRate,
+                completionContext->OperationMode,
+                &completionContext->NameInfo->Name,
+                Data->Iopb->Parameters.Create.Options);
         }
 
-        // Don't fetch the file, if we're not configured for it.
-        if (!FlagOn(completionContext->OperationMode, FetchEnabled))
+        // The file system did not return the STATUS_REPARSE, so the file has no reparse point.
+        if (!placeholderOpened && Data->IoStatus.Status != STATUS_REPARSE)
         {
-            __leave;
+            LcAddNonPlaceholder(FltObjects, &completionContext->NegativeCacheKey);
         }
 
-        // Don't fetch, if non-default stream is opened.
-        if (completionContext->NameInfo->Stream.Length != 0)
+        if (placeholderOpened)
+        {
+            LcRecordPlaceholderOpen(FALSE);
+        }
+        else
         {
-            UNICODE_STRING dataStreamName = CONSTANT_STRING(L"::$DATA");
-
-            // It is possible to open the default data stream and yet
-            // still have a stream name. This is done by appending
-            // '::$DATA' to the end of the file name. So if that is the
-            // name of our stream, this is really the default stream.
-            // Otherwise, it is an alternate stream.
-            if (RtlCompareUnicodeString(&(completionContext->NameInfo->Stream), &dataStreamName, TRUE) != 0)
+            // Skip, if the file was opened by another driver or if the unsupported reparse point is found.
+            if (Data->IoStatus.Status != STATUS_REPARSE || Data->TagData == NULL || Data->TagData->FileTag != LC_REPARSE_TAG)
             {
                 __leave;
             }
-        }
 
-        // Reopen the current file, so the open operation succeeds.
-        //
-        // NOTE: Sharing access is also overwritten.
-        // We fetch in Read/Write operation callback, so it might be possible to two applications to open the same
-        // LazyCopy file with no sharing access. In this case the first read/write will fetch the file, and those
-        // apps will continue to work.
-        // Without overwriting the sharing access, our user-mode client will not be able to easily work with these files.
-        // This driver is designed to work as a fetcher for binary files that are not usually simultaneously written to.
-        // If you feel that sharing access is important, consider disabling it and not accessing these files from the service.
-        if ((Data->Iopb->Parameters.Create.Options & DefaultCreateOptions)      != DefaultCreateOptions
-            || (Data->Iopb->Parameters.Create.ShareAccess & DefaultShareAccess) != DefaultShareAccess)
-        {
-            Data->Iopb->Parameters.Create.Options     |= DefaultCreateOptions;
-            Data->Iopb->Parameters.Create.ShareAccess |= DefaultShareAccess;
+            // Don't fetch the file, if we're not configured for it.
+            if (!FlagOn(completionContext->OperationMode, FetchEnabled))
+            {
+                __leave;
+            }
 
-            FltSetCallbackDataDirty(Data);
-            FltReissueSynchronousIo(FltObjects->Instance, Data);
+            // Don't fetch, if non-default stream is opened.
+            if (!LcIsDefaultStream(completionContext->NameInfo))
+            {
+                __leave;
+            }
+
+            // Reopen the current file, so the open operation succeeds.
+            //
+            // NOTE: Sharing access is also overwritten.
+            // We fetch in Read/Write operation callback, so it might be possible to two applications to open the same
+            // LazyCopy file with no sharing access. In this case the first read/write will fetch the file, and those
+            // apps will continue to work.
+            // Without overwriting the sharing access, our user-mode client will not be able to easily work with these files.
+            // This driver is designed to work as a fetcher for binary files that are not usually simultaneously written to.
+            // If you feel that sharing access is important, consider disabling it and not accessing these files from the service.
+            if ((Data->Iopb->Parameters.Create.Options & DefaultCreateOptions)      != DefaultCreateOptions
+                || (Data->Iopb->Parameters.Create.ShareAccess & DefaultShareAccess) != DefaultShareAccess)
+            {
+                Data->Iopb->Parameters.Create.Options     |= DefaultCreateOptions;
+                Data->Iopb->Parameters.Create.ShareAccess |= DefaultShareAccess;
+
+                FltSetCallbackDataDirty(Data);
+                FltReissueSynchronousIo(FltObjects->Instance, Data);
+                createReissued = TRUE;
+            }
+
+            // The open is counted even if the reissued create failed, because it was performed anyway.
+            LcRecordPlaceholderOpen(createReissued);
             NT_IF_FAIL_LEAVE(Data->IoStatus.Status);
+
+            // Remember the file, so the following opens will not need to be reissued.
+            if (!NT_SUCCESS(LcAddKnownPlaceholder(&completionContext->NameInfo->Name)))
+            {
+                LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_WARNING_LEVEL, "[LazyCopy] Unable to cache LazyCopy file: '%wZ'\n", completionContext->NameInfo->Name));
+            }
         }
 
         // If the file have been created or overwritten, untag it, so it will not be fetched later.
@@ -407,6 +675,7 @@ Return Value:
         {
             LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] File overwritten, removing reparse tag: '%wZ'\n", completionContext->NameInfo->Name));
             NT_IF_FAIL_LEAVE(LcUntagFile(FltObjects, &completionContext->NameInfo->Name));
+            LcRemoveKnownPlaceholder(&completionContext->NameInfo->Name);
 
             __leave;
         }
@@ -468,12 +737,11 @@ Summary:
     This function is invoked before the 'IRP_MJ_READ', 'IRP_MJ_WRITE', and 'IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION'
     are processed by the low-level drivers.
 
-    The algorightm is simple:
-    1. Check, whether the context is set for the stream. If it is not there, return;
-    2. Try to exclusively lock the file for processing. If the obtained lock is not exclusive, return;
-    3. Check for the reparse tag. If it's not there (file is fetched), return;
-    4. Fetch file;
-    5. Untag it and remove stream context, so it will not be fetched again.
+    If the context is set for the stream, the file is fetched by the 'LcFetchFileForOperation'.
+
+    Files fetched by the user-mode client may take long to fetch, so the IRP-based operations on them
+    are pended and the files are fetched by the worker threads. The fast I/O operations are disallowed,
+    so they are reissued as the IRP-based ones. Other operations wait for the fetch to finish.
 
 Arguments:
 
@@ -491,59 +759,175 @@ Return value:
 
 --*/
 {
-    FLT_PREOP_CALLBACK_STATUS      callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
-    NTSTATUS                       status         = STATUS_SUCCESS;
-    PLC_STREAM_CONTEXT             context        = NULL;
-    PFLT_FILE_NAME_INFORMATION     nameInfo       = NULL;
-    FILE_ATTRIBUTE_TAG_INFORMATION attributeTag   = { 0 };
-    LARGE_INTEGER                  bytesFetched   = { 0 };
-    PKEVENT                        fileLockEvent  = NULL;
-    LARGE_INTEGER                  zeroTimeout    = { 0 };
-
-    // Whether I/O should be cancelled on unsuccessful error code.
-    BOOLEAN cancelOnError = FALSE;
+    FLT_PREOP_CALLBACK_STATUS  callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
+    NTSTATUS                   status         = STATUS_SUCCESS;
+    PLC_STREAM_CONTEXT         context        = NULL;
+    PFLT_FILE_NAME_INFORMATION nameInfo       = NULL;
 
     PAGED_CODE();
 
-    UNREFERENCED_PARAMETER(CompletionContext);
-
-    zeroTimeout = RtlConvertLongToLargeInteger(0);
+    LcRecordCallback(PreReadWriteCallback);
 
-    EventWriteFile_Fetch_Start(NULL);
+    UNREFERENCED_PARAMETER(CompletionContext);
 
     __try
     {
+        // If context is not set for the stream, it should not be fetched.
+        // This check is done first, because most of the files are not LazyCopy files.
+        status = LcGetStreamContext(Data, &context);
+        if (!NT_SUCCESS(status))
+        {
+            status = STATUS_SUCCESS;
+            __leave;
+        }
+
         // Skip, if the trusted process is accessing the file.
         if (LcIsProcessTrusted(PsGetThreadProcessId(Data->Thread)))
         {
             __leave;
         }
 
-        // If context is not set for the stream, it should not be fetched.
-        status = LcGetStreamContext(Data, &context);
-        if (!NT_SUCCESS(status))
+        // Fast I/O cannot be pended, so it should be reissued as the IRP-based operation.
+        if (context->UseCustomHandler && FLT_IS_FASTIO_OPERATION(Data))
         {
-            status = STATUS_SUCCESS;
+            callbackStatus = FLT_PREOP_DISALLOW_FASTIO;
             __leave;
         }
 
         // Get the file name details.
         NT_IF_FAIL_LEAVE(LcGetFileNameInformation(Data, &nameInfo));
 
+        // The worker thread completes the operation, when the file is fetched.
+        // If the operation cannot be pended, the file is fetched synchronously.
+        if (context->UseCustomHandler && NT_SUCCESS(LcPendFetch(Data, FltObjects, nameInfo, context)))
+        {
+            callbackStatus = FLT_PREOP_PENDING;
+            __leave;
+        }
+
+        status = LcFetchFileForOperation(FltObjects, nameInfo, context, FltGetRequestorProcessId(Data), NULL);
+        if (!NT_SUCCESS(status))
+        {
+            // Fail I/O operation.
+            Data->IoStatus.Status      = status;
+            Data->IoStatus.Information = 0;
+            FltSetCallbackDataDirty(Data);
+            callbackStatus             = FLT_PREOP_COMPLETE;
+        }
+    }
+    __finally
+    {
+        if (nameInfo != NULL)
+        {
+            FltReleaseFileNameInformation(nameInfo);
+        }
+
+        if (context != NULL)
+        {
+            FltReleaseContext(context);
+        }
+    }
+
+    return callbackStatus;
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcFetchFileForOperation(
+    _In_     PCFLT_RELATED_OBJECTS      FltObjects,
+    _In_     PFLT_FILE_NAME_INFORMATION NameInfo,
+    _In_     PLC_STREAM_CONTEXT         StreamContext,
+    _In_     ULONG                      ProcessId,
+    _In_opt_ PKEVENT                    CancelEvent
+    )
+/*++
+
+Summary:
+
+    This function fetches the LazyCopy file the read/write operation is performed on.
+
+    It's invoked either by the 'PreReadWriteOperationCallback', or by the worker thread,
+    if the operation is pended.
+
+    The algorightm is simple:
+    1. Try to exclusively lock the file for processing. If the obtained lock is not exclusive, return;
+    2. Check for the reparse tag. If it's not there (file is fetched), return;
+    3. Fetch file;
+    4. Untag it and remove stream context, so it will not be fetched again.
+
+Arguments:
+
+    FltObjects    - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                    opaque handles to this filter, instance, its associated volume and
+                    file object.
+
+    NameInfo      - File name information of the file to be fetched.
+
+    StreamContext - Stream context of the file to be fetched.
+
+    ProcessId     - ID of the process, which operation triggered the fetch.
+
+    CancelEvent   - Event signaled, when the operation is cancelled. Optional.
+
+Return value:
+
+    The status the operation should be failed with, or STATUS_SUCCESS, if it should be processed further.
+
+--*/
+{
+    NTSTATUS                       status         = STATUS_SUCCESS;
+    FILE_ATTRIBUTE_TAG_INFORMATION attributeTag   = { 0 };
+    LARGE_INTEGER                  bytesFetched   = { 0 };
+    PKEVENT                        fileLockEvent  = NULL;
+    PACTIVE_FETCH                  activeFetch    = NULL;
+    LARGE_INTEGER                  zeroTimeout    = { 0 };
+    LONGLONG                       phaseStartTime = 0;
+    GUID                           prevActivityId = { 0 };
+
+    // Whether I/O should be cancelled on unsuccessful error code.
+    BOOLEAN cancelOnError = FALSE;
+
+    // Whether the fetch activity ID is set for the current thread.
+    BOOLEAN activityStarted = FALSE;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(FltObjects    != NULL, STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(NameInfo      != NULL, STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT(StreamContext != NULL, STATUS_INVALID_PARAMETER_3);
+
+    zeroTimeout = RtlConvertLongToLargeInteger(0);
+
+    __try
+    {
+        // All events written from now on are correlated with the new activity ID.
+        activityStarted = LcStartFetchActivity(&prevActivityId);
+        EventWriteFile_Fetch_Start(NULL);
+
         // Get the locking event to synchronize access to the same file.
-        NT_IF_FAIL_LEAVE(LcGetFileLock(&nameInfo->Name, &fileLockEvent));
+        NT_IF_FAIL_LEAVE(LcGetFileLock(&NameInfo->Name, &fileLockEvent));
 
         // If the event is not in the signaled state, we don't need to fetch this file,
         // because another thread, which unset the event, is fetching it.
+        phaseStartTime = LcGetStatisticsTimestamp();
         if (KeWaitForSingleObject(fileLockEvent, Executive, KernelMode, FALSE, &zeroTimeout) != STATUS_SUCCESS)
         {
             // Wait for the file to be fetched.
-            NT_IF_FAIL_LEAVE(KeWaitForSingleObject(fileLockEvent, Executive, KernelMode, FALSE, NULL));
+            status = KeWaitForSingleObject(fileLockEvent, Executive, KernelMode, FALSE, NULL);
+            LcRecordFetchPhase(FetchPhaseLockWait, ProcessId, phaseStartTime, 0, status);
+            NT_IF_FAIL_LEAVE(status);
+
             __leave;
         }
 
         // Skip, if the file is not tagged.
-        NT_IF_FAIL_LEAVE(FltQueryInformationFile(FltObjects->Instance, FltObjects->FileObject, &attributeTag, sizeof(FILE_ATTRIBUTE_TAG_INFORMATION), FileAttributeTagInformation, NULL));
+        phaseStartTime = LcGetStatisticsTimestamp();
+        status         = FltQueryInformationFile(FltObjects->Instance, FltObjects->FileObject, &attributeTag, sizeof(FILE_ATTRIBUTE_TAG_INFORMATION), FileAttributeTagInformation, NULL);
+        LcRecordFetchPhase(FetchPhaseReparseRead, ProcessId, phaseStartTime, 0, status);
+        NT_IF_FAIL_LEAVE(status);
+
         if (attributeTag.ReparseTag != LC_REPARSE_TAG)
         {
             __leave;
@@ -552,48 +936,62 @@ Return value:
         // Set the I/O cancellation on error in the __finally block.
         cancelOnError = TRUE;
 
-        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Fetching file: '%wZ'\n", nameInfo->Name));
-        NT_IF_FAIL_LEAVE(LcFetchRemoteFile(FltObjects, &context->RemoteFilePath, &nameInfo->Name, context->UseCustomHandler, &bytesFetched));
-
-        NT_IF_FAIL_LEAVE(LcUntagFile(FltObjects, &nameInfo->Name));
-        NT_IF_FAIL_LEAVE(FltDeleteStreamContext(FltObjects->Instance, FltObjects->FileObject, NULL));
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Fetching file: '%wZ'\n", NameInfo->Name));
 
-        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_INFO_LEVEL, "[LazyCopy] File fetched: '%wZ' (%lld bytes)\n", nameInfo->Name, bytesFetched.QuadPart));
-        EventWriteFileFetchedEvent(NULL, nameInfo->Name.Buffer, context->RemoteFilePath.Buffer, bytesFetched.QuadPart);
-    }
-    __finally
-    {
-        if (!NT_SUCCESS(status) && cancelOnError)
+        // The file is still fetched, if it can't be registered, only its progress can't be queried then.
+        if (!NT_SUCCESS(LcRegisterActiveFetch(&NameInfo->Name, &StreamContext->RemoteFilePath, StreamContext->RemoteFileSize.QuadPart, StreamContext->UseCustomHandler, fileLockEvent, &activeFetch)))
         {
-            LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "[LazyCopy] Unable to fetch file: '%wZ' %08X\n", nameInfo->Name, status));
-            EventWriteFileNotFetchedEvent(NULL, nameInfo->Name.Buffer, context->RemoteFilePath.Buffer, status);
-
-            // Fail I/O operation.
-            Data->IoStatus.Status      = status;
-            Data->IoStatus.Information = 0;
-            FltSetCallbackDataDirty(Data);
-            callbackStatus             = FLT_PREOP_COMPLETE;
+            activeFetch = NULL;
         }
 
-        if (nameInfo != NULL)
+        phaseStartTime = LcGetStatisticsTimestamp();
+        status         = LcFetchRemoteFile(FltObjects, &StreamContext->RemoteFilePath, &NameInfo->Name, StreamContext->UseCustomHandler, activeFetch, CancelEvent, ProcessId, &bytesFetched);
+        LcRecordFetchPhase(FetchPhaseTotal, ProcessId, phaseStartTime, bytesFetched.QuadPart, status);
+        LcRecordFetchResult(status, bytesFetched.QuadPart);
+
+        if (activeFetch != NULL)
         {
-            FltReleaseFileNameInformation(nameInfo);
+            LcUnregisterActiveFetch(activeFetch);
         }
 
-        if (context != NULL)
+        NT_IF_FAIL_LEAVE(status);
+
+        phaseStartTime = LcGetStatisticsTimestamp();
+        status         = LcUntagFile(FltObjects, &NameInfo->Name);
+        LcRecordFetchPhase(FetchPhaseUntag, ProcessId, phaseStartTime, 0, status);
+        NT_IF_FAIL_LEAVE(status);
+
+        LcRemoveKnownPlaceholder(&NameInfo->Name);
+
+        phaseStartTime = LcGetStatisticsTimestamp();
+        status         = FltDeleteStreamContext(FltObjects->Instance, FltObjects->FileObject, NULL);
+        LcRecordFetchPhase(FetchPhaseContextDelete, ProcessId, phaseStartTime, 0, status);
+        NT_IF_FAIL_LEAVE(status);
+
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_INFO_LEVEL, "[LazyCopy] File fetched: '%wZ' (%lld bytes)\n", NameInfo->Name, bytesFetched.QuadPart));
+        EventWriteFileFetchedEvent(NULL, NameInfo->Name.Buffer, StreamContext->RemoteFilePath.Buffer, bytesFetched.QuadPart);
+    }
+    __finally
+    {
+        if (!NT_SUCCESS(status) && cancelOnError)
         {
-            FltReleaseContext(context);
+            LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "[LazyCopy] Unable to fetch file: '%wZ' %08X\n", NameInfo->Name, status));
+            EventWriteFileNotFetchedEvent(NULL, NameInfo->Name.Buffer, StreamContext->RemoteFilePath.Buffer, status);
         }
 
         if (fileLockEvent != NULL)
         {
             LcReleaseFileLock(fileLockEvent);
         }
-    }
 
-    EventWriteFile_Fetch_Stop(NULL);
+        if (activityStarted)
+        {
+            EventWriteFile_Fetch_Stop(NULL);
+            LcStopFetchActivity(&prevActivityId);
+        }
+    }
 
-    return callbackStatus;
+    return cancelOnError ? status : STATUS_SUCCESS;
 }
 
 //------------------------------------------------------------------------
@@ -613,6 +1011,9 @@ Summary:
     It is needed to fake the file size requests, so the applications that use memory mapping
     will read full file contents.
 
+    The operation is only synchronized for files that have the stream context set, so the
+    queries for the regular files are not affected.
+
     This function does not affect the 'Explorer.exe' process behavior.
 
 Arguments:
@@ -632,11 +1033,13 @@ Return value:
 --*/
 {
     FLT_PREOP_CALLBACK_STATUS callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
+    PLC_STREAM_CONTEXT        context        = NULL;
 
     PAGED_CODE();
 
+    LcRecordCallback(PreQueryInformationCallback);
+
     UNREFERENCED_PARAMETER(FltObjects);
-    UNREFERENCED_PARAMETER(CompletionContext);
 
     __try
     {
@@ -654,13 +1057,29 @@ Return value:
             case FileStandardInformation:
             case FileEndOfFileInformation:
             case FileNetworkOpenInformation:
-                callbackStatus = FLT_PREOP_SYNCHRONIZE;
                 break;
+
+            default:
+                __leave;
+        }
+
+        // If the file is already fetched or it's not a LazyCopy file, the context will not be set.
+        if (!NT_SUCCESS(LcGetStreamContext(Data, &context)))
+        {
+            __leave;
         }
+
+        // Pass the context to the post-operation callback.
+        *CompletionContext = context;
+        context            = NULL;
+        callbackStatus     = FLT_PREOP_SYNCHRONIZE;
     }
     __finally
     {
-        // Do nothing.
+        if (context != NULL)
+        {
+            FltReleaseContext(context);
+        }
     }
 
     return callbackStatus;
@@ -684,6 +1103,8 @@ Summary:
     It modifies file size in the structures returned by the underlying drivers with the data from the
     stream context, so the file will appear as non-empty for the callers.
 
+    The stream context is received from the pre-operation callback, and it's released here.
+
 Parameters:
 
     Data              - Pointer to the filter callback data that is passed to us.
@@ -692,7 +1113,7 @@ Parameters:
                         opaque handles to this filter, instance, its associated volume and
                         file object.
 
-    CompletionContext - The completion context set in the pre-operation function.
+    CompletionContext - The stream context set in the pre-operation function.
 
     Flags             - Denotes whether the completion is successful or is being drained.
 
@@ -702,15 +1123,17 @@ Return Value:
 
 --*/
 {
-    NTSTATUS           status     = STATUS_SUCCESS;
     PVOID              userBuffer = NULL;
     PLC_STREAM_CONTEXT context    = NULL;
 
     PAGED_CODE();
 
+    LcRecordCallback(PostQueryInformationCallback);
+
     UNREFERENCED_PARAMETER(FltObjects);
-    UNREFERENCED_PARAMETER(CompletionContext);
-    UNREFERENCED_PARAMETER(Flags);
+
+    context = (PLC_STREAM_CONTEXT)CompletionContext;
+    IF_FALSE_RETURN_RESULT(context != NULL, FLT_POSTOP_FINISHED_PROCESSING);
 
     __try
     {
@@ -724,8 +1147,6 @@ Return Value:
             __leave;
         }
 
-        // If the file is already fetched, it's size will be greater than zero and context will not be set.
-        NT_IF_FAIL_LEAVE(LcGetStreamContext(Data, &context));
         userBuffer = Data->Iopb->Parameters.QueryFileInformation.InfoBuffer;
 
         // Strip offline attributes and fix the EOF data.
@@ -796,6 +1217,62 @@ Return Value:
 
 //------------------------------------------------------------------------
 
+FLT_PREOP_CALLBACK_STATUS
+PreDirectoryControlOperationCallback(
+    _Inout_                        PFLT_CALLBACK_DATA    Data,
+    _In_                           PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID*                CompletionContext
+    )
+/*++
+
+Summary:
+
+    This function is invoked before the 'IRP_MJ_DIRECTORY_CONTROL' for this minifilter driver.
+
+    Directory enumeration is synchronized, so the post-operation callback is invoked
+    at PASSIVE_LEVEL and is able to open the LazyCopy files to get their remote size.
+
+    Queries on the directories known to contain no LazyCopy files are passed through
+    without the post-operation callback.
+
+Arguments:
+
+    Data              - Pointer to the filter's callback data that is passed to us.
+
+    FltObjects        - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                        opaque handles to this filter, instance, its associated volume and
+                        file object.
+
+    CompletionContext - The context for the completion function for this operation.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    PAGED_CODE();
+
+    LcRecordCallback(PreDirectoryControlCallback);
+
+    *CompletionContext = NULL;
+
+    if (Data->Iopb->MinorFunction != IRP_MN_QUERY_DIRECTORY
+        || LcGetDirectoryEntryLayout(Data->Iopb->Parameters.DirectoryControl.QueryDirectory.FileInformationClass) == NULL)
+    {
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    if (LcIsDirectoryPlaceholderFree(FltObjects))
+    {
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    return FLT_PREOP_SYNCHRONIZE;
+}
+
+//------------------------------------------------------------------------
+
 FLT_PREOP_CALLBACK_STATUS
 PostDirectoryControlOperationCallback(
     _Inout_  PFLT_CALLBACK_DATA       Data,
@@ -810,6 +1287,12 @@ Routine Description:
     This callback is invoked after the user tries to enumerate a directory
     or get change notifications.
 
+    For every LazyCopy file in the directory buffer the 'FILE_ATTRIBUTE_OFFLINE' is
+    removed, and the remote file size is reported instead of the local one.
+
+    If the whole directory was enumerated through the current handle and no LazyCopy
+    files were found, the directory is marked, so its further queries are not processed.
+
 Parameters:
 
     Data              - Pointer to the filter callback data that is passed to us.
@@ -828,22 +1311,84 @@ Return Value:
 
 --*/
 {
-    PVOID buffer = NULL;
+    PVOID                        buffer           = NULL;
+    ULONG                        bufferLength     = 0;
+    PCDIRECTORY_ENTRY_LAYOUT     layout           = NULL;
+    PLC_DIRECTORY_HANDLE_CONTEXT handleContext    = NULL;
+    BOOLEAN                      contextCreated   = FALSE;
+    PUNICODE_STRING              fileNameFilter   = NULL;
+    BOOLEAN                      placeholderFound = FALSE;
 
     PAGED_CODE();
 
-    UNREFERENCED_PARAMETER(FltObjects);
+    LcRecordCallback(PostDirectoryControlCallback);
+
     UNREFERENCED_PARAMETER(CompletionContext);
 
     __try
     {
         if (FlagOn(Flags, FLTFL_POST_OPERATION_DRAINING)
-            || !NT_SUCCESS(Data->IoStatus.Status)
             || Data->Iopb->MinorFunction != IRP_MN_QUERY_DIRECTORY)
         {
             __leave;
         }
 
+        layout = LcGetDirectoryEntryLayout(Data->Iopb->Parameters.DirectoryControl.QueryDirectory.FileInformationClass);
+        if (layout == NULL)
+        {
+            __leave;
+        }
+
+        // Track the enumeration state, so the directory can be marked after it's fully enumerated.
+        if (NT_SUCCESS(LcFindOrCreateDirectoryHandleContext(FltObjects, &handleContext, &contextCreated))
+            && (contextCreated || FlagOn(Data->Iopb->OperationFlags, SL_RESTART_SCAN)))
+        {
+            fileNameFilter = Data->Iopb->Parameters.DirectoryControl.QueryDirectory.FileName;
+
+            // Only the enumerations that return every file in the directory are taken into account.
+            handleContext->ScanEligible     = !FlagOn(Data->Iopb->OperationFlags, SL_INDEX_SPECIFIED)
+                                              && (fileNameFilter == NULL
+                                                  || fileNameFilter->Length == 0
+                                                  || (fileNameFilter->Length == sizeof(WCHAR) && fileNameFilter->Buffer[0] == L'*'));
+            handleContext->PlaceholderFound = FALSE;
+            handleContext->Generation       = LcGetPlaceholderGeneration(FltObjects->Instance);
+        }
+
+        if (Data->IoStatus.Status == STATUS_NO_MORE_FILES)
+        {
+            if (handleContext != NULL
+                && handleContext->ScanEligible
+                && !handleContext->PlaceholderFound
+                && handleContext->Generation != 0)
+            {
+                // The mark is ignored, if the placeholder generation has changed during the enumeration.
+                if (!NT_SUCCESS(LcMarkDirectoryPlaceholderFree(FltObjects, handleContext->Generation)))
+                {
+                    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Unable to mark directory %p as placeholder-free\n", FltObjects->FileObject));
+                }
+
+                handleContext->ScanEligible = FALSE;
+            }
+
+            __leave;
+        }
+
+        if (!NT_SUCCESS(Data->IoStatus.Status))
+        {
+            if (handleContext != NULL)
+            {
+                handleContext->ScanEligible = FALSE;
+            }
+
+            __leave;
+        }
+
+        // Assume there are LazyCopy files in the buffer, until it's examined.
+        placeholderFound = TRUE;
+
+        // Only process the data returned by the file system.
+        bufferLength = (ULONG)min(Data->IoStatus.Information, Data->Iopb->Parameters.DirectoryControl.QueryDirectory.Length);
+
         if (NT_SUCCESS(FltLockUserBuffer(Data)))
         {
             PMDL address = Data->Iopb->Parameters.DirectoryControl.QueryDirectory.MdlAddress;
@@ -878,217 +1423,183 @@ Return Value:
             }
         }
 
-        switch (Data->Iopb->Parameters.DirectoryControl.QueryDirectory.FileInformationClass)
+        __try
+        {
+            placeholderFound = LcProcessDirectoryEntries(Data, FltObjects, buffer, bufferLength, layout);
+        }
+        #pragma warning(suppress: __WARNING_EXCEPTIONEXECUTEHANDLER) // Handle all exceptions.
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            // User buffer became invalid.
+            __leave;
+        }
+    }
+    __finally
+    {
+        if (handleContext != NULL)
         {
-            case FileBothDirectoryInformation:
+            if (placeholderFound)
             {
-                PFILE_BOTH_DIR_INFORMATION fileInfo = (PFILE_BOTH_DIR_INFORMATION)buffer;
+                handleContext->PlaceholderFound = TRUE;
+            }
 
-                for (;;)
-                {
-                    if (!FlagOn(fileInfo->FileAttributes, FILE_ATTRIBUTE_DIRECTORY)
-                        && !FlagOn(fileInfo->FileAttributes, FILE_ATTRIBUTE_SYSTEM)
-                        && (fileInfo->FileAttributes & LC_FILE_ATTRIBUTES) == LC_FILE_ATTRIBUTES)
-                    {
-                        fileInfo->FileAttributes &= ~FILE_ATTRIBUTE_OFFLINE;
-                    }
+            FltReleaseContext(handleContext);
+        }
+    }
 
-                    if (fileInfo->NextEntryOffset != 0)
-                    {
-                        fileInfo = (PFILE_BOTH_DIR_INFORMATION)((UCHAR*)fileInfo + fileInfo->NextEntryOffset);
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
+    return FLT_POSTOP_FINISHED_PROCESSING;
+}
 
-                break;
-            }
-            case FileDirectoryInformation:
-            {
-                PFILE_DIRECTORY_INFORMATION fileInfo = (PFILE_DIRECTORY_INFORMATION)buffer;
+//------------------------------------------------------------------------
 
-                for (;;)
-                {
-                    if (!FlagOn(fileInfo->FileAttributes, FILE_ATTRIBUTE_DIRECTORY)
-                        && !FlagOn(fileInfo->FileAttributes, FILE_ATTRIBUTE_SYSTEM)
-                        && (fileInfo->FileAttributes & LC_FILE_ATTRIBUTES) == LC_FILE_ATTRIBUTES)
-                    {
-                        fileInfo->FileAttributes &= ~FILE_ATTRIBUTE_OFFLINE;
-                    }
+FLT_PREOP_CALLBACK_STATUS
+PreFileSystemControlOperationCallback(
+    _Inout_                        PFLT_CALLBACK_DATA    Data,
+    _In_                           PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID*                CompletionContext
+    )
+/*++
 
-                    if (fileInfo->NextEntryOffset != 0)
-                    {
-                        fileInfo = (PFILE_DIRECTORY_INFORMATION)((UCHAR*)fileInfo + fileInfo->NextEntryOffset);
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
+Summary:
 
-                break;
-            }
-            case FileFullDirectoryInformation:
-            {
-                PFILE_FULL_DIR_INFORMATION fileInfo = (PFILE_FULL_DIR_INFORMATION)buffer;
+    This function is invoked before the 'IRP_MJ_FILE_SYSTEM_CONTROL' for this minifilter driver.
 
-                for (;;)
-                {
-                    if (!FlagOn(fileInfo->FileAttributes, FILE_ATTRIBUTE_DIRECTORY)
-                        && !FlagOn(fileInfo->FileAttributes, FILE_ATTRIBUTE_SYSTEM)
-                        && (fileInfo->FileAttributes & LC_FILE_ATTRIBUTES) == LC_FILE_ATTRIBUTES)
-                    {
-                        fileInfo->FileAttributes &= ~FILE_ATTRIBUTE_OFFLINE;
-                    }
+    If the LazyCopy reparse point is being set, a new LazyCopy file appears in the directory,
+    so the directory contexts on the volume are invalidated.
+    An enumeration that is in progress right now will not mark its directory, and the
+    operation is synchronized, so the contexts are invalidated again once it's completed.
 
-                    if (fileInfo->NextEntryOffset != 0)
-                    {
-                        fileInfo = (PFILE_FULL_DIR_INFORMATION)((UCHAR*)fileInfo + fileInfo->NextEntryOffset);
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
+Arguments:
 
-                break;
-            }
-            case FileIdBothDirectoryInformation:
-            {
-                PFILE_ID_BOTH_DIR_INFORMATION fileInfo = (PFILE_ID_BOTH_DIR_INFORMATION)buffer;
+    Data              - Pointer to the filter's callback data that is passed to us.
 
-                for (;;)
-                {
-                    if (!FlagOn(fileInfo->FileAttributes, FILE_ATTRIBUTE_DIRECTORY)
-                        && !FlagOn(fileInfo->FileAttributes, FILE_ATTRIBUTE_SYSTEM)
-                        && (fileInfo->FileAttributes & LC_FILE_ATTRIBUTES) == LC_FILE_ATTRIBUTES)
-                    {
-                        fileInfo->FileAttributes &= ~FILE_ATTRIBUTE_OFFLINE;
-                    }
+    FltObjects        - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                        opaque handles to this filter, instance, its associated volume and
+                        file object.
 
-                    if (fileInfo->NextEntryOffset != 0)
-                    {
-                        fileInfo = (PFILE_ID_BOTH_DIR_INFORMATION)((UCHAR*)fileInfo + fileInfo->NextEntryOffset);
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
+    CompletionContext - The context for the completion function for this operation.
 
-                break;
-            }
-            case FileIdFullDirectoryInformation:
-            {
-                PFILE_ID_FULL_DIR_INFORMATION fileInfo = (PFILE_ID_FULL_DIR_INFORMATION)buffer;
+Return value:
 
-                for (;;)
-                {
-                    if (!FlagOn(fileInfo->FileAttributes, FILE_ATTRIBUTE_DIRECTORY)
-                        && !FlagOn(fileInfo->FileAttributes, FILE_ATTRIBUTE_SYSTEM)
-                        && (fileInfo->FileAttributes & LC_FILE_ATTRIBUTES) == LC_FILE_ATTRIBUTES)
-                    {
-                        fileInfo->FileAttributes &= ~FILE_ATTRIBUTE_OFFLINE;
-                    }
+    The return value is the status of the operation.
 
-                    if (fileInfo->NextEntryOffset != 0)
-                    {
-                        fileInfo = (PFILE_ID_FULL_DIR_INFORMATION)((UCHAR*)fileInfo + fileInfo->NextEntryOffset);
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
+--*/
+{
+    PVOID buffer       = NULL;
+    ULONG bufferLength = 0;
 
-                break;
-            }
-        }
+    PAGED_CODE();
+
+    LcRecordCallback(PreFileSystemControlCallback);
+
+    *CompletionContext = NULL;
+
+    if ((Data->Iopb->MinorFunction != IRP_MN_USER_FS_REQUEST && Data->Iopb->MinorFunction != IRP_MN_KERNEL_CALL)
+        || Data->Iopb->Parameters.FileSystemControl.Common.FsControlCode != FSCTL_SET_REPARSE_POINT)
+    {
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
     }
-    __finally
+
+    // 'FSCTL_SET_REPARSE_POINT' is a buffered request, so the system buffer is safe to read.
+    buffer       = Data->Iopb->Parameters.FileSystemControl.Buffered.SystemBuffer;
+    bufferLength = Data->Iopb->Parameters.FileSystemControl.Buffered.InputBufferLength;
+
+    if (buffer == NULL || bufferLength < sizeof(ULONG) || *(PULONG)buffer != LC_REPARSE_TAG)
     {
-        // Do nothing.
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
     }
 
-    return FLT_POSTOP_FINISHED_PROCESSING;
+    LcInvalidateDirectoryContexts(FltObjects->Instance);
+
+    return FLT_PREOP_SYNCHRONIZE;
 }
 
-//------------------------------------------------------------------------
-//  Local functions.
 //------------------------------------------------------------------------
 
-static
-VOID
-LcEtwFileAccessed(
-    _In_ ULONG            ReportRate,
-    _In_ PCUNICODE_STRING Path,
-    _In_ ULONG            CreateOptions
+FLT_POSTOP_CALLBACK_STATUS
+PostFileSystemControlOperationCallback(
+    _Inout_  PFLT_CALLBACK_DATA       Data,
+    _In_     PCFLT_RELATED_OBJECTS    FltObjects,
+    _In_opt_ PVOID                    CompletionContext,
+    _In_     FLT_POST_OPERATION_FLAGS Flags
     )
 /*++
 
 Summary:
 
-    Raises a new 'FileAccessed' ETW event based on the current report rate value.
+    This function is invoked after the 'IRP_MJ_FILE_SYSTEM_CONTROL' was processed by the low-level drivers.
 
-Arguments:
+    It's only called for the operations that set the LazyCopy reparse point, and the directory contexts
+    are invalidated again, if the operation succeeded.
+    Otherwise, a directory enumeration that started after the pre-operation callback
+    might complete before the file appears, and the directory would be marked as the one
+    without LazyCopy files.
 
-    ReportRate    - Report rate for the path given.
+    The operation is synchronized, so this function is called at the passive level.
 
-    Path          - File path.
+Parameters:
 
-    CreateOptions - File create options.
+    Data              - Pointer to the filter callback data that is passed to us.
 
-Return value:
+    FltObjects        - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                        opaque handles to this filter, instance, its associated volume and
+                        file object.
 
-    None.
+    CompletionContext - The context set in the pre-operation function. Not used.
+
+    Flags             - Denotes whether the completion is successful or is being drained.
+
+Return Value:
+
+    The return value is the status of the operation.
 
 --*/
 {
-    // Factor to be used to normalize the report rate value to the MAXLONG interval.
-    static const ULONG rateFactor = (MAXLONG - 1) / MAX_REPORT_RATE;
-
     PAGED_CODE();
 
-    IF_FALSE_RETURN(Path != NULL);
+    LcRecordCallback(PostFileSystemControlCallback);
 
-    if (ReportRate == 0)
-    {
-        return;
-    }
+    UNREFERENCED_PARAMETER(CompletionContext);
 
-    // Determine whether the event should be sent.
-    if (ReportRate >= MAX_REPORT_RATE
-        || RtlRandomEx(&LC_RANDOM_SEED) < (ReportRate * rateFactor))
+    if (!FlagOn(Flags, FLTFL_POST_OPERATION_DRAINING) && NT_SUCCESS(Data->IoStatus.Status))
     {
-        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] File accessed: '%wZ'\n", Path));
-        EventWriteFileAccessedEvent(NULL, Path->Buffer, CreateOptions);
+        LcInvalidateDirectoryContexts(FltObjects->Instance);
     }
+
+    return FLT_POSTOP_FINISHED_PROCESSING;
 }
 
 //------------------------------------------------------------------------
 
-static
-_Check_return_
-NTSTATUS
-LcGetFileNameInformation(
-    _Inout_  PFLT_CALLBACK_DATA          Data,
-    _Outptr_ PFLT_FILE_NAME_INFORMATION* NameInformation
+FLT_PREOP_CALLBACK_STATUS
+PreSetInformationOperationCallback(
+    _Inout_                        PFLT_CALLBACK_DATA    Data,
+    _In_                           PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID*                CompletionContext
     )
 /*++
 
 Summary:
 
-    This function gets the name information used to open the current file.
+    This function is invoked before the 'IRP_MJ_SET_INFORMATION' for this minifilter driver.
+
+    If a LazyCopy file is being renamed or linked, it might appear in the directory that
+    is marked as the one without LazyCopy files, so the directory contexts on the volume
+    are invalidated.
+    If a directory is being renamed, the LazyCopy files in it get new names, which might
+    be in the negative cache, so it's invalidated the same way.
+    An enumeration that is in progress right now will not mark its directory, and the
+    operation is synchronized, so the contexts are invalidated again once it's completed.
 
 Arguments:
 
-    Data            - A pointer to the callback data structure for the I/O operation.
+    Data              - Pointer to the filter's callback data that is passed to us.
 
-    NameInformation - A pointer to a caller-allocated variable that receives the
-                      address of a system-allocated FLT_FILE_NAME_INFORMATION structure
-                      containing the file name information.
+    FltObjects        - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                        opaque handles to this filter, instance, its associated volume and
+                        file object.
+
+    CompletionContext - The context for the completion function for this operation.
 
 Return value:
 
@@ -1096,23 +1607,339 @@ Return value:
 
 --*/
 {
-    NTSTATUS                   status   = STATUS_SUCCESS;
-    PFLT_FILE_NAME_INFORMATION nameInfo = NULL;
+    FILE_ATTRIBUTE_TAG_INFORMATION tagInformation = { 0 };
 
     PAGED_CODE();
 
-    IF_FALSE_RETURN_RESULT(Data            != NULL, STATUS_INVALID_PARAMETER_1);
-    IF_FALSE_RETURN_RESULT(NameInformation != NULL, STATUS_INVALID_PARAMETER_2);
+    LcRecordCallback(PreSetInformationCallback);
 
-    *NameInformation = NULL;
+    *CompletionContext = NULL;
 
-    __try
+    switch (Data->Iopb->Parameters.SetFileInformation.FileInformationClass)
     {
-        if (FlagOn(Data->Iopb->OperationFlags, SL_OPEN_TARGET_DIRECTORY))
-        {
-            // The SL_OPEN_TARGET_DIRECTORY flag indicates the caller is attempting
-            // to open the target of a rename or hard link creation operation. We
-            // must clear this flag when asking fltmgr for the name or the result
+        case FileRenameInformation:
+        case FileLinkInformation:
+#if (NTDDI_VERSION >= NTDDI_WIN10_RS1)
+        case FileRenameInformationEx:
+        case FileLinkInformationEx:
+#endif // NTDDI_WIN10_RS1
+            break;
+
+        default:
+            return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    if (!NT_SUCCESS(FltQueryInformationFile(FltObjects->Instance, FltObjects->FileObject, &tagInformation, sizeof(tagInformation), FileAttributeTagInformation, NULL))
+        || (tagInformation.ReparseTag != LC_REPARSE_TAG && !FlagOn(tagInformation.FileAttributes, FILE_ATTRIBUTE_DIRECTORY)))
+    {
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    LcInvalidateDirectoryContexts(FltObjects->Instance);
+
+    return FLT_PREOP_SYNCHRONIZE;
+}
+
+//------------------------------------------------------------------------
+
+FLT_POSTOP_CALLBACK_STATUS
+PostSetInformationOperationCallback(
+    _Inout_  PFLT_CALLBACK_DATA       Data,
+    _In_     PCFLT_RELATED_OBJECTS    FltObjects,
+    _In_opt_ PVOID                    CompletionContext,
+    _In_     FLT_POST_OPERATION_FLAGS Flags
+    )
+/*++
+
+Summary:
+
+    This function is invoked after the 'IRP_MJ_SET_INFORMATION' was processed by the low-level drivers.
+
+    It's only called for the operations that rename or link a LazyCopy file or rename a directory,
+    and the directory contexts are invalidated again, if the operation succeeded.
+    Otherwise, a directory enumeration that started after the pre-operation callback
+    might complete before the file appears, and the directory would be marked as the one
+    without LazyCopy files.
+
+    The operation is synchronized, so this function is called at the passive level.
+
+Parameters:
+
+    Data              - Pointer to the filter callback data that is passed to us.
+
+    FltObjects        - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                        opaque handles to this filter, instance, its associated volume and
+                        file object.
+
+    CompletionContext - The context set in the pre-operation function. Not used.
+
+    Flags             - Denotes whether the completion is successful or is being drained.
+
+Return Value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    PAGED_CODE();
+
+    LcRecordCallback(PostSetInformationCallback);
+
+    UNREFERENCED_PARAMETER(CompletionContext);
+
+    if (!FlagOn(Flags, FLTFL_POST_OPERATION_DRAINING) && NT_SUCCESS(Data->IoStatus.Status))
+    {
+        LcInvalidateDirectoryContexts(FltObjects->Instance);
+    }
+
+    return FLT_POSTOP_FINISHED_PROCESSING;
+}
+
+//------------------------------------------------------------------------
+//  Local functions.
+//------------------------------------------------------------------------
+
+static
+VOID
+LcReportFileAccess(
+    _In_ ULONG                 ReportRate,
+    _In_ DRIVER_OPERATION_MODE OperationMode,
+    _In_ PCUNICODE_STRING      Path,
+    _In_ ULONG                 CreateOptions
+    )
+/*++
+
+Summary:
+
+    Reports the file access based on the current report rate value.
+
+    If the 'AggregateAccesses' mode is set, the access is counted in the access table,
+    otherwise a new 'FileAccessed' ETW event is raised.
+
+Arguments:
+
+    ReportRate    - Report rate for the path given.
+
+    OperationMode - Current operation mode. If the 'SampleByPath' is set, the access is
+                    sampled by the 'Path' hash instead of the pseudo-random value, so
+                    the same files are always reported.
+
+    Path          - File path.
+
+    CreateOptions - File create options.
+
+Return value:
+
+    None.
+
+--*/
+{
+    ULONGLONG value = 0;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN(Path != NULL);
+
+    if (ReportRate == 0)
+    {
+        return;
+    }
+
+    value = FlagOn(OperationMode, SampleByPath) ? LcHashSamplerPath(Path) : LcGetNextSamplerValue();
+
+    // Determine whether the access should be reported.
+    if (ReportRate < MAX_REPORT_RATE
+        && value % MAX_REPORT_RATE >= ReportRate)
+    {
+        return;
+    }
+
+    LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] File accessed: '%wZ'\n", Path));
+
+    if (FlagOn(OperationMode, AggregateAccesses))
+    {
+        LcRecordFileAccess(Path);
+    }
+    else
+    {
+        EventWriteFileAccessedEvent(NULL, Path->Buffer, CreateOptions);
+    }
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+ULONGLONG
+LcGetNextSamplerValue()
+/*++
+
+Summary:
+
+    This function returns the next pseudo-random value from the generator that belongs
+    to the current processor.
+
+    The SplitMix64 generator is used. Its state is updated without interlocked operations,
+    so the processors don't contend for the same cache line. If the thread is moved to another
+    processor in the middle of the update, one value might be returned twice, which is fine
+    for the sampling purposes.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    Pseudo-random value.
+
+--*/
+{
+    PSAMPLER_STATE sampler = NULL;
+    ULONGLONG      value   = 0;
+
+    PAGED_CODE();
+
+#if PLATFORM_WIN7
+    sampler = &SamplerStates[KeGetCurrentProcessorNumberEx(NULL) % SAMPLER_SLOTS];
+#else
+    sampler = &SamplerStates[KeGetCurrentProcessorNumber() % SAMPLER_SLOTS];
+#endif // PLATFORM_WIN7
+
+    value = sampler->State;
+
+    // Generators are seeded on the first use, so they produce different sequences.
+    if (value == 0)
+    {
+        value = ((ULONGLONG)LC_RANDOM_SEED << 32) ^ (ULONGLONG)KeQueryPerformanceCounter(NULL).QuadPart ^ (ULONGLONG)(ULONG_PTR)sampler;
+    }
+
+    value         += 0x9E3779B97F4A7C15ULL;
+    sampler->State = value;
+
+    return LcMixSamplerValue(value);
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+ULONGLONG
+LcHashSamplerPath(
+    _In_ PCUNICODE_STRING Path
+    )
+/*++
+
+Summary:
+
+    This function calculates the case-insensitive hash of the 'Path' given.
+
+    The hash doesn't depend on the driver state, so the same files are sampled
+    on every run and on every machine.
+
+Arguments:
+
+    Path - Path to calculate the hash for.
+
+Return value:
+
+    Path hash.
+
+--*/
+{
+    ULONGLONG hash   = 0xCBF29CE484222325ULL;
+    USHORT    length = Path->Length / sizeof(WCHAR);
+    USHORT    idx    = 0;
+
+    PAGED_CODE();
+
+    // FNV-1a is used to combine the characters.
+    for (idx = 0; idx < length; idx++)
+    {
+        hash ^= RtlUpcaseUnicodeChar(Path->Buffer[idx]);
+        hash *= 0x100000001B3ULL;
+    }
+
+    return LcMixSamplerValue(hash);
+}
+
+//------------------------------------------------------------------------
+
+static
+ULONGLONG
+LcMixSamplerValue(
+    _In_ ULONGLONG Value
+    )
+/*++
+
+Summary:
+
+    This function mixes the bits of the 'Value' given, so all of them affect
+    the lower bits of the result.
+
+Arguments:
+
+    Value - Value to mix.
+
+Return value:
+
+    Mixed value.
+
+--*/
+{
+    PAGED_CODE();
+
+    Value = (Value ^ (Value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    Value = (Value ^ (Value >> 27)) * 0x94D049BB133111EBULL;
+
+    return Value ^ (Value >> 31);
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcGetFileNameInformation(
+    _Inout_  PFLT_CALLBACK_DATA          Data,
+    _Outptr_ PFLT_FILE_NAME_INFORMATION* NameInformation
+    )
+/*++
+
+Summary:
+
+    This function gets the name information used to open the current file.
+
+Arguments:
+
+    Data            - A pointer to the callback data structure for the I/O operation.
+
+    NameInformation - A pointer to a caller-allocated variable that receives the
+                      address of a system-allocated FLT_FILE_NAME_INFORMATION structure
+                      containing the file name information.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS                   status   = STATUS_SUCCESS;
+    PFLT_FILE_NAME_INFORMATION nameInfo = NULL;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Data            != NULL, STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(NameInformation != NULL, STATUS_INVALID_PARAMETER_2);
+
+    *NameInformation = NULL;
+
+    __try
+    {
+        if (FlagOn(Data->Iopb->OperationFlags, SL_OPEN_TARGET_DIRECTORY))
+        {
+            // The SL_OPEN_TARGET_DIRECTORY flag indicates the caller is attempting
+            // to open the target of a rename or hard link creation operation. We
+            // must clear this flag when asking fltmgr for the name or the result
             // will not include the final component.
             ClearFlag(Data->Iopb->OperationFlags, SL_OPEN_TARGET_DIRECTORY);
 
@@ -1162,3 +1989,334 @@ Return value:
 
     return status;
 }
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+BOOLEAN
+LcIsDefaultStream(
+    _In_ PFLT_FILE_NAME_INFORMATION NameInformation
+    )
+/*++
+
+Summary:
+
+    This function checks whether the default data stream is being opened.
+
+Arguments:
+
+    NameInformation - File name information for the current open operation.
+
+Return value:
+
+    Whether the default data stream is being opened.
+
+--*/
+{
+    UNICODE_STRING dataStreamName = CONSTANT_STRING(L"::$DATA");
+
+    PAGED_CODE();
+
+    FLT_ASSERT(NameInformation != NULL);
+
+    if (NameInformation->Stream.Length == 0)
+    {
+        return TRUE;
+    }
+
+    // It is possible to open the default data stream and yet
+    // still have a stream name. This is done by appending
+    // '::$DATA' to the end of the file name. So if that is the
+    // name of our stream, this is really the default stream.
+    // Otherwise, it is an alternate stream.
+    return RtlCompareUnicodeString(&NameInformation->Stream, &dataStreamName, TRUE) == 0;
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+PCDIRECTORY_ENTRY_LAYOUT
+LcGetDirectoryEntryLayout(
+    _In_ FILE_INFORMATION_CLASS InformationClass
+    )
+/*++
+
+Summary:
+
+    This function returns the directory entry layout for the information class given.
+
+Arguments:
+
+    InformationClass - Directory information class.
+
+Return value:
+
+    Pointer to the layout, or NULL, if the entries of this class do not contain
+    the file size and attributes.
+
+--*/
+{
+    ULONG idx = 0;
+
+    PAGED_CODE();
+
+    for (idx = 0; idx < ARRAYSIZE(DirectoryEntryLayouts); idx++)
+    {
+        if (DirectoryEntryLayouts[idx].InformationClass == InformationClass)
+        {
+            return &DirectoryEntryLayouts[idx];
+        }
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+static
+BOOLEAN
+LcProcessDirectoryEntries(
+    _In_                                PFLT_CALLBACK_DATA       Data,
+    _In_                                PCFLT_RELATED_OBJECTS    FltObjects,
+    _Inout_updates_bytes_(BufferLength) PVOID                    Buffer,
+    _In_                                ULONG                    BufferLength,
+    _In_                                PCDIRECTORY_ENTRY_LAYOUT Layout
+    )
+/*++
+
+Summary:
+
+    This function walks through the directory entries in the 'Buffer' and updates
+    the ones that belong to the LazyCopy files.
+
+    The 'FILE_ATTRIBUTE_OFFLINE' is removed, and the 'EndOfFile' and 'AllocationSize'
+    are set to the remote file size. Remote file sizes are taken from the directory cache,
+    so the LazyCopy file is only opened, if it's not cached or was changed since then.
+
+    The name of the directory is only queried, if there is at least one LazyCopy file
+    in the buffer.
+
+    The caller is responsible for handling exceptions, if the 'Buffer' is a user buffer.
+
+Arguments:
+
+    Data         - Pointer to the filter callback data that is passed to us.
+
+    FltObjects   - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                   opaque handles to this filter, instance, its associated volume and
+                   file object.
+
+    Buffer       - Buffer containing directory entries.
+
+    BufferLength - Size, in bytes, of the meaningful data in the 'Buffer'.
+
+    Layout       - Layout of the directory entries in the 'Buffer'.
+
+Return value:
+
+    TRUE, if the 'Buffer' contains entries that might belong to the LazyCopy files;
+    otherwise, FALSE.
+
+--*/
+{
+    BOOLEAN                    placeholderFound     = FALSE;
+    ULONG                      offset               = 0;
+    ULONG                      nextEntryOffset      = 0;
+    PUCHAR                     entry                = NULL;
+    PULONG                     fileAttributes       = NULL;
+    PLARGE_INTEGER             endOfFile            = NULL;
+    ULONG                      fileNameLength       = 0;
+    UNICODE_STRING             fileName             = { 0 };
+    LARGE_INTEGER              remoteFileSize       = { 0 };
+    PFLT_FILE_NAME_INFORMATION directoryNameInfo    = NULL;
+    BOOLEAN                    directoryNameQueried = FALSE;
+    VOLUME_TUNING              tuning               = { 0 };
+    ULONG                      sectorSize           = 0;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(Data       != NULL);
+    FLT_ASSERT(FltObjects != NULL);
+    FLT_ASSERT(Layout     != NULL);
+
+    IF_FALSE_RETURN_RESULT(Buffer != NULL, FALSE);
+
+    __try
+    {
+        // Every entry should at least contain all fixed-size fields.
+        while (BufferLength >= Layout->FileNameOffset && offset <= BufferLength - Layout->FileNameOffset)
+        {
+            entry           = (PUCHAR)Buffer + offset;
+            nextEntryOffset = *(PULONG)entry;
+            fileAttributes  = (PULONG)(entry + Layout->FileAttributesOffset);
+
+            // Any file with the LazyCopy reparse tag might become visible as a LazyCopy file later,
+            // so the directory should not be marked as the one without them.
+            if (!FlagOn(*fileAttributes, FILE_ATTRIBUTE_DIRECTORY)
+                && FlagOn(*fileAttributes, FILE_ATTRIBUTE_REPARSE_POINT)
+                && (Layout->ReparseTagOffset == 0 || *(PULONG)(entry + Layout->ReparseTagOffset) == LC_REPARSE_TAG))
+            {
+                placeholderFound = TRUE;
+            }
+
+            if (!FlagOn(*fileAttributes, FILE_ATTRIBUTE_DIRECTORY)
+                && !FlagOn(*fileAttributes, FILE_ATTRIBUTE_SYSTEM)
+                && (*fileAttributes & LC_FILE_ATTRIBUTES) == LC_FILE_ATTRIBUTES
+                && (Layout->ReparseTagOffset == 0 || *(PULONG)(entry + Layout->ReparseTagOffset) == LC_REPARSE_TAG))
+            {
+                ClearFlag(*fileAttributes, FILE_ATTRIBUTE_OFFLINE);
+
+                // LazyCopy files don't have any local content, until they are fetched.
+                endOfFile      = (PLARGE_INTEGER)(entry + Layout->EndOfFileOffset);
+                fileNameLength = *(PULONG)(entry + Layout->FileNameLengthOffset);
+
+                if (endOfFile->QuadPart == 0
+                    && fileNameLength > 0
+                    && fileNameLength <= MAXUSHORT
+                    && fileNameLength <= BufferLength - offset - Layout->FileNameOffset)
+                {
+                    if (!directoryNameQueried)
+                    {
+                        directoryNameQueried = TRUE;
+
+                        if (!NT_SUCCESS(FltGetFileNameInformation(Data, FLT_FILE_NAME_NORMALIZED | FLT_FILE_NAME_QUERY_DEFAULT, &directoryNameInfo)))
+                        {
+                            directoryNameInfo = NULL;
+                        }
+
+                        LcGetInstanceTuning(FltObjects->Instance, &tuning, &sectorSize);
+                    }
+
+                    fileName.Buffer        = (PWCH)(entry + Layout->FileNameOffset);
+                    fileName.Length        = (USHORT)fileNameLength;
+                    fileName.MaximumLength = (USHORT)fileNameLength;
+
+                    if (directoryNameInfo != NULL
+                        && NT_SUCCESS(LcGetDirectoryEntryRemoteFileSize(
+                            FltObjects,
+                            &directoryNameInfo->Name,
+                            &fileName,
+                            (PLARGE_INTEGER)(entry + Layout->ChangeTimeOffset),
+                            &remoteFileSize)))
+                    {
+                        *endOfFile = remoteFileSize;
+
+                        // Report the space the file will occupy, after it's fetched.
+                        ((PLARGE_INTEGER)(entry + Layout->AllocationSizeOffset))->QuadPart = sectorSize != 0
+                            ? (remoteFileSize.QuadPart + sectorSize - 1) / sectorSize * sectorSize
+                            : remoteFileSize.QuadPart;
+                    }
+                }
+            }
+
+            // Make sure the next entry is within the buffer.
+            if (nextEntryOffset == 0 || nextEntryOffset > BufferLength - offset)
+            {
+                break;
+            }
+
+            offset += nextEntryOffset;
+        }
+    }
+    __finally
+    {
+        if (directoryNameInfo != NULL)
+        {
+            FltReleaseFileNameInformation(directoryNameInfo);
+        }
+    }
+
+    return placeholderFound;
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcGetDirectoryEntryRemoteFileSize(
+    _In_  PCFLT_RELATED_OBJECTS FltObjects,
+    _In_  PCUNICODE_STRING      DirectoryName,
+    _In_  PCUNICODE_STRING      FileName,
+    _In_  PLARGE_INTEGER        ChangeTime,
+    _Out_ PLARGE_INTEGER        RemoteFileSize
+    )
+/*++
+
+Summary:
+
+    This function gets the remote file size for the LazyCopy file in the directory given.
+
+    If the file is not in the directory cache, or its 'ChangeTime' differs from the cached one,
+    the file is opened to get the size from its reparse point, and the cache is updated.
+
+Arguments:
+
+    FltObjects     - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                     opaque handles to this filter, instance, its associated volume and
+                     file object.
+
+    DirectoryName  - Full path to the parent directory.
+
+    FileName       - Name of the file without the parent directory path.
+
+    ChangeTime     - Change time of the file reported by the file system.
+
+    RemoteFileSize - Receives the size of the remote file.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS       status   = STATUS_SUCCESS;
+    UNICODE_STRING fullName = { 0 };
+    ULONG          length   = 0;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(FltObjects     != NULL);
+    FLT_ASSERT(DirectoryName  != NULL);
+    FLT_ASSERT(FileName       != NULL);
+    FLT_ASSERT(ChangeTime     != NULL);
+    FLT_ASSERT(RemoteFileSize != NULL);
+
+    if (LcGetCachedFileMetadata(DirectoryName, FileName, ChangeTime, RemoteFileSize))
+    {
+        return STATUS_SUCCESS;
+    }
+
+    __try
+    {
+        // Root directory name already ends with the path separator.
+        length = DirectoryName->Length + sizeof(WCHAR) + FileName->Length;
+        NT_IF_FALSE_LEAVE(length <= MAXUSHORT, STATUS_NAME_TOO_LONG);
+
+        NT_IF_FAIL_LEAVE(LcAllocateUnicodeString(&fullName, (USHORT)length));
+        RtlCopyUnicodeString(&fullName, DirectoryName);
+
+        if (fullName.Length == 0 || fullName.Buffer[fullName.Length / sizeof(WCHAR) - 1] != OBJ_NAME_PATH_SEPARATOR)
+        {
+            NT_IF_FAIL_LEAVE(RtlAppendUnicodeToString(&fullName, L"\\"));
+        }
+
+        NT_IF_FAIL_LEAVE(RtlAppendUnicodeStringToString(&fullName, FileName));
+
+        NT_IF_FAIL_LEAVE(LcGetRemoteFileSize(FltObjects->Filter, FltObjects->Instance, &fullName, RemoteFileSize));
+
+        // It's not critical, if the file metadata cannot be cached.
+        LcCacheFileMetadata(DirectoryName, FileName, ChangeTime, RemoteFileSize);
+    }
+    __finally
+    {
+        if (fullName.Buffer != NULL)
+        {
+            LcFreeUnicodeString(&fullName);
+        }
+    }
+
+    return status;
+}
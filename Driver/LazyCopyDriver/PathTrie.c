@@ -0,0 +1,731 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    PathTrie.c
+
+Abstract:
+
+    Contains the compiled prefix trie used to match file paths against
+    the list of paths to watch.
+
+    Paths are case-folded and compiled into a radix trie, which is stored
+    in a single buffer and is never modified after it's created. Matching
+    a path takes time proportional to its length, regardless of the amount
+    of paths compiled.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "PathTrie.h"
+#include "Utilities.h"
+
+//------------------------------------------------------------------------
+//  Defines.
+//------------------------------------------------------------------------
+
+// Maximum amount of paths that can be compiled into a single trie.
+#define MAX_PATH_TRIE_PATHS 0x1000000
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+//
+// Compiled trie node.
+//
+typedef struct _PATH_TRIE_NODE
+{
+    // Offset, in characters, of the edge label in the 'PATH_TRIE.Labels'.
+    ULONG   LabelOffset;
+
+    // Length, in characters, of the edge label leading to this node.
+    USHORT  LabelLength;
+
+    // Whether one of the compiled paths ends at this node.
+    BOOLEAN Terminal;
+
+    // Child nodes are stored contiguously and are sorted by the first label character.
+    ULONG   FirstChild;
+    ULONG   ChildCount;
+
+    // Indices of the paths ending at this node, stored in the 'PATH_TRIE.Values'.
+    ULONG   FirstValue;
+    ULONG   ValueCount;
+
+    // The closest terminal parent node.
+    // Zero, if there is none, because the root node is never terminal.
+    ULONG   TerminalParent;
+} PATH_TRIE_NODE, *PPATH_TRIE_NODE;
+
+//
+// Compiled trie. Nodes and labels follow this structure in the same buffer.
+//
+struct _PATH_TRIE
+{
+    // The trie is shared by the configuration snapshots.
+    __volatile LONG ReferenceCount;
+
+    ULONG           NodeCount;
+
+    // The first node is the root one.
+    PPATH_TRIE_NODE Nodes;
+
+    // Path indices referenced by the terminal nodes.
+    PULONG          Values;
+
+    // Case-folded edge labels.
+    PWCHAR          Labels;
+};
+
+//
+// Case-folded path used during the trie compilation.
+//
+typedef struct _PATH_TRIE_KEY
+{
+    PWCHAR Buffer;
+
+    // Length, in characters.
+    ULONG  Length;
+
+    // Index of the path in the array given to the 'LcCreatePathTrie'.
+    ULONG  Index;
+} PATH_TRIE_KEY, *PPATH_TRIE_KEY;
+
+//
+// Range of the sorted keys that belong to the trie node being compiled.
+//
+typedef struct _PATH_TRIE_RANGE
+{
+    ULONG First;
+    ULONG Last;
+
+    // Amount of characters matched by the node and all its parents.
+    ULONG Depth;
+} PATH_TRIE_RANGE, *PPATH_TRIE_RANGE;
+
+//------------------------------------------------------------------------
+//  Local functions.
+//------------------------------------------------------------------------
+
+static
+LONG
+LcComparePathTrieKeys(
+    _In_ PPATH_TRIE_KEY First,
+    _In_ PPATH_TRIE_KEY Second
+    );
+
+static
+VOID
+LcSortPathTrieKeys(
+    _Inout_updates_(Count) PPATH_TRIE_KEY Keys,
+    _In_                   ULONG          Count
+    );
+
+//------------------------------------------------------------------------
+//  Text sections.
+//------------------------------------------------------------------------
+
+#ifdef ALLOC_PRAGMA
+    #pragma alloc_text(PAGE, LcCreatePathTrie)
+    #pragma alloc_text(PAGE, LcReferencePathTrie)
+    #pragma alloc_text(PAGE, LcReleasePathTrie)
+    #pragma alloc_text(PAGE, LcMatchPathTrie)
+
+    // Local functions.
+    #pragma alloc_text(PAGE, LcComparePathTrieKeys)
+    #pragma alloc_text(PAGE, LcSortPathTrieKeys)
+#endif // ALLOC_PRAGMA
+
+//------------------------------------------------------------------------
+//  Path trie functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcCreatePathTrie(
+    _In_reads_(PathCount) PCUNICODE_STRING* Paths,
+    _In_                  ULONG             PathCount,
+    _Outptr_              PPATH_TRIE*       Trie
+    )
+/*++
+
+Summary:
+
+    This function compiles the 'Paths' given into a new case-insensitive prefix trie.
+
+    Paths are case-folded and sorted first, so the nodes can be built level by level
+    without recursion. Every group of paths sharing the same character at the current
+    depth becomes a child node labelled with their longest common prefix.
+
+    Nested and duplicate paths are kept, so the 'LcMatchPathTrie' can report all of them.
+
+    The trie returned has a single reference, which should be released with the 'LcReleasePathTrie'.
+
+Arguments:
+
+    Paths     - Array of the paths to compile. Paths are not referenced after this function returns.
+
+    PathCount - Amount of elements in the 'Paths' array.
+
+    Trie      - Receives the trie compiled.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS         status        = STATUS_SUCCESS;
+    ULONGLONG        totalLength   = 0;
+    PWCHAR           characters    = NULL;
+    PPATH_TRIE_KEY   keys          = NULL;
+    PPATH_TRIE_NODE  nodes         = NULL;
+    PPATH_TRIE_RANGE ranges        = NULL;
+    PULONG           values        = NULL;
+    PPATH_TRIE       trie          = NULL;
+    ULONG            maxNodeCount  = 0;
+    ULONG            nodeCount     = 1;
+    ULONG            valueCount    = 0;
+    ULONG            labelLength   = 0;
+    ULONG            position      = 0;
+    ULONG            idx           = 0;
+    ULONG            charIdx       = 0;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Paths != NULL,                                     STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(PathCount > 0 && PathCount <= MAX_PATH_TRIE_PATHS, STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT(Trie != NULL,                                      STATUS_INVALID_PARAMETER_3);
+
+    *Trie = NULL;
+
+    // Each path adds at most one leaf and one branching node.
+    maxNodeCount = PathCount * 2 + 1;
+
+    __try
+    {
+        for (idx = 0; idx < PathCount; idx++)
+        {
+            NT_IF_FALSE_LEAVE(Paths[idx] != NULL && Paths[idx]->Buffer != NULL && Paths[idx]->Length >= sizeof(WCHAR), STATUS_INVALID_PARAMETER_1);
+            totalLength += Paths[idx]->Length / sizeof(WCHAR);
+        }
+
+        NT_IF_FALSE_LEAVE(totalLength <= MAXULONG / sizeof(WCHAR), STATUS_INVALID_PARAMETER_1);
+
+        NT_IF_FAIL_LEAVE(LcAllocateBuffer((PVOID*)&characters, PagedPool, (SIZE_T)totalLength * sizeof(WCHAR),      LC_BUFFER_PAGED_POOL_TAG));
+        NT_IF_FAIL_LEAVE(LcAllocateBuffer((PVOID*)&keys,       PagedPool, (SIZE_T)PathCount * sizeof(PATH_TRIE_KEY), LC_BUFFER_PAGED_POOL_TAG));
+        NT_IF_FAIL_LEAVE(LcAllocateBuffer((PVOID*)&nodes,      PagedPool, (SIZE_T)maxNodeCount * sizeof(PATH_TRIE_NODE),  LC_BUFFER_PAGED_POOL_TAG));
+        NT_IF_FAIL_LEAVE(LcAllocateBuffer((PVOID*)&ranges,     PagedPool, (SIZE_T)maxNodeCount * sizeof(PATH_TRIE_RANGE), LC_BUFFER_PAGED_POOL_TAG));
+        NT_IF_FAIL_LEAVE(LcAllocateBuffer((PVOID*)&values,     PagedPool, (SIZE_T)PathCount * sizeof(ULONG),              LC_BUFFER_PAGED_POOL_TAG));
+
+        // Case-fold all paths into a single buffer.
+        for (idx = 0; idx < PathCount; idx++)
+        {
+            keys[idx].Buffer = characters + position;
+            keys[idx].Length = Paths[idx]->Length / sizeof(WCHAR);
+            keys[idx].Index  = idx;
+
+            for (charIdx = 0; charIdx < keys[idx].Length; charIdx++)
+            {
+                keys[idx].Buffer[charIdx] = RtlUpcaseUnicodeChar(Paths[idx]->Buffer[charIdx]);
+            }
+
+            position += keys[idx].Length;
+        }
+
+        // After sorting, paths that share a prefix are adjacent, and the shorter ones come first.
+        // Equal paths keep their original order.
+        LcSortPathTrieKeys(keys, PathCount);
+
+        // The root node matches the empty prefix of all paths.
+        ranges[0].First = 0;
+        ranges[0].Last  = PathCount;
+        ranges[0].Depth = 0;
+
+        // Nodes are processed in the order they are added, so all children of a node are allocated together.
+        for (idx = 0; idx < nodeCount; idx++)
+        {
+            PPATH_TRIE_NODE node  = &nodes[idx];
+            ULONG           first = ranges[idx].First;
+            ULONG           last  = ranges[idx].Last;
+            ULONG           depth = ranges[idx].Depth;
+
+            // Paths ending at this node are sorted before the longer ones.
+            node->FirstValue = valueCount;
+            while (first < last && keys[first].Length == depth)
+            {
+                node->Terminal       = TRUE;
+                values[valueCount++] = keys[first].Index;
+                first++;
+            }
+
+            node->ValueCount = valueCount - node->FirstValue;
+            node->FirstChild = nodeCount;
+            node->ChildCount = 0;
+
+            while (first < last)
+            {
+                ULONG groupLast = first + 1;
+                ULONG prefix    = depth + 1;
+                WCHAR character = keys[first].Buffer[depth];
+
+                while (groupLast < last && keys[groupLast].Buffer[depth] == character)
+                {
+                    groupLast++;
+                }
+
+                // The common prefix of the first and the last sorted keys is shared by the whole group.
+                while (prefix < keys[first].Length
+                       && prefix < keys[groupLast - 1].Length
+                       && keys[first].Buffer[prefix] == keys[groupLast - 1].Buffer[prefix])
+                {
+                    prefix++;
+                }
+
+                NT_IF_FALSE_LEAVE(nodeCount < maxNodeCount, STATUS_INTERNAL_ERROR);
+
+                nodes[nodeCount].LabelOffset    = (ULONG)(keys[first].Buffer - characters) + depth;
+                nodes[nodeCount].LabelLength    = (USHORT)(prefix - depth);
+                nodes[nodeCount].TerminalParent = node->Terminal ? idx : node->TerminalParent;
+                ranges[nodeCount].First         = first;
+                ranges[nodeCount].Last          = groupLast;
+                ranges[nodeCount].Depth         = prefix;
+
+                labelLength += prefix - depth;
+                nodeCount++;
+                node->ChildCount++;
+
+                first = groupLast;
+            }
+        }
+
+        // Copy nodes, path indices and labels into a single buffer.
+        NT_IF_FAIL_LEAVE(LcAllocateBuffer(
+            (PVOID*)&trie,
+            PagedPool,
+            sizeof(PATH_TRIE) + (SIZE_T)nodeCount * sizeof(PATH_TRIE_NODE) + (SIZE_T)valueCount * sizeof(ULONG) + (SIZE_T)labelLength * sizeof(WCHAR),
+            LC_BUFFER_PAGED_POOL_TAG));
+
+        trie->ReferenceCount = 1;
+        trie->NodeCount      = nodeCount;
+        trie->Nodes          = (PPATH_TRIE_NODE)(trie + 1);
+        trie->Values         = (PULONG)(trie->Nodes + nodeCount);
+        trie->Labels         = (PWCHAR)(trie->Values + valueCount);
+
+        RtlCopyMemory(trie->Values, values, valueCount * sizeof(ULONG));
+
+        position = 0;
+        for (idx = 0; idx < nodeCount; idx++)
+        {
+            trie->Nodes[idx] = nodes[idx];
+            trie->Nodes[idx].LabelOffset = position;
+
+            RtlCopyMemory(trie->Labels + position, characters + nodes[idx].LabelOffset, nodes[idx].LabelLength * sizeof(WCHAR));
+            position += nodes[idx].LabelLength;
+        }
+
+        *Trie = trie;
+        trie  = NULL;
+
+        LOG((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[LazyCopy] Path trie compiled: %u paths, %u nodes, %u label characters\n", PathCount, nodeCount, labelLength));
+    }
+    __finally
+    {
+        if (trie != NULL)
+        {
+            LcFreeBuffer(trie, LC_BUFFER_PAGED_POOL_TAG);
+        }
+
+        if (values != NULL)
+        {
+            LcFreeBuffer(values, LC_BUFFER_PAGED_POOL_TAG);
+        }
+
+        if (ranges != NULL)
+        {
+            LcFreeBuffer(ranges, LC_BUFFER_PAGED_POOL_TAG);
+        }
+
+        if (nodes != NULL)
+        {
+            LcFreeBuffer(nodes, LC_BUFFER_PAGED_POOL_TAG);
+        }
+
+        if (keys != NULL)
+        {
+            LcFreeBuffer(keys, LC_BUFFER_PAGED_POOL_TAG);
+        }
+
+        if (characters != NULL)
+        {
+            LcFreeBuffer(characters, LC_BUFFER_PAGED_POOL_TAG);
+        }
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcReferencePathTrie(
+    _In_ PPATH_TRIE Trie
+    )
+/*++
+
+Summary:
+
+    This function adds a reference to the trie given.
+
+Arguments:
+
+    Trie - Trie to reference.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    IF_FALSE_RETURN(Trie != NULL);
+
+    InterlockedIncrement(&Trie->ReferenceCount);
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcReleasePathTrie(
+    _In_ PPATH_TRIE Trie
+    )
+/*++
+
+Summary:
+
+    This function releases a reference to the trie given.
+    The trie is freed, when the last reference is released.
+
+Arguments:
+
+    Trie - Trie to release.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    IF_FALSE_RETURN(Trie != NULL);
+
+    if (InterlockedDecrement(&Trie->ReferenceCount) == 0)
+    {
+        LcFreeBuffer(Trie, LC_BUFFER_PAGED_POOL_TAG);
+    }
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+BOOLEAN
+LcMatchPathTrie(
+    _In_     PPATH_TRIE                Trie,
+    _In_     PCUNICODE_STRING          Path,
+    _In_opt_ PPATH_TRIE_MATCH_CALLBACK Callback,
+    _In_opt_ PVOID                     Context
+    )
+/*++
+
+Summary:
+
+    This function checks whether one of the paths compiled into the 'Trie' is a prefix
+    of the 'Path' given. The comparison is case-insensitive.
+
+    If the 'Callback' is specified, it's called for every path matched, starting from
+    the longest one. Equal paths are reported in the order they were compiled in.
+
+Arguments:
+
+    Trie     - Compiled trie.
+
+    Path     - Path to match.
+
+    Callback - Optional function to be called for the paths matched.
+
+    Context  - Context to be passed to the 'Callback'.
+
+Return value:
+
+    If the 'Callback' is NULL, whether the 'Path' or one of its parents is in the 'Trie'.
+    Otherwise, whether the 'Callback' returned TRUE for one of the paths matched.
+
+--*/
+{
+    PPATH_TRIE_NODE node     = NULL;
+    PPATH_TRIE_NODE child    = NULL;
+    PPATH_TRIE_NODE terminal = NULL;
+    ULONG           length   = 0;
+    ULONG           position = 0;
+    ULONG           low      = 0;
+    ULONG           high     = 0;
+    ULONG           middle   = 0;
+    ULONG           idx      = 0;
+    WCHAR           character;
+    WCHAR           labelCharacter;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Trie         != NULL, FALSE);
+    IF_FALSE_RETURN_RESULT(Path         != NULL, FALSE);
+    IF_FALSE_RETURN_RESULT(Path->Buffer != NULL, FALSE);
+
+    length = Path->Length / sizeof(WCHAR);
+    node   = &Trie->Nodes[0];
+
+    // Find the deepest terminal node matching the 'Path'.
+    for (;;)
+    {
+        if (node->Terminal)
+        {
+            terminal = node;
+
+            if (Callback == NULL)
+            {
+                return TRUE;
+            }
+        }
+
+        if (position >= length || node->ChildCount == 0)
+        {
+            break;
+        }
+
+        // Children are sorted by the first label character.
+        character = RtlUpcaseUnicodeChar(Path->Buffer[position]);
+        child     = NULL;
+        low       = node->FirstChild;
+        high      = node->FirstChild + node->ChildCount;
+
+        while (low < high)
+        {
+            middle         = low + (high - low) / 2;
+            labelCharacter = Trie->Labels[Trie->Nodes[middle].LabelOffset];
+
+            if (labelCharacter < character)
+            {
+                low = middle + 1;
+            }
+            else if (labelCharacter > character)
+            {
+                high = middle;
+            }
+            else
+            {
+                child = &Trie->Nodes[middle];
+                break;
+            }
+        }
+
+        if (child == NULL || child->LabelLength > length - position)
+        {
+            break;
+        }
+
+        for (idx = 1; idx < child->LabelLength; idx++)
+        {
+            if (RtlUpcaseUnicodeChar(Path->Buffer[position + idx]) != Trie->Labels[child->LabelOffset + idx])
+            {
+                break;
+            }
+        }
+
+        if (idx < child->LabelLength)
+        {
+            break;
+        }
+
+        position += child->LabelLength;
+        node      = child;
+    }
+
+    // Report the paths matched from the longest to the shortest one.
+    while (terminal != NULL && Callback != NULL)
+    {
+        for (idx = 0; idx < terminal->ValueCount; idx++)
+        {
+            if (Callback(Trie->Values[terminal->FirstValue + idx], Context))
+            {
+                return TRUE;
+            }
+        }
+
+        terminal = terminal->TerminalParent != 0 ? &Trie->Nodes[terminal->TerminalParent] : NULL;
+    }
+
+    return FALSE;
+}
+
+//------------------------------------------------------------------------
+//  Local functions.
+//------------------------------------------------------------------------
+
+static
+LONG
+LcComparePathTrieKeys(
+    _In_ PPATH_TRIE_KEY First,
+    _In_ PPATH_TRIE_KEY Second
+    )
+/*++
+
+Summary:
+
+    This function compares two case-folded keys character by character.
+
+Arguments:
+
+    First  - The first key to compare.
+
+    Second - The second key to compare.
+
+Return value:
+
+    Negative value, if the 'First' key is less than the 'Second' one;
+    zero, if they are equal; positive value otherwise.
+
+    Equal keys are ordered by their indices, so the sort is stable.
+
+--*/
+{
+    ULONG length = min(First->Length, Second->Length);
+    ULONG idx    = 0;
+
+    PAGED_CODE();
+
+    for (idx = 0; idx < length; idx++)
+    {
+        if (First->Buffer[idx] != Second->Buffer[idx])
+        {
+            return First->Buffer[idx] < Second->Buffer[idx] ? -1 : 1;
+        }
+    }
+
+    if (First->Length != Second->Length)
+    {
+        return First->Length < Second->Length ? -1 : 1;
+    }
+
+    if (First->Index != Second->Index)
+    {
+        return First->Index < Second->Index ? -1 : 1;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------
+
+static
+VOID
+LcSortPathTrieKeys(
+    _Inout_updates_(Count) PPATH_TRIE_KEY Keys,
+    _In_                   ULONG          Count
+    )
+/*++
+
+Summary:
+
+    This function sorts the 'Keys' in ascending order.
+
+    Heap sort is used, because it doesn't need recursion or additional memory.
+
+Arguments:
+
+    Keys  - Keys to sort.
+
+    Count - Amount of elements in the 'Keys' array.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PATH_TRIE_KEY temp  = { 0 };
+    ULONG         start = 0;
+    ULONG         end   = 0;
+    ULONG         root  = 0;
+    ULONG         child = 0;
+
+    PAGED_CODE();
+
+    // Build the max-heap first, then move its root to the end of the array one by one.
+    for (start = Count / 2, end = Count; ; )
+    {
+        if (start > 0)
+        {
+            start--;
+        }
+        else
+        {
+            if (--end == 0)
+            {
+                break;
+            }
+
+            temp      = Keys[end];
+            Keys[end] = Keys[0];
+            Keys[0]   = temp;
+        }
+
+        // Sift the 'start' element down.
+        for (root = start; (child = root * 2 + 1) < end; root = child)
+        {
+            if (child + 1 < end && LcComparePathTrieKeys(&Keys[child], &Keys[child + 1]) < 0)
+            {
+                child++;
+            }
+
+            if (LcComparePathTrieKeys(&Keys[root], &Keys[child]) >= 0)
+            {
+                break;
+            }
+
+            temp        = Keys[root];
+            Keys[root]  = Keys[child];
+            Keys[child] = temp;
+        }
+    }
+}
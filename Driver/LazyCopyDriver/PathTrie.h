@@ -0,0 +1,105 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    PathTrie.h
+
+Abstract:
+
+    Contains the compiled prefix trie used to match file paths against
+    the list of paths to watch.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+#ifndef __LAZY_COPY_PATH_TRIE_H__
+#define __LAZY_COPY_PATH_TRIE_H__
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "Globals.h"
+
+//------------------------------------------------------------------------
+//  Struct definitions.
+//------------------------------------------------------------------------
+
+//
+// Opaque compiled path trie.
+//
+typedef struct _PATH_TRIE PATH_TRIE, *PPATH_TRIE;
+
+//
+// Function called by the 'LcMatchPathTrie' for the paths matched.
+// 'PathIndex' is the index of the path in the array given to the 'LcCreatePathTrie'.
+// The enumeration stops, when it returns TRUE.
+//
+typedef
+_Check_return_
+BOOLEAN
+PATH_TRIE_MATCH_CALLBACK(
+    _In_     ULONG PathIndex,
+    _In_opt_ PVOID Context
+    );
+
+typedef PATH_TRIE_MATCH_CALLBACK *PPATH_TRIE_MATCH_CALLBACK;
+
+//------------------------------------------------------------------------
+//  Path trie function prototypes.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcCreatePathTrie(
+    _In_reads_(PathCount) PCUNICODE_STRING* Paths,
+    _In_                  ULONG             PathCount,
+    _Outptr_              PPATH_TRIE*       Trie
+    );
+
+VOID
+LcReferencePathTrie(
+    _In_ PPATH_TRIE Trie
+    );
+
+VOID
+LcReleasePathTrie(
+    _In_ PPATH_TRIE Trie
+    );
+
+_Check_return_
+BOOLEAN
+LcMatchPathTrie(
+    _In_     PPATH_TRIE                Trie,
+    _In_     PCUNICODE_STRING          Path,
+    _In_opt_ PPATH_TRIE_MATCH_CALLBACK Callback,
+    _In_opt_ PVOID                     Context
+    );
+
+#endif // __LAZY_COPY_PATH_TRIE_H__
@@ -0,0 +1,921 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    PendedFetches.c
+
+Abstract:
+
+    Contains the functions that pend the read/write operations on the files fetched
+    by the user-mode client, so the I/O threads are not blocked, while the client
+    fetches them. Files are fetched by the worker threads, which complete the pended
+    operations, when the fetch is finished.
+
+    A fetch may take as long as the client needs to download the file, so the driver
+    uses its own worker threads instead of the system ones. Operations are only pended,
+    if there is an idle worker to fetch the file right away. Otherwise, the caller fetches
+    the file synchronously, so the new fetches are not stuck behind the ones waiting for
+    the client reply over the port, which can't be cancelled until the timeout expires.
+
+    Pended operations are kept in the per-instance cancel-safe queue. If the operation
+    is cancelled, it's completed right away, and the fetch waiting for the client reply
+    is cancelled as well.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "PendedFetches.h"
+#include "Context.h"
+#include "LazyCopyDriver.h"
+#include "Utilities.h"
+
+//------------------------------------------------------------------------
+//  Defines.
+//------------------------------------------------------------------------
+
+// Amount of the worker threads fetching the files for the pended operations.
+#define LC_PENDED_FETCH_WORKER_COUNT 4
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+//
+// Contains information about a single pended operation.
+// The pointer to it is stored in the 'QueueContext[0]' of the operation callback data.
+//
+typedef struct _PENDED_FETCH
+{
+    // Queue context used to remove the operation from the queue.
+    FLT_CALLBACK_DATA_QUEUE_IO_CONTEXT QueueContext;
+
+    // Instance context, which queue the operation is inserted into.
+    PLC_INSTANCE_CONTEXT               InstanceContext;
+
+    // Copy of the objects related to the operation.
+    // The instance and file object are referenced, because they are used after the operation is cancelled.
+    FLT_RELATED_OBJECTS                FltObjects;
+
+    // ID of the process, which operation is pended.
+    ULONG                              ProcessId;
+
+    // File name information and stream context of the file to be fetched.
+    PFLT_FILE_NAME_INFORMATION         NameInfo;
+    PLC_STREAM_CONTEXT                 StreamContext;
+
+    // List entry for the 'PendedFetchList'.
+    LIST_ENTRY                         ListEntry;
+
+    // Signaled, when the cancelled operation is completed.
+    // The user-mode fetch stops waiting for the client reply, when it's signaled.
+    KEVENT                             CancelEvent;
+} PENDED_FETCH, *PPENDED_FETCH;
+
+//------------------------------------------------------------------------
+//  Local function prototypes.
+//------------------------------------------------------------------------
+
+static
+NTSTATUS
+LcPendedFetchQueueInsert(
+    _Inout_  PFLT_CALLBACK_DATA_QUEUE Cbdq,
+    _In_     PFLT_CALLBACK_DATA       Data,
+    _In_opt_ PVOID                    InsertContext
+    );
+
+static
+VOID
+LcPendedFetchQueueRemove(
+    _Inout_ PFLT_CALLBACK_DATA_QUEUE Cbdq,
+    _In_    PFLT_CALLBACK_DATA       Data
+    );
+
+static
+PFLT_CALLBACK_DATA
+LcPendedFetchQueuePeekNext(
+    _In_     PFLT_CALLBACK_DATA_QUEUE Cbdq,
+    _In_opt_ PFLT_CALLBACK_DATA       Data,
+    _In_opt_ PVOID                    PeekContext
+    );
+
+static
+_Acquires_lock_(_Global_critical_region_)
+_IRQL_saves_global_(OldIrql, Irql)
+_IRQL_raises_(DISPATCH_LEVEL)
+VOID
+LcPendedFetchQueueAcquire(
+    _Inout_ PFLT_CALLBACK_DATA_QUEUE Cbdq,
+    _Out_   PKIRQL                   Irql
+    );
+
+static
+_Releases_lock_(_Global_critical_region_)
+_IRQL_restores_global_(OldIrql, Irql)
+_IRQL_requires_(DISPATCH_LEVEL)
+VOID
+LcPendedFetchQueueRelease(
+    _Inout_ PFLT_CALLBACK_DATA_QUEUE Cbdq,
+    _In_    KIRQL                    Irql
+    );
+
+static
+VOID
+LcPendedFetchQueueCompleteCanceled(
+    _Inout_ PFLT_CALLBACK_DATA_QUEUE Cbdq,
+    _Inout_ PFLT_CALLBACK_DATA       Data
+    );
+
+static
+KSTART_ROUTINE LcPendedFetchWorker;
+
+static
+VOID
+LcPendedFetchWorker(
+    _In_ PVOID StartContext
+    );
+
+static
+VOID
+LcProcessPendedFetch(
+    _In_ PPENDED_FETCH PendedFetch
+    );
+
+static
+VOID
+LcFreePendedFetch(
+    _In_ PPENDED_FETCH PendedFetch
+    );
+
+//------------------------------------------------------------------------
+//  Text sections.
+//------------------------------------------------------------------------
+
+#ifdef ALLOC_PRAGMA
+    #pragma alloc_text(PAGE, LcInitializePendedFetches)
+    #pragma alloc_text(PAGE, LcFreePendedFetches)
+    #pragma alloc_text(PAGE, LcInitializePendedFetchQueue)
+    #pragma alloc_text(PAGE, LcCancelPendedFetches)
+    #pragma alloc_text(PAGE, LcPendFetch)
+    #pragma alloc_text(PAGE, LcPendedFetchWorker)
+    #pragma alloc_text(PAGE, LcProcessPendedFetch)
+    #pragma alloc_text(PAGE, LcFreePendedFetch)
+#endif // ALLOC_PRAGMA
+
+//------------------------------------------------------------------------
+//  Global variables.
+//------------------------------------------------------------------------
+
+// Worker threads processing the 'PendedFetchList'.
+static PKTHREAD   PendedFetchWorkers[LC_PENDED_FETCH_WORKER_COUNT] = { 0 };
+
+// Amount of the worker threads started.
+static ULONG      PendedFetchWorkerCount = 0;
+
+// List to store the 'PENDED_FETCH' items waiting for the worker thread.
+static LIST_ENTRY PendedFetchList        = { 0 };
+
+// Protects the 'PendedFetchList'.
+static KSPIN_LOCK PendedFetchListLock    = 0;
+
+// Released once per pended fetch inserted to the 'PendedFetchList'.
+static KSEMAPHORE PendedFetchSemaphore   = { 0 };
+
+// Amount of the worker threads not reserved by the pended fetches.
+static __volatile LONG PendedFetchIdleWorkers = 0;
+
+//------------------------------------------------------------------------
+//  Pended fetches functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializePendedFetches()
+/*++
+
+Summary:
+
+    This function initializes objects used by the current module and starts the worker threads.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS          status           = STATUS_SUCCESS;
+    OBJECT_ATTRIBUTES objectAttributes = { 0 };
+    HANDLE            threadHandle     = NULL;
+
+    PAGED_CODE();
+
+    InitializeListHead(&PendedFetchList);
+    KeInitializeSpinLock(&PendedFetchListLock);
+    KeInitializeSemaphore(&PendedFetchSemaphore, 0, MAXLONG);
+
+    InitializeObjectAttributes(&objectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+
+    while (PendedFetchWorkerCount < LC_PENDED_FETCH_WORKER_COUNT)
+    {
+        NT_IF_FAIL_RETURN(PsCreateSystemThread(&threadHandle, THREAD_ALL_ACCESS, &objectAttributes, NULL, NULL, LcPendedFetchWorker, NULL));
+
+        // Thread objects are referenced, so the 'LcFreePendedFetches' can wait for them to exit.
+        status = ObReferenceObjectByHandle(threadHandle, THREAD_ALL_ACCESS, *PsThreadType, KernelMode, (PVOID*)&PendedFetchWorkers[PendedFetchWorkerCount], NULL);
+        ZwClose(threadHandle);
+        NT_IF_FAIL_RETURN(status);
+
+        PendedFetchWorkerCount++;
+        InterlockedIncrement(&PendedFetchIdleWorkers);
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcFreePendedFetches()
+/*++
+
+Summary:
+
+    This function stops the worker threads and releases objects used by the current module.
+
+    It should only be called after the filter is unregistered, so there are no instances
+    left to pend the operations on.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    None.
+
+--*/
+{
+    ULONG idx = 0;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN(PendedFetchWorkerCount > 0);
+
+    // Every worker exits, when it's woken up and there are no pended fetches left.
+    KeReleaseSemaphore(&PendedFetchSemaphore, IO_NO_INCREMENT, (LONG)PendedFetchWorkerCount, FALSE);
+
+    for (idx = 0; idx < PendedFetchWorkerCount; idx++)
+    {
+        (VOID)KeWaitForSingleObject(PendedFetchWorkers[idx], Executive, KernelMode, FALSE, NULL);
+
+        ObDereferenceObject(PendedFetchWorkers[idx]);
+        PendedFetchWorkers[idx] = NULL;
+    }
+
+    PendedFetchWorkerCount = 0;
+    PendedFetchIdleWorkers = 0;
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializePendedFetchQueue(
+    _In_  PFLT_INSTANCE       Instance,
+    _Out_ PPENDED_FETCH_QUEUE Queue
+    )
+/*++
+
+Summary:
+
+    This function initializes the pended operations queue for the instance given.
+
+Arguments:
+
+    Instance - Instance the queue belongs to.
+
+    Queue    - Queue to be initialized.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Instance != NULL, STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(Queue    != NULL, STATUS_INVALID_PARAMETER_2);
+
+    InitializeListHead(&Queue->List);
+    KeInitializeSpinLock(&Queue->Lock);
+
+    return FltCbdqInitialize(
+        Instance,
+        &Queue->Cbdq,
+        LcPendedFetchQueueInsert,
+        LcPendedFetchQueueRemove,
+        LcPendedFetchQueuePeekNext,
+        LcPendedFetchQueueAcquire,
+        LcPendedFetchQueueRelease,
+        LcPendedFetchQueueCompleteCanceled);
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcCancelPendedFetches(
+    _In_ PPENDED_FETCH_QUEUE Queue
+    )
+/*++
+
+Summary:
+
+    This function disables the queue given and cancels all operations pended in it.
+
+    It's invoked, when the instance the queue belongs to is being torn down.
+    Operations cannot be inserted to the queue afterwards, so they are not pended anymore.
+
+    The worker threads stop waiting for the user-mode fetches, once the 'CancelEvent'
+    of their pended fetches is signaled.
+
+Arguments:
+
+    Queue - Queue to be drained.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PFLT_CALLBACK_DATA data = NULL;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN(Queue != NULL);
+
+    FltCbdqDisable(&Queue->Cbdq);
+
+    while ((data = FltCbdqRemoveNextIo(&Queue->Cbdq, NULL)) != NULL)
+    {
+        LcPendedFetchQueueCompleteCanceled(&Queue->Cbdq, data);
+    }
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcPendFetch(
+    _In_ PFLT_CALLBACK_DATA         Data,
+    _In_ PCFLT_RELATED_OBJECTS      FltObjects,
+    _In_ PFLT_FILE_NAME_INFORMATION NameInfo,
+    _In_ PFLT_CONTEXT               StreamContext
+    )
+/*++
+
+Summary:
+
+    This function pends the operation given and queues it to the worker threads, which fetch
+    the file it's performed on. The worker completes the operation, when the fetch is finished.
+
+    If this function succeeds, the caller should return the 'FLT_PREOP_PENDING'.
+    Otherwise, the caller should fetch the file synchronously.
+
+    Only the IRP-based operations, which are not paging I/O and are not issued from
+    the file system code, can be pended. The operation is not pended, if all worker
+    threads are busy, or its user buffer cannot be locked.
+
+Arguments:
+
+    Data          - Pointer to the filter's callback data of the operation to be pended.
+
+    FltObjects    - Pointer to the 'FLT_RELATED_OBJECTS' data structure containing
+                    opaque handles to this filter, instance, its associated volume and
+                    file object.
+
+    NameInfo      - File name information of the file to be fetched.
+
+    StreamContext - Stream context of the file to be fetched.
+
+Return value:
+
+    STATUS_FLT_NOT_SAFE_TO_POST_OPERATION - The operation cannot be pended.
+
+    Any other value is the status of the operation.
+
+--*/
+{
+    NTSTATUS             status          = STATUS_SUCCESS;
+    PLC_INSTANCE_CONTEXT instanceContext = NULL;
+    PPENDED_FETCH        pendedFetch     = NULL;
+    LONG                 idleWorkers     = 0;
+    BOOLEAN              workerReserved  = FALSE;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Data          != NULL, STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(FltObjects    != NULL, STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT(NameInfo      != NULL, STATUS_INVALID_PARAMETER_3);
+    IF_FALSE_RETURN_RESULT(StreamContext != NULL, STATUS_INVALID_PARAMETER_4);
+
+    // The same conditions are checked by the 'FltQueueDeferredIoWorkItem'.
+    IF_FALSE_RETURN_RESULT(FLT_IS_IRP_OPERATION(Data),                  STATUS_FLT_NOT_SAFE_TO_POST_OPERATION);
+    IF_FALSE_RETURN_RESULT(!FlagOn(Data->Iopb->IrpFlags, IRP_PAGING_IO), STATUS_FLT_NOT_SAFE_TO_POST_OPERATION);
+    IF_FALSE_RETURN_RESULT(IoGetTopLevelIrp() == NULL,                  STATUS_FLT_NOT_SAFE_TO_POST_OPERATION);
+
+    // Reserve an idle worker, so the operation doesn't wait in the list for the busy ones.
+    do
+    {
+        idleWorkers = ReadNoFence(&PendedFetchIdleWorkers);
+        IF_FALSE_RETURN_RESULT(idleWorkers > 0, STATUS_FLT_NOT_SAFE_TO_POST_OPERATION);
+    }
+    while (InterlockedCompareExchange(&PendedFetchIdleWorkers, idleWorkers - 1, idleWorkers) != idleWorkers);
+
+    workerReserved = TRUE;
+
+    __try
+    {
+        // The operation is completed by the worker thread in the different process context,
+        // so its user buffer should be locked, while the operation is still in the requestor's context.
+        NT_IF_FAIL_LEAVE(FltLockUserBuffer(Data));
+
+        NT_IF_FAIL_LEAVE(FltGetInstanceContext(FltObjects->Instance, (PFLT_CONTEXT*)&instanceContext));
+
+        NT_IF_FAIL_LEAVE(LcAllocateNonPagedBuffer((PVOID*)&pendedFetch, sizeof(PENDED_FETCH)));
+        KeInitializeEvent(&pendedFetch->CancelEvent, NotificationEvent, FALSE);
+
+        // The instance can't be torn down, until the worker thread is done with it.
+        NT_IF_FAIL_LEAVE(FltObjectReference(FltObjects->Instance));
+
+        // All referenced objects are released by the 'LcFreePendedFetch'.
+        RtlCopyMemory(&pendedFetch->FltObjects, FltObjects, sizeof(FLT_RELATED_OBJECTS));
+        ObReferenceObject(FltObjects->FileObject);
+
+        pendedFetch->ProcessId = FltGetRequestorProcessId(Data);
+
+        FltReferenceFileNameInformation(NameInfo);
+        pendedFetch->NameInfo = NameInfo;
+
+        FltReferenceContext(StreamContext);
+        pendedFetch->StreamContext = (PLC_STREAM_CONTEXT)StreamContext;
+
+        pendedFetch->InstanceContext = instanceContext;
+        instanceContext              = NULL;
+
+        NT_IF_FAIL_LEAVE(FltCbdqInsertIo(&pendedFetch->InstanceContext->PendedFetches.Cbdq, Data, &pendedFetch->QueueContext, pendedFetch));
+
+        // The worker thread owns the pended fetch now.
+        ExInterlockedInsertTailList(&PendedFetchList, &pendedFetch->ListEntry, &PendedFetchListLock);
+        KeReleaseSemaphore(&PendedFetchSemaphore, IO_NO_INCREMENT, 1, FALSE);
+
+        pendedFetch    = NULL;
+        workerReserved = FALSE;
+    }
+    __finally
+    {
+        if (pendedFetch != NULL)
+        {
+            LcFreePendedFetch(pendedFetch);
+        }
+
+        if (workerReserved)
+        {
+            InterlockedIncrement(&PendedFetchIdleWorkers);
+        }
+
+        if (instanceContext != NULL)
+        {
+            FltReleaseContext(instanceContext);
+        }
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+//  Local functions.
+//------------------------------------------------------------------------
+
+static
+VOID
+LcPendedFetchWorker(
+    _In_ PVOID StartContext
+    )
+/*++
+
+Summary:
+
+    This is the worker thread routine, which processes the pended fetches in the
+    order they are inserted to the 'PendedFetchList'. The worker is reserved by the
+    'LcPendFetch', so it becomes idle again, when the fetch is processed.
+
+    The thread exits, when it's woken up and the list is empty.
+
+Arguments:
+
+    StartContext - Not used.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PLIST_ENTRY listEntry = NULL;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER(StartContext);
+
+    for (;;)
+    {
+        (VOID)KeWaitForSingleObject(&PendedFetchSemaphore, Executive, KernelMode, FALSE, NULL);
+
+        listEntry = ExInterlockedRemoveHeadList(&PendedFetchList, &PendedFetchListLock);
+        if (listEntry == NULL)
+        {
+            // Woken up by the 'LcFreePendedFetches'.
+            break;
+        }
+
+        LcProcessPendedFetch(CONTAINING_RECORD(listEntry, PENDED_FETCH, ListEntry));
+        InterlockedIncrement(&PendedFetchIdleWorkers);
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+//------------------------------------------------------------------------
+
+static
+VOID
+LcProcessPendedFetch(
+    _In_ PPENDED_FETCH PendedFetch
+    )
+/*++
+
+Summary:
+
+    This function fetches the file the pended operation is performed on, and
+    completes the operation, unless it has been cancelled.
+
+Arguments:
+
+    PendedFetch - Pended fetch to be processed. It's freed by this function.
+
+Return value:
+
+    None.
+
+--*/
+{
+    NTSTATUS           status = STATUS_SUCCESS;
+    PFLT_CALLBACK_DATA data   = NULL;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(PendedFetch != NULL);
+
+    // Don't start the fetch, if the operation has been cancelled while it was waiting for the worker.
+    if (KeReadStateEvent(&PendedFetch->CancelEvent) == 0)
+    {
+        status = LcFetchFileForOperation(&PendedFetch->FltObjects, PendedFetch->NameInfo, PendedFetch->StreamContext, PendedFetch->ProcessId, &PendedFetch->CancelEvent);
+    }
+
+    data = FltCbdqRemoveIo(&PendedFetch->InstanceContext->PendedFetches.Cbdq, &PendedFetch->QueueContext);
+    if (data != NULL)
+    {
+        if (NT_SUCCESS(status))
+        {
+            FltCompletePendedPreOperation(data, FLT_PREOP_SUCCESS_NO_CALLBACK, NULL);
+        }
+        else
+        {
+            // Fail I/O operation.
+            data->IoStatus.Status      = status;
+            data->IoStatus.Information = 0;
+            FltCompletePendedPreOperation(data, FLT_PREOP_COMPLETE, NULL);
+        }
+    }
+    else
+    {
+        // The operation has been cancelled. Make sure the cancel callback doesn't use the pended fetch anymore.
+        (VOID)KeWaitForSingleObject(&PendedFetch->CancelEvent, Executive, KernelMode, FALSE, NULL);
+    }
+
+    LcFreePendedFetch(PendedFetch);
+}
+
+//------------------------------------------------------------------------
+
+static
+VOID
+LcFreePendedFetch(
+    _In_ PPENDED_FETCH PendedFetch
+    )
+/*++
+
+Summary:
+
+    This function releases the objects referenced by the 'PendedFetch' and frees it.
+
+Arguments:
+
+    PendedFetch - Pended fetch to be freed.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    FLT_ASSERT(PendedFetch != NULL);
+
+    if (PendedFetch->InstanceContext != NULL)
+    {
+        FltReleaseContext(PendedFetch->InstanceContext);
+    }
+
+    if (PendedFetch->StreamContext != NULL)
+    {
+        FltReleaseContext(PendedFetch->StreamContext);
+    }
+
+    if (PendedFetch->NameInfo != NULL)
+    {
+        FltReleaseFileNameInformation(PendedFetch->NameInfo);
+    }
+
+    if (PendedFetch->FltObjects.FileObject != NULL)
+    {
+        ObDereferenceObject(PendedFetch->FltObjects.FileObject);
+    }
+
+    if (PendedFetch->FltObjects.Instance != NULL)
+    {
+        FltObjectDereference(PendedFetch->FltObjects.Instance);
+    }
+
+    LcFreeNonPagedBuffer(PendedFetch);
+}
+
+//------------------------------------------------------------------------
+//  Queue callbacks.
+//  They are invoked at DISPATCH_LEVEL, so they are not pageable.
+//------------------------------------------------------------------------
+
+static
+NTSTATUS
+LcPendedFetchQueueInsert(
+    _Inout_  PFLT_CALLBACK_DATA_QUEUE Cbdq,
+    _In_     PFLT_CALLBACK_DATA       Data,
+    _In_opt_ PVOID                    InsertContext
+    )
+/*++
+
+Summary:
+
+    This function inserts the operation given to the queue.
+    It's invoked with the queue lock held.
+
+Arguments:
+
+    Cbdq          - Queue the operation is inserted to.
+
+    Data          - Operation to be inserted.
+
+    InsertContext - Pended fetch the operation belongs to.
+
+Return value:
+
+    STATUS_SUCCESS.
+
+--*/
+{
+    PPENDED_FETCH_QUEUE queue = CONTAINING_RECORD(Cbdq, PENDED_FETCH_QUEUE, Cbdq);
+
+    Data->QueueContext[0] = InsertContext;
+    InsertTailList(&queue->List, &Data->QueueLinks);
+
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------
+
+static
+VOID
+LcPendedFetchQueueRemove(
+    _Inout_ PFLT_CALLBACK_DATA_QUEUE Cbdq,
+    _In_    PFLT_CALLBACK_DATA       Data
+    )
+/*++
+
+Summary:
+
+    This function removes the operation given from the queue.
+    It's invoked with the queue lock held.
+
+Arguments:
+
+    Cbdq - Queue the operation is removed from.
+
+    Data - Operation to be removed.
+
+Return value:
+
+    None.
+
+--*/
+{
+    UNREFERENCED_PARAMETER(Cbdq);
+
+    RemoveEntryList(&Data->QueueLinks);
+}
+
+//------------------------------------------------------------------------
+
+static
+PFLT_CALLBACK_DATA
+LcPendedFetchQueuePeekNext(
+    _In_     PFLT_CALLBACK_DATA_QUEUE Cbdq,
+    _In_opt_ PFLT_CALLBACK_DATA       Data,
+    _In_opt_ PVOID                    PeekContext
+    )
+/*++
+
+Summary:
+
+    This function returns the operation following the one given.
+    It's invoked with the queue lock held.
+
+    Operations are always removed by their queue contexts, so it's only used, when the queue is drained.
+
+Arguments:
+
+    Cbdq        - Queue to be enumerated.
+
+    Data        - Operation to start from. If it's NULL, the first operation is returned.
+
+    PeekContext - Not used.
+
+Return value:
+
+    The next operation in the queue, or NULL, if there are no more operations.
+
+--*/
+{
+    PPENDED_FETCH_QUEUE queue     = CONTAINING_RECORD(Cbdq, PENDED_FETCH_QUEUE, Cbdq);
+    PLIST_ENTRY         nextEntry = NULL;
+
+    UNREFERENCED_PARAMETER(PeekContext);
+
+    nextEntry = Data == NULL ? queue->List.Flink : Data->QueueLinks.Flink;
+
+    return nextEntry == &queue->List ? NULL : CONTAINING_RECORD(nextEntry, FLT_CALLBACK_DATA, QueueLinks);
+}
+
+//------------------------------------------------------------------------
+
+static
+_Acquires_lock_(_Global_critical_region_)
+_IRQL_saves_global_(OldIrql, Irql)
+_IRQL_raises_(DISPATCH_LEVEL)
+VOID
+LcPendedFetchQueueAcquire(
+    _Inout_ PFLT_CALLBACK_DATA_QUEUE Cbdq,
+    _Out_   PKIRQL                   Irql
+    )
+/*++
+
+Summary:
+
+    This function acquires the queue lock.
+
+Arguments:
+
+    Cbdq - Queue to be locked.
+
+    Irql - Receives the IRQL the lock was acquired at.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PPENDED_FETCH_QUEUE queue = CONTAINING_RECORD(Cbdq, PENDED_FETCH_QUEUE, Cbdq);
+
+    KeAcquireSpinLock(&queue->Lock, Irql);
+}
+
+//------------------------------------------------------------------------
+
+static
+_Releases_lock_(_Global_critical_region_)
+_IRQL_restores_global_(OldIrql, Irql)
+_IRQL_requires_(DISPATCH_LEVEL)
+VOID
+LcPendedFetchQueueRelease(
+    _Inout_ PFLT_CALLBACK_DATA_QUEUE Cbdq,
+    _In_    KIRQL                    Irql
+    )
+/*++
+
+Summary:
+
+    This function releases the queue lock.
+
+Arguments:
+
+    Cbdq - Queue to be unlocked.
+
+    Irql - IRQL returned by the 'LcPendedFetchQueueAcquire'.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PPENDED_FETCH_QUEUE queue = CONTAINING_RECORD(Cbdq, PENDED_FETCH_QUEUE, Cbdq);
+
+    KeReleaseSpinLock(&queue->Lock, Irql);
+}
+
+//------------------------------------------------------------------------
+
+static
+VOID
+LcPendedFetchQueueCompleteCanceled(
+    _Inout_ PFLT_CALLBACK_DATA_QUEUE Cbdq,
+    _Inout_ PFLT_CALLBACK_DATA       Data
+    )
+/*++
+
+Summary:
+
+    This function completes the cancelled operation and cancels the fetch
+    the worker thread performs for it.
+
+    The worker thread frees the pended fetch, once its 'CancelEvent' is signaled,
+    so the event is signaled last.
+
+Arguments:
+
+    Cbdq - Queue the operation has been removed from.
+
+    Data - Cancelled operation.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PPENDED_FETCH pendedFetch = (PPENDED_FETCH)Data->QueueContext[0];
+
+    UNREFERENCED_PARAMETER(Cbdq);
+
+    FLT_ASSERT(pendedFetch != NULL);
+
+    Data->IoStatus.Status      = STATUS_CANCELLED;
+    Data->IoStatus.Information = 0;
+    FltCompletePendedPreOperation(Data, FLT_PREOP_COMPLETE, NULL);
+
+    KeSetEvent(&pendedFetch->CancelEvent, IO_NO_INCREMENT, FALSE);
+}
@@ -0,0 +1,102 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    PendedFetches.h
+
+Abstract:
+
+    Contains type definitions and function prototypes for the user-mode fetches
+    pended by the read/write callbacks and completed by the worker threads.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+#ifndef __LAZY_COPY_PENDED_FETCHES_H__
+#define __LAZY_COPY_PENDED_FETCHES_H__
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "Globals.h"
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+//
+// Cancel-safe queue of the operations pended on a single instance.
+// Operations stay in the queue, while their files are fetched, so they can be cancelled.
+//
+typedef struct _PENDED_FETCH_QUEUE
+{
+    // Callback data queue. Should be the first field, so the queue can be found by the callbacks.
+    FLT_CALLBACK_DATA_QUEUE Cbdq;
+
+    // List of the pended operations linked by their 'QueueLinks'.
+    LIST_ENTRY              List;
+
+    // Protects the 'List'.
+    KSPIN_LOCK              Lock;
+} PENDED_FETCH_QUEUE, *PPENDED_FETCH_QUEUE;
+
+//------------------------------------------------------------------------
+//  Pended fetches function prototypes.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializePendedFetches();
+
+VOID
+LcFreePendedFetches();
+
+_Check_return_
+NTSTATUS
+LcInitializePendedFetchQueue(
+    _In_  PFLT_INSTANCE       Instance,
+    _Out_ PPENDED_FETCH_QUEUE Queue
+    );
+
+VOID
+LcCancelPendedFetches(
+    _In_ PPENDED_FETCH_QUEUE Queue
+    );
+
+_Check_return_
+NTSTATUS
+LcPendFetch(
+    _In_ PFLT_CALLBACK_DATA         Data,
+    _In_ PCFLT_RELATED_OBJECTS      FltObjects,
+    _In_ PFLT_FILE_NAME_INFORMATION NameInfo,
+    _In_ PFLT_CONTEXT               StreamContext
+    );
+
+#endif // __LAZY_COPY_PENDED_FETCHES_H__
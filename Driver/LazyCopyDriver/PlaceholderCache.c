@@ -0,0 +1,376 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    PlaceholderCache.c
+
+Abstract:
+
+    Contains the cache of file names that are known to be LazyCopy files.
+    It allows the pre-create callback to decide, whether the reparse point
+    itself should be opened, without waiting for the file system to return
+    the STATUS_REPARSE and reissuing the create operation.
+
+    The cache is looked up on every create, so it does not use any locks.
+    Only the 64-bit case-insensitive hashes of the file names are stored in a fixed
+    set-associative table, and every slot is read and updated with a single
+    interlocked operation. There is nothing to free, so the readers don't need
+    to be tracked. A hash collision only makes the pre-create callback open
+    the reparse point of an ordinary file, which the post-create callback detects
+    by checking the reparse tag.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "PlaceholderCache.h"
+#include "Statistics.h"
+#include "Utilities.h"
+
+//------------------------------------------------------------------------
+//  Defines.
+//------------------------------------------------------------------------
+
+// Amount of hash buckets. Should be a power of two.
+#define PLACEHOLDER_CACHE_BUCKETS 128
+
+// Amount of file name hashes stored in a single bucket.
+// When the bucket is full, one of the hashes is replaced.
+#define PLACEHOLDER_CACHE_WAYS    8
+
+// Value of the empty slot. Hashes calculated are never equal to it.
+#define PLACEHOLDER_CACHE_EMPTY   0
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+//
+// Contains hashes of the file names known to be LazyCopy files.
+// Bucket fits into a single cache line.
+//
+typedef struct DECLSPEC_CACHEALIGN _PLACEHOLDER_CACHE_BUCKET
+{
+    __volatile LONG64 Hashes[PLACEHOLDER_CACHE_WAYS];
+} PLACEHOLDER_CACHE_BUCKET, *PPLACEHOLDER_CACHE_BUCKET;
+
+//------------------------------------------------------------------------
+//  Local function prototypes.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+LONG64
+LcHashPlaceholderName(
+    _In_ PCUNICODE_STRING FileName
+    );
+
+//------------------------------------------------------------------------
+//  Text sections.
+//------------------------------------------------------------------------
+
+#ifdef ALLOC_PRAGMA
+    #pragma alloc_text(PAGE, LcInitializePlaceholderCache)
+    #pragma alloc_text(PAGE, LcFreePlaceholderCache)
+    #pragma alloc_text(PAGE, LcIsKnownPlaceholder)
+    #pragma alloc_text(PAGE, LcAddKnownPlaceholder)
+    #pragma alloc_text(PAGE, LcRemoveKnownPlaceholder)
+
+    // Local functions.
+    #pragma alloc_text(PAGE, LcHashPlaceholderName)
+#endif // ALLOC_PRAGMA
+
+//------------------------------------------------------------------------
+//  Global variables.
+//------------------------------------------------------------------------
+
+// Hash buckets containing the file name hashes.
+static PLACEHOLDER_CACHE_BUCKET PlaceholderCacheBuckets[PLACEHOLDER_CACHE_BUCKETS] = { 0 };
+
+//------------------------------------------------------------------------
+//  Placeholder cache functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializePlaceholderCache()
+/*++
+
+Summary:
+
+    This function initializes objects used by the current module.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    PAGED_CODE();
+
+    RtlZeroMemory(PlaceholderCacheBuckets, sizeof(PlaceholderCacheBuckets));
+
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcFreePlaceholderCache()
+/*++
+
+Summary:
+
+    This function releases objects used by the current module.
+
+    It is not thread-safe, so it should only be called when the driver is about to be unloaded.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    RtlZeroMemory(PlaceholderCacheBuckets, sizeof(PlaceholderCacheBuckets));
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+BOOLEAN
+LcIsKnownPlaceholder(
+    _In_ PCUNICODE_STRING FileName
+    )
+/*++
+
+Summary:
+
+    This function checks whether the 'FileName' given was previously seen
+    as a LazyCopy file.
+
+    The result is only a hint. The file might have been fetched or replaced
+    since it was added to the cache, or another file name might have the same hash,
+    so the caller should validate the reparse tag once the file is opened.
+
+Arguments:
+
+    FileName - Full path to the file to check.
+
+Return value:
+
+    Whether the 'FileName' is in the cache.
+
+--*/
+{
+    LONG64                    hash   = 0;
+    PPLACEHOLDER_CACHE_BUCKET bucket = NULL;
+    ULONG                     idx    = 0;
+    BOOLEAN                   result = FALSE;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(NT_SUCCESS(RtlUnicodeStringValidate(FileName)), FALSE);
+
+    hash   = LcHashPlaceholderName(FileName);
+    bucket = &PlaceholderCacheBuckets[(ULONG)hash & (PLACEHOLDER_CACHE_BUCKETS - 1)];
+
+    for (idx = 0; idx < PLACEHOLDER_CACHE_WAYS; idx++)
+    {
+        if (ReadNoFence64(&bucket->Hashes[idx]) == hash)
+        {
+            result = TRUE;
+            break;
+        }
+    }
+
+    LcRecordPlaceholderLookup(result);
+
+    return result;
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcAddKnownPlaceholder(
+    _In_ PCUNICODE_STRING FileName
+    )
+/*++
+
+Summary:
+
+    This function adds the 'FileName' given to the cache of LazyCopy files.
+
+    If the bucket is full, one of its entries is replaced. The entry to replace
+    is selected by the hash bits that are not used to select the bucket.
+
+Arguments:
+
+    FileName - Full path to the LazyCopy file.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    LONG64                    hash   = 0;
+    PPLACEHOLDER_CACHE_BUCKET bucket = NULL;
+    ULONG                     idx    = 0;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(NT_SUCCESS(RtlUnicodeStringValidate(FileName)), STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(FileName->Length > 0,                           STATUS_INVALID_PARAMETER_1);
+
+    hash   = LcHashPlaceholderName(FileName);
+    bucket = &PlaceholderCacheBuckets[(ULONG)hash & (PLACEHOLDER_CACHE_BUCKETS - 1)];
+
+    for (idx = 0; idx < PLACEHOLDER_CACHE_WAYS; idx++)
+    {
+        if (ReadNoFence64(&bucket->Hashes[idx]) == hash)
+        {
+            return STATUS_SUCCESS;
+        }
+    }
+
+    // Take the first empty slot. Another thread might fill it first, so the slots are claimed atomically.
+    for (idx = 0; idx < PLACEHOLDER_CACHE_WAYS; idx++)
+    {
+        if (InterlockedCompareExchange64(&bucket->Hashes[idx], hash, PLACEHOLDER_CACHE_EMPTY) == PLACEHOLDER_CACHE_EMPTY)
+        {
+            return STATUS_SUCCESS;
+        }
+    }
+
+    // Bucket is full, so replace one of the hashes.
+    InterlockedExchange64(&bucket->Hashes[(ULONG)((ULONG64)hash >> 32) & (PLACEHOLDER_CACHE_WAYS - 1)], hash);
+
+    return STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcRemoveKnownPlaceholder(
+    _In_ PCUNICODE_STRING FileName
+    )
+/*++
+
+Summary:
+
+    This function removes the 'FileName' given from the cache.
+    It should be called, when the file is fetched or untagged.
+
+Arguments:
+
+    FileName - Full path to the file.
+
+Return value:
+
+    None.
+
+--*/
+{
+    LONG64                    hash   = 0;
+    PPLACEHOLDER_CACHE_BUCKET bucket = NULL;
+    ULONG                     idx    = 0;
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN(NT_SUCCESS(RtlUnicodeStringValidate(FileName)));
+
+    hash   = LcHashPlaceholderName(FileName);
+    bucket = &PlaceholderCacheBuckets[(ULONG)hash & (PLACEHOLDER_CACHE_BUCKETS - 1)];
+
+    // Clear every slot with the hash, because concurrent adds might have stored it twice.
+    for (idx = 0; idx < PLACEHOLDER_CACHE_WAYS; idx++)
+    {
+        InterlockedCompareExchange64(&bucket->Hashes[idx], PLACEHOLDER_CACHE_EMPTY, hash);
+    }
+}
+
+//------------------------------------------------------------------------
+//  Local functions.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+LONG64
+LcHashPlaceholderName(
+    _In_ PCUNICODE_STRING FileName
+    )
+/*++
+
+Summary:
+
+    This function calculates the 64-bit case-insensitive hash of the 'FileName' given.
+
+    The 'PLACEHOLDER_CACHE_EMPTY' value is never returned.
+
+Arguments:
+
+    FileName - Full path to the file.
+
+Return value:
+
+    File name hash.
+
+--*/
+{
+    ULONGLONG hash   = 0xCBF29CE484222325ULL;
+    USHORT    length = FileName->Length / sizeof(WCHAR);
+    USHORT    idx    = 0;
+
+    PAGED_CODE();
+
+    // FNV-1a is used to combine the characters.
+    for (idx = 0; idx < length; idx++)
+    {
+        hash ^= RtlUpcaseUnicodeChar(FileName->Buffer[idx]);
+        hash *= 0x100000001B3ULL;
+    }
+
+    // Mix the higher bits into the lower ones, because the lower bits select the bucket.
+    hash ^= hash >> 32;
+
+    return hash == PLACEHOLDER_CACHE_EMPTY ? 1 : (LONG64)hash;
+}
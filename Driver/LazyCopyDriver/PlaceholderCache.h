@@ -0,0 +1,80 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    PlaceholderCache.h
+
+Abstract:
+
+    Contains the cache of file names that are known to be LazyCopy files.
+    It allows the pre-create callback to decide, whether the reparse point
+    itself should be opened, without waiting for the file system to return
+    the STATUS_REPARSE and reissuing the create operation.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+#ifndef __LAZY_COPY_PLACEHOLDER_CACHE_H__
+#define __LAZY_COPY_PLACEHOLDER_CACHE_H__
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "Globals.h"
+
+//------------------------------------------------------------------------
+//  Placeholder cache function prototypes.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializePlaceholderCache();
+
+VOID
+LcFreePlaceholderCache();
+
+_Check_return_
+BOOLEAN
+LcIsKnownPlaceholder(
+    _In_ PCUNICODE_STRING FileName
+    );
+
+_Check_return_
+NTSTATUS
+LcAddKnownPlaceholder(
+    _In_ PCUNICODE_STRING FileName
+    );
+
+VOID
+LcRemoveKnownPlaceholder(
+    _In_ PCUNICODE_STRING FileName
+    );
+
+#endif // __LAZY_COPY_PLACEHOLDER_CACHE_H__
@@ -67,6 +67,42 @@ static const FLT_CONTEXT_REGISTRATION Contexts[] =
          NULL                            // Reserved
      },
 
+     {
+         FLT_INSTANCE_CONTEXT,           // Context type
+         0,                              // Flags
+         (PFLT_CONTEXT_CLEANUP_CALLBACK)
+            LcContextCleanup,            // Cleanup callback
+         sizeof(LC_INSTANCE_CONTEXT),    // Context size
+         LC_CONTEXT_NON_PAGED_POOL_TAG,  // Pool tag
+         NULL,                           // Allocate callback
+         NULL,                           // Free callback
+         NULL                            // Reserved
+     },
+
+     {
+         FLT_FILE_CONTEXT,               // Context type
+         0,                              // Flags
+         (PFLT_CONTEXT_CLEANUP_CALLBACK)
+            LcContextCleanup,            // Cleanup callback
+         sizeof(LC_DIRECTORY_CONTEXT),   // Context size
+         LC_CONTEXT_PAGED_POOL_TAG,      // Pool tag
+         NULL,                           // Allocate callback
+         NULL,                           // Free callback
+         NULL                            // Reserved
+     },
+
+     {
+         FLT_STREAMHANDLE_CONTEXT,            // Context type
+         0,                                   // Flags
+         (PFLT_CONTEXT_CLEANUP_CALLBACK)
+            LcContextCleanup,                 // Cleanup callback
+         sizeof(LC_DIRECTORY_HANDLE_CONTEXT), // Context size
+         LC_CONTEXT_PAGED_POOL_TAG,           // Pool tag
+         NULL,                                // Allocate callback
+         NULL,                                // Free callback
+         NULL                                 // Reserved
+     },
+
      { FLT_CONTEXT_END }
 };
 
@@ -113,10 +149,24 @@ static const FLT_OPERATION_REGISTRATION Callbacks[] =
     {
         IRP_MJ_DIRECTORY_CONTROL,
         FLTFL_OPERATION_REGISTRATION_SKIP_PAGING_IO,
-        NULL,
+        (PFLT_PRE_OPERATION_CALLBACK)PreDirectoryControlOperationCallback,
         (PFLT_POST_OPERATION_CALLBACK)PostDirectoryControlOperationCallback
     },
 
+    {
+        IRP_MJ_FILE_SYSTEM_CONTROL,
+        0,
+        (PFLT_PRE_OPERATION_CALLBACK)PreFileSystemControlOperationCallback,
+        (PFLT_POST_OPERATION_CALLBACK)PostFileSystemControlOperationCallback
+    },
+
+    {
+        IRP_MJ_SET_INFORMATION,
+        FLTFL_OPERATION_REGISTRATION_SKIP_PAGING_IO,
+        (PFLT_PRE_OPERATION_CALLBACK)PreSetInformationOperationCallback,
+        (PFLT_POST_OPERATION_CALLBACK)PostSetInformationOperationCallback
+    },
+
     { IRP_MJ_OPERATION_END }
 };
 
@@ -142,7 +192,8 @@ const FLT_REGISTRATION FilterRegistration =
         DriverInstanceSetup,
     (PFLT_INSTANCE_QUERY_TEARDOWN_CALLBACK)  // InstanceQueryTeardown function
         DriverInstanceQueryTeardown,
-    NULL,                                    // InstanceTeardownStart function
+    (PFLT_INSTANCE_TEARDOWN_CALLBACK)        // InstanceTeardownStart function
+        DriverInstanceTeardownStart,
     NULL,                                    // InstanceTeardownComplete function
     NULL,                                    // Filename generation support callback
     NULL,                                    // Filename normalization support callback
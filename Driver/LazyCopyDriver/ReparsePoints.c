@@ -50,7 +50,11 @@ Environment:
 
 #ifdef ALLOC_PRAGMA
     #pragma alloc_text(PAGE, LcGetReparsePointData)
+    #pragma alloc_text(PAGE, LcGetRemoteFileSize)
     #pragma alloc_text(PAGE, LcUntagFile)
+
+    // Local functions.
+    #pragma alloc_text(PAGE, LcReadReparsePointData)
 #endif // ALLOC_PRAGMA
 
 //------------------------------------------------------------------------
@@ -86,6 +90,21 @@ typedef struct _LC_REPARSE_DATA
     } ReparseBuffer;
 } LC_REPARSE_DATA, *PLC_REPARSE_DATA;
 
+//------------------------------------------------------------------------
+//  Local function prototypes.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcReadReparsePointData(
+    _In_      PFLT_INSTANCE   Instance,
+    _In_      PFILE_OBJECT    FileObject,
+    _Out_     PLARGE_INTEGER  RemoteFileSize,
+    _Out_opt_ PUNICODE_STRING RemoteFilePath,
+    _Out_opt_ PBOOLEAN        UseCustomHandler
+    );
+
 //------------------------------------------------------------------------
 //  Reparse points management functions.
 //------------------------------------------------------------------------
@@ -123,14 +142,6 @@ Return Value:
 
 --*/
 {
-    NTSTATUS                 status               = STATUS_SUCCESS;
-    REPARSE_GUID_DATA_BUFFER dataBuffer           = { 0 };
-    PLC_REPARSE_DATA         reparseData          = NULL;
-    ULONG                    reparseDataLength    = 0;
-    SIZE_T                   remoteFilePathLength = 0;
-    LARGE_INTEGER            remoteFileSize       = { 0 };
-    UNICODE_STRING           remoteFilePath       = { 0 };
-
     PAGED_CODE();
 
     IF_FALSE_RETURN_RESULT(FltObjects             != NULL, STATUS_INVALID_PARAMETER_1);
@@ -140,49 +151,89 @@ Return Value:
     IF_FALSE_RETURN_RESULT(RemoteFilePath         != NULL, STATUS_INVALID_PARAMETER_3);
     IF_FALSE_RETURN_RESULT(UseCustomHandler       != NULL, STATUS_INVALID_PARAMETER_4);
 
-    __try
-    {
-        // Get the reparse data size.
-        status = FltFsControlFile(FltObjects->Instance, FltObjects->FileObject, FSCTL_GET_REPARSE_POINT, NULL, 0, &dataBuffer, sizeof(REPARSE_GUID_DATA_BUFFER), NULL);
-        if (status != STATUS_BUFFER_OVERFLOW)
-        {
-            status = STATUS_NOT_A_REPARSE_POINT;
-            __leave;
-        }
+    return LcReadReparsePointData(FltObjects->Instance, FltObjects->FileObject, RemoteFileSize, RemoteFilePath, UseCustomHandler);
+}
 
-        reparseDataLength = REPARSE_GUID_DATA_BUFFER_HEADER_SIZE + dataBuffer.ReparseDataLength;
+//------------------------------------------------------------------------
 
-        // Get the reparse point buffer.
-        NT_IF_FAIL_LEAVE(LcAllocateNonPagedBuffer((PVOID*)&reparseData, reparseDataLength));
-        NT_IF_FAIL_LEAVE(FltFsControlFile(FltObjects->Instance, FltObjects->FileObject, FSCTL_GET_REPARSE_POINT, NULL, 0, reparseData, reparseDataLength, NULL));
+_Check_return_
+_IRQL_requires_(PASSIVE_LEVEL)
+NTSTATUS
+LcGetRemoteFileSize(
+    _In_  PFLT_FILTER     Filter,
+    _In_  PFLT_INSTANCE   Instance,
+    _In_  PUNICODE_STRING FileName,
+    _Out_ PLARGE_INTEGER  RemoteFileSize
+    )
+/*++
 
-        // Get remote file path.
-        remoteFilePathLength = (wcslen(reparseData->ReparseBuffer.RemoteFilePath) + 1) * sizeof(WCHAR);
-        NT_IF_FALSE_LEAVE(reparseData->ReparseDataLength < sizeof(reparseData->ReparseBuffer) + remoteFilePathLength, STATUS_IO_REPARSE_DATA_INVALID);
-        NT_IF_FAIL_LEAVE(LcAllocateUnicodeString(&remoteFilePath, (USHORT)remoteFilePathLength));
+Summary:
 
-        __analysis_assume(remoteFilePath.Buffer != NULL);
-        RtlCopyMemory(remoteFilePath.Buffer, &reparseData->ReparseBuffer.RemoteFilePath, remoteFilePathLength);
-        remoteFilePath.Length = (USHORT)remoteFilePathLength - sizeof(WCHAR);
+    This function opens the LazyCopy file given without following its reparse point
+    and returns the remote file size stored in the reparse point data.
 
-        // And size.
-        remoteFileSize.QuadPart = reparseData->ReparseBuffer.RemoteFileSize;
+Arguments:
 
-        *RemoteFileSize       = remoteFileSize;
-        *RemoteFilePath       = remoteFilePath;
-        *UseCustomHandler     = !!reparseData->ReparseBuffer.UseCustomHandler;
-        remoteFilePath.Buffer = NULL;
+    Filter         - Opaque filter pointer for the caller.
+
+    Instance       - Opaque instance pointer for the minifilter driver instance that
+                     the create request is to be sent to.
+
+    FileName       - Full file name to be opened.
+
+    RemoteFileSize - Receives the size of the remote file.
+
+Return Value:
+
+    The return value is the status of the operation.
+    Returns STATUS_NOT_A_REPARSE_POINT, if the file is not a LazyCopy file.
+
+--*/
+{
+    NTSTATUS          status           = STATUS_SUCCESS;
+    HANDLE            fileHandle       = NULL;
+    PFILE_OBJECT      fileObject       = NULL;
+    OBJECT_ATTRIBUTES objectAttributes = { 0 };
+    IO_STATUS_BLOCK   statusBlock      = { 0 };
+
+    PAGED_CODE();
+
+    IF_FALSE_RETURN_RESULT(Filter           != NULL, STATUS_INVALID_PARAMETER_1);
+    IF_FALSE_RETURN_RESULT(Instance         != NULL, STATUS_INVALID_PARAMETER_2);
+    IF_FALSE_RETURN_RESULT(FileName         != NULL, STATUS_INVALID_PARAMETER_3);
+    IF_FALSE_RETURN_RESULT(FileName->Buffer != NULL, STATUS_INVALID_PARAMETER_3);
+    IF_FALSE_RETURN_RESULT(RemoteFileSize   != NULL, STATUS_INVALID_PARAMETER_4);
+
+    __try
+    {
+        InitializeObjectAttributes(&objectAttributes, FileName, OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE, NULL, NULL);
+
+        // Only attributes are needed, so the file is opened without breaking OpLocks.
+        NT_IF_FAIL_LEAVE(FltCreateFileEx(
+            Filter,
+            Instance,
+            &fileHandle,
+            &fileObject,
+            FILE_READ_ATTRIBUTES,
+            &objectAttributes,
+            &statusBlock,
+            0,
+            FILE_ATTRIBUTE_NORMAL,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            FILE_OPEN,
+            FILE_OPEN_REPARSE_POINT | FILE_NON_DIRECTORY_FILE | FILE_COMPLETE_IF_OPLOCKED,
+            NULL,
+            0,
+            IO_IGNORE_SHARE_ACCESS_CHECK));
+
+        NT_IF_FAIL_LEAVE(LcReadReparsePointData(Instance, fileObject, RemoteFileSize, NULL, NULL));
     }
     __finally
     {
-        if (reparseData != NULL)
-        {
-            LcFreeNonPagedBuffer(reparseData);
-        }
-
-        if (remoteFilePath.Buffer != NULL)
+        if (fileHandle != NULL)
         {
-            LcFreeUnicodeString(&remoteFilePath);
+            FltClose(fileHandle);
+            ObfDereferenceObject(fileObject);
         }
     }
 
@@ -299,3 +350,116 @@ Return Value:
 
     return status;
 }
+
+//------------------------------------------------------------------------
+//  Local functions.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+NTSTATUS
+LcReadReparsePointData(
+    _In_      PFLT_INSTANCE   Instance,
+    _In_      PFILE_OBJECT    FileObject,
+    _Out_     PLARGE_INTEGER  RemoteFileSize,
+    _Out_opt_ PUNICODE_STRING RemoteFilePath,
+    _Out_opt_ PBOOLEAN        UseCustomHandler
+    )
+/*++
+
+Summary:
+
+    This function reads the LazyCopy reparse point data from the file object given.
+
+Arguments:
+
+    Instance         - Opaque instance pointer for the minifilter driver instance
+                       the file object is opened on.
+
+    FileObject       - File object to read reparse point data from.
+
+    RemoteFileSize   - Size of the remote file to be fetched.
+
+    RemoteFilePath   - Path of the file to be fetched. Optional.
+
+    UseCustomHandler - Whether the file should be fetched by the user-mode client. Optional.
+
+Return Value:
+
+    The return value is the status of the operation.
+    Returns STATUS_NOT_A_REPARSE_POINT, if reparse point data was not found.
+
+--*/
+{
+    NTSTATUS                 status               = STATUS_SUCCESS;
+    REPARSE_GUID_DATA_BUFFER dataBuffer           = { 0 };
+    PLC_REPARSE_DATA         reparseData          = NULL;
+    ULONG                    reparseDataLength    = 0;
+    SIZE_T                   remoteFilePathLength = 0;
+    LARGE_INTEGER            remoteFileSize       = { 0 };
+    UNICODE_STRING           remoteFilePath       = { 0 };
+
+    PAGED_CODE();
+
+    FLT_ASSERT(Instance       != NULL);
+    FLT_ASSERT(FileObject     != NULL);
+    FLT_ASSERT(RemoteFileSize != NULL);
+
+    __try
+    {
+        // Get the reparse data size.
+        status = FltFsControlFile(Instance, FileObject, FSCTL_GET_REPARSE_POINT, NULL, 0, &dataBuffer, sizeof(REPARSE_GUID_DATA_BUFFER), NULL);
+        if (status != STATUS_BUFFER_OVERFLOW)
+        {
+            status = STATUS_NOT_A_REPARSE_POINT;
+            __leave;
+        }
+
+        reparseDataLength = REPARSE_GUID_DATA_BUFFER_HEADER_SIZE + dataBuffer.ReparseDataLength;
+
+        // Get the reparse point buffer.
+        NT_IF_FAIL_LEAVE(LcAllocateNonPagedBuffer((PVOID*)&reparseData, reparseDataLength));
+        NT_IF_FAIL_LEAVE(FltFsControlFile(Instance, FileObject, FSCTL_GET_REPARSE_POINT, NULL, 0, reparseData, reparseDataLength, NULL));
+        NT_IF_FALSE_LEAVE(reparseData->ReparseTag == LC_REPARSE_TAG, STATUS_NOT_A_REPARSE_POINT);
+
+        // And size.
+        remoteFileSize.QuadPart = reparseData->ReparseBuffer.RemoteFileSize;
+        *RemoteFileSize         = remoteFileSize;
+
+        if (UseCustomHandler != NULL)
+        {
+            *UseCustomHandler = !!reparseData->ReparseBuffer.UseCustomHandler;
+        }
+
+        if (RemoteFilePath == NULL)
+        {
+            __leave;
+        }
+
+        // Get remote file path.
+        remoteFilePathLength = (wcslen(reparseData->ReparseBuffer.RemoteFilePath) + 1) * sizeof(WCHAR);
+        NT_IF_FALSE_LEAVE(reparseData->ReparseDataLength < sizeof(reparseData->ReparseBuffer) + remoteFilePathLength, STATUS_IO_REPARSE_DATA_INVALID);
+        NT_IF_FAIL_LEAVE(LcAllocateUnicodeString(&remoteFilePath, (USHORT)remoteFilePathLength));
+
+        __analysis_assume(remoteFilePath.Buffer != NULL);
+        RtlCopyMemory(remoteFilePath.Buffer, &reparseData->ReparseBuffer.RemoteFilePath, remoteFilePathLength);
+        remoteFilePath.Length = (USHORT)remoteFilePathLength - sizeof(WCHAR);
+
+        *RemoteFilePath       = remoteFilePath;
+        remoteFilePath.Buffer = NULL;
+    }
+    __finally
+    {
+        if (reparseData != NULL)
+        {
+            LcFreeNonPagedBuffer(reparseData);
+        }
+
+        if (remoteFilePath.Buffer != NULL)
+        {
+            LcFreeUnicodeString(&remoteFilePath);
+        }
+    }
+
+    return status;
+}
@@ -60,6 +60,16 @@ LcGetReparsePointData(
     _Out_ PBOOLEAN              UseCustomHandler
     );
 
+_Check_return_
+_IRQL_requires_(PASSIVE_LEVEL)
+NTSTATUS
+LcGetRemoteFileSize(
+    _In_  PFLT_FILTER     Filter,
+    _In_  PFLT_INSTANCE   Instance,
+    _In_  PUNICODE_STRING FileName,
+    _Out_ PLARGE_INTEGER  RemoteFileSize
+    );
+
 _Check_return_
 _IRQL_requires_(PASSIVE_LEVEL)
 NTSTATUS
@@ -0,0 +1,790 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    Statistics.c
+
+Abstract:
+
+    Contains the driver statistics: operation callback counters, fetch latency
+    histograms and byte counters.
+    Every processor updates its own cache-aligned slot, so the hot paths don't
+    contend for the same cache line. Slots are summed, when the statistics are queried.
+
+    Every fetch phase is also traced as an ETW span correlated by the activity ID
+    of the fetch it belongs to.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "Statistics.h"
+#include "Utilities.h"
+
+// See the 'LazyCopyDriver.c' for details.
+#include "LazyCopyEtw.h"
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+//
+// Contains statistics collected on a single processor.
+//
+typedef struct DECLSPEC_CACHEALIGN _STATISTICS_SLOT
+{
+    __volatile LONGLONG CallbackCounts[DriverCallbackTypeCount];
+
+    __volatile LONGLONG FetchesCompleted;
+    __volatile LONGLONG FetchesFailed;
+
+    __volatile LONGLONG BytesRead;
+    __volatile LONGLONG BytesWritten;
+    __volatile LONGLONG BytesFetched;
+
+    __volatile LONGLONG PlaceholderCacheHits;
+    __volatile LONGLONG PlaceholderCacheMisses;
+    __volatile LONGLONG CreatesReissued;
+    __volatile LONGLONG CreatesNotReissued;
+
+    __volatile LONGLONG DirectoryQueriesSkipped;
+    __volatile LONGLONG DirectoryQueriesProcessed;
+
+    __volatile LONGLONG NegativeCacheHits;
+    __volatile LONGLONG NegativeCacheMisses;
+
+    __volatile LONGLONG FetchLatency[FetchPhaseCount][STATISTICS_LATENCY_BUCKETS];
+} STATISTICS_SLOT, *PSTATISTICS_SLOT;
+
+//------------------------------------------------------------------------
+//  Local function prototypes.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+PSTATISTICS_SLOT
+LcGetStatisticsSlot();
+
+static
+_Check_return_
+LONGLONG
+LcGetElapsedTime(
+    _In_ LONGLONG StartTimestamp
+    );
+
+static
+_Check_return_
+ULONG
+LcGetLatencyBucket(
+    _In_ LONGLONG ElapsedTime
+    );
+
+//------------------------------------------------------------------------
+//  Text sections.
+//------------------------------------------------------------------------
+
+// The recording functions are not pageable, because they are called from every operation callback.
+#ifdef ALLOC_PRAGMA
+    #pragma alloc_text(PAGE, LcInitializeStatistics)
+    #pragma alloc_text(PAGE, LcFreeStatistics)
+    #pragma alloc_text(PAGE, LcQueryStatistics)
+    #pragma alloc_text(PAGE, LcStartFetchActivity)
+    #pragma alloc_text(PAGE, LcStopFetchActivity)
+#endif // ALLOC_PRAGMA
+
+//------------------------------------------------------------------------
+//  Global variables.
+//------------------------------------------------------------------------
+
+// Buffer the 'StatisticsSlots' are allocated in.
+static PVOID            StatisticsBuffer     = NULL;
+
+// Cache-aligned statistics slots, one per processor.
+static PSTATISTICS_SLOT StatisticsSlots      = NULL;
+
+// Amount of items in the 'StatisticsSlots'.
+static ULONG            StatisticsSlotCount  = 0;
+
+// Performance counter frequency, in ticks per second.
+static LONGLONG         PerformanceFrequency = 0;
+
+// Amount of notifications waiting for the client reply in each lane.
+// It's a gauge rather than a counter, so it's not split between the slots.
+static __volatile LONG  NotificationQueueDepth[NotificationLaneCount] = { 0 };
+
+//------------------------------------------------------------------------
+//  Statistics functions.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializeStatistics()
+/*++
+
+Summary:
+
+    This function initializes objects used by the current module.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    The return value is the status of the operation.
+
+--*/
+{
+    NTSTATUS      status    = STATUS_SUCCESS;
+    LARGE_INTEGER frequency = { 0 };
+    ULONG         slotCount = 0;
+
+    PAGED_CODE();
+
+#if PLATFORM_WIN7
+    slotCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+#else
+    slotCount = KeQueryMaximumProcessorCount();
+#endif // PLATFORM_WIN7
+
+    IF_FALSE_RETURN_RESULT(slotCount > 0, STATUS_UNSUCCESSFUL);
+
+    // Pool allocations are not guaranteed to be cache-aligned, so the slots are aligned manually.
+    NT_IF_FAIL_RETURN(LcAllocateNonPagedBuffer(&StatisticsBuffer, (SIZE_T)slotCount * sizeof(STATISTICS_SLOT) + SYSTEM_CACHE_ALIGNMENT_SIZE));
+    RtlZeroMemory(StatisticsBuffer, (SIZE_T)slotCount * sizeof(STATISTICS_SLOT) + SYSTEM_CACHE_ALIGNMENT_SIZE);
+
+    KeQueryPerformanceCounter(&frequency);
+
+    PerformanceFrequency = frequency.QuadPart;
+    StatisticsSlotCount  = slotCount;
+    StatisticsSlots      = (PSTATISTICS_SLOT)ALIGN_UP_POINTER_BY(StatisticsBuffer, SYSTEM_CACHE_ALIGNMENT_SIZE);
+
+    return status;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcFreeStatistics()
+/*++
+
+Summary:
+
+    This function releases objects used by the current module.
+
+    It is not thread-safe, so it should only be called when the driver is about to be unloaded.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    StatisticsSlots     = NULL;
+    StatisticsSlotCount = 0;
+
+    if (StatisticsBuffer != NULL)
+    {
+        LcFreeNonPagedBuffer(StatisticsBuffer);
+        StatisticsBuffer = NULL;
+    }
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcRecordCallback(
+    _In_ DRIVER_CALLBACK_TYPE Callback
+    )
+/*++
+
+Summary:
+
+    This function increments the invocation counter for the operation 'Callback' given.
+
+Arguments:
+
+    Callback - Type of the callback invoked.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PSTATISTICS_SLOT slot = LcGetStatisticsSlot();
+
+    IF_FALSE_RETURN(slot != NULL);
+    IF_FALSE_RETURN((ULONG)Callback < DriverCallbackTypeCount);
+
+    InterlockedIncrement64(&slot->CallbackCounts[Callback]);
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+LONGLONG
+LcGetStatisticsTimestamp()
+/*++
+
+Summary:
+
+    This function returns the current timestamp to be passed to the 'LcRecordFetchPhase',
+    when the measured operation is finished.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    Current performance counter value.
+
+--*/
+{
+    return KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcRecordFetchPhase(
+    _In_ FETCH_PHASE Phase,
+    _In_ ULONG       ProcessId,
+    _In_ LONGLONG    StartTimestamp,
+    _In_ LONGLONG    Bytes,
+    _In_ NTSTATUS    Status
+    )
+/*++
+
+Summary:
+
+    This function adds the time passed since the 'StartTimestamp' to the latency
+    histogram of the fetch 'Phase' given, and writes the 'File_Fetch_Phase' ETW event.
+
+    The event uses the activity ID of the current thread, so it is correlated with the
+    fetch started by the 'LcStartFetchActivity'.
+
+Arguments:
+
+    Phase          - Fetch phase finished.
+
+    ProcessId      - ID of the process, which access triggered the fetch.
+                     The fetch may be performed by the worker thread, so it's not the current process.
+
+    StartTimestamp - Value returned by the 'LcGetStatisticsTimestamp', when the phase was started.
+
+    Bytes          - Amount of bytes processed during the phase.
+                     For the read and write phases, it's also added to the byte counters.
+
+    Status         - Status the phase finished with.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PSTATISTICS_SLOT slot        = LcGetStatisticsSlot();
+    LONGLONG         elapsedTime = 0;
+
+    IF_FALSE_RETURN(slot != NULL);
+    IF_FALSE_RETURN((ULONG)Phase < FetchPhaseCount);
+
+    elapsedTime = LcGetElapsedTime(StartTimestamp);
+
+    InterlockedIncrement64(&slot->FetchLatency[Phase][LcGetLatencyBucket(elapsedTime)]);
+
+    if (Phase == FetchPhaseRead && Bytes > 0)
+    {
+        InterlockedExchangeAdd64(&slot->BytesRead, Bytes);
+    }
+    else if (Phase == FetchPhaseWrite && Bytes > 0)
+    {
+        InterlockedExchangeAdd64(&slot->BytesWritten, Bytes);
+    }
+
+    EventWriteFile_Fetch_Phase(NULL, (ULONG)Phase, ProcessId, Bytes, elapsedTime, Status);
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcRecordFetchResult(
+    _In_ NTSTATUS Status,
+    _In_ LONGLONG BytesFetched
+    )
+/*++
+
+Summary:
+
+    This function updates the fetch counters, when the file fetch is finished.
+
+Arguments:
+
+    Status       - Status of the fetch operation.
+
+    BytesFetched - Amount of bytes fetched.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PSTATISTICS_SLOT slot = LcGetStatisticsSlot();
+
+    IF_FALSE_RETURN(slot != NULL);
+
+    if (!NT_SUCCESS(Status))
+    {
+        InterlockedIncrement64(&slot->FetchesFailed);
+        return;
+    }
+
+    InterlockedIncrement64(&slot->FetchesCompleted);
+    InterlockedExchangeAdd64(&slot->BytesFetched, BytesFetched);
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcRecordPlaceholderLookup(
+    _In_ BOOLEAN Found
+    )
+/*++
+
+Summary:
+
+    This function updates the placeholder cache hit or miss counter.
+
+Arguments:
+
+    Found - Whether the file name was found in the placeholder cache.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PSTATISTICS_SLOT slot = LcGetStatisticsSlot();
+
+    IF_FALSE_RETURN(slot != NULL);
+
+    InterlockedIncrement64(Found ? &slot->PlaceholderCacheHits : &slot->PlaceholderCacheMisses);
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcRecordPlaceholderOpen(
+    _In_ BOOLEAN CreateReissued
+    )
+/*++
+
+Summary:
+
+    This function updates the placeholder open counters.
+
+Arguments:
+
+    CreateReissued - Whether the create operation had to be reissued to
+                     open the LazyCopy file.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PSTATISTICS_SLOT slot = LcGetStatisticsSlot();
+
+    IF_FALSE_RETURN(slot != NULL);
+
+    InterlockedIncrement64(CreateReissued ? &slot->CreatesReissued : &slot->CreatesNotReissued);
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcRecordDirectoryQuery(
+    _In_ BOOLEAN Skipped
+    )
+/*++
+
+Summary:
+
+    This function updates the directory query counters.
+
+Arguments:
+
+    Skipped - Whether the query results are passed through, because the directory
+              is known to contain no LazyCopy files.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PSTATISTICS_SLOT slot = LcGetStatisticsSlot();
+
+    IF_FALSE_RETURN(slot != NULL);
+
+    InterlockedIncrement64(Skipped ? &slot->DirectoryQueriesSkipped : &slot->DirectoryQueriesProcessed);
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcRecordNegativeCacheLookup(
+    _In_ BOOLEAN Found
+    )
+/*++
+
+Summary:
+
+    This function updates the negative cache hit or miss counter.
+
+Arguments:
+
+    Found - Whether the file was found in the negative cache.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PSTATISTICS_SLOT slot = LcGetStatisticsSlot();
+
+    IF_FALSE_RETURN(slot != NULL);
+
+    InterlockedIncrement64(Found ? &slot->NegativeCacheHits : &slot->NegativeCacheMisses);
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcUpdateNotificationQueueDepth(
+    _In_ NOTIFICATION_LANE Lane,
+    _In_ LONG              Delta
+    )
+/*++
+
+Summary:
+
+    This function adjusts the amount of notifications waiting for the client reply in the lane given.
+
+Arguments:
+
+    Lane  - Lane the notification is sent through.
+
+    Delta - 1, when the notification is sent, and -1, when the reply is received or the send fails.
+
+Return value:
+
+    None.
+
+--*/
+{
+    FLT_ASSERT(Lane < NotificationLaneCount);
+
+    InterlockedExchangeAdd(&NotificationQueueDepth[Lane], Delta);
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcQueryStatistics(
+    _Out_ PDRIVER_STATISTICS Statistics
+    )
+/*++
+
+Summary:
+
+    This function sums the statistics collected on all processors.
+
+    Slots are not locked, so the counters being updated at the moment might be
+    slightly behind each other.
+
+Arguments:
+
+    Statistics - Pointer to the structure that receives the statistics.
+
+Return value:
+
+    None.
+
+--*/
+{
+    LARGE_INTEGER collectionTime = { 0 };
+    ULONG         idx            = 0;
+    ULONG         callback       = 0;
+    ULONG         phase          = 0;
+    ULONG         bucket         = 0;
+    ULONG         lane           = 0;
+
+    PAGED_CODE();
+
+    FLT_ASSERT(Statistics != NULL);
+
+    RtlZeroMemory(Statistics, sizeof(DRIVER_STATISTICS));
+
+    KeQuerySystemTime(&collectionTime);
+    Statistics->CollectionTime = collectionTime.QuadPart;
+
+    for (idx = 0; idx < StatisticsSlotCount; idx++)
+    {
+        PSTATISTICS_SLOT slot = &StatisticsSlots[idx];
+
+        for (callback = 0; callback < DriverCallbackTypeCount; callback++)
+        {
+            Statistics->CallbackCounts[callback] += slot->CallbackCounts[callback];
+        }
+
+        Statistics->FetchesCompleted += slot->FetchesCompleted;
+        Statistics->FetchesFailed    += slot->FetchesFailed;
+        Statistics->BytesRead        += slot->BytesRead;
+        Statistics->BytesWritten     += slot->BytesWritten;
+        Statistics->BytesFetched     += slot->BytesFetched;
+
+        Statistics->PlaceholderCacheHits   += slot->PlaceholderCacheHits;
+        Statistics->PlaceholderCacheMisses += slot->PlaceholderCacheMisses;
+        Statistics->CreatesReissued        += slot->CreatesReissued;
+        Statistics->CreatesNotReissued     += slot->CreatesNotReissued;
+
+        Statistics->DirectoryQueriesSkipped   += slot->DirectoryQueriesSkipped;
+        Statistics->DirectoryQueriesProcessed += slot->DirectoryQueriesProcessed;
+
+        Statistics->NegativeCacheHits   += slot->NegativeCacheHits;
+        Statistics->NegativeCacheMisses += slot->NegativeCacheMisses;
+
+        for (phase = 0; phase < FetchPhaseCount; phase++)
+        {
+            for (bucket = 0; bucket < STATISTICS_LATENCY_BUCKETS; bucket++)
+            {
+                Statistics->FetchLatency[phase][bucket] += slot->FetchLatency[phase][bucket];
+            }
+        }
+    }
+
+    for (lane = 0; lane < NotificationLaneCount; lane++)
+    {
+        Statistics->NotificationQueueDepth[lane] = NotificationQueueDepth[lane];
+    }
+}
+
+//------------------------------------------------------------------------
+
+_Check_return_
+BOOLEAN
+LcStartFetchActivity(
+    _Out_ LPGUID PreviousActivityId
+    )
+/*++
+
+Summary:
+
+    This function sets a new ETW activity ID for the current thread, so all events
+    written while the file is fetched can be correlated.
+
+    The 'LcStopFetchActivity' should be called with the 'PreviousActivityId' value,
+    when the fetch is finished.
+
+Arguments:
+
+    PreviousActivityId - Pointer to a variable that receives the activity ID the thread had before.
+
+Return value:
+
+    TRUE, if the new activity ID is set.
+
+--*/
+{
+    PAGED_CODE();
+
+    FLT_ASSERT(PreviousActivityId != NULL);
+
+    // Generates a new ID, sets it for the current thread and returns the previous one.
+    return NT_SUCCESS(EtwActivityIdControl(EVENT_ACTIVITY_CTRL_CREATE_SET_ID, PreviousActivityId));
+}
+
+//------------------------------------------------------------------------
+
+VOID
+LcStopFetchActivity(
+    _In_ LPGUID PreviousActivityId
+    )
+/*++
+
+Summary:
+
+    This function restores the ETW activity ID the current thread had before
+    the 'LcStartFetchActivity' was called.
+
+Arguments:
+
+    PreviousActivityId - Activity ID returned by the 'LcStartFetchActivity'.
+
+Return value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    FLT_ASSERT(PreviousActivityId != NULL);
+
+    (VOID)EtwActivityIdControl(EVENT_ACTIVITY_CTRL_SET_ID, PreviousActivityId);
+}
+
+//------------------------------------------------------------------------
+//  Local functions.
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+PSTATISTICS_SLOT
+LcGetStatisticsSlot()
+/*++
+
+Summary:
+
+    This function returns the statistics slot that belongs to the current processor.
+
+    The thread might be moved to another processor right after this call, so the slot
+    should only be updated with the interlocked operations. They are cheap, because
+    the slot's cache line is rarely shared.
+
+Arguments:
+
+    None.
+
+Return value:
+
+    Statistics slot to use, or NULL, if the statistics are not initialized.
+
+--*/
+{
+    if (StatisticsSlots == NULL)
+    {
+        return NULL;
+    }
+
+#if PLATFORM_WIN7
+    return &StatisticsSlots[KeGetCurrentProcessorNumberEx(NULL) % StatisticsSlotCount];
+#else
+    return &StatisticsSlots[KeGetCurrentProcessorNumber() % StatisticsSlotCount];
+#endif // PLATFORM_WIN7
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+LONGLONG
+LcGetElapsedTime(
+    _In_ LONGLONG StartTimestamp
+    )
+/*++
+
+Summary:
+
+    This function returns the time passed since the 'StartTimestamp'.
+
+Arguments:
+
+    StartTimestamp - Value returned by the 'LcGetStatisticsTimestamp'.
+
+Return value:
+
+    Elapsed time in 100-nanosecond units.
+
+--*/
+{
+    LONGLONG elapsedTicks = LcGetStatisticsTimestamp() - StartTimestamp;
+
+    if (elapsedTicks <= 0 || PerformanceFrequency <= 0)
+    {
+        return 0;
+    }
+
+    // Split the conversion, so the multiplication doesn't overflow for the long operations.
+    return (elapsedTicks / PerformanceFrequency) * 10000000
+           + (elapsedTicks % PerformanceFrequency) * 10000000 / PerformanceFrequency;
+}
+
+//------------------------------------------------------------------------
+
+static
+_Check_return_
+ULONG
+LcGetLatencyBucket(
+    _In_ LONGLONG ElapsedTime
+    )
+/*++
+
+Summary:
+
+    This function converts the elapsed time into the latency histogram bucket.
+    See the 'STATISTICS_LATENCY_BUCKETS' for more details.
+
+Arguments:
+
+    ElapsedTime - Elapsed time in 100-nanosecond units.
+
+Return value:
+
+    Histogram bucket index.
+
+--*/
+{
+    ULONGLONG microseconds = ElapsedTime > 0 ? (ULONGLONG)ElapsedTime / 10 : 0;
+    ULONG     bucket       = 0;
+
+    while (microseconds != 0 && bucket < STATISTICS_LATENCY_BUCKETS - 1)
+    {
+        microseconds >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
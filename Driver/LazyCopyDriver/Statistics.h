@@ -0,0 +1,128 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    Statistics.h
+
+Abstract:
+
+    Contains per-processor statistics and fetch tracing function declarations.
+
+Environment:
+
+    Kernel mode.
+
+--*/
+
+#pragma once
+#ifndef __LAZY_COPY_STATISTICS_H__
+#define __LAZY_COPY_STATISTICS_H__
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#include "Globals.h"
+#include "CommunicationData.h"
+
+//------------------------------------------------------------------------
+//  Statistics function prototypes.
+//------------------------------------------------------------------------
+
+_Check_return_
+NTSTATUS
+LcInitializeStatistics();
+
+VOID
+LcFreeStatistics();
+
+VOID
+LcRecordCallback(
+    _In_ DRIVER_CALLBACK_TYPE Callback
+    );
+
+_Check_return_
+LONGLONG
+LcGetStatisticsTimestamp();
+
+VOID
+LcRecordFetchPhase(
+    _In_ FETCH_PHASE Phase,
+    _In_ ULONG       ProcessId,
+    _In_ LONGLONG    StartTimestamp,
+    _In_ LONGLONG    Bytes,
+    _In_ NTSTATUS    Status
+    );
+
+VOID
+LcRecordFetchResult(
+    _In_ NTSTATUS Status,
+    _In_ LONGLONG BytesFetched
+    );
+
+VOID
+LcRecordPlaceholderLookup(
+    _In_ BOOLEAN Found
+    );
+
+VOID
+LcRecordPlaceholderOpen(
+    _In_ BOOLEAN CreateReissued
+    );
+
+VOID
+LcRecordDirectoryQuery(
+    _In_ BOOLEAN Skipped
+    );
+
+VOID
+LcRecordNegativeCacheLookup(
+    _In_ BOOLEAN Found
+    );
+
+VOID
+LcUpdateNotificationQueueDepth(
+    _In_ NOTIFICATION_LANE Lane,
+    _In_ LONG              Delta
+    );
+
+VOID
+LcQueryStatistics(
+    _Out_ PDRIVER_STATISTICS Statistics
+    );
+
+_Check_return_
+BOOLEAN
+LcStartFetchActivity(
+    _Out_ LPGUID PreviousActivityId
+    );
+
+VOID
+LcStopFetchActivity(
+    _In_ LPGUID PreviousActivityId
+    );
+
+#endif // __LAZY_COPY_STATISTICS_H__
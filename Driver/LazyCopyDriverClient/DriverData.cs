@@ -27,6 +27,7 @@
 namespace LazyCopy.DriverClient
 {
     using System;
+    using System.Collections.Generic;
     using System.Globalization;
     using System.Runtime.InteropServices;
 
@@ -54,7 +55,18 @@ namespace LazyCopy.DriverClient
         /// <summary>
         /// Watch is enabled.
         /// </summary>
-        WatchEnabled = 2
+        WatchEnabled = 2,
+
+        /// <summary>
+        /// File access events are sampled by the path hash instead of randomly, so the same files are reported every time.
+        /// </summary>
+        SampleByPath = 4,
+
+        /// <summary>
+        /// File accesses are counted by the driver, and should be drained with the <see cref="LazyCopyDriverClient.DrainFileAccesses"/>,
+        /// instead of raising an ETW event per access.
+        /// </summary>
+        AggregateAccesses = 8
     }
 
     /// <summary>
@@ -90,7 +102,171 @@ namespace LazyCopy.DriverClient
         /// <summary>
         /// Sets the driver's report rate.
         /// </summary>
-        SetReportRate = 103
+        SetReportRate = 103,
+
+        /// <summary>
+        /// Sets the list of rules defining the volumes the driver attaches to.
+        /// </summary>
+        SetVolumePolicy = 104,
+
+        /// <summary>
+        /// Sets the operation mode, report rate, watch paths and, optionally, the volume policy at once.
+        /// </summary>
+        ApplyConfiguration = 105,
+
+        /// <summary>
+        /// Moves the file access records collected by the driver to the response.
+        /// </summary>
+        DrainFileAccesses = 200,
+
+        /// <summary>
+        /// Gets the operation counters and fetch latency histograms.
+        /// </summary>
+        GetStatistics = 201,
+
+        /// <summary>
+        /// Gets the progress of the file fetches in flight.
+        /// </summary>
+        GetActiveFetches = 202,
+
+        /// <summary>
+        /// Maps the notification ring into the client process.
+        /// </summary>
+        MapNotificationRing = 300,
+
+        /// <summary>
+        /// Tells the driver that the replies are written to the notification ring.
+        /// </summary>
+        CompleteRingNotifications = 301
+    }
+
+    /// <summary>
+    /// Driver operation callback counted in the <see cref="DriverStatistics"/>.
+    /// </summary>
+    public enum DriverCallbackType
+    {
+        /// <summary>
+        /// Pre-create callback.
+        /// </summary>
+        PreCreate = 0,
+
+        /// <summary>
+        /// Post-create callback.
+        /// </summary>
+        PostCreate = 1,
+
+        /// <summary>
+        /// Pre-read, pre-write and pre-acquire for section synchronization callback.
+        /// </summary>
+        PreReadWrite = 2,
+
+        /// <summary>
+        /// Pre-query information callback.
+        /// </summary>
+        PreQueryInformation = 3,
+
+        /// <summary>
+        /// Post-query information callback.
+        /// </summary>
+        PostQueryInformation = 4,
+
+        /// <summary>
+        /// Pre-directory control callback.
+        /// </summary>
+        PreDirectoryControl = 5,
+
+        /// <summary>
+        /// Post-directory control callback.
+        /// </summary>
+        PostDirectoryControl = 6,
+
+        /// <summary>
+        /// Pre-file system control callback.
+        /// </summary>
+        PreFileSystemControl = 7,
+
+        /// <summary>
+        /// Pre-set information callback.
+        /// </summary>
+        PreSetInformation = 8,
+
+        /// <summary>
+        /// Post-file system control callback.
+        /// </summary>
+        PostFileSystemControl = 9,
+
+        /// <summary>
+        /// Post-set information callback.
+        /// </summary>
+        PostSetInformation = 10
+    }
+
+    /// <summary>
+    /// Phase of the file fetch, which latency is measured by the driver.
+    /// </summary>
+    public enum FetchPhase
+    {
+        /// <summary>
+        /// Opening the remote file.
+        /// </summary>
+        Open = 0,
+
+        /// <summary>
+        /// Querying the remote file size.
+        /// </summary>
+        SizeQuery = 1,
+
+        /// <summary>
+        /// Reading a single chunk from the remote file.
+        /// </summary>
+        Read = 2,
+
+        /// <summary>
+        /// Writing a single chunk to the local file.
+        /// </summary>
+        Write = 3,
+
+        /// <summary>
+        /// Removing the reparse point from the fetched file.
+        /// </summary>
+        Untag = 4,
+
+        /// <summary>
+        /// Whole fetch, including the ones performed by the user-mode client.
+        /// </summary>
+        Total = 5,
+
+        /// <summary>
+        /// Waiting for another thread fetching the same file.
+        /// </summary>
+        LockWait = 6,
+
+        /// <summary>
+        /// Checking the reparse tag of the file to be fetched.
+        /// </summary>
+        ReparseRead = 7,
+
+        /// <summary>
+        /// Deleting the stream context from the fetched file.
+        /// </summary>
+        ContextDelete = 8
+    }
+
+    /// <summary>
+    /// Lane the driver sends notifications through.
+    /// Each connection serves a set of lanes, so the short requests don't wait behind the long ones.
+    /// </summary>
+    public enum NotificationLane
+    {
+        /// <summary>
+        /// Latency-sensitive requests: opening and closing files in the user-mode.
+        /// </summary>
+        Latency = 0,
+
+        /// <summary>
+        /// Bulk requests: fetching files in the user-mode.
+        /// </summary>
+        Bulk = 1
     }
 
     /// <summary>
@@ -157,6 +333,389 @@ namespace LazyCopy.DriverClient
         }
     }
 
+    /// <summary>
+    /// Rule for the <see cref="DriverCommandType.SetVolumePolicy"/> command.
+    /// </summary>
+    [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Performance", "CA1815:OverrideEqualsAndOperatorEqualsOnValueTypes",
+        Justification = "This structure is a part of the communication protocol and the equality methods are not needed.")]
+    public struct VolumePolicyRule
+    {
+        /// <summary>
+        /// Volume selector: <c>*</c>, <c>FS:&lt;name&gt;</c>, <c>GUID:&lt;guid&gt;</c> or <c>LABEL:&lt;label&gt;</c>.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public string Selector;
+
+        /// <summary>
+        /// Size of the chunks used to fetch files. Zero means the driver's default value.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public int ChunkSize;
+
+        /// <summary>
+        /// Maximum amount of chunks used to fetch a file. Zero means the driver's default value.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public int MaxChunks;
+
+        /// <summary>
+        /// Files of this size or larger are written bypassing the system cache. Zero disables it.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public int UnbufferedThreshold;
+    }
+
+    /// <summary>
+    /// Rule for the <see cref="DriverCommandType.SetWatchPaths"/> command.
+    /// </summary>
+    [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Performance", "CA1815:OverrideEqualsAndOperatorEqualsOnValueTypes",
+        Justification = "This structure is a part of the communication protocol and the equality methods are not needed.")]
+    public struct WatchPathRule
+    {
+        /// <summary>
+        /// Path to watch. Files in this directory and its subdirectories match the rule.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public string Path;
+
+        /// <summary>
+        /// Report rate for the files matching this rule, or <see cref="LazyCopyDriverClient.GlobalReportRate"/>
+        /// to use the value set by the <see cref="LazyCopyDriverClient.SetReportRate"/>.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public int ReportRate;
+
+        /// <summary>
+        /// Optional file extension filter, for example: <c>dll</c>. Empty value matches any file.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public string Extension;
+
+        /// <summary>
+        /// Optional process filter. Zero matches any process.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public int ProcessId;
+    }
+
+    /// <summary>
+    /// Contains access statistics collected by the driver for a single file.
+    /// </summary>
+    [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Performance", "CA1815:OverrideEqualsAndOperatorEqualsOnValueTypes",
+        Justification = "This structure is a part of the communication protocol and the equality methods are not needed.")]
+    public struct FileAccessRecord
+    {
+        /// <summary>
+        /// Path to the file accessed. It's in the DOS name format, for example: <c>\Device\HarddiskVolume1\Folder\File.txt</c>
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public string Path;
+
+        /// <summary>
+        /// Amount of times the file access was reported.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long AccessCount;
+
+        /// <summary>
+        /// Time of the first reported file access, in UTC.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public DateTime FirstAccessTime;
+
+        /// <summary>
+        /// Time of the last reported file access, in UTC.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public DateTime LastAccessTime;
+    }
+
+    /// <summary>
+    /// Response for the <see cref="DriverCommandType.DrainFileAccesses"/> command.
+    /// </summary>
+    [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Performance", "CA1815:OverrideEqualsAndOperatorEqualsOnValueTypes",
+        Justification = "This structure is a part of the communication protocol and the equality methods are not needed.")]
+    public struct FileAccessBatch
+    {
+        /// <summary>
+        /// File access records drained from the driver.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public IList<FileAccessRecord> Records;
+
+        /// <summary>
+        /// Amount of records left in the driver, because they didn't fit into the response.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public int RemainingCount;
+
+        /// <summary>
+        /// Amount of file accesses the driver did not record since the previous drain, because its table was full.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long DroppedCount;
+    }
+
+    /// <summary>
+    /// Response for the <see cref="DriverCommandType.GetStatistics"/> command.
+    /// </summary>
+    /// <remarks>
+    /// All counters are accumulated since the driver was loaded, so the rates should be calculated
+    /// using the difference between two snapshots.
+    /// </remarks>
+    [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Performance", "CA1815:OverrideEqualsAndOperatorEqualsOnValueTypes",
+        Justification = "This structure is a part of the communication protocol and the equality methods are not needed.")]
+    public struct DriverStatistics
+    {
+        /// <summary>
+        /// Time the statistics were collected at, in UTC.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public DateTime CollectionTime;
+
+        /// <summary>
+        /// Amount of times each operation callback was invoked.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public IDictionary<DriverCallbackType, long> CallbackCounts;
+
+        /// <summary>
+        /// Amount of files fetched successfully.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long FetchesCompleted;
+
+        /// <summary>
+        /// Amount of files the driver failed to fetch.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long FetchesFailed;
+
+        /// <summary>
+        /// Amount of bytes read from the remote files by the driver.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long BytesRead;
+
+        /// <summary>
+        /// Amount of bytes written to the local files by the driver.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long BytesWritten;
+
+        /// <summary>
+        /// Amount of bytes fetched, including the files fetched by the user-mode client.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long BytesFetched;
+
+        /// <summary>
+        /// Amount of placeholder cache lookups that found the file name.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long PlaceholderCacheHits;
+
+        /// <summary>
+        /// Amount of placeholder cache lookups that did not find the file name.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long PlaceholderCacheMisses;
+
+        /// <summary>
+        /// Amount of LazyCopy file opens that required the create operation to be reissued.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long CreatesReissued;
+
+        /// <summary>
+        /// Amount of LazyCopy file opens that were completed with a single create operation.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long CreatesNotReissued;
+
+        /// <summary>
+        /// Amount of directory queries passed through, because the directory is known to contain no LazyCopy files.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long DirectoryQueriesSkipped;
+
+        /// <summary>
+        /// Amount of directory queries, which results were processed by the driver.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long DirectoryQueriesProcessed;
+
+        /// <summary>
+        /// Amount of create operations skipped, because the file is known not to be a LazyCopy file.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long NegativeCacheHits;
+
+        /// <summary>
+        /// Amount of create operations, which file was not found in the negative cache.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long NegativeCacheMisses;
+
+        /// <summary>
+        /// Latency histograms for each fetch phase.
+        /// Bucket <c>0</c> counts operations faster than 1 microsecond, and the bucket <c>N</c> counts the ones that
+        /// took [2^(N-1), 2^N) microseconds. The last bucket also counts all slower operations.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public IDictionary<FetchPhase, long[]> FetchLatency;
+
+        /// <summary>
+        /// Amount of notifications waiting for the client reply in each lane.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public IDictionary<NotificationLane, long> NotificationQueueDepth;
+
+        /// <summary>
+        /// Estimates the latency <paramref name="percentile"/> for the fetch <paramref name="phase"/> given.
+        /// </summary>
+        /// <param name="phase">Fetch phase.</param>
+        /// <param name="percentile">Percentile to estimate, for example: <c>99</c>.</param>
+        /// <returns>
+        /// Upper bound of the histogram bucket containing the <paramref name="percentile"/>, or <see cref="TimeSpan.Zero"/>,
+        /// if there were no operations measured.
+        /// </returns>
+        /// <exception cref="ArgumentOutOfRangeException"><paramref name="percentile"/> is not within the 0 - 100 range.</exception>
+        public TimeSpan GetLatencyPercentile(FetchPhase phase, double percentile)
+        {
+            if (percentile < 0 || percentile > 100)
+            {
+                throw new ArgumentOutOfRangeException(nameof(percentile), percentile, "Percentile should be within 0 - 100 range");
+            }
+
+            long[] histogram;
+            if (this.FetchLatency == null || !this.FetchLatency.TryGetValue(phase, out histogram))
+            {
+                return TimeSpan.Zero;
+            }
+
+            long total = 0;
+            foreach (long count in histogram)
+            {
+                total += count;
+            }
+
+            long threshold = (long)Math.Ceiling(total * percentile / 100);
+            long current   = 0;
+
+            for (int bucket = 0; bucket < histogram.Length; bucket++)
+            {
+                current += histogram[bucket];
+                if (current > 0 && current >= threshold)
+                {
+                    // One tick is 100 nanoseconds.
+                    return TimeSpan.FromTicks((1L << bucket) * 10);
+                }
+            }
+
+            return TimeSpan.Zero;
+        }
+    }
+
+    /// <summary>
+    /// Contains the progress of a single file fetch in flight.
+    /// </summary>
+    [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Performance", "CA1815:OverrideEqualsAndOperatorEqualsOnValueTypes",
+        Justification = "This structure is a part of the communication protocol and the equality methods are not needed.")]
+    public struct ActiveFetchRecord
+    {
+        /// <summary>
+        /// Path to the file being fetched. It's in the DOS name format, for example: <c>\Device\HarddiskVolume1\Folder\File.txt</c>
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public string LocalPath;
+
+        /// <summary>
+        /// Path to the remote file the content is fetched from.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public string RemotePath;
+
+        /// <summary>
+        /// Expected size of the file.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long FileSize;
+
+        /// <summary>
+        /// Amount of bytes written to the local file so far.
+        /// Files fetched by the user-mode client report zero until they are fetched.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public long BytesCopied;
+
+        /// <summary>
+        /// Time the fetch was started at, in UTC.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public DateTime StartTime;
+
+        /// <summary>
+        /// Time elapsed since the fetch was started till the snapshot was taken.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public TimeSpan Elapsed;
+
+        /// <summary>
+        /// ID of the process, which access triggered the fetch.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public int ProcessId;
+
+        /// <summary>
+        /// Amount of threads blocked, until the fetch is finished.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public int WaiterCount;
+
+        /// <summary>
+        /// Whether the file is fetched by the user-mode client.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public bool UserModeFetch;
+
+        /// <summary>
+        /// Gets the average fetch rate, in bytes per second.
+        /// </summary>
+        public double BytesPerSecond => this.Elapsed > TimeSpan.Zero ? this.BytesCopied / this.Elapsed.TotalSeconds : 0;
+
+        /// <summary>
+        /// Gets the fetch progress, in percents, or <c>0</c>, if the file size is not known.
+        /// </summary>
+        public double Progress => this.FileSize > 0 ? Math.Min(100, this.BytesCopied * 100.0 / this.FileSize) : 0;
+    }
+
+    /// <summary>
+    /// Response for the <see cref="DriverCommandType.GetActiveFetches"/> command.
+    /// </summary>
+    [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Performance", "CA1815:OverrideEqualsAndOperatorEqualsOnValueTypes",
+        Justification = "This structure is a part of the communication protocol and the equality methods are not needed.")]
+    public struct ActiveFetchSnapshot
+    {
+        /// <summary>
+        /// Time the snapshot was taken at, in UTC.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public DateTime CollectionTime;
+
+        /// <summary>
+        /// Fetches in flight ordered by their start time.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public IList<ActiveFetchRecord> Records;
+
+        /// <summary>
+        /// Amount of fetches not returned, because they didn't fit into the response.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public int RemainingCount;
+    }
+
     /// <summary>
     /// Contains data for the <see cref="DriverNotificationType.OpenFileInUserMode"/> notification.
     /// </summary>
@@ -217,6 +776,15 @@ namespace LazyCopy.DriverClient
         Justification = "This structure is a part of the communication protocol and the equality methods are not needed.")]
     public struct FetchFileInUserModeNotification
     {
+        /// <summary>
+        /// Handle to the target file opened for writing.
+        /// The handler owns it and should close it, when the fetch is finished, even if the driver has stopped waiting
+        /// for the reply, because the fetch has timed out or been cancelled.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Security", "CA2111:PointersShouldNotBeVisible",      Justification = "Declared as public to simplify access and assignment.")]
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1051:DoNotDeclareVisibleInstanceFields", Justification = "Declared as public to simplify access and assignment.")]
+        public IntPtr TargetHandle;
+
         /// <summary>
         /// Path to the file to fetch content from.
         /// </summary>
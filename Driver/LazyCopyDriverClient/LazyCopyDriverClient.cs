@@ -32,8 +32,11 @@ namespace LazyCopy.DriverClient
     using System.Linq;
     using System.Runtime.InteropServices;
     using System.Text;
+    using System.Threading;
+    using System.Threading.Tasks;
 
     using LazyCopy.DriverClientLibrary;
+    using Microsoft.Win32.SafeHandles;
     using LazyCopy.Utilities;
 
     /// <summary>
@@ -48,16 +51,62 @@ namespace LazyCopy.DriverClient
         /// </summary>
         public const int MaxReportRate = 10000;
 
+        /// <summary>
+        /// Watch rule report rate value meaning that the driver's 'ReportRate' variable is used.
+        /// </summary>
+        public const int GlobalReportRate = -1;
+
         /// <summary>
         /// Default communication port name.
         /// </summary>
         public const string DefaultPortName = "\\LazyCopyDriverPort";
 
+        /// <summary>
+        /// Name of the port for the monitoring tools.
+        /// It only accepts the commands querying the driver state, and can be used while the service is connected.
+        /// </summary>
+        public const string MonitorPortName = "\\LazyCopyDriverMonitorPort";
+
         /// <summary>
         /// Default notification size value.
         /// </summary>
         private const int DefaultNotificationSize = 4 * 1024;
 
+        /// <summary>
+        /// Size of the response buffer for the <c>DrainFileAccesses</c> command.
+        /// </summary>
+        private const int FileAccessBatchSize = 64 * 1024;
+
+        /// <summary>
+        /// Initial size of the response buffer for the <c>GetActiveFetches</c> command.
+        /// </summary>
+        private const int ActiveFetchesSize = 16 * 1024;
+
+        /// <summary>
+        /// Maximum size of the response buffer for the <c>GetActiveFetches</c> command.
+        /// </summary>
+        private const int MaxActiveFetchesSize = 1024 * 1024;
+
+        /// <summary>
+        /// Version of the <c>DRIVER_CONFIGURATION</c> structure layout.
+        /// </summary>
+        private const int ConfigurationVersion = 1;
+
+        /// <summary>
+        /// Amount of buckets in each fetch latency histogram.
+        /// </summary>
+        private const int LatencyBucketCount = 32;
+
+        /// <summary>
+        /// Size of the <c>MapNotificationRing</c> command response.
+        /// </summary>
+        private const int NotificationRingMappingSize = 16;
+
+        /// <summary>
+        /// Event the driver signals, when new notifications are posted to the notification ring.
+        /// </summary>
+        private AutoResetEvent ringRequestEvent;
+
         #endregion // Fields
 
         #region Constructors
@@ -75,12 +124,49 @@ namespace LazyCopy.DriverClient
         /// Initializes a new instance of the <see cref="LazyCopyDriverClient"/> class.
         /// </summary>
         /// <param name="portName">Name of the port.</param>
+        /// <remarks>
+        /// A single connection serving all notification lanes is opened.
+        /// </remarks>
         public LazyCopyDriverClient(string portName)
             : base(portName, 1, LazyCopyDriverClient.DefaultNotificationSize)
         {
             // Do nothing.
         }
 
+        /// <summary>
+        /// Initializes a new instance of the <see cref="LazyCopyDriverClient"/> class.
+        /// </summary>
+        /// <param name="portName">Name of the port.</param>
+        /// <param name="connectionsPerLane">Amount of connections to open for each notification lane.</param>
+        /// <param name="latencyThreadCount">Amount of threads processing the <see cref="NotificationLane.Latency"/> notifications per connection.</param>
+        /// <param name="bulkThreadCount">Amount of threads processing the <see cref="NotificationLane.Bulk"/> notifications per connection.</param>
+        /// <remarks>
+        /// Each lane has its own connections and threads, so the files are opened without waiting for the fetches to finish.
+        /// </remarks>
+        public LazyCopyDriverClient(string portName, int connectionsPerLane, int latencyThreadCount, int bulkThreadCount)
+            : this(portName, connectionsPerLane, latencyThreadCount, bulkThreadCount, bulkThreadCount * 2)
+        {
+            // Do nothing.
+        }
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="LazyCopyDriverClient"/> class.
+        /// </summary>
+        /// <param name="portName">Name of the port.</param>
+        /// <param name="connectionsPerLane">Amount of connections to open for each notification lane.</param>
+        /// <param name="latencyThreadCount">Amount of threads processing the <see cref="NotificationLane.Latency"/> notifications per connection.</param>
+        /// <param name="bulkThreadCount">Amount of threads processing the <see cref="NotificationLane.Bulk"/> notifications per connection.</param>
+        /// <param name="bulkReceiveCount">Amount of <see cref="NotificationLane.Bulk"/> notifications that may be handled at once per connection.</param>
+        /// <remarks>
+        /// If the <see cref="FetchFileInUserModeAsyncHandler"/> is set, the fetches don't block the threads,
+        /// so the <paramref name="bulkReceiveCount"/> may be much larger than the <paramref name="bulkThreadCount"/>.
+        /// </remarks>
+        public LazyCopyDriverClient(string portName, int connectionsPerLane, int latencyThreadCount, int bulkThreadCount, int bulkReceiveCount)
+            : base(portName, LazyCopyDriverClient.DefaultNotificationSize, LazyCopyDriverClient.CreateLaneConnections(connectionsPerLane, latencyThreadCount, bulkThreadCount, bulkReceiveCount))
+        {
+            // Do nothing.
+        }
+
         #endregion // Constructor
 
         #region Properties
@@ -100,6 +186,12 @@ namespace LazyCopy.DriverClient
         /// </summary>
         public Func<FetchFileInUserModeNotification, FetchFileInUserModeNotificationReply> FetchFileInUserModeHandler { get; set; }
 
+        /// <summary>
+        /// Gets or sets the asynchronous <c>FetchFileInUserMode</c> notification handler.
+        /// If set, the fetches received via the ports don't occupy any threads, while they are in progress.
+        /// </summary>
+        public Func<FetchFileInUserModeNotification, Task<FetchFileInUserModeNotificationReply>> FetchFileInUserModeAsyncHandler { get; set; }
+
         #endregion // Properties
 
         #region Public methods
@@ -127,11 +219,26 @@ namespace LazyCopy.DriverClient
         /// <summary>
         /// Sets the list of paths the driver should watch.
         /// </summary>
-        /// <param name="paths">List of paths to watch and their report rates. Should be in DOS name format, for example: <c>\Device\HarddiskVolume1\Folder\</c></param>
+        /// <param name="paths">List of paths to watch. Should be in DOS name format, for example: <c>\Device\HarddiskVolume1\Folder\</c></param>
+        /// <remarks>
+        /// Files in all <paramref name="paths"/> are reported using the global report rate.
+        /// </remarks>
         /// <exception cref="InvalidOperationException">Client is not connected to the driver.</exception>
         public void SetWatchPaths(string[] paths)
         {
-            byte[] data = LazyCopyDriverClient.GetWatchPathsData(paths);
+            IEnumerable<WatchPathRule> rules = (paths ?? new string[0]).Select(path => new WatchPathRule { Path = path, ReportRate = LazyCopyDriverClient.GlobalReportRate });
+            this.SetWatchPaths(rules);
+        }
+
+        /// <summary>
+        /// Sets the list of rules defining the paths the driver should watch.
+        /// </summary>
+        /// <param name="rules">List of rules. If several rules match the same file, the one with the longest path is used.</param>
+        /// <exception cref="ArgumentException">One of the <paramref name="rules"/> has empty path or invalid report rate.</exception>
+        /// <exception cref="InvalidOperationException">Client is not connected to the driver.</exception>
+        public void SetWatchPaths(IEnumerable<WatchPathRule> rules)
+        {
+            byte[] data = LazyCopyDriverClient.GetWatchPathsData(rules);
             this.ExecuteCommand(new DriverCommand(DriverCommandType.SetWatchPaths, data));
         }
 
@@ -161,25 +268,172 @@ namespace LazyCopy.DriverClient
         /// <exception cref="ArgumentOutOfRangeException"><paramref name="reportRate"/> is invalid.</exception>
         public void SetReportRate(int reportRate)
         {
-            if (reportRate < 0 || reportRate > LazyCopyDriverClient.MaxReportRate)
+            LazyCopyDriverClient.ValidateReportRate(reportRate);
+            this.ExecuteCommand(new DriverCommand(DriverCommandType.SetReportRate, BitConverter.GetBytes(reportRate)));
+        }
+
+        /// <summary>
+        /// Sets the list of rules defining the volumes the driver attaches to, and the fetch parameters for them.
+        /// </summary>
+        /// <param name="rules">List of volume policy rules. If it's empty, the driver attaches to all NTFS volumes.</param>
+        /// <exception cref="InvalidOperationException">Client is not connected to the driver.</exception>
+        public void SetVolumePolicy(IEnumerable<VolumePolicyRule> rules)
+        {
+            this.ExecuteCommand(new DriverCommand(DriverCommandType.SetVolumePolicy, LazyCopyDriverClient.GetVolumePolicyData(rules)));
+        }
+
+        /// <summary>
+        /// Applies the whole driver configuration with a single command.
+        /// </summary>
+        /// <param name="mode">New operation mode.</param>
+        /// <param name="reportRate">New report rate.</param>
+        /// <param name="watchPaths">List of rules defining the paths the driver should watch.</param>
+        /// <param name="volumePolicy">List of volume policy rules. If it's <see langword="null"/>, the current volume policy is kept.</param>
+        /// <remarks>
+        /// The driver either applies all parameters at once, or disables itself, if any of them cannot be applied.
+        /// </remarks>
+        /// <exception cref="ArgumentOutOfRangeException"><paramref name="reportRate"/> is invalid.</exception>
+        /// <exception cref="ArgumentException">One of the rules is invalid.</exception>
+        /// <exception cref="InvalidOperationException">Client is not connected to the driver.</exception>
+        public void ApplyConfiguration(OperationMode mode, int reportRate, IEnumerable<WatchPathRule> watchPaths, IEnumerable<VolumePolicyRule> volumePolicy)
+        {
+            LazyCopyDriverClient.ValidateReportRate(reportRate);
+
+            // See the 'DRIVER_CONFIGURATION' structure for more details.
+            const int HeaderSize = 20;
+
+            byte[] watchPathsData   = LazyCopyDriverClient.GetWatchPathsData(watchPaths);
+            byte[] volumePolicyData = volumePolicy == null ? null : LazyCopyDriverClient.GetVolumePolicyData(volumePolicy);
+
+            // Both sections have ULONG-aligned size, so the volume policy offset is aligned, too.
+            int volumePolicyOffset = volumePolicyData == null ? 0 : HeaderSize + watchPathsData.Length;
+
+            List<byte> data = new List<byte>(HeaderSize + watchPathsData.Length + (volumePolicyData?.Length ?? 0));
+            data.AddRange(BitConverter.GetBytes(LazyCopyDriverClient.ConfigurationVersion));
+            data.AddRange(BitConverter.GetBytes((int)mode));
+            data.AddRange(BitConverter.GetBytes(reportRate));
+            data.AddRange(BitConverter.GetBytes(HeaderSize));
+            data.AddRange(BitConverter.GetBytes(volumePolicyOffset));
+            data.AddRange(watchPathsData);
+
+            if (volumePolicyData != null)
             {
-                throw new ArgumentOutOfRangeException(
-                    nameof(reportRate),
-                    reportRate,
-                    string.Format(
-                        CultureInfo.InvariantCulture,
-                        "Report rate should be within {0} - {1} range",
-                        0,
-                        LazyCopyDriverClient.MaxReportRate));
+                data.AddRange(volumePolicyData);
             }
 
-            this.ExecuteCommand(new DriverCommand(DriverCommandType.SetReportRate, BitConverter.GetBytes(reportRate)));
+            this.ExecuteCommand(new DriverCommand(DriverCommandType.ApplyConfiguration, data.ToArray()));
+        }
+
+        /// <summary>
+        /// Moves the next batch of file access records collected by the driver, if the <see cref="OperationMode.AggregateAccesses"/> mode is set.
+        /// </summary>
+        /// <returns>
+        /// Batch of the oldest records. If the <see cref="FileAccessBatch.RemainingCount"/> is not zero, this method should be called again.
+        /// </returns>
+        /// <exception cref="InvalidOperationException">Client is not connected to the driver.</exception>
+        public FileAccessBatch DrainFileAccesses()
+        {
+            byte[] data = this.ExecuteCommand(new DriverCommand(DriverCommandType.DrainFileAccesses), LazyCopyDriverClient.FileAccessBatchSize);
+            return LazyCopyDriverClient.ParseFileAccesses(data);
+        }
+
+        /// <summary>
+        /// Gets the operation counters and fetch latency histograms collected by the driver.
+        /// </summary>
+        /// <returns>Driver statistics.</returns>
+        /// <exception cref="InvalidOperationException">Client is not connected to the driver.</exception>
+        public DriverStatistics GetStatistics()
+        {
+            int responseSize = LazyCopyDriverClient.GetStatisticsSize();
+            byte[] data      = this.ExecuteCommand(new DriverCommand(DriverCommandType.GetStatistics), responseSize);
+
+            return LazyCopyDriverClient.ParseStatistics(data);
+        }
+
+        /// <summary>
+        /// Gets the progress of the file fetches the driver is currently performing.
+        /// </summary>
+        /// <returns>
+        /// Snapshot of the fetches in flight. The <see cref="ActiveFetchSnapshot.RemainingCount"/> is only non-zero,
+        /// if there are too many fetches to fit into the largest response buffer.
+        /// </returns>
+        /// <exception cref="InvalidOperationException">Client is not connected to the driver.</exception>
+        public ActiveFetchSnapshot GetActiveFetches()
+        {
+            int responseSize = LazyCopyDriverClient.ActiveFetchesSize;
+
+            for (;;)
+            {
+                byte[] data                  = this.ExecuteCommand(new DriverCommand(DriverCommandType.GetActiveFetches), responseSize);
+                ActiveFetchSnapshot snapshot = LazyCopyDriverClient.ParseActiveFetches(data);
+
+                if (snapshot.RemainingCount == 0 || responseSize >= LazyCopyDriverClient.MaxActiveFetchesSize)
+                {
+                    return snapshot;
+                }
+
+                responseSize *= 2;
+            }
+        }
+
+        /// <summary>
+        /// Asks the driver to post the notifications to the ring shared with the current process,
+        /// instead of sending each of them via the communication port.
+        /// </summary>
+        /// <remarks>
+        /// The ring can only be enabled once per client instance. It's unmapped by the driver, when the client disconnects.
+        /// Notifications that don't fit into the ring are still sent via the communication port.
+        /// </remarks>
+        /// <exception cref="InvalidOperationException">Client is not connected to the driver, or the ring is already enabled.</exception>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Reliability", "CA2001:AvoidCallingProblematicMethods", MessageId = "System.Runtime.InteropServices.SafeHandle.DangerousGetHandle",
+            Justification = "The event is disposed only after the client is disconnected.")]
+        public void EnableNotificationRing()
+        {
+            if (this.ringRequestEvent != null)
+            {
+                throw new InvalidOperationException("Notification ring is already enabled.");
+            }
+
+            AutoResetEvent requestEvent = new AutoResetEvent(false);
+
+            try
+            {
+                // See the 'NOTIFICATION_RING_MAPPING_REQUEST' and 'NOTIFICATION_RING_MAPPING' structures for more details.
+                IntPtr eventHandle = requestEvent.SafeWaitHandle.DangerousGetHandle();
+                byte[] data        = IntPtr.Size == 8 ? BitConverter.GetBytes(eventHandle.ToInt64()) : BitConverter.GetBytes(eventHandle.ToInt32());
+                byte[] response    = this.ExecuteCommand(new DriverCommand(DriverCommandType.MapNotificationRing, data), LazyCopyDriverClient.NotificationRingMappingSize);
+                IntPtr ring        = IntPtr.Size == 8 ? new IntPtr(BitConverter.ToInt64(response, 0)) : new IntPtr(BitConverter.ToInt32(response, 0));
+
+                this.StartNotificationRing(ring, requestEvent, new DriverCommand(DriverCommandType.CompleteRingNotifications));
+                this.ringRequestEvent = requestEvent;
+            }
+            catch
+            {
+                requestEvent.Dispose();
+                throw;
+            }
         }
 
         #endregion // Public methods
 
         #region Protected methods
 
+        /// <summary>
+        /// Releases unmanaged and - optionally - managed resources.
+        /// </summary>
+        /// <param name="disposing"><see langword="true"/> to release both managed and unmanaged resources; <see langword="false"/> to release only unmanaged resources.</param>
+        protected override void Dispose(bool disposing)
+        {
+            // Disconnect first, so the ring monitor is stopped before the event is disposed.
+            base.Dispose(disposing);
+
+            if (disposing && this.ringRequestEvent != null)
+            {
+                this.ringRequestEvent.Dispose();
+                this.ringRequestEvent = null;
+            }
+        }
+
         /// <summary>
         /// Handles notifications received from the driver.
         /// </summary>
@@ -233,58 +487,419 @@ namespace LazyCopy.DriverClient
                     Func<FetchFileInUserModeNotification, FetchFileInUserModeNotificationReply> fetchHandler = this.FetchFileInUserModeHandler;
                     if (fetchHandler != null)
                     {
-                        string sourceFile = Marshal.PtrToStringUni(driverNotification.Data);
-                        string targetFile = Marshal.PtrToStringUni(IntPtr.Add(driverNotification.Data, Marshal.SystemDefaultCharSize * (sourceFile.Length + 1)));
-
-                        FetchFileInUserModeNotification notification = new FetchFileInUserModeNotification
-                        {
-                            SourceFile = sourceFile,
-                            TargetFile = targetFile,
-                        };
+                        return fetchHandler(LazyCopyDriverClient.ReadFetchNotification(driverNotification));
+                    }
 
-                        return fetchHandler(notification);
+                    // Synchronous callers wait for the asynchronous handler.
+                    Func<FetchFileInUserModeNotification, Task<FetchFileInUserModeNotificationReply>> fetchAsyncHandler = this.FetchFileInUserModeAsyncHandler;
+                    if (fetchAsyncHandler != null)
+                    {
+                        return fetchAsyncHandler(LazyCopyDriverClient.ReadFetchNotification(driverNotification)).GetAwaiter().GetResult();
                     }
 
+                    // The client owns the target handle, once the notification is received, so it's closed, even if it's not handled.
+                    new SafeFileHandle(LazyCopyDriverClient.ReadFetchNotification(driverNotification).TargetHandle, true).Dispose();
                     break;
             }
 
             throw new InvalidOperationException(string.Format(CultureInfo.InvariantCulture, "No handler found for the notification of type {0}", driverNotification.Type));
         }
 
+        /// <summary>
+        /// Handles notifications received from the driver via the communication port asynchronously.
+        /// </summary>
+        /// <param name="driverNotification">Driver notification.</param>
+        /// <returns>Task that returns the reply to be sent back to the driver.</returns>
+        /// <remarks>
+        /// File fetches may take a long time, so they are handled by the thread pool, and the notification threads
+        /// can dispatch other notifications meanwhile.
+        /// </remarks>
+        protected override Task<object> NotificationsHandlerAsync(IDriverNotification driverNotification)
+        {
+            if (driverNotification?.Type == (int)DriverNotificationType.FetchFileInUserMode)
+            {
+                // The notification buffer is reused, once this method returns, so it's parsed right away.
+                Func<FetchFileInUserModeNotification, Task<FetchFileInUserModeNotificationReply>> fetchHandler = this.FetchFileInUserModeAsyncHandler;
+                if (fetchHandler != null)
+                {
+                    return LazyCopyDriverClient.FetchFileInUserModeAsync(fetchHandler, LazyCopyDriverClient.ReadFetchNotification(driverNotification));
+                }
+
+                return Task.Run(() => this.NotificationsHandler(driverNotification));
+            }
+
+            return base.NotificationsHandlerAsync(driverNotification);
+        }
+
         #endregion // Protected methods
 
         #region Private methods
 
         /// <summary>
-        /// Converts the <paramref name="paths"/> list into a byte array containing the amount of paths in the
-        /// <paramref name="paths"/> as a first <c>int</c>, and the unicode-converted list of paths after it.
+        /// Creates the settings for the connections serving each notification lane.
+        /// </summary>
+        /// <param name="connectionsPerLane">Amount of connections to open for each notification lane.</param>
+        /// <param name="latencyThreadCount">Amount of threads processing the <see cref="NotificationLane.Latency"/> notifications per connection.</param>
+        /// <param name="bulkThreadCount">Amount of threads processing the <see cref="NotificationLane.Bulk"/> notifications per connection.</param>
+        /// <param name="bulkReceiveCount">Amount of <see cref="NotificationLane.Bulk"/> notifications that may be handled at once per connection.</param>
+        /// <returns>Connection settings. Latency lane connections go first, so the commands are not sent via the busy ones.</returns>
+        /// <exception cref="ArgumentOutOfRangeException"><paramref name="connectionsPerLane"/> is lesser than one.</exception>
+        private static IEnumerable<ConnectionSettings> CreateLaneConnections(int connectionsPerLane, int latencyThreadCount, int bulkThreadCount, int bulkReceiveCount)
+        {
+            if (connectionsPerLane <= 0)
+            {
+                throw new ArgumentOutOfRangeException(nameof(connectionsPerLane), connectionsPerLane, "Connection count should be more than zero.");
+            }
+
+            // See the 'CLIENT_CONNECTION_CONTEXT' structure for more details.
+            ConnectionSettings latency = new ConnectionSettings(latencyThreadCount, BitConverter.GetBytes(1 << (int)NotificationLane.Latency));
+            ConnectionSettings bulk    = new ConnectionSettings(bulkThreadCount,    bulkReceiveCount, BitConverter.GetBytes(1 << (int)NotificationLane.Bulk));
+
+            return Enumerable.Repeat(latency, connectionsPerLane).Concat(Enumerable.Repeat(bulk, connectionsPerLane)).ToList();
+        }
+
+        /// <summary>
+        /// Reads the <see cref="FetchFileInUserModeNotification"/> from the <paramref name="driverNotification"/> data.
         /// </summary>
-        /// <param name="paths">List of paths to convert.</param>
+        /// <param name="driverNotification">Driver notification of the <see cref="DriverNotificationType.FetchFileInUserMode"/> type.</param>
+        /// <returns>Notification read.</returns>
+        private static FetchFileInUserModeNotification ReadFetchNotification(IDriverNotification driverNotification)
+        {
+            // Paths follow the target file handle. See the 'FILE_FETCH_NOTIFICATION_DATA' structure for more details.
+            IntPtr paths      = IntPtr.Add(driverNotification.Data, IntPtr.Size);
+            string sourceFile = Marshal.PtrToStringUni(paths);
+            string targetFile = Marshal.PtrToStringUni(IntPtr.Add(paths, Marshal.SystemDefaultCharSize * (sourceFile.Length + 1)));
+
+            return new FetchFileInUserModeNotification
+            {
+                TargetHandle = Marshal.ReadIntPtr(driverNotification.Data),
+                SourceFile   = sourceFile,
+                TargetFile   = targetFile,
+            };
+        }
+
+        /// <summary>
+        /// Invokes the asynchronous <paramref name="handler"/> for the <paramref name="notification"/> given.
+        /// </summary>
+        /// <param name="handler">Asynchronous <c>FetchFileInUserMode</c> notification handler.</param>
+        /// <param name="notification">Notification to handle.</param>
+        /// <returns>Task that returns the reply to be sent back to the driver.</returns>
+        private static async Task<object> FetchFileInUserModeAsync(Func<FetchFileInUserModeNotification, Task<FetchFileInUserModeNotificationReply>> handler, FetchFileInUserModeNotification notification)
+        {
+            return await handler(notification).ConfigureAwait(false);
+        }
+
+        /// <summary>
+        /// Validates the <paramref name="reportRate"/> value.
+        /// </summary>
+        /// <param name="reportRate">The report rate.</param>
+        /// <exception cref="ArgumentOutOfRangeException"><paramref name="reportRate"/> is invalid.</exception>
+        private static void ValidateReportRate(int reportRate)
+        {
+            if (reportRate < 0 || reportRate > LazyCopyDriverClient.MaxReportRate)
+            {
+                throw new ArgumentOutOfRangeException(
+                    nameof(reportRate),
+                    reportRate,
+                    string.Format(
+                        CultureInfo.InvariantCulture,
+                        "Report rate should be within {0} - {1} range",
+                        0,
+                        LazyCopyDriverClient.MaxReportRate));
+            }
+        }
+
+        /// <summary>
+        /// Converts the <paramref name="rules"/> list into a byte array containing the amount of rules as a
+        /// first <c>int</c>, and the rules after it, each one aligned to the <c>int</c> boundary.
+        /// </summary>
+        /// <param name="rules">List of rules to convert.</param>
         /// <returns>
-        /// Byte array suitable to be used as a <c>FETCH_PATHS</c> data.
+        /// Byte array suitable to be used as a <c>WATCH_PATHS</c> data.
         /// </returns>
-        private static byte[] GetWatchPathsData(IEnumerable<string> paths)
+        /// <exception cref="ArgumentException">One of the <paramref name="rules"/> has empty path or invalid report rate.</exception>
+        private static byte[] GetWatchPathsData(IEnumerable<WatchPathRule> rules)
         {
-            if (paths == null)
+            WatchPathRule[] rulesArray = rules == null ? new WatchPathRule[0] : rules.ToArray();
+
+            // See the 'WATCH_PATHS' and 'WATCH_PATH_RULE' structures for more details.
+            List<byte> data = new List<byte>(BitConverter.GetBytes(rulesArray.Length));
+
+            foreach (WatchPathRule rule in rulesArray)
             {
-                paths = new string[0];
+                if (string.IsNullOrEmpty(rule.Path))
+                {
+                    throw new ArgumentException("Watch path rule path should not be empty.", nameof(rules));
+                }
+
+                if (rule.ReportRate != LazyCopyDriverClient.GlobalReportRate && (rule.ReportRate < 0 || rule.ReportRate > LazyCopyDriverClient.MaxReportRate))
+                {
+                    throw new ArgumentException(
+                        string.Format(CultureInfo.InvariantCulture, "Report rate should be within {0} - {1} range", 0, LazyCopyDriverClient.MaxReportRate),
+                        nameof(rules));
+                }
+
+                data.AddRange(BitConverter.GetBytes(rule.ReportRate));
+                data.AddRange(BitConverter.GetBytes(rule.ProcessId));
+
+                // This will replace the Windows path roots with the device names.
+                data.AddRange(LazyCopyDriverClient.ConvertToDevicePath(rule.Path));
+                data.AddRange(Encoding.Unicode.GetBytes((rule.Extension ?? string.Empty) + '\0'));
+
+                // Next rule should be aligned.
+                while (data.Count % sizeof(int) != 0)
+                {
+                    data.Add(0);
+                }
             }
 
-            // This will replace the Windows path roots with the device names.
-            string[] pathsArray = paths.ToArray();
+            return data.ToArray();
+        }
 
-            // See the 'FETCH_PATHS' structure for more details.
-            List<byte> data = new List<byte>(BitConverter.GetBytes(pathsArray.Length));
+        /// <summary>
+        /// Converts the <paramref name="rules"/> list into a byte array containing the amount of rules as a
+        /// first <c>int</c>, and the rules after it, each one aligned to the <c>int</c> boundary.
+        /// </summary>
+        /// <param name="rules">List of rules to convert.</param>
+        /// <returns>
+        /// Byte array suitable to be used as a <c>VOLUME_POLICY</c> data.
+        /// </returns>
+        /// <exception cref="ArgumentException">One of the <paramref name="rules"/> has empty selector.</exception>
+        private static byte[] GetVolumePolicyData(IEnumerable<VolumePolicyRule> rules)
+        {
+            VolumePolicyRule[] rulesArray = rules == null ? new VolumePolicyRule[0] : rules.ToArray();
+
+            // See the 'VOLUME_POLICY' and 'VOLUME_POLICY_RULE' structures for more details.
+            List<byte> data = new List<byte>(BitConverter.GetBytes(rulesArray.Length));
 
-            // Convert strings to byte array.
-            foreach (string path in pathsArray)
+            foreach (VolumePolicyRule rule in rulesArray)
             {
-                data.AddRange(LazyCopyDriverClient.ConvertToDevicePath(path));
+                if (string.IsNullOrEmpty(rule.Selector))
+                {
+                    throw new ArgumentException("Volume policy rule selector should not be empty.", nameof(rules));
+                }
+
+                data.AddRange(BitConverter.GetBytes(rule.ChunkSize));
+                data.AddRange(BitConverter.GetBytes(rule.MaxChunks));
+                data.AddRange(BitConverter.GetBytes(rule.UnbufferedThreshold));
+                data.AddRange(Encoding.Unicode.GetBytes(rule.Selector + '\0'));
+
+                // Next rule should be aligned.
+                while (data.Count % sizeof(int) != 0)
+                {
+                    data.Add(0);
+                }
             }
 
             return data.ToArray();
         }
 
+        /// <summary>
+        /// Gets the size of the <c>DRIVER_STATISTICS</c> structure.
+        /// </summary>
+        /// <returns>Structure size, in bytes.</returns>
+        private static int GetStatisticsSize()
+        {
+            int callbackCount = Enum.GetValues(typeof(DriverCallbackType)).Length;
+            int phaseCount    = Enum.GetValues(typeof(FetchPhase)).Length;
+            int laneCount     = Enum.GetValues(typeof(NotificationLane)).Length;
+
+            // Collection time, callback counters, five fetch counters, four placeholder counters,
+            // two directory query counters, two negative cache counters, histograms and queue depths.
+            return sizeof(long) * (1 + callbackCount + 5 + 4 + 2 + 2 + phaseCount * LazyCopyDriverClient.LatencyBucketCount + laneCount);
+        }
+
+        /// <summary>
+        /// Converts the <c>DRIVER_STATISTICS</c> data received from the driver into the <see cref="DriverStatistics"/>.
+        /// </summary>
+        /// <param name="data">Data received from the driver.</param>
+        /// <returns>Driver statistics.</returns>
+        /// <exception cref="InvalidOperationException"><paramref name="data"/> is malformed.</exception>
+        private static DriverStatistics ParseStatistics(byte[] data)
+        {
+            // See the 'DRIVER_STATISTICS' structure for more details.
+            if (data == null || data.Length < LazyCopyDriverClient.GetStatisticsSize())
+            {
+                throw new InvalidOperationException("Statistics data received from the driver is too short.");
+            }
+
+            DriverStatistics statistics = new DriverStatistics
+            {
+                CollectionTime         = DateTime.FromFileTimeUtc(BitConverter.ToInt64(data, 0)),
+                CallbackCounts         = new Dictionary<DriverCallbackType, long>(),
+                FetchLatency           = new Dictionary<FetchPhase, long[]>(),
+                NotificationQueueDepth = new Dictionary<NotificationLane, long>()
+            };
+
+            int offset = sizeof(long);
+            foreach (DriverCallbackType callback in Enum.GetValues(typeof(DriverCallbackType)))
+            {
+                statistics.CallbackCounts[callback] = BitConverter.ToInt64(data, offset);
+                offset += sizeof(long);
+            }
+
+            statistics.FetchesCompleted = BitConverter.ToInt64(data, offset);
+            statistics.FetchesFailed    = BitConverter.ToInt64(data, offset + 8);
+            statistics.BytesRead        = BitConverter.ToInt64(data, offset + 16);
+            statistics.BytesWritten     = BitConverter.ToInt64(data, offset + 24);
+            statistics.BytesFetched     = BitConverter.ToInt64(data, offset + 32);
+            offset += 40;
+
+            statistics.PlaceholderCacheHits   = BitConverter.ToInt64(data, offset);
+            statistics.PlaceholderCacheMisses = BitConverter.ToInt64(data, offset + 8);
+            statistics.CreatesReissued        = BitConverter.ToInt64(data, offset + 16);
+            statistics.CreatesNotReissued     = BitConverter.ToInt64(data, offset + 24);
+            offset += 32;
+
+            statistics.DirectoryQueriesSkipped   = BitConverter.ToInt64(data, offset);
+            statistics.DirectoryQueriesProcessed = BitConverter.ToInt64(data, offset + 8);
+            offset += 16;
+
+            statistics.NegativeCacheHits   = BitConverter.ToInt64(data, offset);
+            statistics.NegativeCacheMisses = BitConverter.ToInt64(data, offset + 8);
+            offset += 16;
+
+            foreach (FetchPhase phase in Enum.GetValues(typeof(FetchPhase)))
+            {
+                long[] histogram = new long[LazyCopyDriverClient.LatencyBucketCount];
+                for (int bucket = 0; bucket < histogram.Length; bucket++)
+                {
+                    histogram[bucket] = BitConverter.ToInt64(data, offset);
+                    offset += sizeof(long);
+                }
+
+                statistics.FetchLatency[phase] = histogram;
+            }
+
+            foreach (NotificationLane lane in Enum.GetValues(typeof(NotificationLane)))
+            {
+                statistics.NotificationQueueDepth[lane] = BitConverter.ToInt64(data, offset);
+                offset += sizeof(long);
+            }
+
+            return statistics;
+        }
+
+        /// <summary>
+        /// Converts the <c>FILE_ACCESSES</c> data received from the driver into the <see cref="FileAccessBatch"/>.
+        /// </summary>
+        /// <param name="data">Data received from the driver.</param>
+        /// <returns>File access batch.</returns>
+        /// <exception cref="InvalidOperationException"><paramref name="data"/> is malformed.</exception>
+        private static FileAccessBatch ParseFileAccesses(byte[] data)
+        {
+            // See the 'FILE_ACCESSES' and 'FILE_ACCESS_RECORD' structures for more details.
+            const int HeaderSize       = 16;
+            const int RecordHeaderSize = 28;
+
+            if (data == null || data.Length < HeaderSize)
+            {
+                throw new InvalidOperationException("File access data received from the driver is too short.");
+            }
+
+            int recordCount = BitConverter.ToInt32(data, 0);
+            FileAccessBatch batch = new FileAccessBatch
+            {
+                Records        = new List<FileAccessRecord>(recordCount),
+                RemainingCount = BitConverter.ToInt32(data, 4),
+                DroppedCount   = BitConverter.ToInt64(data, 8)
+            };
+
+            int offset = HeaderSize;
+            for (int i = 0; i < recordCount; i++)
+            {
+                if (offset + RecordHeaderSize > data.Length)
+                {
+                    throw new InvalidOperationException("File access data received from the driver is malformed.");
+                }
+
+                int pathLength = BitConverter.ToInt32(data, offset + 24);
+                if (pathLength < 0 || offset + RecordHeaderSize + pathLength > data.Length)
+                {
+                    throw new InvalidOperationException("File access data received from the driver is malformed.");
+                }
+
+                batch.Records.Add(
+                    new FileAccessRecord
+                    {
+                        AccessCount     = BitConverter.ToInt64(data, offset),
+                        FirstAccessTime = DateTime.FromFileTimeUtc(BitConverter.ToInt64(data, offset + 8)),
+                        LastAccessTime  = DateTime.FromFileTimeUtc(BitConverter.ToInt64(data, offset + 16)),
+                        Path            = Encoding.Unicode.GetString(data, offset + RecordHeaderSize, pathLength)
+                    });
+
+                // Next record is aligned to the 'long' boundary, and the path is followed by the null-terminator.
+                offset += (RecordHeaderSize + pathLength + sizeof(char) + sizeof(long) - 1) & ~(sizeof(long) - 1);
+            }
+
+            return batch;
+        }
+
+        /// <summary>
+        /// Converts the <c>ACTIVE_FETCHES</c> data received from the driver into the <see cref="ActiveFetchSnapshot"/>.
+        /// </summary>
+        /// <param name="data">Data received from the driver.</param>
+        /// <returns>Active fetches snapshot.</returns>
+        /// <exception cref="InvalidOperationException"><paramref name="data"/> is malformed.</exception>
+        private static ActiveFetchSnapshot ParseActiveFetches(byte[] data)
+        {
+            // See the 'ACTIVE_FETCHES' and 'ACTIVE_FETCH_RECORD' structures for more details.
+            const int HeaderSize       = 16;
+            const int RecordHeaderSize = 44;
+
+            if (data == null || data.Length < HeaderSize)
+            {
+                throw new InvalidOperationException("Active fetches data received from the driver is too short.");
+            }
+
+            int recordCount              = BitConverter.ToInt32(data, 0);
+            ActiveFetchSnapshot snapshot = new ActiveFetchSnapshot
+            {
+                Records        = new List<ActiveFetchRecord>(recordCount),
+                RemainingCount = BitConverter.ToInt32(data, 4),
+                CollectionTime = DateTime.FromFileTimeUtc(BitConverter.ToInt64(data, 8))
+            };
+
+            int offset = HeaderSize;
+            for (int i = 0; i < recordCount; i++)
+            {
+                if (offset + RecordHeaderSize > data.Length)
+                {
+                    throw new InvalidOperationException("Active fetches data received from the driver is malformed.");
+                }
+
+                int localPathLength  = BitConverter.ToInt32(data, offset + 36);
+                int remotePathLength = BitConverter.ToInt32(data, offset + 40);
+                int pathsLength      = localPathLength + remotePathLength + 2 * sizeof(char);
+
+                if (localPathLength < 0 || remotePathLength < 0 || offset + RecordHeaderSize + pathsLength > data.Length)
+                {
+                    throw new InvalidOperationException("Active fetches data received from the driver is malformed.");
+                }
+
+                DateTime startTime = DateTime.FromFileTimeUtc(BitConverter.ToInt64(data, offset + 16));
+
+                snapshot.Records.Add(
+                    new ActiveFetchRecord
+                    {
+                        FileSize      = BitConverter.ToInt64(data, offset),
+                        BytesCopied   = BitConverter.ToInt64(data, offset + 8),
+                        StartTime     = startTime,
+                        Elapsed       = snapshot.CollectionTime - startTime,
+                        ProcessId     = BitConverter.ToInt32(data, offset + 24),
+                        WaiterCount   = BitConverter.ToInt32(data, offset + 28),
+                        UserModeFetch = BitConverter.ToInt32(data, offset + 32) != 0,
+                        LocalPath     = Encoding.Unicode.GetString(data, offset + RecordHeaderSize, localPathLength),
+                        RemotePath    = Encoding.Unicode.GetString(data, offset + RecordHeaderSize + localPathLength + sizeof(char), remotePathLength)
+                    });
+
+                // Next record is aligned to the 'long' boundary.
+                offset += (RecordHeaderSize + pathsLength + sizeof(long) - 1) & ~(sizeof(long) - 1);
+            }
+
+            return snapshot;
+        }
+
         /// <summary>
         /// Replaces the <paramref name="path"/> root with the according device name and converts it to the
         /// Unicode byte array.
@@ -0,0 +1,467 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    NegativeCacheBench.c
+
+Abstract:
+
+    Benchmark and stress harness for the per-volume negative cache implemented by the
+    'LcIsKnownNonPlaceholder' and 'LcAddNonPlaceholder' in the 'LazyCopyDriver\NegativeCache.c'.
+
+    The table layout, hashing and entry replacement are reproduced with the GCC atomic builtins.
+    Create threads look random file names up and add the ones that are not tagged,
+    as the pre-create and post-create callbacks do. Most of the lookups go to a small
+    set of hot names, so the hit rate is similar to the one of a real volume.
+    The tagger thread keeps tagging and untagging random names, incrementing the
+    placeholder generation before and after the tag is set, as the file system
+    control callbacks do.
+
+    Every hit is checked against the tag state: if the name was tagged, and the generation
+    was incremented after that before the lookup has started, the hit would make the create
+    path skip a LazyCopy file, so it's counted as a violation.
+
+    Build and run:
+
+        gcc -O2 -pthread -o NegativeCacheBench NegativeCacheBench.c
+        ./NegativeCacheBench [threads] [seconds] [names] [legacy]
+
+    The 'legacy' argument makes the tagger skip the generation increments, to check that
+    the harness detects the stale entries.
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//------------------------------------------------------------------------
+//  Definitions.
+//------------------------------------------------------------------------
+
+// Should match the ones in the 'NegativeCache.h'.
+#define NEGATIVE_CACHE_BUCKETS 256
+#define NEGATIVE_CACHE_WAYS    8
+
+#define NEGATIVE_CACHE_EMPTY   0
+
+#define NEGATIVE_CACHE_ENTRY(Hash, Generation) ((int64_t)(((Hash) & 0xFFFFFFFF00000000ULL) | (uint32_t)(Generation)))
+
+// Maximum length of the generated file names.
+#define MAX_NAME_LENGTH 64
+
+// Percentage of lookups that go to the hot names.
+#define HOT_LOOKUP_PERCENT 90
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+typedef struct _NEGATIVE_CACHE
+{
+    volatile int64_t Entries[NEGATIVE_CACHE_BUCKETS][NEGATIVE_CACHE_WAYS];
+} __attribute__((aligned(64))) NEGATIVE_CACHE, *PNEGATIVE_CACHE;
+
+typedef struct _NEGATIVE_CACHE_KEY
+{
+    uint64_t Hash;
+    int32_t  Generation;
+} NEGATIVE_CACHE_KEY, *PNEGATIVE_CACHE_KEY;
+
+typedef struct _FILE_NAME
+{
+    uint16_t Buffer[MAX_NAME_LENGTH];
+    uint16_t Length;
+} FILE_NAME, *PFILE_NAME;
+
+typedef struct _THREAD_STATE
+{
+    unsigned int  Seed;
+    unsigned long Lookups;
+    unsigned long Hits;
+    unsigned long Inserts;
+    unsigned long Tags;
+} THREAD_STATE, *PTHREAD_STATE;
+
+//------------------------------------------------------------------------
+//  Global variables.
+//------------------------------------------------------------------------
+
+static NEGATIVE_CACHE   Cache;
+
+// Mirrors the instance context 'PlaceholderGeneration'. Zero is never used.
+static volatile int32_t PlaceholderGeneration = 1;
+
+static PFILE_NAME       Names          = NULL;
+static int              NameCount      = 0;
+static int              HotNameCount   = 0;
+
+// Whether the name is tagged, and the generation set after the tag was applied.
+static volatile int*     Tagged        = NULL;
+static volatile int32_t* TagGeneration = NULL;
+
+static volatile int     StopRequested  = 0;
+static volatile long    Violations     = 0;
+static int              SkipInvalidate = 0;
+
+//------------------------------------------------------------------------
+//  Negative cache functions.
+//------------------------------------------------------------------------
+
+static
+uint64_t
+LcGetNegativeCacheHash(
+    PFILE_NAME Name
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcGetNegativeCacheHash'.
+
+--*/
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    uint16_t idx  = 0;
+
+    for (idx = 0; idx < Name->Length; idx++)
+    {
+        hash ^= Name->Buffer[idx];
+        hash *= 0x100000001B3ULL;
+    }
+
+    hash ^= hash >> 32;
+
+    return hash == 0 ? 1 : hash;
+}
+
+//------------------------------------------------------------------------
+
+static
+int
+LcIsKnownNonPlaceholder(
+    PFILE_NAME          Name,
+    PNEGATIVE_CACHE_KEY Key
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcIsKnownNonPlaceholder'.
+
+--*/
+{
+    volatile int64_t* bucket = NULL;
+    int64_t           entry  = NEGATIVE_CACHE_EMPTY;
+    int               idx    = 0;
+
+    Key->Hash       = LcGetNegativeCacheHash(Name);
+    Key->Generation = __atomic_load_n(&PlaceholderGeneration, __ATOMIC_SEQ_CST);
+
+    entry  = NEGATIVE_CACHE_ENTRY(Key->Hash, Key->Generation);
+    bucket = Cache.Entries[(uint32_t)Key->Hash & (NEGATIVE_CACHE_BUCKETS - 1)];
+
+    for (idx = 0; idx < NEGATIVE_CACHE_WAYS; idx++)
+    {
+        if (__atomic_load_n(&bucket[idx], __ATOMIC_RELAXED) == entry)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcAddNonPlaceholder(
+    PNEGATIVE_CACHE_KEY Key
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcAddNonPlaceholder'.
+
+--*/
+{
+    volatile int64_t* bucket     = NULL;
+    int64_t           entry      = NEGATIVE_CACHE_EMPTY;
+    int64_t           current    = NEGATIVE_CACHE_EMPTY;
+    int32_t           generation = __atomic_load_n(&PlaceholderGeneration, __ATOMIC_SEQ_CST);
+    int               idx        = 0;
+
+    if (Key->Generation != generation)
+    {
+        return;
+    }
+
+    entry  = NEGATIVE_CACHE_ENTRY(Key->Hash, Key->Generation);
+    bucket = Cache.Entries[(uint32_t)Key->Hash & (NEGATIVE_CACHE_BUCKETS - 1)];
+
+    for (idx = 0; idx < NEGATIVE_CACHE_WAYS; idx++)
+    {
+        current = __atomic_load_n(&bucket[idx], __ATOMIC_RELAXED);
+        if (current == entry)
+        {
+            break;
+        }
+
+        if ((current == NEGATIVE_CACHE_EMPTY || (int32_t)(uint32_t)current != generation)
+            && __atomic_compare_exchange_n(&bucket[idx], &current, entry, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        {
+            break;
+        }
+    }
+
+    if (idx == NEGATIVE_CACHE_WAYS)
+    {
+        __atomic_exchange_n(&bucket[(uint32_t)(Key->Hash >> 32) & (NEGATIVE_CACHE_WAYS - 1)], entry, __ATOMIC_SEQ_CST);
+    }
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcIncrementPlaceholderGeneration()
+/*++
+
+Summary:
+
+    This function mirrors the 'LcInvalidateDirectoryContexts'.
+
+--*/
+{
+    if (__atomic_add_fetch(&PlaceholderGeneration, 1, __ATOMIC_SEQ_CST) == 0)
+    {
+        __atomic_add_fetch(&PlaceholderGeneration, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+//------------------------------------------------------------------------
+//  Thread routines.
+//------------------------------------------------------------------------
+
+static
+void*
+LcCreateThread(
+    void* Context
+    )
+{
+    PTHREAD_STATE      state      = (PTHREAD_STATE)Context;
+    NEGATIVE_CACHE_KEY key        = { 0 };
+    int                nameIdx    = 0;
+    int32_t            generation = 0;
+
+    while (!__atomic_load_n(&StopRequested, __ATOMIC_RELAXED))
+    {
+        nameIdx = (int)(rand_r(&state->Seed) % 100) < HOT_LOOKUP_PERCENT
+                ? (int)(rand_r(&state->Seed) % (unsigned int)HotNameCount)
+                : (int)(rand_r(&state->Seed) % (unsigned int)NameCount);
+
+        state->Lookups++;
+
+        // Pre-create callback.
+        if (LcIsKnownNonPlaceholder(&Names[nameIdx], &key))
+        {
+            state->Hits++;
+
+            // The name was tagged and the generation was incremented after that before the lookup.
+            generation = __atomic_load_n(&TagGeneration[nameIdx], __ATOMIC_SEQ_CST);
+            if (generation != 0 && generation - key.Generation <= 0)
+            {
+                __atomic_add_fetch(&Violations, 1, __ATOMIC_SEQ_CST);
+            }
+
+            continue;
+        }
+
+        // The file system opens the file. Post-create callback adds it, if it has no reparse point.
+        if (!__atomic_load_n(&Tagged[nameIdx], __ATOMIC_SEQ_CST))
+        {
+            LcAddNonPlaceholder(&key);
+            state->Inserts++;
+        }
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+static
+void*
+LcTaggerThread(
+    void* Context
+    )
+{
+    PTHREAD_STATE   state    = (PTHREAD_STATE)Context;
+    struct timespec interval = { 0, 20000 };
+    int             nameIdx  = 0;
+
+    while (!__atomic_load_n(&StopRequested, __ATOMIC_RELAXED))
+    {
+        nameIdx = (int)(rand_r(&state->Seed) % (unsigned int)HotNameCount);
+
+        if (__atomic_load_n(&Tagged[nameIdx], __ATOMIC_SEQ_CST))
+        {
+            // Files are untagged, when they are fetched. It doesn't invalidate anything.
+            __atomic_store_n(&TagGeneration[nameIdx], 0, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&Tagged[nameIdx], 0, __ATOMIC_SEQ_CST);
+        }
+        else
+        {
+            // Pre-operation and post-operation callbacks of the 'FSCTL_SET_REPARSE_POINT'.
+            if (!SkipInvalidate)
+            {
+                LcIncrementPlaceholderGeneration();
+            }
+
+            __atomic_store_n(&Tagged[nameIdx], 1, __ATOMIC_SEQ_CST);
+
+            if (!SkipInvalidate)
+            {
+                LcIncrementPlaceholderGeneration();
+            }
+
+            __atomic_store_n(&TagGeneration[nameIdx], __atomic_load_n(&PlaceholderGeneration, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+        }
+
+        state->Tags++;
+        nanosleep(&interval, NULL);
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+int
+main(
+    int   argc,
+    char* argv[]
+    )
+{
+    int             threadCount = argc > 1 ? atoi(argv[1]) : 8;
+    int             seconds     = argc > 2 ? atoi(argv[2]) : 10;
+    pthread_t*      threads     = NULL;
+    PTHREAD_STATE   states      = NULL;
+    unsigned long   lookups     = 0;
+    unsigned long   hits        = 0;
+    unsigned long   inserts     = 0;
+    unsigned long   tags        = 0;
+    char            name[MAX_NAME_LENGTH] = { 0 };
+    int             length      = 0;
+    long            idx         = 0;
+    int             charIdx     = 0;
+    struct timespec duration    = { 0 };
+
+    NameCount      = argc > 3 ? atoi(argv[3]) : 100000;
+    SkipInvalidate = argc > 4 && strcmp(argv[4], "legacy") == 0;
+
+    if (threadCount <= 0 || seconds <= 0 || NameCount <= 0)
+    {
+        fprintf(stderr, "Usage: %s [threads] [seconds] [names] [legacy]\n", argv[0]);
+        return 2;
+    }
+
+    // Hot names fit into the cache, the rest of them don't.
+    HotNameCount = NameCount < NEGATIVE_CACHE_BUCKETS * NEGATIVE_CACHE_WAYS / 4 ? NameCount : NEGATIVE_CACHE_BUCKETS * NEGATIVE_CACHE_WAYS / 4;
+
+    threads       = calloc((size_t)threadCount + 1, sizeof(pthread_t));
+    states        = calloc((size_t)threadCount + 1, sizeof(THREAD_STATE));
+    Names         = calloc((size_t)NameCount, sizeof(FILE_NAME));
+    Tagged        = calloc((size_t)NameCount, sizeof(int));
+    TagGeneration = calloc((size_t)NameCount, sizeof(int32_t));
+    if (threads == NULL || states == NULL || Names == NULL || Tagged == NULL || TagGeneration == NULL)
+    {
+        return 2;
+    }
+
+    for (idx = 0; idx < NameCount; idx++)
+    {
+        length = snprintf(name, sizeof(name), "\\Users\\Build\\Source\\Module%03ld\\File%07ld.obj", idx % 512, idx);
+        for (charIdx = 0; charIdx < length; charIdx++)
+        {
+            Names[idx].Buffer[charIdx] = (uint16_t)name[charIdx];
+        }
+
+        Names[idx].Length = (uint16_t)length;
+    }
+
+    for (idx = 0; idx <= threadCount; idx++)
+    {
+        states[idx].Seed = (unsigned int)(idx * 2654435761u + (unsigned int)time(NULL));
+        pthread_create(&threads[idx], NULL, idx < threadCount ? LcCreateThread : LcTaggerThread, &states[idx]);
+    }
+
+    duration.tv_sec = seconds;
+    nanosleep(&duration, NULL);
+
+    __atomic_store_n(&StopRequested, 1, __ATOMIC_SEQ_CST);
+
+    for (idx = 0; idx <= threadCount; idx++)
+    {
+        pthread_join(threads[idx], NULL);
+
+        lookups += states[idx].Lookups;
+        hits    += states[idx].Hits;
+        inserts += states[idx].Inserts;
+        tags    += states[idx].Tags;
+    }
+
+    printf("Lookups: %lu (%.1f M/s), hit rate: %.1f%%, inserts: %lu, tag changes: %lu, stale hits: %ld\n",
+           lookups,
+           lookups / (seconds * 1e6),
+           lookups > 0 ? hits * 100.0 / lookups : 0.0,
+           inserts,
+           tags,
+           Violations);
+
+    free((void*)TagGeneration);
+    free((void*)Tagged);
+    free(Names);
+    free(states);
+    free(threads);
+
+    return Violations == 0 ? 0 : 1;
+}
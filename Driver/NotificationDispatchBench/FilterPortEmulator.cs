@@ -0,0 +1,468 @@
+﻿// --------------------------------------------------------------------------------------------------------------------
+// <copyright file="FilterPortEmulator.cs">
+//   The MIT License (MIT)
+//   Copyright (c) 2015 Aleksey Kabanov
+// </copyright>
+// <summary>
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to deal
+//   in the Software without restriction, including without limitation the rights
+//   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//   copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be included in
+//   all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//   THE SOFTWARE.
+// </summary>
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace LazyCopy.NotificationDispatchBench
+{
+    using System;
+    using System.Collections.Concurrent;
+    using System.Collections.Generic;
+    using System.Runtime.InteropServices;
+    using System.Threading;
+
+    using LazyCopy.DriverClientLibrary.Native;
+
+    /// <summary>
+    /// Emulates the driver communication port and the I/O completion port associated with it.
+    /// </summary>
+    /// <remarks>
+    /// The message requests issued by the <c>FilterGetMessage</c> are completed with the notifications sent by the
+    /// <see cref="SendMessage"/>, and their completions are posted to the queue the <c>GetQueuedCompletionStatus</c> reads.
+    /// The sender waits for the reply the same way the <c>FltSendMessage</c> does, and gives up after the timeout.
+    /// The methods called by the client threads don't allocate, so the allocations counted on these threads belong to the monitor.
+    /// </remarks>
+    internal static class FilterPortEmulator
+    {
+        #region Fields
+
+        /// <summary>
+        /// Win32 error codes the completions are posted with.
+        /// </summary>
+        private const int ErrorSuccess = 0, ErrorOperationAborted = 995, ErrorNotFound = 1168;
+
+        /// <summary>
+        /// Offsets of the <see cref="DriverNotificationHeader"/> fields.
+        /// </summary>
+        private static readonly int
+            ReplyLengthOffset = Marshal.OffsetOf(typeof(DriverNotificationHeader), nameof(DriverNotificationHeader.ReplyLength)).ToInt32(),
+            MessageIdOffset   = Marshal.OffsetOf(typeof(DriverNotificationHeader), nameof(DriverNotificationHeader.MessageId)).ToInt32(),
+            TypeOffset        = Marshal.OffsetOf(typeof(DriverNotificationHeader), nameof(DriverNotificationHeader.Type)).ToInt32(),
+            DataLengthOffset  = Marshal.OffsetOf(typeof(DriverNotificationHeader), nameof(DriverNotificationHeader.DataLength)).ToInt32();
+
+        /// <summary>
+        /// Offsets of the <see cref="DriverReplyHeader"/> fields.
+        /// </summary>
+        private static readonly int
+            ReplyStatusOffset    = Marshal.OffsetOf(typeof(DriverReplyHeader), nameof(DriverReplyHeader.Status)).ToInt32(),
+            ReplyMessageIdOffset = Marshal.OffsetOf(typeof(DriverReplyHeader), nameof(DriverReplyHeader.MessageId)).ToInt32();
+
+        /// <summary>
+        /// Size of the <see cref="DriverNotificationHeader"/> structure.
+        /// </summary>
+        private static readonly int NotificationHeaderSize = Marshal.SizeOf(typeof(DriverNotificationHeader));
+
+        /// <summary>
+        /// Size of the <see cref="DriverReplyHeader"/> structure.
+        /// </summary>
+        private static readonly int ReplyHeaderSize = Marshal.SizeOf(typeof(DriverReplyHeader));
+
+        /// <summary>
+        /// Protects the port state.
+        /// </summary>
+        private static readonly object PortLock = new object();
+
+        /// <summary>
+        /// Message requests waiting for the notifications.
+        /// </summary>
+        private static readonly Queue<PendingReceive> Receives = new Queue<PendingReceive>();
+
+        /// <summary>
+        /// Notifications waiting for the message requests.
+        /// </summary>
+        private static readonly Queue<PendingMessage> Messages = new Queue<PendingMessage>();
+
+        /// <summary>
+        /// Notifications delivered, which senders are waiting for the replies to, keyed by their message identifiers.
+        /// </summary>
+        private static readonly Dictionary<long, PendingMessage> Waiters = new Dictionary<long, PendingMessage>();
+
+        /// <summary>
+        /// Completion packets posted to the emulated I/O completion port.
+        /// </summary>
+        private static readonly ConcurrentQueue<Completion> Completions = new ConcurrentQueue<Completion>();
+
+        /// <summary>
+        /// Amount of completion packets queued. It's used instead of a <see cref="BlockingCollection{T}"/>, because its blocking take allocates.
+        /// </summary>
+        private static readonly SemaphoreSlim CompletionCount = new SemaphoreSlim(0);
+
+        /// <summary>
+        /// The last message identifier assigned.
+        /// </summary>
+        private static long lastMessageId;
+
+        #endregion // Fields
+
+        #region Properties
+
+        /// <summary>
+        /// Gets the amount of message requests that are not completed yet.
+        /// </summary>
+        public static int PendingReceiveCount
+        {
+            get
+            {
+                lock (FilterPortEmulator.PortLock)
+                {
+                    return FilterPortEmulator.Receives.Count;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Gets the amount of senders waiting for the replies.
+        /// </summary>
+        public static int WaiterCount
+        {
+            get
+            {
+                lock (FilterPortEmulator.PortLock)
+                {
+                    return FilterPortEmulator.Waiters.Count;
+                }
+            }
+        }
+
+        #endregion // Properties
+
+        #region Public methods
+
+        /// <summary>
+        /// Resets the port state, so it can be connected to again.
+        /// </summary>
+        public static void Reset()
+        {
+            lock (FilterPortEmulator.PortLock)
+            {
+                FilterPortEmulator.Receives.Clear();
+                FilterPortEmulator.Messages.Clear();
+                FilterPortEmulator.Waiters.Clear();
+            }
+
+            while (FilterPortEmulator.CompletionCount.Wait(0))
+            {
+                Completion completion;
+                FilterPortEmulator.Completions.TryDequeue(out completion);
+            }
+        }
+
+        /// <summary>
+        /// Sends the notification to the client and waits for the reply.
+        /// This method mirrors the <c>FltSendMessage</c>.
+        /// </summary>
+        /// <param name="type">Notification type.</param>
+        /// <param name="data">Notification data.</param>
+        /// <param name="reply">Buffer to store the reply data into.</param>
+        /// <param name="timeout">Amount of milliseconds to wait for the reply.</param>
+        /// <param name="status">Status returned by the client.</param>
+        /// <returns><see langword="true"/>, if the reply is received; otherwise, <see langword="false"/>.</returns>
+        public static bool SendMessage(int type, byte[] data, byte[] reply, int timeout, out int status)
+        {
+            PendingMessage message = new PendingMessage
+            {
+                MessageId   = Interlocked.Increment(ref FilterPortEmulator.lastMessageId),
+                Type        = type,
+                Data        = data,
+                ReplyLength = FilterPortEmulator.ReplyHeaderSize + reply.Length,
+                Reply       = reply
+            };
+
+            lock (FilterPortEmulator.PortLock)
+            {
+                FilterPortEmulator.Waiters.Add(message.MessageId, message);
+
+                if (FilterPortEmulator.Receives.Count > 0)
+                {
+                    FilterPortEmulator.Deliver(message, FilterPortEmulator.Receives.Dequeue());
+                }
+                else
+                {
+                    FilterPortEmulator.Messages.Enqueue(message);
+                }
+            }
+
+            bool replied = message.Replied.Wait(timeout);
+
+            lock (FilterPortEmulator.PortLock)
+            {
+                // The reply might've arrived after the wait timed out, but before the waiter was removed.
+                replied = message.Replied.IsSet;
+                FilterPortEmulator.Waiters.Remove(message.MessageId);
+            }
+
+            message.Replied.Dispose();
+
+            status = message.Status;
+            return replied;
+        }
+
+        /// <summary>
+        /// Queues the message request.
+        /// This method mirrors the <c>FilterGetMessage</c> for the port opened for the asynchronous I/O.
+        /// </summary>
+        /// <param name="messageBuffer">Buffer to receive the notification into.</param>
+        /// <param name="messageBufferSize">Size of the <paramref name="messageBuffer"/>.</param>
+        /// <param name="overlapped">OVERLAPPED structure identifying the request.</param>
+        /// <returns><see cref="NativeMethods.ErrorIoPending"/>, since the completion is always posted to the completion port.</returns>
+        public static uint GetMessage(IntPtr messageBuffer, int messageBufferSize, IntPtr overlapped)
+        {
+            PendingReceive receive = new PendingReceive { Buffer = messageBuffer, BufferSize = messageBufferSize, Overlapped = overlapped };
+
+            lock (FilterPortEmulator.PortLock)
+            {
+                if (FilterPortEmulator.Messages.Count > 0)
+                {
+                    FilterPortEmulator.Deliver(FilterPortEmulator.Messages.Dequeue(), receive);
+                }
+                else
+                {
+                    FilterPortEmulator.Receives.Enqueue(receive);
+                }
+            }
+
+            return NativeMethods.ErrorIoPending;
+        }
+
+        /// <summary>
+        /// Completes the notification with the reply given.
+        /// This method mirrors the <c>FilterReplyMessage</c>.
+        /// </summary>
+        /// <param name="replyBuffer">Reply that starts with the <see cref="DriverReplyHeader"/>.</param>
+        /// <param name="replyBufferSize">Size of the <paramref name="replyBuffer"/>.</param>
+        /// <returns><see cref="NativeMethods.Ok"/>, if the sender received the reply; otherwise, <see cref="NativeMethods.ErrorFltNoWaiterForReply"/>.</returns>
+        public static uint ReplyMessage(IntPtr replyBuffer, uint replyBufferSize)
+        {
+            long messageId = Marshal.ReadInt64(replyBuffer, FilterPortEmulator.ReplyMessageIdOffset);
+
+            lock (FilterPortEmulator.PortLock)
+            {
+                PendingMessage message;
+                if (!FilterPortEmulator.Waiters.TryGetValue(messageId, out message) || message.Replied.IsSet)
+                {
+                    return NativeMethods.ErrorFltNoWaiterForReply;
+                }
+
+                message.Status = Marshal.ReadInt32(replyBuffer, FilterPortEmulator.ReplyStatusOffset);
+                Marshal.Copy(replyBuffer + FilterPortEmulator.ReplyHeaderSize, message.Reply, 0, Math.Min(message.Reply.Length, (int)replyBufferSize - FilterPortEmulator.ReplyHeaderSize));
+
+                message.Replied.Set();
+            }
+
+            return NativeMethods.Ok;
+        }
+
+        /// <summary>
+        /// Cancels the message requests.
+        /// This method mirrors the <c>CancelIoEx</c>.
+        /// </summary>
+        /// <param name="overlapped">Request to be cancelled, or <see cref="IntPtr.Zero"/> to cancel all requests.</param>
+        /// <returns><see langword="true"/>, if any request was cancelled; otherwise, <see langword="false"/>.</returns>
+        public static bool CancelIo(IntPtr overlapped)
+        {
+            bool cancelled = false;
+
+            lock (FilterPortEmulator.PortLock)
+            {
+                // Requests that are not cancelled are queued again in the same order.
+                for (int count = FilterPortEmulator.Receives.Count; count > 0; count--)
+                {
+                    PendingReceive receive = FilterPortEmulator.Receives.Dequeue();
+
+                    if (overlapped == IntPtr.Zero || receive.Overlapped == overlapped)
+                    {
+                        FilterPortEmulator.Enqueue(new Completion { Overlapped = receive.Overlapped, Error = FilterPortEmulator.ErrorOperationAborted });
+                        cancelled = true;
+                    }
+                    else
+                    {
+                        FilterPortEmulator.Receives.Enqueue(receive);
+                    }
+                }
+            }
+
+            Marshal.SetLastPInvokeError(cancelled ? FilterPortEmulator.ErrorSuccess : FilterPortEmulator.ErrorNotFound);
+            return cancelled;
+        }
+
+        /// <summary>
+        /// Dequeues the completion packet.
+        /// This method mirrors the <c>GetQueuedCompletionStatus</c>.
+        /// </summary>
+        /// <param name="numberOfBytes">Amount of bytes transferred.</param>
+        /// <param name="overlapped">OVERLAPPED structure of the request completed.</param>
+        /// <returns><see langword="true"/>, if the request succeeded; otherwise, <see langword="false"/>.</returns>
+        public static bool GetCompletion(out uint numberOfBytes, out IntPtr overlapped)
+        {
+            Completion completion;
+
+            FilterPortEmulator.CompletionCount.Wait();
+            FilterPortEmulator.Completions.TryDequeue(out completion);
+
+            numberOfBytes = completion.NumberOfBytes;
+            overlapped    = completion.Overlapped;
+
+            Marshal.SetLastPInvokeError(completion.Error);
+            return completion.Error == FilterPortEmulator.ErrorSuccess;
+        }
+
+        /// <summary>
+        /// Posts the completion packet.
+        /// This method mirrors the <c>PostQueuedCompletionStatus</c>.
+        /// </summary>
+        /// <param name="numberOfBytes">Amount of bytes transferred.</param>
+        /// <param name="overlapped">OVERLAPPED structure pointer.</param>
+        public static void PostCompletion(uint numberOfBytes, IntPtr overlapped)
+        {
+            FilterPortEmulator.Enqueue(new Completion { NumberOfBytes = numberOfBytes, Overlapped = overlapped });
+        }
+
+        #endregion // Public methods
+
+        #region Private methods
+
+        /// <summary>
+        /// Copies the <paramref name="message"/> into the <paramref name="receive"/> buffer and posts its completion.
+        /// This method should be called under the <see cref="PortLock"/>.
+        /// </summary>
+        /// <param name="message">Notification to be delivered.</param>
+        /// <param name="receive">Message request to be completed.</param>
+        private static void Deliver(PendingMessage message, PendingReceive receive)
+        {
+            int size = FilterPortEmulator.NotificationHeaderSize + message.Data.Length;
+            if (size > receive.BufferSize)
+            {
+                throw new InvalidOperationException("Notification doesn't fit the message buffer.");
+            }
+
+            Marshal.WriteInt32(receive.Buffer, FilterPortEmulator.ReplyLengthOffset, message.ReplyLength);
+            Marshal.WriteInt64(receive.Buffer, FilterPortEmulator.MessageIdOffset,   message.MessageId);
+            Marshal.WriteInt32(receive.Buffer, FilterPortEmulator.TypeOffset,        message.Type);
+            Marshal.WriteInt32(receive.Buffer, FilterPortEmulator.DataLengthOffset,  message.Data.Length);
+            Marshal.Copy(message.Data, 0, receive.Buffer + FilterPortEmulator.NotificationHeaderSize, message.Data.Length);
+
+            FilterPortEmulator.Enqueue(new Completion { NumberOfBytes = (uint)size, Overlapped = receive.Overlapped });
+        }
+
+        /// <summary>
+        /// Queues the completion packet and wakes up the thread waiting for it.
+        /// </summary>
+        /// <param name="completion">Completion packet.</param>
+        private static void Enqueue(Completion completion)
+        {
+            FilterPortEmulator.Completions.Enqueue(completion);
+            FilterPortEmulator.CompletionCount.Release();
+        }
+
+        #endregion // Private methods
+
+        #region Nested types
+
+        /// <summary>
+        /// Message request issued by the client.
+        /// It's a structure, so the client thread issuing the request doesn't allocate anything.
+        /// </summary>
+        private struct PendingReceive
+        {
+            /// <summary>
+            /// Gets or sets the buffer to receive the notification into.
+            /// </summary>
+            public IntPtr Buffer { get; set; }
+
+            /// <summary>
+            /// Gets or sets the size of the <see cref="Buffer"/>.
+            /// </summary>
+            public int BufferSize { get; set; }
+
+            /// <summary>
+            /// Gets or sets the OVERLAPPED structure identifying the request.
+            /// </summary>
+            public IntPtr Overlapped { get; set; }
+        }
+
+        /// <summary>
+        /// Notification sent to the client.
+        /// </summary>
+        private sealed class PendingMessage
+        {
+            /// <summary>
+            /// Gets the event that is set, when the reply is received.
+            /// </summary>
+            public ManualResetEventSlim Replied { get; } = new ManualResetEventSlim(false);
+
+            /// <summary>
+            /// Gets or sets the message identifier.
+            /// </summary>
+            public long MessageId { get; set; }
+
+            /// <summary>
+            /// Gets or sets the notification type.
+            /// </summary>
+            public int Type { get; set; }
+
+            /// <summary>
+            /// Gets or sets the notification data.
+            /// </summary>
+            public byte[] Data { get; set; }
+
+            /// <summary>
+            /// Gets or sets the size of the reply expected, including the <see cref="DriverReplyHeader"/>.
+            /// </summary>
+            public int ReplyLength { get; set; }
+
+            /// <summary>
+            /// Gets or sets the buffer the reply data is copied to.
+            /// </summary>
+            public byte[] Reply { get; set; }
+
+            /// <summary>
+            /// Gets or sets the status returned by the client.
+            /// </summary>
+            public int Status { get; set; }
+        }
+
+        /// <summary>
+        /// Completion packet.
+        /// </summary>
+        private struct Completion
+        {
+            /// <summary>
+            /// Gets or sets the amount of bytes transferred.
+            /// </summary>
+            public uint NumberOfBytes { get; set; }
+
+            /// <summary>
+            /// Gets or sets the OVERLAPPED structure of the request.
+            /// </summary>
+            public IntPtr Overlapped { get; set; }
+
+            /// <summary>
+            /// Gets or sets the Win32 error code.
+            /// </summary>
+            public int Error { get; set; }
+        }
+
+        #endregion // Nested types
+    }
+}
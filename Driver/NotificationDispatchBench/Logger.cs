@@ -0,0 +1,84 @@
+﻿// --------------------------------------------------------------------------------------------------------------------
+// <copyright file="Logger.cs">
+//   The MIT License (MIT)
+//   Copyright (c) 2015 Aleksey Kabanov
+// </copyright>
+// <summary>
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to deal
+//   in the Software without restriction, including without limitation the rights
+//   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//   copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be included in
+//   all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//   THE SOFTWARE.
+// </summary>
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace NLog
+{
+    using System;
+
+    /// <summary>
+    /// Minimal replacement for the NLog logger, which writes warnings and errors to the standard error stream.
+    /// NLog package is not referenced, so the benchmark builds without restoring any packages.
+    /// </summary>
+    internal sealed class Logger
+    {
+        /// <summary>
+        /// Writes the error message.
+        /// </summary>
+        /// <param name="exception">Exception to be logged.</param>
+        /// <param name="message">Message to be logged.</param>
+        public void Error(Exception exception, string message)
+        {
+            Console.Error.WriteLine("ERROR: {0} {1}", message, exception.Message);
+        }
+
+        /// <summary>
+        /// Writes the error message.
+        /// </summary>
+        /// <param name="formatProvider">Format provider.</param>
+        /// <param name="message">Message format.</param>
+        /// <param name="args">Message arguments.</param>
+        public void Error(IFormatProvider formatProvider, string message, params object[] args)
+        {
+            Console.Error.WriteLine("ERROR: " + string.Format(formatProvider, message, args));
+        }
+
+        /// <summary>
+        /// Writes the warning message.
+        /// </summary>
+        /// <param name="formatProvider">Format provider.</param>
+        /// <param name="message">Message format.</param>
+        /// <param name="args">Message arguments.</param>
+        public void Warn(IFormatProvider formatProvider, string message, params object[] args)
+        {
+            Console.Error.WriteLine("WARN: " + string.Format(formatProvider, message, args));
+        }
+    }
+
+    /// <summary>
+    /// Creates the <see cref="Logger"/> instances.
+    /// </summary>
+    internal static class LogManager
+    {
+        /// <summary>
+        /// Gets the logger.
+        /// </summary>
+        /// <returns>Logger instance.</returns>
+        public static Logger GetCurrentClassLogger()
+        {
+            return new Logger();
+        }
+    }
+}
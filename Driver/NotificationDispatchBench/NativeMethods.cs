@@ -0,0 +1,165 @@
+﻿// --------------------------------------------------------------------------------------------------------------------
+// <copyright file="NativeMethods.cs">
+//   The MIT License (MIT)
+//   Copyright (c) 2015 Aleksey Kabanov
+// </copyright>
+// <summary>
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to deal
+//   in the Software without restriction, including without limitation the rights
+//   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//   copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be included in
+//   all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//   THE SOFTWARE.
+// </summary>
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace LazyCopy.DriverClientLibrary.Native
+{
+    using System;
+    using System.Threading;
+
+    using LazyCopy.NotificationDispatchBench;
+    using Microsoft.Win32.SafeHandles;
+
+    /// <summary>
+    /// Replaces the P/Invoke declarations used by the <see cref="NotificationsMonitor"/> with the <see cref="FilterPortEmulator"/> calls.
+    /// The signatures and constants match the ones declared in the DriverClientLibrary.
+    /// </summary>
+    internal static class NativeMethods
+    {
+        #region Constants
+
+        /// <summary>
+        /// Operation completed successfully.
+        /// </summary>
+        public const uint Ok = 0;
+
+        /// <summary>
+        /// The I/O operation has been aborted (<c>ERROR_OPERATION_ABORTED</c>).
+        /// </summary>
+        public const uint ErrorOperationAborted = 0x800703E3;
+
+        /// <summary>
+        /// Overlapped I/O operation is in progress (<c>ERROR_IO_PENDING</c>).
+        /// </summary>
+        public const uint ErrorIoPending = 0x800703E5;
+
+        /// <summary>
+        /// No waiter is waiting for the reply (<c>ERROR_FLT_NO_WAITER_FOR_REPLY</c>).
+        /// </summary>
+        public const uint ErrorFltNoWaiterForReply = 0x801F0020;
+
+        /// <summary>
+        /// The handle is invalid (<c>ERROR_INVALID_HANDLE</c>).
+        /// </summary>
+        public const uint ErrorInvalidHandle = 0x80070006;
+
+        /// <summary>
+        /// Element not found (<c>ERROR_NOT_FOUND</c>).
+        /// </summary>
+        public const uint ErrorNotFound = 0x80070490;
+
+        #endregion // Constants
+
+        #region Public methods
+
+        /// <summary>
+        /// Emulates the <c>FilterGetMessage</c>.
+        /// </summary>
+        /// <param name="portHandle">Communication port handle.</param>
+        /// <param name="messageBuffer">Buffer to receive the notification into.</param>
+        /// <param name="messageBufferSize">Size of the <paramref name="messageBuffer"/>.</param>
+        /// <param name="overlapped">OVERLAPPED structure pointer.</param>
+        /// <returns><see cref="ErrorIoPending"/>.</returns>
+        public static uint FilterGetMessage(SafeFileHandle portHandle, IntPtr messageBuffer, int messageBufferSize, IntPtr overlapped)
+        {
+            return FilterPortEmulator.GetMessage(messageBuffer, messageBufferSize, overlapped);
+        }
+
+        /// <summary>
+        /// Emulates the <c>FilterReplyMessage</c>.
+        /// </summary>
+        /// <param name="portHandle">Communication port handle.</param>
+        /// <param name="replyBuffer">Reply buffer.</param>
+        /// <param name="replyBufferSize">Size of the <paramref name="replyBuffer"/>.</param>
+        /// <returns><see cref="Ok"/> or <see cref="ErrorFltNoWaiterForReply"/>.</returns>
+        public static uint FilterReplyMessage(SafeFileHandle portHandle, IntPtr replyBuffer, uint replyBufferSize)
+        {
+            return FilterPortEmulator.ReplyMessage(replyBuffer, replyBufferSize);
+        }
+
+        /// <summary>
+        /// Emulates the <c>GetQueuedCompletionStatus</c>. The <paramref name="milliseconds"/> value is ignored, the wait is infinite.
+        /// </summary>
+        /// <param name="completionPort">Completion port handle.</param>
+        /// <param name="numberOfBytes">Amount of bytes transferred.</param>
+        /// <param name="completionKey">Completion key, always <see cref="IntPtr.Zero"/>.</param>
+        /// <param name="overlapped">OVERLAPPED structure pointer.</param>
+        /// <param name="milliseconds">Wait timeout.</param>
+        /// <returns><see langword="true"/>, if the request succeeded; otherwise, <see langword="false"/>.</returns>
+        public static bool GetQueuedCompletionStatus(IntPtr completionPort, out uint numberOfBytes, out IntPtr completionKey, out IntPtr overlapped, int milliseconds)
+        {
+            completionKey = IntPtr.Zero;
+            return FilterPortEmulator.GetCompletion(out numberOfBytes, out overlapped);
+        }
+
+        /// <summary>
+        /// Emulates the <c>PostQueuedCompletionStatus</c>.
+        /// </summary>
+        /// <param name="completionPort">Completion port handle.</param>
+        /// <param name="numberOfBytes">Amount of bytes transferred.</param>
+        /// <param name="completionKey">Completion key.</param>
+        /// <param name="overlapped">OVERLAPPED structure pointer.</param>
+        /// <returns><see langword="true"/>.</returns>
+        public static bool PostQueuedCompletionStatus(IntPtr completionPort, uint numberOfBytes, IntPtr completionKey, IntPtr overlapped)
+        {
+            FilterPortEmulator.PostCompletion(numberOfBytes, overlapped);
+            return true;
+        }
+
+        /// <summary>
+        /// Emulates the <c>CancelIoEx</c>.
+        /// </summary>
+        /// <param name="portHandle">Communication port handle.</param>
+        /// <param name="overlapped">OVERLAPPED structure of the request to be cancelled, or <see cref="IntPtr.Zero"/> to cancel all requests.</param>
+        /// <returns><see langword="true"/>, if any request was cancelled; otherwise, <see langword="false"/>.</returns>
+        public static bool CancelIoEx(SafeFileHandle portHandle, IntPtr overlapped)
+        {
+            return FilterPortEmulator.CancelIo(overlapped);
+        }
+
+        #endregion // Public methods
+    }
+}
+
+namespace LazyCopy.Utilities.Native
+{
+    using System;
+
+    /// <summary>
+    /// Replaces the <c>kernel32.dll</c> functions used by the <see cref="MarshalingHelper"/>.
+    /// </summary>
+    internal static class NativeMethods
+    {
+        /// <summary>
+        /// Fills the memory block with zeros.
+        /// </summary>
+        /// <param name="handle">A pointer to the starting address of the block of memory to fill with zeros.</param>
+        /// <param name="length">The size of the block of memory to fill with zeros, in bytes.</param>
+        public static unsafe void ZeroMemory(IntPtr handle, uint length)
+        {
+            new Span<byte>(handle.ToPointer(), checked((int)length)).Clear();
+        }
+    }
+}
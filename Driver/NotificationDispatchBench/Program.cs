@@ -0,0 +1,549 @@
+﻿// --------------------------------------------------------------------------------------------------------------------
+// <copyright file="Program.cs">
+//   The MIT License (MIT)
+//   Copyright (c) 2015 Aleksey Kabanov
+// </copyright>
+// <summary>
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to deal
+//   in the Software without restriction, including without limitation the rights
+//   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//   copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be included in
+//   all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//   THE SOFTWARE.
+// </summary>
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace LazyCopy.NotificationDispatchBench
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Diagnostics;
+    using System.Globalization;
+    using System.Runtime.InteropServices;
+    using System.Threading;
+    using System.Threading.Tasks;
+
+    using LazyCopy.DriverClientLibrary;
+    using LazyCopy.DriverClientLibrary.Native;
+    using LazyCopy.Utilities;
+
+    /// <summary>
+    /// Measures the <see cref="NotificationsMonitor"/> throughput and latency under synthetic notification load.
+    /// </summary>
+    /// <remarks>
+    /// <para>
+    /// Several "driver" threads send the slow notifications, which handlers take <see cref="SlowHandlerDelay"/> to complete
+    /// (like the file fetches do), and the other ones send the fast notifications back to back and measure the round-trip time.
+    /// Every reply is checked to belong to the notification it's sent for.
+    /// </para>
+    /// <para>
+    /// The "per-thread" scenario mirrors the previous dispatcher: one message request per thread, and the handler blocks
+    /// the thread until it's finished. The "async" scenario keeps more requests pending than there are threads,
+    /// and the slow handlers complete asynchronously.
+    /// </para>
+    /// <para>
+    /// The "allocations" mode counts the bytes the monitor thread allocates per notification in the steady state,
+    /// and the bytes the <see cref="MarshalingHelper"/> allocates per reply marshaled.
+    /// </para>
+    /// <para>
+    /// Build and run:
+    ///     dotnet run -c Release -p NotificationDispatchBench.csproj [seconds | allocations]
+    /// </para>
+    /// </remarks>
+    internal static class Program
+    {
+        #region Fields
+
+        /// <summary>
+        /// Notification types.
+        /// </summary>
+        private const int FastNotification = 0, SlowNotification = 1;
+
+        /// <summary>
+        /// Amount of milliseconds the slow notification handler takes.
+        /// </summary>
+        private const int SlowHandlerDelay = 20;
+
+        /// <summary>
+        /// Amount of milliseconds the driver waits for the reply.
+        /// </summary>
+        private const int ReplyTimeout = 5000;
+
+        /// <summary>
+        /// Amount of threads sending the notifications of each type.
+        /// </summary>
+        private const int SlowSenderCount = 4, FastSenderCount = 2;
+
+        /// <summary>
+        /// Amount of threads dequeuing the completions.
+        /// </summary>
+        private const int ThreadCount = 2;
+
+        /// <summary>
+        /// Amount of message requests pending in the "async" scenario.
+        /// </summary>
+        private const int AsyncReceiveCount = 16;
+
+        /// <summary>
+        /// Maximum notification data size.
+        /// </summary>
+        private const int MaxNotificationSize = 64;
+
+        /// <summary>
+        /// Amount of notifications sent in the short and long allocation runs.
+        /// The difference between the runs excludes the allocations made when the monitor starts and stops.
+        /// </summary>
+        private const int ShortRunCount = 10000, LongRunCount = 110000;
+
+        /// <summary>
+        /// Amount of message requests pending in the allocation runs.
+        /// </summary>
+        private const int AllocationReceiveCount = 4;
+
+        /// <summary>
+        /// Amount of times every value is marshaled in the <see cref="MarshalingHelper"/> runs.
+        /// </summary>
+        private const int MarshalCount = 100000;
+
+        /// <summary>
+        /// Reply returned by the handler in the allocation runs.
+        /// </summary>
+        private const int CachedReplyValue = 42;
+
+        /// <summary>
+        /// Completed handler task returned for every notification in the allocation runs, so the handler doesn't allocate anything itself.
+        /// </summary>
+        private static readonly Task<object> CachedReply = Task.FromResult<object>(Program.CachedReplyValue);
+
+        #endregion // Fields
+
+        #region Private methods
+
+        /// <summary>
+        /// Runs the scenarios and prints the results.
+        /// </summary>
+        /// <param name="args">Optional amount of seconds every scenario runs for.</param>
+        /// <returns><c>0</c>, if all notifications were replied to correctly; otherwise, <c>1</c>.</returns>
+        private static int Main(string[] args)
+        {
+            if (args.Length > 0 && args[0] == "allocations")
+            {
+                return Program.MeasureAllocations();
+            }
+
+            int seconds = args.Length > 0 ? int.Parse(args[0], CultureInfo.InvariantCulture) : 3;
+
+            Console.WriteLine(
+                "{0} slow ({1} ms) and {2} fast senders, {3} threads, {4} seconds per scenario.",
+                Program.SlowSenderCount,
+                Program.SlowHandlerDelay,
+                Program.FastSenderCount,
+                Program.ThreadCount,
+                seconds);
+
+            Console.WriteLine("{0,-10} {1,8} {2,10} {3,10} {4,10} {5,10} {6,9}", "scenario", "receives", "fast/s", "p50 ms", "p99 ms", "slow/s", "failures");
+
+            int failures = Program.RunScenario("per-thread", Program.ThreadCount, true, seconds)
+                         + Program.RunScenario("async", Program.AsyncReceiveCount, false, seconds);
+
+            if (failures != 0)
+            {
+                Console.WriteLine("FAILED: {0} failures.", failures);
+                return 1;
+            }
+
+            return 0;
+        }
+
+        /// <summary>
+        /// Counts the bytes allocated per notification by the monitor thread, and per value by the <see cref="MarshalingHelper"/>.
+        /// </summary>
+        /// <returns><c>0</c>, if the steady-state message path doesn't allocate; otherwise, <c>1</c>.</returns>
+        private static int MeasureAllocations()
+        {
+            int failures = 0;
+
+            // The first run warms up the code paths and the pools.
+            Program.CountMonitorAllocations(Program.ShortRunCount, ref failures);
+
+            long shortRun = Program.CountMonitorAllocations(Program.ShortRunCount, ref failures);
+            long longRun  = Program.CountMonitorAllocations(Program.LongRunCount, ref failures);
+
+            double perNotification = (double)(longRun - shortRun) / (Program.LongRunCount - Program.ShortRunCount);
+            Console.WriteLine("monitor thread: {0} bytes for {1} notifications, {2} bytes for {3} ({4:F3} bytes per notification)", shortRun, Program.ShortRunCount, longRun, Program.LongRunCount, perNotification);
+
+            if (perNotification >= 1)
+            {
+                failures++;
+            }
+
+            object[] values =
+            {
+                42,
+                42L,
+                42.0f,
+                42.0,
+                "C:\\Source\\File.txt",
+                new byte[16],
+                new DriverReplyHeader { Status = 1, MessageId = 42 }
+            };
+
+            IntPtr buffer = Marshal.AllocHGlobal(Program.MaxNotificationSize);
+
+            try
+            {
+                foreach (object value in values)
+                {
+                    double perValue = Program.CountMarshalingAllocations(value, buffer);
+                    Console.WriteLine("MarshalingHelper, {0,-24} {1:F3} bytes per value", value.GetType().Name + ":", perValue);
+
+                    if (perValue >= 1)
+                    {
+                        failures++;
+                    }
+                }
+            }
+            finally
+            {
+                Marshal.FreeHGlobal(buffer);
+            }
+
+            if (failures != 0)
+            {
+                Console.WriteLine("FAILED: {0} failures.", failures);
+                return 1;
+            }
+
+            return 0;
+        }
+
+        /// <summary>
+        /// Sends the notifications to the monitor with one thread and counts the bytes that thread allocates.
+        /// </summary>
+        /// <param name="count">Amount of notifications to send.</param>
+        /// <param name="failures">Failures counter to be updated.</param>
+        /// <returns>Amount of bytes allocated by the monitor thread from the start until it finished.</returns>
+        private static long CountMonitorAllocations(int count, ref int failures)
+        {
+            FilterPortEmulator.Reset();
+
+            LoadStatistics statistics = new LoadStatistics();
+            long allocated = 0;
+
+            using (CancellationTokenSource cancellationTokenSource = new CancellationTokenSource())
+            {
+                NotificationsMonitor monitor = new NotificationsMonitor(cancellationTokenSource.Token, Program.MaxNotificationSize, Program.HandleCached, new IntPtr(1), new IntPtr(2), Program.AllocationReceiveCount);
+
+                Thread worker = Program.StartThread(
+                    () =>
+                    {
+                        long start = GC.GetAllocatedBytesForCurrentThread();
+                        Program.DoMonitorWork(monitor, statistics);
+                        allocated = GC.GetAllocatedBytesForCurrentThread() - start;
+                    });
+
+                monitor.Start();
+
+                byte[] data  = new byte[sizeof(int)];
+                byte[] reply = new byte[sizeof(int)];
+
+                for (int i = 0; i < count; i++)
+                {
+                    int status;
+                    if (!FilterPortEmulator.SendMessage(Program.FastNotification, data, reply, Program.ReplyTimeout, out status) || status != 0 || BitConverter.ToInt32(reply, 0) != Program.CachedReplyValue)
+                    {
+                        statistics.Failures++;
+                    }
+                }
+
+                cancellationTokenSource.Cancel();
+                worker.Join();
+            }
+
+            failures += statistics.Failures;
+            return allocated;
+        }
+
+        /// <summary>
+        /// Marshals the <paramref name="value"/> like the monitor marshals the replies, and counts the bytes allocated.
+        /// </summary>
+        /// <param name="value">Value to be marshaled.</param>
+        /// <param name="buffer">Buffer to marshal the value to.</param>
+        /// <returns>Amount of bytes allocated per value.</returns>
+        private static double CountMarshalingAllocations(object value, IntPtr buffer)
+        {
+            // The marshaler for the value type is created by the first call.
+            MarshalingHelper.MarshalObjectToPointer(value, buffer, MarshalingHelper.GetObjectSize(value));
+
+            long start = GC.GetAllocatedBytesForCurrentThread();
+
+            for (int i = 0; i < Program.MarshalCount; i++)
+            {
+                MarshalingHelper.MarshalObjectToPointer(value, buffer, MarshalingHelper.GetObjectSize(value));
+            }
+
+            return (double)(GC.GetAllocatedBytesForCurrentThread() - start) / Program.MarshalCount;
+        }
+
+        /// <summary>
+        /// Runs the monitor under load and prints the results.
+        /// </summary>
+        /// <param name="name">Scenario name.</param>
+        /// <param name="receiveCount">Amount of message requests to keep pending.</param>
+        /// <param name="blockingHandler">Whether the slow handler blocks the thread it's invoked on.</param>
+        /// <param name="seconds">Amount of seconds to run for.</param>
+        /// <returns>Amount of failures detected.</returns>
+        private static int RunScenario(string name, int receiveCount, bool blockingHandler, int seconds)
+        {
+            FilterPortEmulator.Reset();
+
+            LoadStatistics statistics = new LoadStatistics();
+            Stopwatch stopwatch = new Stopwatch();
+            Func<IDriverNotification, Task<object>> handler = blockingHandler ? (Func<IDriverNotification, Task<object>>)Program.HandleBlocking : Program.HandleAsync;
+
+            using (CancellationTokenSource cancellationTokenSource = new CancellationTokenSource())
+            {
+                NotificationsMonitor monitor = new NotificationsMonitor(cancellationTokenSource.Token, Program.MaxNotificationSize, handler, new IntPtr(1), new IntPtr(2), receiveCount);
+
+                List<Thread> workers = new List<Thread>();
+                for (int i = 0; i < Program.ThreadCount; i++)
+                {
+                    workers.Add(Program.StartThread(() => Program.DoMonitorWork(monitor, statistics)));
+                }
+
+                monitor.Start();
+
+                List<Thread> senders = new List<Thread>();
+                for (int i = 0; i < Program.SlowSenderCount + Program.FastSenderCount; i++)
+                {
+                    int type = i < Program.SlowSenderCount ? Program.SlowNotification : Program.FastNotification;
+                    int seed = i << 24;
+
+                    senders.Add(Program.StartThread(() => Program.SendNotifications(type, seed, statistics)));
+                }
+
+                stopwatch.Start();
+                Thread.Sleep(TimeSpan.FromSeconds(seconds));
+
+                Volatile.Write(ref statistics.Stopped, 1);
+                senders.ForEach(t => t.Join());
+                stopwatch.Stop();
+
+                // All notifications are replied to, so the monitor threads finish as soon as the requests are cancelled.
+                cancellationTokenSource.Cancel();
+                workers.ForEach(t => t.Join());
+            }
+
+            if (FilterPortEmulator.PendingReceiveCount != 0 || FilterPortEmulator.WaiterCount != 0)
+            {
+                Console.WriteLine("{0}: {1} requests were not cancelled, {2} senders are still waiting.", name, FilterPortEmulator.PendingReceiveCount, FilterPortEmulator.WaiterCount);
+                statistics.Failures++;
+            }
+
+            double elapsed = stopwatch.Elapsed.TotalSeconds;
+
+            statistics.FastLatencies.Sort();
+            Console.WriteLine(
+                "{0,-10} {1,8} {2,10:F0} {3,10:F2} {4,10:F2} {5,10:F0} {6,9}",
+                name,
+                receiveCount,
+                statistics.FastLatencies.Count / elapsed,
+                Program.Percentile(statistics.FastLatencies, 0.50),
+                Program.Percentile(statistics.FastLatencies, 0.99),
+                statistics.SlowCount / elapsed,
+                statistics.Failures);
+
+            return statistics.Failures;
+        }
+
+        /// <summary>
+        /// Sends the notifications of the <paramref name="type"/> given, until the scenario is stopped, and checks the replies.
+        /// This method mirrors the driver threads waiting in the <c>FltSendMessage</c>.
+        /// </summary>
+        /// <param name="type">Notification type.</param>
+        /// <param name="seed">The first notification value.</param>
+        /// <param name="statistics">Statistics to be updated.</param>
+        private static void SendNotifications(int type, int seed, LoadStatistics statistics)
+        {
+            byte[] data  = new byte[sizeof(int)];
+            byte[] reply = new byte[sizeof(int)];
+            List<double> latencies = new List<double>();
+            int slowCount = 0;
+            int failures  = 0;
+
+            for (int value = seed; Volatile.Read(ref statistics.Stopped) == 0; value++)
+            {
+                BitConverter.TryWriteBytes(data, value);
+
+                long start = Stopwatch.GetTimestamp();
+
+                int status;
+                bool replied = FilterPortEmulator.SendMessage(type, data, reply, Program.ReplyTimeout, out status);
+
+                double milliseconds = (Stopwatch.GetTimestamp() - start) * 1000.0 / Stopwatch.Frequency;
+
+                // The reply should belong to this notification.
+                if (!replied || status != 0 || BitConverter.ToInt32(reply, 0) != value + 1)
+                {
+                    failures++;
+                }
+                else if (type == Program.FastNotification)
+                {
+                    latencies.Add(milliseconds);
+                }
+                else
+                {
+                    slowCount++;
+                }
+            }
+
+            lock (statistics)
+            {
+                statistics.FastLatencies.AddRange(latencies);
+                statistics.SlowCount += slowCount;
+                statistics.Failures  += failures;
+            }
+        }
+
+        /// <summary>
+        /// Dequeues the completions until the monitor is stopped.
+        /// </summary>
+        /// <param name="monitor">Monitor to run.</param>
+        /// <param name="statistics">Statistics to record the failure to.</param>
+        private static void DoMonitorWork(NotificationsMonitor monitor, LoadStatistics statistics)
+        {
+            try
+            {
+                monitor.DoWork();
+            }
+            catch (InvalidOperationException e)
+            {
+                Console.WriteLine("Monitor failed: {0}", e.InnerException?.Message ?? e.Message);
+
+                lock (statistics)
+                {
+                    statistics.Failures++;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Handles the notification asynchronously. The reply is the notification value plus one.
+        /// </summary>
+        /// <param name="notification">Notification received.</param>
+        /// <returns>Handler task.</returns>
+        private static Task<object> HandleAsync(IDriverNotification notification)
+        {
+            int value = Marshal.ReadInt32(notification.Data);
+
+            return notification.Type == Program.SlowNotification
+                ? Program.FetchAsync(value)
+                : Task.FromResult<object>(value + 1);
+        }
+
+        /// <summary>
+        /// Emulates the slow handler, which doesn't block the thread while it waits.
+        /// </summary>
+        /// <param name="value">Notification value.</param>
+        /// <returns>Handler task.</returns>
+        private static async Task<object> FetchAsync(int value)
+        {
+            await Task.Delay(Program.SlowHandlerDelay).ConfigureAwait(false);
+            return value + 1;
+        }
+
+        /// <summary>
+        /// Returns the cached reply for every notification.
+        /// </summary>
+        /// <param name="notification">Notification received.</param>
+        /// <returns>Completed handler task.</returns>
+        private static Task<object> HandleCached(IDriverNotification notification)
+        {
+            return Program.CachedReply;
+        }
+
+        /// <summary>
+        /// Handles the notification on the thread it's received on, like the previous dispatcher did.
+        /// </summary>
+        /// <param name="notification">Notification received.</param>
+        /// <returns>Completed handler task.</returns>
+        private static Task<object> HandleBlocking(IDriverNotification notification)
+        {
+            int value = Marshal.ReadInt32(notification.Data);
+
+            if (notification.Type == Program.SlowNotification)
+            {
+                Thread.Sleep(Program.SlowHandlerDelay);
+            }
+
+            return Task.FromResult<object>(value + 1);
+        }
+
+        /// <summary>
+        /// Gets the percentile of the sorted values.
+        /// </summary>
+        /// <param name="sortedValues">Values sorted in the ascending order.</param>
+        /// <param name="fraction">Percentile fraction.</param>
+        /// <returns>Percentile value, or <c>0</c>, if there are no values.</returns>
+        private static double Percentile(List<double> sortedValues, double fraction)
+        {
+            return sortedValues.Count == 0 ? 0 : sortedValues[Math.Min(sortedValues.Count - 1, (int)(sortedValues.Count * fraction))];
+        }
+
+        /// <summary>
+        /// Starts the background thread.
+        /// </summary>
+        /// <param name="start">Thread procedure.</param>
+        /// <returns>Thread started.</returns>
+        private static Thread StartThread(ThreadStart start)
+        {
+            Thread thread = new Thread(start) { IsBackground = true };
+            thread.Start();
+
+            return thread;
+        }
+
+        #endregion // Private methods
+
+        #region Nested types
+
+        /// <summary>
+        /// Scenario statistics.
+        /// </summary>
+        private sealed class LoadStatistics
+        {
+            /// <summary>
+            /// Round-trip times of the fast notifications, in milliseconds.
+            /// </summary>
+            public readonly List<double> FastLatencies = new List<double>();
+
+            /// <summary>
+            /// Whether the senders should stop.
+            /// </summary>
+            public int Stopped;
+
+            /// <summary>
+            /// Amount of the slow notifications replied to.
+            /// </summary>
+            public int SlowCount;
+
+            /// <summary>
+            /// Amount of notifications not replied to or replied to incorrectly, and monitor failures.
+            /// </summary>
+            public int Failures;
+        }
+
+        #endregion // Nested types
+    }
+}
@@ -0,0 +1,1280 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    NotificationRingBench.c
+
+Abstract:
+
+    Two-process benchmark and stress test for the notification ring protocol implemented by the
+    'LcSendRingNotification', 'LcCompleteRingNotifications' and 'LcAbandonRingSlot' in the
+    'LazyCopyDriver\NotificationRing.c', and by the 'NotificationRingMonitor' in the client library.
+
+    The parent process plays the driver, and the child process plays the client. The ring is
+    a shared anonymous mapping created before the fork, and the kernel events are replaced by futexes
+    in the same mapping. The 'CompleteRingNotifications' command runs the driver code in the client
+    thread, the same way the command handler does.
+
+    The benchmark compares the round trip rate of the ring with a port stand-in, which sends every
+    notification as a separate message over a socket and delivers the replies through a
+    dispatcher thread, as the 'FltSendMessage' and the 'NotificationsMonitor' do.
+
+    The stress phase makes some senders give up after a short timeout, cancels random fetches the
+    way the 'LcPendedFetchQueueCompleteCanceled' does, and makes the client handler slow, so the slots
+    are withdrawn and abandoned, while a hostile client thread keeps rewriting the 'DataLength' of the
+    replied slots with huge values. Every ring notification carries a target handle, as the fetch
+    notification does, which is owned by the client, once it's delivered. It checks that:
+    - Every reply received belongs to the request sent;
+    - The reply copy never goes past the 'ReplyLength' given (a canary follows the reply buffer);
+    - The client never processes a notification the driver has withdrawn;
+    - Every slot is free when both sides stop, so the abandoned slots are released;
+    - Every target handle is closed exactly once, and never before the client is done with it,
+      even if the fetch has timed out or been cancelled.
+
+    Build and run:
+
+        gcc -O2 -pthread -o NotificationRingBench NotificationRingBench.c
+        ./NotificationRingBench [senders] [seconds] [legacy]
+
+    The 'legacy' argument re-reads the 'DataLength' when the reply is copied, makes the client
+    take the slots with a plain write instead of the compare-exchange, and makes the driver close
+    the target handle, once it stops waiting for the reply, as both sides did before, to check
+    that the harness detects the failures.
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------
+//  Definitions.
+//------------------------------------------------------------------------
+
+// Should match the ones in the 'CommunicationData.h'.
+#define NOTIFICATION_RING_VERSION         1
+#define NOTIFICATION_RING_SLOT_COUNT      32
+#define NOTIFICATION_RING_SLOT_DATA_SIZE  4072
+
+#define NotificationSlotFree        0
+#define NotificationSlotFilling     1
+#define NotificationSlotRequest     2
+#define NotificationSlotProcessing  3
+#define NotificationSlotReply       4
+
+#define STATUS_SUCCESS              0
+#define STATUS_NOT_SUPPORTED        1
+#define STATUS_IO_TIMEOUT           2
+#define STATUS_UNSUCCESSFUL         3
+#define STATUS_CANCELLED            4
+
+// Notification and reply sizes.
+#define REQUEST_SIZE                512
+#define REPLY_LENGTH                64
+
+#define CANARY                      0xA5
+
+// Maximum amount of notifications tracked by the withdrawn notification map.
+#define MAX_SEQUENCES               (1 << 24)
+
+#define MAX_SENDERS                 64
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+typedef struct _LC_EVENT
+{
+    volatile int Signaled;
+} LC_EVENT, *PLC_EVENT;
+
+typedef struct _NOTIFICATION_RING_SLOT
+{
+    volatile int32_t State;
+    int32_t          Type;
+    uint32_t         DataLength;
+    uint32_t         ReplyLength;
+    int32_t          Status;
+    uint32_t         Reserved;
+    uint8_t          Data[NOTIFICATION_RING_SLOT_DATA_SIZE];
+} NOTIFICATION_RING_SLOT, *PNOTIFICATION_RING_SLOT;
+
+typedef struct _NOTIFICATION_RING
+{
+    uint32_t               Version;
+    uint32_t               SlotCount;
+    uint32_t               SlotSize;
+    volatile int32_t       ClientWaiting;
+    NOTIFICATION_RING_SLOT Slots[NOTIFICATION_RING_SLOT_COUNT];
+} NOTIFICATION_RING, *PNOTIFICATION_RING;
+
+_Static_assert(sizeof(NOTIFICATION_RING_SLOT) == 4096, "NOTIFICATION_RING_SLOT layout");
+
+// Driver-side ring state. It's in the shared mapping only because the client runs the completion command.
+typedef struct _NOTIFICATION_RING_STATE
+{
+    NOTIFICATION_RING Ring;
+    LC_EVENT          RequestEvent;
+    volatile int32_t  NextSlot;
+    LC_EVENT          ReplyEvents[NOTIFICATION_RING_SLOT_COUNT];
+    volatile int32_t  AbandonedSlots[NOTIFICATION_RING_SLOT_COUNT];
+} NOTIFICATION_RING_STATE, *PNOTIFICATION_RING_STATE;
+
+// Notification data.
+typedef struct _REQUEST
+{
+    uint64_t Sequence;
+    uint32_t Checksum;
+    uint32_t Delay;
+    uint8_t  Payload[REQUEST_SIZE - 16];
+} REQUEST, *PREQUEST;
+
+// Reply data.
+typedef struct _REPLY
+{
+    uint64_t Sequence;
+    uint32_t Checksum;
+    uint32_t Reserved;
+} REPLY, *PREPLY;
+
+// Port stand-in message.
+typedef struct _PORT_MESSAGE
+{
+    uint32_t Sender;
+    uint32_t Reserved;
+    union
+    {
+        REQUEST Request;
+        REPLY   Reply;
+    };
+} PORT_MESSAGE, *PPORT_MESSAGE;
+
+// State shared by both processes.
+typedef struct _SHARED_STATE
+{
+    NOTIFICATION_RING_STATE RingState;
+
+    volatile int            StopClient;
+    volatile long           Processed;
+    volatile long           WithdrawnProcessed;
+    volatile long           HostileWrites;
+    volatile long           DoubleClosedHandles;
+    volatile long           ClosedHandlesUsed;
+
+    // Set by the driver for every notification it withdraws from the ring.
+    volatile uint8_t        Withdrawn[MAX_SEQUENCES];
+
+    // Set, while the target handle of the notification is open.
+    volatile uint8_t        Handles[MAX_SEQUENCES];
+} SHARED_STATE, *PSHARED_STATE;
+
+typedef struct _THREAD_STATE
+{
+    pthread_t     Thread;
+    uint32_t      Index;
+    unsigned int  Seed;
+    unsigned long Completed;
+    unsigned long TimedOut;
+    unsigned long Cancelled;
+    unsigned long Mismatched;
+    unsigned long Overruns;
+
+    // Signaled by the canceller thread, when the current fetch is no longer needed.
+    LC_EVENT      CancelEvent;
+
+    // Port stand-in reply delivery.
+    LC_EVENT      ReplyEvent;
+    REPLY         Reply;
+} THREAD_STATE, *PTHREAD_STATE;
+
+typedef enum _BENCH_MODE
+{
+    ModePort,
+    ModeRing,
+    ModeStress
+} BENCH_MODE;
+
+//------------------------------------------------------------------------
+//  Global variables.
+//------------------------------------------------------------------------
+
+static PSHARED_STATE  Shared        = NULL;
+static int            Legacy        = 0;
+static BENCH_MODE     Mode          = ModeRing;
+
+static volatile int   StopRequested = 0;
+static volatile long  NextSequence  = 0;
+
+// Port stand-in socket, and the senders the dispatcher delivers the replies to.
+static int            PortSocket    = -1;
+static PTHREAD_STATE  Senders       = NULL;
+
+//------------------------------------------------------------------------
+//  Event functions.
+//------------------------------------------------------------------------
+
+static
+void
+LcSetEvent(
+    PLC_EVENT Event
+    )
+{
+    __atomic_store_n(&Event->Signaled, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &Event->Signaled, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcClearEvent(
+    PLC_EVENT Event
+    )
+{
+    __atomic_store_n(&Event->Signaled, 0, __ATOMIC_SEQ_CST);
+}
+
+//------------------------------------------------------------------------
+
+static
+int
+LcWaitEvent(
+    PLC_EVENT Event,
+    long long TimeoutNs
+    )
+/*++
+
+Summary:
+
+    This function waits for the event to be signaled. Returns zero, if the wait timed out.
+    Negative 'TimeoutNs' means no timeout.
+
+--*/
+{
+    struct timespec timeout = { (time_t)(TimeoutNs / 1000000000LL), (long)(TimeoutNs % 1000000000LL) };
+
+    if (__atomic_load_n(&Event->Signaled, __ATOMIC_SEQ_CST) == 0)
+    {
+        syscall(SYS_futex, &Event->Signaled, FUTEX_WAIT, 0, TimeoutNs >= 0 ? &timeout : NULL, NULL, 0);
+    }
+
+    return __atomic_load_n(&Event->Signaled, __ATOMIC_SEQ_CST) != 0;
+}
+
+//------------------------------------------------------------------------
+
+static
+long long
+LcNow(
+    void
+    )
+{
+    struct timespec now = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+//------------------------------------------------------------------------
+
+static
+uint32_t
+LcChecksum(
+    const uint8_t* Data,
+    size_t         Length
+    )
+{
+    uint32_t hash = 2166136261u;
+    size_t   idx  = 0;
+
+    for (idx = 0; idx < Length; idx++)
+    {
+        hash = (hash ^ Data[idx]) * 16777619u;
+    }
+
+    return hash;
+}
+
+//------------------------------------------------------------------------
+//  Target handle functions.
+//------------------------------------------------------------------------
+
+static
+void
+LcOpenTargetHandle(
+    uint64_t Sequence
+    )
+{
+    __atomic_store_n(&Shared->Handles[Sequence % MAX_SEQUENCES], 1, __ATOMIC_SEQ_CST);
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcCloseTargetHandle(
+    uint64_t Sequence
+    )
+/*++
+
+Summary:
+
+    This function closes the target handle of the notification given, and counts the handles closed twice.
+
+--*/
+{
+    if (__atomic_exchange_n(&Shared->Handles[Sequence % MAX_SEQUENCES], 0, __ATOMIC_SEQ_CST) == 0)
+    {
+        __atomic_add_fetch(&Shared->DoubleClosedHandles, 1, __ATOMIC_RELAXED);
+    }
+}
+
+//------------------------------------------------------------------------
+
+static
+int
+LcIsTargetHandleOpen(
+    uint64_t Sequence
+    )
+{
+    return __atomic_load_n(&Shared->Handles[Sequence % MAX_SEQUENCES], __ATOMIC_SEQ_CST) != 0;
+}
+
+//------------------------------------------------------------------------
+//  Driver side.
+//------------------------------------------------------------------------
+
+static
+int
+LcAbandonRingSlot(
+    PNOTIFICATION_RING_STATE State,
+    uint32_t                 Index,
+    uint64_t                 Sequence
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcAbandonRingSlot'. Returns non-zero, if the notification is withdrawn.
+
+--*/
+{
+    int32_t expected = NotificationSlotRequest;
+
+    if (__atomic_compare_exchange_n(&State->Ring.Slots[Index].State, &expected, NotificationSlotFree, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    {
+        // The notification is withdrawn, so the client must never process it.
+        Shared->Withdrawn[Sequence % MAX_SEQUENCES] = 1;
+        return 1;
+    }
+
+    __atomic_store_n(&State->AbandonedSlots[Index], 1, __ATOMIC_SEQ_CST);
+
+    expected = 1;
+    if (__atomic_load_n(&State->Ring.Slots[Index].State, __ATOMIC_SEQ_CST) == NotificationSlotReply
+        && __atomic_compare_exchange_n(&State->AbandonedSlots[Index], &expected, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    {
+        __atomic_store_n(&State->Ring.Slots[Index].State, NotificationSlotFree, __ATOMIC_SEQ_CST);
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------
+
+static
+int
+LcSendRingNotification(
+    const void* Data,
+    uint32_t    DataLength,
+    void*       Reply,
+    uint32_t    ReplyLength,
+    long long   TimeoutNs,
+    PLC_EVENT   CancelEvent,
+    uint64_t    Sequence,
+    int*        Delivered
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcSendRingNotification'.
+    Negative 'TimeoutNs' means no timeout.
+
+    The futex can't wait for two events, so the 'CancelEvent' is polled every millisecond,
+    instead of being waited for along with the reply event.
+
+--*/
+{
+    PNOTIFICATION_RING_STATE state      = &Shared->RingState;
+    PNOTIFICATION_RING_SLOT  slot       = NULL;
+    uint32_t                 index      = 0;
+    uint32_t                 attempt    = 0;
+    uint32_t                 dataLength = 0;
+    int32_t                  slotStatus = 0;
+    uint32_t                 replySize  = 0;
+    long long                deadline   = 0;
+    long long                waitTime   = -1;
+    int32_t                  expected   = 0;
+
+    *Delivered = 0;
+
+    for (attempt = 0; attempt < NOTIFICATION_RING_SLOT_COUNT; attempt++)
+    {
+        index    = (uint32_t)__atomic_add_fetch(&state->NextSlot, 1, __ATOMIC_SEQ_CST) % NOTIFICATION_RING_SLOT_COUNT;
+        expected = NotificationSlotFree;
+
+        if (__atomic_compare_exchange_n(&state->Ring.Slots[index].State, &expected, NotificationSlotFilling, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        {
+            slot = &state->Ring.Slots[index];
+            break;
+        }
+    }
+
+    if (slot == NULL)
+    {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    slot->Type        = 1;
+    slot->DataLength  = DataLength;
+    slot->ReplyLength = ReplyLength;
+    slot->Status      = 0;
+    memcpy(slot->Data, Data, DataLength);
+
+    LcClearEvent(&state->ReplyEvents[index]);
+
+    __atomic_store_n(&slot->State, NotificationSlotRequest, __ATOMIC_SEQ_CST);
+    *Delivered = 1;
+
+    expected = 1;
+    if (__atomic_compare_exchange_n(&state->Ring.ClientWaiting, &expected, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    {
+        LcSetEvent(&state->RequestEvent);
+    }
+
+    if (TimeoutNs >= 0)
+    {
+        deadline = LcNow() + TimeoutNs;
+    }
+
+    while (__atomic_load_n(&slot->State, __ATOMIC_SEQ_CST) != NotificationSlotReply)
+    {
+        if (TimeoutNs >= 0)
+        {
+            waitTime = deadline - LcNow();
+            if (waitTime <= 0)
+            {
+                *Delivered = !LcAbandonRingSlot(state, index, Sequence);
+                return STATUS_IO_TIMEOUT;
+            }
+        }
+
+        if (CancelEvent != NULL)
+        {
+            if (__atomic_load_n(&CancelEvent->Signaled, __ATOMIC_SEQ_CST) != 0)
+            {
+                *Delivered = !LcAbandonRingSlot(state, index, Sequence);
+                return STATUS_CANCELLED;
+            }
+
+            waitTime = waitTime < 0 || waitTime > 1000000 ? 1000000 : waitTime;
+        }
+
+        LcWaitEvent(&state->ReplyEvents[index], waitTime);
+        LcClearEvent(&state->ReplyEvents[index]);
+    }
+
+    if (Legacy)
+    {
+        // 'min(slot->DataLength, ReplyLength)' reads the length twice.
+        replySize = __atomic_load_n(&slot->DataLength, __ATOMIC_RELAXED) < ReplyLength ? (sched_yield(), __atomic_load_n(&slot->DataLength, __ATOMIC_RELAXED)) : ReplyLength;
+    }
+    else
+    {
+        dataLength = __atomic_load_n(&slot->DataLength, __ATOMIC_RELAXED);
+        replySize  = dataLength < ReplyLength ? dataLength : ReplyLength;
+    }
+
+    slotStatus = __atomic_load_n(&slot->Status, __ATOMIC_RELAXED);
+
+    // The sender buffer has room for the whole slot data, and the copy is limited to it,
+    // so a copy past the 'ReplyLength' is detected by the canary instead of corrupting memory.
+    memcpy(Reply, slot->Data, replySize < NOTIFICATION_RING_SLOT_DATA_SIZE ? replySize : NOTIFICATION_RING_SLOT_DATA_SIZE);
+    if (replySize < ReplyLength)
+    {
+        memset((uint8_t*)Reply + replySize, 0, ReplyLength - replySize);
+    }
+
+    __atomic_store_n(&slot->State, NotificationSlotFree, __ATOMIC_SEQ_CST);
+
+    return slotStatus < 0 ? STATUS_UNSUCCESSFUL : STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcCompleteRingNotifications(
+    void
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcCompleteRingNotifications'.
+
+--*/
+{
+    PNOTIFICATION_RING_STATE state    = &Shared->RingState;
+    uint32_t                 index    = 0;
+    int32_t                  expected = 0;
+
+    for (index = 0; index < NOTIFICATION_RING_SLOT_COUNT; index++)
+    {
+        if (__atomic_load_n(&state->Ring.Slots[index].State, __ATOMIC_SEQ_CST) != NotificationSlotReply)
+        {
+            continue;
+        }
+
+        expected = 1;
+        if (__atomic_compare_exchange_n(&state->AbandonedSlots[index], &expected, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        {
+            __atomic_store_n(&state->Ring.Slots[index].State, NotificationSlotFree, __ATOMIC_SEQ_CST);
+        }
+        else
+        {
+            LcSetEvent(&state->ReplyEvents[index]);
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+//  Client side.
+//------------------------------------------------------------------------
+
+static
+int
+LcHandleRequest(
+    const REQUEST* Request,
+    PREPLY         Reply
+    )
+/*++
+
+Summary:
+
+    This function is the client notification handler. Returns the reply size.
+
+--*/
+{
+    struct timespec delay = { 0, (long)Request->Delay * 1000L };
+
+    if (Request->Delay != 0)
+    {
+        nanosleep(&delay, NULL);
+    }
+
+    Reply->Sequence = Request->Sequence;
+    Reply->Checksum = LcChecksum(Request->Payload, sizeof(Request->Payload));
+    Reply->Reserved = 0;
+
+    return sizeof(REPLY);
+}
+
+//------------------------------------------------------------------------
+
+static
+int
+LcProcessSlot(
+    PNOTIFICATION_RING_SLOT Slot
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'NotificationRingMonitor.ProcessSlot'.
+
+--*/
+{
+    REQUEST  request     = { 0 };
+    REPLY    reply       = { 0 };
+    uint32_t replyLength = Slot->ReplyLength;
+    int      replySize   = 0;
+
+    memcpy(&request, Slot->Data, sizeof(request));
+
+    replySize = LcHandleRequest(&request, &reply);
+
+    // The handle is used by the handler till the end, even if the driver has stopped waiting for the reply.
+    if (!LcIsTargetHandleOpen(request.Sequence))
+    {
+        __atomic_add_fetch(&Shared->ClosedHandlesUsed, 1, __ATOMIC_RELAXED);
+    }
+    else if (!Legacy)
+    {
+        LcCloseTargetHandle(request.Sequence);
+    }
+
+    __atomic_add_fetch(&Shared->Processed, 1, __ATOMIC_RELAXED);
+
+    if (Shared->Withdrawn[request.Sequence % MAX_SEQUENCES])
+    {
+        __atomic_add_fetch(&Shared->WithdrawnProcessed, 1, __ATOMIC_RELAXED);
+    }
+
+    if (replyLength == 0)
+    {
+        __atomic_store_n(&Slot->State, NotificationSlotFree, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+
+    memcpy(Slot->Data, &reply, (size_t)replySize);
+    Slot->DataLength = (uint32_t)replySize;
+    Slot->Status     = 0;
+
+    __atomic_store_n(&Slot->State, NotificationSlotReply, __ATOMIC_SEQ_CST);
+
+    return 1;
+}
+
+//------------------------------------------------------------------------
+
+static
+int
+LcProcessRequests(
+    unsigned int* Seed,
+    int*          ReplyCount
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'NotificationRingMonitor.ProcessRequests'.
+
+--*/
+{
+    static uint32_t         nextSlot  = 0;
+    PNOTIFICATION_RING_SLOT slot      = NULL;
+    uint32_t                idx       = 0;
+    uint32_t                index     = 0;
+    int                     processed = 0;
+    int32_t                 expected  = 0;
+
+    *ReplyCount = 0;
+
+    for (idx = 0; idx < NOTIFICATION_RING_SLOT_COUNT; idx++)
+    {
+        index = (nextSlot + idx) % NOTIFICATION_RING_SLOT_COUNT;
+        slot  = &Shared->RingState.Ring.Slots[index];
+
+        if (__atomic_load_n(&slot->State, __ATOMIC_SEQ_CST) != NotificationSlotRequest)
+        {
+            continue;
+        }
+
+        // Give the senders a chance to withdraw the notification in the middle.
+        if (Mode == ModeStress && rand_r(Seed) % 4 == 0)
+        {
+            sched_yield();
+        }
+
+        if (Legacy)
+        {
+            __atomic_store_n(&slot->State, NotificationSlotProcessing, __ATOMIC_SEQ_CST);
+        }
+        else
+        {
+            expected = NotificationSlotRequest;
+            if (!__atomic_compare_exchange_n(&slot->State, &expected, NotificationSlotProcessing, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            {
+                continue;
+            }
+        }
+
+        *ReplyCount += LcProcessSlot(slot);
+
+        nextSlot = index + 1;
+        processed++;
+    }
+
+    return processed;
+}
+
+//------------------------------------------------------------------------
+
+static
+int
+LcHasRequests(
+    void
+    )
+{
+    uint32_t idx = 0;
+
+    for (idx = 0; idx < NOTIFICATION_RING_SLOT_COUNT; idx++)
+    {
+        if (__atomic_load_n(&Shared->RingState.Ring.Slots[idx].State, __ATOMIC_SEQ_CST) == NotificationSlotRequest)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------
+
+static
+void*
+LcHostileThread(
+    void* Context
+    )
+/*++
+
+Summary:
+
+    This function keeps rewriting the reply length of the replied slots with huge values.
+
+--*/
+{
+    unsigned int seed = 1;
+    uint32_t     idx  = 0;
+
+    (void)Context;
+
+    while (!__atomic_load_n(&Shared->StopClient, __ATOMIC_RELAXED))
+    {
+        idx = (uint32_t)rand_r(&seed) % NOTIFICATION_RING_SLOT_COUNT;
+
+        if (__atomic_load_n(&Shared->RingState.Ring.Slots[idx].State, __ATOMIC_RELAXED) == NotificationSlotReply)
+        {
+            __atomic_store_n(&Shared->RingState.Ring.Slots[idx].DataLength, 0xFFFFFFF0u, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&Shared->HostileWrites, 1, __ATOMIC_RELAXED);
+        }
+
+        if (rand_r(&seed) % 64 == 0)
+        {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcRingClient(
+    void
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'NotificationRingMonitor.DoWork'.
+
+--*/
+{
+    unsigned int seed       = 1;
+    int          replyCount = 0;
+    pthread_t    hostile    = { 0 };
+
+    if (Mode == ModeStress)
+    {
+        pthread_create(&hostile, NULL, LcHostileThread, NULL);
+    }
+
+    for (;;)
+    {
+        if (LcProcessRequests(&seed, &replyCount) > 0)
+        {
+            if (replyCount > 0)
+            {
+                LcCompleteRingNotifications();
+            }
+
+            continue;
+        }
+
+        if (__atomic_load_n(&Shared->StopClient, __ATOMIC_SEQ_CST))
+        {
+            break;
+        }
+
+        __atomic_store_n(&Shared->RingState.Ring.ClientWaiting, 1, __ATOMIC_SEQ_CST);
+
+        if (LcHasRequests())
+        {
+            continue;
+        }
+
+        LcWaitEvent(&Shared->RingState.RequestEvent, -1);
+        LcClearEvent(&Shared->RingState.RequestEvent);
+    }
+
+    // Release the slots replied after the last completion.
+    LcCompleteRingNotifications();
+
+    if (Mode == ModeStress)
+    {
+        pthread_join(hostile, NULL);
+    }
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcPortClient(
+    int Socket
+    )
+/*++
+
+Summary:
+
+    This function plays the 'NotificationsMonitor': every notification is received, handled and replied separately.
+
+--*/
+{
+    PORT_MESSAGE message = { 0 };
+    REPLY        reply   = { 0 };
+
+    while (recv(Socket, &message, sizeof(message), 0) > 0)
+    {
+        LcHandleRequest(&message.Request, &reply);
+        __atomic_add_fetch(&Shared->Processed, 1, __ATOMIC_RELAXED);
+
+        message.Reply = reply;
+        if (send(Socket, &message, offsetof(PORT_MESSAGE, Reply) + sizeof(REPLY), 0) < 0)
+        {
+            break;
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+//  Driver threads.
+//------------------------------------------------------------------------
+
+static
+void*
+LcPortDispatcherThread(
+    void* Context
+    )
+/*++
+
+Summary:
+
+    This function delivers the port stand-in replies to the waiting senders.
+
+--*/
+{
+    PORT_MESSAGE message = { 0 };
+
+    (void)Context;
+
+    while (recv(PortSocket, &message, sizeof(message), 0) > 0)
+    {
+        Senders[message.Sender].Reply = message.Reply;
+        LcSetEvent(&Senders[message.Sender].ReplyEvent);
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+static
+void*
+LcSenderThread(
+    void* Context
+    )
+{
+    PTHREAD_STATE state                          = (PTHREAD_STATE)Context;
+    PORT_MESSAGE  message                        = { 0 };
+    uint8_t       reply[NOTIFICATION_RING_SLOT_DATA_SIZE];
+    PREPLY        received                       = (PREPLY)reply;
+    long long     timeout                        = -1;
+    uint32_t      idx                            = 0;
+    int           status                         = 0;
+    int           delivered                      = 0;
+
+    message.Sender = state->Index;
+
+    for (idx = 0; idx < sizeof(message.Request.Payload); idx++)
+    {
+        message.Request.Payload[idx] = (uint8_t)rand_r(&state->Seed);
+    }
+
+    while (!__atomic_load_n(&StopRequested, __ATOMIC_RELAXED))
+    {
+        message.Request.Sequence = (uint64_t)__atomic_add_fetch(&NextSequence, 1, __ATOMIC_RELAXED);
+        message.Request.Payload[message.Request.Sequence % sizeof(message.Request.Payload)]++;
+        message.Request.Checksum = LcChecksum(message.Request.Payload, sizeof(message.Request.Payload));
+        message.Request.Delay    = 0;
+        timeout                  = -1;
+
+        // Some senders give up early, and some notifications take longer to handle.
+        if (Mode == ModeStress)
+        {
+            if (rand_r(&state->Seed) % 4 == 0)
+            {
+                timeout = 10000 + rand_r(&state->Seed) % 200000;
+            }
+
+            if (rand_r(&state->Seed) % 8 == 0)
+            {
+                message.Request.Delay = (uint32_t)(rand_r(&state->Seed) % 300);
+            }
+        }
+
+        memset(reply, CANARY, sizeof(reply));
+
+        if (Mode == ModePort)
+        {
+            LcClearEvent(&state->ReplyEvent);
+            send(PortSocket, &message, sizeof(message), 0);
+            LcWaitEvent(&state->ReplyEvent, -1);
+
+            memcpy(reply, &state->Reply, sizeof(REPLY));
+            status = STATUS_SUCCESS;
+        }
+        else
+        {
+            // The driver opens the target handle for the client, and closes it only, if the client has never received it.
+            LcOpenTargetHandle(message.Request.Sequence);
+            LcClearEvent(&state->CancelEvent);
+
+            status = LcSendRingNotification(
+                &message.Request,
+                sizeof(message.Request),
+                reply,
+                REPLY_LENGTH,
+                timeout,
+                Mode == ModeStress ? &state->CancelEvent : NULL,
+                message.Request.Sequence,
+                &delivered);
+
+            if (Legacy || !delivered)
+            {
+                LcCloseTargetHandle(message.Request.Sequence);
+            }
+        }
+
+        if (status == STATUS_NOT_SUPPORTED)
+        {
+            // The ring is full; the driver would use the port instead.
+            sched_yield();
+            continue;
+        }
+
+        if (status == STATUS_IO_TIMEOUT)
+        {
+            state->TimedOut++;
+            continue;
+        }
+
+        if (status == STATUS_CANCELLED)
+        {
+            state->Cancelled++;
+            continue;
+        }
+
+        if (received->Sequence != message.Request.Sequence || received->Checksum != message.Request.Checksum)
+        {
+            state->Mismatched++;
+        }
+
+        for (idx = REPLY_LENGTH; idx < sizeof(reply); idx++)
+        {
+            if (reply[idx] != CANARY)
+            {
+                state->Overruns++;
+                break;
+            }
+        }
+
+        state->Completed++;
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+static
+void*
+LcCancellerThread(
+    void* Context
+    )
+/*++
+
+Summary:
+
+    This function keeps cancelling the fetches of random senders, as the cancelled I/O operations do.
+
+--*/
+{
+    int             senderCount = (int)(intptr_t)Context;
+    unsigned int    seed        = 7;
+    struct timespec delay       = { 0 };
+
+    while (!__atomic_load_n(&StopRequested, __ATOMIC_RELAXED))
+    {
+        delay.tv_nsec = 10000 + rand_r(&seed) % 100000;
+        nanosleep(&delay, NULL);
+
+        LcSetEvent(&Senders[rand_r(&seed) % senderCount].CancelEvent);
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+static
+int
+LcRun(
+    BENCH_MODE RunMode,
+    int        SenderCount,
+    double     Seconds
+    )
+/*++
+
+Summary:
+
+    This function runs the client process and the senders for the time given.
+    Returns the amount of violations detected.
+
+--*/
+{
+    static const char* modeNames[] = { "port", "ring", "ring stress" };
+
+    int             sockets[2]  = { -1, -1 };
+    pthread_t       dispatcher  = { 0 };
+    pthread_t       canceller   = { 0 };
+    pid_t           client      = 0;
+    struct timespec delay       = { (time_t)Seconds, (long)((Seconds - (time_t)Seconds) * 1e9) };
+    unsigned long   completed   = 0;
+    unsigned long   timedOut    = 0;
+    unsigned long   cancelled   = 0;
+    unsigned long   mismatched  = 0;
+    unsigned long   overruns    = 0;
+    unsigned long   leaked      = 0;
+    unsigned long   openHandles = 0;
+    long long       start       = 0;
+    long long       elapsed     = 0;
+    int             idx         = 0;
+
+    Mode = RunMode;
+
+    memset((void*)Shared, 0, offsetof(SHARED_STATE, Withdrawn));
+    memset((void*)Shared->Withdrawn, 0, sizeof(Shared->Withdrawn));
+    memset((void*)Shared->Handles,   0, sizeof(Shared->Handles));
+
+    Shared->RingState.Ring.Version   = NOTIFICATION_RING_VERSION;
+    Shared->RingState.Ring.SlotCount = NOTIFICATION_RING_SLOT_COUNT;
+    Shared->RingState.Ring.SlotSize  = sizeof(NOTIFICATION_RING_SLOT);
+
+    if (Mode == ModePort && socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets) != 0)
+    {
+        perror("socketpair");
+        exit(2);
+    }
+
+    client = fork();
+    if (client == 0)
+    {
+        if (Mode == ModePort)
+        {
+            close(sockets[0]);
+            LcPortClient(sockets[1]);
+        }
+        else
+        {
+            LcRingClient();
+        }
+
+        _exit(0);
+    }
+
+    if (Mode == ModePort)
+    {
+        close(sockets[1]);
+        PortSocket = sockets[0];
+        pthread_create(&dispatcher, NULL, LcPortDispatcherThread, NULL);
+    }
+
+    StopRequested = 0;
+    start         = LcNow();
+
+    for (idx = 0; idx < SenderCount; idx++)
+    {
+        memset(&Senders[idx], 0, sizeof(THREAD_STATE));
+        Senders[idx].Index = (uint32_t)idx;
+        Senders[idx].Seed  = (unsigned int)idx + 1;
+        pthread_create(&Senders[idx].Thread, NULL, LcSenderThread, &Senders[idx]);
+    }
+
+    if (Mode == ModeStress)
+    {
+        pthread_create(&canceller, NULL, LcCancellerThread, (void*)(intptr_t)SenderCount);
+    }
+
+    nanosleep(&delay, NULL);
+    __atomic_store_n(&StopRequested, 1, __ATOMIC_SEQ_CST);
+
+    if (Mode == ModeStress)
+    {
+        pthread_join(canceller, NULL);
+    }
+
+    for (idx = 0; idx < SenderCount; idx++)
+    {
+        pthread_join(Senders[idx].Thread, NULL);
+
+        completed  += Senders[idx].Completed;
+        timedOut   += Senders[idx].TimedOut;
+        cancelled  += Senders[idx].Cancelled;
+        mismatched += Senders[idx].Mismatched;
+        overruns   += Senders[idx].Overruns;
+    }
+
+    elapsed = LcNow() - start;
+
+    __atomic_store_n(&Shared->StopClient, 1, __ATOMIC_SEQ_CST);
+    LcSetEvent(&Shared->RingState.RequestEvent);
+
+    if (Mode == ModePort)
+    {
+        shutdown(PortSocket, SHUT_RDWR);
+        pthread_join(dispatcher, NULL);
+        close(PortSocket);
+    }
+
+    waitpid(client, NULL, 0);
+
+    if (Mode != ModePort)
+    {
+        for (idx = 0; idx < NOTIFICATION_RING_SLOT_COUNT; idx++)
+        {
+            if (Shared->RingState.Ring.Slots[idx].State != NotificationSlotFree || Shared->RingState.AbandonedSlots[idx] != 0)
+            {
+                leaked++;
+            }
+        }
+
+        // Every handle is closed by either side, once both of them stop.
+        for (idx = 0; idx < MAX_SEQUENCES; idx++)
+        {
+            openHandles += Shared->Handles[idx];
+        }
+    }
+
+    printf("%-12s %2d senders: %8.0f round trips/s, %7.2f us each; %lu timed out, %lu cancelled, %ld hostile writes\n",
+           modeNames[Mode],
+           SenderCount,
+           completed / (elapsed / 1e9),
+           elapsed / 1e3 * SenderCount / (completed != 0 ? completed : 1),
+           timedOut,
+           cancelled,
+           Shared->HostileWrites);
+
+    if (mismatched != 0 || overruns != 0 || leaked != 0 || Shared->WithdrawnProcessed != 0
+        || openHandles != 0 || Shared->DoubleClosedHandles != 0 || Shared->ClosedHandlesUsed != 0)
+    {
+        fprintf(stderr, "FAILED: %s: %lu mismatched replies, %lu reply overruns, %lu slots not released, %ld withdrawn notifications processed\n",
+                modeNames[Mode], mismatched, overruns, leaked, Shared->WithdrawnProcessed);
+        fprintf(stderr, "FAILED: %s: %lu target handles leaked, %ld closed twice, %ld used after being closed\n",
+                modeNames[Mode], openHandles, Shared->DoubleClosedHandles, Shared->ClosedHandlesUsed);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------
+
+int
+main(
+    int   argc,
+    char* argv[]
+    )
+{
+    int    senders  = argc > 1 ? atoi(argv[1]) : 8;
+    double seconds  = argc > 2 ? atof(argv[2]) : 2.0;
+    int    failures = 0;
+
+    Legacy = argc > 3 && strcmp(argv[3], "legacy") == 0;
+
+    if (senders <= 0 || senders > MAX_SENDERS || seconds <= 0)
+    {
+        fprintf(stderr, "Usage: %s [senders] [seconds] [legacy]\n", argv[0]);
+        return 2;
+    }
+
+    Shared  = mmap(NULL, sizeof(SHARED_STATE), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    Senders = calloc(MAX_SENDERS, sizeof(THREAD_STATE));
+    if (Shared == MAP_FAILED || Senders == NULL)
+    {
+        return 2;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    failures += LcRun(ModePort,   senders, seconds);
+    failures += LcRun(ModeRing,   senders, seconds);
+    failures += LcRun(ModeStress, senders, seconds);
+
+    printf("%d failure(s)\n", failures);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,903 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    PathTrieBench.c
+
+Abstract:
+
+    Microbenchmark for the compiled prefix trie implemented by the 'LcCreatePathTrie' and
+    'LcMatchPathTrie' in the 'LazyCopyDriver\PathTrie.c'.
+
+    The trie compilation and matching are reproduced with the kernel helpers replaced by
+    the C runtime ones. The trie is compared with the linear 'RtlPrefixUnicodeString' scan
+    the 'LcIsPathWatched' used before, for 10, 1,000 and 100,000 watch roots.
+
+    Query paths are first matched by both implementations, and the paths reported by the
+    trie callback are checked against the ones found by the scan, so a mismatch fails the run.
+    For the large root counts only the first queries are checked, because the scan is slow.
+    Half of the queries are below one of the roots, and use a different character case.
+
+    Build and run:
+
+        gcc -O2 -o PathTrieBench PathTrieBench.c
+        ./PathTrieBench [seconds]
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//------------------------------------------------------------------------
+//  Definitions.
+//------------------------------------------------------------------------
+
+#define QUERY_COUNT      4096
+#define MAX_PATH_LENGTH  128
+#define MAX_MATCHES      16
+
+// The scan is slow for the large root counts, so only some of the queries are verified.
+#define VERIFY_WORK      (1 << 24)
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+typedef uint16_t WCHAR;
+
+typedef struct _UNICODE_STRING
+{
+    uint16_t Length;
+    uint16_t MaximumLength;
+    WCHAR*   Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+typedef const UNICODE_STRING* PCUNICODE_STRING;
+
+// Should match the 'PATH_TRIE_NODE' in the 'PathTrie.c'.
+typedef struct _PATH_TRIE_NODE
+{
+    uint32_t LabelOffset;
+    uint16_t LabelLength;
+    uint8_t  Terminal;
+    uint32_t FirstChild;
+    uint32_t ChildCount;
+    uint32_t FirstValue;
+    uint32_t ValueCount;
+    uint32_t TerminalParent;
+} PATH_TRIE_NODE, *PPATH_TRIE_NODE;
+
+// Should match the 'PATH_TRIE' in the 'PathTrie.c'.
+typedef struct _PATH_TRIE
+{
+    long            ReferenceCount;
+    uint32_t        NodeCount;
+    PPATH_TRIE_NODE Nodes;
+    uint32_t*       Values;
+    WCHAR*          Labels;
+} PATH_TRIE, *PPATH_TRIE;
+
+typedef struct _PATH_TRIE_KEY
+{
+    WCHAR*   Buffer;
+    uint32_t Length;
+    uint32_t Index;
+} PATH_TRIE_KEY, *PPATH_TRIE_KEY;
+
+typedef struct _PATH_TRIE_RANGE
+{
+    uint32_t First;
+    uint32_t Last;
+    uint32_t Depth;
+} PATH_TRIE_RANGE, *PPATH_TRIE_RANGE;
+
+typedef int (*PPATH_TRIE_MATCH_CALLBACK)(uint32_t PathIndex, void* Context);
+
+// Paths matched, collected by the 'LcCollectMatch'.
+typedef struct _MATCH_LIST
+{
+    uint32_t Count;
+    uint32_t Indices[MAX_MATCHES];
+} MATCH_LIST, *PMATCH_LIST;
+
+//------------------------------------------------------------------------
+//  Global variables.
+//------------------------------------------------------------------------
+
+static int Failures = 0;
+
+//------------------------------------------------------------------------
+//  Helper functions.
+//------------------------------------------------------------------------
+
+static
+WCHAR
+RtlUpcaseUnicodeChar(
+    WCHAR Character
+    )
+{
+    return Character >= 'a' && Character <= 'z' ? (WCHAR)(Character - ('a' - 'A')) : Character;
+}
+
+//------------------------------------------------------------------------
+
+static
+int
+RtlPrefixUnicodeString(
+    PCUNICODE_STRING String1,
+    PCUNICODE_STRING String2
+    )
+/*++
+
+Summary:
+
+    This function is the case-insensitive 'RtlPrefixUnicodeString'.
+
+--*/
+{
+    uint32_t idx = 0;
+
+    if (String1->Length > String2->Length)
+    {
+        return 0;
+    }
+
+    for (idx = 0; idx < String1->Length / sizeof(WCHAR); idx++)
+    {
+        if (RtlUpcaseUnicodeChar(String1->Buffer[idx]) != RtlUpcaseUnicodeChar(String2->Buffer[idx]))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcInitString(
+    PUNICODE_STRING String,
+    const char*     Source
+    )
+{
+    size_t length = strlen(Source);
+    size_t idx    = 0;
+
+    String->Buffer        = malloc((length + 1) * sizeof(WCHAR));
+    String->Length        = (uint16_t)(length * sizeof(WCHAR));
+    String->MaximumLength = (uint16_t)((length + 1) * sizeof(WCHAR));
+
+    for (idx = 0; idx <= length; idx++)
+    {
+        String->Buffer[idx] = (WCHAR)Source[idx];
+    }
+}
+
+//------------------------------------------------------------------------
+
+static
+double
+LcNow(
+    void
+    )
+{
+    struct timespec now = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + now.tv_nsec / 1e9;
+}
+
+//------------------------------------------------------------------------
+//  Path trie functions.
+//------------------------------------------------------------------------
+
+static
+int
+LcComparePathTrieKeys(
+    const PATH_TRIE_KEY* First,
+    const PATH_TRIE_KEY* Second
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcComparePathTrieKeys'.
+
+--*/
+{
+    uint32_t length = First->Length < Second->Length ? First->Length : Second->Length;
+    uint32_t idx    = 0;
+
+    for (idx = 0; idx < length; idx++)
+    {
+        if (First->Buffer[idx] != Second->Buffer[idx])
+        {
+            return First->Buffer[idx] < Second->Buffer[idx] ? -1 : 1;
+        }
+    }
+
+    if (First->Length != Second->Length)
+    {
+        return First->Length < Second->Length ? -1 : 1;
+    }
+
+    if (First->Index != Second->Index)
+    {
+        return First->Index < Second->Index ? -1 : 1;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcSortPathTrieKeys(
+    PPATH_TRIE_KEY Keys,
+    uint32_t       Count
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcSortPathTrieKeys'.
+
+--*/
+{
+    PATH_TRIE_KEY temp  = { 0 };
+    uint32_t      start = 0;
+    uint32_t      end   = 0;
+    uint32_t      root  = 0;
+    uint32_t      child = 0;
+
+    for (start = Count / 2, end = Count; ; )
+    {
+        if (start > 0)
+        {
+            start--;
+        }
+        else
+        {
+            if (--end == 0)
+            {
+                break;
+            }
+
+            temp      = Keys[end];
+            Keys[end] = Keys[0];
+            Keys[0]   = temp;
+        }
+
+        for (root = start; (child = root * 2 + 1) < end; root = child)
+        {
+            if (child + 1 < end && LcComparePathTrieKeys(&Keys[child], &Keys[child + 1]) < 0)
+            {
+                child++;
+            }
+
+            if (LcComparePathTrieKeys(&Keys[root], &Keys[child]) >= 0)
+            {
+                break;
+            }
+
+            temp        = Keys[root];
+            Keys[root]  = Keys[child];
+            Keys[child] = temp;
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+
+static
+PPATH_TRIE
+LcCreatePathTrie(
+    PCUNICODE_STRING* Paths,
+    uint32_t          PathCount
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcCreatePathTrie'.
+
+--*/
+{
+    size_t           totalLength  = 0;
+    WCHAR*           characters   = NULL;
+    PPATH_TRIE_KEY   keys         = NULL;
+    PPATH_TRIE_NODE  nodes        = NULL;
+    PPATH_TRIE_RANGE ranges       = NULL;
+    uint32_t*        values       = NULL;
+    PPATH_TRIE       trie         = NULL;
+    uint32_t         maxNodeCount = PathCount * 2 + 1;
+    uint32_t         nodeCount    = 1;
+    uint32_t         valueCount   = 0;
+    uint32_t         labelLength  = 0;
+    uint32_t         position     = 0;
+    uint32_t         idx          = 0;
+    uint32_t         charIdx      = 0;
+
+    for (idx = 0; idx < PathCount; idx++)
+    {
+        totalLength += Paths[idx]->Length / sizeof(WCHAR);
+    }
+
+    characters = malloc(totalLength * sizeof(WCHAR));
+    keys       = malloc(PathCount * sizeof(PATH_TRIE_KEY));
+    nodes      = calloc(maxNodeCount, sizeof(PATH_TRIE_NODE));
+    ranges     = calloc(maxNodeCount, sizeof(PATH_TRIE_RANGE));
+    values     = malloc(PathCount * sizeof(uint32_t));
+
+    for (idx = 0; idx < PathCount; idx++)
+    {
+        keys[idx].Buffer = characters + position;
+        keys[idx].Length = Paths[idx]->Length / sizeof(WCHAR);
+        keys[idx].Index  = idx;
+
+        for (charIdx = 0; charIdx < keys[idx].Length; charIdx++)
+        {
+            keys[idx].Buffer[charIdx] = RtlUpcaseUnicodeChar(Paths[idx]->Buffer[charIdx]);
+        }
+
+        position += keys[idx].Length;
+    }
+
+    LcSortPathTrieKeys(keys, PathCount);
+
+    ranges[0].First = 0;
+    ranges[0].Last  = PathCount;
+    ranges[0].Depth = 0;
+
+    for (idx = 0; idx < nodeCount; idx++)
+    {
+        PPATH_TRIE_NODE node  = &nodes[idx];
+        uint32_t        first = ranges[idx].First;
+        uint32_t        last  = ranges[idx].Last;
+        uint32_t        depth = ranges[idx].Depth;
+
+        node->FirstValue = valueCount;
+        while (first < last && keys[first].Length == depth)
+        {
+            node->Terminal       = 1;
+            values[valueCount++] = keys[first].Index;
+            first++;
+        }
+
+        node->ValueCount = valueCount - node->FirstValue;
+        node->FirstChild = nodeCount;
+        node->ChildCount = 0;
+
+        while (first < last)
+        {
+            uint32_t groupLast = first + 1;
+            uint32_t prefix    = depth + 1;
+            WCHAR    character = keys[first].Buffer[depth];
+
+            while (groupLast < last && keys[groupLast].Buffer[depth] == character)
+            {
+                groupLast++;
+            }
+
+            while (prefix < keys[first].Length
+                   && prefix < keys[groupLast - 1].Length
+                   && keys[first].Buffer[prefix] == keys[groupLast - 1].Buffer[prefix])
+            {
+                prefix++;
+            }
+
+            if (nodeCount >= maxNodeCount)
+            {
+                fprintf(stderr, "FAILED: node limit exceeded\n");
+                exit(1);
+            }
+
+            nodes[nodeCount].LabelOffset    = (uint32_t)(keys[first].Buffer - characters) + depth;
+            nodes[nodeCount].LabelLength    = (uint16_t)(prefix - depth);
+            nodes[nodeCount].TerminalParent = node->Terminal ? idx : node->TerminalParent;
+            ranges[nodeCount].First         = first;
+            ranges[nodeCount].Last          = groupLast;
+            ranges[nodeCount].Depth         = prefix;
+
+            labelLength += prefix - depth;
+            nodeCount++;
+            node->ChildCount++;
+
+            first = groupLast;
+        }
+    }
+
+    trie = malloc(sizeof(PATH_TRIE) + (size_t)nodeCount * sizeof(PATH_TRIE_NODE) + (size_t)valueCount * sizeof(uint32_t) + (size_t)labelLength * sizeof(WCHAR));
+
+    trie->ReferenceCount = 1;
+    trie->NodeCount      = nodeCount;
+    trie->Nodes          = (PPATH_TRIE_NODE)(trie + 1);
+    trie->Values         = (uint32_t*)(trie->Nodes + nodeCount);
+    trie->Labels         = (WCHAR*)(trie->Values + valueCount);
+
+    memcpy(trie->Values, values, valueCount * sizeof(uint32_t));
+
+    position = 0;
+    for (idx = 0; idx < nodeCount; idx++)
+    {
+        trie->Nodes[idx] = nodes[idx];
+        trie->Nodes[idx].LabelOffset = position;
+
+        memcpy(trie->Labels + position, characters + nodes[idx].LabelOffset, nodes[idx].LabelLength * sizeof(WCHAR));
+        position += nodes[idx].LabelLength;
+    }
+
+    free(values);
+    free(ranges);
+    free(nodes);
+    free(keys);
+    free(characters);
+
+    return trie;
+}
+
+//------------------------------------------------------------------------
+
+static
+int
+LcMatchPathTrie(
+    PPATH_TRIE                Trie,
+    PCUNICODE_STRING          Path,
+    PPATH_TRIE_MATCH_CALLBACK Callback,
+    void*                     Context
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcMatchPathTrie'.
+
+--*/
+{
+    PPATH_TRIE_NODE node     = NULL;
+    PPATH_TRIE_NODE child    = NULL;
+    PPATH_TRIE_NODE terminal = NULL;
+    uint32_t        length   = Path->Length / sizeof(WCHAR);
+    uint32_t        position = 0;
+    uint32_t        low      = 0;
+    uint32_t        high     = 0;
+    uint32_t        middle   = 0;
+    uint32_t        idx      = 0;
+    WCHAR           character;
+    WCHAR           labelCharacter;
+
+    node = &Trie->Nodes[0];
+
+    for (;;)
+    {
+        if (node->Terminal)
+        {
+            terminal = node;
+
+            if (Callback == NULL)
+            {
+                return 1;
+            }
+        }
+
+        if (position >= length || node->ChildCount == 0)
+        {
+            break;
+        }
+
+        character = RtlUpcaseUnicodeChar(Path->Buffer[position]);
+        child     = NULL;
+        low       = node->FirstChild;
+        high      = node->FirstChild + node->ChildCount;
+
+        while (low < high)
+        {
+            middle         = low + (high - low) / 2;
+            labelCharacter = Trie->Labels[Trie->Nodes[middle].LabelOffset];
+
+            if (labelCharacter < character)
+            {
+                low = middle + 1;
+            }
+            else if (labelCharacter > character)
+            {
+                high = middle;
+            }
+            else
+            {
+                child = &Trie->Nodes[middle];
+                break;
+            }
+        }
+
+        if (child == NULL || child->LabelLength > length - position)
+        {
+            break;
+        }
+
+        for (idx = 1; idx < child->LabelLength; idx++)
+        {
+            if (RtlUpcaseUnicodeChar(Path->Buffer[position + idx]) != Trie->Labels[child->LabelOffset + idx])
+            {
+                break;
+            }
+        }
+
+        if (idx < child->LabelLength)
+        {
+            break;
+        }
+
+        position += child->LabelLength;
+        node      = child;
+    }
+
+    while (terminal != NULL && Callback != NULL)
+    {
+        for (idx = 0; idx < terminal->ValueCount; idx++)
+        {
+            if (Callback(Trie->Values[terminal->FirstValue + idx], Context))
+            {
+                return 1;
+            }
+        }
+
+        terminal = terminal->TerminalParent != 0 ? &Trie->Nodes[terminal->TerminalParent] : NULL;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------
+//  Linear scan.
+//------------------------------------------------------------------------
+
+static
+int
+LcMatchLinear(
+    PCUNICODE_STRING* Paths,
+    uint32_t          PathCount,
+    PCUNICODE_STRING  Path,
+    PMATCH_LIST       Matches
+    )
+/*++
+
+Summary:
+
+    This function scans the 'Paths' the way the 'LcIsPathWatched' did before the trie was added.
+    If the 'Matches' is not NULL, all paths matched are collected.
+
+--*/
+{
+    uint32_t idx = 0;
+
+    for (idx = 0; idx < PathCount; idx++)
+    {
+        if (RtlPrefixUnicodeString(Paths[idx], Path))
+        {
+            if (Matches == NULL)
+            {
+                return 1;
+            }
+
+            if (Matches->Count < MAX_MATCHES)
+            {
+                Matches->Indices[Matches->Count] = idx;
+            }
+
+            Matches->Count++;
+        }
+    }
+
+    return Matches != NULL && Matches->Count > 0;
+}
+
+//------------------------------------------------------------------------
+
+static
+int
+LcCollectMatch(
+    uint32_t PathIndex,
+    void*    Context
+    )
+{
+    PMATCH_LIST matches = (PMATCH_LIST)Context;
+
+    if (matches->Count < MAX_MATCHES)
+    {
+        matches->Indices[matches->Count] = PathIndex;
+    }
+
+    matches->Count++;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------
+
+static
+int
+LcCompareIndices(
+    const void* First,
+    const void* Second
+    )
+{
+    uint32_t first  = *(const uint32_t*)First;
+    uint32_t second = *(const uint32_t*)Second;
+
+    return first < second ? -1 : first > second;
+}
+
+//------------------------------------------------------------------------
+//  Benchmark.
+//------------------------------------------------------------------------
+
+static
+void
+LcBuildPaths(
+    uint32_t          RootCount,
+    PCUNICODE_STRING* Roots,
+    PUNICODE_STRING   Queries,
+    unsigned int*     Seed
+    )
+/*++
+
+Summary:
+
+    This function generates the watch roots and the query paths.
+
+    Roots look like '\Device\HarddiskVolume2\Shares\TeamNNN\ProjectNNNNN\', and some of them
+    are nested into the other ones. Half of the queries are below one of the roots, with the
+    character case changed, and the rest share the volume prefix, but are not watched.
+
+--*/
+{
+    char     path[MAX_PATH_LENGTH] = { 0 };
+    uint32_t idx                   = 0;
+    uint32_t root                  = 0;
+    size_t   charIdx               = 0;
+
+    for (idx = 0; idx < RootCount; idx++)
+    {
+        PUNICODE_STRING string = malloc(sizeof(UNICODE_STRING));
+
+        if (idx > 0 && idx % 16 == 0)
+        {
+            // Nested root.
+            snprintf(path, sizeof(path), "\\Device\\HarddiskVolume2\\Shares\\Team%03u\\Project%05u\\Nested\\", (idx - 1) % 997, idx - 1);
+        }
+        else
+        {
+            snprintf(path, sizeof(path), "\\Device\\HarddiskVolume2\\Shares\\Team%03u\\Project%05u\\", idx % 997, idx);
+        }
+
+        LcInitString(string, path);
+        Roots[idx] = string;
+    }
+
+    for (idx = 0; idx < QUERY_COUNT; idx++)
+    {
+        root = (uint32_t)rand_r(Seed) % RootCount;
+
+        if (idx % 2 == 0)
+        {
+            snprintf(path, sizeof(path), "\\Device\\HarddiskVolume2\\Shares\\Team%03u\\Project%05u\\Nested\\Source\\File%04d.cs", root % 997, root, rand_r(Seed) % 10000);
+
+            for (charIdx = 0; path[charIdx] != '\0'; charIdx++)
+            {
+                if (rand_r(Seed) % 2 == 0)
+                {
+                    path[charIdx] = (char)(path[charIdx] >= 'A' && path[charIdx] <= 'Z' ? path[charIdx] + ('a' - 'A') : path[charIdx]);
+                }
+            }
+        }
+        else
+        {
+            snprintf(path, sizeof(path), "\\Device\\HarddiskVolume2\\Shares\\Team%03u\\Archive%05u\\File%04d.cs", root % 997, root, rand_r(Seed) % 10000);
+        }
+
+        LcInitString(&Queries[idx], path);
+    }
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcVerify(
+    PPATH_TRIE        Trie,
+    PCUNICODE_STRING* Roots,
+    uint32_t          RootCount,
+    PUNICODE_STRING   Queries
+    )
+/*++
+
+Summary:
+
+    This function checks that the trie reports the same paths as the linear scan.
+
+--*/
+{
+    MATCH_LIST expected = { 0 };
+    MATCH_LIST actual   = { 0 };
+    uint32_t   count    = VERIFY_WORK / RootCount;
+    uint32_t   idx      = 0;
+
+    for (idx = 0; idx < QUERY_COUNT && idx < count; idx++)
+    {
+        memset(&expected, 0, sizeof(expected));
+        memset(&actual,   0, sizeof(actual));
+
+        LcMatchLinear(Roots, RootCount, &Queries[idx], &expected);
+        LcMatchPathTrie(Trie, &Queries[idx], LcCollectMatch, &actual);
+
+        if (LcMatchPathTrie(Trie, &Queries[idx], NULL, NULL) != (expected.Count > 0))
+        {
+            fprintf(stderr, "FAILED: %u roots, query %u: trie and scan disagree\n", RootCount, idx);
+            Failures++;
+            continue;
+        }
+
+        qsort(actual.Indices, actual.Count < MAX_MATCHES ? actual.Count : MAX_MATCHES, sizeof(uint32_t), LcCompareIndices);
+
+        if (expected.Count != actual.Count || memcmp(expected.Indices, actual.Indices, sizeof(expected.Indices)) != 0)
+        {
+            fprintf(stderr, "FAILED: %u roots, query %u: %u paths matched instead of %u\n", RootCount, idx, actual.Count, expected.Count);
+            Failures++;
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcBenchmark(
+    uint32_t RootCount,
+    double   Seconds
+    )
+/*++
+
+Summary:
+
+    This function compiles a trie from the 'RootCount' roots, checks it and reports the time
+    per match for the trie and the linear scan.
+
+--*/
+{
+    PCUNICODE_STRING* roots        = malloc(RootCount * sizeof(PCUNICODE_STRING));
+    PUNICODE_STRING   queries      = malloc(QUERY_COUNT * sizeof(UNICODE_STRING));
+    PPATH_TRIE        trie         = NULL;
+    unsigned int      seed         = RootCount;
+    unsigned long     trieMatches  = 0;
+    unsigned long     scanMatches  = 0;
+    unsigned long     hits         = 0;
+    double            start        = 0;
+    double            compileTime  = 0;
+    double            trieTime     = 0;
+    double            scanTime     = 0;
+    uint32_t          idx          = 0;
+
+    LcBuildPaths(RootCount, roots, queries, &seed);
+
+    start       = LcNow();
+    trie        = LcCreatePathTrie(roots, RootCount);
+    compileTime = LcNow() - start;
+
+    LcVerify(trie, roots, RootCount, queries);
+
+    start = LcNow();
+    do
+    {
+        for (idx = 0; idx < QUERY_COUNT; idx++)
+        {
+            hits += (unsigned long)LcMatchPathTrie(trie, &queries[idx], NULL, NULL);
+        }
+
+        trieMatches += QUERY_COUNT;
+        trieTime     = LcNow() - start;
+    } while (trieTime < Seconds);
+
+    start = LcNow();
+    do
+    {
+        for (idx = 0; idx < QUERY_COUNT && (scanTime = LcNow() - start) < Seconds; idx++)
+        {
+            hits += (unsigned long)LcMatchLinear(roots, RootCount, &queries[idx], NULL);
+            scanMatches++;
+        }
+    } while (scanTime < Seconds);
+
+    printf("%6u roots: %6u nodes, compiled in %8.3f ms; trie %8.1f ns per match; scan %10.1f ns per match (%.0fx)%s\n",
+           RootCount,
+           trie->NodeCount,
+           compileTime * 1e3,
+           trieTime * 1e9 / trieMatches,
+           scanTime * 1e9 / scanMatches,
+           (scanTime / scanMatches) / (trieTime / trieMatches),
+           hits == 0 ? " (no hits)" : "");
+
+    free(trie);
+
+    for (idx = 0; idx < RootCount; idx++)
+    {
+        free(roots[idx]->Buffer);
+        free((void*)roots[idx]);
+    }
+
+    for (idx = 0; idx < QUERY_COUNT; idx++)
+    {
+        free(queries[idx].Buffer);
+    }
+
+    free(queries);
+    free(roots);
+}
+
+//------------------------------------------------------------------------
+
+int
+main(
+    int   argc,
+    char* argv[]
+    )
+{
+    static const uint32_t rootCounts[] = { 10, 1000, 100000 };
+
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    size_t idx     = 0;
+
+    if (seconds <= 0)
+    {
+        fprintf(stderr, "Usage: %s [seconds]\n", argv[0]);
+        return 2;
+    }
+
+    for (idx = 0; idx < sizeof(rootCounts) / sizeof(rootCounts[0]); idx++)
+    {
+        LcBenchmark(rootCounts[idx], seconds);
+    }
+
+    printf("%d failure(s)\n", Failures);
+
+    return Failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,563 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    SamplerBench.c
+
+Abstract:
+
+    Distribution test and benchmark for the file access sampler implemented by the
+    'LcReportFileAccess', 'LcGetNextSamplerValue', 'LcHashSamplerPath' and 'LcMixSamplerValue'
+    in the 'LazyCopyDriver\Operations.c'.
+
+    The distribution test checks, for several report rates, that:
+    - The fraction of the accesses reported by the per-processor generators is within
+      five standard deviations of the report rate;
+    - The generator values are uniform: the chi-square statistic over 100 buckets of
+      the 'value % MAX_REPORT_RATE' stays below the 0.001 critical value;
+    - In the 'SampleByPath' mode, the decision is the same for the same path in any
+      character case, and the fraction of distinct, similar paths reported matches the rate.
+
+    The benchmark runs the sampling decision on several threads at once, comparing the
+    per-processor generators and the path hash with the single shared seed the driver
+    used before. 'RtlRandomEx' is approximated by the 'RtlUniform' recurrence on a shared
+    variable, which has the same cache line traffic.
+
+    Build and run:
+
+        gcc -O2 -pthread -o SamplerBench SamplerBench.c
+        ./SamplerBench [threads] [seconds]
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//------------------------------------------------------------------------
+//  Definitions.
+//------------------------------------------------------------------------
+
+// Should match the ones in the 'Operations.c' and 'Configuration.h'.
+#define SAMPLER_SLOTS    64
+#define MAX_REPORT_RATE  10000
+
+#define DISTRIBUTION_SAMPLES  2000000
+#define DISTRIBUTION_PATHS    200000
+#define CHI_SQUARE_BUCKETS    100
+
+// Chi-square critical value for 99 degrees of freedom at the 0.001 significance level.
+#define CHI_SQUARE_LIMIT      148.23
+
+#define PATH_LENGTH           96
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+typedef uint16_t WCHAR;
+
+typedef struct _SAMPLER_STATE
+{
+    uint64_t State;
+} __attribute__((aligned(64))) SAMPLER_STATE, *PSAMPLER_STATE;
+
+typedef enum _SAMPLER_MODE
+{
+    SamplerPerProcessor,
+    SamplerByPath,
+    SamplerSharedSeed,
+    SamplerModeCount
+} SAMPLER_MODE;
+
+typedef struct _THREAD_STATE
+{
+    pthread_t     Thread;
+    SAMPLER_MODE  Mode;
+    unsigned int  Seed;
+    unsigned long Operations;
+    unsigned long Reported;
+} THREAD_STATE, *PTHREAD_STATE;
+
+//------------------------------------------------------------------------
+//  Global variables.
+//------------------------------------------------------------------------
+
+static const char*   ModeNames[SamplerModeCount] = { "per-processor", "path hash", "shared seed" };
+
+static SAMPLER_STATE SamplerStates[SAMPLER_SLOTS];
+static uint32_t      LC_RANDOM_SEED              = 0x53656544;
+
+static WCHAR         Paths[1024][PATH_LENGTH];
+static uint16_t      PathLengths[1024];
+
+static volatile int  StopRequested               = 0;
+static int           Failures                    = 0;
+
+//------------------------------------------------------------------------
+//  Sampler functions.
+//------------------------------------------------------------------------
+
+static
+uint64_t
+LcMixSamplerValue(
+    uint64_t Value
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcMixSamplerValue'.
+
+--*/
+{
+    Value = (Value ^ (Value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    Value = (Value ^ (Value >> 27)) * 0x94D049BB133111EBULL;
+
+    return Value ^ (Value >> 31);
+}
+
+//------------------------------------------------------------------------
+
+static
+uint64_t
+LcGetNextSamplerValue(
+    void
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcGetNextSamplerValue'.
+    The state is accessed with relaxed atomics, so the unsynchronized update is well defined.
+
+--*/
+{
+    PSAMPLER_STATE  sampler = &SamplerStates[(unsigned int)sched_getcpu() % SAMPLER_SLOTS];
+    uint64_t        value   = __atomic_load_n(&sampler->State, __ATOMIC_RELAXED);
+    struct timespec now     = { 0 };
+
+    if (value == 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        value = ((uint64_t)LC_RANDOM_SEED << 32) ^ (uint64_t)now.tv_nsec ^ (uint64_t)(uintptr_t)sampler;
+    }
+
+    value += 0x9E3779B97F4A7C15ULL;
+    __atomic_store_n(&sampler->State, value, __ATOMIC_RELAXED);
+
+    return LcMixSamplerValue(value);
+}
+
+//------------------------------------------------------------------------
+
+static
+uint64_t
+LcHashSamplerPath(
+    const WCHAR* Path,
+    uint16_t     Length
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcHashSamplerPath'. 'Length' is in characters.
+
+--*/
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    uint16_t idx  = 0;
+
+    for (idx = 0; idx < Length; idx++)
+    {
+        WCHAR character = Path[idx];
+
+        hash ^= character >= 'a' && character <= 'z' ? character - ('a' - 'A') : character;
+        hash *= 0x100000001B3ULL;
+    }
+
+    return LcMixSamplerValue(hash);
+}
+
+//------------------------------------------------------------------------
+
+static
+uint64_t
+LcGetSharedSeedValue(
+    void
+    )
+/*++
+
+Summary:
+
+    This function approximates the 'RtlRandomEx(&LC_RANDOM_SEED)' call the driver used before.
+
+--*/
+{
+    uint32_t seed = __atomic_load_n(&LC_RANDOM_SEED, __ATOMIC_RELAXED);
+
+    seed = (uint32_t)(((uint64_t)seed * 0x7FFFFFED + 0x7FFFFFC3) % 0x7FFFFFFF);
+    __atomic_store_n(&LC_RANDOM_SEED, seed, __ATOMIC_RELAXED);
+
+    return seed;
+}
+
+//------------------------------------------------------------------------
+
+static
+int
+LcShouldReport(
+    uint64_t Value,
+    uint32_t ReportRate
+    )
+/*++
+
+Summary:
+
+    This function mirrors the decision made by the 'LcReportFileAccess'.
+
+--*/
+{
+    return ReportRate != 0 && (ReportRate >= MAX_REPORT_RATE || Value % MAX_REPORT_RATE < ReportRate);
+}
+
+//------------------------------------------------------------------------
+//  Helper functions.
+//------------------------------------------------------------------------
+
+static
+uint16_t
+LcFormatPath(
+    WCHAR*       Buffer,
+    unsigned int Index,
+    int          Lowercase
+    )
+/*++
+
+Summary:
+
+    This function formats a path that differs from its neighbours in one or two characters.
+
+--*/
+{
+    char     path[PATH_LENGTH] = { 0 };
+    int      length            = snprintf(path, sizeof(path), "\\Device\\HarddiskVolume2\\Src\\Module%03u\\File%04u.cs", Index / 1000, Index % 1000);
+    int      idx               = 0;
+
+    for (idx = 0; idx < length; idx++)
+    {
+        char character = path[idx];
+
+        Buffer[idx] = (WCHAR)(Lowercase && character >= 'A' && character <= 'Z' ? character + ('a' - 'A') : character);
+    }
+
+    return (uint16_t)length;
+}
+
+//------------------------------------------------------------------------
+
+static
+double
+LcNow(
+    void
+    )
+{
+    struct timespec now = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + now.tv_nsec / 1e9;
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcCheckFraction(
+    const char*   Name,
+    unsigned long Reported,
+    unsigned long Total,
+    uint32_t      ReportRate
+    )
+/*++
+
+Summary:
+
+    This function checks that the fraction reported is within five standard deviations of the rate.
+
+--*/
+{
+    double expected = (double)ReportRate / MAX_REPORT_RATE;
+    double actual   = (double)Reported / Total;
+    double sigma    = sqrt(expected * (1 - expected) / Total);
+
+    printf("  %-13s rate %5u: reported %.5f, expected %.5f\n", Name, ReportRate, actual, expected);
+
+    if (fabs(actual - expected) > 5 * sigma + 1e-12)
+    {
+        fprintf(stderr, "FAILED: %s, rate %u: reported %.5f instead of %.5f\n", Name, ReportRate, actual, expected);
+        Failures++;
+    }
+}
+
+//------------------------------------------------------------------------
+//  Tests.
+//------------------------------------------------------------------------
+
+static
+void
+LcTestDistribution(
+    void
+    )
+/*++
+
+Summary:
+
+    This function checks the sampling distribution of both modes.
+
+--*/
+{
+    static const uint32_t rates[] = { 0, 1, 100, 2500, 5000, 9999, MAX_REPORT_RATE };
+
+    static unsigned long buckets[CHI_SQUARE_BUCKETS];
+    static WCHAR         upper[PATH_LENGTH];
+    static WCHAR         lower[PATH_LENGTH];
+
+    unsigned long reported   = 0;
+    unsigned long idx        = 0;
+    double        chiSquare  = 0;
+    double        expected   = (double)DISTRIBUTION_SAMPLES / CHI_SQUARE_BUCKETS;
+    uint16_t      length     = 0;
+    uint64_t      value      = 0;
+    size_t        rateIdx    = 0;
+
+    printf("Distribution:\n");
+
+    for (rateIdx = 0; rateIdx < sizeof(rates) / sizeof(rates[0]); rateIdx++)
+    {
+        memset(buckets, 0, sizeof(buckets));
+        reported = 0;
+
+        for (idx = 0; idx < DISTRIBUTION_SAMPLES; idx++)
+        {
+            value     = LcGetNextSamplerValue();
+            reported += (unsigned long)LcShouldReport(value, rates[rateIdx]);
+
+            buckets[value % MAX_REPORT_RATE * CHI_SQUARE_BUCKETS / MAX_REPORT_RATE]++;
+        }
+
+        LcCheckFraction(ModeNames[SamplerPerProcessor], reported, DISTRIBUTION_SAMPLES, rates[rateIdx]);
+
+        chiSquare = 0;
+        for (idx = 0; idx < CHI_SQUARE_BUCKETS; idx++)
+        {
+            chiSquare += (buckets[idx] - expected) * (buckets[idx] - expected) / expected;
+        }
+
+        if (chiSquare > CHI_SQUARE_LIMIT)
+        {
+            fprintf(stderr, "FAILED: per-processor values are not uniform, chi-square %.1f\n", chiSquare);
+            Failures++;
+        }
+    }
+
+    for (rateIdx = 0; rateIdx < sizeof(rates) / sizeof(rates[0]); rateIdx++)
+    {
+        reported = 0;
+
+        for (idx = 0; idx < DISTRIBUTION_PATHS; idx++)
+        {
+            int decision = 0;
+
+            length   = LcFormatPath(upper, (unsigned int)idx, 0);
+            decision = LcShouldReport(LcHashSamplerPath(upper, length), rates[rateIdx]);
+
+            LcFormatPath(lower, (unsigned int)idx, 1);
+            if (decision != LcShouldReport(LcHashSamplerPath(lower, length), rates[rateIdx])
+                || decision != LcShouldReport(LcHashSamplerPath(upper, length), rates[rateIdx]))
+            {
+                fprintf(stderr, "FAILED: path %lu is sampled inconsistently\n", idx);
+                Failures++;
+            }
+
+            reported += (unsigned long)decision;
+        }
+
+        LcCheckFraction(ModeNames[SamplerByPath], reported, DISTRIBUTION_PATHS, rates[rateIdx]);
+    }
+}
+
+//------------------------------------------------------------------------
+//  Benchmark.
+//------------------------------------------------------------------------
+
+static
+void*
+LcSamplerThread(
+    void* Context
+    )
+{
+    PTHREAD_STATE state      = (PTHREAD_STATE)Context;
+    uint64_t      value      = 0;
+    unsigned int  pathIdx    = 0;
+    unsigned long operations = 0;
+    unsigned long reported   = 0;
+
+    while (!__atomic_load_n(&StopRequested, __ATOMIC_RELAXED))
+    {
+        switch (state->Mode)
+        {
+            case SamplerPerProcessor:
+                value = LcGetNextSamplerValue();
+                break;
+
+            case SamplerByPath:
+                pathIdx = (unsigned int)rand_r(&state->Seed) % 1024;
+                value   = LcHashSamplerPath(Paths[pathIdx], PathLengths[pathIdx]);
+                break;
+
+            default:
+                value = LcGetSharedSeedValue();
+                break;
+        }
+
+        reported += (unsigned long)LcShouldReport(value, 100);
+        operations++;
+    }
+
+    state->Operations = operations;
+    state->Reported   = reported;
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcBenchmark(
+    int    ThreadCount,
+    double Seconds
+    )
+/*++
+
+Summary:
+
+    This function reports the sampling decisions per second for every mode.
+
+--*/
+{
+    PTHREAD_STATE   threads    = calloc((size_t)ThreadCount, sizeof(THREAD_STATE));
+    unsigned long   operations = 0;
+    unsigned long   reported   = 0;
+    struct timespec delay      = { (time_t)Seconds, (long)((Seconds - (time_t)Seconds) * 1e9) };
+    double          start      = 0;
+    double          elapsed    = 0;
+    int             mode       = 0;
+    int             idx        = 0;
+
+    for (idx = 0; idx < 1024; idx++)
+    {
+        PathLengths[idx] = LcFormatPath(Paths[idx], (unsigned int)idx * 7, idx % 2);
+    }
+
+    printf("Throughput, %d threads:\n", ThreadCount);
+
+    for (mode = 0; mode < SamplerModeCount; mode++)
+    {
+        StopRequested = 0;
+        start         = LcNow();
+
+        for (idx = 0; idx < ThreadCount; idx++)
+        {
+            threads[idx].Mode = (SAMPLER_MODE)mode;
+            threads[idx].Seed = (unsigned int)idx + 1;
+            pthread_create(&threads[idx].Thread, NULL, LcSamplerThread, &threads[idx]);
+        }
+
+        nanosleep(&delay, NULL);
+        __atomic_store_n(&StopRequested, 1, __ATOMIC_RELAXED);
+
+        operations = 0;
+        reported   = 0;
+
+        for (idx = 0; idx < ThreadCount; idx++)
+        {
+            pthread_join(threads[idx].Thread, NULL);
+            operations += threads[idx].Operations;
+            reported   += threads[idx].Reported;
+        }
+
+        elapsed = LcNow() - start;
+
+        printf("  %-13s %8.1f M decisions/s, %6.2f ns per decision per thread, %.4f reported\n",
+               ModeNames[mode],
+               operations / elapsed / 1e6,
+               elapsed * ThreadCount * 1e9 / operations,
+               (double)reported / operations);
+    }
+
+    free(threads);
+}
+
+//------------------------------------------------------------------------
+
+int
+main(
+    int   argc,
+    char* argv[]
+    )
+{
+    int    threads = argc > 1 ? atoi(argv[1]) : 4;
+    double seconds = argc > 2 ? atof(argv[2]) : 1.0;
+
+    if (threads <= 0 || seconds <= 0)
+    {
+        fprintf(stderr, "Usage: %s [threads] [seconds]\n", argv[0]);
+        return 2;
+    }
+
+    LcTestDistribution();
+    LcBenchmark(threads, seconds);
+
+    printf("%d failure(s)\n", Failures);
+
+    return Failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,437 @@
+/*++
+
+    The MIT License (MIT)
+
+    Copyright (c) 2015 Aleksey Kabanov
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    SnapshotStress.c
+
+Abstract:
+
+    Stress harness for the configuration snapshot reclamation scheme used by the
+    'LcAcquireConfigurationSnapshot', 'LcReleaseConfigurationSnapshot' and
+    'LcPublishConfigurationSnapshot' in the 'LazyCopyDriver\Configuration.c'.
+
+    The reader and writer protocols are reproduced with the GCC atomic builtins.
+    Reader threads acquire and release snapshot references, while the writer threads
+    keep publishing new snapshots. Retired snapshots are poisoned instead of being freed,
+    so a reader that still uses a reclaimed snapshot is detected.
+    The writer also checks that the reader counters never sum below zero, because
+    such a sum means that a reader still using the snapshot might not be counted.
+
+    The processor number is picked at random on every call by default, so every
+    reference behaves as if the thread migrated between the acquire, the retry and the release.
+
+    Build and run:
+
+        gcc -O2 -pthread -o SnapshotStress SnapshotStress.c
+        ./SnapshotStress [readers] [writers] [seconds] [legacy]
+
+    The 'legacy' argument makes the retry path look the processor counter up again,
+    as the driver did before, to check that the harness detects the failure.
+
+Environment:
+
+    User mode, Linux.
+
+--*/
+
+//------------------------------------------------------------------------
+//  Includes.
+//------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//------------------------------------------------------------------------
+//  Definitions.
+//------------------------------------------------------------------------
+
+// Should match the 'SNAPSHOT_READER_SLOTS' in the 'Configuration.c'.
+#define SNAPSHOT_READER_SLOTS 64
+
+#define SNAPSHOT_LIVE_SIGNATURE 0x4C495645
+#define SNAPSHOT_DEAD_SIGNATURE 0x44454144
+
+// Maximum amount of snapshots that can be retired during the run.
+#define MAX_RETIRED_SNAPSHOTS (1 << 20)
+
+//------------------------------------------------------------------------
+//  Structures.
+//------------------------------------------------------------------------
+
+typedef struct _SNAPSHOT_READER_SLOT
+{
+    volatile long Count[2];
+} __attribute__((aligned(64))) SNAPSHOT_READER_SLOT, *PSNAPSHOT_READER_SLOT;
+
+typedef struct _SNAPSHOT
+{
+    volatile long Signature;
+    long          Version;
+} SNAPSHOT, *PSNAPSHOT;
+
+typedef struct _SNAPSHOT_REFERENCE
+{
+    PSNAPSHOT      Snapshot;
+    volatile long* ReaderCount;
+} SNAPSHOT_REFERENCE, *PSNAPSHOT_REFERENCE;
+
+typedef struct _THREAD_STATE
+{
+    unsigned int  Seed;
+    unsigned long Operations;
+} THREAD_STATE, *PTHREAD_STATE;
+
+//------------------------------------------------------------------------
+//  Global variables.
+//------------------------------------------------------------------------
+
+static SNAPSHOT_READER_SLOT SnapshotReaders[SNAPSHOT_READER_SLOTS];
+static PSNAPSHOT            CurrentSnapshot  = NULL;
+static volatile long        SnapshotEpoch    = 0;
+static pthread_mutex_t      WriterLock       = PTHREAD_MUTEX_INITIALIZER;
+
+static PSNAPSHOT*           RetiredSnapshots = NULL;
+static volatile long        RetiredCount     = 0;
+
+static volatile int         StopRequested    = 0;
+static volatile long        Violations       = 0;
+static volatile long        Undercounts      = 0;
+static int                  LegacyRetry      = 0;
+
+//------------------------------------------------------------------------
+//  Snapshot functions.
+//------------------------------------------------------------------------
+
+static
+PSNAPSHOT_READER_SLOT
+LcGetSnapshotReaderSlot(
+    PTHREAD_STATE State
+    )
+/*++
+
+Summary:
+
+    This function returns the reader counters for a random processor,
+    so every call simulates a thread migration.
+
+--*/
+{
+    return &SnapshotReaders[rand_r(&State->Seed) % SNAPSHOT_READER_SLOTS];
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcAcquireSnapshot(
+    PTHREAD_STATE       State,
+    PSNAPSHOT_REFERENCE Reference
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcAcquireConfigurationSnapshot'.
+
+--*/
+{
+    long           epoch       = 0;
+    volatile long* readerCount = NULL;
+
+    for (;;)
+    {
+        epoch       = __atomic_load_n(&SnapshotEpoch, __ATOMIC_SEQ_CST);
+        readerCount = &LcGetSnapshotReaderSlot(State)->Count[epoch & 1];
+
+        // Give the writer a chance to advance the epoch and scan the counters, so the retry path is exercised.
+        if (rand_r(&State->Seed) % 16 == 0)
+        {
+            sched_yield();
+        }
+
+        __atomic_add_fetch(readerCount, 1, __ATOMIC_SEQ_CST);
+
+        if (rand_r(&State->Seed) % 16 == 0)
+        {
+            sched_yield();
+        }
+
+        if (epoch == __atomic_load_n(&SnapshotEpoch, __ATOMIC_SEQ_CST))
+        {
+            break;
+        }
+
+        if (LegacyRetry)
+        {
+            readerCount = &LcGetSnapshotReaderSlot(State)->Count[epoch & 1];
+        }
+
+        __atomic_sub_fetch(readerCount, 1, __ATOMIC_SEQ_CST);
+    }
+
+    Reference->ReaderCount = readerCount;
+    Reference->Snapshot    = __atomic_load_n(&CurrentSnapshot, __ATOMIC_SEQ_CST);
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcReleaseSnapshot(
+    PSNAPSHOT_REFERENCE Reference
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcReleaseConfigurationSnapshot'.
+
+--*/
+{
+    __atomic_sub_fetch(Reference->ReaderCount, 1, __ATOMIC_SEQ_CST);
+
+    Reference->ReaderCount = NULL;
+    Reference->Snapshot    = NULL;
+}
+
+//------------------------------------------------------------------------
+
+static
+void
+LcPublishSnapshot(
+    long Version
+    )
+/*++
+
+Summary:
+
+    This function mirrors the 'LcPublishConfigurationSnapshot'.
+    Instead of being freed, the previous snapshot is poisoned and retired.
+
+--*/
+{
+    PSNAPSHOT snapshot    = NULL;
+    PSNAPSHOT oldSnapshot = NULL;
+    long      epoch       = 0;
+    long      readers     = 0;
+    int       idx         = 0;
+
+    snapshot = malloc(sizeof(SNAPSHOT));
+    if (snapshot == NULL)
+    {
+        abort();
+    }
+
+    snapshot->Signature = SNAPSHOT_LIVE_SIGNATURE;
+    snapshot->Version   = Version;
+
+    pthread_mutex_lock(&WriterLock);
+
+    oldSnapshot = __atomic_exchange_n(&CurrentSnapshot, snapshot, __ATOMIC_SEQ_CST);
+
+    // New readers are counted in the next epoch. Wait for the ones counted in the previous epoch to leave.
+    epoch = __atomic_add_fetch(&SnapshotEpoch, 1, __ATOMIC_SEQ_CST) - 1;
+
+    for (;;)
+    {
+        readers = 0;
+        for (idx = 0; idx < SNAPSHOT_READER_SLOTS; idx++)
+        {
+            readers += __atomic_load_n(&SnapshotReaders[idx].Count[epoch & 1], __ATOMIC_SEQ_CST);
+
+            // Let the readers run in the middle of the scan, as they would on other processors.
+            if (idx % 16 == 15)
+            {
+                sched_yield();
+            }
+        }
+
+        if (readers < 0)
+        {
+            __atomic_add_fetch(&Undercounts, 1, __ATOMIC_SEQ_CST);
+        }
+
+        if (readers == 0)
+        {
+            break;
+        }
+
+        sched_yield();
+    }
+
+    pthread_mutex_unlock(&WriterLock);
+
+    if (oldSnapshot != NULL)
+    {
+        __atomic_store_n(&oldSnapshot->Signature, SNAPSHOT_DEAD_SIGNATURE, __ATOMIC_SEQ_CST);
+
+        if (RetiredCount < MAX_RETIRED_SNAPSHOTS)
+        {
+            RetiredSnapshots[__atomic_fetch_add(&RetiredCount, 1, __ATOMIC_SEQ_CST)] = oldSnapshot;
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+//  Thread routines.
+//------------------------------------------------------------------------
+
+static
+void*
+LcReaderThread(
+    void* Context
+    )
+{
+    PTHREAD_STATE      state     = (PTHREAD_STATE)Context;
+    SNAPSHOT_REFERENCE reference = { 0 };
+    int                spin      = 0;
+
+    while (!__atomic_load_n(&StopRequested, __ATOMIC_RELAXED))
+    {
+        LcAcquireSnapshot(state, &reference);
+
+        // Use the snapshot for a while, sometimes giving up the processor.
+        for (spin = rand_r(&state->Seed) % 64; spin > 0; spin--)
+        {
+            if (__atomic_load_n(&reference.Snapshot->Signature, __ATOMIC_SEQ_CST) != SNAPSHOT_LIVE_SIGNATURE)
+            {
+                __atomic_add_fetch(&Violations, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+
+            if (spin % 16 == 0)
+            {
+                sched_yield();
+            }
+        }
+
+        LcReleaseSnapshot(&reference);
+        state->Operations++;
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+static
+void*
+LcWriterThread(
+    void* Context
+    )
+{
+    PTHREAD_STATE state = (PTHREAD_STATE)Context;
+
+    while (!__atomic_load_n(&StopRequested, __ATOMIC_RELAXED) && RetiredCount < MAX_RETIRED_SNAPSHOTS)
+    {
+        LcPublishSnapshot((long)state->Operations);
+        state->Operations++;
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+int
+main(
+    int   argc,
+    char* argv[]
+    )
+{
+    int             readerCount = argc > 1 ? atoi(argv[1]) : 8;
+    int             writerCount = argc > 2 ? atoi(argv[2]) : 2;
+    int             seconds     = argc > 3 ? atoi(argv[3]) : 10;
+    pthread_t*      threads     = NULL;
+    PTHREAD_STATE   states      = NULL;
+    unsigned long   readerOps   = 0;
+    unsigned long   writerOps   = 0;
+    long            idx         = 0;
+    struct timespec duration    = { 0 };
+
+    LegacyRetry = argc > 4 && strcmp(argv[4], "legacy") == 0;
+
+    if (readerCount <= 0 || writerCount <= 0 || seconds <= 0)
+    {
+        fprintf(stderr, "Usage: %s [readers] [writers] [seconds] [legacy]\n", argv[0]);
+        return 2;
+    }
+
+    threads          = calloc((size_t)(readerCount + writerCount), sizeof(pthread_t));
+    states           = calloc((size_t)(readerCount + writerCount), sizeof(THREAD_STATE));
+    RetiredSnapshots = calloc(MAX_RETIRED_SNAPSHOTS, sizeof(PSNAPSHOT));
+    if (threads == NULL || states == NULL || RetiredSnapshots == NULL)
+    {
+        return 2;
+    }
+
+    LcPublishSnapshot(0);
+
+    for (idx = 0; idx < readerCount + writerCount; idx++)
+    {
+        states[idx].Seed = (unsigned int)(idx * 2654435761u + (unsigned int)time(NULL));
+        pthread_create(&threads[idx], NULL, idx < readerCount ? LcReaderThread : LcWriterThread, &states[idx]);
+    }
+
+    duration.tv_sec = seconds;
+    nanosleep(&duration, NULL);
+
+    __atomic_store_n(&StopRequested, 1, __ATOMIC_SEQ_CST);
+
+    for (idx = 0; idx < readerCount + writerCount; idx++)
+    {
+        pthread_join(threads[idx], NULL);
+
+        if (idx < readerCount)
+        {
+            readerOps += states[idx].Operations;
+        }
+        else
+        {
+            writerOps += states[idx].Operations;
+        }
+    }
+
+    printf("Reader references: %lu, snapshots published: %lu, use-after-reclaim: %ld, undercounts: %ld\n", readerOps, writerOps, Violations, Undercounts);
+
+    for (idx = 0; idx < RetiredCount; idx++)
+    {
+        free(RetiredSnapshots[idx]);
+    }
+
+    free(CurrentSnapshot);
+    free(RetiredSnapshots);
+    free(states);
+    free(threads);
+
+    return Violations == 0 && Undercounts == 0 ? 0 : 1;
+}
@@ -42,8 +42,9 @@ namespace LazyCopy.Service
         /// </summary>
         public DriverConfiguration()
         {
-            this.WatchPaths = new HashSet<string>(StringComparer.OrdinalIgnoreCase);
-            this.ReportRate = Settings.Default.ReportRate;
+            this.WatchPaths              = new HashSet<string>(StringComparer.OrdinalIgnoreCase);
+            this.ReportRate              = Settings.Default.ReportRate;
+            this.FileAccessDrainInterval = Settings.Default.FileAccessDrainInterval;
         }
 
         /// <summary>
@@ -60,5 +61,11 @@ namespace LazyCopy.Service
         /// Gets or sets the driver operation mode.
         /// </summary>
         public OperationMode OperationMode { get; set; }
+
+        /// <summary>
+        /// Gets or sets the interval the file access records are drained from the driver with.
+        /// If it's <see cref="TimeSpan.Zero"/>, the driver raises an ETW event per file access instead.
+        /// </summary>
+        public TimeSpan FileAccessDrainInterval { get; set; }
     }
 }
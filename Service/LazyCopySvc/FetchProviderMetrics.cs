@@ -0,0 +1,172 @@
+﻿// --------------------------------------------------------------------------------------------------------------------
+// <copyright file="FetchProviderMetrics.cs">
+//   The MIT License (MIT)
+//   Copyright (c) 2015 Aleksey Kabanov
+// </copyright>
+// <summary>
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to deal
+//   in the Software without restriction, including without limitation the rights
+//   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//   copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be included in
+//   all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//   THE SOFTWARE.
+// </summary>
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace LazyCopy.Service
+{
+    using System;
+    using System.Globalization;
+    using System.Threading;
+
+    /// <summary>
+    /// Collects the throughput and latency metrics of a fetch provider.
+    /// </summary>
+    /// <remarks>
+    /// All members are thread-safe, but the values read at once may belong to different fetches.
+    /// </remarks>
+    public sealed class FetchProviderMetrics
+    {
+        #region Fields
+
+        /// <summary>
+        /// Amount of fetches completed, including the failed ones.
+        /// </summary>
+        private long fetchCount;
+
+        /// <summary>
+        /// Amount of fetches failed.
+        /// </summary>
+        private long failureCount;
+
+        /// <summary>
+        /// Total amount of bytes fetched.
+        /// </summary>
+        private long bytesFetched;
+
+        /// <summary>
+        /// Total duration of all fetches, in ticks.
+        /// </summary>
+        private long totalTicks;
+
+        /// <summary>
+        /// Duration of the longest fetch, in ticks.
+        /// </summary>
+        private long maxTicks;
+
+        #endregion // Fields
+
+        #region Properties
+
+        /// <summary>
+        /// Gets the amount of fetches completed, including the failed ones.
+        /// </summary>
+        public long FetchCount => Interlocked.Read(ref this.fetchCount);
+
+        /// <summary>
+        /// Gets the amount of fetches failed.
+        /// </summary>
+        public long FailureCount => Interlocked.Read(ref this.failureCount);
+
+        /// <summary>
+        /// Gets the total amount of bytes fetched.
+        /// </summary>
+        public long BytesFetched => Interlocked.Read(ref this.bytesFetched);
+
+        /// <summary>
+        /// Gets the average fetch duration.
+        /// </summary>
+        public TimeSpan AverageLatency
+        {
+            get
+            {
+                long count = this.FetchCount;
+                return count > 0 ? TimeSpan.FromTicks(Interlocked.Read(ref this.totalTicks) / count) : TimeSpan.Zero;
+            }
+        }
+
+        /// <summary>
+        /// Gets the duration of the longest fetch.
+        /// </summary>
+        public TimeSpan MaxLatency => TimeSpan.FromTicks(Interlocked.Read(ref this.maxTicks));
+
+        /// <summary>
+        /// Gets the average throughput of a single fetch, in bytes per second.
+        /// </summary>
+        /// <remarks>
+        /// Concurrent fetches are not summed up, so the provider throughput is higher, if it fetches several files at once.
+        /// </remarks>
+        public double BytesPerSecond
+        {
+            get
+            {
+                long ticks = Interlocked.Read(ref this.totalTicks);
+                return ticks > 0 ? this.BytesFetched / TimeSpan.FromTicks(ticks).TotalSeconds : 0;
+            }
+        }
+
+        #endregion // Properties
+
+        #region Public methods
+
+        /// <summary>
+        /// Records the fetch completed.
+        /// </summary>
+        /// <param name="bytes">Amount of bytes fetched.</param>
+        /// <param name="elapsed">Fetch duration.</param>
+        /// <param name="succeeded">Whether the fetch succeeded.</param>
+        public void Record(long bytes, TimeSpan elapsed, bool succeeded)
+        {
+            Interlocked.Increment(ref this.fetchCount);
+            Interlocked.Add(ref this.bytesFetched, bytes);
+            Interlocked.Add(ref this.totalTicks, elapsed.Ticks);
+
+            if (!succeeded)
+            {
+                Interlocked.Increment(ref this.failureCount);
+            }
+
+            long max = Interlocked.Read(ref this.maxTicks);
+            while (elapsed.Ticks > max)
+            {
+                long current = Interlocked.CompareExchange(ref this.maxTicks, elapsed.Ticks, max);
+                if (current == max)
+                {
+                    break;
+                }
+
+                max = current;
+            }
+        }
+
+        /// <summary>
+        /// Returns the string representation of the metrics.
+        /// </summary>
+        /// <returns>String representation of the metrics.</returns>
+        public override string ToString()
+        {
+            return string.Format(
+                CultureInfo.InvariantCulture,
+                "{0} fetches, {1} failed, {2} bytes, {3:F1} ms average, {4:F1} ms max, {5:F0} bytes/s per fetch",
+                this.FetchCount,
+                this.FailureCount,
+                this.BytesFetched,
+                this.AverageLatency.TotalMilliseconds,
+                this.MaxLatency.TotalMilliseconds,
+                this.BytesPerSecond);
+        }
+
+        #endregion // Public methods
+    }
+}
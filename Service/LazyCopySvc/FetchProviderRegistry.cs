@@ -0,0 +1,94 @@
+﻿// --------------------------------------------------------------------------------------------------------------------
+// <copyright file="FetchProviderRegistry.cs">
+//   The MIT License (MIT)
+//   Copyright (c) 2015 Aleksey Kabanov
+// </copyright>
+// <summary>
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to deal
+//   in the Software without restriction, including without limitation the rights
+//   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//   copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be included in
+//   all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//   THE SOFTWARE.
+// </summary>
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace LazyCopy.Service
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Linq;
+
+    /// <summary>
+    /// Contains the fetch providers keyed by the URI schemes they serve.
+    /// </summary>
+    /// <remarks>
+    /// Providers should be registered before the fetches start, as the lookups are not synchronized with the registration.
+    /// </remarks>
+    public sealed class FetchProviderRegistry
+    {
+        #region Fields
+
+        /// <summary>
+        /// Providers keyed by the URI scheme.
+        /// </summary>
+        private readonly Dictionary<string, IFetchProvider> providers = new Dictionary<string, IFetchProvider>(StringComparer.OrdinalIgnoreCase);
+
+        #endregion // Fields
+
+        #region Properties
+
+        /// <summary>
+        /// Gets the providers registered.
+        /// </summary>
+        public IEnumerable<IFetchProvider> Providers => this.providers.Values.Distinct();
+
+        #endregion // Properties
+
+        #region Public methods
+
+        /// <summary>
+        /// Registers the <paramref name="provider"/> given for all its schemes.
+        /// </summary>
+        /// <param name="provider">Provider to register.</param>
+        /// <exception cref="ArgumentNullException"><paramref name="provider"/> is <see langword="null"/>.</exception>
+        /// <exception cref="ArgumentException">Any of the <paramref name="provider"/> schemes is already registered.</exception>
+        public void Register(IFetchProvider provider)
+        {
+            if (provider == null)
+            {
+                throw new ArgumentNullException(nameof(provider));
+            }
+
+            foreach (string scheme in provider.Schemes)
+            {
+                this.providers.Add(scheme, provider);
+            }
+        }
+
+        /// <summary>
+        /// Finds the provider for the <paramref name="source"/> URI scheme.
+        /// </summary>
+        /// <param name="source">Source file URI.</param>
+        /// <param name="provider">Receives the provider found, or <see langword="null"/>.</param>
+        /// <returns><see langword="true"/>, if the provider is found.</returns>
+        public bool TryGetProvider(Uri source, out IFetchProvider provider)
+        {
+            provider = null;
+            return source != null && source.IsAbsoluteUri && this.providers.TryGetValue(source.Scheme, out provider);
+        }
+
+        #endregion // Public methods
+    }
+}
@@ -0,0 +1,438 @@
+﻿// --------------------------------------------------------------------------------------------------------------------
+// <copyright file="HttpBatchFetcher.cs">
+//   The MIT License (MIT)
+//   Copyright (c) 2015 Aleksey Kabanov
+// </copyright>
+// <summary>
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to deal
+//   in the Software without restriction, including without limitation the rights
+//   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//   copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be included in
+//   all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//   THE SOFTWARE.
+// </summary>
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace LazyCopy.Service
+{
+    using System;
+    using System.Collections.Concurrent;
+    using System.Collections.Generic;
+    using System.IO;
+    using System.Linq;
+    using System.Net;
+    using System.Net.Http;
+    using System.Text;
+    using System.Threading;
+    using System.Threading.Tasks;
+
+    using NLog;
+
+    /// <summary>
+    /// Coalesces the concurrent fetches of the files from the same server into the batch requests.
+    /// </summary>
+    /// <remarks>
+    /// Fetches requested within the batch window are sent to the server batch endpoint as a single <c>POST</c> request.
+    /// The request body contains the UTF-8 encoded paths of the files requested, one per line.<br/>
+    /// The response contains the files in the same order. Each file is prefixed with its length as
+    /// a little-endian 64-bit integer. The server returns <c>-1</c> length for the files it doesn't want
+    /// to batch, for example, the large ones, and they are fetched one by one.<br/>
+    /// If the server doesn't have the batch endpoint, batching is disabled for it.
+    /// </remarks>
+    public sealed class HttpBatchFetcher : IDisposable
+    {
+        #region Fields
+
+        /// <summary>
+        /// Size of the buffer used to copy the response content to the target streams.
+        /// </summary>
+        private const int BufferSize = 81920;
+
+        /// <summary>
+        /// Logger instance.
+        /// </summary>
+        private static readonly Logger Logger = LogManager.GetCurrentClassLogger();
+
+        /// <summary>
+        /// HTTP client shared by all batches, so the connections are reused.
+        /// </summary>
+        private readonly HttpClient client;
+
+        /// <summary>
+        /// Path of the batch endpoint on each server.
+        /// </summary>
+        private readonly string batchPath;
+
+        /// <summary>
+        /// Maximum amount of files in a single batch.
+        /// </summary>
+        private readonly int maxBatchSize;
+
+        /// <summary>
+        /// Time to wait for the concurrent fetches to join the batch.
+        /// </summary>
+        private readonly TimeSpan batchWindow;
+
+        /// <summary>
+        /// Pending fetches for each server.
+        /// </summary>
+        private readonly ConcurrentDictionary<string, BatchQueue> queues = new ConcurrentDictionary<string, BatchQueue>(StringComparer.OrdinalIgnoreCase);
+
+        #endregion // Fields
+
+        #region Constructor
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="HttpBatchFetcher"/> class.
+        /// </summary>
+        /// <param name="batchPath">Path of the batch endpoint on each server, for example, <c>/batch</c>.</param>
+        /// <param name="maxBatchSize">Maximum amount of files in a single batch.</param>
+        /// <param name="batchWindow">Time to wait for the concurrent fetches to join the batch.</param>
+        /// <exception cref="ArgumentNullException"><paramref name="batchPath"/> is <see langword="null"/> or empty.</exception>
+        /// <exception cref="ArgumentOutOfRangeException">
+        /// <paramref name="maxBatchSize"/> is lesser than two.<br/>
+        /// -or-<br/>
+        /// <paramref name="batchWindow"/> is negative.
+        /// </exception>
+        public HttpBatchFetcher(string batchPath, int maxBatchSize, TimeSpan batchWindow)
+        {
+            if (string.IsNullOrEmpty(batchPath))
+            {
+                throw new ArgumentNullException(nameof(batchPath));
+            }
+
+            if (maxBatchSize < 2)
+            {
+                throw new ArgumentOutOfRangeException(nameof(maxBatchSize), maxBatchSize, "Batch should contain at least two files.");
+            }
+
+            if (batchWindow < TimeSpan.Zero)
+            {
+                throw new ArgumentOutOfRangeException(nameof(batchWindow), batchWindow, "Batch window is negative.");
+            }
+
+            this.batchPath    = batchPath;
+            this.maxBatchSize = maxBatchSize;
+            this.batchWindow  = batchWindow;
+
+            HttpClientHandler handler = new HttpClientHandler
+            {
+                AllowAutoRedirect      = true,
+                AutomaticDecompression = DecompressionMethods.GZip | DecompressionMethods.Deflate,
+                UseDefaultCredentials  = true
+            };
+
+            this.client = new HttpClient(handler, true) { Timeout = Timeout.InfiniteTimeSpan };
+            this.client.DefaultRequestHeaders.ConnectionClose = false;
+        }
+
+        #endregion // Constructor
+
+        #region Public methods
+
+        /// <summary>
+        /// Adds the <paramref name="source"/> file to the next batch for its server.
+        /// </summary>
+        /// <param name="source">Source file URI.</param>
+        /// <param name="target">Stream to write the content to.</param>
+        /// <returns>
+        /// Task that returns the amount of bytes written to the <paramref name="target"/>,
+        /// or <c>-1</c>, if the file was not fetched and should be requested on its own.
+        /// </returns>
+        /// <exception cref="ArgumentNullException"><paramref name="source"/> or <paramref name="target"/> is <see langword="null"/>.</exception>
+        /// <remarks>
+        /// The <paramref name="target"/> stream should not be used, until the task returned is completed.
+        /// </remarks>
+        public Task<long> FetchAsync(Uri source, Stream target)
+        {
+            if (source == null)
+            {
+                throw new ArgumentNullException(nameof(source));
+            }
+
+            if (target == null)
+            {
+                throw new ArgumentNullException(nameof(target));
+            }
+
+            string authority = source.GetLeftPart(UriPartial.Authority);
+            BatchQueue queue = this.queues.GetOrAdd(authority, key => new BatchQueue(new Uri(new Uri(key), this.batchPath)));
+
+            if (!queue.IsSupported)
+            {
+                return Task.FromResult(-1L);
+            }
+
+            BatchItem item     = new BatchItem(source, target);
+            bool      dispatch = false;
+
+            lock (queue)
+            {
+                queue.Items.Add(item);
+
+                // Only one dispatcher collects the batch, the rest of the fetches just join it.
+                dispatch = !queue.IsDispatching;
+                queue.IsDispatching = true;
+            }
+
+            if (dispatch)
+            {
+                Task.Run(() => this.DispatchAsync(queue));
+            }
+
+            return item.Completion.Task;
+        }
+
+        /// <summary>
+        /// Releases the pooled connections.
+        /// </summary>
+        public void Dispose()
+        {
+            this.client.Dispose();
+        }
+
+        #endregion // Public methods
+
+        #region Private methods
+
+        /// <summary>
+        /// Reads exactly <paramref name="count"/> bytes from the <paramref name="stream"/> given.
+        /// </summary>
+        /// <param name="stream">Stream to read from.</param>
+        /// <param name="buffer">Buffer to read to.</param>
+        /// <param name="count">Amount of bytes to read.</param>
+        /// <returns>Task that completes, once the data is read.</returns>
+        /// <exception cref="EndOfStreamException">Stream ended before <paramref name="count"/> bytes were read.</exception>
+        private static async Task ReadExactlyAsync(Stream stream, byte[] buffer, int count)
+        {
+            for (int offset = 0; offset < count;)
+            {
+                int bytesRead = await stream.ReadAsync(buffer, offset, count - offset).ConfigureAwait(false);
+                if (bytesRead == 0)
+                {
+                    throw new EndOfStreamException("Batch response ended unexpectedly.");
+                }
+
+                offset += bytesRead;
+            }
+        }
+
+        /// <summary>
+        /// Sends the pending fetches of the <paramref name="queue"/> in batches, until it's empty.
+        /// </summary>
+        /// <param name="queue">Queue to dispatch.</param>
+        /// <returns>Task that completes, once the queue is empty.</returns>
+        /// <remarks>
+        /// Batches are not waited for, so several of them may be in flight at once.
+        /// </remarks>
+        private async Task DispatchAsync(BatchQueue queue)
+        {
+            while (true)
+            {
+                // Let the concurrent fetches join the batch.
+                await Task.Delay(this.batchWindow).ConfigureAwait(false);
+
+                List<BatchItem> batch;
+                lock (queue)
+                {
+                    if (queue.Items.Count == 0)
+                    {
+                        queue.IsDispatching = false;
+                        return;
+                    }
+
+                    batch = queue.Items.Take(this.maxBatchSize).ToList();
+                    queue.Items.RemoveRange(0, batch.Count);
+                }
+
+                // A single file gains nothing from the batch, and it's fetched in ranges on its own.
+                if (batch.Count == 1)
+                {
+                    batch[0].Completion.TrySetResult(-1);
+                    continue;
+                }
+
+                // The next batch is collected, while this one is in flight.
+                Task sendTask = this.SendBatchAsync(queue, batch);
+            }
+        }
+
+        /// <summary>
+        /// Sends the batch request and writes the files received to their targets.
+        /// </summary>
+        /// <param name="queue">Queue the <paramref name="batch"/> belongs to.</param>
+        /// <param name="batch">Fetches to send.</param>
+        /// <returns>Task that completes, once all fetches in the <paramref name="batch"/> are completed.</returns>
+        /// <remarks>
+        /// This method never fails. The fetches that are not completed are returned to their callers to be fetched one by one.
+        /// </remarks>
+        private async Task SendBatchAsync(BatchQueue queue, List<BatchItem> batch)
+        {
+            try
+            {
+                using (HttpRequestMessage request = new HttpRequestMessage(HttpMethod.Post, queue.BatchUri))
+                {
+                    request.Content = new StringContent(string.Join("\n", batch.Select(item => item.Source.PathAndQuery)), Encoding.UTF8, "text/plain");
+
+                    using (HttpResponseMessage response = await this.client.SendAsync(request, HttpCompletionOption.ResponseHeadersRead).ConfigureAwait(false))
+                    {
+                        if (response.StatusCode == HttpStatusCode.NotFound || response.StatusCode == HttpStatusCode.MethodNotAllowed || response.StatusCode == HttpStatusCode.NotImplemented)
+                        {
+                            HttpBatchFetcher.Logger.Info("Server doesn't support batches, fetching files from {0} one by one.", queue.BatchUri);
+                            queue.IsSupported = false;
+                            return;
+                        }
+
+                        response.EnsureSuccessStatusCode();
+
+                        using (Stream content = await response.Content.ReadAsStreamAsync().ConfigureAwait(false))
+                        {
+                            byte[] buffer = new byte[HttpBatchFetcher.BufferSize];
+
+                            foreach (BatchItem item in batch)
+                            {
+                                await HttpBatchFetcher.ReadExactlyAsync(content, buffer, sizeof(long)).ConfigureAwait(false);
+
+                                long length = BitConverter.ToInt64(buffer, 0);
+                                if (length >= 0)
+                                {
+                                    await HttpBatchFetcher.CopyFileAsync(content, item.Target, buffer, length).ConfigureAwait(false);
+                                }
+
+                                item.Completion.TrySetResult(length);
+                            }
+                        }
+                    }
+                }
+            }
+            catch (Exception e)
+            {
+                // Individual fetches are retried, so the batch is not.
+                HttpBatchFetcher.Logger.Warn(e, "Batch of {0} files to {1} failed, fetching them one by one.", batch.Count, queue.BatchUri);
+            }
+            finally
+            {
+                foreach (BatchItem item in batch)
+                {
+                    item.Completion.TrySetResult(-1);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Copies a single file of the <paramref name="length"/> given from the batch response to its <paramref name="target"/>.
+        /// </summary>
+        /// <param name="content">Batch response content.</param>
+        /// <param name="target">Stream to write the file to.</param>
+        /// <param name="buffer">Buffer to use for copying.</param>
+        /// <param name="length">File length.</param>
+        /// <returns>Task that completes, once the file is written.</returns>
+        /// <exception cref="EndOfStreamException">Response ended before the whole file was read.</exception>
+        private static async Task CopyFileAsync(Stream content, Stream target, byte[] buffer, long length)
+        {
+            if (target.CanSeek)
+            {
+                target.Position = 0;
+            }
+
+            for (long remaining = length; remaining > 0;)
+            {
+                int toRead = (int)Math.Min(buffer.Length, remaining);
+                await HttpBatchFetcher.ReadExactlyAsync(content, buffer, toRead).ConfigureAwait(false);
+
+                target.Write(buffer, 0, toRead);
+                remaining -= toRead;
+            }
+        }
+
+        #endregion // Private methods
+
+        #region Nested types
+
+        /// <summary>
+        /// Contains the pending fetches of a single server.
+        /// </summary>
+        private sealed class BatchQueue
+        {
+            /// <summary>
+            /// Initializes a new instance of the <see cref="BatchQueue"/> class.
+            /// </summary>
+            /// <param name="batchUri">URI of the server batch endpoint.</param>
+            public BatchQueue(Uri batchUri)
+            {
+                this.BatchUri    = batchUri;
+                this.IsSupported = true;
+            }
+
+            /// <summary>
+            /// Gets the URI of the server batch endpoint.
+            /// </summary>
+            public Uri BatchUri { get; }
+
+            /// <summary>
+            /// Gets or sets a value indicating whether the server supports batches.
+            /// </summary>
+            public bool IsSupported { get; set; }
+
+            /// <summary>
+            /// Gets or sets a value indicating whether the dispatcher is collecting the next batch.
+            /// Should only be accessed under the queue lock.
+            /// </summary>
+            public bool IsDispatching { get; set; }
+
+            /// <summary>
+            /// Gets the fetches waiting for the next batch.
+            /// Should only be accessed under the queue lock.
+            /// </summary>
+            public List<BatchItem> Items { get; } = new List<BatchItem>();
+        }
+
+        /// <summary>
+        /// Contains a single fetch waiting for the batch.
+        /// </summary>
+        private sealed class BatchItem
+        {
+            /// <summary>
+            /// Initializes a new instance of the <see cref="BatchItem"/> class.
+            /// </summary>
+            /// <param name="source">Source file URI.</param>
+            /// <param name="target">Stream to write the content to.</param>
+            public BatchItem(Uri source, Stream target)
+            {
+                this.Source = source;
+                this.Target = target;
+
+                // The caller disposes the target, once the task is completed, so the batch should not continue with it inline.
+                this.Completion = new TaskCompletionSource<long>(TaskCreationOptions.RunContinuationsAsynchronously);
+            }
+
+            /// <summary>
+            /// Gets the source file URI.
+            /// </summary>
+            public Uri Source { get; }
+
+            /// <summary>
+            /// Gets the stream to write the content to.
+            /// </summary>
+            public Stream Target { get; }
+
+            /// <summary>
+            /// Gets the completion source, which receives the amount of bytes written, or <c>-1</c>, if the file was not fetched.
+            /// </summary>
+            public TaskCompletionSource<long> Completion { get; }
+        }
+
+        #endregion // Nested types
+    }
+}
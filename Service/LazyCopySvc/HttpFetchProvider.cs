@@ -0,0 +1,594 @@
+﻿// --------------------------------------------------------------------------------------------------------------------
+// <copyright file="HttpFetchProvider.cs">
+//   The MIT License (MIT)
+//   Copyright (c) 2015 Aleksey Kabanov
+// </copyright>
+// <summary>
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to deal
+//   in the Software without restriction, including without limitation the rights
+//   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//   copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be included in
+//   all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//   THE SOFTWARE.
+// </summary>
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace LazyCopy.Service
+{
+    using System;
+    using System.Collections.Concurrent;
+    using System.Collections.Generic;
+    using System.Diagnostics;
+    using System.IO;
+    using System.Linq;
+    using System.Net;
+    using System.Net.Http;
+    using System.Net.Http.Headers;
+    using System.Threading;
+    using System.Threading.Tasks;
+
+    using NLog;
+
+    /// <summary>
+    /// Downloads the remote files via HTTP or HTTPS.
+    /// </summary>
+    /// <remarks>
+    /// Connections are pooled and kept alive between the fetches. Large files are split into ranges
+    /// downloaded concurrently, and each range is resumed from its last written byte, if the transfer fails.<br/>
+    /// If the server doesn't support ranges, the file is downloaded with a single request.<br/>
+    /// Derived classes may serve other HTTP-based schemes by overriding the <see cref="CreateRequest"/> method.
+    /// </remarks>
+    public class HttpFetchProvider : IFetchProvider, IDisposable
+    {
+        #region Fields
+
+        /// <summary>
+        /// Size of the buffer used to copy the response content to the target stream.
+        /// </summary>
+        private const int BufferSize = 81920;
+
+        /// <summary>
+        /// Logger instance.
+        /// </summary>
+        private static readonly Logger Logger = LogManager.GetCurrentClassLogger();
+
+        /// <summary>
+        /// HTTP client shared by all fetches, so the connections are reused.
+        /// </summary>
+        private readonly HttpClient client;
+
+        /// <summary>
+        /// Size of a single range request, in bytes.
+        /// </summary>
+        private readonly long rangeSize;
+
+        /// <summary>
+        /// Maximum amount of ranges of a single file downloaded at once.
+        /// </summary>
+        private readonly int parallelism;
+
+        /// <summary>
+        /// Amount of times a range is retried, if it doesn't make any progress.
+        /// </summary>
+        private readonly int retryCount;
+
+        /// <summary>
+        /// Delay before the first retry. It's doubled on each subsequent one.
+        /// </summary>
+        private readonly TimeSpan retryDelay;
+
+        #endregion // Fields
+
+        #region Constructor
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="HttpFetchProvider"/> class.
+        /// </summary>
+        /// <param name="rangeSize">Size of a single range request, in bytes.</param>
+        /// <param name="parallelism">Maximum amount of ranges of a single file downloaded at once.</param>
+        /// <param name="retryCount">Amount of times a range is retried, if it doesn't make any progress.</param>
+        /// <param name="retryDelay">Delay before the first retry. It's doubled on each subsequent one.</param>
+        /// <param name="connectionLimit">Maximum amount of concurrent connections to a single server.</param>
+        /// <exception cref="ArgumentOutOfRangeException">
+        /// <paramref name="rangeSize"/>, <paramref name="parallelism"/> or <paramref name="connectionLimit"/> is lesser than one.<br/>
+        /// -or-<br/>
+        /// <paramref name="retryCount"/> or <paramref name="retryDelay"/> is negative.
+        /// </exception>
+        /// <remarks>
+        /// Connection limit is applied to the whole process, as the <see cref="HttpClientHandler"/> uses the shared service points.
+        /// </remarks>
+        public HttpFetchProvider(long rangeSize, int parallelism, int retryCount, TimeSpan retryDelay, int connectionLimit)
+        {
+            if (rangeSize <= 0)
+            {
+                throw new ArgumentOutOfRangeException(nameof(rangeSize), rangeSize, "Range size should be more than zero.");
+            }
+
+            if (parallelism <= 0)
+            {
+                throw new ArgumentOutOfRangeException(nameof(parallelism), parallelism, "Parallelism should be more than zero.");
+            }
+
+            if (retryCount < 0)
+            {
+                throw new ArgumentOutOfRangeException(nameof(retryCount), retryCount, "Retry count is negative.");
+            }
+
+            if (retryDelay < TimeSpan.Zero)
+            {
+                throw new ArgumentOutOfRangeException(nameof(retryDelay), retryDelay, "Retry delay is negative.");
+            }
+
+            if (connectionLimit <= 0)
+            {
+                throw new ArgumentOutOfRangeException(nameof(connectionLimit), connectionLimit, "Connection limit should be more than zero.");
+            }
+
+            this.rangeSize   = rangeSize;
+            this.parallelism = parallelism;
+            this.retryCount  = retryCount;
+            this.retryDelay  = retryDelay;
+
+            // The default limit is two connections per server, which would serialize the ranges.
+            ServicePointManager.DefaultConnectionLimit = Math.Max(ServicePointManager.DefaultConnectionLimit, connectionLimit);
+
+            // Ranges are requested for the raw content bytes, so it should not be decompressed.
+            HttpClientHandler handler = new HttpClientHandler
+            {
+                AllowAutoRedirect      = true,
+                AutomaticDecompression = DecompressionMethods.None,
+                UseDefaultCredentials  = true
+            };
+
+            // Fetches are limited by the driver timeout, and a single range may take long on a slow link.
+            this.client = new HttpClient(handler, true) { Timeout = Timeout.InfiniteTimeSpan };
+            this.client.DefaultRequestHeaders.ConnectionClose = false;
+        }
+
+        #endregion // Constructor
+
+        #region Properties
+
+        /// <summary>
+        /// Gets the URI schemes this provider fetches.
+        /// </summary>
+        public virtual IEnumerable<string> Schemes => new[] { Uri.UriSchemeHttp, Uri.UriSchemeHttps };
+
+        /// <summary>
+        /// Gets the throughput and latency metrics of this provider.
+        /// </summary>
+        public FetchProviderMetrics Metrics { get; } = new FetchProviderMetrics();
+
+        /// <summary>
+        /// Gets or sets the fetcher the files are batched with, before they are fetched one by one. Optional.
+        /// </summary>
+        public HttpBatchFetcher BatchFetcher { get; set; }
+
+        #endregion // Properties
+
+        #region Public methods
+
+        /// <summary>
+        /// Downloads the <paramref name="source"/> file to the <paramref name="target"/> stream.
+        /// </summary>
+        /// <param name="source">Source file URI.</param>
+        /// <param name="target">Stream to write the content to. Ranges are only downloaded concurrently, if it's seekable.</param>
+        /// <param name="token">Cancellation token.</param>
+        /// <returns>Amount of bytes written to the <paramref name="target"/>.</returns>
+        /// <exception cref="ArgumentNullException"><paramref name="source"/> or <paramref name="target"/> is <see langword="null"/>.</exception>
+        /// <exception cref="ArgumentException"><paramref name="source"/> scheme is not one of the <see cref="Schemes"/>.</exception>
+        /// <exception cref="HttpRequestException">Server failed the request, or the retry count for a range is exceeded.</exception>
+        /// <exception cref="IOException">Connection was closed before the content was received, and the retry count is exceeded.</exception>
+        /// <remarks>
+        /// The <paramref name="target"/> stream is written starting from its beginning, but it's not truncated.
+        /// </remarks>
+        public async Task<long> FetchAsync(Uri source, Stream target, CancellationToken token)
+        {
+            if (source == null)
+            {
+                throw new ArgumentNullException(nameof(source));
+            }
+
+            if (target == null)
+            {
+                throw new ArgumentNullException(nameof(target));
+            }
+
+            if (!source.IsAbsoluteUri || !this.Schemes.Contains(source.Scheme, StringComparer.OrdinalIgnoreCase))
+            {
+                throw new ArgumentException($"URI is not supported: {source}", nameof(source));
+            }
+
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            long bytesCopied    = -1;
+
+            try
+            {
+                HttpBatchFetcher batchFetcher = this.BatchFetcher;
+                if (batchFetcher != null)
+                {
+                    bytesCopied = await batchFetcher.FetchAsync(source, target).ConfigureAwait(false);
+                }
+
+                if (bytesCopied < 0)
+                {
+                    bytesCopied = await this.FetchInRangesAsync(source, target, token).ConfigureAwait(false);
+                }
+
+                return bytesCopied;
+            }
+            finally
+            {
+                this.Metrics.Record(Math.Max(bytesCopied, 0), stopwatch.Elapsed, bytesCopied >= 0);
+            }
+        }
+
+        /// <summary>
+        /// Releases the pooled connections.
+        /// </summary>
+        public void Dispose()
+        {
+            this.Dispose(true);
+            GC.SuppressFinalize(this);
+        }
+
+        #endregion // Public methods
+
+        #region Protected methods
+
+        /// <summary>
+        /// Creates the request for the <paramref name="source"/> file content.
+        /// </summary>
+        /// <param name="source">Source file URI.</param>
+        /// <returns>Request message. The <c>Range</c> header is set by the caller.</returns>
+        /// <remarks>
+        /// A new request is created for each range and each retry.
+        /// </remarks>
+        protected virtual HttpRequestMessage CreateRequest(Uri source)
+        {
+            return new HttpRequestMessage(HttpMethod.Get, source);
+        }
+
+        /// <summary>
+        /// Releases the pooled connections.
+        /// </summary>
+        /// <param name="disposing"><see langword="true"/> to release both managed and unmanaged resources; <see langword="false"/> to release only unmanaged resources.</param>
+        protected virtual void Dispose(bool disposing)
+        {
+            if (disposing)
+            {
+                this.client.Dispose();
+            }
+        }
+
+        #endregion // Protected methods
+
+        #region Private methods
+
+        /// <summary>
+        /// Downloads the <paramref name="source"/> file in ranges.
+        /// </summary>
+        /// <param name="source">Source file URI.</param>
+        /// <param name="target">Stream to write the content to.</param>
+        /// <param name="token">Cancellation token.</param>
+        /// <returns>Task that returns the amount of bytes written to the <paramref name="target"/>.</returns>
+        private async Task<long> FetchInRangesAsync(Uri source, Stream target, CancellationToken token)
+        {
+            // The first range tells whether the server supports ranges and how large the file is,
+            // so the rest of them are requested as soon as its headers are received.
+            FetchRange first                         = new FetchRange(0, target.CanSeek ? this.rangeSize : -1);
+            TaskCompletionSource<long> contentLength = new TaskCompletionSource<long>(TaskCreationOptions.RunContinuationsAsynchronously);
+
+            using (CancellationTokenSource cancellation = CancellationTokenSource.CreateLinkedTokenSource(token))
+            {
+                Task firstTask = this.FetchRangeAsync(source, target, first, contentLength, cancellation.Token);
+
+                if (await Task.WhenAny(firstTask, contentLength.Task).ConfigureAwait(false) == firstTask && !contentLength.Task.IsCompleted)
+                {
+                    await firstTask.ConfigureAwait(false);
+                }
+
+                long length = contentLength.Task.Result;
+                if (length <= first.End)
+                {
+                    await firstTask.ConfigureAwait(false);
+                    return first.Offset;
+                }
+
+                // Preallocate the file, so the concurrent ranges don't extend it one by one.
+                lock (target)
+                {
+                    target.SetLength(length);
+                }
+
+                ConcurrentQueue<FetchRange> ranges = new ConcurrentQueue<FetchRange>();
+                for (long offset = first.End; offset < length; offset += this.rangeSize)
+                {
+                    ranges.Enqueue(new FetchRange(offset, Math.Min(offset + this.rangeSize, length)));
+                }
+
+                HttpFetchProvider.Logger.Debug("Fetching {0} bytes from {1} in {2} ranges.", length, source, ranges.Count + 1);
+
+                // The first range is already being downloaded, so its worker picks up the next range, once it's done.
+                List<Task> workers = new List<Task> { this.FetchRangesAsync(source, target, firstTask, ranges, cancellation) };
+                workers.AddRange(Enumerable.Range(1, Math.Min(this.parallelism, ranges.Count + 1) - 1).Select(i => this.FetchRangesAsync(source, target, Task.CompletedTask, ranges, cancellation)));
+
+                await Task.WhenAll(workers).ConfigureAwait(false);
+                return length;
+            }
+        }
+
+        /// <summary>
+        /// Checks whether the <paramref name="exception"/> given is caused by a transient failure, so the request can be retried.
+        /// </summary>
+        /// <param name="exception">Exception to check.</param>
+        /// <param name="token">Cancellation token of the fetch.</param>
+        /// <returns><see langword="true"/>, if the request can be retried.</returns>
+        private static bool IsTransient(Exception exception, CancellationToken token)
+        {
+            // 'HttpClient' reports the connection failures as cancellations, if they are not caused by the token.
+            return exception is HttpRequestException
+                || exception is IOException
+                || (exception is TaskCanceledException && !token.IsCancellationRequested);
+        }
+
+        /// <summary>
+        /// Checks whether the request failed with the <paramref name="statusCode"/> given can be retried.
+        /// </summary>
+        /// <param name="statusCode">Response status code.</param>
+        /// <returns><see langword="true"/>, if the server may succeed later.</returns>
+        private static bool IsTransient(HttpStatusCode statusCode)
+        {
+            return (int)statusCode >= 500 || statusCode == HttpStatusCode.RequestTimeout || (int)statusCode == 429;
+        }
+
+        /// <summary>
+        /// Downloads the ranges from the <paramref name="ranges"/> queue one by one, until it's empty.
+        /// </summary>
+        /// <param name="source">Source file URI.</param>
+        /// <param name="target">Stream to write the content to.</param>
+        /// <param name="previous">Task to wait for, before the first range is dequeued.</param>
+        /// <param name="ranges">Ranges left to download.</param>
+        /// <param name="cancellation">Cancellation source, that is signaled, if any of the ranges fail.</param>
+        /// <returns>Task that completes, once the queue is empty.</returns>
+        private async Task FetchRangesAsync(Uri source, Stream target, Task previous, ConcurrentQueue<FetchRange> ranges, CancellationTokenSource cancellation)
+        {
+            try
+            {
+                await previous.ConfigureAwait(false);
+
+                FetchRange range;
+                while (ranges.TryDequeue(out range))
+                {
+                    await this.FetchRangeAsync(source, target, range, null, cancellation.Token).ConfigureAwait(false);
+                }
+            }
+            catch
+            {
+                // The file can't be completed anyway, so the other ranges are not needed.
+                cancellation.Cancel();
+                throw;
+            }
+        }
+
+        /// <summary>
+        /// Downloads the <paramref name="range"/> given, resuming it from the last written byte on failure.
+        /// </summary>
+        /// <param name="source">Source file URI.</param>
+        /// <param name="target">Stream to write the content to.</param>
+        /// <param name="range">Range to download. Its offset is advanced, as the content is written.</param>
+        /// <param name="contentLength">
+        /// Receives the file length, once the first response is received, or <c>-1</c>, if the server doesn't support ranges.
+        /// Only set for the first range of the file.
+        /// </param>
+        /// <param name="token">Cancellation token.</param>
+        /// <returns>Task that completes, once the whole range is written.</returns>
+        private async Task FetchRangeAsync(Uri source, Stream target, FetchRange range, TaskCompletionSource<long> contentLength, CancellationToken token)
+        {
+            int failures = 0;
+
+            while (true)
+            {
+                long offset = range.Offset;
+
+                try
+                {
+                    if (await this.SendRangeRequestAsync(source, target, range, contentLength, token).ConfigureAwait(false))
+                    {
+                        return;
+                    }
+
+                    // Server can't serve this range, so it's requested differently at once.
+                    continue;
+                }
+                catch (Exception e) when (HttpFetchProvider.IsTransient(e, token))
+                {
+                    // Only the failures in a row are counted, so a long range over a flaky link is not abandoned.
+                    failures = range.Offset > offset ? 1 : failures + 1;
+                    if (failures > this.retryCount)
+                    {
+                        throw;
+                    }
+
+                    HttpFetchProvider.Logger.Warn(e, "Range {0}-{1} of {2} failed, resuming from {3}.", range.Start, range.End, source, range.Offset);
+                }
+
+                await Task.Delay(TimeSpan.FromTicks(this.retryDelay.Ticks << Math.Min(failures - 1, 16)), token).ConfigureAwait(false);
+            }
+        }
+
+        /// <summary>
+        /// Sends a single request for the rest of the <paramref name="range"/> and writes the response content.
+        /// </summary>
+        /// <param name="source">Source file URI.</param>
+        /// <param name="target">Stream to write the content to.</param>
+        /// <param name="range">Range to download. Its offset is advanced, as the content is written.</param>
+        /// <param name="contentLength">Receives the file length, once the response is received. Optional.</param>
+        /// <param name="token">Cancellation token.</param>
+        /// <returns>
+        /// Task that returns <see langword="true"/>, once the response content is written,
+        /// or <see langword="false"/>, if the request should be resent for the whole file.
+        /// </returns>
+        /// <exception cref="HttpRequestException">Server failed the request.</exception>
+        /// <exception cref="IOException">Connection was closed before the whole range was received.</exception>
+        /// <exception cref="InvalidDataException">Server returned the content for a different range.</exception>
+        private async Task<bool> SendRangeRequestAsync(Uri source, Stream target, FetchRange range, TaskCompletionSource<long> contentLength, CancellationToken token)
+        {
+            using (HttpRequestMessage request = this.CreateRequest(source))
+            {
+                if (range.End >= 0)
+                {
+                    request.Headers.Range = new RangeHeaderValue(range.Offset, range.End - 1);
+                }
+                else if (range.Offset > 0)
+                {
+                    request.Headers.Range = new RangeHeaderValue(range.Offset, null);
+                }
+
+                using (HttpResponseMessage response = await this.client.SendAsync(request, HttpCompletionOption.ResponseHeadersRead, token).ConfigureAwait(false))
+                {
+                    if (!response.IsSuccessStatusCode)
+                    {
+                        string message = $"Request for {source} failed with {(int)response.StatusCode} ({response.ReasonPhrase}).";
+                        if (HttpFetchProvider.IsTransient(response.StatusCode))
+                        {
+                            throw new HttpRequestException(message);
+                        }
+
+                        throw new WebException(message, WebExceptionStatus.ProtocolError);
+                    }
+
+                    // The first response of the file decides, whether it's downloaded in ranges.
+                    bool firstResponse                   = contentLength != null && !contentLength.Task.IsCompleted;
+                    ContentRangeHeaderValue contentRange = response.Content.Headers.ContentRange;
+
+                    if (response.StatusCode == HttpStatusCode.PartialContent && contentRange?.From == range.Offset)
+                    {
+                        if (firstResponse && contentRange.Length.HasValue)
+                        {
+                            range.End = range.End >= 0 ? Math.Min(range.End, contentRange.Length.Value) : contentRange.Length.Value;
+                            contentLength.TrySetResult(contentRange.Length.Value);
+                        }
+                        else if (firstResponse)
+                        {
+                            // File length is unknown, so it can't be split, and it's downloaded with a single request.
+                            range.End = -1;
+                            contentLength.TrySetResult(-1);
+                            return false;
+                        }
+                    }
+                    else if (range.Start == 0 && contentLength != null && (firstResponse || contentLength.Task.Result < 0))
+                    {
+                        // Server ignored the range, so the whole file is received. Previous progress is lost.
+                        range.Offset = 0;
+                        range.End    = -1;
+                        contentLength.TrySetResult(-1);
+                    }
+                    else
+                    {
+                        throw new InvalidDataException($"Server returned content for a different range of {source}.");
+                    }
+
+                    using (Stream content = await response.Content.ReadAsStreamAsync().ConfigureAwait(false))
+                    {
+                        await HttpFetchProvider.CopyRangeAsync(content, target, range, token).ConfigureAwait(false);
+                    }
+
+                    return true;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Copies the response <paramref name="content"/> to the <paramref name="target"/> stream at the <paramref name="range"/> offset.
+        /// </summary>
+        /// <param name="content">Response content stream.</param>
+        /// <param name="target">Stream to write the content to.</param>
+        /// <param name="range">Range being downloaded. Its offset is advanced after each write.</param>
+        /// <param name="token">Cancellation token.</param>
+        /// <returns>Task that completes, once the content is written.</returns>
+        /// <exception cref="IOException">Content ended before the whole range was received.</exception>
+        private static async Task CopyRangeAsync(Stream content, Stream target, FetchRange range, CancellationToken token)
+        {
+            byte[] buffer = new byte[HttpFetchProvider.BufferSize];
+
+            while (range.End < 0 || range.Offset < range.End)
+            {
+                int toRead    = range.End < 0 ? buffer.Length : (int)Math.Min(buffer.Length, range.End - range.Offset);
+                int bytesRead = await content.ReadAsync(buffer, 0, toRead, token).ConfigureAwait(false);
+                if (bytesRead == 0)
+                {
+                    if (range.End < 0)
+                    {
+                        return;
+                    }
+
+                    throw new IOException($"Connection closed at {range.Offset}, before the range end {range.End} was received.");
+                }
+
+                // Ranges share the target stream, so the position and the write should not be interleaved.
+                lock (target)
+                {
+                    if (target.CanSeek)
+                    {
+                        target.Position = range.Offset;
+                    }
+
+                    target.Write(buffer, 0, bytesRead);
+                }
+
+                range.Offset += bytesRead;
+            }
+        }
+
+        #endregion // Private methods
+
+        #region Nested types
+
+        /// <summary>
+        /// Contains the state of a single range download.
+        /// </summary>
+        private sealed class FetchRange
+        {
+            /// <summary>
+            /// Initializes a new instance of the <see cref="FetchRange"/> class.
+            /// </summary>
+            /// <param name="start">Offset of the first byte of the range.</param>
+            /// <param name="end">Offset right after the last byte of the range, or <c>-1</c>, if the range lasts till the end of file.</param>
+            public FetchRange(long start, long end)
+            {
+                this.Start  = start;
+                this.Offset = start;
+                this.End    = end;
+            }
+
+            /// <summary>
+            /// Gets the offset of the first byte of the range.
+            /// </summary>
+            public long Start { get; }
+
+            /// <summary>
+            /// Gets or sets the offset of the next byte to be written.
+            /// </summary>
+            public long Offset { get; set; }
+
+            /// <summary>
+            /// Gets or sets the offset right after the last byte of the range, or <c>-1</c>, if the range lasts till the end of file.
+            /// </summary>
+            public long End { get; set; }
+        }
+
+        #endregion // Nested types
+    }
+}
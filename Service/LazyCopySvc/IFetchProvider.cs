@@ -0,0 +1,59 @@
+﻿// --------------------------------------------------------------------------------------------------------------------
+// <copyright file="IFetchProvider.cs">
+//   The MIT License (MIT)
+//   Copyright (c) 2015 Aleksey Kabanov
+// </copyright>
+// <summary>
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to deal
+//   in the Software without restriction, including without limitation the rights
+//   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//   copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be included in
+//   all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//   THE SOFTWARE.
+// </summary>
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace LazyCopy.Service
+{
+    using System;
+    using System.Collections.Generic;
+    using System.IO;
+    using System.Threading;
+    using System.Threading.Tasks;
+
+    /// <summary>
+    /// Fetches the remote file content for the URI schemes the driver can't access itself.
+    /// </summary>
+    public interface IFetchProvider
+    {
+        /// <summary>
+        /// Gets the URI schemes this provider fetches.
+        /// </summary>
+        IEnumerable<string> Schemes { get; }
+
+        /// <summary>
+        /// Gets the throughput and latency metrics of this provider.
+        /// </summary>
+        FetchProviderMetrics Metrics { get; }
+
+        /// <summary>
+        /// Downloads the <paramref name="source"/> file to the <paramref name="target"/> stream.
+        /// </summary>
+        /// <param name="source">Source file URI.</param>
+        /// <param name="target">Stream to write the content to, starting from its beginning.</param>
+        /// <param name="token">Cancellation token.</param>
+        /// <returns>Task that returns the amount of bytes written to the <paramref name="target"/>.</returns>
+        Task<long> FetchAsync(Uri source, Stream target, CancellationToken token);
+    }
+}
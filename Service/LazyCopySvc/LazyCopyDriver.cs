@@ -29,15 +29,16 @@ namespace LazyCopy.Service
     using System;
     using System.IO;
     using System.Linq;
-    using System.Net;
     using System.Runtime.InteropServices;
     using System.Security.Principal;
     using System.Threading;
+    using System.Threading.Tasks;
 
     using LazyCopy.DriverClient;
     using LazyCopy.DriverClientLibrary;
     using LazyCopy.Service.Properties;
     using LazyCopy.Utilities;
+    using Microsoft.Win32.SafeHandles;
     using NLog;
 
     /// <summary>
@@ -48,6 +49,11 @@ namespace LazyCopy.Service
     {
         #region Fields
 
+        /// <summary>
+        /// Size of the buffer used to stream the fetched content to the target file.
+        /// </summary>
+        private const int FetchBufferSize = 256 * 1024;
+
         /// <summary>
         /// Logger instance.
         /// </summary>
@@ -73,6 +79,21 @@ namespace LazyCopy.Service
         /// </summary>
         private readonly ThreadLocal<WindowsImpersonationContext> impersonationContext = new ThreadLocal<WindowsImpersonationContext>();
 
+        /// <summary>
+        /// Periodically drains the file access records from the driver.
+        /// </summary>
+        private readonly Timer fileAccessDrainTimer;
+
+        /// <summary>
+        /// Providers fetching the remote files, keyed by the URI scheme.
+        /// </summary>
+        private readonly FetchProviderRegistry fetchProviders = new FetchProviderRegistry();
+
+        /// <summary>
+        /// Periodically logs the fetch provider metrics.
+        /// </summary>
+        private readonly Timer fetchMetricsTimer;
+
         #endregion // Fields
 
         #region Constructor
@@ -85,11 +106,30 @@ namespace LazyCopy.Service
             // First, load the driver.
             FltmcManager.Instance.LoadFilter(Settings.Default.DriverName);
 
-            // And connect to it.
-            this.driverClient = new LazyCopyDriverClient();
-            this.driverClient.OpenFileInUserModeHandler  += this.OpenFileInUserModeHandler;
-            this.driverClient.CloseFileHandleHandler     += this.CloseFileHandleHandler;
-            this.driverClient.FetchFileInUserModeHandler += this.FetchFileInUserModeHandler;
+            LazyCopyDriver.RegisterFetchProviders(this.fetchProviders);
+
+            // And connect to it. Notifications are distributed between the connections,
+            // so a connection closed doesn't lose the ones in flight. Open requests get their own
+            // connections and threads, so they are not stuck behind the file fetches.
+            this.driverClient = new LazyCopyDriverClient(
+                LazyCopyDriverClient.DefaultPortName,
+                Settings.Default.DriverConnectionCount,
+                Settings.Default.LatencyLaneThreadCount,
+                Settings.Default.BulkLaneThreadCount,
+                Settings.Default.BulkLaneReceiveCount);
+            this.driverClient.OpenFileInUserModeHandler       += this.OpenFileInUserModeHandler;
+            this.driverClient.CloseFileHandleHandler          += this.CloseFileHandleHandler;
+            this.driverClient.FetchFileInUserModeAsyncHandler += this.FetchFileInUserModeHandlerAsync;
+
+            // Receive the notifications via the shared ring, so they don't need to be copied through the port one by one.
+            this.driverClient.EnableNotificationRing();
+
+            this.fileAccessDrainTimer = new Timer(this.DrainFileAccesses, null, Timeout.Infinite, Timeout.Infinite);
+
+            if (Settings.Default.FetchMetricsInterval > TimeSpan.Zero)
+            {
+                this.fetchMetricsTimer = new Timer(this.LogFetchMetrics, null, Settings.Default.FetchMetricsInterval, Settings.Default.FetchMetricsInterval);
+            }
         }
 
         #endregion // Constructor
@@ -117,9 +157,23 @@ namespace LazyCopy.Service
 
                 LazyCopyDriver.Logger.Debug("Updating driver settings...");
 
-                this.driverClient.SetWatchPaths(configuration.WatchPaths.ToArray());
-                this.driverClient.SetReportRate(configuration.ReportRate);
-                this.driverClient.SetOperationStatus(configuration.OperationMode);
+                // All settings are applied at once, so the driver never runs with the partially updated configuration.
+                // Volume policy is not managed by the service, so the current one is kept.
+                this.driverClient.ApplyConfiguration(
+                    configuration.OperationMode,
+                    configuration.ReportRate,
+                    configuration.WatchPaths.Select(path => new WatchPathRule { Path = path, ReportRate = LazyCopyDriverClient.GlobalReportRate }),
+                    null);
+
+                // Drain the file access records periodically, if the driver aggregates them.
+                if (configuration.FileAccessDrainInterval > TimeSpan.Zero)
+                {
+                    this.fileAccessDrainTimer.Change(configuration.FileAccessDrainInterval, configuration.FileAccessDrainInterval);
+                }
+                else
+                {
+                    this.fileAccessDrainTimer.Change(Timeout.Infinite, Timeout.Infinite);
+                }
 
                 LazyCopyDriver.Logger.Debug("Finished configuring driver.");
             }
@@ -141,9 +195,105 @@ namespace LazyCopy.Service
                 OperationMode = OperationMode.FetchEnabled
             };
 
+            if (configuration.FileAccessDrainInterval > TimeSpan.Zero)
+            {
+                configuration.OperationMode |= OperationMode.AggregateAccesses;
+            }
+
             return configuration;
         }
 
+        /// <summary>
+        /// Creates the fetch providers using the current settings and adds them to the <paramref name="registry"/>.
+        /// </summary>
+        /// <param name="registry">Registry to add the providers to.</param>
+        private static void RegisterFetchProviders(FetchProviderRegistry registry)
+        {
+            // Every bulk lane notification may fetch a file at once, and each of them uses several connections.
+            int connectionLimit = Settings.Default.FetchParallelism * Settings.Default.BulkLaneReceiveCount * Settings.Default.DriverConnectionCount;
+
+            HttpFetchProvider httpProvider = new HttpFetchProvider(
+                Settings.Default.FetchRangeSize,
+                Settings.Default.FetchParallelism,
+                Settings.Default.FetchRetryCount,
+                Settings.Default.FetchRetryDelay,
+                connectionLimit);
+
+            if (!string.IsNullOrEmpty(Settings.Default.FetchBatchPath))
+            {
+                httpProvider.BatchFetcher = new HttpBatchFetcher(Settings.Default.FetchBatchPath, Settings.Default.FetchBatchSize, Settings.Default.FetchBatchWindow);
+            }
+
+            registry.Register(httpProvider);
+
+            // Credentials are taken from the standard environment variables, if they are not configured.
+            string accessKey = !string.IsNullOrEmpty(Settings.Default.S3AccessKey) ? Settings.Default.S3AccessKey : Environment.GetEnvironmentVariable("AWS_ACCESS_KEY_ID");
+            string secretKey = !string.IsNullOrEmpty(Settings.Default.S3SecretKey) ? Settings.Default.S3SecretKey : Environment.GetEnvironmentVariable("AWS_SECRET_ACCESS_KEY");
+
+            registry.Register(new S3FetchProvider(
+                new Uri(Settings.Default.S3Endpoint),
+                Settings.Default.S3Region,
+                accessKey,
+                secretKey,
+                Settings.Default.FetchRangeSize,
+                Settings.Default.FetchParallelism,
+                Settings.Default.FetchRetryCount,
+                Settings.Default.FetchRetryDelay,
+                connectionLimit));
+        }
+
+        /// <summary>
+        /// Logs the throughput and latency metrics of each fetch provider.
+        /// </summary>
+        /// <param name="state">Timer state. Not used.</param>
+        private void LogFetchMetrics(object state)
+        {
+            foreach (IFetchProvider provider in this.fetchProviders.Providers)
+            {
+                LazyCopyDriver.Logger.Info("{0} ({1}): {2}", provider.GetType().Name, string.Join(", ", provider.Schemes), provider.Metrics);
+            }
+        }
+
+        /// <summary>
+        /// Drains all file access records collected by the driver and logs them.
+        /// </summary>
+        /// <param name="state">Timer state. Not used.</param>
+        private void DrainFileAccesses(object state)
+        {
+            try
+            {
+                FileAccessBatch batch;
+
+                do
+                {
+                    lock (this.syncRoot)
+                    {
+                        batch = this.driverClient.DrainFileAccesses();
+                    }
+
+                    if (batch.DroppedCount > 0)
+                    {
+                        LazyCopyDriver.Logger.Warn("Driver dropped {0} file accesses, because its table was full.", batch.DroppedCount);
+                    }
+
+                    foreach (FileAccessRecord record in batch.Records)
+                    {
+                        LazyCopyDriver.Logger.Debug(
+                            "File accessed {0} time(s) between {1:o} and {2:o}: {3}",
+                            record.AccessCount,
+                            record.FirstAccessTime,
+                            record.LastAccessTime,
+                            record.Path);
+                    }
+                }
+                while (batch.RemainingCount > 0 && batch.Records.Count > 0);
+            }
+            catch (Exception e)
+            {
+                LazyCopyDriver.Logger.Error(e, "Unable to drain file accesses from the driver.");
+            }
+        }
+
         /// <summary>
         /// Opens the file given.
         /// </summary>
@@ -185,22 +335,42 @@ namespace LazyCopy.Service
         /// Downloads the remote file given.
         /// </summary>
         /// <param name="notification">Driver notification.</param>
-        private FetchFileInUserModeNotificationReply FetchFileInUserModeHandler(FetchFileInUserModeNotification notification)
+        /// <returns>Task that returns the reply containing the amount of bytes written to the target file.</returns>
+        /// <remarks>
+        /// If the driver provides the target file handle, the content is streamed directly into it,
+        /// so the file is not reopened and the writes are not filtered by the driver again.<br/>
+        /// The file is fetched by the provider registered for the source URI scheme.
+        /// </remarks>
+        /// <exception cref="NotSupportedException">No provider is registered for the source URI scheme.</exception>
+        private async Task<FetchFileInUserModeNotificationReply> FetchFileInUserModeHandlerAsync(FetchFileInUserModeNotification notification)
         {
-            this.ImpersonateCurrentThread();
+            // The handle is owned by the service, so it's closed, when the fetch is finished, even if the driver has stopped waiting for it.
+            using (SafeFileHandle targetHandle = new SafeFileHandle(notification.TargetHandle, true))
+            {
+                this.ImpersonateCurrentThread();
 
-            string sourceFile = notification.SourceFile;
-            string targetFile = PathHelper.ChangeDeviceNameToDriveLetter(notification.TargetFile);
+                Uri source;
+                IFetchProvider provider;
+                if (!Uri.TryCreate(notification.SourceFile, UriKind.Absolute, out source) || !this.fetchProviders.TryGetProvider(source, out provider))
+                {
+                    // The driver fails the file access with the error returned, instead of leaving the file empty.
+                    throw new NotSupportedException($"No fetch provider is registered for: {notification.SourceFile}");
+                }
 
-            if (sourceFile.StartsWith("http://", StringComparison.OrdinalIgnoreCase) || sourceFile.StartsWith("https://", StringComparison.OrdinalIgnoreCase))
-            {
-                using (WebClient client = new WebClient())
+                // Without the handle from the driver, the target file is opened by its path.
+                using (FileStream target = targetHandle.IsInvalid
+                    ? new FileStream(PathHelper.ChangeDeviceNameToDriveLetter(notification.TargetFile), FileMode.OpenOrCreate, FileAccess.Write, FileShare.ReadWrite | FileShare.Delete, LazyCopyDriver.FetchBufferSize)
+                    : new FileStream(targetHandle, FileAccess.Write, LazyCopyDriver.FetchBufferSize))
                 {
-                    client.DownloadFile(sourceFile, targetFile);
+                    long bytesCopied = await provider.FetchAsync(source, target, CancellationToken.None).ConfigureAwait(false);
+
+                    // Remove the stale content, if the file was larger.
+                    target.SetLength(bytesCopied);
+                    target.Flush();
+
+                    return new FetchFileInUserModeNotificationReply { BytesCopied = bytesCopied };
                 }
             }
-
-            return new FetchFileInUserModeNotificationReply { BytesCopied = 404 };
         }
 
         /// <summary>
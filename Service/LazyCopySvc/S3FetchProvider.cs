@@ -0,0 +1,236 @@
+﻿// --------------------------------------------------------------------------------------------------------------------
+// <copyright file="S3FetchProvider.cs">
+//   The MIT License (MIT)
+//   Copyright (c) 2015 Aleksey Kabanov
+// </copyright>
+// <summary>
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to deal
+//   in the Software without restriction, including without limitation the rights
+//   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//   copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be included in
+//   all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//   THE SOFTWARE.
+// </summary>
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace LazyCopy.Service
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Globalization;
+    using System.Linq;
+    using System.Net.Http;
+    using System.Security.Cryptography;
+    using System.Text;
+
+    /// <summary>
+    /// Downloads the files from the S3-compatible object stores.
+    /// </summary>
+    /// <remarks>
+    /// Source files are given as <c>s3://bucket/key</c> URIs, and requested from the configured endpoint
+    /// using the path-style addressing, so any S3-compatible store can be used.<br/>
+    /// Requests are signed with the AWS Signature Version 4, if the credentials are given.
+    /// Otherwise, they are anonymous, and only the public objects can be fetched.
+    /// </remarks>
+    public sealed class S3FetchProvider : HttpFetchProvider
+    {
+        #region Fields
+
+        /// <summary>
+        /// URI scheme this provider fetches.
+        /// </summary>
+        public const string UriSchemeS3 = "s3";
+
+        /// <summary>
+        /// Signing algorithm name.
+        /// </summary>
+        private const string Algorithm = "AWS4-HMAC-SHA256";
+
+        /// <summary>
+        /// Headers included into the signature.
+        /// </summary>
+        private const string SignedHeaders = "host;x-amz-content-sha256;x-amz-date";
+
+        /// <summary>
+        /// SHA-256 hash of the empty request body.
+        /// </summary>
+        private const string EmptyPayloadHash = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+
+        /// <summary>
+        /// Object store endpoint, for example, <c>https://s3.amazonaws.com</c>.
+        /// </summary>
+        private readonly Uri endpoint;
+
+        /// <summary>
+        /// Region the requests are signed for.
+        /// </summary>
+        private readonly string region;
+
+        /// <summary>
+        /// Access key ID, or <see langword="null"/>, if the requests are anonymous.
+        /// </summary>
+        private readonly string accessKey;
+
+        /// <summary>
+        /// Secret access key.
+        /// </summary>
+        private readonly string secretKey;
+
+        #endregion // Fields
+
+        #region Constructor
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="S3FetchProvider"/> class.
+        /// </summary>
+        /// <param name="endpoint">Object store endpoint, for example, <c>https://s3.amazonaws.com</c>.</param>
+        /// <param name="region">Region the requests are signed for.</param>
+        /// <param name="accessKey">Access key ID. If <see langword="null"/> or empty, the requests are anonymous.</param>
+        /// <param name="secretKey">Secret access key.</param>
+        /// <param name="rangeSize">Size of a single range request, in bytes.</param>
+        /// <param name="parallelism">Maximum amount of ranges of a single file downloaded at once.</param>
+        /// <param name="retryCount">Amount of times a range is retried, if it doesn't make any progress.</param>
+        /// <param name="retryDelay">Delay before the first retry. It's doubled on each subsequent one.</param>
+        /// <param name="connectionLimit">Maximum amount of concurrent connections to a single server.</param>
+        /// <exception cref="ArgumentNullException"><paramref name="endpoint"/> or <paramref name="region"/> is <see langword="null"/>.</exception>
+        /// <exception cref="ArgumentException"><paramref name="endpoint"/> is not an absolute HTTP or HTTPS URI.</exception>
+        /// <exception cref="ArgumentOutOfRangeException">Any of the fetch parameters is invalid.</exception>
+        public S3FetchProvider(Uri endpoint, string region, string accessKey, string secretKey, long rangeSize, int parallelism, int retryCount, TimeSpan retryDelay, int connectionLimit)
+            : base(rangeSize, parallelism, retryCount, retryDelay, connectionLimit)
+        {
+            if (endpoint == null)
+            {
+                throw new ArgumentNullException(nameof(endpoint));
+            }
+
+            if (!endpoint.IsAbsoluteUri || (endpoint.Scheme != Uri.UriSchemeHttp && endpoint.Scheme != Uri.UriSchemeHttps))
+            {
+                throw new ArgumentException($"Endpoint should be an HTTP or HTTPS URI: {endpoint}", nameof(endpoint));
+            }
+
+            if (string.IsNullOrEmpty(region))
+            {
+                throw new ArgumentNullException(nameof(region));
+            }
+
+            this.endpoint  = endpoint;
+            this.region    = region;
+            this.accessKey = string.IsNullOrEmpty(accessKey) ? null : accessKey;
+            this.secretKey = secretKey ?? string.Empty;
+        }
+
+        #endregion // Constructor
+
+        #region Properties
+
+        /// <summary>
+        /// Gets the URI schemes this provider fetches.
+        /// </summary>
+        public override IEnumerable<string> Schemes => new[] { S3FetchProvider.UriSchemeS3 };
+
+        #endregion // Properties
+
+        #region Protected methods
+
+        /// <summary>
+        /// Creates the signed request for the <paramref name="source"/> object content.
+        /// </summary>
+        /// <param name="source">Source object URI, for example, <c>s3://bucket/key</c>.</param>
+        /// <returns>Request message.</returns>
+        protected override HttpRequestMessage CreateRequest(Uri source)
+        {
+            // Keys are encoded the same way in the request and in the signature. See the AWS Signature Version 4 documentation.
+            string key           = Uri.UnescapeDataString(source.AbsolutePath).TrimStart('/');
+            string canonicalPath = "/" + Uri.EscapeDataString(source.Host) + "/" + string.Join("/", key.Split('/').Select(Uri.EscapeDataString));
+
+            HttpRequestMessage request = new HttpRequestMessage(HttpMethod.Get, new Uri(this.endpoint.GetLeftPart(UriPartial.Authority) + canonicalPath));
+            if (this.accessKey == null)
+            {
+                return request;
+            }
+
+            DateTime now       = DateTime.UtcNow;
+            string   amzDate   = now.ToString("yyyyMMdd'T'HHmmss'Z'", CultureInfo.InvariantCulture);
+            string   dateStamp = now.ToString("yyyyMMdd", CultureInfo.InvariantCulture);
+            string   host      = request.RequestUri.IsDefaultPort ? request.RequestUri.Host : request.RequestUri.Host + ":" + request.RequestUri.Port.ToString(CultureInfo.InvariantCulture);
+            string   scope     = $"{dateStamp}/{this.region}/s3/aws4_request";
+
+            // The 'Range' header is not signed, so the same request can be sent for any range.
+            string canonicalRequest = $"GET\n{canonicalPath}\n\nhost:{host}\nx-amz-content-sha256:{S3FetchProvider.EmptyPayloadHash}\nx-amz-date:{amzDate}\n\n{S3FetchProvider.SignedHeaders}\n{S3FetchProvider.EmptyPayloadHash}";
+            string stringToSign     = $"{S3FetchProvider.Algorithm}\n{amzDate}\n{scope}\n{S3FetchProvider.ToHex(S3FetchProvider.Hash(canonicalRequest))}";
+
+            byte[] signingKey = S3FetchProvider.Sign(Encoding.UTF8.GetBytes("AWS4" + this.secretKey), dateStamp);
+            signingKey        = S3FetchProvider.Sign(signingKey, this.region);
+            signingKey        = S3FetchProvider.Sign(signingKey, "s3");
+            signingKey        = S3FetchProvider.Sign(signingKey, "aws4_request");
+
+            string signature = S3FetchProvider.ToHex(S3FetchProvider.Sign(signingKey, stringToSign));
+
+            request.Headers.TryAddWithoutValidation("x-amz-date", amzDate);
+            request.Headers.TryAddWithoutValidation("x-amz-content-sha256", S3FetchProvider.EmptyPayloadHash);
+            request.Headers.TryAddWithoutValidation("Authorization", $"{S3FetchProvider.Algorithm} Credential={this.accessKey}/{scope}, SignedHeaders={S3FetchProvider.SignedHeaders}, Signature={signature}");
+
+            return request;
+        }
+
+        #endregion // Protected methods
+
+        #region Private methods
+
+        /// <summary>
+        /// Computes the SHA-256 hash of the UTF-8 encoded <paramref name="value"/>.
+        /// </summary>
+        /// <param name="value">Value to hash.</param>
+        /// <returns>Hash computed.</returns>
+        private static byte[] Hash(string value)
+        {
+            using (SHA256 sha = SHA256.Create())
+            {
+                return sha.ComputeHash(Encoding.UTF8.GetBytes(value));
+            }
+        }
+
+        /// <summary>
+        /// Computes the HMAC-SHA256 of the UTF-8 encoded <paramref name="value"/> using the <paramref name="key"/> given.
+        /// </summary>
+        /// <param name="key">Signing key.</param>
+        /// <param name="value">Value to sign.</param>
+        /// <returns>Signature computed.</returns>
+        private static byte[] Sign(byte[] key, string value)
+        {
+            using (HMACSHA256 hmac = new HMACSHA256(key))
+            {
+                return hmac.ComputeHash(Encoding.UTF8.GetBytes(value));
+            }
+        }
+
+        /// <summary>
+        /// Converts the <paramref name="bytes"/> given to the lowercase hexadecimal string.
+        /// </summary>
+        /// <param name="bytes">Bytes to convert.</param>
+        /// <returns>Hexadecimal string.</returns>
+        private static string ToHex(byte[] bytes)
+        {
+            StringBuilder builder = new StringBuilder(bytes.Length * 2);
+            foreach (byte b in bytes)
+            {
+                builder.Append(b.ToString("x2", CultureInfo.InvariantCulture));
+            }
+
+            return builder.ToString();
+        }
+
+        #endregion // Private methods
+    }
+}
@@ -0,0 +1,82 @@
+﻿// --------------------------------------------------------------------------------------------------------------------
+// <copyright file="FetchPhase.cs">
+//   The MIT License (MIT)
+//   Copyright (c) 2015 Aleksey Kabanov
+// </copyright>
+// <summary>
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to deal
+//   in the Software without restriction, including without limitation the rights
+//   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//   copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be included in
+//   all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//   THE SOFTWARE.
+// </summary>
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace LazyCopy.EventTracing
+{
+    /// <summary>
+    /// Phase of the file fetch reported by the <see cref="LazyCopyEventType.FetchPhase"/> event.
+    /// </summary>
+    /// <remarks>
+    /// Values should be in sync with the <c>FETCH_PHASE</c> enumeration in the driver.
+    /// </remarks>
+    public enum FetchPhase
+    {
+        /// <summary>
+        /// Opening the remote file.
+        /// </summary>
+        Open = 0,
+
+        /// <summary>
+        /// Querying the remote file size.
+        /// </summary>
+        SizeQuery = 1,
+
+        /// <summary>
+        /// Reading a single chunk from the remote file.
+        /// </summary>
+        Read = 2,
+
+        /// <summary>
+        /// Writing a single chunk to the local file.
+        /// </summary>
+        Write = 3,
+
+        /// <summary>
+        /// Removing the reparse point from the fetched file.
+        /// </summary>
+        Untag = 4,
+
+        /// <summary>
+        /// Whole fetch, including the ones performed by the user-mode client.
+        /// </summary>
+        Total = 5,
+
+        /// <summary>
+        /// Waiting for another thread fetching the same file.
+        /// </summary>
+        LockWait = 6,
+
+        /// <summary>
+        /// Checking the reparse tag of the file to be fetched.
+        /// </summary>
+        ReparseRead = 7,
+
+        /// <summary>
+        /// Deleting the stream context from the fetched file.
+        /// </summary>
+        ContextDelete = 8
+    }
+}
@@ -0,0 +1,95 @@
+﻿// --------------------------------------------------------------------------------------------------------------------
+// <copyright file="FetchSpan.cs">
+//   The MIT License (MIT)
+//   Copyright (c) 2015 Aleksey Kabanov
+// </copyright>
+// <summary>
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to deal
+//   in the Software without restriction, including without limitation the rights
+//   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//   copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be included in
+//   all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//   THE SOFTWARE.
+// </summary>
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace LazyCopy.EventTracing
+{
+    using System;
+
+    /// <summary>
+    /// Single phase of the file fetch reconstructed from the <see cref="LazyCopyEventType.FetchPhase"/> event.
+    /// </summary>
+    public class FetchSpan
+    {
+        #region Constructor
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="FetchSpan"/> class.
+        /// </summary>
+        /// <param name="eventData">Event data to copy the span values from.</param>
+        /// <exception cref="ArgumentNullException"><paramref name="eventData"/> is <see langword="null"/>.</exception>
+        internal FetchSpan(FetchPhaseEventData eventData)
+        {
+            if (eventData == null)
+            {
+                throw new ArgumentNullException(nameof(eventData));
+            }
+
+            // Event data object is reused by the trace source, so all values should be copied.
+            this.Phase     = eventData.Phase;
+            this.ProcessId = eventData.PhaseProcessId;
+            this.StartTime = eventData.StartTime;
+            this.Duration  = eventData.Duration;
+            this.Bytes     = eventData.Bytes;
+            this.Status    = eventData.Status;
+        }
+
+        #endregion // Constructor
+
+        #region Properties
+
+        /// <summary>
+        /// Gets the fetch phase.
+        /// </summary>
+        public FetchPhase Phase { get; }
+
+        /// <summary>
+        /// Gets the ID of the process, which thread performed the phase.
+        /// </summary>
+        public int ProcessId { get; }
+
+        /// <summary>
+        /// Gets the time the phase was started at.
+        /// </summary>
+        public DateTime StartTime { get; }
+
+        /// <summary>
+        /// Gets the phase duration.
+        /// </summary>
+        public TimeSpan Duration { get; }
+
+        /// <summary>
+        /// Gets the amount of bytes processed during the phase.
+        /// </summary>
+        public long Bytes { get; }
+
+        /// <summary>
+        /// Gets the status the phase was finished with.
+        /// </summary>
+        public uint Status { get; }
+
+        #endregion // Properties
+    }
+}
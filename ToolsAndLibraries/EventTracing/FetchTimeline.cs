@@ -0,0 +1,131 @@
+﻿// --------------------------------------------------------------------------------------------------------------------
+// <copyright file="FetchTimeline.cs">
+//   The MIT License (MIT)
+//   Copyright (c) 2015 Aleksey Kabanov
+// </copyright>
+// <summary>
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to deal
+//   in the Software without restriction, including without limitation the rights
+//   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//   copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be included in
+//   all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//   THE SOFTWARE.
+// </summary>
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace LazyCopy.EventTracing
+{
+    using System;
+    using System.Collections.Generic;
+
+    /// <summary>
+    /// Timeline of a single file fetch reconstructed from the events sharing the same activity ID.
+    /// </summary>
+    public class FetchTimeline
+    {
+        #region Fields
+
+        /// <summary>
+        /// Phases finished during the fetch.
+        /// </summary>
+        private readonly List<FetchSpan> spans = new List<FetchSpan>();
+
+        #endregion // Fields
+
+        #region Constructor
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="FetchTimeline"/> class.
+        /// </summary>
+        /// <param name="activityId">Activity ID of the fetch.</param>
+        /// <param name="processId">ID of the process, which access triggered the fetch.</param>
+        /// <param name="startTime">Time the fetch was started at.</param>
+        internal FetchTimeline(Guid activityId, int processId, DateTime startTime)
+        {
+            this.ActivityId = activityId;
+            this.ProcessId  = processId;
+            this.StartTime  = startTime;
+        }
+
+        #endregion // Constructor
+
+        #region Properties
+
+        /// <summary>
+        /// Gets the activity ID shared by all events of the current fetch.
+        /// </summary>
+        public Guid ActivityId { get; }
+
+        /// <summary>
+        /// Gets the ID of the process, which access triggered the fetch.
+        /// </summary>
+        public int ProcessId { get; }
+
+        /// <summary>
+        /// Gets the time the fetch was started at.
+        /// </summary>
+        public DateTime StartTime { get; }
+
+        /// <summary>
+        /// Gets the time the fetch was finished at.
+        /// </summary>
+        public DateTime StopTime { get; internal set; }
+
+        /// <summary>
+        /// Gets the total fetch duration.
+        /// </summary>
+        public TimeSpan Duration => this.StopTime - this.StartTime;
+
+        /// <summary>
+        /// Gets the path of the local file.
+        /// May be <see langword="null"/>, if the file was already fetched by another thread.
+        /// </summary>
+        public string LocalPath { get; internal set; }
+
+        /// <summary>
+        /// Gets the path of the remote file, or the remote root, if the fetch failed.
+        /// </summary>
+        public string RemotePath { get; internal set; }
+
+        /// <summary>
+        /// Gets the size of the fetched file.
+        /// </summary>
+        public long Size { get; internal set; }
+
+        /// <summary>
+        /// Gets the error code, if the fetch failed, or <see langword="null"/> otherwise.
+        /// </summary>
+        public ulong? FailureStatus { get; internal set; }
+
+        /// <summary>
+        /// Gets the phases finished during the fetch ordered by their completion time.
+        /// </summary>
+        public IReadOnlyList<FetchSpan> Spans => this.spans;
+
+        #endregion // Properties
+
+        #region Internal methods
+
+        /// <summary>
+        /// Adds the <paramref name="span"/> given to the current timeline.
+        /// </summary>
+        /// <param name="span">Span to add.</param>
+        internal void AddSpan(FetchSpan span)
+        {
+            this.spans.Add(span);
+        }
+
+        #endregion // Internal methods
+    }
+}
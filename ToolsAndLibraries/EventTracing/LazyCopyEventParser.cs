@@ -27,6 +27,7 @@
 namespace LazyCopy.EventTracing
 {
     using System;
+    using System.Collections.Generic;
 
     using LazyCopy.Utilities.Extensions;
     using Microsoft.Diagnostics.Tracing;
@@ -48,6 +49,21 @@ namespace LazyCopy.EventTracing
         /// </summary>
         public static readonly Guid ProviderGuid = new Guid("{0FE08EE4-B08F-4D27-8CBB-C816308AE235}");
 
+        /// <summary>
+        /// Name of the file fetch task.
+        /// </summary>
+        private const string FetchTaskName = "File_Fetch";
+
+        /// <summary>
+        /// GUID of the file fetch task.
+        /// </summary>
+        private static readonly Guid FetchTaskGuid = new Guid("{BFDB9F63-0939-4A77-9382-2F31705D5DBA}");
+
+        /// <summary>
+        /// Timelines of the fetches, which were started but not stopped yet, keyed by their activity IDs.
+        /// </summary>
+        private readonly Dictionary<Guid, FetchTimeline> activeFetches = new Dictionary<Guid, FetchTimeline>();
+
         #endregion // Fields
 
         #region Constructor
@@ -69,6 +85,10 @@ namespace LazyCopy.EventTracing
             this.source.RegisterEventTemplate(new FileAccessedEventData(this.InvokeFileAccessed,     (int)LazyCopyEventType.FileAccessed,   0, null, Guid.Empty, 0, null, LazyCopyEventParser.ProviderGuid, LazyCopyEventParser.ProviderName));
             this.source.RegisterEventTemplate(new FileFetchedEventData(this.InvokeFileFetched,       (int)LazyCopyEventType.FileFetched,    0, null, Guid.Empty, 0, null, LazyCopyEventParser.ProviderGuid, LazyCopyEventParser.ProviderName));
             this.source.RegisterEventTemplate(new FileNotFetchedEventData(this.InvokeFileNotFetched, (int)LazyCopyEventType.FileNotFetched, 0, null, Guid.Empty, 0, null, LazyCopyEventParser.ProviderGuid, LazyCopyEventParser.ProviderName));
+
+            this.source.RegisterEventTemplate(new FetchActivityEventData(this.InvokeFetchStarted, (int)LazyCopyEventType.FetchStarted, 1, LazyCopyEventParser.FetchTaskName, LazyCopyEventParser.FetchTaskGuid, 1, "Start", LazyCopyEventParser.ProviderGuid, LazyCopyEventParser.ProviderName));
+            this.source.RegisterEventTemplate(new FetchActivityEventData(this.InvokeFetchStopped, (int)LazyCopyEventType.FetchStopped, 1, LazyCopyEventParser.FetchTaskName, LazyCopyEventParser.FetchTaskGuid, 2, "Stop",  LazyCopyEventParser.ProviderGuid, LazyCopyEventParser.ProviderName));
+            this.source.RegisterEventTemplate(new FetchPhaseEventData(this.InvokeFetchPhase,      (int)LazyCopyEventType.FetchPhase,   1, LazyCopyEventParser.FetchTaskName, LazyCopyEventParser.FetchTaskGuid, 0, "Info",  LazyCopyEventParser.ProviderGuid, LazyCopyEventParser.ProviderName));
         }
 
         #endregion // Constructor
@@ -96,6 +116,21 @@ namespace LazyCopy.EventTracing
         [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Naming", "CA1710:IdentifiersShouldHaveCorrectSuffix", Justification = "The current name is desired.")]
         public event EventHandler<FileNotFetchedEventData> FileNotFetched;
 
+        /// <summary>
+        /// Occurs when a <see cref="LazyCopyEventType.FetchPhase"/> event is found in the source.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1009:DeclareEventHandlersCorrectly",      Justification = "The current declaration is desired.")]
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Naming", "CA1710:IdentifiersShouldHaveCorrectSuffix", Justification = "The current name is desired.")]
+        public event EventHandler<FetchPhaseEventData> FetchPhaseFinished;
+
+        /// <summary>
+        /// Occurs when a <see cref="LazyCopyEventType.FetchStopped"/> event is found in the source,
+        /// and the timeline of the whole fetch is reconstructed.
+        /// </summary>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Design", "CA1009:DeclareEventHandlersCorrectly",      Justification = "The current declaration is desired.")]
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Naming", "CA1710:IdentifiersShouldHaveCorrectSuffix", Justification = "The current name is desired.")]
+        public event EventHandler<FetchTimeline> FetchCompleted;
+
         #endregion // Events
 
         #region Protected methods
@@ -138,6 +173,14 @@ namespace LazyCopy.EventTracing
         /// <param name="eventData">Event data.</param>
         private void InvokeFileFetched(FileFetchedEventData eventData)
         {
+            FetchTimeline timeline;
+            if (this.activeFetches.TryGetValue(eventData.ActivityID, out timeline))
+            {
+                timeline.LocalPath  = eventData.LocalPath;
+                timeline.RemotePath = eventData.RemotePath;
+                timeline.Size       = eventData.Size;
+            }
+
             this.FileFetched.Notify(this, eventData);
         }
 
@@ -147,9 +190,65 @@ namespace LazyCopy.EventTracing
         /// <param name="eventData">Event data.</param>
         private void InvokeFileNotFetched(FileNotFetchedEventData eventData)
         {
+            FetchTimeline timeline;
+            if (this.activeFetches.TryGetValue(eventData.ActivityID, out timeline))
+            {
+                timeline.LocalPath     = eventData.Path;
+                timeline.RemotePath    = eventData.RemoteRoot;
+                timeline.FailureStatus = eventData.Status;
+            }
+
             this.FileNotFetched.Notify(this, eventData);
         }
 
+        /// <summary>
+        /// Starts a new fetch timeline for the activity of the event given.
+        /// </summary>
+        /// <param name="eventData">Event data.</param>
+        private void InvokeFetchStarted(FetchActivityEventData eventData)
+        {
+            // Events written without the activity ID can't be correlated.
+            if (eventData.ActivityID == Guid.Empty)
+            {
+                return;
+            }
+
+            this.activeFetches[eventData.ActivityID] = new FetchTimeline(eventData.ActivityID, eventData.ProcessID, eventData.TimeStamp);
+        }
+
+        /// <summary>
+        /// Completes the fetch timeline and invokes the <see cref="FetchCompleted"/> handlers, if any.
+        /// </summary>
+        /// <param name="eventData">Event data.</param>
+        private void InvokeFetchStopped(FetchActivityEventData eventData)
+        {
+            FetchTimeline timeline;
+            if (!this.activeFetches.TryGetValue(eventData.ActivityID, out timeline))
+            {
+                return;
+            }
+
+            this.activeFetches.Remove(eventData.ActivityID);
+            timeline.StopTime = eventData.TimeStamp;
+
+            this.FetchCompleted.Notify(this, timeline);
+        }
+
+        /// <summary>
+        /// Adds the phase to the fetch timeline and invokes the <see cref="FetchPhaseFinished"/> handlers, if any.
+        /// </summary>
+        /// <param name="eventData">Event data.</param>
+        private void InvokeFetchPhase(FetchPhaseEventData eventData)
+        {
+            FetchTimeline timeline;
+            if (this.activeFetches.TryGetValue(eventData.ActivityID, out timeline))
+            {
+                timeline.AddSpan(new FetchSpan(eventData));
+            }
+
+            this.FetchPhaseFinished.Notify(this, eventData);
+        }
+
         #endregion // Private methods
     }
 }
@@ -49,6 +49,21 @@ namespace LazyCopy.EventTracing
         /// <summary>
         /// File was not fetched (error occurred).
         /// </summary>
-        FileNotFetched = 3
+        FileNotFetched = 3,
+
+        /// <summary>
+        /// File fetch was started.
+        /// </summary>
+        FetchStarted = 100,
+
+        /// <summary>
+        /// File fetch was finished, either successfully or not.
+        /// </summary>
+        FetchStopped = 101,
+
+        /// <summary>
+        /// Single phase of the file fetch was finished.
+        /// </summary>
+        FetchPhase = 108
     }
 }
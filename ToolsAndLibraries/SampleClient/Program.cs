@@ -27,6 +27,8 @@
 namespace SampleClient
 {
     using System;
+    using System.Globalization;
+    using System.Threading;
 
     using LazyCopy.DriverClient;
     using LongPath;
@@ -37,10 +39,20 @@ namespace SampleClient
         /// This sample application accepts two input parameters:
         /// * source file - file with actual data which content should be copied to the target file, when it's opened.
         /// * target file - empty file to be created. When this file is opened, its contents are downloaded from the source file.
+        ///
+        /// If the first parameter is <c>/fetches</c>, it prints the fetches in flight every second instead.
+        /// An optional second parameter sets the polling interval in milliseconds.
         /// </summary>
         /// <param name="args"></param>
         static void Main(string[] args)
         {
+            if (args.Length >= 1 && string.Equals(args[0], "/fetches", StringComparison.OrdinalIgnoreCase))
+            {
+                int interval = args.Length > 1 ? int.Parse(args[1], CultureInfo.InvariantCulture) : 1000;
+                PrintActiveFetches(interval);
+                return;
+            }
+
             if (args.Length != 2 || string.IsNullOrEmpty(args[0]) || string.IsNullOrEmpty(args[1]))
             {
                 Console.Out.WriteLine("sampleclient.exe \"<source_file_with_data>\" \"<local_file>\"");
@@ -67,5 +79,40 @@ namespace SampleClient
                 LazyCopyFileHelper.CreateLazyCopyFile(targetFile.FullName, new LazyCopyFileData { RemotePath = sourceFile.FullName, FileSize = sourceFile.Length });
             }
         }
+
+        /// <summary>
+        /// Polls the driver for the fetches in flight and prints them, until the application is stopped.
+        /// </summary>
+        /// <param name="interval">Polling interval, in milliseconds.</param>
+        static void PrintActiveFetches(int interval)
+        {
+            // Client connects to the port, when it's created.
+            using (var client = new LazyCopyDriverClient(LazyCopyDriverClient.MonitorPortName))
+            {
+                for (;;)
+                {
+                    ActiveFetchSnapshot snapshot = client.GetActiveFetches();
+
+                    Console.Out.WriteLine("{0:HH:mm:ss} - {1} fetch(es) in flight", snapshot.CollectionTime.ToLocalTime(), snapshot.Records.Count + snapshot.RemainingCount);
+                    foreach (ActiveFetchRecord record in snapshot.Records)
+                    {
+                        Console.Out.WriteLine(
+                            "  {0,5:F1}% {1,12:N0}/{2,-12:N0} {3,10:N0} KB/s {4,8:F1}s pid={5} waiters={6}{7} {8} <- {9}",
+                            record.Progress,
+                            record.BytesCopied,
+                            record.FileSize,
+                            record.BytesPerSecond / 1024,
+                            record.Elapsed.TotalSeconds,
+                            record.ProcessId,
+                            record.WaiterCount,
+                            record.UserModeFetch ? " (user-mode)" : string.Empty,
+                            record.LocalPath,
+                            record.RemotePath);
+                    }
+
+                    Thread.Sleep(interval);
+                }
+            }
+        }
     }
 }
@@ -28,9 +28,8 @@ namespace LazyCopy.Utilities
 {
     using System;
     using System.Collections;
-    using System.Collections.Generic;
+    using System.Collections.Concurrent;
     using System.Globalization;
-    using System.Linq;
     using System.Runtime.InteropServices;
     using System.Text;
 
@@ -41,6 +40,20 @@ namespace LazyCopy.Utilities
     /// </summary>
     public static class MarshalingHelper
     {
+        #region Fields
+
+        /// <summary>
+        /// Marshalers created for the types of the objects marshaled.
+        /// </summary>
+        private static readonly ConcurrentDictionary<Type, ObjectMarshaler> Marshalers = new ConcurrentDictionary<Type, ObjectMarshaler>();
+
+        /// <summary>
+        /// Cached <see cref="CreateMarshaler"/> delegate, so the lookups don't allocate it.
+        /// </summary>
+        private static readonly Func<Type, ObjectMarshaler> MarshalerFactory = MarshalingHelper.CreateMarshaler;
+
+        #endregion // Fields
+
         #region Public methods
 
         /// <summary>
@@ -60,7 +73,7 @@ namespace LazyCopy.Utilities
                 throw new ArgumentException(string.Format(CultureInfo.InvariantCulture, "Type {0} is not a structure.", type));
             }
 
-            if (data == null || !data.Any())
+            if (data == null || data.Length == 0)
             {
                 return default(T);
             }
@@ -100,17 +113,19 @@ namespace LazyCopy.Utilities
                 throw new ArgumentNullException(nameof(destination));
             }
 
-            if (values == null || !values.Any())
+            if (values == null || values.Length == 0)
             {
                 throw new ArgumentNullException(nameof(values));
             }
 
-            // Calculate the object sizes and save it for future use.
+            // Calculate the total size of the values given.
             // This will also validate the 'values' array elements.
-            List<int> valueSizes = values.Select(MarshalingHelper.GetObjectSize).ToList();
+            int totalSize = 0;
+            foreach (object value in values)
+            {
+                totalSize += MarshalingHelper.GetObjectSize(value);
+            }
 
-            // Calculate the total size of the values given.
-            int totalSize = valueSizes.Sum();
             if (totalSize <= 0)
             {
                 throw new ArgumentException("The total size of the values given is zero.");
@@ -126,7 +141,6 @@ namespace LazyCopy.Utilities
             NativeMethods.ZeroMemory(destination, (uint)destinationSize);
 
             // Marshal each value (skipping 'null') to the destination pointer.
-            int currentValueIndex = 0;
             IntPtr currentPointer = destination;
 
             foreach (object value in values)
@@ -134,11 +148,48 @@ namespace LazyCopy.Utilities
                 if (value != null)
                 {
                     MarshalingHelper.MarshalObjectToPointer(value, currentPointer);
-                    currentPointer += valueSizes[currentValueIndex];
+                    currentPointer += MarshalingHelper.GetObjectSize(value);
                 }
+            }
+        }
+
+        /// <summary>
+        /// Zeroes the <paramref name="destinationSize"/> bytes at the <paramref name="destination"/> and marshals the <paramref name="value"/> there.
+        /// </summary>
+        /// <param name="value">Object to be marshaled. May be an array of value type objects.</param>
+        /// <param name="destination">The pointer to marshal the <paramref name="value"/> object to.</param>
+        /// <param name="destinationSize">Size of the buffer the <paramref name="destination"/> points to.</param>
+        /// <exception cref="ArgumentNullException">
+        /// <paramref name="value"/> is <see langword="null"/>.
+        ///     <para>-or-</para>
+        /// <paramref name="destination"/> is <see cref="IntPtr.Zero"/>.
+        /// </exception>
+        /// <exception cref="ArgumentOutOfRangeException"><paramref name="destinationSize"/> is not large enough to store the <paramref name="value"/>.</exception>
+        /// <remarks>
+        /// Unlike the <see cref="MarshalObjectsToPointer"/>, this method doesn't allocate the arguments array, so it's preferred for the single values.
+        /// </remarks>
+        public static void MarshalObjectToPointer(object value, IntPtr destination, int destinationSize)
+        {
+            if (value == null)
+            {
+                throw new ArgumentNullException(nameof(value));
+            }
+
+            if (destination == IntPtr.Zero)
+            {
+                throw new ArgumentNullException(nameof(destination));
+            }
 
-                currentValueIndex++;
+            int valueSize = MarshalingHelper.GetObjectSize(value);
+            if (destinationSize < valueSize)
+            {
+                throw new ArgumentOutOfRangeException(
+                    nameof(destinationSize),
+                    string.Format(CultureInfo.InvariantCulture, "Buffer is too small ({0} bytes) to hold the value given, it should be at least {1} bytes.", destinationSize, valueSize));
             }
+
+            NativeMethods.ZeroMemory(destination, (uint)destinationSize);
+            MarshalingHelper.MarshalObjectToPointer(value, destination);
         }
 
         /// <summary>
@@ -154,7 +205,9 @@ namespace LazyCopy.Utilities
         /// </exception>
         /// <exception cref="InvalidOperationException"><paramref name="value"/> cannot be marshaled.</exception>
         /// <exception cref="NotSupportedException"><paramref name="value"/> (or one of its elements, if it's a collection) is not supported.</exception>
-        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Performance", "CA1800:DoNotCastUnnecessarily", Justification = "Fixing this warning will make code less readable.")]
+        /// <remarks>
+        /// Value types, strings and arrays of primitives are marshaled by the <see cref="ObjectMarshaler"/> created once for their type.
+        /// </remarks>
         public static void MarshalObjectToPointer(object value, IntPtr destination)
         {
             if (value == null)
@@ -167,87 +220,31 @@ namespace LazyCopy.Utilities
                 throw new ArgumentNullException(nameof(destination));
             }
 
-            Type valueType = value.GetType();
-
-            // If a structure or a primitive was passed, marshal it and exit.
-            if (valueType.IsValueType)
+            ObjectMarshaler marshaler = MarshalingHelper.GetMarshaler(value.GetType());
+            if (marshaler != null)
             {
-                if (valueType.IsPrimitive)
-                {
-                    MarshalingHelper.MarshalPrimitiveToPointer(value, destination);
-                }
-                else
-                {
-                    Marshal.StructureToPtr(value, destination, true);
-                }
-
+                marshaler.Write(value, destination);
                 return;
             }
 
             // If the value passed is not a structure and a primitive type,
             // check, whether it's an enumerable collection we can marshal.
-            if (!(value is IEnumerable))
+            IEnumerable enumerable = value as IEnumerable;
+            if (enumerable == null)
             {
                 throw new InvalidOperationException(string.Format(CultureInfo.InvariantCulture, "Type {0} cannot be marshaled.", value.GetType()));
             }
 
-            //
-            // We've found out that the value passed is an enumerable collection.
-            //
-
-            if (value is Array && ((Array)value).Length == 0)
-            {
-                // We don't want to do anything with empty arrays, so just exit.
-                return;
-            }
-
-            // First, we want to use the pre-defined marshaling methods for arrays of primitives.
-            if (value is byte[])
-            {
-                Marshal.Copy((byte[])value, 0, destination, ((byte[])value).Length);
-            }
-            else if (value is char[])
-            {
-                Marshal.Copy((char[])value, 0, destination, ((char[])value).Length);
-            }
-            else if (value is short[])
-            {
-                Marshal.Copy((short[])value, 0, destination, ((short[])value).Length);
-            }
-            else if (value is int[])
-            {
-                Marshal.Copy((int[])value, 0, destination, ((int[])value).Length);
-            }
-            else if (value is long[])
-            {
-                Marshal.Copy((long[])value, 0, destination, ((long[])value).Length);
-            }
-            else if (value is float[])
-            {
-                Marshal.Copy((float[])value, 0, destination, ((float[])value).Length);
-            }
-            else if (value is double[])
-            {
-                Marshal.Copy((double[])value, 0, destination, ((double[])value).Length);
-            }
-            else if (value is string)
-            {
-                byte[] stringAsByteArray = Encoding.Unicode.GetBytes((string)value + '\0');
-                Marshal.Copy(stringAsByteArray, 0, destination, stringAsByteArray.Length);
-            }
-            else
+            // It wasn't collection of primitives that we received, iterate over it and try to marshal each element.
+            IntPtr currentPointer = destination;
+            foreach (object element in enumerable)
             {
-                // It wasn't collection of primitives that we received, iterate over it and try to marshal each element.
-                IntPtr currentPointer = destination;
-                foreach (object element in (IEnumerable)value)
-                {
-                    // Recursively call this method to marshal the element in the collection.
-                    MarshalingHelper.MarshalObjectToPointer(element, currentPointer);
+                // Recursively call this method to marshal the element in the collection.
+                MarshalingHelper.MarshalObjectToPointer(element, currentPointer);
 
-                    // And don't forget to move the current pointer to a new location,
-                    // so the next element won't overwrite the marshaled data.
-                    currentPointer += MarshalingHelper.GetObjectSize(element);
-                }
+                // And don't forget to move the current pointer to a new location,
+                // so the next element won't overwrite the marshaled data.
+                currentPointer += MarshalingHelper.GetObjectSize(element);
             }
         }
 
@@ -258,7 +255,7 @@ namespace LazyCopy.Utilities
         /// <returns>The <paramref name="value"/> size, if it's not <see langword="null"/>; otherwise, <c>0</c>.</returns>
         /// <exception cref="ArgumentException"><paramref name="value"/> type is not supported.</exception>
         /// <remarks>
-        /// This method is called recursively, if the <paramref name="value"/> is a collection.
+        /// This method is called recursively, if the <paramref name="value"/> is a collection other than an array of primitives.
         /// </remarks>
         public static int GetObjectSize(object value)
         {
@@ -267,26 +264,26 @@ namespace LazyCopy.Utilities
                 return 0;
             }
 
-            Type type = value.GetType();
-            if (type.IsValueType)
+            ObjectMarshaler marshaler = MarshalingHelper.GetMarshaler(value.GetType());
+            if (marshaler != null)
             {
-                return Marshal.SizeOf(value);
-            }
-
-            string strValue = value as string;
-            if (strValue != null)
-            {
-                return Encoding.Unicode.GetByteCount(strValue + '\0');
+                return marshaler.GetSize(value);
             }
 
             // If the value given is an enumerable collection, call this method recursively.
             IEnumerable enumerable = value as IEnumerable;
             if (enumerable != null)
             {
-                return enumerable.Cast<object>().Sum(element => MarshalingHelper.GetObjectSize(element));
+                int size = 0;
+                foreach (object element in enumerable)
+                {
+                    size += MarshalingHelper.GetObjectSize(element);
+                }
+
+                return size;
             }
 
-            throw new ArgumentException(string.Format(CultureInfo.InvariantCulture, "Type {0} is not a collection or a value type.", type));
+            throw new ArgumentException(string.Format(CultureInfo.InvariantCulture, "Type {0} is not a collection or a value type.", value.GetType()));
         }
 
         #endregion // Public methods
@@ -294,69 +291,207 @@ namespace LazyCopy.Utilities
         #region Private methods
 
         /// <summary>
-        /// Marshals the <paramref name="primitiveValue"/> primitive to the <paramref name="pointer"/>.
+        /// Gets the marshaler for the <paramref name="type"/> given, creating it, if it's the first object of this type.
         /// </summary>
-        /// <param name="primitiveValue">Primitive value to be marshaled.</param>
-        /// <param name="pointer">Pointer to marshal the <paramref name="primitiveValue"/> to.</param>
-        /// <exception cref="ArgumentNullException">
-        /// <paramref name="primitiveValue"/> is <see langword="null"/>.
-        ///     <para>-or-</para>
-        /// <paramref name="pointer"/> is <see cref="IntPtr.Zero"/>.
-        /// </exception>
-        /// <exception cref="ArgumentException"><paramref name="primitiveValue"/> is not a primitive value.</exception>
-        /// <exception cref="NotSupportedException"><paramref name="primitiveValue"/>'s type is not supported.</exception>
-        private static void MarshalPrimitiveToPointer(object primitiveValue, IntPtr pointer)
+        /// <param name="type">Type of the object to be marshaled.</param>
+        /// <returns>Marshaler for the <paramref name="type"/>, or <see langword="null"/>, if the objects of this type are marshaled element by element.</returns>
+        private static ObjectMarshaler GetMarshaler(Type type)
+        {
+            return MarshalingHelper.Marshalers.GetOrAdd(type, MarshalingHelper.MarshalerFactory);
+        }
+
+        /// <summary>
+        /// Creates the marshaler for the <paramref name="type"/> given.
+        /// </summary>
+        /// <param name="type">Type of the objects to be marshaled.</param>
+        /// <returns>New marshaler, or <see langword="null"/>, if the objects of the <paramref name="type"/> are marshaled element by element.</returns>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Maintainability", "CA1502:AvoidExcessiveComplexity", Justification = "Every supported type is listed here, so the marshalers are easier to compare.")]
+        private static ObjectMarshaler CreateMarshaler(Type type)
         {
-            if (primitiveValue == null)
+            // Primitives and their arrays are written directly, without any boxing or temporary arrays.
+            if (type == typeof(byte))
+            {
+                return new ObjectMarshaler(sizeof(byte), (value, pointer) => Marshal.WriteByte(pointer, (byte)value));
+            }
+
+            if (type == typeof(char))
+            {
+                return new ObjectMarshaler(UnicodeEncoding.CharSize, (value, pointer) => Marshal.WriteInt16(pointer, (char)value));
+            }
+
+            if (type == typeof(short))
+            {
+                return new ObjectMarshaler(sizeof(short), (value, pointer) => Marshal.WriteInt16(pointer, (short)value));
+            }
+
+            if (type == typeof(int))
+            {
+                return new ObjectMarshaler(sizeof(int), (value, pointer) => Marshal.WriteInt32(pointer, (int)value));
+            }
+
+            if (type == typeof(long))
+            {
+                return new ObjectMarshaler(sizeof(long), (value, pointer) => Marshal.WriteInt64(pointer, (long)value));
+            }
+
+            if (type == typeof(float))
+            {
+                return new ObjectMarshaler(sizeof(float), (value, pointer) => Marshal.WriteInt32(pointer, new SingleBits { Single = (float)value }.Int32));
+            }
+
+            if (type == typeof(double))
             {
-                throw new ArgumentNullException(nameof(primitiveValue));
+                return new ObjectMarshaler(sizeof(double), (value, pointer) => Marshal.WriteInt64(pointer, BitConverter.DoubleToInt64Bits((double)value)));
             }
 
-            if (pointer == IntPtr.Zero)
+            if (type.IsPrimitive)
             {
-                throw new ArgumentNullException(nameof(pointer));
+                return new ObjectMarshaler(
+                    Marshal.SizeOf(type),
+                    (value, pointer) => { throw new NotSupportedException(string.Format(CultureInfo.InvariantCulture, "Value type {0} is not supported.", value.GetType())); });
             }
 
-            Type valueType = primitiveValue.GetType();
-            if (!valueType.IsPrimitive)
+            // Other value types are marshaled according to their layout.
+            if (type.IsValueType)
             {
-                throw new ArgumentException(string.Format(CultureInfo.InvariantCulture, "Value type is not a primitive: {0}", valueType));
+                return new ObjectMarshaler(Marshal.SizeOf(type), (value, pointer) => Marshal.StructureToPtr(value, pointer, true));
             }
 
-            if (primitiveValue is byte)
+            // UTF-16 string with the terminating null character. Every character, including the invalid ones, takes two bytes.
+            if (type == typeof(string))
             {
-                Marshal.WriteByte(pointer, (byte)primitiveValue);
+                return new ObjectMarshaler(
+                    value => (((string)value).Length + 1) * UnicodeEncoding.CharSize,
+                    (value, pointer) =>
+                    {
+                        string stringValue = (string)value;
+
+                        for (int i = 0; i < stringValue.Length; i++)
+                        {
+                            Marshal.WriteInt16(pointer, i * UnicodeEncoding.CharSize, stringValue[i]);
+                        }
+
+                        Marshal.WriteInt16(pointer, stringValue.Length * UnicodeEncoding.CharSize, 0);
+                    });
             }
-            else if (primitiveValue is char)
+
+            // Use the pre-defined marshaling methods for arrays of primitives.
+            if (type == typeof(byte[]))
             {
-                Marshal.WriteInt16(pointer, (char)primitiveValue);
+                return new ObjectMarshaler(value => ((byte[])value).Length * sizeof(byte), (value, pointer) => Marshal.Copy((byte[])value, 0, pointer, ((byte[])value).Length));
             }
-            else if (primitiveValue is short)
+
+            if (type == typeof(char[]))
             {
-                Marshal.WriteInt16(pointer, (short)primitiveValue);
+                return new ObjectMarshaler(value => ((char[])value).Length * UnicodeEncoding.CharSize, (value, pointer) => Marshal.Copy((char[])value, 0, pointer, ((char[])value).Length));
             }
-            else if (primitiveValue is int)
+
+            if (type == typeof(short[]))
             {
-                Marshal.WriteInt32(pointer, (int)primitiveValue);
+                return new ObjectMarshaler(value => ((short[])value).Length * sizeof(short), (value, pointer) => Marshal.Copy((short[])value, 0, pointer, ((short[])value).Length));
             }
-            else if (primitiveValue is long)
+
+            if (type == typeof(int[]))
             {
-                Marshal.WriteInt64(pointer, (long)primitiveValue);
+                return new ObjectMarshaler(value => ((int[])value).Length * sizeof(int), (value, pointer) => Marshal.Copy((int[])value, 0, pointer, ((int[])value).Length));
             }
-            else if (primitiveValue is float)
+
+            if (type == typeof(long[]))
             {
-                Marshal.Copy(new[] { (float)primitiveValue }, 0, pointer, 1);
+                return new ObjectMarshaler(value => ((long[])value).Length * sizeof(long), (value, pointer) => Marshal.Copy((long[])value, 0, pointer, ((long[])value).Length));
             }
-            else if (primitiveValue is double)
+
+            if (type == typeof(float[]))
             {
-                Marshal.Copy(new[] { (double)primitiveValue }, 0, pointer, 1);
+                return new ObjectMarshaler(value => ((float[])value).Length * sizeof(float), (value, pointer) => Marshal.Copy((float[])value, 0, pointer, ((float[])value).Length));
             }
-            else
+
+            if (type == typeof(double[]))
             {
-                throw new NotSupportedException(string.Format(CultureInfo.InvariantCulture, "Value type {0} is not supported.", valueType));
+                return new ObjectMarshaler(value => ((double[])value).Length * sizeof(double), (value, pointer) => Marshal.Copy((double[])value, 0, pointer, ((double[])value).Length));
             }
+
+            // Other collections are marshaled element by element.
+            return null;
         }
 
         #endregion // Private methods
+
+        #region Nested types
+
+        /// <summary>
+        /// Gets the size of the objects of a particular type and marshals them.
+        /// </summary>
+        private sealed class ObjectMarshaler
+        {
+            /// <summary>
+            /// Size of every object, in bytes, or <c>-1</c>, if it's variable.
+            /// </summary>
+            private readonly int size;
+
+            /// <summary>
+            /// Method that gets the object size, in bytes, if it's variable.
+            /// </summary>
+            private readonly Func<object, int> getSize;
+
+            /// <summary>
+            /// Initializes a new instance of the <see cref="ObjectMarshaler"/> class for the type with the fixed size.
+            /// </summary>
+            /// <param name="size">Size of every object, in bytes.</param>
+            /// <param name="write">Method that marshals the object to the pointer.</param>
+            public ObjectMarshaler(int size, Action<object, IntPtr> write)
+            {
+                this.size  = size;
+                this.Write = write;
+            }
+
+            /// <summary>
+            /// Initializes a new instance of the <see cref="ObjectMarshaler"/> class for the type with the variable size.
+            /// </summary>
+            /// <param name="getSize">Method that gets the object size, in bytes.</param>
+            /// <param name="write">Method that marshals the object to the pointer.</param>
+            public ObjectMarshaler(Func<object, int> getSize, Action<object, IntPtr> write)
+            {
+                this.size    = -1;
+                this.getSize = getSize;
+                this.Write   = write;
+            }
+
+            /// <summary>
+            /// Gets the method that marshals the object to the pointer.
+            /// </summary>
+            public Action<object, IntPtr> Write { get; }
+
+            /// <summary>
+            /// Gets the size of the <paramref name="value"/>, in bytes.
+            /// </summary>
+            /// <param name="value">Object to get the size of.</param>
+            /// <returns>Object size.</returns>
+            public int GetSize(object value)
+            {
+                return this.size >= 0 ? this.size : this.getSize(value);
+            }
+        }
+
+        /// <summary>
+        /// Reinterprets the <see cref="float"/> value as an <see cref="int"/> one, so it's written without a temporary array.
+        /// </summary>
+        [StructLayout(LayoutKind.Explicit)]
+        private struct SingleBits
+        {
+            /// <summary>
+            /// Floating point value.
+            /// </summary>
+            [FieldOffset(0)]
+            public float Single;
+
+            /// <summary>
+            /// The same bits as an integer.
+            /// </summary>
+            [FieldOffset(0)]
+            public int Int32;
+        }
+
+        #endregion // Nested types
     }
 }